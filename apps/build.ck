@@ -52,6 +52,8 @@ function build() {
         "apps/ck:chalk",
         "apps/debug:debug",
         "apps/efiboot:efiboot",
+        "apps/iostat:iostat",
+        "apps/iotrace:iotrace",
         "apps/lib/lzma/util:lzma",
         "apps/lib/lzma/util:build_lzma",
         "apps/mingen:bootstrap_stamp",
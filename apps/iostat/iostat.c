@@ -0,0 +1,672 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    iostat.c
+
+Abstract:
+
+    This module implements the iostat application, which periodically prints
+    the throughput, service time and queue depth of each device.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/minocaos.h>
+#include <minoca/lib/mlibc.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define IOSTAT_VERSION_MAJOR 1
+#define IOSTAT_VERSION_MINOR 0
+
+#define IOSTAT_USAGE                                                          \
+    "usage: iostat [-x] [interval [count]]\n\n"                               \
+    "The iostat utility prints the I/O throughput, average service time, \n"  \
+    "and queue depth of each device. The first report covers the time \n"     \
+    "since boot. If an interval is given, a report of the activity during \n" \
+    "each interval follows, count times or until interrupted. Options are:\n" \
+    "  -x, --histogram -- Also print the latency histogram of each device.\n" \
+    "  --help -- Display this help text.\n"                                   \
+    "  --version -- Display the application version and exit.\n\n"
+
+#define IOSTAT_OPTIONS_STRING "xhV"
+
+//
+// Define the number of devices to guess when sizing the statistics buffer,
+// and how many times to try growing it.
+//
+
+#define IOSTAT_DEVICE_GUESS 8
+#define IOSTAT_TRY_COUNT 4
+
+//
+// Define iostat options.
+//
+
+//
+// Set this option to print latency histograms.
+//
+
+#define IOSTAT_OPTION_HISTOGRAM 0x00000001
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+INT
+IostatGetStatistics (
+    PIO_DEVICE_STATISTICS *Statistics,
+    PUINTN Count
+    );
+
+VOID
+IostatPrintReport (
+    PIO_DEVICE_STATISTICS Statistics,
+    UINTN Count,
+    PIO_DEVICE_STATISTICS Previous,
+    UINTN PreviousCount,
+    ULONGLONG ElapsedMicroseconds,
+    ULONG Options
+    );
+
+VOID
+IostatPrintHistogram (
+    PCSTR Direction,
+    PIO_DEVICE_OPERATION_STATISTICS Operation,
+    PIO_DEVICE_OPERATION_STATISTICS PreviousOperation
+    );
+
+ULONGLONG
+IostatGetMicroseconds (
+    VOID
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+struct option IostatLongOptions[] = {
+    {"histogram", no_argument, 0, 'x'},
+    {"help", no_argument, 0, 'h'},
+    {"version", no_argument, 0, 'V'},
+    {NULL, 0, 0, 0}
+};
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INT
+main (
+    INT ArgumentCount,
+    CHAR **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the iostat user mode program.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of elements in the arguments array.
+
+    Arguments - Supplies an array of strings. The array count is bounded by the
+        previous parameter, and the strings are null-terminated.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    PSTR AfterScan;
+    ULONG ArgumentIndex;
+    UINTN Count;
+    ULONGLONG Elapsed;
+    LONG Interval;
+    ULONGLONG Now;
+    INT Option;
+    ULONG Options;
+    PIO_DEVICE_STATISTICS Previous;
+    UINTN PreviousCount;
+    ULONGLONG PreviousTime;
+    LONG ReportCount;
+    INT ReturnValue;
+    PIO_DEVICE_STATISTICS Statistics;
+
+    Interval = 0;
+    Options = 0;
+    Previous = NULL;
+    PreviousCount = 0;
+    ReportCount = -1;
+    ReturnValue = 0;
+    Statistics = NULL;
+
+    //
+    // Process the control arguments.
+    //
+
+    while (TRUE) {
+        Option = getopt_long(ArgumentCount,
+                             Arguments,
+                             IOSTAT_OPTIONS_STRING,
+                             IostatLongOptions,
+                             NULL);
+
+        if (Option == -1) {
+            break;
+        }
+
+        if ((Option == '?') || (Option == ':')) {
+            ReturnValue = 1;
+            goto mainEnd;
+        }
+
+        switch (Option) {
+        case 'x':
+            Options |= IOSTAT_OPTION_HISTOGRAM;
+            break;
+
+        case 'V':
+            printf("iostat version %d.%02d\n",
+                   IOSTAT_VERSION_MAJOR,
+                   IOSTAT_VERSION_MINOR);
+
+            ReturnValue = 1;
+            goto mainEnd;
+
+        case 'h':
+            printf(IOSTAT_USAGE);
+            return 1;
+
+        default:
+
+            assert(FALSE);
+
+            ReturnValue = 1;
+            goto mainEnd;
+        }
+    }
+
+    ArgumentIndex = optind;
+    if (ArgumentIndex > ArgumentCount) {
+        ArgumentIndex = ArgumentCount;
+    }
+
+    if (ArgumentIndex < ArgumentCount) {
+        Interval = strtol(Arguments[ArgumentIndex], &AfterScan, 10);
+        if ((AfterScan == Arguments[ArgumentIndex]) || (*AfterScan != '\0') ||
+            (Interval <= 0)) {
+
+            fprintf(stderr,
+                    "iostat: Invalid interval %s\n",
+                    Arguments[ArgumentIndex]);
+
+            ReturnValue = EINVAL;
+            goto mainEnd;
+        }
+
+        ArgumentIndex += 1;
+    }
+
+    if (ArgumentIndex < ArgumentCount) {
+        ReportCount = strtol(Arguments[ArgumentIndex], &AfterScan, 10);
+        if ((AfterScan == Arguments[ArgumentIndex]) || (*AfterScan != '\0') ||
+            (ReportCount <= 0)) {
+
+            fprintf(stderr,
+                    "iostat: Invalid count %s\n",
+                    Arguments[ArgumentIndex]);
+
+            ReturnValue = EINVAL;
+            goto mainEnd;
+        }
+
+        ArgumentIndex += 1;
+    }
+
+    if (ArgumentIndex < ArgumentCount) {
+        fprintf(stderr,
+                "iostat: Unexpected argument %s\n",
+                Arguments[ArgumentIndex]);
+
+        ReturnValue = EINVAL;
+        goto mainEnd;
+    }
+
+    //
+    // The first report covers everything since boot, which is when the
+    // monotonic clock started.
+    //
+
+    if (Interval == 0) {
+        ReportCount = 1;
+    }
+
+    PreviousTime = 0;
+    while (ReportCount != 0) {
+        ReturnValue = IostatGetStatistics(&Statistics, &Count);
+        if (ReturnValue != 0) {
+            goto mainEnd;
+        }
+
+        Now = IostatGetMicroseconds();
+        Elapsed = Now - PreviousTime;
+        IostatPrintReport(Statistics,
+                          Count,
+                          Previous,
+                          PreviousCount,
+                          Elapsed,
+                          Options);
+
+        if (Previous != NULL) {
+            free(Previous);
+        }
+
+        Previous = Statistics;
+        PreviousCount = Count;
+        PreviousTime = Now;
+        Statistics = NULL;
+        if (ReportCount > 0) {
+            ReportCount -= 1;
+        }
+
+        if (ReportCount != 0) {
+            sleep(Interval);
+        }
+    }
+
+mainEnd:
+    if (Previous != NULL) {
+        free(Previous);
+    }
+
+    if (Statistics != NULL) {
+        free(Statistics);
+    }
+
+    return ReturnValue;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+INT
+IostatGetStatistics (
+    PIO_DEVICE_STATISTICS *Statistics,
+    PUINTN Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a snapshot of the I/O statistics of every device.
+
+Arguments:
+
+    Statistics - Supplies a pointer where a pointer to the array of device
+        statistics will be returned on success. The caller is responsible for
+        freeing this array.
+
+    Count - Supplies a pointer where the number of elements in the array will
+        be returned.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    INT ReturnValue;
+    UINTN Size;
+    PIO_DEVICE_STATISTICS Snapshot;
+    KSTATUS Status;
+    UINTN Try;
+
+    *Statistics = NULL;
+    *Count = 0;
+    Snapshot = NULL;
+    Size = IOSTAT_DEVICE_GUESS * sizeof(IO_DEVICE_STATISTICS);
+    Status = STATUS_BUFFER_TOO_SMALL;
+    for (Try = 0; Try < IOSTAT_TRY_COUNT; Try += 1) {
+        Snapshot = malloc(Size);
+        if (Snapshot == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        Status = OsGetSetSystemInformation(SystemInformationIo,
+                                           IoInformationDeviceStatistics,
+                                           Snapshot,
+                                           &Size,
+                                           FALSE);
+
+        if (Status != STATUS_BUFFER_TOO_SMALL) {
+            break;
+        }
+
+        //
+        // Leave room for devices that show up before the next attempt.
+        //
+
+        free(Snapshot);
+        Snapshot = NULL;
+        Size *= 2;
+    }
+
+    if (!KSUCCESS(Status)) {
+        ReturnValue = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "Error: failed to get device statistics: status %d: %s.\n",
+                Status,
+                strerror(ReturnValue));
+
+        if (Snapshot != NULL) {
+            free(Snapshot);
+        }
+
+        return ReturnValue;
+    }
+
+    *Statistics = Snapshot;
+    *Count = Size / sizeof(IO_DEVICE_STATISTICS);
+    return 0;
+}
+
+VOID
+IostatPrintReport (
+    PIO_DEVICE_STATISTICS Statistics,
+    UINTN Count,
+    PIO_DEVICE_STATISTICS Previous,
+    UINTN PreviousCount,
+    ULONGLONG ElapsedMicroseconds,
+    ULONG Options
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the activity of each device between two snapshots.
+
+Arguments:
+
+    Statistics - Supplies a pointer to the current snapshot.
+
+    Count - Supplies the number of devices in the current snapshot.
+
+    Previous - Supplies an optional pointer to the previous snapshot. Devices
+        that are not in it are reported as if all their I/O happened during
+        the interval.
+
+    PreviousCount - Supplies the number of devices in the previous snapshot.
+
+    ElapsedMicroseconds - Supplies the time between the two snapshots.
+
+    Options - Supplies a bitfield of IOSTAT_OPTION_* flags.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    IO_DEVICE_STATISTICS Baseline;
+    UINTN Index;
+    UINTN PreviousIndex;
+    PIO_DEVICE_STATISTICS PreviousDevice;
+    double QueueSize;
+    double ReadAwait;
+    double ReadKilobytes;
+    double Reads;
+    double Seconds;
+    double WriteAwait;
+    double WriteKilobytes;
+    double Writes;
+
+    if (ElapsedMicroseconds == 0) {
+        ElapsedMicroseconds = 1;
+    }
+
+    Seconds = (double)ElapsedMicroseconds / 1000000.0;
+    printf("%-16s %8s %8s %10s %10s %8s %8s %7s %5s\n",
+           "Device",
+           "r/s",
+           "w/s",
+           "rkB/s",
+           "wkB/s",
+           "r_await",
+           "w_await",
+           "aqu-sz",
+           "infl");
+
+    for (Index = 0; Index < Count; Index += 1) {
+        PreviousDevice = NULL;
+        for (PreviousIndex = 0;
+             PreviousIndex < PreviousCount;
+             PreviousIndex += 1) {
+
+            if (Previous[PreviousIndex].DeviceId ==
+                Statistics[Index].DeviceId) {
+
+                PreviousDevice = &(Previous[PreviousIndex]);
+                break;
+            }
+        }
+
+        memset(&Baseline, 0, sizeof(IO_DEVICE_STATISTICS));
+        if (PreviousDevice != NULL) {
+            Baseline.Read = PreviousDevice->Read;
+            Baseline.Write = PreviousDevice->Write;
+        }
+
+        Reads = (double)(Statistics[Index].Read.Count - Baseline.Read.Count);
+        Writes = (double)(Statistics[Index].Write.Count - Baseline.Write.Count);
+        ReadKilobytes = (double)(Statistics[Index].Read.Bytes -
+                                 Baseline.Read.Bytes) / 1024.0;
+
+        WriteKilobytes = (double)(Statistics[Index].Write.Bytes -
+                                  Baseline.Write.Bytes) / 1024.0;
+
+        ReadAwait = 0.0;
+        if (Reads != 0.0) {
+            ReadAwait = (double)(Statistics[Index].Read.Microseconds -
+                                 Baseline.Read.Microseconds) /
+                        Reads / 1000.0;
+        }
+
+        WriteAwait = 0.0;
+        if (Writes != 0.0) {
+            WriteAwait = (double)(Statistics[Index].Write.Microseconds -
+                                  Baseline.Write.Microseconds) /
+                        Writes / 1000.0;
+        }
+
+        //
+        // The average queue depth is the total time requests spent
+        // outstanding divided by the length of the interval.
+        //
+
+        QueueSize = (double)(Statistics[Index].Read.Microseconds -
+                             Baseline.Read.Microseconds +
+                             Statistics[Index].Write.Microseconds -
+                             Baseline.Write.Microseconds) /
+                    (double)ElapsedMicroseconds;
+
+        printf("%-16.16s %8.2f %8.2f %10.2f %10.2f %8.2f %8.2f %7.2f %5u\n",
+               Statistics[Index].DeviceName,
+               Reads / Seconds,
+               Writes / Seconds,
+               ReadKilobytes / Seconds,
+               WriteKilobytes / Seconds,
+               ReadAwait,
+               WriteAwait,
+               QueueSize,
+               Statistics[Index].InFlight);
+
+        if ((Options & IOSTAT_OPTION_HISTOGRAM) != 0) {
+            IostatPrintHistogram("read",
+                                 &(Statistics[Index].Read),
+                                 &(Baseline.Read));
+
+            IostatPrintHistogram("write",
+                                 &(Statistics[Index].Write),
+                                 &(Baseline.Write));
+        }
+    }
+
+    printf("\n");
+    return;
+}
+
+VOID
+IostatPrintHistogram (
+    PCSTR Direction,
+    PIO_DEVICE_OPERATION_STATISTICS Operation,
+    PIO_DEVICE_OPERATION_STATISTICS PreviousOperation
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the latency histogram of one direction of a device's
+    I/O, skipping empty buckets.
+
+Arguments:
+
+    Direction - Supplies the name of the direction being printed.
+
+    Operation - Supplies a pointer to the current statistics.
+
+    PreviousOperation - Supplies a pointer to the statistics at the start of
+        the interval.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    ULONGLONG Low;
+    ULONGLONG Requests;
+
+    if (Operation->Count == PreviousOperation->Count) {
+        return;
+    }
+
+    printf("    %s latency (us):\n", Direction);
+    for (Bucket = 0; Bucket < IO_LATENCY_HISTOGRAM_SIZE; Bucket += 1) {
+        Requests = Operation->Histogram[Bucket] -
+                   PreviousOperation->Histogram[Bucket];
+
+        if (Requests == 0) {
+            continue;
+        }
+
+        //
+        // The first bucket also counts anything faster than a microsecond.
+        //
+
+        Low = 1ULL << Bucket;
+        if (Bucket == 0) {
+            Low = 0;
+        }
+
+        if (Bucket == IO_LATENCY_HISTOGRAM_SIZE - 1) {
+            printf("        %10llu+          %llu\n", Low, Requests);
+
+        } else {
+            printf("        %10llu - %-10llu %llu\n",
+                   Low,
+                   (2ULL << Bucket) - 1,
+                   Requests);
+        }
+    }
+
+    return;
+}
+
+ULONGLONG
+IostatGetMicroseconds (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the current value of the monotonic clock.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of microseconds since boot.
+
+--*/
+
+{
+
+    struct timespec Time;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &Time) != 0) {
+        return 0;
+    }
+
+    return ((ULONGLONG)Time.tv_sec * 1000000ULL) + (Time.tv_nsec / 1000);
+}
+
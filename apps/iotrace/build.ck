@@ -0,0 +1,59 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    iotrace
+
+Abstract:
+
+    This executable implements the iotrace application, which records block
+    I/O traces and replays them to measure IOPS and latency.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    User
+
+--*/
+
+from menv import application;
+
+function build() {
+    var app;
+    var dynlibs;
+    var entries;
+    var includes;
+    var sources;
+
+    sources = [
+        "iotrace.c"
+    ];
+
+    dynlibs = [
+        "apps/osbase:libminocaos"
+    ];
+
+    includes = [
+        "$S/apps/libc/include"
+    ];
+
+    app = {
+        "label": "iotrace",
+        "inputs": sources + dynlibs,
+        "includes": includes
+    };
+
+    entries = application(app);
+    return entries;
+}
+
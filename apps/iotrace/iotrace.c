@@ -0,0 +1,2076 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    iotrace.c
+
+Abstract:
+
+    This module implements the iotrace application, which captures the block
+    I/O requests sent to devices into a trace file, and replays a captured
+    trace against a RAM disk or image file to measure IOPS and latency.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/minocaos.h>
+#include <minoca/lib/mlibc.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define IOTRACE_VERSION_MAJOR 1
+#define IOTRACE_VERSION_MINOR 0
+
+#define IOTRACE_USAGE                                                         \
+    "usage: iotrace record [-c capacity] [-i interval] [-t seconds] file\n"   \
+    "       iotrace replay [-DrT] [-d device] file target\n"                  \
+    "       iotrace show file\n\n"                                            \
+    "The iotrace utility captures and replays block I/O workloads.\n\n"       \
+    "record -- Trace every read and write sent to a device into the given \n" \
+    "    file, until interrupted or the time limit passes. Options are:\n"    \
+    "    -c, --capacity=count -- Set the number of records the kernel \n"     \
+    "        buffers between reads (default 65536).\n"                        \
+    "    -i, --interval=ms -- Set how often to drain the kernel buffer \n"    \
+    "        (default 100ms).\n"                                              \
+    "    -t, --time=seconds -- Stop tracing after the given time.\n\n"        \
+    "replay -- Issue the traced requests of one device against the target \n" \
+    "    file or device, and report IOPS and latency percentiles next to \n"  \
+    "    those of the original trace. Requests beyond the end of the \n"      \
+    "    target wrap around. Options are:\n"                                  \
+    "    -d, --device=name -- Replay the requests of the given device name \n"\
+    "        or ID (default: the device with the most requests).\n"           \
+    "    -D, --direct -- Open the target for direct I/O, bypassing the \n"    \
+    "        page cache.\n"                                                   \
+    "    -r, --read-only -- Skip traced writes.\n"                            \
+    "    -T, --timed -- Wait to issue each request until the same time \n"    \
+    "        after the start as in the trace, rather than issuing \n"         \
+    "        requests back to back.\n\n"                                      \
+    "show -- Print a summary of a trace file.\n\n"                            \
+    "  --help -- Display this help text.\n"                                   \
+    "  --version -- Display the application version and exit.\n\n"
+
+#define IOTRACE_RECORD_OPTIONS_STRING "c:i:t:hV"
+#define IOTRACE_REPLAY_OPTIONS_STRING "d:DrThV"
+
+//
+// Define the trace file magic, 'IoTr'.
+//
+
+#define IOTRACE_FILE_MAGIC 0x72546F49
+#define IOTRACE_FILE_VERSION 1
+
+#define IOTRACE_DEFAULT_CAPACITY 65536
+#define IOTRACE_DEFAULT_INTERVAL 100
+
+//
+// Define the number of records to pull from the kernel at once.
+//
+
+#define IOTRACE_READ_BATCH 4096
+
+//
+// Define the number of devices to guess when sizing the statistics buffer,
+// and how many times to try growing it.
+//
+
+#define IOTRACE_DEVICE_GUESS 8
+#define IOTRACE_TRY_COUNT 4
+
+//
+// Define the alignment of the replay buffer and of wrapped offsets, which
+// keeps direct I/O happy.
+//
+
+#define IOTRACE_BUFFER_ALIGNMENT 4096
+#define IOTRACE_SECTOR_SIZE 512
+
+//
+// Define replay options.
+//
+
+//
+// Set this option to open the target for direct I/O.
+//
+
+#define IOTRACE_OPTION_DIRECT 0x00000001
+
+//
+// Set this option to skip writes.
+//
+
+#define IOTRACE_OPTION_READ_ONLY 0x00000002
+
+//
+// Set this option to issue requests at their traced times.
+//
+
+#define IOTRACE_OPTION_TIMED 0x00000004
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines the header of a trace file. The header is followed
+    by the records, then by the table of devices.
+
+Members:
+
+    Magic - Stores IOTRACE_FILE_MAGIC.
+
+    Version - Stores IOTRACE_FILE_VERSION.
+
+    RecordSize - Stores the size of each record in bytes.
+
+    DeviceCount - Stores the number of entries in the device table.
+
+    RecordCount - Stores the number of records in the file.
+
+    LostRecords - Stores the number of records the kernel overwrote before
+        they could be saved.
+
+    TimeCounterFrequency - Stores the frequency of the time counter used for
+        the record times, in Hertz.
+
+--*/
+
+typedef struct _IOTRACE_FILE_HEADER {
+    ULONG Magic;
+    ULONG Version;
+    ULONG RecordSize;
+    ULONG DeviceCount;
+    ULONGLONG RecordCount;
+    ULONGLONG LostRecords;
+    ULONGLONG TimeCounterFrequency;
+} IOTRACE_FILE_HEADER, *PIOTRACE_FILE_HEADER;
+
+/*++
+
+Structure Description:
+
+    This structure defines an entry in the device table of a trace file.
+
+Members:
+
+    DeviceId - Stores the ID of the device.
+
+    Name - Stores the name of the device.
+
+--*/
+
+typedef struct _IOTRACE_DEVICE {
+    DEVICE_ID DeviceId;
+    CHAR Name[IO_DEVICE_STATISTICS_NAME_SIZE];
+} IOTRACE_DEVICE, *PIOTRACE_DEVICE;
+
+/*++
+
+Structure Description:
+
+    This structure defines a trace file loaded into memory.
+
+Members:
+
+    Header - Stores the file header.
+
+    Records - Stores the array of records.
+
+    Devices - Stores the device table.
+
+--*/
+
+typedef struct _IOTRACE_TRACE {
+    IOTRACE_FILE_HEADER Header;
+    PIO_TRACE_RECORD Records;
+    PIOTRACE_DEVICE Devices;
+} IOTRACE_TRACE, *PIOTRACE_TRACE;
+
+/*++
+
+Structure Description:
+
+    This structure collects the latencies of a set of requests.
+
+Members:
+
+    Latencies - Stores the array of request latencies, in nanoseconds.
+
+    Count - Stores the number of latencies in the array.
+
+    Bytes - Stores the number of bytes the requests transferred.
+
+--*/
+
+typedef struct _IOTRACE_LATENCIES {
+    PULONGLONG Latencies;
+    UINTN Count;
+    ULONGLONG Bytes;
+} IOTRACE_LATENCIES, *PIOTRACE_LATENCIES;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+INT
+IotraceRecord (
+    INT ArgumentCount,
+    CHAR **Arguments
+    );
+
+INT
+IotraceReplay (
+    INT ArgumentCount,
+    CHAR **Arguments
+    );
+
+INT
+IotraceShow (
+    INT ArgumentCount,
+    CHAR **Arguments
+    );
+
+INT
+IotraceSetCapacity (
+    ULONG Capacity,
+    PULONGLONG Frequency
+    );
+
+INT
+IotraceDrain (
+    FILE *File,
+    PIO_TRACE_INFORMATION Information,
+    PULONGLONG NextSequence,
+    PIOTRACE_FILE_HEADER Header
+    );
+
+INT
+IotraceWriteDevices (
+    FILE *File,
+    PULONG DeviceCount
+    );
+
+INT
+IotraceLoad (
+    PCSTR Path,
+    PIOTRACE_TRACE Trace
+    );
+
+VOID
+IotraceFreeTrace (
+    PIOTRACE_TRACE Trace
+    );
+
+INT
+IotraceSelectDevice (
+    PIOTRACE_TRACE Trace,
+    PCSTR Name,
+    PDEVICE_ID DeviceId
+    );
+
+PCSTR
+IotraceGetDeviceName (
+    PIOTRACE_TRACE Trace,
+    DEVICE_ID DeviceId
+    );
+
+VOID
+IotracePrintLatencyHeader (
+    VOID
+    );
+
+VOID
+IotracePrintLatencies (
+    PCSTR Label,
+    PIOTRACE_LATENCIES Latencies,
+    ULONGLONG ElapsedNanoseconds
+    );
+
+INT
+IotraceCompareRecords (
+    const VOID *Left,
+    const VOID *Right
+    );
+
+INT
+IotraceCompareLatencies (
+    const VOID *Left,
+    const VOID *Right
+    );
+
+ULONGLONG
+IotraceTicksToNanoseconds (
+    ULONGLONG Ticks,
+    ULONGLONG Frequency
+    );
+
+ULONGLONG
+IotraceGetNanoseconds (
+    VOID
+    );
+
+VOID
+IotraceSignalHandler (
+    int Signal
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+struct option IotraceRecordLongOptions[] = {
+    {"capacity", required_argument, 0, 'c'},
+    {"interval", required_argument, 0, 'i'},
+    {"time", required_argument, 0, 't'},
+    {"help", no_argument, 0, 'h'},
+    {"version", no_argument, 0, 'V'},
+    {NULL, 0, 0, 0}
+};
+
+struct option IotraceReplayLongOptions[] = {
+    {"device", required_argument, 0, 'd'},
+    {"direct", no_argument, 0, 'D'},
+    {"read-only", no_argument, 0, 'r'},
+    {"timed", no_argument, 0, 'T'},
+    {"help", no_argument, 0, 'h'},
+    {"version", no_argument, 0, 'V'},
+    {NULL, 0, 0, 0}
+};
+
+//
+// Set this when a SIGINT asks recording to stop.
+//
+
+volatile BOOL IotraceStop = FALSE;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INT
+main (
+    INT ArgumentCount,
+    CHAR **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the iotrace user mode program.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of elements in the arguments array.
+
+    Arguments - Supplies an array of strings. The array count is bounded by the
+        previous parameter, and the strings are null-terminated.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    PCSTR Command;
+
+    if (ArgumentCount < 2) {
+        fprintf(stderr, IOTRACE_USAGE);
+        return 1;
+    }
+
+    Command = Arguments[1];
+    if (strcmp(Command, "record") == 0) {
+        return IotraceRecord(ArgumentCount - 1, Arguments + 1);
+
+    } else if (strcmp(Command, "replay") == 0) {
+        return IotraceReplay(ArgumentCount - 1, Arguments + 1);
+
+    } else if (strcmp(Command, "show") == 0) {
+        return IotraceShow(ArgumentCount - 1, Arguments + 1);
+
+    } else if ((strcmp(Command, "--help") == 0) ||
+               (strcmp(Command, "-h") == 0)) {
+
+        printf(IOTRACE_USAGE);
+        return 1;
+
+    } else if ((strcmp(Command, "--version") == 0) ||
+               (strcmp(Command, "-V") == 0)) {
+
+        printf("iotrace version %d.%02d\n",
+               IOTRACE_VERSION_MAJOR,
+               IOTRACE_VERSION_MINOR);
+
+        return 1;
+    }
+
+    fprintf(stderr, "iotrace: Unknown command %s\n", Command);
+    return EINVAL;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+INT
+IotraceRecord (
+    INT ArgumentCount,
+    CHAR **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the record command, which enables I/O tracing in
+    the kernel and saves the records to a file.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of elements in the arguments array.
+
+    Arguments - Supplies an array of strings, starting with the command name.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    struct sigaction Action;
+    PSTR AfterScan;
+    UINTN BufferSize;
+    ULONG Capacity;
+    BOOL Enabled;
+    FILE *File;
+    IOTRACE_FILE_HEADER Header;
+    PIO_TRACE_INFORMATION Information;
+    LONG Interval;
+    ULONGLONG NextSequence;
+    INT Option;
+    struct sigaction OriginalSigint;
+    PCSTR Path;
+    ULONGLONG PreviousCount;
+    INT ReturnValue;
+    ULONGLONG Start;
+    LONG TimeLimit;
+
+    Capacity = IOTRACE_DEFAULT_CAPACITY;
+    Enabled = FALSE;
+    File = NULL;
+    Information = NULL;
+    Interval = IOTRACE_DEFAULT_INTERVAL;
+    ReturnValue = 0;
+    TimeLimit = 0;
+    memset(&Header, 0, sizeof(IOTRACE_FILE_HEADER));
+    while (TRUE) {
+        Option = getopt_long(ArgumentCount,
+                             Arguments,
+                             IOTRACE_RECORD_OPTIONS_STRING,
+                             IotraceRecordLongOptions,
+                             NULL);
+
+        if (Option == -1) {
+            break;
+        }
+
+        if ((Option == '?') || (Option == ':')) {
+            return 1;
+        }
+
+        switch (Option) {
+        case 'c':
+            Capacity = strtoul(optarg, &AfterScan, 10);
+            if ((AfterScan == optarg) || (*AfterScan != '\0') ||
+                (Capacity == 0)) {
+
+                fprintf(stderr, "iotrace: Invalid capacity %s\n", optarg);
+                return EINVAL;
+            }
+
+            break;
+
+        case 'i':
+            Interval = strtol(optarg, &AfterScan, 10);
+            if ((AfterScan == optarg) || (*AfterScan != '\0') ||
+                (Interval <= 0)) {
+
+                fprintf(stderr, "iotrace: Invalid interval %s\n", optarg);
+                return EINVAL;
+            }
+
+            break;
+
+        case 't':
+            TimeLimit = strtol(optarg, &AfterScan, 10);
+            if ((AfterScan == optarg) || (*AfterScan != '\0') ||
+                (TimeLimit <= 0)) {
+
+                fprintf(stderr, "iotrace: Invalid time %s\n", optarg);
+                return EINVAL;
+            }
+
+            break;
+
+        case 'V':
+            printf("iotrace version %d.%02d\n",
+                   IOTRACE_VERSION_MAJOR,
+                   IOTRACE_VERSION_MINOR);
+
+            return 1;
+
+        case 'h':
+            printf(IOTRACE_USAGE);
+            return 1;
+
+        default:
+
+            assert(FALSE);
+
+            return 1;
+        }
+    }
+
+    if (optind != ArgumentCount - 1) {
+        fprintf(stderr, "iotrace: record takes one file argument\n");
+        return EINVAL;
+    }
+
+    Path = Arguments[optind];
+    File = fopen(Path, "wb");
+    if (File == NULL) {
+        ReturnValue = errno;
+        fprintf(stderr,
+                "iotrace: Failed to open %s: %s.\n",
+                Path,
+                strerror(ReturnValue));
+
+        goto RecordEnd;
+    }
+
+    //
+    // Write a placeholder header, which is filled in once the record and
+    // device counts are known.
+    //
+
+    if (fwrite(&Header, sizeof(IOTRACE_FILE_HEADER), 1, File) != 1) {
+        ReturnValue = errno;
+        goto RecordEnd;
+    }
+
+    BufferSize = sizeof(IO_TRACE_INFORMATION) +
+                 (IOTRACE_READ_BATCH * sizeof(IO_TRACE_RECORD));
+
+    Information = malloc(BufferSize);
+    if (Information == NULL) {
+        ReturnValue = ENOMEM;
+        goto RecordEnd;
+    }
+
+    ReturnValue = IotraceSetCapacity(Capacity,
+                                     &(Header.TimeCounterFrequency));
+
+    if (ReturnValue != 0) {
+        goto RecordEnd;
+    }
+
+    Enabled = TRUE;
+    memset(&Action, 0, sizeof(struct sigaction));
+    Action.sa_handler = IotraceSignalHandler;
+    sigaction(SIGINT, &Action, &OriginalSigint);
+    fprintf(stderr, "iotrace: Tracing, press Ctrl+C to stop.\n");
+    NextSequence = 1;
+    Start = IotraceGetNanoseconds();
+    while (IotraceStop == FALSE) {
+        PreviousCount = Header.RecordCount;
+        ReturnValue = IotraceDrain(File, Information, &NextSequence, &Header);
+        if (ReturnValue != 0) {
+            break;
+        }
+
+        //
+        // Keep draining without sleeping while the kernel has a backlog.
+        //
+
+        if ((Header.RecordCount - PreviousCount) == IOTRACE_READ_BATCH) {
+            continue;
+        }
+
+        if ((TimeLimit != 0) &&
+            ((IotraceGetNanoseconds() - Start) >=
+             ((ULONGLONG)TimeLimit * 1000000000ULL))) {
+
+            break;
+        }
+
+        usleep(Interval * 1000);
+    }
+
+    sigaction(SIGINT, &OriginalSigint, NULL);
+    if (ReturnValue != 0) {
+        goto RecordEnd;
+    }
+
+    //
+    // Pick up whatever completed since the last pass.
+    //
+
+    do {
+        PreviousCount = Header.RecordCount;
+        ReturnValue = IotraceDrain(File, Information, &NextSequence, &Header);
+        if (ReturnValue != 0) {
+            goto RecordEnd;
+        }
+
+    } while ((Header.RecordCount - PreviousCount) == IOTRACE_READ_BATCH);
+
+    IotraceSetCapacity(0, NULL);
+    Enabled = FALSE;
+    ReturnValue = IotraceWriteDevices(File, &(Header.DeviceCount));
+    if (ReturnValue != 0) {
+        goto RecordEnd;
+    }
+
+    Header.Magic = IOTRACE_FILE_MAGIC;
+    Header.Version = IOTRACE_FILE_VERSION;
+    Header.RecordSize = sizeof(IO_TRACE_RECORD);
+    if ((fseek(File, 0, SEEK_SET) != 0) ||
+        (fwrite(&Header, sizeof(IOTRACE_FILE_HEADER), 1, File) != 1)) {
+
+        ReturnValue = errno;
+        goto RecordEnd;
+    }
+
+    printf("Recorded %llu requests from %lu devices to %s",
+           Header.RecordCount,
+           (unsigned long)Header.DeviceCount,
+           Path);
+
+    if (Header.LostRecords != 0) {
+        printf(", %llu lost (try a larger capacity or shorter interval)",
+               Header.LostRecords);
+    }
+
+    printf(".\n");
+
+RecordEnd:
+    if (Enabled != FALSE) {
+        IotraceSetCapacity(0, NULL);
+    }
+
+    if (Information != NULL) {
+        free(Information);
+    }
+
+    if (File != NULL) {
+        if (fclose(File) != 0) {
+            if (ReturnValue == 0) {
+                ReturnValue = errno;
+            }
+        }
+    }
+
+    if ((ReturnValue != 0) && (File != NULL)) {
+        fprintf(stderr,
+                "iotrace: Failed to record %s: %s.\n",
+                Path,
+                strerror(ReturnValue));
+    }
+
+    return ReturnValue;
+}
+
+INT
+IotraceReplay (
+    INT ArgumentCount,
+    CHAR **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the replay command, which issues the requests in
+    a trace against a target file or device and reports how they performed.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of elements in the arguments array.
+
+    Arguments - Supplies an array of strings, starting with the command name.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    PVOID Buffer;
+    UINTN BufferSize;
+    ssize_t BytesDone;
+    PIO_TRACE_RECORD Copy;
+    UINTN Count;
+    DEVICE_ID DeviceId;
+    PCSTR DeviceName;
+    ULONGLONG Elapsed;
+    ULONGLONG End;
+    ULONGLONG FirstIssue;
+    INT Flags;
+    ULONGLONG Frequency;
+    UINTN Index;
+    ULONGLONG IssueTime;
+    ULONGLONG Now;
+    ULONGLONG Offset;
+    INT Option;
+    ULONG Options;
+    IOTRACE_LATENCIES Original[2];
+    PIO_TRACE_RECORD Record;
+    IOTRACE_LATENCIES Replayed[2];
+    INT ReturnValue;
+    ULONGLONG Start;
+    ULONGLONG Target;
+    PCSTR TargetPath;
+    off_t TargetSize;
+    IOTRACE_LATENCIES Total;
+    IOTRACE_TRACE Trace;
+    PCSTR TracePath;
+    INT TraceTarget;
+    struct timespec Wait;
+    BOOL Write;
+
+    Buffer = NULL;
+    Copy = NULL;
+    DeviceName = NULL;
+    Options = 0;
+    ReturnValue = 0;
+    TraceTarget = -1;
+    memset(&Original, 0, sizeof(Original));
+    memset(&Replayed, 0, sizeof(Replayed));
+    memset(&Total, 0, sizeof(IOTRACE_LATENCIES));
+    memset(&Trace, 0, sizeof(IOTRACE_TRACE));
+    while (TRUE) {
+        Option = getopt_long(ArgumentCount,
+                             Arguments,
+                             IOTRACE_REPLAY_OPTIONS_STRING,
+                             IotraceReplayLongOptions,
+                             NULL);
+
+        if (Option == -1) {
+            break;
+        }
+
+        if ((Option == '?') || (Option == ':')) {
+            return 1;
+        }
+
+        switch (Option) {
+        case 'd':
+            DeviceName = optarg;
+            break;
+
+        case 'D':
+            Options |= IOTRACE_OPTION_DIRECT;
+            break;
+
+        case 'r':
+            Options |= IOTRACE_OPTION_READ_ONLY;
+            break;
+
+        case 'T':
+            Options |= IOTRACE_OPTION_TIMED;
+            break;
+
+        case 'V':
+            printf("iotrace version %d.%02d\n",
+                   IOTRACE_VERSION_MAJOR,
+                   IOTRACE_VERSION_MINOR);
+
+            return 1;
+
+        case 'h':
+            printf(IOTRACE_USAGE);
+            return 1;
+
+        default:
+
+            assert(FALSE);
+
+            return 1;
+        }
+    }
+
+    if (optind != ArgumentCount - 2) {
+        fprintf(stderr, "iotrace: replay takes a trace and a target\n");
+        return EINVAL;
+    }
+
+    TracePath = Arguments[optind];
+    TargetPath = Arguments[optind + 1];
+    ReturnValue = IotraceLoad(TracePath, &Trace);
+    if (ReturnValue != 0) {
+        goto ReplayEnd;
+    }
+
+    ReturnValue = IotraceSelectDevice(&Trace, DeviceName, &DeviceId);
+    if (ReturnValue != 0) {
+        goto ReplayEnd;
+    }
+
+    //
+    // Pull out the successful requests to the chosen device, in the order
+    // they were issued. The trace holds them in completion order.
+    //
+
+    Copy = malloc(Trace.Header.RecordCount * sizeof(IO_TRACE_RECORD));
+    if ((Copy == NULL) && (Trace.Header.RecordCount != 0)) {
+        ReturnValue = ENOMEM;
+        goto ReplayEnd;
+    }
+
+    Count = 0;
+    BufferSize = 0;
+    for (Index = 0; Index < Trace.Header.RecordCount; Index += 1) {
+        Record = &(Trace.Records[Index]);
+        if ((Record->DeviceId != DeviceId) || (!KSUCCESS(Record->Status)) ||
+            (Record->Size == 0)) {
+
+            continue;
+        }
+
+        if (((Options & IOTRACE_OPTION_READ_ONLY) != 0) &&
+            ((Record->Flags & IO_TRACE_RECORD_FLAG_WRITE) != 0)) {
+
+            continue;
+        }
+
+        if (Record->Size > BufferSize) {
+            BufferSize = Record->Size;
+        }
+
+        Copy[Count] = *Record;
+        Count += 1;
+    }
+
+    if (Count == 0) {
+        fprintf(stderr, "iotrace: No requests to replay.\n");
+        ReturnValue = ENOENT;
+        goto ReplayEnd;
+    }
+
+    qsort(Copy, Count, sizeof(IO_TRACE_RECORD), IotraceCompareRecords);
+    for (Index = 0; Index < 2; Index += 1) {
+        Original[Index].Latencies = malloc(Count * sizeof(ULONGLONG));
+        Replayed[Index].Latencies = malloc(Count * sizeof(ULONGLONG));
+        if ((Original[Index].Latencies == NULL) ||
+            (Replayed[Index].Latencies == NULL)) {
+
+            ReturnValue = ENOMEM;
+            goto ReplayEnd;
+        }
+    }
+
+    Total.Latencies = malloc(Count * sizeof(ULONGLONG));
+    if (Total.Latencies == NULL) {
+        ReturnValue = ENOMEM;
+        goto ReplayEnd;
+    }
+
+    BufferSize = ALIGN_RANGE_UP(BufferSize, IOTRACE_BUFFER_ALIGNMENT);
+    ReturnValue = posix_memalign(&Buffer, IOTRACE_BUFFER_ALIGNMENT, BufferSize);
+    if (ReturnValue != 0) {
+        Buffer = NULL;
+        goto ReplayEnd;
+    }
+
+    memset(Buffer, 0xA5, BufferSize);
+    Flags = O_RDWR;
+    if ((Options & IOTRACE_OPTION_READ_ONLY) != 0) {
+        Flags = O_RDONLY;
+    }
+
+    if ((Options & IOTRACE_OPTION_DIRECT) != 0) {
+        Flags |= O_DIRECT;
+    }
+
+    TraceTarget = open(TargetPath, Flags);
+    if (TraceTarget < 0) {
+        ReturnValue = errno;
+        fprintf(stderr,
+                "iotrace: Failed to open %s: %s.\n",
+                TargetPath,
+                strerror(ReturnValue));
+
+        goto ReplayEnd;
+    }
+
+    TargetSize = lseek(TraceTarget, 0, SEEK_END);
+    if (TargetSize < (off_t)BufferSize) {
+        fprintf(stderr,
+                "iotrace: %s is too small to replay requests of %lu bytes.\n",
+                TargetPath,
+                (unsigned long)BufferSize);
+
+        ReturnValue = EINVAL;
+        goto ReplayEnd;
+    }
+
+    //
+    // Issue each request and time it.
+    //
+
+    FirstIssue = Copy[0].IssueTime;
+    Frequency = Trace.Header.TimeCounterFrequency;
+    Start = IotraceGetNanoseconds();
+    for (Index = 0; Index < Count; Index += 1) {
+        Record = &(Copy[Index]);
+        Write = FALSE;
+        if ((Record->Flags & IO_TRACE_RECORD_FLAG_WRITE) != 0) {
+            Write = TRUE;
+        }
+
+        Offset = Record->Offset;
+        if (Offset + Record->Size > (ULONGLONG)TargetSize) {
+            Offset %= (ULONGLONG)TargetSize - Record->Size + 1;
+            Offset = ALIGN_RANGE_DOWN(Offset, IOTRACE_SECTOR_SIZE);
+        }
+
+        if ((Options & IOTRACE_OPTION_TIMED) != 0) {
+            Target = Start +
+                     IotraceTicksToNanoseconds(Record->IssueTime - FirstIssue,
+                                               Frequency);
+
+            Now = IotraceGetNanoseconds();
+            if (Now < Target) {
+                Wait.tv_sec = (Target - Now) / 1000000000ULL;
+                Wait.tv_nsec = (Target - Now) % 1000000000ULL;
+                nanosleep(&Wait, NULL);
+            }
+        }
+
+        IssueTime = IotraceGetNanoseconds();
+        if (Write != FALSE) {
+            BytesDone = pwrite(TraceTarget, Buffer, Record->Size, Offset);
+
+        } else {
+            BytesDone = pread(TraceTarget, Buffer, Record->Size, Offset);
+        }
+
+        End = IotraceGetNanoseconds();
+        if (BytesDone < 0) {
+            ReturnValue = errno;
+            fprintf(stderr,
+                    "iotrace: %s of %llu bytes at offset %llu failed: %s.\n",
+                    (Write != FALSE) ? "Write" : "Read",
+                    Record->Size,
+                    Offset,
+                    strerror(ReturnValue));
+
+            goto ReplayEnd;
+        }
+
+        Replayed[Write].Latencies[Replayed[Write].Count] = End - IssueTime;
+        Replayed[Write].Count += 1;
+        Replayed[Write].Bytes += BytesDone;
+        Original[Write].Latencies[Original[Write].Count] =
+                     IotraceTicksToNanoseconds(
+                                    Record->CompleteTime - Record->IssueTime,
+                                    Frequency);
+
+        Original[Write].Count += 1;
+        Original[Write].Bytes += Record->BytesCompleted;
+    }
+
+    Elapsed = IotraceGetNanoseconds() - Start;
+    printf("Replayed %lu requests of %s (%lu reads, %lu writes) against %s "
+           "in %.3f s.\n\n",
+           (unsigned long)Count,
+           IotraceGetDeviceName(&Trace, DeviceId),
+           (unsigned long)Replayed[0].Count,
+           (unsigned long)Replayed[1].Count,
+           TargetPath,
+           (double)Elapsed / 1000000000.0);
+
+    //
+    // Print the replay, then the original trace over the span it covered.
+    //
+
+    printf("Replay:\n");
+    IotracePrintLatencyHeader();
+    IotracePrintLatencies("read", &(Replayed[0]), Elapsed);
+    IotracePrintLatencies("write", &(Replayed[1]), Elapsed);
+    Total.Count = Replayed[0].Count + Replayed[1].Count;
+    Total.Bytes = Replayed[0].Bytes + Replayed[1].Bytes;
+    memcpy(Total.Latencies,
+           Replayed[0].Latencies,
+           Replayed[0].Count * sizeof(ULONGLONG));
+
+    memcpy(Total.Latencies + Replayed[0].Count,
+           Replayed[1].Latencies,
+           Replayed[1].Count * sizeof(ULONGLONG));
+
+    IotracePrintLatencies("all", &Total, Elapsed);
+    Elapsed = 0;
+    for (Index = 0; Index < Count; Index += 1) {
+        if (Copy[Index].CompleteTime - FirstIssue > Elapsed) {
+            Elapsed = Copy[Index].CompleteTime - FirstIssue;
+        }
+    }
+
+    Elapsed = IotraceTicksToNanoseconds(Elapsed, Frequency);
+
+    printf("\nTrace:\n");
+    IotracePrintLatencyHeader();
+    IotracePrintLatencies("read", &(Original[0]), Elapsed);
+    IotracePrintLatencies("write", &(Original[1]), Elapsed);
+    Total.Count = Original[0].Count + Original[1].Count;
+    Total.Bytes = Original[0].Bytes + Original[1].Bytes;
+    memcpy(Total.Latencies,
+           Original[0].Latencies,
+           Original[0].Count * sizeof(ULONGLONG));
+
+    memcpy(Total.Latencies + Original[0].Count,
+           Original[1].Latencies,
+           Original[1].Count * sizeof(ULONGLONG));
+
+    IotracePrintLatencies("all", &Total, Elapsed);
+
+ReplayEnd:
+    if (TraceTarget >= 0) {
+        close(TraceTarget);
+    }
+
+    for (Index = 0; Index < 2; Index += 1) {
+        if (Original[Index].Latencies != NULL) {
+            free(Original[Index].Latencies);
+        }
+
+        if (Replayed[Index].Latencies != NULL) {
+            free(Replayed[Index].Latencies);
+        }
+    }
+
+    if (Total.Latencies != NULL) {
+        free(Total.Latencies);
+    }
+
+    if (Buffer != NULL) {
+        free(Buffer);
+    }
+
+    if (Copy != NULL) {
+        free(Copy);
+    }
+
+    IotraceFreeTrace(&Trace);
+    return ReturnValue;
+}
+
+INT
+IotraceShow (
+    INT ArgumentCount,
+    CHAR **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the show command, which summarizes a trace file.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of elements in the arguments array.
+
+    Arguments - Supplies an array of strings, starting with the command name.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    ULONGLONG Bytes[2];
+    ULONGLONG Count[2];
+    ULONGLONG DeviceIndex;
+    ULONGLONG Duration;
+    ULONGLONG End;
+    ULONGLONG Failed;
+    UINTN Index;
+    PIO_TRACE_RECORD Record;
+    INT ReturnValue;
+    ULONGLONG Start;
+    IOTRACE_TRACE Trace;
+    UINTN Write;
+
+    if (ArgumentCount != 2) {
+        fprintf(stderr, "iotrace: show takes one file argument\n");
+        return EINVAL;
+    }
+
+    ReturnValue = IotraceLoad(Arguments[1], &Trace);
+    if (ReturnValue != 0) {
+        return ReturnValue;
+    }
+
+    Start = MAX_ULONGLONG;
+    End = 0;
+    for (Index = 0; Index < Trace.Header.RecordCount; Index += 1) {
+        Record = &(Trace.Records[Index]);
+        if (Record->IssueTime < Start) {
+            Start = Record->IssueTime;
+        }
+
+        if (Record->CompleteTime > End) {
+            End = Record->CompleteTime;
+        }
+    }
+
+    Duration = 0;
+    if (End > Start) {
+        Duration = IotraceTicksToNanoseconds(
+                                         End - Start,
+                                         Trace.Header.TimeCounterFrequency);
+    }
+
+    printf("%llu requests over %.3f s, %llu lost.\n\n",
+           Trace.Header.RecordCount,
+           (double)Duration / 1000000000.0,
+           Trace.Header.LostRecords);
+
+    printf("%-16s %20s %10s %10s %10s %10s %7s\n",
+           "Device",
+           "ID",
+           "reads",
+           "rkB",
+           "writes",
+           "wkB",
+           "failed");
+
+    for (DeviceIndex = 0;
+         DeviceIndex < Trace.Header.DeviceCount;
+         DeviceIndex += 1) {
+
+        memset(Bytes, 0, sizeof(Bytes));
+        memset(Count, 0, sizeof(Count));
+        Failed = 0;
+        for (Index = 0; Index < Trace.Header.RecordCount; Index += 1) {
+            Record = &(Trace.Records[Index]);
+            if (Record->DeviceId != Trace.Devices[DeviceIndex].DeviceId) {
+                continue;
+            }
+
+            if (!KSUCCESS(Record->Status)) {
+                Failed += 1;
+            }
+
+            Write = 0;
+            if ((Record->Flags & IO_TRACE_RECORD_FLAG_WRITE) != 0) {
+                Write = 1;
+            }
+
+            Count[Write] += 1;
+            Bytes[Write] += Record->BytesCompleted;
+        }
+
+        if ((Count[0] == 0) && (Count[1] == 0)) {
+            continue;
+        }
+
+        printf("%-16.16s %20llu %10llu %10llu %10llu %10llu %7llu\n",
+               Trace.Devices[DeviceIndex].Name,
+               Trace.Devices[DeviceIndex].DeviceId,
+               Count[0],
+               Bytes[0] / 1024,
+               Count[1],
+               Bytes[1] / 1024,
+               Failed);
+    }
+
+    IotraceFreeTrace(&Trace);
+    return 0;
+}
+
+INT
+IotraceSetCapacity (
+    ULONG Capacity,
+    PULONGLONG Frequency
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts or stops I/O tracing in the kernel.
+
+Arguments:
+
+    Capacity - Supplies the number of records the kernel buffer should hold,
+        or zero to stop tracing.
+
+    Frequency - Supplies an optional pointer where the frequency of the time
+        counter used in records will be returned.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    IO_TRACE_INFORMATION Information;
+    INT ReturnValue;
+    UINTN Size;
+    KSTATUS Status;
+
+    memset(&Information, 0, sizeof(IO_TRACE_INFORMATION));
+    Information.Version = IO_TRACE_INFORMATION_VERSION;
+    Information.Capacity = Capacity;
+    Size = sizeof(IO_TRACE_INFORMATION);
+    Status = OsGetSetSystemInformation(SystemInformationIo,
+                                       IoInformationTrace,
+                                       &Information,
+                                       &Size,
+                                       TRUE);
+
+    if (!KSUCCESS(Status)) {
+        ReturnValue = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "Error: failed to set I/O trace: status %d: %s.\n",
+                Status,
+                strerror(ReturnValue));
+
+        return ReturnValue;
+    }
+
+    if (Frequency != NULL) {
+        *Frequency = Information.TimeCounterFrequency;
+    }
+
+    return 0;
+}
+
+INT
+IotraceDrain (
+    FILE *File,
+    PIO_TRACE_INFORMATION Information,
+    PULONGLONG NextSequence,
+    PIOTRACE_FILE_HEADER Header
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pulls one batch of records out of the kernel and appends them
+    to the trace file.
+
+Arguments:
+
+    File - Supplies the open trace file.
+
+    Information - Supplies a pointer to a buffer large enough for the trace
+        information and IOTRACE_READ_BATCH records.
+
+    NextSequence - Supplies a pointer that on input contains the sequence
+        number of the next record wanted, and on output contains the one to
+        ask for next time.
+
+    Header - Supplies a pointer to the file header, whose record and lost
+        counts are updated.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    INT ReturnValue;
+    UINTN Size;
+    KSTATUS Status;
+
+    memset(Information, 0, sizeof(IO_TRACE_INFORMATION));
+    Information->Version = IO_TRACE_INFORMATION_VERSION;
+    Information->NextSequence = *NextSequence;
+    Size = sizeof(IO_TRACE_INFORMATION) +
+           (IOTRACE_READ_BATCH * sizeof(IO_TRACE_RECORD));
+
+    Status = OsGetSetSystemInformation(SystemInformationIo,
+                                       IoInformationTrace,
+                                       Information,
+                                       &Size,
+                                       FALSE);
+
+    if (!KSUCCESS(Status)) {
+        ReturnValue = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "Error: failed to read I/O trace: status %d: %s.\n",
+                Status,
+                strerror(ReturnValue));
+
+        return ReturnValue;
+    }
+
+    if (Information->RecordCount != 0) {
+        if (fwrite(Information + 1,
+                   sizeof(IO_TRACE_RECORD),
+                   Information->RecordCount,
+                   File) != Information->RecordCount) {
+
+            return errno;
+        }
+    }
+
+    *NextSequence = Information->NextSequence;
+    Header->RecordCount += Information->RecordCount;
+    Header->LostRecords += Information->LostRecords;
+    return 0;
+}
+
+INT
+IotraceWriteDevices (
+    FILE *File,
+    PULONG DeviceCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine appends the ID and name of every device that has received
+    I/O to the trace file, so that replays can refer to devices by name.
+
+Arguments:
+
+    File - Supplies the open trace file, positioned after the records.
+
+    DeviceCount - Supplies a pointer where the number of devices written will
+        be returned.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    IOTRACE_DEVICE Device;
+    UINTN Index;
+    INT ReturnValue;
+    UINTN Size;
+    PIO_DEVICE_STATISTICS Statistics;
+    KSTATUS Status;
+    UINTN Try;
+
+    *DeviceCount = 0;
+    Statistics = NULL;
+    Size = IOTRACE_DEVICE_GUESS * sizeof(IO_DEVICE_STATISTICS);
+    Status = STATUS_BUFFER_TOO_SMALL;
+    for (Try = 0; Try < IOTRACE_TRY_COUNT; Try += 1) {
+        Statistics = malloc(Size);
+        if (Statistics == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        Status = OsGetSetSystemInformation(SystemInformationIo,
+                                           IoInformationDeviceStatistics,
+                                           Statistics,
+                                           &Size,
+                                           FALSE);
+
+        if (Status != STATUS_BUFFER_TOO_SMALL) {
+            break;
+        }
+
+        free(Statistics);
+        Statistics = NULL;
+        Size *= 2;
+    }
+
+    if (!KSUCCESS(Status)) {
+        ReturnValue = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "Error: failed to get device names: status %d: %s.\n",
+                Status,
+                strerror(ReturnValue));
+
+        goto WriteDevicesEnd;
+    }
+
+    ReturnValue = 0;
+    for (Index = 0; Index < Size / sizeof(IO_DEVICE_STATISTICS); Index += 1) {
+        memset(&Device, 0, sizeof(IOTRACE_DEVICE));
+        Device.DeviceId = Statistics[Index].DeviceId;
+        strncpy(Device.Name,
+                Statistics[Index].DeviceName,
+                sizeof(Device.Name) - 1);
+
+        if (fwrite(&Device, sizeof(IOTRACE_DEVICE), 1, File) != 1) {
+            ReturnValue = errno;
+            goto WriteDevicesEnd;
+        }
+
+        *DeviceCount += 1;
+    }
+
+WriteDevicesEnd:
+    if (Statistics != NULL) {
+        free(Statistics);
+    }
+
+    return ReturnValue;
+}
+
+INT
+IotraceLoad (
+    PCSTR Path,
+    PIOTRACE_TRACE Trace
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads a trace file into memory.
+
+Arguments:
+
+    Path - Supplies the path of the trace file.
+
+    Trace - Supplies a pointer where the trace will be returned. The caller
+        must free it with IotraceFreeTrace, even on failure.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    FILE *File;
+    PIOTRACE_FILE_HEADER Header;
+    INT ReturnValue;
+
+    memset(Trace, 0, sizeof(IOTRACE_TRACE));
+    Header = &(Trace->Header);
+    ReturnValue = 0;
+    File = fopen(Path, "rb");
+    if (File == NULL) {
+        ReturnValue = errno;
+        goto LoadEnd;
+    }
+
+    if (fread(Header, sizeof(IOTRACE_FILE_HEADER), 1, File) != 1) {
+        ReturnValue = EINVAL;
+        goto LoadEnd;
+    }
+
+    if ((Header->Magic != IOTRACE_FILE_MAGIC) ||
+        (Header->Version != IOTRACE_FILE_VERSION) ||
+        (Header->RecordSize != sizeof(IO_TRACE_RECORD)) ||
+        (Header->RecordCount > (MAX_UINTN / sizeof(IO_TRACE_RECORD)))) {
+
+        ReturnValue = EINVAL;
+        goto LoadEnd;
+    }
+
+    if (Header->RecordCount != 0) {
+        Trace->Records = malloc(Header->RecordCount * sizeof(IO_TRACE_RECORD));
+        if (Trace->Records == NULL) {
+            ReturnValue = ENOMEM;
+            goto LoadEnd;
+        }
+
+        if (fread(Trace->Records,
+                  sizeof(IO_TRACE_RECORD),
+                  Header->RecordCount,
+                  File) != Header->RecordCount) {
+
+            ReturnValue = EINVAL;
+            goto LoadEnd;
+        }
+    }
+
+    if (Header->DeviceCount != 0) {
+        Trace->Devices = malloc(Header->DeviceCount * sizeof(IOTRACE_DEVICE));
+        if (Trace->Devices == NULL) {
+            ReturnValue = ENOMEM;
+            goto LoadEnd;
+        }
+
+        if (fread(Trace->Devices,
+                  sizeof(IOTRACE_DEVICE),
+                  Header->DeviceCount,
+                  File) != Header->DeviceCount) {
+
+            ReturnValue = EINVAL;
+            goto LoadEnd;
+        }
+    }
+
+LoadEnd:
+    if (File != NULL) {
+        fclose(File);
+    }
+
+    if (ReturnValue != 0) {
+        fprintf(stderr,
+                "iotrace: Failed to load trace %s: %s.\n",
+                Path,
+                strerror(ReturnValue));
+
+        IotraceFreeTrace(Trace);
+    }
+
+    return ReturnValue;
+}
+
+VOID
+IotraceFreeTrace (
+    PIOTRACE_TRACE Trace
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a trace loaded into memory.
+
+Arguments:
+
+    Trace - Supplies a pointer to the trace.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Trace->Records != NULL) {
+        free(Trace->Records);
+        Trace->Records = NULL;
+    }
+
+    if (Trace->Devices != NULL) {
+        free(Trace->Devices);
+        Trace->Devices = NULL;
+    }
+
+    return;
+}
+
+INT
+IotraceSelectDevice (
+    PIOTRACE_TRACE Trace,
+    PCSTR Name,
+    PDEVICE_ID DeviceId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine picks which device's requests to replay.
+
+Arguments:
+
+    Trace - Supplies a pointer to the loaded trace.
+
+    Name - Supplies an optional device name or numeric device ID. If this is
+        NULL, the device with the most requests in the trace is chosen.
+
+    DeviceId - Supplies a pointer where the chosen device ID is returned.
+
+Return Value:
+
+    0 on success.
+
+    ENOENT if the device is not in the trace.
+
+--*/
+
+{
+
+    PSTR AfterScan;
+    ULONGLONG BestCount;
+    ULONGLONG Count;
+    ULONG DeviceIndex;
+    DEVICE_ID Id;
+    UINTN Index;
+
+    if (Name != NULL) {
+        for (DeviceIndex = 0;
+             DeviceIndex < Trace->Header.DeviceCount;
+             DeviceIndex += 1) {
+
+            if (strcmp(Trace->Devices[DeviceIndex].Name, Name) == 0) {
+                *DeviceId = Trace->Devices[DeviceIndex].DeviceId;
+                return 0;
+            }
+        }
+
+        Id = strtoull(Name, &AfterScan, 0);
+        if ((AfterScan != Name) && (*AfterScan == '\0')) {
+            for (Index = 0; Index < Trace->Header.RecordCount; Index += 1) {
+                if (Trace->Records[Index].DeviceId == Id) {
+                    *DeviceId = Id;
+                    return 0;
+                }
+            }
+        }
+
+        fprintf(stderr, "iotrace: Device %s is not in the trace.\n", Name);
+        return ENOENT;
+    }
+
+    BestCount = 0;
+    for (DeviceIndex = 0;
+         DeviceIndex < Trace->Header.DeviceCount;
+         DeviceIndex += 1) {
+
+        Id = Trace->Devices[DeviceIndex].DeviceId;
+        Count = 0;
+        for (Index = 0; Index < Trace->Header.RecordCount; Index += 1) {
+            if (Trace->Records[Index].DeviceId == Id) {
+                Count += 1;
+            }
+        }
+
+        if (Count > BestCount) {
+            BestCount = Count;
+            *DeviceId = Id;
+        }
+    }
+
+    if (BestCount == 0) {
+        fprintf(stderr, "iotrace: The trace has no requests.\n");
+        return ENOENT;
+    }
+
+    return 0;
+}
+
+PCSTR
+IotraceGetDeviceName (
+    PIOTRACE_TRACE Trace,
+    DEVICE_ID DeviceId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the name of a device in a trace.
+
+Arguments:
+
+    Trace - Supplies a pointer to the loaded trace.
+
+    DeviceId - Supplies the device ID to look up.
+
+Return Value:
+
+    Returns the device name, or a placeholder if the device is not in the
+    trace's device table.
+
+--*/
+
+{
+
+    ULONG DeviceIndex;
+
+    for (DeviceIndex = 0;
+         DeviceIndex < Trace->Header.DeviceCount;
+         DeviceIndex += 1) {
+
+        if (Trace->Devices[DeviceIndex].DeviceId == DeviceId) {
+            return Trace->Devices[DeviceIndex].Name;
+        }
+    }
+
+    return "(unknown device)";
+}
+
+VOID
+IotracePrintLatencyHeader (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the column headings for latency reports.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    printf("%-6s %9s %10s %9s %9s %9s %9s %9s %9s %9s\n",
+           "",
+           "count",
+           "IOPS",
+           "MB/s",
+           "avg(us)",
+           "p50",
+           "p90",
+           "p99",
+           "p99.9",
+           "max");
+
+    return;
+}
+
+VOID
+IotracePrintLatencies (
+    PCSTR Label,
+    PIOTRACE_LATENCIES Latencies,
+    ULONGLONG ElapsedNanoseconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the throughput and latency percentiles of a set of
+    requests. The latency array is sorted in place.
+
+Arguments:
+
+    Label - Supplies the label of the row.
+
+    Latencies - Supplies a pointer to the requests' latencies.
+
+    ElapsedNanoseconds - Supplies the time the requests spanned.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN Count;
+    UINTN Index;
+    ULONG PercentileIndex;
+    double Percentiles[4];
+    ULONG PerMille[4];
+    double Seconds;
+    double Sum;
+
+    Count = Latencies->Count;
+    if (Count == 0) {
+        return;
+    }
+
+    if (ElapsedNanoseconds == 0) {
+        ElapsedNanoseconds = 1;
+    }
+
+    qsort(Latencies->Latencies,
+          Count,
+          sizeof(ULONGLONG),
+          IotraceCompareLatencies);
+
+    Sum = 0.0;
+    for (Index = 0; Index < Count; Index += 1) {
+        Sum += (double)Latencies->Latencies[Index];
+    }
+
+    //
+    // Use the nearest-rank percentile: the smallest latency that at least the
+    // given fraction of requests did not exceed.
+    //
+
+    PerMille[0] = 500;
+    PerMille[1] = 900;
+    PerMille[2] = 990;
+    PerMille[3] = 999;
+    for (PercentileIndex = 0; PercentileIndex < 4; PercentileIndex += 1) {
+        Index = ((Count * PerMille[PercentileIndex]) + 999) / 1000;
+        if (Index != 0) {
+            Index -= 1;
+        }
+
+        Percentiles[PercentileIndex] =
+                             (double)Latencies->Latencies[Index] / 1000.0;
+    }
+
+    Seconds = (double)ElapsedNanoseconds / 1000000000.0;
+    printf("%-6s %9lu %10.1f %9.2f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+           Label,
+           (unsigned long)Count,
+           (double)Count / Seconds,
+           (double)Latencies->Bytes / (1024.0 * 1024.0) / Seconds,
+           Sum / (double)Count / 1000.0,
+           Percentiles[0],
+           Percentiles[1],
+           Percentiles[2],
+           Percentiles[3],
+           (double)Latencies->Latencies[Count - 1] / 1000.0);
+
+    return;
+}
+
+INT
+IotraceCompareRecords (
+    const VOID *Left,
+    const VOID *Right
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two trace records by issue time, then sequence.
+
+Arguments:
+
+    Left - Supplies a pointer to the left record.
+
+    Right - Supplies a pointer to the right record.
+
+Return Value:
+
+    Less than zero if the left record was issued first, greater than zero if
+    the right was, and zero if they are the same record.
+
+--*/
+
+{
+
+    const IO_TRACE_RECORD *LeftRecord;
+    const IO_TRACE_RECORD *RightRecord;
+
+    LeftRecord = Left;
+    RightRecord = Right;
+    if (LeftRecord->IssueTime != RightRecord->IssueTime) {
+        if (LeftRecord->IssueTime < RightRecord->IssueTime) {
+            return -1;
+        }
+
+        return 1;
+    }
+
+    if (LeftRecord->Sequence < RightRecord->Sequence) {
+        return -1;
+
+    } else if (LeftRecord->Sequence > RightRecord->Sequence) {
+        return 1;
+    }
+
+    return 0;
+}
+
+INT
+IotraceCompareLatencies (
+    const VOID *Left,
+    const VOID *Right
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two latencies.
+
+Arguments:
+
+    Left - Supplies a pointer to the left latency.
+
+    Right - Supplies a pointer to the right latency.
+
+Return Value:
+
+    Less than zero if the left latency is smaller, greater than zero if it is
+    larger, and zero if they are equal.
+
+--*/
+
+{
+
+    ULONGLONG LeftValue;
+    ULONGLONG RightValue;
+
+    LeftValue = *((const ULONGLONG *)Left);
+    RightValue = *((const ULONGLONG *)Right);
+    if (LeftValue < RightValue) {
+        return -1;
+
+    } else if (LeftValue > RightValue) {
+        return 1;
+    }
+
+    return 0;
+}
+
+ULONGLONG
+IotraceTicksToNanoseconds (
+    ULONGLONG Ticks,
+    ULONGLONG Frequency
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts a time counter interval to nanoseconds without
+    overflowing on long intervals.
+
+Arguments:
+
+    Ticks - Supplies the interval in time counter ticks.
+
+    Frequency - Supplies the time counter frequency in Hertz.
+
+Return Value:
+
+    Returns the interval in nanoseconds.
+
+--*/
+
+{
+
+    if (Frequency == 0) {
+        return 0;
+    }
+
+    return ((Ticks / Frequency) * 1000000000ULL) +
+           (((Ticks % Frequency) * 1000000000ULL) / Frequency);
+}
+
+ULONGLONG
+IotraceGetNanoseconds (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the current value of the monotonic clock.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of nanoseconds since boot.
+
+--*/
+
+{
+
+    struct timespec Time;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &Time) != 0) {
+        return 0;
+    }
+
+    return ((ULONGLONG)Time.tv_sec * 1000000000ULL) + Time.tv_nsec;
+}
+
+VOID
+IotraceSignalHandler (
+    int Signal
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles a SIGINT while recording, which stops the recording.
+
+Arguments:
+
+    Signal - Supplies the signal number that fired.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    assert(Signal == SIGINT);
+
+    IotraceStop = TRUE;
+    return;
+}
+
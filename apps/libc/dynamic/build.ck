@@ -121,6 +121,7 @@ function build() {
         "if.c",
         "inet.c",
         "init.c",
+        "ioring.c",
         "kerror.c",
         "langinfo.c",
         "line.c",
@@ -349,6 +349,10 @@ Return Value:
             Parameters.Flags |= SYS_OPEN_FLAG_ASYNCHRONOUS;
         }
 
+        if ((SetFlags & O_DIRECT) != 0) {
+            Parameters.Flags |= SYS_OPEN_FLAG_DIRECT;
+        }
+
         break;
 
     case F_GETOWN:
@@ -561,6 +565,10 @@ Return Value:
             ReturnValue |= O_ASYNC;
         }
 
+        if ((Flags & SYS_OPEN_FLAG_DIRECT) != 0) {
+            ReturnValue |= O_DIRECT;
+        }
+
         break;
 
     case F_GETLK:
@@ -3497,6 +3505,10 @@ Return Value:
         OsOpenFlags |= SYS_OPEN_FLAG_ASYNCHRONOUS;
     }
 
+    if ((OpenFlags & O_DIRECT) != 0) {
+        OsOpenFlags |= SYS_OPEN_FLAG_DIRECT;
+    }
+
     //
     // Set other flags.
     //
@@ -0,0 +1,262 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ioring.c
+
+Abstract:
+
+    This module implements the C library interface to I/O submission and
+    completion rings.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    User Mode C Library
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include "libcp.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/ioring.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// This macro asserts that the C library ring definitions line up with the
+// system's.
+//
+
+#define ASSERT_IORING_EQUIVALENT()                                          \
+    assert((sizeof(struct ioring_header) == sizeof(IO_RING_HEADER)) &&      \
+           (sizeof(struct ioring_submission) ==                             \
+            sizeof(IO_RING_SUBMISSION)) &&                                  \
+           (sizeof(struct ioring_completion) ==                             \
+            sizeof(IO_RING_COMPLETION)) &&                                  \
+           (offsetof(struct ioring_submission, descriptor) ==               \
+            FIELD_OFFSET(IO_RING_SUBMISSION, Handle)) &&                    \
+           (offsetof(struct ioring_submission, timeout) ==                  \
+            FIELD_OFFSET(IO_RING_SUBMISSION, TimeoutInMilliseconds)) &&     \
+           (offsetof(struct ioring_completion, status) ==                   \
+            FIELD_OFFSET(IO_RING_COMPLETION, Status)) &&                    \
+           (IORING_OP_POLL == IoRingOperationPoll) &&                       \
+           (IORING_FLAG_DSYNC == IO_RING_SUBMISSION_FLAG_DATA_SYNCHRONIZED) && \
+           (IORING_MAX_ENTRIES == IO_RING_MAX_ENTRIES) &&                   \
+           (POLLIN == POLL_EVENT_IN) && (POLLOUT == POLL_EVENT_OUT))
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+LIBC_API
+int
+ioring_create (
+    void *Buffer,
+    size_t Size,
+    unsigned int SubmitEntries,
+    unsigned int CompleteEntries,
+    int Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates an I/O ring backed by the given buffer. The system
+    fills in the ring header and keeps the buffer resident until the returned
+    descriptor is closed.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the page aligned buffer backing the ring.
+
+    Size - Supplies the size of the buffer in bytes. This must be at least
+        IORING_BUFFER_SIZE of the entry counts.
+
+    SubmitEntries - Supplies the number of submission entries. This must be a
+        power of two.
+
+    CompleteEntries - Supplies the number of completion entries. This must be
+        a power of two no smaller than the number of submission entries.
+
+    Flags - Supplies flags for the new descriptor. Only O_CLOEXEC is honored.
+
+Return Value:
+
+    Returns the new ring descriptor on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    HANDLE Handle;
+    ULONG OpenFlags;
+    KSTATUS Status;
+
+    ASSERT_IORING_EQUIVALENT();
+
+    OpenFlags = 0;
+    if ((Flags & O_CLOEXEC) != 0) {
+        OpenFlags |= SYS_OPEN_FLAG_CLOSE_ON_EXECUTE;
+    }
+
+    Status = OsCreateIoRing(Buffer,
+                            Size,
+                            SubmitEntries,
+                            CompleteEntries,
+                            OpenFlags,
+                            &Handle);
+
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    return (int)(UINTN)Handle;
+}
+
+LIBC_API
+int
+ioring_enter (
+    int Ring,
+    unsigned int SubmitCount,
+    unsigned int WaitCount,
+    int Timeout
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands pending submissions to the system and optionally waits
+    for completions to arrive.
+
+Arguments:
+
+    Ring - Supplies the ring descriptor.
+
+    SubmitCount - Supplies the maximum number of pending submissions to hand
+        off. Fewer are consumed if the completion array would overflow.
+
+    WaitCount - Supplies the number of unconsumed completions to wait for.
+
+    Timeout - Supplies the number of milliseconds to wait, or -1 to wait
+        indefinitely.
+
+Return Value:
+
+    Returns the number of submissions consumed on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    KSTATUS Status;
+    ULONG Submitted;
+    ULONG TimeoutInMilliseconds;
+
+    TimeoutInMilliseconds = SYS_WAIT_TIME_INDEFINITE;
+    if (Timeout >= 0) {
+        TimeoutInMilliseconds = Timeout;
+    }
+
+    Status = OsSubmitIoRing((HANDLE)(UINTN)Ring,
+                            SubmitCount,
+                            WaitCount,
+                            TimeoutInMilliseconds,
+                            &Submitted);
+
+    if (Status == STATUS_TIMEOUT) {
+        errno = ETIMEDOUT;
+        return -1;
+
+    } else if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    return (int)Submitted;
+}
+
+LIBC_API
+int
+ioring_error (
+    int Status
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts the status of a ring completion into an error
+    number.
+
+Arguments:
+
+    Status - Supplies the status member of the completion.
+
+Return Value:
+
+    0 if the operation succeeded.
+
+    Returns an error number describing the failure otherwise.
+
+--*/
+
+{
+
+    if ((KSUCCESS(Status)) || (Status == STATUS_END_OF_FILE)) {
+        return 0;
+    }
+
+    if (Status == STATUS_TIMEOUT) {
+        return EAGAIN;
+    }
+
+    return ClConvertKstatusToErrorNumber(Status);
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
@@ -133,7 +133,8 @@ mode_t ClStatFileTypeConversions[IoObjectTypeCount] = {
     S_IFCHR,
     S_IFCHR,
     S_IFREG,
-    S_IFLNK
+    S_IFLNK,
+    0
 };
 
 //
@@ -1589,7 +1590,7 @@ Return Value:
     // added.
     //
 
-    assert(IoObjectSymbolicLink + 1 == IoObjectTypeCount);
+    assert(IoObjectIoRing + 1 == IoObjectTypeCount);
 
     Stat->st_mode |= ClStatFileTypeConversions[Properties->Type];
     return;
@@ -257,6 +257,15 @@ extern "C" {
 #define O_ASYNC 0x00010000
 #define FASYNC O_ASYNC
 
+//
+// Set this flag to have reads and writes bypass the system's file cache and
+// go directly to the file system or device. The file offset and the size of
+// each transfer must be a multiple of the page size. Buffers aligned to the
+// page size avoid an extra copy.
+//
+
+#define O_DIRECT 0x00020000
+
 //
 // Set this flag to enable opening files whose offsets cannot be described in
 // off_t types but can be described in off64_t. Since off_t is always 64-bits,
@@ -0,0 +1,342 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU Lesser General Public
+    License version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details.
+
+Module Name:
+
+    ioring.h
+
+Abstract:
+
+    This header contains definitions for I/O submission and completion rings,
+    which allow a batch of reads, writes, flushes, and polls to be handed to
+    the system in one call and their results collected from shared memory.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+--*/
+
+#ifndef _SYS_IORING_H
+#define _SYS_IORING_H
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <stdint.h>
+#include <sys/types.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// This macro returns the size of the buffer needed to back a ring with the
+// given number of submission and completion entries.
+//
+
+#define IORING_BUFFER_SIZE(_SubmitEntries, _CompleteEntries) \
+    (sizeof(struct ioring_header) +                          \
+     ((_SubmitEntries) * sizeof(struct ioring_submission)) + \
+     ((_CompleteEntries) * sizeof(struct ioring_completion)))
+
+//
+// These macros return pointers to the submission and completion arrays of a
+// ring buffer.
+//
+
+#define IORING_SUBMISSIONS(_Header)                                         \
+    ((struct ioring_submission *)((char *)(_Header) +                       \
+                                  (_Header)->submit_offset))
+
+#define IORING_COMPLETIONS(_Header)                                         \
+    ((struct ioring_completion *)((char *)(_Header) +                       \
+                                  (_Header)->complete_offset))
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#ifdef __cplusplus
+
+extern "C" {
+
+#endif
+
+//
+// Define the maximum number of entries in either array of a ring. Entry counts
+// must be powers of two.
+//
+
+#define IORING_MAX_ENTRIES 4096
+
+//
+// Define the ring operations.
+//
+
+#define IORING_OP_NOP   0
+#define IORING_OP_READ  1
+#define IORING_OP_WRITE 2
+#define IORING_OP_FLUSH 3
+#define IORING_OP_POLL  4
+
+//
+// Set this flag on a write submission to have the data synchronized to the
+// backing device before the write completes.
+//
+
+#define IORING_FLAG_DSYNC 0x00000001
+
+//
+// Supply this offset to use and update the descriptor's file position.
+//
+
+#define IORING_OFFSET_CURRENT (-1LL)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines the header at the start of a ring buffer. Indices
+    run freely and are reduced modulo the entry count to find an entry.
+
+Members:
+
+    submit_head - Stores the index of the next submission the system will
+        consume. This is only written by the system.
+
+    submit_tail - Stores the index one beyond the last submission filled in.
+        This is only written by the application.
+
+    complete_head - Stores the index of the next completion the application
+        will consume. This is only written by the application.
+
+    complete_tail - Stores the index one beyond the last completion posted.
+        This is only written by the system. Applications can poll this value
+        to reap completions without calling into the system.
+
+    submit_entries - Stores the number of submission entries.
+
+    complete_entries - Stores the number of completion entries.
+
+    submit_offset - Stores the byte offset of the submission array from the
+        start of the header.
+
+    complete_offset - Stores the byte offset of the completion array from the
+        start of the header.
+
+--*/
+
+struct ioring_header {
+    volatile unsigned int submit_head;
+    volatile unsigned int submit_tail;
+    volatile unsigned int complete_head;
+    volatile unsigned int complete_tail;
+    unsigned int submit_entries;
+    unsigned int complete_entries;
+    unsigned int submit_offset;
+    unsigned int complete_offset;
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines a ring submission entry.
+
+Members:
+
+    user_data - Stores an opaque value copied into the completion.
+
+    offset - Stores the file offset for the operation, or
+        IORING_OFFSET_CURRENT.
+
+    buffer - Stores the data buffer for reads and writes.
+
+    size - Stores the size of the buffer in bytes.
+
+    descriptor - Stores the file descriptor to operate on.
+
+    operation - Stores the operation. See IORING_OP_* definitions.
+
+    flags - Stores a bitfield of flags. See IORING_FLAG_* definitions.
+
+    events - Stores the poll events (POLLIN, POLLOUT, etc) for poll
+        operations.
+
+    timeout - Stores the number of milliseconds the operation may block, or
+        -1 to block indefinitely.
+
+    reserved - Stores a reserved value that must be zero.
+
+--*/
+
+struct ioring_submission {
+    uint64_t user_data;
+    int64_t offset;
+    void *buffer;
+    size_t size;
+    intptr_t descriptor;
+    unsigned int operation;
+    unsigned int flags;
+    unsigned int events;
+    int timeout;
+    unsigned int reserved;
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines a ring completion entry.
+
+Members:
+
+    user_data - Stores the user data value from the submission.
+
+    bytes_completed - Stores the number of bytes transferred.
+
+    status - Stores the raw completion status. Use ioring_error to convert
+        this to an error number.
+
+    events - Stores the returned poll events for poll operations.
+
+    reserved - Stores a reserved value.
+
+--*/
+
+struct ioring_completion {
+    uint64_t user_data;
+    size_t bytes_completed;
+    int status;
+    unsigned int events;
+    unsigned int reserved;
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+LIBC_API
+int
+ioring_create (
+    void *Buffer,
+    size_t Size,
+    unsigned int SubmitEntries,
+    unsigned int CompleteEntries,
+    int Flags
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates an I/O ring backed by the given buffer. The system
+    fills in the ring header and keeps the buffer resident until the returned
+    descriptor is closed.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the page aligned buffer backing the ring.
+
+    Size - Supplies the size of the buffer in bytes. This must be at least
+        IORING_BUFFER_SIZE of the entry counts.
+
+    SubmitEntries - Supplies the number of submission entries. This must be a
+        power of two.
+
+    CompleteEntries - Supplies the number of completion entries. This must be
+        a power of two no smaller than the number of submission entries.
+
+    Flags - Supplies flags for the new descriptor. Only O_CLOEXEC is honored.
+
+Return Value:
+
+    Returns the new ring descriptor on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+ioring_enter (
+    int Ring,
+    unsigned int SubmitCount,
+    unsigned int WaitCount,
+    int Timeout
+    );
+
+/*++
+
+Routine Description:
+
+    This routine hands pending submissions to the system and optionally waits
+    for completions to arrive.
+
+Arguments:
+
+    Ring - Supplies the ring descriptor.
+
+    SubmitCount - Supplies the maximum number of pending submissions to hand
+        off. Fewer are consumed if the completion array would overflow.
+
+    WaitCount - Supplies the number of unconsumed completions to wait for.
+
+    Timeout - Supplies the number of milliseconds to wait, or -1 to wait
+        indefinitely.
+
+Return Value:
+
+    Returns the number of submissions consumed on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+ioring_error (
+    int Status
+    );
+
+/*++
+
+Routine Description:
+
+    This routine converts the status of a ring completion into an error
+    number.
+
+Arguments:
+
+    Status - Supplies the status member of the completion.
+
+Return Value:
+
+    0 if the operation succeeded.
+
+    Returns an error number describing the failure otherwise.
+
+--*/
+
+#ifdef __cplusplus
+
+}
+
+#endif
+#endif
+
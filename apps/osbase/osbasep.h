@@ -369,6 +369,33 @@ Return Value:
 
 --*/
 
+#if defined(__i386) || defined(__amd64)
+
+ULONGLONG
+OspReadProcessorCounter (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads the raw processor counter directly from user mode. It
+    should only be called if the kernel has indicated in the user shared data
+    page that the processor counter is readable and backs the time counter.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the current raw value of the processor counter.
+
+--*/
+
+#endif
+
 //
 // Thread-Local storage functions
 //
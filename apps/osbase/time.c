@@ -144,6 +144,37 @@ Return Value:
 
     SYSTEM_CALL_QUERY_TIME_COUNTER Parameters;
 
+#if defined(__i386) || defined(__amd64)
+
+    ULONGLONG Offset;
+    ULONGLONG ProcessorCounter;
+    ULONGLONG TickCount;
+    PUSER_SHARED_DATA UserSharedData;
+
+    //
+    // If the kernel says the time counter is just an offset from an invariant
+    // processor counter, read the counter directly and avoid the system call.
+    // Snap the offset between the two tick count values in case it's being
+    // republished. Only the 64-bit TSC can back the time counter this way, so
+    // other architectures always make the system call.
+    //
+
+    UserSharedData = OspGetUserSharedData();
+    if ((UserSharedData->TimeCounterFlags &
+         USER_TIME_COUNTER_FLAG_PROCESSOR_COUNTER) != 0) {
+
+        do {
+            TickCount = UserSharedData->TickCount;
+            Offset = UserSharedData->ProcessorCounterTimeOffset;
+            ProcessorCounter = OspReadProcessorCounter();
+
+        } while (TickCount != UserSharedData->TickCount2);
+
+        return ProcessorCounter + Offset;
+    }
+
+#endif
+
     OsSystemCall(SystemCallQueryTimeCounter, &Parameters);
     return Parameters.Value;
 }
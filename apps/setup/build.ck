@@ -25,7 +25,7 @@ Module Name:
 
 --*/
 
-from menv import application, copy, mconfig;
+from menv import addConfig, application, copy, mconfig;
 
 function build() {
     var app;
@@ -57,19 +57,22 @@ function build() {
         "plat.c",
         "setup.c",
         "steps.c",
+        "stream.c",
         "util.c"
     ];
 
     minocaSources = [
         "minoca/io.c",
         "minoca/misc.c",
-        "minoca/part.c"
+        "minoca/part.c",
+        "posix.c"
     ];
 
     uosSources = [
         "uos/io.c",
         "uos/misc.c",
-        "uos/part.c"
+        "uos/part.c",
+        "posix.c"
     ];
 
     win32Sources = [
@@ -124,7 +127,11 @@ function build() {
     } else {
         buildSources = commonSources + uosSources;
         if (buildOs != "Darwin" && buildOs != "FreeBSD") {
-            buildConfig["DYNLIBS"] = ["-ldl"];
+            addConfig(buildConfig, "DYNLIBS", "-ldl");
+        }
+
+        if (buildOs != "Darwin") {
+            addConfig(buildConfig, "DYNLIBS", "-pthread");
         }
     }
 
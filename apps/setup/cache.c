@@ -48,6 +48,13 @@ Module Name:
 
 #define SETUP_MAX_CACHE_SIZE (1024 * 1024 * 10)
 
+//
+// Define the maximum number of adjacent dirty blocks combined into a single
+// write.
+//
+
+#define SETUP_CACHE_MAX_WRITE_BLOCKS 16
+
 //
 // Define some max offset to ever expect to write to in order to debug stray
 // writes.
@@ -84,6 +91,9 @@ Structure Description:
     CheckBlock - Stores a single block's worth of buffer space, used to verify
         writes.
 
+    WriteBuffer - Stores an optional pointer to a buffer used to combine
+        adjacent dirty blocks into a single write.
+
 --*/
 
 typedef struct _SETUP_HANDLE {
@@ -96,6 +106,7 @@ typedef struct _SETUP_HANDLE {
     UINTN CacheSize;
     UINTN MaxCacheSize;
     PVOID CheckBlock;
+    PVOID WriteBuffer;
 } SETUP_HANDLE, *PSETUP_HANDLE;
 
 /*++
@@ -149,6 +160,13 @@ SetupCleanCacheData (
     PSETUP_CACHE_DATA Data
     );
 
+VOID
+SetupVerifyCacheBlock (
+    PSETUP_HANDLE Handle,
+    ULONGLONG Offset,
+    PUCHAR Bytes
+    );
+
 PSETUP_CACHE_DATA
 SetupGetCacheData (
     PSETUP_HANDLE Handle,
@@ -172,6 +190,12 @@ SetupCompareCacheTreeNodes (
 
 BOOL SetupVerifyWrites = TRUE;
 
+//
+// Store the statistics of writes from the cache to the devices.
+//
+
+SETUP_CACHE_STATISTICS SetupCacheStatistics;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -230,6 +254,14 @@ Return Value:
 
         INITIALIZE_LIST_HEAD(&(IoHandle->CacheLruList));
         IoHandle->MaxCacheSize = SETUP_MAX_CACHE_SIZE / SETUP_CACHE_BLOCK_SIZE;
+
+        //
+        // Failing to allocate the write buffer just means dirty blocks get
+        // written one at a time.
+        //
+
+        IoHandle->WriteBuffer = malloc(SETUP_CACHE_MAX_WRITE_BLOCKS *
+                                       SETUP_CACHE_BLOCK_SIZE);
     }
 
     IoHandle->Handle = SetupOsOpenDestination(Destination,
@@ -237,6 +269,10 @@ Return Value:
                                               CreatePermissions);
 
     if (IoHandle->Handle == NULL) {
+        if (IoHandle->WriteBuffer != NULL) {
+            free(IoHandle->WriteBuffer);
+        }
+
         free(IoHandle);
         IoHandle = NULL;
     }
@@ -276,6 +312,10 @@ Return Value:
         IoHandle->Handle = NULL;
     }
 
+    if (IoHandle->WriteBuffer != NULL) {
+        free(IoHandle->WriteBuffer);
+    }
+
     free(IoHandle);
     return;
 }
@@ -752,6 +792,34 @@ Return Value:
     return;
 }
 
+VOID
+SetupGetCacheStatistics (
+    PSETUP_CACHE_STATISTICS Statistics
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the accumulated statistics of writes from the block
+    cache to the underlying devices.
+
+Arguments:
+
+    Statistics - Supplies a pointer where the statistics will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    memcpy(Statistics, &SetupCacheStatistics, sizeof(SETUP_CACHE_STATISTICS));
+    return;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -781,6 +849,7 @@ Return Value:
 
     PLIST_ENTRY CurrentEntry;
     PSETUP_CACHE_DATA Data;
+    PRED_BLACK_TREE_NODE TreeNode;
 
     if (Handle->Cached == FALSE) {
         return;
@@ -788,17 +857,33 @@ Return Value:
 
     assert(Handle->CacheLruList.Next != NULL);
 
+    //
+    // Clean the dirty entries in offset order so that adjacent blocks go out
+    // together in sequential writes.
+    //
+
+    TreeNode = RtlRedBlackTreeGetLowestNode(&(Handle->Cache));
+    while (TreeNode != NULL) {
+        Data = RED_BLACK_TREE_VALUE(TreeNode, SETUP_CACHE_DATA, TreeNode);
+        if (Data->Dirty != FALSE) {
+            SetupCleanCacheData(Handle, Data);
+        }
+
+        TreeNode = RtlRedBlackTreeGetNextNode(&(Handle->Cache),
+                                              FALSE,
+                                              TreeNode);
+    }
+
     //
     // Rudely go through the list. Don't bother removing them from the list
-    // or the tree, but do clean them.
+    // or the tree.
     //
 
     CurrentEntry = Handle->CacheLruList.Previous;
     while (CurrentEntry != &(Handle->CacheLruList)) {
         Data = LIST_VALUE(CurrentEntry, SETUP_CACHE_DATA, ListEntry);
-        if (Data->Dirty != FALSE) {
-            SetupCleanCacheData(Handle, Data);
-        }
+
+        assert(Data->Dirty == FALSE);
 
         CurrentEntry = CurrentEntry->Previous;
         Handle->CacheSize -= 1;
@@ -861,13 +946,19 @@ Return Value:
                           SETUP_CACHE_DATA,
                           ListEntry);
 
-        LIST_REMOVE(&(Data->ListEntry));
-        RtlRedBlackTreeRemove(&(Handle->Cache), &(Data->TreeNode));
-        Handle->CacheSize -= 1;
+        //
+        // Clean the entry while it is still in the tree so that the dirty
+        // blocks following it can be written along with it.
+        //
+
         if (Data->Dirty != FALSE) {
             SetupCleanCacheData(Handle, Data);
         }
 
+        LIST_REMOVE(&(Data->ListEntry));
+        RtlRedBlackTreeRemove(&(Handle->Cache), &(Data->TreeNode));
+        Handle->CacheSize -= 1;
+
     } else {
         Data = malloc(sizeof(SETUP_CACHE_DATA) + SETUP_CACHE_BLOCK_SIZE);
         if (Data == NULL) {
@@ -901,13 +992,15 @@ SetupCleanCacheData (
 Routine Description:
 
     This routine cleans dirty cache data, writing it out to the underlying
-    handle.
+    handle. Any dirty blocks directly following it are written out in the
+    same request.
 
 Arguments:
 
     Handle - Supplies the handle.
 
-    Data - Supplies the dirty cache entry to write out.
+    Data - Supplies the dirty cache entry to write out. This entry must still
+        be in the cache tree.
 
 Return Value:
 
@@ -919,16 +1012,61 @@ Return Value:
 
 {
 
-    PUCHAR Bytes;
+    UINTN BlockCount;
+    UINTN BlockIndex;
+    PUCHAR Buffer;
     ssize_t BytesWritten;
-    UINTN Errors;
-    UINTN FirstBad;
-    UINTN Index;
-    UINTN LastBad;
-    PUCHAR ReadBytes;
+    PSETUP_CACHE_DATA NextData;
+    PRED_BLACK_TREE_NODE NextNode;
+    UINTN Size;
+    ULONGLONG StartTime;
 
     assert(Data->Dirty != FALSE);
 
+    StartTime = SetupGetMicroseconds();
+
+    //
+    // Gather up the dirty blocks that directly follow this one.
+    //
+
+    Buffer = Data->Data;
+    BlockCount = 1;
+    if (Handle->WriteBuffer != NULL) {
+        NextNode = &(Data->TreeNode);
+        while (BlockCount < SETUP_CACHE_MAX_WRITE_BLOCKS) {
+            NextNode = RtlRedBlackTreeGetNextNode(&(Handle->Cache),
+                                                  FALSE,
+                                                  NextNode);
+
+            if (NextNode == NULL) {
+                break;
+            }
+
+            NextData = RED_BLACK_TREE_VALUE(NextNode,
+                                            SETUP_CACHE_DATA,
+                                            TreeNode);
+
+            if ((NextData->Dirty == FALSE) ||
+                (NextData->Offset !=
+                 Data->Offset + (BlockCount * SETUP_CACHE_BLOCK_SIZE))) {
+
+                break;
+            }
+
+            if (BlockCount == 1) {
+                Buffer = Handle->WriteBuffer;
+                memcpy(Buffer, Data->Data, SETUP_CACHE_BLOCK_SIZE);
+            }
+
+            memcpy(Buffer + (BlockCount * SETUP_CACHE_BLOCK_SIZE),
+                   NextData->Data,
+                   SETUP_CACHE_BLOCK_SIZE);
+
+            BlockCount += 1;
+        }
+    }
+
+    Size = BlockCount * SETUP_CACHE_BLOCK_SIZE;
     errno = 0;
     if (Data->Offset != Handle->NextOsOffset) {
         Handle->NextOsOffset = SetupOsSeek(Handle->Handle, Data->Offset);
@@ -938,11 +1076,8 @@ Return Value:
         }
     }
 
-    BytesWritten = SetupOsWrite(Handle->Handle,
-                                Data->Data,
-                                SETUP_CACHE_BLOCK_SIZE);
-
-    if (BytesWritten != SETUP_CACHE_BLOCK_SIZE) {
+    BytesWritten = SetupOsWrite(Handle->Handle, Buffer, Size);
+    if (BytesWritten != Size) {
         if (errno != 0) {
             fprintf(stderr,
                     "Error: Write failed at offset %llx: %d bytes "
@@ -956,49 +1091,114 @@ Return Value:
     }
 
     if (SetupVerifyWrites != FALSE) {
-        Bytes = Data->Data;
-        ReadBytes = Handle->CheckBlock;
         SetupOsSeek(Handle->Handle, Data->Offset);
-        SetupOsRead(Handle->Handle, ReadBytes, SETUP_CACHE_BLOCK_SIZE);
-        if (memcmp(ReadBytes, Bytes, SETUP_CACHE_BLOCK_SIZE) != 0) {
-            FirstBad = SETUP_CACHE_BLOCK_SIZE;
-            LastBad = 0;
-            Errors = 0;
-            for (Index = 0; Index < SETUP_CACHE_BLOCK_SIZE; Index += 1) {
-                if (Bytes[Index] != ReadBytes[Index]) {
-                    Errors += 1;
-                    if (Errors < 10) {
-                        fprintf(stderr,
-                                "    Offset %lx: Got %02x, expected %02x\n",
-                                Index,
-                                ReadBytes[Index],
-                                Bytes[Index]);
-                    }
+        for (BlockIndex = 0; BlockIndex < BlockCount; BlockIndex += 1) {
+            SetupVerifyCacheBlock(
+                         Handle,
+                         Data->Offset + (BlockIndex * SETUP_CACHE_BLOCK_SIZE),
+                         Buffer + (BlockIndex * SETUP_CACHE_BLOCK_SIZE));
+        }
+    }
 
-                    if (Index < FirstBad) {
-                        FirstBad = Index;
-                    }
+    //
+    // Mark the blocks that went out with this one as clean too.
+    //
 
-                    if (Index > LastBad) {
-                        LastBad = Index;
-                    }
-                }
-            }
+    NextNode = &(Data->TreeNode);
+    for (BlockIndex = 1; BlockIndex < BlockCount; BlockIndex += 1) {
+        NextNode = RtlRedBlackTreeGetNextNode(&(Handle->Cache),
+                                              FALSE,
+                                              NextNode);
 
-            fprintf(stderr,
-                    "%ld errors (offsets %lx - %lx) at offset %llx\n",
-                    Errors,
-                    FirstBad,
-                    LastBad,
-                    Data->Offset);
-        }
+        NextData = RED_BLACK_TREE_VALUE(NextNode, SETUP_CACHE_DATA, TreeNode);
+        NextData->Dirty = FALSE;
     }
 
-    Handle->NextOsOffset += SETUP_CACHE_BLOCK_SIZE;
+    Handle->NextOsOffset += Size;
     Data->Dirty = FALSE;
+    SetupCacheStatistics.BytesWritten += Size;
+    SetupCacheStatistics.Writes += 1;
+    SetupCacheStatistics.Microseconds += SetupGetMicroseconds() - StartTime;
     return 0;
 }
 
+VOID
+SetupVerifyCacheBlock (
+    PSETUP_HANDLE Handle,
+    ULONGLONG Offset,
+    PUCHAR Bytes
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads back a block that was just written and complains if it
+    does not match what was written. The handle's OS file position is assumed
+    to be at the block already.
+
+Arguments:
+
+    Handle - Supplies the handle.
+
+    Offset - Supplies the offset of the block, for error reporting.
+
+    Bytes - Supplies a pointer to the block's worth of data that was written.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN Errors;
+    UINTN FirstBad;
+    UINTN Index;
+    UINTN LastBad;
+    PUCHAR ReadBytes;
+
+    ReadBytes = Handle->CheckBlock;
+    SetupOsRead(Handle->Handle, ReadBytes, SETUP_CACHE_BLOCK_SIZE);
+    if (memcmp(ReadBytes, Bytes, SETUP_CACHE_BLOCK_SIZE) == 0) {
+        return;
+    }
+
+    FirstBad = SETUP_CACHE_BLOCK_SIZE;
+    LastBad = 0;
+    Errors = 0;
+    for (Index = 0; Index < SETUP_CACHE_BLOCK_SIZE; Index += 1) {
+        if (Bytes[Index] != ReadBytes[Index]) {
+            Errors += 1;
+            if (Errors < 10) {
+                fprintf(stderr,
+                        "    Offset %lx: Got %02x, expected %02x\n",
+                        Index,
+                        ReadBytes[Index],
+                        Bytes[Index]);
+            }
+
+            if (Index < FirstBad) {
+                FirstBad = Index;
+            }
+
+            if (Index > LastBad) {
+                LastBad = Index;
+            }
+        }
+    }
+
+    fprintf(stderr,
+            "%ld errors (offsets %lx - %lx) at offset %llx\n",
+            Errors,
+            FirstBad,
+            LastBad,
+            Offset);
+
+    return;
+}
+
 PSETUP_CACHE_DATA
 SetupGetCacheData (
     PSETUP_HANDLE Handle,
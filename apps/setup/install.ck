@@ -102,6 +102,7 @@ var DriverFiles = [
     "null.drv",
     "onering.drv",
     "part.drv",
+    "cow.drv",
     "pci.drv",
     "rtlw81xx.drv",
     "rtlw8188eufw.bin",
@@ -112,6 +113,7 @@ var DriverFiles = [
     "smsc95xx.drv",
     "sound.drv",
     "special.drv",
+    "tmpfs.drv",
     "usbcomp.drv",
     "usbcore.drv",
     "usbhid.drv",
@@ -152,6 +154,7 @@ var BootDrivers = [
     "fat.drv",
     "null.drv",
     "part.drv",
+    "cow.drv",
     "special.drv",
     "videocon.drv",
 ];
@@ -492,6 +495,7 @@ if (plat == "install-armv6") {
         "om4gpio.drv",
         "onering.drv",
         "part.drv",
+        "cow.drv",
         "pci.drv",
         "pl050.drv",
         "ramdisk.drv",
@@ -512,6 +516,7 @@ if (plat == "install-armv6") {
         "sound.drv",
         "spb.drv",
         "special.drv",
+        "tmpfs.drv",
         "tps65217.drv",
         "usbcomp.drv",
         "usbcore.drv",
@@ -620,6 +625,7 @@ if (plat == "install-armv7") {
         "onering.drv",
         "pandafw",
         "part.drv",
+        "cow.drv",
         "pci.drv",
         "pl050.drv",
         "ramdisk.drv",
@@ -642,6 +648,7 @@ if (plat == "install-armv7") {
         "sound.drv",
         "spb.drv",
         "special.drv",
+        "tmpfs.drv",
         "tps65217.drv",
         "usbcomp.drv",
         "usbcore.drv",
@@ -743,6 +750,7 @@ if ((plat == "install-x86") || (plat == "install-x64")) {
         "null.drv",
         "onering.drv",
         "part.drv",
+        "cow.drv",
         "pci.drv",
         "pcnet32.drv",
         "qrkhostb.drv",
@@ -756,6 +764,7 @@ if ((plat == "install-x86") || (plat == "install-x64")) {
         "smsc95xx.drv",
         "sound.drv",
         "special.drv",
+        "tmpfs.drv",
         "uhci.drv",
         "usbcomp.drv",
         "usbcore.drv",
@@ -1024,8 +1033,10 @@ if ((plat == "pc32-tiny") || (plat == "pc64-tiny")) {
         "netcore.drv",
         "null.drv",
         "part.drv",
+        "cow.drv",
         "pci.drv",
         "special.drv",
+        "tmpfs.drv",
         "usrinput.drv",
         "videocon.drv",
         "ata.drv",
@@ -1039,6 +1050,7 @@ if ((plat == "pc32-tiny") || (plat == "pc64-tiny")) {
         "fat.drv",
         "null.drv",
         "part.drv",
+        "cow.drv",
         "pci.drv",
         "special.drv",
         "videocon.drv",
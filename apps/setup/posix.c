@@ -0,0 +1,412 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    posix.c
+
+Abstract:
+
+    This module implements the thread, lock, and condition variable support
+    functions for the setup application on top of POSIX threads. It is shared
+    by the Minoca and POSIX builds.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "setup.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INT
+SetupOsCreateThread (
+    PSETUP_THREAD_ROUTINE ThreadRoutine,
+    PVOID Parameter,
+    PVOID *Thread
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new thread.
+
+Arguments:
+
+    ThreadRoutine - Supplies a pointer to the routine to run in the new thread.
+        The thread is destroyed when the supplied routine returns.
+
+    Parameter - Supplies a pointer to a parameter to pass to the thread.
+
+    Thread - Supplies a pointer where a handle to the thread will be returned
+        on success. The caller must wait for the thread with
+        SetupOsWaitForThread.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if threads are not supported.
+
+    Returns an error code on failure.
+
+--*/
+
+{
+
+    pthread_t *NewThread;
+    INT Result;
+
+    *Thread = NULL;
+    NewThread = malloc(sizeof(pthread_t));
+    if (NewThread == NULL) {
+        return ENOMEM;
+    }
+
+    Result = pthread_create(NewThread, NULL, ThreadRoutine, Parameter);
+    if (Result != 0) {
+        free(NewThread);
+        return Result;
+    }
+
+    *Thread = NewThread;
+    return 0;
+}
+
+VOID
+SetupOsWaitForThread (
+    PVOID Thread
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for a thread to exit and releases its handle.
+
+Arguments:
+
+    Thread - Supplies the thread handle returned when the thread was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    pthread_t *JoinThread;
+
+    JoinThread = Thread;
+    pthread_join(*JoinThread, NULL);
+    free(JoinThread);
+    return;
+}
+
+INT
+SetupOsCreateLock (
+    PVOID *Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a lock.
+
+Arguments:
+
+    Lock - Supplies a pointer where a pointer to the lock will be returned on
+        success.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if locks are not supported.
+
+    Returns an error code on failure.
+
+--*/
+
+{
+
+    pthread_mutex_t *Mutex;
+    INT Result;
+
+    *Lock = NULL;
+    Mutex = malloc(sizeof(pthread_mutex_t));
+    if (Mutex == NULL) {
+        return ENOMEM;
+    }
+
+    Result = pthread_mutex_init(Mutex, NULL);
+    if (Result != 0) {
+        free(Mutex);
+        return Result;
+    }
+
+    *Lock = Mutex;
+    return 0;
+}
+
+VOID
+SetupOsDestroyLock (
+    PVOID Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    pthread_mutex_destroy(Lock);
+    free(Lock);
+    return;
+}
+
+VOID
+SetupOsAcquireLock (
+    PVOID Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine acquires a lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to acquire.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    pthread_mutex_lock(Lock);
+    return;
+}
+
+VOID
+SetupOsReleaseLock (
+    PVOID Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    pthread_mutex_unlock(Lock);
+    return;
+}
+
+INT
+SetupOsCreateCondition (
+    PVOID *Condition
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a condition variable.
+
+Arguments:
+
+    Condition - Supplies a pointer where a pointer to the condition variable
+        will be returned on success.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if condition variables are not supported.
+
+    Returns an error code on failure.
+
+--*/
+
+{
+
+    pthread_cond_t *NewCondition;
+    INT Result;
+
+    *Condition = NULL;
+    NewCondition = malloc(sizeof(pthread_cond_t));
+    if (NewCondition == NULL) {
+        return ENOMEM;
+    }
+
+    Result = pthread_cond_init(NewCondition, NULL);
+    if (Result != 0) {
+        free(NewCondition);
+        return Result;
+    }
+
+    *Condition = NewCondition;
+    return 0;
+}
+
+VOID
+SetupOsDestroyCondition (
+    PVOID Condition
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a condition variable.
+
+Arguments:
+
+    Condition - Supplies a pointer to the condition variable to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    pthread_cond_destroy(Condition);
+    free(Condition);
+    return;
+}
+
+VOID
+SetupOsWaitCondition (
+    PVOID Condition,
+    PVOID Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine atomically releases the given lock and waits for the
+    condition to be signaled, then reacquires the lock. Waits can end
+    spuriously, so callers must recheck what they are waiting for.
+
+Arguments:
+
+    Condition - Supplies a pointer to the condition variable to wait on.
+
+    Lock - Supplies a pointer to the lock, which must be held.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    pthread_cond_wait(Condition, Lock);
+    return;
+}
+
+VOID
+SetupOsSignalCondition (
+    PVOID Condition
+    )
+
+/*++
+
+Routine Description:
+
+    This routine wakes all threads waiting on a condition variable.
+
+Arguments:
+
+    Condition - Supplies a pointer to the condition variable to signal.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    pthread_cond_broadcast(Condition);
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
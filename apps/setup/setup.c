@@ -75,6 +75,9 @@ Module Name:
     "  -l, --platform=name -- Specifies the platform type.\n"                  \
     "  -p, --partition=destination -- Specifies the install destination as \n" \
     "      a partition.\n"                                                     \
+    "  -P, --pipeline -- Read the install source on a separate thread while \n"\
+    "      writing the destination, and report the throughput of each \n"     \
+    "      stage.\n"                                                           \
     "  -q, --quiet -- Print nothing but errors.\n"                             \
     "  -r, --reboot -- Reboot after installation is complete.\n"               \
     "  -s, --script=file -- Load a script file.\n"                             \
@@ -89,7 +92,7 @@ Module Name:
     "Example: 'msetup -v -p 0x26' Installs on a partition with device ID "     \
     "0x26.\n"
 
-#define SETUP_OPTIONS_STRING "Aa:b:BDd:G:hi:l:p:f:qrs:vx:V"
+#define SETUP_OPTIONS_STRING "Aa:b:BDd:G:hi:l:p:Pf:qrs:vx:V"
 
 #define SETUP_ADD_PARTITION_SCRIPT_FORMAT \
     "Partitions.append({" \
@@ -137,6 +140,7 @@ struct option SetupLongOptions[] = {
     {"input", required_argument, 0, 'i'},
     {"platform", required_argument, 0, 'l'},
     {"partition", required_argument, 0, 'p'},
+    {"pipeline", no_argument, 0, 'P'},
     {"quiet", no_argument, 0, 'q'},
     {"reboot", no_argument, 0, 'r'},
     {"script", required_argument, 0, 's'},
@@ -330,6 +334,10 @@ Return Value:
 
             break;
 
+        case 'P':
+            Context.Flags |= SETUP_FLAG_PIPELINE;
+            break;
+
         case 'l':
             if (SetupParsePlatformString(&Context, optarg) == FALSE) {
                 fprintf(stderr, "Error: Invalid platform '%s'.\n", optarg);
@@ -647,6 +655,23 @@ Return Value:
         goto mainEnd;
     }
 
+    //
+    // Fire up the copy stream if requested. Fall back to copying serially if
+    // it cannot be created.
+    //
+
+    if ((Context.Flags & SETUP_FLAG_PIPELINE) != 0) {
+        Status = SetupCreateCopyStream(&Context);
+        if (Status != 0) {
+            fprintf(stderr,
+                    "Warning: Failed to create copy stream, copying "
+                    "serially: %s.\n",
+                    strerror(Status));
+
+            Context.Flags &= ~SETUP_FLAG_PIPELINE;
+        }
+    }
+
     //
     // Install to a disk.
     //
@@ -768,6 +793,19 @@ Return Value:
         SetupClose(Context.Disk);
     }
 
+    //
+    // Report the throughput now that the last of the cached data has been
+    // written out.
+    //
+
+    if (Context.CopyStream != NULL) {
+        if ((Status == 0) && ((Context.Flags & SETUP_FLAG_QUIET) == 0)) {
+            SetupPrintCopyStreamStatistics(&Context);
+        }
+
+        SetupDestroyCopyStream(&Context);
+    }
+
     if (Context.DiskPath != NULL) {
         SetupDestroyDestination(Context.DiskPath);
     }
@@ -80,6 +80,13 @@ Module Name:
 
 #define SETUP_FLAG_QUIET 0x00000020
 
+//
+// Set this flag to read the install source on a separate thread while the
+// destination is written, and to report the throughput of each stage.
+//
+
+#define SETUP_FLAG_PIPELINE 0x00000040
+
 //
 // Define the name of the source install image.
 //
@@ -137,6 +144,28 @@ Module Name:
 // ------------------------------------------------------ Data Type Definitions
 //
 
+typedef
+PVOID
+(*PSETUP_THREAD_ROUTINE) (
+    PVOID Parameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point prototype for a new thread.
+
+Arguments:
+
+    Parameter - Supplies a pointer supplied by the creator of the thread.
+
+Return Value:
+
+    Returns a pointer value.
+
+--*/
+
 //
 // Define setup recipe IDs, alphabetized by config file name.
 //
@@ -281,6 +310,9 @@ Structure Description:
 
     ArchName - Stores a pointer to the selected architecture name.
 
+    CopyStream - Stores an optional pointer to the pipelined copy stream used
+        to read source files ahead of writing them.
+
 --*/
 
 typedef struct _SETUP_CONTEXT {
@@ -302,10 +334,35 @@ typedef struct _SETUP_CONTEXT {
     PSETUP_CONFIGURATION Configuration;
     PSTR PlatformName;
     PSTR ArchName;
+    PVOID CopyStream;
 } SETUP_CONTEXT, *PSETUP_CONTEXT;
 
 /*++
 
+Structure Description:
+
+    This structure describes the accumulated statistics of writes sent from
+    the block cache to the underlying disks and images.
+
+Members:
+
+    BytesWritten - Stores the number of bytes written.
+
+    Writes - Stores the number of write requests issued. Adjacent dirty blocks
+        are combined into a single request.
+
+    Microseconds - Stores the time spent writing, including verification.
+
+--*/
+
+typedef struct _SETUP_CACHE_STATISTICS {
+    ULONGLONG BytesWritten;
+    ULONGLONG Writes;
+    ULONGLONG Microseconds;
+} SETUP_CACHE_STATISTICS, *PSETUP_CACHE_STATISTICS;
+
+/*++
+
 Structure Description:
 
     This structure describes a handle to a volume in the setup app.
@@ -908,6 +965,244 @@ Return Value:
 
 --*/
 
+INT
+SetupOsCreateThread (
+    PSETUP_THREAD_ROUTINE ThreadRoutine,
+    PVOID Parameter,
+    PVOID *Thread
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new thread.
+
+Arguments:
+
+    ThreadRoutine - Supplies a pointer to the routine to run in the new thread.
+        The thread is destroyed when the supplied routine returns.
+
+    Parameter - Supplies a pointer to a parameter to pass to the thread.
+
+    Thread - Supplies a pointer where a handle to the thread will be returned
+        on success. The caller must wait for the thread with
+        SetupOsWaitForThread.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if threads are not supported.
+
+    Returns an error code on failure.
+
+--*/
+
+VOID
+SetupOsWaitForThread (
+    PVOID Thread
+    );
+
+/*++
+
+Routine Description:
+
+    This routine waits for a thread to exit and releases its handle.
+
+Arguments:
+
+    Thread - Supplies the thread handle returned when the thread was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+INT
+SetupOsCreateLock (
+    PVOID *Lock
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a lock.
+
+Arguments:
+
+    Lock - Supplies a pointer where a pointer to the lock will be returned on
+        success.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if locks are not supported.
+
+    Returns an error code on failure.
+
+--*/
+
+VOID
+SetupOsDestroyLock (
+    PVOID Lock
+    );
+
+/*++
+
+Routine Description:
+
+    This routine destroys a lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+SetupOsAcquireLock (
+    PVOID Lock
+    );
+
+/*++
+
+Routine Description:
+
+    This routine acquires a lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to acquire.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+SetupOsReleaseLock (
+    PVOID Lock
+    );
+
+/*++
+
+Routine Description:
+
+    This routine releases a lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+INT
+SetupOsCreateCondition (
+    PVOID *Condition
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a condition variable.
+
+Arguments:
+
+    Condition - Supplies a pointer where a pointer to the condition variable
+        will be returned on success.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if condition variables are not supported.
+
+    Returns an error code on failure.
+
+--*/
+
+VOID
+SetupOsDestroyCondition (
+    PVOID Condition
+    );
+
+/*++
+
+Routine Description:
+
+    This routine destroys a condition variable.
+
+Arguments:
+
+    Condition - Supplies a pointer to the condition variable to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+SetupOsWaitCondition (
+    PVOID Condition,
+    PVOID Lock
+    );
+
+/*++
+
+Routine Description:
+
+    This routine atomically releases the given lock and waits for the
+    condition to be signaled, then reacquires the lock. Waits can end
+    spuriously, so callers must recheck what they are waiting for.
+
+Arguments:
+
+    Condition - Supplies a pointer to the condition variable to wait on.
+
+    Lock - Supplies a pointer to the lock, which must be held.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+SetupOsSignalCondition (
+    PVOID Condition
+    );
+
+/*++
+
+Routine Description:
+
+    This routine wakes all threads waiting on a condition variable.
+
+Arguments:
+
+    Condition - Supplies a pointer to the condition variable to signal.
+
+Return Value:
+
+    None.
+
+--*/
+
 //
 // Cache wrapper functions for OS layer functionality.
 //
@@ -1171,6 +1466,28 @@ Return Value:
 
 --*/
 
+VOID
+SetupGetCacheStatistics (
+    PSETUP_CACHE_STATISTICS Statistics
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the accumulated statistics of writes from the block
+    cache to the underlying devices.
+
+Arguments:
+
+    Statistics - Supplies a pointer where the statistics will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
 //
 // File I/O functions
 //
@@ -2224,3 +2541,137 @@ Return Value:
 
 --*/
 
+ULONGLONG
+SetupGetMicroseconds (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns a time counter in microseconds, suitable for timing
+    operations.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the current time in microseconds.
+
+--*/
+
+//
+// Copy stream functions
+//
+
+INT
+SetupCreateCopyStream (
+    PSETUP_CONTEXT Context
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates the pipelined copy stream, which reads source files
+    on a separate thread ahead of their data being written out.
+
+Arguments:
+
+    Context - Supplies a pointer to the application context. The stream is
+        stored in the context.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if the host does not support threads.
+
+    Non-zero on failure.
+
+--*/
+
+VOID
+SetupDestroyCopyStream (
+    PSETUP_CONTEXT Context
+    );
+
+/*++
+
+Routine Description:
+
+    This routine stops the reader thread and destroys the pipelined copy
+    stream, if there is one.
+
+Arguments:
+
+    Context - Supplies a pointer to the application context.
+
+Return Value:
+
+    None.
+
+--*/
+
+INT
+SetupStreamCopyFile (
+    PSETUP_CONTEXT Context,
+    PVOID DestinationFile,
+    PVOID SourceFile,
+    ULONGLONG FileSize,
+    PCSTR DestinationPath
+    );
+
+/*++
+
+Routine Description:
+
+    This routine copies the contents of an open file through the copy stream.
+    The reader thread reads the source while this thread writes the
+    destination. The source and destination must be on different volumes.
+
+Arguments:
+
+    Context - Supplies a pointer to the application context.
+
+    DestinationFile - Supplies the open destination file handle.
+
+    SourceFile - Supplies the open source file handle.
+
+    FileSize - Supplies the number of bytes to copy.
+
+    DestinationPath - Supplies the path of the destination, for error messages.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+VOID
+SetupPrintCopyStreamStatistics (
+    PSETUP_CONTEXT Context
+    );
+
+/*++
+
+Routine Description:
+
+    This routine prints the throughput of each stage of the copy stream,
+    along with the writes from the block cache to the devices.
+
+Arguments:
+
+    Context - Supplies a pointer to the application context.
+
+Return Value:
+
+    None.
+
+--*/
+
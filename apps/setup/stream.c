@@ -0,0 +1,660 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    stream.c
+
+Abstract:
+
+    This module implements the pipelined copy stream for the setup
+    application. A reader thread reads source files into a ring of buffers
+    while the main thread writes the buffers out to the destination, so that
+    reading the install source overlaps with writing the target.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "setup.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define SETUP_STREAM_BUFFER_COUNT 4
+#define SETUP_STREAM_BUFFER_SIZE (1024 * 512)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure describes a buffer in the copy stream ring.
+
+Members:
+
+    Data - Stores a pointer to the buffer data.
+
+    Size - Stores the number of bytes read into the buffer, 0 if the source
+        ended early, or -1 if the read failed.
+
+    Error - Stores the error number if the read failed.
+
+--*/
+
+typedef struct _SETUP_STREAM_BUFFER {
+    PVOID Data;
+    ssize_t Size;
+    INT Error;
+} SETUP_STREAM_BUFFER, *PSETUP_STREAM_BUFFER;
+
+/*++
+
+Structure Description:
+
+    This structure describes the accumulated statistics of one stage of the
+    copy stream.
+
+Members:
+
+    Bytes - Stores the number of bytes the stage has processed.
+
+    Microseconds - Stores the time the stage has spent working.
+
+    StallMicroseconds - Stores the time the stage spent waiting on the other
+        stage.
+
+--*/
+
+typedef struct _SETUP_STREAM_STAGE {
+    ULONGLONG Bytes;
+    ULONGLONG Microseconds;
+    ULONGLONG StallMicroseconds;
+} SETUP_STREAM_STAGE, *PSETUP_STREAM_STAGE;
+
+/*++
+
+Structure Description:
+
+    This structure describes the pipelined copy stream.
+
+Members:
+
+    Lock - Stores a pointer to the lock protecting the stream.
+
+    Condition - Stores a pointer to the condition variable signaled whenever
+        the stream state changes.
+
+    Thread - Stores a pointer to the reader thread.
+
+    Buffers - Stores the ring of buffers.
+
+    Head - Stores the index of the oldest full buffer.
+
+    Count - Stores the number of full buffers.
+
+    SourceFile - Stores the file the reader is currently reading, or NULL if
+        the reader is idle.
+
+    Remaining - Stores the number of bytes left for the reader to read from
+        the source file.
+
+    ReaderBusy - Stores a boolean indicating whether the reader is in the
+        middle of a read, outside the lock.
+
+    Exit - Stores a boolean indicating whether the reader thread should exit.
+
+    StartTime - Stores the time the stream was created, in microseconds.
+
+    Files - Stores the number of files copied through the stream.
+
+    Read - Stores the statistics of the reader stage.
+
+    Write - Stores the statistics of the writer stage.
+
+--*/
+
+typedef struct _SETUP_COPY_STREAM {
+    PVOID Lock;
+    PVOID Condition;
+    PVOID Thread;
+    SETUP_STREAM_BUFFER Buffers[SETUP_STREAM_BUFFER_COUNT];
+    ULONG Head;
+    ULONG Count;
+    PVOID SourceFile;
+    ULONGLONG Remaining;
+    BOOL ReaderBusy;
+    BOOL Exit;
+    ULONGLONG StartTime;
+    ULONGLONG Files;
+    SETUP_STREAM_STAGE Read;
+    SETUP_STREAM_STAGE Write;
+} SETUP_COPY_STREAM, *PSETUP_COPY_STREAM;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+PVOID
+SetupStreamReaderThread (
+    PVOID Parameter
+    );
+
+VOID
+SetupPrintStreamStage (
+    PCSTR Name,
+    ULONGLONG Bytes,
+    ULONGLONG Microseconds
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INT
+SetupCreateCopyStream (
+    PSETUP_CONTEXT Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the pipelined copy stream, which reads source files
+    on a separate thread ahead of their data being written out.
+
+Arguments:
+
+    Context - Supplies a pointer to the application context. The stream is
+        stored in the context.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if the host does not support threads.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    UINTN Index;
+    INT Result;
+    PSETUP_COPY_STREAM Stream;
+
+    assert(Context->CopyStream == NULL);
+
+    Stream = malloc(sizeof(SETUP_COPY_STREAM));
+    if (Stream == NULL) {
+        return ENOMEM;
+    }
+
+    memset(Stream, 0, sizeof(SETUP_COPY_STREAM));
+    Context->CopyStream = Stream;
+    for (Index = 0; Index < SETUP_STREAM_BUFFER_COUNT; Index += 1) {
+        Stream->Buffers[Index].Data = malloc(SETUP_STREAM_BUFFER_SIZE);
+        if (Stream->Buffers[Index].Data == NULL) {
+            Result = ENOMEM;
+            goto CreateCopyStreamEnd;
+        }
+    }
+
+    Result = SetupOsCreateLock(&(Stream->Lock));
+    if (Result != 0) {
+        goto CreateCopyStreamEnd;
+    }
+
+    Result = SetupOsCreateCondition(&(Stream->Condition));
+    if (Result != 0) {
+        goto CreateCopyStreamEnd;
+    }
+
+    Stream->StartTime = SetupGetMicroseconds();
+    Result = SetupOsCreateThread(SetupStreamReaderThread,
+                                 Stream,
+                                 &(Stream->Thread));
+
+CreateCopyStreamEnd:
+    if (Result != 0) {
+        SetupDestroyCopyStream(Context);
+    }
+
+    return Result;
+}
+
+VOID
+SetupDestroyCopyStream (
+    PSETUP_CONTEXT Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine stops the reader thread and destroys the pipelined copy
+    stream, if there is one.
+
+Arguments:
+
+    Context - Supplies a pointer to the application context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN Index;
+    PSETUP_COPY_STREAM Stream;
+
+    Stream = Context->CopyStream;
+    if (Stream == NULL) {
+        return;
+    }
+
+    if (Stream->Thread != NULL) {
+        SetupOsAcquireLock(Stream->Lock);
+        Stream->Exit = TRUE;
+        SetupOsSignalCondition(Stream->Condition);
+        SetupOsReleaseLock(Stream->Lock);
+        SetupOsWaitForThread(Stream->Thread);
+    }
+
+    if (Stream->Condition != NULL) {
+        SetupOsDestroyCondition(Stream->Condition);
+    }
+
+    if (Stream->Lock != NULL) {
+        SetupOsDestroyLock(Stream->Lock);
+    }
+
+    for (Index = 0; Index < SETUP_STREAM_BUFFER_COUNT; Index += 1) {
+        if (Stream->Buffers[Index].Data != NULL) {
+            free(Stream->Buffers[Index].Data);
+        }
+    }
+
+    free(Stream);
+    Context->CopyStream = NULL;
+    return;
+}
+
+INT
+SetupStreamCopyFile (
+    PSETUP_CONTEXT Context,
+    PVOID DestinationFile,
+    PVOID SourceFile,
+    ULONGLONG FileSize,
+    PCSTR DestinationPath
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies the contents of an open file through the copy stream.
+    The reader thread reads the source while this thread writes the
+    destination. The source and destination must be on different volumes.
+
+Arguments:
+
+    Context - Supplies a pointer to the application context.
+
+    DestinationFile - Supplies the open destination file handle.
+
+    SourceFile - Supplies the open source file handle.
+
+    FileSize - Supplies the number of bytes to copy.
+
+    DestinationPath - Supplies the path of the destination, for error messages.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    PSETUP_STREAM_BUFFER Buffer;
+    ULONGLONG Duration;
+    INT Result;
+    ssize_t Size;
+    ssize_t SizeWritten;
+    ULONGLONG StartTime;
+    PSETUP_COPY_STREAM Stream;
+
+    Result = 0;
+    Stream = Context->CopyStream;
+    SetupOsAcquireLock(Stream->Lock);
+
+    assert((Stream->SourceFile == NULL) && (Stream->Count == 0));
+
+    Stream->SourceFile = SourceFile;
+    Stream->Remaining = FileSize;
+    Stream->Files += 1;
+    SetupOsSignalCondition(Stream->Condition);
+    while (FileSize != 0) {
+        StartTime = SetupGetMicroseconds();
+        while (Stream->Count == 0) {
+            SetupOsWaitCondition(Stream->Condition, Stream->Lock);
+        }
+
+        Stream->Write.StallMicroseconds += SetupGetMicroseconds() - StartTime;
+        Buffer = &(Stream->Buffers[Stream->Head]);
+        SetupOsReleaseLock(Stream->Lock);
+
+        //
+        // Stop if the read failed or the source came up short.
+        //
+
+        Size = Buffer->Size;
+        if (Size <= 0) {
+            if (Size < 0) {
+                Result = Buffer->Error;
+                if (Result == 0) {
+                    Result = EINVAL;
+                }
+            }
+
+            SetupOsAcquireLock(Stream->Lock);
+            break;
+        }
+
+        StartTime = SetupGetMicroseconds();
+        SizeWritten = SetupFileWrite(DestinationFile, Buffer->Data, Size);
+        if (SizeWritten != Size) {
+            Result = errno;
+            if (Result == 0) {
+                Result = EIO;
+            }
+
+            fprintf(stderr, "Failed to write to file %s.\n", DestinationPath);
+        }
+
+        Duration = SetupGetMicroseconds() - StartTime;
+        SetupOsAcquireLock(Stream->Lock);
+        Stream->Write.Microseconds += Duration;
+        if (Result != 0) {
+            break;
+        }
+
+        Stream->Write.Bytes += Size;
+        Stream->Head = (Stream->Head + 1) % SETUP_STREAM_BUFFER_COUNT;
+        Stream->Count -= 1;
+        FileSize -= Size;
+        SetupOsSignalCondition(Stream->Condition);
+    }
+
+    //
+    // Stop the reader if it is still working on this file, wait for it to
+    // let go of the source, and throw away anything it read ahead.
+    //
+
+    Stream->SourceFile = NULL;
+    Stream->Remaining = 0;
+    while (Stream->ReaderBusy != FALSE) {
+        SetupOsWaitCondition(Stream->Condition, Stream->Lock);
+    }
+
+    Stream->Head = 0;
+    Stream->Count = 0;
+    SetupOsReleaseLock(Stream->Lock);
+    return Result;
+}
+
+VOID
+SetupPrintCopyStreamStatistics (
+    PSETUP_CONTEXT Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the throughput of each stage of the copy stream,
+    along with the writes from the block cache to the devices.
+
+Arguments:
+
+    Context - Supplies a pointer to the application context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    SETUP_CACHE_STATISTICS CacheStatistics;
+    ULONGLONG Elapsed;
+    PSETUP_COPY_STREAM Stream;
+
+    Stream = Context->CopyStream;
+    if (Stream == NULL) {
+        return;
+    }
+
+    SetupGetCacheStatistics(&CacheStatistics);
+    Elapsed = SetupGetMicroseconds() - Stream->StartTime;
+    printf("Pipelined copy: %llu files in %.2f seconds.\n",
+           Stream->Files,
+           (double)Elapsed / 1000000.0);
+
+    printf("%-8s %12s %10s %10s\n", "Stage", "MB", "Seconds", "MB/s");
+    SetupPrintStreamStage("Read",
+                          Stream->Read.Bytes,
+                          Stream->Read.Microseconds);
+
+    SetupPrintStreamStage("Write",
+                          Stream->Write.Bytes,
+                          Stream->Write.Microseconds);
+
+    SetupPrintStreamStage("Device",
+                          CacheStatistics.BytesWritten,
+                          CacheStatistics.Microseconds);
+
+    printf("Reader waited %.2f seconds for free buffers, writer waited %.2f "
+           "seconds for data.\n",
+           (double)Stream->Read.StallMicroseconds / 1000000.0,
+           (double)Stream->Write.StallMicroseconds / 1000000.0);
+
+    printf("Device writes: %llu.\n", CacheStatistics.Writes);
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+PVOID
+SetupStreamReaderThread (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the copy stream reader thread. It fills free
+    buffers from the current source file until told to exit.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the copy stream.
+
+Return Value:
+
+    NULL always.
+
+--*/
+
+{
+
+    PSETUP_STREAM_BUFFER Buffer;
+    ULONGLONG Duration;
+    ssize_t Size;
+    PVOID SourceFile;
+    BOOL Stalled;
+    ULONGLONG StartTime;
+    PSETUP_COPY_STREAM Stream;
+
+    Stream = Parameter;
+    SetupOsAcquireLock(Stream->Lock);
+    while (TRUE) {
+
+        //
+        // Wait for a file to read and a free buffer to read it into. Only
+        // waiting on a full ring counts as a stall.
+        //
+
+        while ((Stream->Exit == FALSE) &&
+               ((Stream->SourceFile == NULL) ||
+                (Stream->Count == SETUP_STREAM_BUFFER_COUNT))) {
+
+            Stalled = FALSE;
+            if (Stream->SourceFile != NULL) {
+                Stalled = TRUE;
+            }
+
+            StartTime = SetupGetMicroseconds();
+            SetupOsWaitCondition(Stream->Condition, Stream->Lock);
+            if (Stalled != FALSE) {
+                Stream->Read.StallMicroseconds += SetupGetMicroseconds() -
+                                                  StartTime;
+            }
+        }
+
+        if (Stream->Exit != FALSE) {
+            break;
+        }
+
+        Buffer = &(Stream->Buffers[(Stream->Head + Stream->Count) %
+                                   SETUP_STREAM_BUFFER_COUNT]);
+
+        SourceFile = Stream->SourceFile;
+        Size = SETUP_STREAM_BUFFER_SIZE;
+        if (Size > Stream->Remaining) {
+            Size = Stream->Remaining;
+        }
+
+        Stream->ReaderBusy = TRUE;
+        SetupOsReleaseLock(Stream->Lock);
+        StartTime = SetupGetMicroseconds();
+        errno = 0;
+        Buffer->Size = SetupFileRead(SourceFile, Buffer->Data, Size);
+        Buffer->Error = errno;
+        Duration = SetupGetMicroseconds() - StartTime;
+        SetupOsAcquireLock(Stream->Lock);
+        Stream->ReaderBusy = FALSE;
+        Stream->Read.Microseconds += Duration;
+
+        //
+        // If the writer gave up on the file in the meantime, it will throw
+        // this buffer away.
+        //
+
+        if (Stream->SourceFile == SourceFile) {
+            if (Buffer->Size > 0) {
+                Stream->Read.Bytes += Buffer->Size;
+                Stream->Remaining -= Buffer->Size;
+
+            } else {
+                Stream->Remaining = 0;
+            }
+
+            if (Stream->Remaining == 0) {
+                Stream->SourceFile = NULL;
+            }
+        }
+
+        Stream->Count += 1;
+        SetupOsSignalCondition(Stream->Condition);
+    }
+
+    SetupOsReleaseLock(Stream->Lock);
+    return NULL;
+}
+
+VOID
+SetupPrintStreamStage (
+    PCSTR Name,
+    ULONGLONG Bytes,
+    ULONGLONG Microseconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints a line of copy stream statistics.
+
+Arguments:
+
+    Name - Supplies the name of the stage.
+
+    Bytes - Supplies the number of bytes the stage processed.
+
+    Microseconds - Supplies the time the stage spent working.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    double Megabytes;
+    double Rate;
+    double Seconds;
+
+    Megabytes = (double)Bytes / (double)_1MB;
+    Seconds = (double)Microseconds / 1000000.0;
+    Rate = 0.0;
+    if (Microseconds != 0) {
+        Rate = Megabytes / Seconds;
+    }
+
+    printf("%-8s %12.1f %10.2f %10.1f\n", Name, Megabytes, Seconds, Rate);
+    return;
+}
+
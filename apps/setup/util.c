@@ -36,6 +36,7 @@ Module Name:
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <time.h>
 
 #include "setup.h"
@@ -1000,6 +1001,27 @@ Return Value:
             goto CopyFileEnd;
         }
 
+        //
+        // Let the copy stream read the source ahead while this thread writes,
+        // as long as the two files are on different volumes.
+        //
+
+        if ((Context->CopyStream != NULL) && (Source != Destination) &&
+            (FileSize > SETUP_FILE_BUFFER_SIZE)) {
+
+            Result = SetupStreamCopyFile(Context,
+                                         DestinationFile,
+                                         SourceFile,
+                                         FileSize,
+                                         DestinationPath);
+
+            if (Result != 0) {
+                goto CopyFileEnd;
+            }
+
+            FileSize = 0;
+        }
+
         //
         // Loop copying chunks.
         //
@@ -1299,6 +1321,36 @@ Return Value:
     return Status;
 }
 
+ULONGLONG
+SetupGetMicroseconds (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns a time counter in microseconds, suitable for timing
+    operations.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the current time in microseconds.
+
+--*/
+
+{
+
+    struct timeval Time;
+
+    gettimeofday(&Time, NULL);
+    return ((ULONGLONG)Time.tv_sec * 1000000ULL) + Time.tv_usec;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -154,6 +154,311 @@ Return Value:
     return ENOSYS;
 }
 
+INT
+SetupOsCreateThread (
+    PSETUP_THREAD_ROUTINE ThreadRoutine,
+    PVOID Parameter,
+    PVOID *Thread
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new thread.
+
+Arguments:
+
+    ThreadRoutine - Supplies a pointer to the routine to run in the new thread.
+        The thread is destroyed when the supplied routine returns.
+
+    Parameter - Supplies a pointer to a parameter to pass to the thread.
+
+    Thread - Supplies a pointer where a handle to the thread will be returned
+        on success. The caller must wait for the thread with
+        SetupOsWaitForThread.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if threads are not supported.
+
+    Returns an error code on failure.
+
+--*/
+
+{
+
+    *Thread = NULL;
+    return ENOSYS;
+}
+
+VOID
+SetupOsWaitForThread (
+    PVOID Thread
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for a thread to exit and releases its handle.
+
+Arguments:
+
+    Thread - Supplies the thread handle returned when the thread was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    assert(FALSE);
+
+    return;
+}
+
+INT
+SetupOsCreateLock (
+    PVOID *Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a lock.
+
+Arguments:
+
+    Lock - Supplies a pointer where a pointer to the lock will be returned on
+        success.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if locks are not supported.
+
+    Returns an error code on failure.
+
+--*/
+
+{
+
+    *Lock = NULL;
+    return ENOSYS;
+}
+
+VOID
+SetupOsDestroyLock (
+    PVOID Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    assert(FALSE);
+
+    return;
+}
+
+VOID
+SetupOsAcquireLock (
+    PVOID Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine acquires a lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to acquire.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    assert(FALSE);
+
+    return;
+}
+
+VOID
+SetupOsReleaseLock (
+    PVOID Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    assert(FALSE);
+
+    return;
+}
+
+INT
+SetupOsCreateCondition (
+    PVOID *Condition
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a condition variable.
+
+Arguments:
+
+    Condition - Supplies a pointer where a pointer to the condition variable
+        will be returned on success.
+
+Return Value:
+
+    0 on success.
+
+    ENOSYS if condition variables are not supported.
+
+    Returns an error code on failure.
+
+--*/
+
+{
+
+    *Condition = NULL;
+    return ENOSYS;
+}
+
+VOID
+SetupOsDestroyCondition (
+    PVOID Condition
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a condition variable.
+
+Arguments:
+
+    Condition - Supplies a pointer to the condition variable to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    assert(FALSE);
+
+    return;
+}
+
+VOID
+SetupOsWaitCondition (
+    PVOID Condition,
+    PVOID Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine atomically releases the given lock and waits for the
+    condition to be signaled, then reacquires the lock. Waits can end
+    spuriously, so callers must recheck what they are waiting for.
+
+Arguments:
+
+    Condition - Supplies a pointer to the condition variable to wait on.
+
+    Lock - Supplies a pointer to the lock, which must be held.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    assert(FALSE);
+
+    return;
+}
+
+VOID
+SetupOsSignalCondition (
+    PVOID Condition
+    )
+
+/*++
+
+Routine Description:
+
+    This routine wakes all threads waiting on a condition variable.
+
+Arguments:
+
+    Condition - Supplies a pointer to the condition variable to signal.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    assert(FALSE);
+
+    return;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -36,6 +36,7 @@ function build() {
     appNames = [
         "dbgtest",
         "filetest",
+        "iobench",
         "ktest",
         "mmaptest",
         "mnttest",
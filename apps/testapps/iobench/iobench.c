@@ -0,0 +1,933 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    iobench.c
+
+Abstract:
+
+    This module implements a small block I/O benchmark that compares
+    synchronous reads and writes against the same workload driven through an
+    I/O ring at a configurable queue depth.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    User Mode
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/types.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioring.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+#define PRINT_ERROR(...) fprintf(stderr, "iobench: " __VA_ARGS__)
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define IO_BENCH_VERSION_MAJOR 1
+#define IO_BENCH_VERSION_MINOR 0
+
+#define IO_BENCH_USAGE                                                         \
+    "Usage: iobench [options]\n"                                               \
+    "This utility measures small block I/O throughput, comparing \n"           \
+    "synchronous calls against an I/O ring. Options are:\n"                    \
+    "  -f, --file <path> -- Set the file to operate on. It is created and \n"  \
+    "      filled if it is smaller than the file size.\n"                      \
+    "  -s, --file-size <size> -- Set the size of the working set in bytes.\n"  \
+    "  -b, --block-size <size> -- Set the size of each I/O in bytes.\n"        \
+    "  -q, --queue-depth <count> -- Set the number of ring operations kept \n" \
+    "      in flight.\n"                                                       \
+    "  -n, --count <count> -- Set the number of I/Os to perform per mode.\n"   \
+    "  -m, --mode <mode> -- Set the mode to measure: sync, ring, or both.\n"   \
+    "  -w, --write -- Perform writes instead of reads.\n"                      \
+    "  -r, --random -- Use random offsets instead of sequential ones.\n"       \
+    "  -S, --seed <int> -- Set the random seed.\n"                             \
+    "  --no-cleanup -- Leave the file in place when finished.\n"               \
+    "  --help -- Print this help text and exit.\n"                             \
+    "  --version -- Print the version and exit.\n"                             \
+
+#define IO_BENCH_OPTIONS_STRING "f:s:b:q:n:m:wrS:khV"
+
+#define IO_BENCH_CREATE_PERMISSIONS (S_IRUSR | S_IWUSR)
+
+#define DEFAULT_FILE_NAME "iobench.dat"
+#define DEFAULT_FILE_SIZE (16 * 1024 * 1024)
+#define DEFAULT_BLOCK_SIZE 4096
+#define DEFAULT_QUEUE_DEPTH 16
+#define DEFAULT_IO_COUNT 8192
+
+#define IO_BENCH_MODE_SYNC 0x1
+#define IO_BENCH_MODE_RING 0x2
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines the parameters of a benchmark run.
+
+Members:
+
+    FileDescriptor - Stores the open descriptor of the file under test.
+
+    BlockSize - Stores the size of each I/O in bytes.
+
+    BlockCount - Stores the number of blocks in the working set.
+
+    IoCount - Stores the number of I/Os to perform.
+
+    QueueDepth - Stores the number of ring operations to keep in flight.
+
+    Write - Stores a boolean indicating whether to write rather than read.
+
+    Random - Stores a boolean indicating whether to pick random offsets.
+
+--*/
+
+typedef struct _IO_BENCH_PARAMETERS {
+    INT FileDescriptor;
+    size_t BlockSize;
+    ULONGLONG BlockCount;
+    ULONG IoCount;
+    ULONG QueueDepth;
+    BOOL Write;
+    BOOL Random;
+} IO_BENCH_PARAMETERS, *PIO_BENCH_PARAMETERS;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+INT
+IoBenchPrepareFile (
+    PIO_BENCH_PARAMETERS Parameters,
+    off_t FileSize
+    );
+
+INT
+IoBenchRunSynchronous (
+    PIO_BENCH_PARAMETERS Parameters,
+    double *Seconds
+    );
+
+INT
+IoBenchRunRing (
+    PIO_BENCH_PARAMETERS Parameters,
+    double *Seconds
+    );
+
+off_t
+IoBenchGetOffset (
+    PIO_BENCH_PARAMETERS Parameters,
+    ULONG Index
+    );
+
+double
+IoBenchGetTime (
+    VOID
+    );
+
+VOID
+IoBenchPrintResult (
+    PSTR Mode,
+    PIO_BENCH_PARAMETERS Parameters,
+    double Seconds
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+struct option IoBenchLongOptions[] = {
+    {"file", required_argument, 0, 'f'},
+    {"file-size", required_argument, 0, 's'},
+    {"block-size", required_argument, 0, 'b'},
+    {"queue-depth", required_argument, 0, 'q'},
+    {"count", required_argument, 0, 'n'},
+    {"mode", required_argument, 0, 'm'},
+    {"write", no_argument, 0, 'w'},
+    {"random", no_argument, 0, 'r'},
+    {"seed", required_argument, 0, 'S'},
+    {"no-cleanup", no_argument, 0, 'k'},
+    {"help", no_argument, 0, 'h'},
+    {"version", no_argument, 0, 'V'},
+    {NULL, 0, 0, 0},
+};
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+int
+main (
+    int ArgumentCount,
+    char **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the I/O benchmark program.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of elements in the arguments array.
+
+    Arguments - Supplies an array of strings. The array count is bounded by the
+        previous parameter, and the strings are null-terminated.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    PSTR AfterScan;
+    BOOL Cleanup;
+    PSTR FileName;
+    LONGLONG FileSize;
+    ULONG Modes;
+    INT Option;
+    IO_BENCH_PARAMETERS Parameters;
+    double Seconds;
+    INT Seed;
+    INT Status;
+    LONGLONG Value;
+
+    Cleanup = TRUE;
+    FileName = DEFAULT_FILE_NAME;
+    FileSize = DEFAULT_FILE_SIZE;
+    Modes = IO_BENCH_MODE_SYNC | IO_BENCH_MODE_RING;
+    memset(&Parameters, 0, sizeof(IO_BENCH_PARAMETERS));
+    Parameters.FileDescriptor = -1;
+    Parameters.BlockSize = DEFAULT_BLOCK_SIZE;
+    Parameters.IoCount = DEFAULT_IO_COUNT;
+    Parameters.QueueDepth = DEFAULT_QUEUE_DEPTH;
+    Seed = time(NULL) ^ getpid();
+    Status = 0;
+
+    //
+    // Process the control arguments.
+    //
+
+    while (TRUE) {
+        Option = getopt_long(ArgumentCount,
+                             Arguments,
+                             IO_BENCH_OPTIONS_STRING,
+                             IoBenchLongOptions,
+                             NULL);
+
+        if (Option == -1) {
+            break;
+        }
+
+        if ((Option == '?') || (Option == ':')) {
+            Status = 1;
+            goto MainEnd;
+        }
+
+        switch (Option) {
+        case 'f':
+            FileName = optarg;
+            break;
+
+        case 's':
+            FileSize = strtoll(optarg, &AfterScan, 0);
+            if ((FileSize <= 0) || (AfterScan == optarg)) {
+                PRINT_ERROR("Invalid file size %s.\n", optarg);
+                Status = 1;
+                goto MainEnd;
+            }
+
+            break;
+
+        case 'b':
+            Value = strtoll(optarg, &AfterScan, 0);
+            if ((Value <= 0) || (AfterScan == optarg)) {
+                PRINT_ERROR("Invalid block size %s.\n", optarg);
+                Status = 1;
+                goto MainEnd;
+            }
+
+            Parameters.BlockSize = Value;
+            break;
+
+        case 'q':
+            Value = strtoll(optarg, &AfterScan, 0);
+            if ((Value <= 0) || (Value > IORING_MAX_ENTRIES) ||
+                (AfterScan == optarg)) {
+
+                PRINT_ERROR("Invalid queue depth %s.\n", optarg);
+                Status = 1;
+                goto MainEnd;
+            }
+
+            Parameters.QueueDepth = Value;
+            break;
+
+        case 'n':
+            Value = strtoll(optarg, &AfterScan, 0);
+            if ((Value <= 0) || (Value > MAX_LONG) || (AfterScan == optarg)) {
+                PRINT_ERROR("Invalid I/O count %s.\n", optarg);
+                Status = 1;
+                goto MainEnd;
+            }
+
+            Parameters.IoCount = Value;
+            break;
+
+        case 'm':
+            if (strcasecmp(optarg, "sync") == 0) {
+                Modes = IO_BENCH_MODE_SYNC;
+
+            } else if (strcasecmp(optarg, "ring") == 0) {
+                Modes = IO_BENCH_MODE_RING;
+
+            } else if (strcasecmp(optarg, "both") == 0) {
+                Modes = IO_BENCH_MODE_SYNC | IO_BENCH_MODE_RING;
+
+            } else {
+                PRINT_ERROR("Invalid mode: %s.\n", optarg);
+                Status = 1;
+                goto MainEnd;
+            }
+
+            break;
+
+        case 'w':
+            Parameters.Write = TRUE;
+            break;
+
+        case 'r':
+            Parameters.Random = TRUE;
+            break;
+
+        case 'S':
+            Seed = strtol(optarg, &AfterScan, 0);
+            if (AfterScan == optarg) {
+                PRINT_ERROR("Invalid seed %s.\n", optarg);
+                Status = 1;
+                goto MainEnd;
+            }
+
+            break;
+
+        case 'k':
+            Cleanup = FALSE;
+            break;
+
+        case 'V':
+            printf("Minoca iobench version %d.%d\n",
+                   IO_BENCH_VERSION_MAJOR,
+                   IO_BENCH_VERSION_MINOR);
+
+            return 1;
+
+        case 'h':
+            printf(IO_BENCH_USAGE);
+            return 1;
+
+        default:
+
+            assert(FALSE);
+
+            Status = 1;
+            goto MainEnd;
+        }
+    }
+
+    Parameters.BlockCount = FileSize / Parameters.BlockSize;
+    if (Parameters.BlockCount == 0) {
+        PRINT_ERROR("The file size must be at least one block.\n");
+        Status = 1;
+        goto MainEnd;
+    }
+
+    srand(Seed);
+    Parameters.FileDescriptor = open(FileName,
+                                     O_RDWR | O_CREAT,
+                                     IO_BENCH_CREATE_PERMISSIONS);
+
+    if (Parameters.FileDescriptor < 0) {
+        Status = errno;
+        PRINT_ERROR("Failed to open %s: %s.\n", FileName, strerror(Status));
+        goto MainEnd;
+    }
+
+    Status = IoBenchPrepareFile(&Parameters, FileSize);
+    if (Status != 0) {
+        PRINT_ERROR("Failed to fill %s: %s.\n", FileName, strerror(Status));
+        goto MainEnd;
+    }
+
+    printf("%s %s, %ld byte blocks, %lu I/Os, %llu byte working set, "
+           "seed %d\n",
+           (Parameters.Random != FALSE) ? "random" : "sequential",
+           (Parameters.Write != FALSE) ? "writes" : "reads",
+           (long)Parameters.BlockSize,
+           (unsigned long)Parameters.IoCount,
+           (unsigned long long)Parameters.BlockCount * Parameters.BlockSize,
+           Seed);
+
+    if ((Modes & IO_BENCH_MODE_SYNC) != 0) {
+        Status = IoBenchRunSynchronous(&Parameters, &Seconds);
+        if (Status != 0) {
+            PRINT_ERROR("Synchronous run failed: %s.\n", strerror(Status));
+            goto MainEnd;
+        }
+
+        IoBenchPrintResult("sync", &Parameters, Seconds);
+    }
+
+    if ((Modes & IO_BENCH_MODE_RING) != 0) {
+        Status = IoBenchRunRing(&Parameters, &Seconds);
+        if (Status != 0) {
+            PRINT_ERROR("Ring run failed: %s.\n", strerror(Status));
+            goto MainEnd;
+        }
+
+        IoBenchPrintResult("ring", &Parameters, Seconds);
+    }
+
+MainEnd:
+    if (Parameters.FileDescriptor >= 0) {
+        close(Parameters.FileDescriptor);
+        if (Cleanup != FALSE) {
+            unlink(FileName);
+        }
+    }
+
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+INT
+IoBenchPrepareFile (
+    PIO_BENCH_PARAMETERS Parameters,
+    off_t FileSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes sure the file under test covers the working set, so
+    that reads return data rather than hitting the end of the file.
+
+Arguments:
+
+    Parameters - Supplies a pointer to the benchmark parameters.
+
+    FileSize - Supplies the desired size of the file in bytes.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    PUCHAR Buffer;
+    ssize_t BytesWritten;
+    off_t Offset;
+    struct stat Stat;
+    INT Status;
+
+    Buffer = NULL;
+    if (fstat(Parameters->FileDescriptor, &Stat) != 0) {
+        Status = errno;
+        goto PrepareFileEnd;
+    }
+
+    if (Stat.st_size >= FileSize) {
+        Status = 0;
+        goto PrepareFileEnd;
+    }
+
+    Buffer = malloc(Parameters->BlockSize);
+    if (Buffer == NULL) {
+        Status = ENOMEM;
+        goto PrepareFileEnd;
+    }
+
+    memset(Buffer, 0xA5, Parameters->BlockSize);
+    for (Offset = 0;
+         Offset < Parameters->BlockCount * Parameters->BlockSize;
+         Offset += Parameters->BlockSize) {
+
+        do {
+            BytesWritten = pwrite(Parameters->FileDescriptor,
+                                  Buffer,
+                                  Parameters->BlockSize,
+                                  Offset);
+
+        } while ((BytesWritten < 0) && (errno == EINTR));
+
+        if (BytesWritten < 0) {
+            Status = errno;
+            goto PrepareFileEnd;
+        }
+
+        if (BytesWritten != Parameters->BlockSize) {
+            Status = EIO;
+            goto PrepareFileEnd;
+        }
+    }
+
+    if (fsync(Parameters->FileDescriptor) != 0) {
+        Status = errno;
+        goto PrepareFileEnd;
+    }
+
+    Status = 0;
+
+PrepareFileEnd:
+    if (Buffer != NULL) {
+        free(Buffer);
+    }
+
+    return Status;
+}
+
+INT
+IoBenchRunSynchronous (
+    PIO_BENCH_PARAMETERS Parameters,
+    double *Seconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the workload one system call at a time.
+
+Arguments:
+
+    Parameters - Supplies a pointer to the benchmark parameters.
+
+    Seconds - Supplies a pointer where the elapsed time will be returned.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    PUCHAR Buffer;
+    ssize_t BytesDone;
+    ULONG Index;
+    off_t Offset;
+    double Start;
+    INT Status;
+
+    Buffer = malloc(Parameters->BlockSize);
+    if (Buffer == NULL) {
+        return ENOMEM;
+    }
+
+    memset(Buffer, 0x5A, Parameters->BlockSize);
+    Status = 0;
+    Start = IoBenchGetTime();
+    for (Index = 0; Index < Parameters->IoCount; Index += 1) {
+        Offset = IoBenchGetOffset(Parameters, Index);
+        do {
+            if (Parameters->Write != FALSE) {
+                BytesDone = pwrite(Parameters->FileDescriptor,
+                                   Buffer,
+                                   Parameters->BlockSize,
+                                   Offset);
+
+            } else {
+                BytesDone = pread(Parameters->FileDescriptor,
+                                  Buffer,
+                                  Parameters->BlockSize,
+                                  Offset);
+            }
+
+        } while ((BytesDone < 0) && (errno == EINTR));
+
+        if (BytesDone < 0) {
+            Status = errno;
+            break;
+        }
+
+        if (BytesDone != Parameters->BlockSize) {
+            Status = EIO;
+            break;
+        }
+    }
+
+    *Seconds = IoBenchGetTime() - Start;
+    free(Buffer);
+    return Status;
+}
+
+INT
+IoBenchRunRing (
+    PIO_BENCH_PARAMETERS Parameters,
+    double *Seconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the workload through an I/O ring, keeping up to the
+    queue depth operations in flight and reaping completions directly out of
+    the shared completion array.
+
+Arguments:
+
+    Parameters - Supplies a pointer to the benchmark parameters.
+
+    Seconds - Supplies a pointer where the elapsed time will be returned.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    PUCHAR Buffers;
+    ULONG Completed;
+    struct ioring_completion *Completion;
+    struct ioring_completion *Completions;
+    ULONG EntryCount;
+    ULONG FreeCount;
+    PULONG FreeSlots;
+    struct ioring_header *Header;
+    ULONG Issued;
+    long PageSize;
+    ULONG Pending;
+    INT Result;
+    INT Ring;
+    size_t RingSize;
+    ULONG Slot;
+    double Start;
+    INT Status;
+    struct ioring_submission *Submission;
+    struct ioring_submission *Submissions;
+    ULONG Wait;
+
+    Buffers = NULL;
+    FreeSlots = NULL;
+    Header = NULL;
+    Ring = -1;
+    Start = IoBenchGetTime();
+
+    //
+    // Ring entry counts must be powers of two.
+    //
+
+    EntryCount = 1;
+    while (EntryCount < Parameters->QueueDepth) {
+        EntryCount <<= 1;
+    }
+
+    PageSize = sysconf(_SC_PAGESIZE);
+    RingSize = IORING_BUFFER_SIZE(EntryCount, EntryCount);
+    RingSize = (RingSize + PageSize - 1) & ~(PageSize - 1);
+    Status = posix_memalign((void **)&Header, PageSize, RingSize);
+    if (Status != 0) {
+        Header = NULL;
+        goto RunRingEnd;
+    }
+
+    memset(Header, 0, RingSize);
+    Buffers = malloc(Parameters->QueueDepth * Parameters->BlockSize);
+    FreeSlots = malloc(Parameters->QueueDepth * sizeof(ULONG));
+    if ((Buffers == NULL) || (FreeSlots == NULL)) {
+        Status = ENOMEM;
+        goto RunRingEnd;
+    }
+
+    memset(Buffers, 0x5A, Parameters->QueueDepth * Parameters->BlockSize);
+    for (Slot = 0; Slot < Parameters->QueueDepth; Slot += 1) {
+        FreeSlots[Slot] = Slot;
+    }
+
+    FreeCount = Parameters->QueueDepth;
+    Ring = ioring_create(Header, RingSize, EntryCount, EntryCount, O_CLOEXEC);
+    if (Ring < 0) {
+        Status = errno;
+        goto RunRingEnd;
+    }
+
+    Submissions = IORING_SUBMISSIONS(Header);
+    Completions = IORING_COMPLETIONS(Header);
+    Completed = 0;
+    Issued = 0;
+    Start = IoBenchGetTime();
+    while (Completed < Parameters->IoCount) {
+
+        //
+        // Fill the submission array up to the queue depth.
+        //
+
+        while ((FreeCount != 0) && (Issued < Parameters->IoCount)) {
+            FreeCount -= 1;
+            Slot = FreeSlots[FreeCount];
+            Submission = &(Submissions[Header->submit_tail & (EntryCount - 1)]);
+            memset(Submission, 0, sizeof(struct ioring_submission));
+            Submission->user_data = Slot;
+            Submission->offset = IoBenchGetOffset(Parameters, Issued);
+            Submission->buffer = Buffers + (Slot * Parameters->BlockSize);
+            Submission->size = Parameters->BlockSize;
+            Submission->descriptor = Parameters->FileDescriptor;
+            Submission->operation = IORING_OP_READ;
+            if (Parameters->Write != FALSE) {
+                Submission->operation = IORING_OP_WRITE;
+            }
+
+            Submission->timeout = -1;
+
+            //
+            // Make sure the entry is visible before the tail moves over it.
+            //
+
+            __sync_synchronize();
+            Header->submit_tail += 1;
+            Issued += 1;
+        }
+
+        //
+        // Hand off whatever is pending. Only block if there is nothing else
+        // to do, which is when no completions are waiting to be reaped.
+        //
+
+        Pending = Header->submit_tail - Header->submit_head;
+        Wait = 0;
+        if (Header->complete_tail == Header->complete_head) {
+            Wait = 1;
+        }
+
+        if ((Pending != 0) || (Wait != 0)) {
+            Result = ioring_enter(Ring, Pending, Wait, -1);
+            if ((Result < 0) && (errno != EINTR)) {
+                Status = errno;
+                goto RunRingEnd;
+            }
+        }
+
+        //
+        // Reap completions straight out of shared memory.
+        //
+
+        while (Header->complete_head != Header->complete_tail) {
+            __sync_synchronize();
+            Completion =
+                   &(Completions[Header->complete_head & (EntryCount - 1)]);
+
+            Status = ioring_error(Completion->status);
+            if (Status == 0) {
+                if (Completion->bytes_completed != Parameters->BlockSize) {
+                    Status = EIO;
+                }
+            }
+
+            if (Status != 0) {
+                goto RunRingEnd;
+            }
+
+            FreeSlots[FreeCount] = (ULONG)Completion->user_data;
+            FreeCount += 1;
+            Header->complete_head += 1;
+            Completed += 1;
+        }
+    }
+
+    Status = 0;
+
+RunRingEnd:
+    *Seconds = IoBenchGetTime() - Start;
+    if (Ring >= 0) {
+
+        //
+        // Operations still in flight after a failure keep the ring alive
+        // until they finish. The benchmark exits on failure, so there is no
+        // need to drain them first.
+        //
+
+        close(Ring);
+    }
+
+    if (Buffers != NULL) {
+        free(Buffers);
+    }
+
+    if (FreeSlots != NULL) {
+        free(FreeSlots);
+    }
+
+    if (Header != NULL) {
+        free(Header);
+    }
+
+    return Status;
+}
+
+off_t
+IoBenchGetOffset (
+    PIO_BENCH_PARAMETERS Parameters,
+    ULONG Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the file offset of the given I/O.
+
+Arguments:
+
+    Parameters - Supplies a pointer to the benchmark parameters.
+
+    Index - Supplies the index of the I/O within the run.
+
+Return Value:
+
+    Returns the byte offset to operate on.
+
+--*/
+
+{
+
+    ULONGLONG Block;
+
+    if (Parameters->Random != FALSE) {
+        Block = (((ULONGLONG)rand() << 16) ^ rand()) % Parameters->BlockCount;
+
+    } else {
+        Block = Index % Parameters->BlockCount;
+    }
+
+    return Block * Parameters->BlockSize;
+}
+
+double
+IoBenchGetTime (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the current monotonic time.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the current time in seconds.
+
+--*/
+
+{
+
+    struct timespec Time;
+
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return (double)Time.tv_sec + ((double)Time.tv_nsec / 1000000000.0);
+}
+
+VOID
+IoBenchPrintResult (
+    PSTR Mode,
+    PIO_BENCH_PARAMETERS Parameters,
+    double Seconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the results of one run.
+
+Arguments:
+
+    Mode - Supplies the name of the mode that was run.
+
+    Parameters - Supplies a pointer to the benchmark parameters.
+
+    Seconds - Supplies the elapsed time of the run.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    double Bytes;
+
+    if (Seconds <= 0) {
+        Seconds = 0.000001;
+    }
+
+    Bytes = (double)Parameters->IoCount * Parameters->BlockSize;
+    printf("%-4s qd %-4lu %10.3f s %12.0f IOPS %10.2f MB/s\n",
+           Mode,
+           (Mode[0] == 'r') ? (unsigned long)Parameters->QueueDepth : 1UL,
+           Seconds,
+           Parameters->IoCount / Seconds,
+           Bytes / Seconds / (1024.0 * 1024.0));
+
+    return;
+}
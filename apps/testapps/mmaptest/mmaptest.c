@@ -78,7 +78,7 @@ Module Name:
     "  -i, --iterations <count> -- Set the number of operations to perform.\n" \
     "  -p, --threads <count> -- Set the number of threads to spin up.\n"       \
     "  -t, --test -- Set the test to perform. Valid values are all, \n"        \
-    "      basic, private, shared, shmprivate, and shmshared.\n"               \
+    "      basic, private, shared, shmprivate, shmshared, and sequential.\n"   \
     "  --debug -- Print lots of information about what's happening.\n"         \
     "  --quiet -- Print only errors.\n"                                        \
     "  --no-cleanup -- Leave test files around for debugging.\n"               \
@@ -94,6 +94,14 @@ Module Name:
 #define DEFAULT_OPERATION_COUNT (DEFAULT_FILE_COUNT * 50)
 #define DEFAULT_THREAD_COUNT 1
 
+//
+// Define the size of the file used by the sequential read test, and the
+// number of iterations per pass over the file.
+//
+
+#define SEQUENTIAL_TEST_FILE_SIZE (8 * 1024 * 1024)
+#define SEQUENTIAL_TEST_ITERATIONS_PER_PASS 100
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -121,7 +129,8 @@ typedef enum _MEMORY_MAP_TEST_TYPE {
     MemoryMapTestPrivate,
     MemoryMapTestShared,
     MemoryMapTestShmPrivate,
-    MemoryMapTestShmShared
+    MemoryMapTestShmShared,
+    MemoryMapTestSequential
 } MEMORY_MAP_TEST_TYPE, *PMEMORY_MAP_TEST_TYPE;
 
 typedef
@@ -198,6 +207,11 @@ RunMemoryMapShmSharedTest (
     INT Iterations
     );
 
+ULONG
+RunMemoryMapSequentialTest (
+    INT Iterations
+    );
+
 static
 VOID
 MemoryMapTestExpectedSignalHandler (
@@ -437,6 +451,9 @@ Return Value:
             } else if (strcasecmp(optarg, "shmshared") == 0) {
                 Test = MemoryMapTestShmShared;
 
+            } else if (strcasecmp(optarg, "sequential") == 0) {
+                Test = MemoryMapTestSequential;
+
             } else {
                 PRINT_ERROR("Invalid test: %s.\n", optarg);
                 Status = 1;
@@ -533,6 +550,10 @@ Return Value:
         Failures += RunMemoryMapShmSharedTest(FileCount, FileSize, Iterations);
     }
 
+    if ((Test == MemoryMapTestAll) || (Test == MemoryMapTestSequential)) {
+        Failures += RunMemoryMapSequentialTest(Iterations);
+    }
+
     //
     // Wait for any children.
     //
@@ -3018,6 +3039,210 @@ Return Value:
     return Failures;
 }
 
+ULONG
+RunMemoryMapSequentialTest (
+    INT Iterations
+    )
+
+/*++
+
+Routine Description:
+
+    This routine times sequential reads through a freshly mapped file. The
+    file stays in the page cache between passes, so this mostly measures the
+    cost of the page faults taken to map it.
+
+Arguments:
+
+    Iterations - Supplies the number of iterations to perform. One pass over
+        the file is made for every hundred iterations.
+
+Return Value:
+
+    Returns the number of failures in the test.
+
+--*/
+
+{
+
+    ssize_t BytesComplete;
+    ULONG Failures;
+    INT File;
+    PINT FileBuffer;
+    CHAR FileName[16];
+    INT FillIndex;
+    PBYTE MapBuffer;
+    INT OpenFlags;
+    long PageSize;
+    INT Pass;
+    INT PassCount;
+    pid_t Process;
+    INT Result;
+    struct sigaction SignalAction;
+    struct timeval StartTime;
+    size_t TotalBytesComplete;
+    ULONG Value;
+    size_t ValueOffset;
+
+    Failures = 0;
+    File = -1;
+    FileBuffer = NULL;
+    MapBuffer = MAP_FAILED;
+    PageSize = sysconf(_SC_PAGESIZE);
+    PassCount = Iterations / SEQUENTIAL_TEST_ITERATIONS_PER_PASS;
+    if (PassCount == 0) {
+        PassCount = 1;
+    }
+
+    SignalAction.sa_sigaction = MemoryMapTestUnexpectedSignalHandler;
+    sigemptyset(&(SignalAction.sa_mask));
+    SignalAction.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &SignalAction, NULL);
+    sigaction(SIGBUS, &SignalAction, NULL);
+
+    //
+    // Create a file filled with each word's own offset.
+    //
+
+    Process = getpid();
+    PRINT("Process %d Running memory map sequential read test with %d "
+          "passes over %d bytes.\n",
+          Process,
+          PassCount,
+          SEQUENTIAL_TEST_FILE_SIZE);
+
+    snprintf(FileName, sizeof(FileName), "mmsq-%06x", Process);
+    OpenFlags = O_RDWR | O_CREAT | O_TRUNC;
+    File = open(FileName, OpenFlags, MEMORY_MAP_TEST_CREATE_PERMISSIONS);
+    if (File < 0) {
+        PRINT_ERROR("Failed to open file %s (flags %x): %s.\n",
+                    FileName,
+                    OpenFlags,
+                    strerror(errno));
+
+        Failures += 1;
+        goto RunMemoryMapSequentialTestEnd;
+    }
+
+    FileBuffer = malloc(SEQUENTIAL_TEST_FILE_SIZE);
+    if (FileBuffer == NULL) {
+        Failures += 1;
+        goto RunMemoryMapSequentialTestEnd;
+    }
+
+    for (FillIndex = 0;
+         FillIndex < SEQUENTIAL_TEST_FILE_SIZE / sizeof(INT);
+         FillIndex += 1) {
+
+        FileBuffer[FillIndex] = FillIndex * sizeof(INT);
+    }
+
+    TotalBytesComplete = 0;
+    while (TotalBytesComplete < SEQUENTIAL_TEST_FILE_SIZE) {
+        BytesComplete = write(File,
+                              (PBYTE)FileBuffer + TotalBytesComplete,
+                              SEQUENTIAL_TEST_FILE_SIZE - TotalBytesComplete);
+
+        if (BytesComplete <= 0) {
+            PRINT_ERROR("Write failed. Wrote %d of %d bytes: %s.\n",
+                        (INT)TotalBytesComplete,
+                        SEQUENTIAL_TEST_FILE_SIZE,
+                        strerror(errno));
+
+            Failures += 1;
+            goto RunMemoryMapSequentialTestEnd;
+        }
+
+        TotalBytesComplete += BytesComplete;
+    }
+
+    //
+    // Map the file and touch every page in order, checking the contents.
+    //
+
+    Result = gettimeofday(&StartTime, NULL);
+    if (Result != 0) {
+        PRINT_ERROR("Failed to get time of day: %s.\n", strerror(errno));
+        Failures += 1;
+        goto RunMemoryMapSequentialTestEnd;
+    }
+
+    for (Pass = 0; Pass < PassCount; Pass += 1) {
+        MapBuffer = mmap(0,
+                         SEQUENTIAL_TEST_FILE_SIZE,
+                         PROT_READ,
+                         MAP_PRIVATE,
+                         File,
+                         0);
+
+        if (MapBuffer == MAP_FAILED) {
+            PRINT_ERROR("Failed to map file %s for %x bytes: %s\n",
+                        FileName,
+                        SEQUENTIAL_TEST_FILE_SIZE,
+                        strerror(errno));
+
+            Failures += 1;
+            goto RunMemoryMapSequentialTestEnd;
+        }
+
+        for (ValueOffset = 0;
+             ValueOffset < SEQUENTIAL_TEST_FILE_SIZE;
+             ValueOffset += PageSize) {
+
+            Value = *((PULONG)(MapBuffer + ValueOffset));
+            if (Value != ValueOffset) {
+                PRINT_ERROR("Read %x at offset %x of %s, expected %x.\n",
+                            Value,
+                            (ULONG)ValueOffset,
+                            FileName,
+                            (ULONG)ValueOffset);
+
+                Failures += 1;
+            }
+        }
+
+        Result = munmap(MapBuffer, SEQUENTIAL_TEST_FILE_SIZE);
+        MapBuffer = MAP_FAILED;
+        if (Result != 0) {
+            PRINT_ERROR("Failed to unmap file %s: %s.\n",
+                        FileName,
+                        strerror(errno));
+
+            Failures += 1;
+        }
+
+        PRINT("q");
+    }
+
+    PRINT("\n");
+    Failures += PrintTestTime(&StartTime);
+
+RunMemoryMapSequentialTestEnd:
+    if (MapBuffer != MAP_FAILED) {
+        munmap(MapBuffer, SEQUENTIAL_TEST_FILE_SIZE);
+    }
+
+    if (FileBuffer != NULL) {
+        free(FileBuffer);
+    }
+
+    if (File >= 0) {
+        close(File);
+        if (MemoryMapTestNoCleanup == FALSE) {
+            Result = unlink(FileName);
+            if (Result != 0) {
+                PRINT_ERROR("Failed to unlink file %s: %s.\n",
+                            FileName,
+                            strerror(errno));
+
+                Failures += 1;
+            }
+        }
+    }
+
+    return Failures;
+}
+
 static
 VOID
 MemoryMapTestExpectedSignalHandler (
@@ -42,6 +42,7 @@ function build() {
         "dup.c",
         "getppid.c",
         "exec.c",
+        "flock.c",
         "fork.c",
         "malloc.c",
         "mmap.c",
@@ -55,6 +56,7 @@ function build() {
         "rename.c",
         "signal.c",
         "stat.c",
+        "unixsock.c",
         "write.c"
     ];
 
@@ -14,7 +14,8 @@ Module Name:
 Abstract:
 
     This module implements the performance benchmark tests for the creat() and
-    remove() C library calls.
+    remove() C library calls, alone and in the create, write, remove cycle of
+    a build's temporary files.
 
 Author:
 
@@ -33,6 +34,7 @@ Module Name:
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -44,6 +46,14 @@ Module Name:
 
 #define PT_CREATE_TEST_FILE_NAME_LENGTH 48
 
+//
+// Define the number of files the create write test creates before removing
+// them all, and how much it writes to each.
+//
+
+#define PT_CREATE_WRITE_TEST_BATCH_SIZE 64
+#define PT_CREATE_WRITE_TEST_FILE_SIZE 4096
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -52,6 +62,13 @@ Module Name:
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+int
+PtpCreateWriteBatch (
+    pid_t ProcessId,
+    char *Buffer,
+    unsigned long long *Iterations
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -87,6 +104,7 @@ Return Value:
 
 {
 
+    char Buffer[PT_CREATE_WRITE_TEST_FILE_SIZE];
     int FileDescriptor;
     char FileName[PT_CREATE_TEST_FILE_NAME_LENGTH];
     unsigned long long Iterations;
@@ -96,6 +114,7 @@ Return Value:
     Iterations = 0;
     Result->Type = PtResultIterations;
     Result->Status = 0;
+    memset(Buffer, 'o', sizeof(Buffer));
 
     //
     // Get the process ID and create a process safe file path to create and
@@ -123,6 +142,23 @@ Return Value:
         goto MainEnd;
     }
 
+    //
+    // Measure a build's temporary file churn by counting the number of files
+    // that can be created, written, and later removed in batches.
+    //
+
+    if (Test->TestType == PtTestCreateWrite) {
+        while (PtIsTimedTestRunning() != 0) {
+            Status = PtpCreateWriteBatch(ProcessId, Buffer, &Iterations);
+            if (Status != 0) {
+                Result->Status = Status;
+                break;
+            }
+        }
+
+        goto MainFinish;
+    }
+
     //
     // Measure the performance of the creat() and remove() C library routines
     // by counting the number of times a file can be created and removed.
@@ -150,6 +186,7 @@ Return Value:
         Iterations += 1;
     }
 
+MainFinish:
     Status = PtFinishTimedTest(Result);
     if ((Status != 0) && (Result->Status == 0)) {
         Result->Status = errno;
@@ -164,3 +201,106 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+int
+PtpCreateWriteBatch (
+    pid_t ProcessId,
+    char *Buffer,
+    unsigned long long *Iterations
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates and writes a batch of small files, then removes them
+    all, the way a compiler leaves and a build cleans object files.
+
+Arguments:
+
+    ProcessId - Supplies the ID of the current process, used to keep file
+        names unique.
+
+    Buffer - Supplies a pointer to the data to write to each file.
+
+    Iterations - Supplies a pointer to the running count of files, which is
+        incremented for each file created.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    ssize_t BytesWritten;
+    int Error;
+    int FileDescriptor;
+    char FileName[PT_CREATE_TEST_FILE_NAME_LENGTH];
+    int FileIndex;
+    int RemoveIndex;
+    int Status;
+
+    Error = 0;
+    for (FileIndex = 0;
+         FileIndex < PT_CREATE_WRITE_TEST_BATCH_SIZE;
+         FileIndex += 1) {
+
+        snprintf(FileName,
+                 PT_CREATE_TEST_FILE_NAME_LENGTH,
+                 "create_%d_%d.o",
+                 ProcessId,
+                 FileIndex);
+
+        FileDescriptor = creat(FileName, S_IRUSR | S_IWUSR);
+        if (FileDescriptor < 0) {
+            Error = errno;
+            break;
+        }
+
+        BytesWritten = write(FileDescriptor,
+                             Buffer,
+                             PT_CREATE_WRITE_TEST_FILE_SIZE);
+
+        if (BytesWritten != PT_CREATE_WRITE_TEST_FILE_SIZE) {
+            Error = errno;
+            if (Error == 0) {
+                Error = EIO;
+            }
+        }
+
+        Status = close(FileDescriptor);
+        if ((Status != 0) && (Error == 0)) {
+            Error = errno;
+        }
+
+        if (Error != 0) {
+            FileIndex += 1;
+            break;
+        }
+
+        *Iterations += 1;
+    }
+
+    //
+    // Remove every file created, even if the batch did not finish.
+    //
+
+    for (RemoveIndex = 0; RemoveIndex < FileIndex; RemoveIndex += 1) {
+        snprintf(FileName,
+                 PT_CREATE_TEST_FILE_NAME_LENGTH,
+                 "create_%d_%d.o",
+                 ProcessId,
+                 RemoveIndex);
+
+        Status = remove(FileName);
+        if ((Status != 0) && (Error == 0)) {
+            Error = errno;
+        }
+    }
+
+    return Error;
+}
+
@@ -0,0 +1,353 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    flock.c
+
+Abstract:
+
+    This module implements the byte-range file lock performance benchmark
+    test. A child process holds thousands of record locks on a file while the
+    parent locks and unlocks the records in between them.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "perftest.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PT_FLOCK_TEST_FILE_NAME_LENGTH 48
+
+//
+// The child locks every odd record, leaving the even records for the parent.
+//
+
+#define PT_FLOCK_TEST_RECORD_COUNT 8192
+#define PT_FLOCK_TEST_RECORD_SIZE 64
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+int
+FlockSetRecordLock (
+    int FileDescriptor,
+    int Record,
+    short Type
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+void
+FlockMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the byte-range file lock benchmark test.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ssize_t BytesRead;
+    pid_t Child;
+    int FileCreated;
+    int FileDescriptor;
+    char FileName[PT_FLOCK_TEST_FILE_NAME_LENGTH];
+    int DonePipe[2];
+    unsigned long long Iterations;
+    int PipesCreated;
+    pid_t ProcessId;
+    char Ready;
+    int ReadyPipe[2];
+    int Record;
+    int Status;
+
+    assert(Test->TestType == PtTestFlock);
+
+    Child = -1;
+    FileCreated = 0;
+    FileDescriptor = -1;
+    Iterations = 0;
+    PipesCreated = 0;
+    Result->Type = PtResultIterations;
+    Result->Status = 0;
+
+    //
+    // Get the process ID and create a process safe file path.
+    //
+
+    ProcessId = getpid();
+    Status = snprintf(FileName,
+                      PT_FLOCK_TEST_FILE_NAME_LENGTH,
+                      "flock_%d.txt",
+                      ProcessId);
+
+    if (Status < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    FileDescriptor = open(FileName,
+                          O_RDWR | O_CREAT | O_TRUNC,
+                          S_IRUSR | S_IWUSR);
+
+    if (FileDescriptor < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    FileCreated = 1;
+    Status = pipe(ReadyPipe);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    Status = pipe(DonePipe);
+    if (Status != 0) {
+        Result->Status = errno;
+        close(ReadyPipe[0]);
+        close(ReadyPipe[1]);
+        goto MainEnd;
+    }
+
+    PipesCreated = 1;
+
+    //
+    // Fork a child that locks the odd records, reports that it is ready, and
+    // then holds the locks until the parent closes the done pipe.
+    //
+
+    Child = fork();
+    if (Child < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+
+    } else if (Child == 0) {
+        close(ReadyPipe[0]);
+        close(DonePipe[1]);
+        for (Record = 1; Record < PT_FLOCK_TEST_RECORD_COUNT; Record += 2) {
+            Status = FlockSetRecordLock(FileDescriptor, Record, F_WRLCK);
+            if (Status != 0) {
+                exit(Status);
+            }
+        }
+
+        Ready = 1;
+        if (write(ReadyPipe[1], &Ready, sizeof(Ready)) < 0) {
+            exit(errno);
+        }
+
+        do {
+            BytesRead = read(DonePipe[0], &Ready, sizeof(Ready));
+
+        } while ((BytesRead > 0) ||
+                 ((BytesRead < 0) && (errno == EINTR)));
+
+        exit(0);
+    }
+
+    close(ReadyPipe[1]);
+    close(DonePipe[0]);
+
+    //
+    // Wait for the child to take all of its locks.
+    //
+
+    do {
+        BytesRead = read(ReadyPipe[0], &Ready, sizeof(Ready));
+
+    } while ((BytesRead < 0) && (errno == EINTR));
+
+    if (BytesRead != sizeof(Ready)) {
+        Result->Status = EPIPE;
+        if (BytesRead < 0) {
+            Result->Status = errno;
+        }
+
+        goto MainEnd;
+    }
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    //
+    // Lock and unlock random even records, each of which sits between two
+    // records the child holds.
+    //
+
+    while (PtIsTimedTestRunning() != 0) {
+        Record = (rand() % (PT_FLOCK_TEST_RECORD_COUNT / 2)) * 2;
+        Status = FlockSetRecordLock(FileDescriptor, Record, F_WRLCK);
+        if (Status == 0) {
+            Status = FlockSetRecordLock(FileDescriptor, Record, F_UNLCK);
+        }
+
+        if (Status != 0) {
+            if (Status != EINTR) {
+                Result->Status = Status;
+            }
+
+            break;
+        }
+
+        Iterations += 1;
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+MainEnd:
+    if (PipesCreated != 0) {
+        if (Child <= 0) {
+            close(ReadyPipe[1]);
+            close(DonePipe[0]);
+        }
+
+        close(ReadyPipe[0]);
+        close(DonePipe[1]);
+    }
+
+    if (Child > 0) {
+        Child = waitpid(Child, &Status, 0);
+        if ((Child == -1) && (Result->Status == 0)) {
+            Result->Status = errno;
+
+        } else if ((Status != 0) && (Result->Status == 0)) {
+            Result->Status = WEXITSTATUS(Status);
+        }
+    }
+
+    if (FileDescriptor >= 0) {
+        close(FileDescriptor);
+    }
+
+    if (FileCreated != 0) {
+        Status = remove(FileName);
+        if ((Status != 0) && (Result->Status == 0)) {
+            Result->Status = errno;
+        }
+    }
+
+    Result->Data.Iterations = Iterations;
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+int
+FlockSetRecordLock (
+    int FileDescriptor,
+    int Record,
+    short Type
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets or clears a lock on a record of the test file without
+    blocking.
+
+Arguments:
+
+    FileDescriptor - Supplies the open file descriptor of the test file.
+
+    Record - Supplies the index of the record to lock.
+
+    Type - Supplies the lock type: F_RDLCK, F_WRLCK, or F_UNLCK.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    struct flock Lock;
+    int Status;
+
+    Lock.l_type = Type;
+    Lock.l_whence = SEEK_SET;
+    Lock.l_start = (off_t)Record * PT_FLOCK_TEST_RECORD_SIZE;
+    Lock.l_len = PT_FLOCK_TEST_RECORD_SIZE;
+    Lock.l_pid = 0;
+    Status = fcntl(FileDescriptor, F_SETLK, &Lock);
+    if (Status != 0) {
+        return errno;
+    }
+
+    return 0;
+}
+
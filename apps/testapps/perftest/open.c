@@ -30,6 +30,7 @@ Module Name:
 // ------------------------------------------------------------------- Includes
 //
 
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -45,6 +46,12 @@ Module Name:
 
 #define PT_OPEN_TEST_FILE_NAME_LENGTH 48
 
+//
+// Define the number of files the many-file variant cycles through.
+//
+
+#define PT_OPEN_MANY_TEST_FILE_COUNT 256
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -88,41 +95,71 @@ Return Value:
 
 {
 
-    int FileCreated;
+    int FileCount;
     int FileDescriptor;
-    char FileName[PT_OPEN_TEST_FILE_NAME_LENGTH];
+    int FileIndex;
+    char *FileName;
+    char *FileNames;
+    int FilesCreated;
     unsigned long long Iterations;
     pid_t ProcessId;
     int Status;
 
-    FileCreated = 0;
+    FileIndex = 0;
+    FileNames = NULL;
+    FilesCreated = 0;
     Iterations = 0;
     Result->Type = PtResultIterations;
     Result->Status = 0;
+    switch (Test->TestType) {
+    case PtTestOpen:
+        FileCount = 1;
+        break;
 
-    //
-    // Get the process ID and create a process safe file to open and close.
-    //
+    case PtTestOpenMany:
+        FileCount = PT_OPEN_MANY_TEST_FILE_COUNT;
+        break;
 
-    ProcessId = getpid();
-    Status = snprintf(FileName,
-                      PT_OPEN_TEST_FILE_NAME_LENGTH,
-                      "open_%d.txt",
-                      ProcessId);
+    default:
 
-    if (Status < 0) {
-        Result->Status = errno;
-        goto MainEnd;
+        assert(0);
+
+        Result->Status = EINVAL;
+        return;
     }
 
-    FileDescriptor = creat(FileName, S_IRUSR | S_IWUSR);
-    if (FileDescriptor < 0) {
-        Result->Status = errno;
+    FileNames = malloc(FileCount * PT_OPEN_TEST_FILE_NAME_LENGTH);
+    if (FileNames == NULL) {
+        Result->Status = ENOMEM;
         goto MainEnd;
     }
 
-    close(FileDescriptor);
-    FileCreated = 1;
+    //
+    // Get the process ID and create process safe files to open and close.
+    //
+
+    ProcessId = getpid();
+    for (FilesCreated = 0; FilesCreated < FileCount; FilesCreated += 1) {
+        FileName = FileNames + (FilesCreated * PT_OPEN_TEST_FILE_NAME_LENGTH);
+        Status = snprintf(FileName,
+                          PT_OPEN_TEST_FILE_NAME_LENGTH,
+                          "open_%d_%d.txt",
+                          ProcessId,
+                          FilesCreated);
+
+        if (Status < 0) {
+            Result->Status = errno;
+            goto MainEnd;
+        }
+
+        FileDescriptor = creat(FileName, S_IRUSR | S_IWUSR);
+        if (FileDescriptor < 0) {
+            Result->Status = errno;
+            goto MainEnd;
+        }
+
+        close(FileDescriptor);
+    }
 
     //
     // Start the test. This snaps resource usage and starts the clock ticking.
@@ -136,10 +173,17 @@ Return Value:
 
     //
     // Measure the performance of the open() and close() C library routines by
-    // counting the number of times a file can be opened and closed.
+    // counting the number of times a file can be opened and closed. Cycle
+    // through the files so that each open looks up a different file.
     //
 
     while (PtIsTimedTestRunning() != 0) {
+        FileName = FileNames + (FileIndex * PT_OPEN_TEST_FILE_NAME_LENGTH);
+        FileIndex += 1;
+        if (FileIndex == FileCount) {
+            FileIndex = 0;
+        }
+
         FileDescriptor = open(FileName, O_RDWR);
         if (FileDescriptor < 0) {
             Result->Status = errno;
@@ -161,8 +205,12 @@ Return Value:
     }
 
 MainEnd:
-    if (FileCreated != 0) {
-        remove(FileName);
+    if (FileNames != NULL) {
+        for (FileIndex = 0; FileIndex < FilesCreated; FileIndex += 1) {
+            remove(FileNames + (FileIndex * PT_OPEN_TEST_FILE_NAME_LENGTH));
+        }
+
+        free(FileNames);
     }
 
     Result->Data.Iterations = Iterations;
@@ -218,6 +218,13 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtResultIterations,
      OPEN_TEST_DEFAULT_DURATION},
 
+    {OPEN_MANY_TEST_NAME,
+     OPEN_MANY_TEST_DESCRIPTION,
+     OpenMain,
+     PtTestOpenMany,
+     PtResultIterations,
+     OPEN_MANY_TEST_DEFAULT_DURATION},
+
     {CREATE_TEST_NAME,
      CREATE_TEST_DESCRIPTION,
      CreateMain,
@@ -225,6 +232,13 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtResultIterations,
      CREATE_TEST_DEFAULT_DURATION},
 
+    {CREATE_WRITE_TEST_NAME,
+     CREATE_WRITE_TEST_DESCRIPTION,
+     CreateMain,
+     PtTestCreateWrite,
+     PtResultIterations,
+     CREATE_WRITE_TEST_DEFAULT_DURATION},
+
     {DUP_TEST_NAME,
      DUP_TEST_DESCRIPTION,
      DupMain,
@@ -253,6 +267,34 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtResultIterations,
      PIPE_IO_TEST_DEFAULT_DURATION},
 
+    {PIPE_STREAM_TEST_NAME,
+     PIPE_STREAM_TEST_DESCRIPTION,
+     PipeStreamMain,
+     PtTestPipeStream,
+     PtResultBytes,
+     PIPE_STREAM_TEST_DEFAULT_DURATION},
+
+    {PIPE_STREAM_LARGE_TEST_NAME,
+     PIPE_STREAM_LARGE_TEST_DESCRIPTION,
+     PipeStreamMain,
+     PtTestPipeStreamLarge,
+     PtResultBytes,
+     PIPE_STREAM_LARGE_TEST_DEFAULT_DURATION},
+
+    {UNIX_STREAM_TEST_NAME,
+     UNIX_STREAM_TEST_DESCRIPTION,
+     UnixSocketMain,
+     PtTestUnixStream,
+     PtResultBytes,
+     UNIX_STREAM_TEST_DEFAULT_DURATION},
+
+    {UNIX_ROUND_TRIP_TEST_NAME,
+     UNIX_ROUND_TRIP_TEST_DESCRIPTION,
+     UnixSocketMain,
+     PtTestUnixRoundTrip,
+     PtResultIterations,
+     UNIX_ROUND_TRIP_TEST_DEFAULT_DURATION},
+
     {READ_TEST_NAME,
      READ_TEST_DESCRIPTION,
      ReadMain,
@@ -260,6 +302,27 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtResultBytes,
      READ_TEST_DEFAULT_DURATION},
 
+    {READ_CONTENDED_TEST_NAME,
+     READ_CONTENDED_TEST_DESCRIPTION,
+     ReadMain,
+     PtTestReadContended,
+     PtResultBytes,
+     READ_CONTENDED_TEST_DEFAULT_DURATION},
+
+    {READ_LARGE_TEST_NAME,
+     READ_LARGE_TEST_DESCRIPTION,
+     ReadMain,
+     PtTestReadLarge,
+     PtResultBytes,
+     READ_LARGE_TEST_DEFAULT_DURATION},
+
+    {READ_DIRECT_TEST_NAME,
+     READ_DIRECT_TEST_DESCRIPTION,
+     ReadMain,
+     PtTestReadDirect,
+     PtResultBytes,
+     READ_DIRECT_TEST_DEFAULT_DURATION},
+
     {WRITE_TEST_NAME,
      WRITE_TEST_DESCRIPTION,
      WriteMain,
@@ -267,6 +330,13 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtResultBytes,
      WRITE_TEST_DEFAULT_DURATION},
 
+    {WRITE_DIRECT_TEST_NAME,
+     WRITE_DIRECT_TEST_DESCRIPTION,
+     WriteMain,
+     PtTestWriteDirect,
+     PtResultBytes,
+     WRITE_DIRECT_TEST_DEFAULT_DURATION},
+
     {COPY_TEST_NAME,
      COPY_TEST_DESCRIPTION,
      CopyMain,
@@ -274,6 +344,13 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtResultBytes,
      COPY_TEST_DEFAULT_DURATION},
 
+    {FLOCK_TEST_NAME,
+     FLOCK_TEST_DESCRIPTION,
+     FlockMain,
+     PtTestFlock,
+     PtResultIterations,
+     FLOCK_TEST_DEFAULT_DURATION},
+
     {DLOPEN_TEST_NAME,
      DLOPEN_TEST_DESCRIPTION,
      DlopenMain,
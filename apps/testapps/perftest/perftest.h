@@ -45,10 +45,18 @@ Module Name:
 #define OPEN_TEST_DESCRIPTION \
     "Benchmarks the open() and close() C library routines."
 
+#define OPEN_MANY_TEST_NAME "open_many"
+#define OPEN_MANY_TEST_DESCRIPTION \
+    "Benchmarks open() and close() cycling through many different files."
+
 #define CREATE_TEST_NAME "create"
 #define CREATE_TEST_DESCRIPTION \
     "Benchmarks the create() and remove() C library routines."
 
+#define CREATE_WRITE_TEST_NAME "create_write"
+#define CREATE_WRITE_TEST_DESCRIPTION \
+    "Benchmarks creating, writing, and removing batches of small files."
+
 #define DUP_TEST_NAME "dup"
 #define DUP_TEST_DESCRIPTION "Benchmarks the dup() C library routine."
 #define RENAME_TEST_NAME "rename"
@@ -57,14 +65,50 @@ Module Name:
 #define GETPPID_TEST_DESCRIPTION "Benchmarks the getppid() C library routine."
 #define PIPE_IO_TEST_NAME "pipe_io"
 #define PIPE_IO_TEST_DESCRIPTION "Benchmarks pipe I/O throughput."
+#define PIPE_STREAM_TEST_NAME "pipe_stream"
+#define PIPE_STREAM_TEST_DESCRIPTION \
+    "Benchmarks one-way pipe throughput between two processes."
+
+#define PIPE_STREAM_LARGE_TEST_NAME "pipe_stream_large"
+#define PIPE_STREAM_LARGE_TEST_DESCRIPTION \
+    "Benchmarks one-way pipe throughput with large page aligned writes."
+
+#define UNIX_STREAM_TEST_NAME "unix_stream"
+#define UNIX_STREAM_TEST_DESCRIPTION \
+    "Benchmarks one-way Unix socket throughput with large messages."
+
+#define UNIX_ROUND_TRIP_TEST_NAME "unix_round_trip"
+#define UNIX_ROUND_TRIP_TEST_DESCRIPTION \
+    "Benchmarks Unix socket request and response latency."
+
 #define READ_TEST_NAME "read"
 #define READ_TEST_DESCRIPTION "Benchmarks read() throughput."
+#define READ_CONTENDED_TEST_NAME "read_contended"
+#define READ_CONTENDED_TEST_DESCRIPTION \
+    "Benchmarks read() throughput with threads on separate descriptors."
+
+#define READ_LARGE_TEST_NAME "read_large"
+#define READ_LARGE_TEST_DESCRIPTION \
+    "Benchmarks multi-page read() throughput from a large cached file."
+
+#define READ_DIRECT_TEST_NAME "read_direct"
+#define READ_DIRECT_TEST_DESCRIPTION \
+    "Benchmarks multi-page read() throughput bypassing the cache (O_DIRECT)."
+
 #define WRITE_TEST_NAME "write"
 #define WRITE_TEST_DESCRIPTION "Benchmarks write() throughput."
+#define WRITE_DIRECT_TEST_NAME "write_direct"
+#define WRITE_DIRECT_TEST_DESCRIPTION \
+    "Benchmarks multi-page write() throughput bypassing the cache (O_DIRECT)."
+
 #define COPY_TEST_NAME "copy"
 #define COPY_TEST_DESCRIPTION \
     "Benchmarks read()/write() throughput copying data between files."
 
+#define FLOCK_TEST_NAME "flock"
+#define FLOCK_TEST_DESCRIPTION \
+    "Benchmarks fcntl() record locking against thousands of held locks."
+
 #define DLOPEN_TEST_NAME "dlopen"
 #define DLOPEN_TEST_DESCRIPTION \
     "Benchmarks the dlopen() and dlclose() C library routines."
@@ -152,14 +196,25 @@ Module Name:
 #define FORK_TEST_DEFAULT_DURATION 60
 #define EXEC_TEST_DEFAULT_DURATION 60
 #define OPEN_TEST_DEFAULT_DURATION 30
+#define OPEN_MANY_TEST_DEFAULT_DURATION 30
 #define CREATE_TEST_DEFAULT_DURATION 30
+#define CREATE_WRITE_TEST_DEFAULT_DURATION 30
 #define DUP_TEST_DEFAULT_DURATION 30
 #define RENAME_TEST_DEFAULT_DURATION 30
 #define GETPPID_TEST_DEFAULT_DURATION 10
 #define PIPE_IO_TEST_DEFAULT_DURATION 30
+#define PIPE_STREAM_TEST_DEFAULT_DURATION 30
+#define PIPE_STREAM_LARGE_TEST_DEFAULT_DURATION 30
+#define UNIX_STREAM_TEST_DEFAULT_DURATION 30
+#define UNIX_ROUND_TRIP_TEST_DEFAULT_DURATION 30
 #define READ_TEST_DEFAULT_DURATION 60
+#define READ_CONTENDED_TEST_DEFAULT_DURATION 60
+#define READ_LARGE_TEST_DEFAULT_DURATION 60
+#define READ_DIRECT_TEST_DEFAULT_DURATION 60
 #define WRITE_TEST_DEFAULT_DURATION 60
+#define WRITE_DIRECT_TEST_DEFAULT_DURATION 60
 #define COPY_TEST_DEFAULT_DURATION 60
+#define FLOCK_TEST_DEFAULT_DURATION 30
 #define DLOPEN_TEST_DEFAULT_DURATION 30
 #define MMAP_PRIVATE_TEST_DEFAULT_DURATION 30
 #define MMAP_SHARED_TEST_DEFAULT_DURATION 30
@@ -197,14 +252,25 @@ typedef enum _PT_TEST_TYPE {
     PtTestFork,
     PtTestExec,
     PtTestOpen,
+    PtTestOpenMany,
     PtTestCreate,
+    PtTestCreateWrite,
     PtTestDup,
     PtTestRename,
     PtTestGetppid,
     PtTestPipeIo,
+    PtTestPipeStream,
+    PtTestPipeStreamLarge,
+    PtTestUnixStream,
+    PtTestUnixRoundTrip,
     PtTestRead,
+    PtTestReadContended,
+    PtTestReadLarge,
+    PtTestReadDirect,
     PtTestWrite,
+    PtTestWriteDirect,
     PtTestCopy,
+    PtTestFlock,
     PtTestDlopen,
     PtTestMmapPrivate,
     PtTestMmapShared,
@@ -746,6 +812,56 @@ Return Value:
 
 --*/
 
+void
+PipeStreamMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the one-way pipe streaming benchmark tests.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+void
+UnixSocketMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the Unix domain socket benchmark tests.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
 void
 ReadMain (
     PPT_TEST_INFORMATION Test,
@@ -821,6 +937,31 @@ Return Value:
 
 --*/
 
+void
+FlockMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the byte-range file lock benchmark test.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
 void
 DlopenMain (
     PPT_TEST_INFORMATION Test,
@@ -14,6 +14,8 @@ Module Name:
 Abstract:
 
     This module implements the performance benchmark tests pipe I/O throughput.
+    The streaming tests measure data moving one way from a writer process to
+    a reader process, as in a shell pipeline.
 
 Author:
 
@@ -29,9 +31,11 @@ Module Name:
 // ------------------------------------------------------------------- Includes
 //
 
+#include <assert.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <signal.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "perftest.h"
@@ -42,6 +46,16 @@ Module Name:
 
 #define PT_PIPE_IO_BUFFER_SIZE 4096
 
+//
+// The streaming test writes in atomic sized chunks, which go through the
+// pipe's buffer. The large test writes page aligned chunks big enough for
+// most of each to be handed straight to the reader.
+//
+
+#define PT_PIPE_STREAM_BUFFER_SIZE 4096
+#define PT_PIPE_STREAM_LARGE_BUFFER_SIZE (256 * 1024)
+#define PT_PIPE_STREAM_ALIGNMENT 4096
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -189,6 +203,177 @@ Return Value:
     return;
 }
 
+void
+PipeStreamMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the one-way pipe streaming benchmark tests.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    char *Buffer;
+    size_t BufferSize;
+    ssize_t BytesCompleted;
+    pid_t Child;
+    int PipeCreated;
+    int PipeDescriptors[2];
+    int Status;
+    unsigned long long TotalBytes;
+
+    Child = -1;
+    PipeCreated = 0;
+    Result->Type = PtResultBytes;
+    Result->Status = 0;
+    TotalBytes = 0;
+    switch (Test->TestType) {
+    case PtTestPipeStream:
+        BufferSize = PT_PIPE_STREAM_BUFFER_SIZE;
+        break;
+
+    case PtTestPipeStreamLarge:
+        BufferSize = PT_PIPE_STREAM_LARGE_BUFFER_SIZE;
+        break;
+
+    default:
+
+        assert(0);
+
+        Result->Status = EINVAL;
+        return;
+    }
+
+    //
+    // Allocate a page aligned buffer to use for reads and writes.
+    //
+
+    Status = posix_memalign((void **)&Buffer,
+                            PT_PIPE_STREAM_ALIGNMENT,
+                            BufferSize);
+
+    if (Status != 0) {
+        Buffer = NULL;
+        Result->Status = Status;
+        goto StreamMainEnd;
+    }
+
+    Status = pipe(PipeDescriptors);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto StreamMainEnd;
+    }
+
+    PipeCreated = 1;
+
+    //
+    // Fork a child that reads until the write end is closed.
+    //
+
+    Child = fork();
+    if (Child < 0) {
+        Result->Status = errno;
+        goto StreamMainEnd;
+
+    } else if (Child == 0) {
+        close(PipeDescriptors[1]);
+        do {
+            BytesCompleted = read(PipeDescriptors[0], Buffer, BufferSize);
+
+        } while ((BytesCompleted > 0) ||
+                 ((BytesCompleted < 0) && (errno == EINTR)));
+
+        if (BytesCompleted < 0) {
+            exit(errno);
+        }
+
+        exit(0);
+    }
+
+    close(PipeDescriptors[0]);
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto StreamMainEnd;
+    }
+
+    //
+    // Measure pipe throughput by counting the bytes the reader takes in.
+    //
+
+    while (PtIsTimedTestRunning() != 0) {
+        do {
+            BytesCompleted = write(PipeDescriptors[1], Buffer, BufferSize);
+
+        } while ((BytesCompleted < 0) &&
+                 (errno == EINTR) &&
+                 (PtIsTimedTestRunning() != 0));
+
+        if (BytesCompleted < 0) {
+            if (errno != EINTR) {
+                Result->Status = errno;
+            }
+
+            break;
+        }
+
+        TotalBytes += (unsigned long long)BytesCompleted;
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+StreamMainEnd:
+    if (PipeCreated != 0) {
+        if (Child <= 0) {
+            close(PipeDescriptors[0]);
+        }
+
+        close(PipeDescriptors[1]);
+    }
+
+    if (Child > 0) {
+        Child = waitpid(Child, &Status, 0);
+        if ((Child == -1) && (Result->Status == 0)) {
+            Result->Status = errno;
+
+        } else if ((Status != 0) && (Result->Status == 0)) {
+            Result->Status = WEXITSTATUS(Status);
+        }
+    }
+
+    if (Buffer != NULL) {
+        free(Buffer);
+    }
+
+    Result->Data.Bytes = TotalBytes;
+    return;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
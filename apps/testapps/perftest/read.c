@@ -30,10 +30,12 @@ Module Name:
 // ------------------------------------------------------------------- Includes
 //
 
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include "perftest.h"
@@ -46,18 +48,83 @@ Module Name:
 #define PT_READ_TEST_FILE_SIZE (2 * 1024 * 1024)
 #define PT_READ_TEST_BUFFER_SIZE 4096
 
+//
+// The contended test uses small reads so that the time spent translating the
+// descriptor dominates over copying data.
+//
+
+#define PT_READ_CONTENDED_TEST_THREAD_COUNT 8
+#define PT_READ_CONTENDED_TEST_BUFFER_SIZE 256
+
+//
+// The large test reads a file that spans many pages of the page cache in
+// multi-page chunks, which stresses looking up cached pages.
+//
+
+#define PT_READ_LARGE_TEST_FILE_SIZE (64 * 1024 * 1024)
+#define PT_READ_LARGE_TEST_BUFFER_SIZE (64 * 1024)
+
+//
+// The direct test reads the same large file through a descriptor opened with
+// O_DIRECT, which requires page aligned buffers, offsets, and sizes.
+//
+
+#define PT_READ_DIRECT_TEST_ALIGNMENT 4096
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines the state of an additional thread in the contended
+    read test.
+
+Members:
+
+    Thread - Stores the thread identifier.
+
+    FileName - Stores a pointer to the name of the file to read.
+
+    TotalBytes - Stores the number of bytes the thread read.
+
+    Status - Stores 0 on success or an error number on failure.
+
+--*/
+
+typedef struct _PT_READ_THREAD {
+    pthread_t Thread;
+    char *FileName;
+    unsigned long long TotalBytes;
+    int Status;
+} PT_READ_THREAD, *PPT_READ_THREAD;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+void *
+ReadStartRoutine (
+    void *Parameter
+    );
+
+int
+ReadLoop (
+    int FileDescriptor,
+    char *Buffer,
+    size_t BufferSize,
+    unsigned long long *TotalBytes
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
+pthread_mutex_t ReadReadyLock = PTHREAD_MUTEX_INITIALIZER;
+volatile int ReadReadyThreadCount;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -89,28 +156,77 @@ Return Value:
 
 {
 
+    size_t AllocationSize;
     char *Buffer;
-    ssize_t BytesRead;
+    size_t BufferSize;
     ssize_t BytesWritten;
     int FileCreated;
     int FileDescriptor;
     char FileName[PT_READ_TEST_FILE_NAME_LENGTH];
+    size_t FileSize;
     int Index;
     pid_t ProcessId;
     int Status;
+    int ThreadCount;
+    int ThreadIndex;
+    PPT_READ_THREAD Threads;
     unsigned long long TotalBytes;
 
     FileCreated = 0;
     FileDescriptor = -1;
     Result->Type = PtResultBytes;
     Result->Status = 0;
+    ThreadIndex = 0;
+    Threads = NULL;
     TotalBytes = 0;
+    switch (Test->TestType) {
+    case PtTestRead:
+        BufferSize = PT_READ_TEST_BUFFER_SIZE;
+        FileSize = PT_READ_TEST_FILE_SIZE;
+        break;
+
+    case PtTestReadContended:
+        BufferSize = PT_READ_CONTENDED_TEST_BUFFER_SIZE;
+        FileSize = PT_READ_TEST_FILE_SIZE;
+        break;
+
+    case PtTestReadLarge:
+    case PtTestReadDirect:
+        BufferSize = PT_READ_LARGE_TEST_BUFFER_SIZE;
+        FileSize = PT_READ_LARGE_TEST_FILE_SIZE;
+        break;
+
+    default:
+
+        assert(0);
+
+        Result->Status = EINVAL;
+        return;
+    }
 
     //
-    // Allocate a buffer for the reads.
+    // Allocate a buffer for the reads. Priming the file uses the full test
+    // buffer size.
     //
 
-    Buffer = malloc(PT_READ_TEST_BUFFER_SIZE);
+    AllocationSize = BufferSize;
+    if (AllocationSize < PT_READ_TEST_BUFFER_SIZE) {
+        AllocationSize = PT_READ_TEST_BUFFER_SIZE;
+    }
+
+    if (Test->TestType == PtTestReadDirect) {
+        Status = posix_memalign((void **)&Buffer,
+                                PT_READ_DIRECT_TEST_ALIGNMENT,
+                                AllocationSize);
+
+        if (Status != 0) {
+            Buffer = NULL;
+        }
+
+    } else {
+        Buffer = malloc(AllocationSize);
+    }
+
     if (Buffer == NULL) {
         Result->Status = ENOMEM;
         goto MainEnd;
@@ -155,7 +271,7 @@ Return Value:
     //
 
     for (Index = 0;
-         Index < (PT_READ_TEST_FILE_SIZE / PT_READ_TEST_BUFFER_SIZE);
+         Index < (FileSize / PT_READ_TEST_BUFFER_SIZE);
          Index += 1) {
 
         do {
@@ -187,59 +303,100 @@ Return Value:
     }
 
     //
-    // Start the test. This snaps resource usage and starts the clock ticking.
+    // For the direct test, reopen the file so that reads bypass the cache.
     //
 
-    Status = PtStartTimedTest(Test->Duration);
-    if (Status != 0) {
-        Result->Status = errno;
-        goto MainEnd;
+    if (Test->TestType == PtTestReadDirect) {
+        close(FileDescriptor);
+        FileDescriptor = open(FileName, O_RDONLY | O_DIRECT);
+        if (FileDescriptor < 0) {
+            Result->Status = errno;
+            goto MainEnd;
+        }
     }
 
     //
-    // Measure the performance of the read() C library routine by counting the
-    // number of bytes that can be read in.
+    // For the contended test, spin up threads that each read the file
+    // through their own descriptor.
     //
 
-    while (PtIsTimedTestRunning() != 0) {
-        do {
-            BytesRead = read(FileDescriptor, Buffer, PT_READ_TEST_BUFFER_SIZE);
-
-        } while ((BytesRead < 0) && (errno == EINTR));
+    if (Test->TestType == PtTestReadContended) {
+        Threads = calloc(PT_READ_CONTENDED_TEST_THREAD_COUNT,
+                         sizeof(PT_READ_THREAD));
 
-        if (BytesRead < 0) {
-            Result->Status = errno;
-            break;
+        if (Threads == NULL) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
         }
 
-        //
-        // If the bytes read did not fill the entire buffer, then the end of
-        // the file was likely reached. Seek back to the beginning.
-        //
+        ReadReadyThreadCount = 0;
+        for (ThreadIndex = 0;
+             ThreadIndex < PT_READ_CONTENDED_TEST_THREAD_COUNT;
+             ThreadIndex += 1) {
+
+            Threads[ThreadIndex].FileName = FileName;
+            Status = pthread_create(&(Threads[ThreadIndex].Thread),
+                                    NULL,
+                                    ReadStartRoutine,
+                                    &(Threads[ThreadIndex]));
 
-        if (BytesRead != PT_READ_TEST_BUFFER_SIZE) {
-            Status = lseek(FileDescriptor, 0, SEEK_SET);
             if (Status != 0) {
-                if (Status < 0) {
-                    Result->Status = errno;
+                Result->Status = Status;
+                goto MainEnd;
+            }
+        }
 
-                } else {
-                    Result->Status = EIO;
-                }
+        //
+        // Wait until all threads are spun up.
+        //
 
-                break;
-            }
+        while (ReadReadyThreadCount != PT_READ_CONTENDED_TEST_THREAD_COUNT) {
+            sleep(1);
         }
+    }
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
 
-        TotalBytes += (unsigned long long)BytesRead;
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
     }
 
+    //
+    // Measure the performance of the read() C library routine by counting the
+    // number of bytes that can be read in.
+    //
+
+    Result->Status = ReadLoop(FileDescriptor, Buffer, BufferSize, &TotalBytes);
     Status = PtFinishTimedTest(Result);
     if ((Status != 0) && (Result->Status == 0)) {
         Result->Status = errno;
     }
 
 MainEnd:
+
+    //
+    // The threads stop on their own once the test is over. Cancel them in
+    // case the test never started.
+    //
+
+    if (Threads != NULL) {
+        ThreadCount = ThreadIndex;
+        for (ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex += 1) {
+            pthread_cancel(Threads[ThreadIndex].Thread);
+            pthread_join(Threads[ThreadIndex].Thread, NULL);
+            TotalBytes += Threads[ThreadIndex].TotalBytes;
+            if ((Threads[ThreadIndex].Status != 0) && (Result->Status == 0)) {
+                Result->Status = Threads[ThreadIndex].Status;
+            }
+        }
+
+        free(Threads);
+    }
+
     if (FileCreated != 0) {
         close(FileDescriptor);
         remove(FileName);
@@ -257,3 +414,137 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+void *
+ReadStartRoutine (
+    void *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the start routine for an additional thread in the
+    contended read test. It opens its own descriptor to the test file, waits
+    for the test to start, and then reads until the test stops.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the thread's state.
+
+Return Value:
+
+    Returns the NULL pointer.
+
+--*/
+
+{
+
+    char Buffer[PT_READ_CONTENDED_TEST_BUFFER_SIZE];
+    int FileDescriptor;
+    PPT_READ_THREAD Thread;
+
+    Thread = (PPT_READ_THREAD)Parameter;
+    FileDescriptor = open(Thread->FileName, O_RDONLY);
+    if (FileDescriptor < 0) {
+        Thread->Status = errno;
+    }
+
+    //
+    // Announce that the thread is ready.
+    //
+
+    pthread_mutex_lock(&ReadReadyLock);
+    ReadReadyThreadCount += 1;
+    pthread_mutex_unlock(&ReadReadyLock);
+    if (FileDescriptor < 0) {
+        return NULL;
+    }
+
+    //
+    // Busy spin waiting for the test to start.
+    //
+
+    while (PtIsTimedTestRunning() == 0) {
+        pthread_testcancel();
+    }
+
+    Thread->Status = ReadLoop(FileDescriptor,
+                              Buffer,
+                              sizeof(Buffer),
+                              &(Thread->TotalBytes));
+
+    close(FileDescriptor);
+    return NULL;
+}
+
+int
+ReadLoop (
+    int FileDescriptor,
+    char *Buffer,
+    size_t BufferSize,
+    unsigned long long *TotalBytes
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the test file over and over until the timed test
+    stops.
+
+Arguments:
+
+    FileDescriptor - Supplies the descriptor to read from.
+
+    Buffer - Supplies a pointer to the buffer to read into.
+
+    BufferSize - Supplies the size of each read in bytes.
+
+    TotalBytes - Supplies a pointer whose value is incremented by the number
+        of bytes read.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    ssize_t BytesRead;
+    off_t Offset;
+
+    while (PtIsTimedTestRunning() != 0) {
+        do {
+            BytesRead = read(FileDescriptor, Buffer, BufferSize);
+
+        } while ((BytesRead < 0) && (errno == EINTR));
+
+        if (BytesRead < 0) {
+            return errno;
+        }
+
+        //
+        // If the bytes read did not fill the entire buffer, then the end of
+        // the file was likely reached. Seek back to the beginning.
+        //
+
+        if (BytesRead != BufferSize) {
+            Offset = lseek(FileDescriptor, 0, SEEK_SET);
+            if (Offset != 0) {
+                if (Offset < 0) {
+                    return errno;
+                }
+
+                return EIO;
+            }
+        }
+
+        *TotalBytes += (unsigned long long)BytesRead;
+    }
+
+    return 0;
+}
+
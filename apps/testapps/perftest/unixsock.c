@@ -0,0 +1,373 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    unixsock.c
+
+Abstract:
+
+    This module implements the Unix domain socket performance benchmark
+    tests. The streaming test measures large payloads moving one way between
+    two processes, and the round trip test measures the latency of small
+    request and response messages.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "perftest.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// The streaming test sends payloads larger than the socket's send buffer, as
+// bulk RPC traffic does. The round trip test sends small messages.
+//
+
+#define PT_UNIX_STREAM_BUFFER_SIZE (1024 * 1024)
+#define PT_UNIX_ROUND_TRIP_MESSAGE_SIZE 64
+#define PT_UNIX_SOCKET_ALIGNMENT 4096
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+int
+UnixSocketTransfer (
+    int Socket,
+    char *Buffer,
+    size_t Size,
+    int Write
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+void
+UnixSocketMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the Unix domain socket benchmark tests.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    char *Buffer;
+    size_t BufferSize;
+    ssize_t BytesCompleted;
+    pid_t Child;
+    unsigned long long Iterations;
+    int PairCreated;
+    int Sockets[2];
+    int Status;
+    unsigned long long TotalBytes;
+
+    Buffer = NULL;
+    Child = -1;
+    Iterations = 0;
+    PairCreated = 0;
+    Result->Status = 0;
+    TotalBytes = 0;
+    switch (Test->TestType) {
+    case PtTestUnixStream:
+        BufferSize = PT_UNIX_STREAM_BUFFER_SIZE;
+        Result->Type = PtResultBytes;
+        break;
+
+    case PtTestUnixRoundTrip:
+        BufferSize = PT_UNIX_ROUND_TRIP_MESSAGE_SIZE;
+        Result->Type = PtResultIterations;
+        break;
+
+    default:
+
+        assert(0);
+
+        Result->Status = EINVAL;
+        return;
+    }
+
+    Status = posix_memalign((void **)&Buffer,
+                            PT_UNIX_SOCKET_ALIGNMENT,
+                            BufferSize);
+
+    if (Status != 0) {
+        Buffer = NULL;
+        Result->Status = Status;
+        goto MainEnd;
+    }
+
+    memset(Buffer, 0, BufferSize);
+    Status = socketpair(AF_UNIX, SOCK_STREAM, 0, Sockets);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    PairCreated = 1;
+
+    //
+    // Fork a child that either drains the stream or echoes each message back,
+    // until the parent closes its end.
+    //
+
+    Child = fork();
+    if (Child < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+
+    } else if (Child == 0) {
+        close(Sockets[0]);
+        if (Test->TestType == PtTestUnixStream) {
+            do {
+                BytesCompleted = read(Sockets[1], Buffer, BufferSize);
+
+            } while ((BytesCompleted > 0) ||
+                     ((BytesCompleted < 0) && (errno == EINTR)));
+
+            if (BytesCompleted < 0) {
+                exit(errno);
+            }
+
+        } else {
+            while (1) {
+                Status = UnixSocketTransfer(Sockets[1], Buffer, BufferSize, 0);
+                if (Status != 0) {
+                    break;
+                }
+
+                Status = UnixSocketTransfer(Sockets[1], Buffer, BufferSize, 1);
+                if (Status != 0) {
+                    break;
+                }
+            }
+
+            if ((Status != 0) && (Status != EPIPE)) {
+                exit(Status);
+            }
+        }
+
+        exit(0);
+    }
+
+    close(Sockets[1]);
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    while (PtIsTimedTestRunning() != 0) {
+
+        //
+        // Count the bytes the child takes in for the streaming test.
+        //
+
+        if (Test->TestType == PtTestUnixStream) {
+            do {
+                BytesCompleted = write(Sockets[0], Buffer, BufferSize);
+
+            } while ((BytesCompleted < 0) &&
+                     (errno == EINTR) &&
+                     (PtIsTimedTestRunning() != 0));
+
+            if (BytesCompleted < 0) {
+                if (errno != EINTR) {
+                    Result->Status = errno;
+                }
+
+                break;
+            }
+
+            TotalBytes += (unsigned long long)BytesCompleted;
+
+        //
+        // Count complete round trips for the latency test.
+        //
+
+        } else {
+            Status = UnixSocketTransfer(Sockets[0], Buffer, BufferSize, 1);
+            if (Status == 0) {
+                Status = UnixSocketTransfer(Sockets[0], Buffer, BufferSize, 0);
+            }
+
+            if (Status != 0) {
+                if (Status != EINTR) {
+                    Result->Status = Status;
+                }
+
+                break;
+            }
+
+            Iterations += 1;
+        }
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+MainEnd:
+    if (PairCreated != 0) {
+        if (Child <= 0) {
+            close(Sockets[1]);
+        }
+
+        close(Sockets[0]);
+    }
+
+    if (Child > 0) {
+        Child = waitpid(Child, &Status, 0);
+        if ((Child == -1) && (Result->Status == 0)) {
+            Result->Status = errno;
+
+        } else if ((Status != 0) && (Result->Status == 0)) {
+            Result->Status = WEXITSTATUS(Status);
+        }
+    }
+
+    if (Buffer != NULL) {
+        free(Buffer);
+    }
+
+    if (Result->Type == PtResultBytes) {
+        Result->Data.Bytes = TotalBytes;
+
+    } else {
+        Result->Data.Iterations = Iterations;
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+int
+UnixSocketTransfer (
+    int Socket,
+    char *Buffer,
+    size_t Size,
+    int Write
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads or writes an entire message on a stream socket.
+
+Arguments:
+
+    Socket - Supplies the socket descriptor.
+
+    Buffer - Supplies a pointer to the message buffer.
+
+    Size - Supplies the size of the message in bytes.
+
+    Write - Supplies a non-zero value to write the message, or zero to read
+        it.
+
+Return Value:
+
+    0 on success.
+
+    EPIPE if the other end closed the connection.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    ssize_t BytesCompleted;
+    size_t Offset;
+
+    Offset = 0;
+    while (Offset < Size) {
+        if (Write != 0) {
+            BytesCompleted = write(Socket, Buffer + Offset, Size - Offset);
+
+        } else {
+            BytesCompleted = read(Socket, Buffer + Offset, Size - Offset);
+        }
+
+        if (BytesCompleted < 0) {
+            if ((errno == EINTR) && (PtIsTimedTestRunning() != 0)) {
+                continue;
+            }
+
+            return errno;
+        }
+
+        if (BytesCompleted == 0) {
+            return EPIPE;
+        }
+
+        Offset += BytesCompleted;
+    }
+
+    return 0;
+}
+
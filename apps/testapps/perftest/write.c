@@ -30,6 +30,7 @@ Module Name:
 // ------------------------------------------------------------------- Includes
 //
 
+#include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -47,6 +48,14 @@ Module Name:
 #define PT_WRITE_TEST_FILE_SIZE (2 * 1024 * 1024)
 #define PT_WRITE_TEST_BUFFER_SIZE 4096
 
+//
+// The direct test writes page aligned multi-page chunks through a descriptor
+// opened with O_DIRECT, which bypasses the cache.
+//
+
+#define PT_WRITE_DIRECT_TEST_BUFFER_SIZE (64 * 1024)
+#define PT_WRITE_DIRECT_TEST_ALIGNMENT 4096
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -91,11 +100,13 @@ Return Value:
 {
 
     char *Buffer;
+    size_t BufferSize;
     ssize_t BytesWritten;
     int FileCreated;
     int FileDescriptor;
     char FileName[PT_WRITE_TEST_FILE_NAME_LENGTH];
     int Index;
+    int OpenFlags;
     pid_t ProcessId;
     int Status;
     unsigned long long TotalBytes;
@@ -105,12 +116,37 @@ Return Value:
     Result->Type = PtResultBytes;
     Result->Status = 0;
     TotalBytes = 0;
+    switch (Test->TestType) {
+    case PtTestWrite:
+        BufferSize = PT_WRITE_TEST_BUFFER_SIZE;
+        OpenFlags = 0;
+        break;
+
+    case PtTestWriteDirect:
+        BufferSize = PT_WRITE_DIRECT_TEST_BUFFER_SIZE;
+        OpenFlags = O_DIRECT;
+        break;
+
+    default:
+
+        assert(0);
+
+        Result->Status = EINVAL;
+        return;
+    }
 
     //
-    // Allocate a buffer for the writes.
+    // Allocate a buffer for the writes. Direct writes need it page aligned.
     //
 
-    Buffer = malloc(PT_WRITE_TEST_BUFFER_SIZE);
+    Status = posix_memalign((void **)&Buffer,
+                            PT_WRITE_DIRECT_TEST_ALIGNMENT,
+                            BufferSize);
+
+    if (Status != 0) {
+        Buffer = NULL;
+    }
+
     if (Buffer == NULL) {
         Result->Status = ENOMEM;
         goto MainEnd;
@@ -132,10 +168,13 @@ Return Value:
     }
 
     //
-    // Create the new file, which will open it write-only.
+    // Create the new file write-only.
     //
 
-    FileDescriptor = creat(FileName, S_IRUSR | S_IWUSR);
+    FileDescriptor = open(FileName,
+                          O_WRONLY | O_CREAT | O_TRUNC | OpenFlags,
+                          S_IRUSR | S_IWUSR);
+
     if (FileDescriptor < 0) {
         Result->Status = errno;
         goto MainEnd;
@@ -150,13 +189,11 @@ Return Value:
     //
 
     for (Index = 0;
-         Index < (PT_WRITE_TEST_FILE_SIZE / PT_WRITE_TEST_BUFFER_SIZE);
+         Index < (PT_WRITE_TEST_FILE_SIZE / BufferSize);
          Index += 1) {
 
         do {
-            BytesWritten = write(FileDescriptor,
-                                 Buffer,
-                                 PT_WRITE_TEST_BUFFER_SIZE);
+            BytesWritten = write(FileDescriptor, Buffer, BufferSize);
 
         } while ((BytesWritten < 0) && (errno == EINTR));
 
@@ -165,7 +202,7 @@ Return Value:
             goto MainEnd;
         }
 
-        if (BytesWritten != PT_WRITE_TEST_BUFFER_SIZE) {
+        if (BytesWritten != BufferSize) {
             Result->Status = EIO;
             goto MainEnd;
         }
@@ -199,9 +236,7 @@ Return Value:
     Index = 0;
     while (PtIsTimedTestRunning() != 0) {
         do {
-            BytesWritten = write(FileDescriptor,
-                                 Buffer,
-                                 PT_WRITE_TEST_BUFFER_SIZE);
+            BytesWritten = write(FileDescriptor, Buffer, BufferSize);
 
         } while ((BytesWritten < 0) && (errno == EINTR));
 
@@ -210,14 +245,14 @@ Return Value:
             break;
         }
 
-        if (BytesWritten != PT_WRITE_TEST_BUFFER_SIZE) {
+        if (BytesWritten != BufferSize) {
             Result->Status = EIO;
             break;
         }
 
         TotalBytes += (unsigned long long)BytesWritten;
         Index += 1;
-        if (Index >= (PT_WRITE_TEST_FILE_SIZE / PT_WRITE_TEST_BUFFER_SIZE)) {
+        if (Index >= (PT_WRITE_TEST_FILE_SIZE / BufferSize)) {
             Status = lseek(FileDescriptor, 0, SEEK_SET);
             if (Status != 0) {
                 if (Status < 0) {
@@ -56,6 +56,14 @@ Module Name:
 
 #define VMSTAT_OPTIONS_STRING "hV"
 
+//
+// Define the number of devices to guess when sizing the writeback statistics
+// buffer, and how many times to try growing it.
+//
+
+#define VMSTAT_WRITEBACK_DEVICE_GUESS 8
+#define VMSTAT_WRITEBACK_TRY_COUNT 4
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -69,6 +77,11 @@ VmstatPrintInformation (
     VOID
     );
 
+INT
+VmstatPrintWriteback (
+    ULONG PageSize
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -217,6 +230,7 @@ Return Value:
 
     IO_CACHE_STATISTICS IoCache;
     ULONGLONG Megabytes;
+    MM_PAGE_MERGE_INFORMATION Merge;
     MM_STATISTICS MmStatistics;
     INT ReturnValue;
     UINTN Size;
@@ -303,6 +317,128 @@ Return Value:
     printf("Page Cache Size: %lldMB\n", Megabytes);
     Megabytes = (IoCache.DirtyPageCount * MmStatistics.PageSize) / _1MB;
     printf("Dirty Page Cache Size: %lldMB\n", Megabytes);
+    Size = sizeof(MM_PAGE_MERGE_INFORMATION);
+    Status = OsGetSetSystemInformation(SystemInformationMm,
+                                       MmInformationPageMerge,
+                                       &Merge,
+                                       &Size,
+                                       FALSE);
+
+    if (!KSUCCESS(Status)) {
+        ReturnValue = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "Error: failed to get page merge information: status %d: "
+                "%s.\n",
+                Status,
+                strerror(ReturnValue));
+
+        return ReturnValue;
+    }
+
+    printf("Fork Page Re-sharing and Zero Page Reclaim: %s\n",
+           (Merge.Enabled != FALSE) ? "on" : "off");
+
+    printf("    Pages Scanned: %ld\n", Merge.PagesScanned);
+    printf("    Fork Pages Re-shared: %ld\n", Merge.ForkPagesReshared);
+    printf("    Zero Pages Freed: %ld\n", Merge.ZeroPagesFreed);
+    Megabytes = ((ULONGLONG)Merge.PagesSaved * MmStatistics.PageSize) / _1MB;
+    printf("    Pages Saved: %ld (%lldMB)\n", Merge.PagesSaved, Megabytes);
+    ReturnValue = VmstatPrintWriteback(MmStatistics.PageSize);
+    return ReturnValue;
+}
+
+INT
+VmstatPrintWriteback (
+    ULONG PageSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the writeback state of each device.
+
+Arguments:
+
+    PageSize - Supplies the size of a page in bytes.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    UINTN Count;
+    UINTN Index;
+    INT ReturnValue;
+    UINTN Size;
+    PIO_WRITEBACK_STATISTICS Statistics;
+    KSTATUS Status;
+    UINTN Try;
+
+    ReturnValue = 0;
+    Statistics = NULL;
+    Size = VMSTAT_WRITEBACK_DEVICE_GUESS * sizeof(IO_WRITEBACK_STATISTICS);
+    Status = STATUS_BUFFER_TOO_SMALL;
+    for (Try = 0; Try < VMSTAT_WRITEBACK_TRY_COUNT; Try += 1) {
+        Statistics = malloc(Size);
+        if (Statistics == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        Status = OsGetSetSystemInformation(SystemInformationIo,
+                                           IoInformationWritebackStatistics,
+                                           Statistics,
+                                           &Size,
+                                           FALSE);
+
+        if (Status != STATUS_BUFFER_TOO_SMALL) {
+            break;
+        }
+
+        //
+        // Leave room for devices that show up before the next attempt.
+        //
+
+        free(Statistics);
+        Statistics = NULL;
+        Size *= 2;
+    }
+
+    if (!KSUCCESS(Status)) {
+        ReturnValue = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "Error: failed to get writeback information: status %d: "
+                "%s.\n",
+                Status,
+                strerror(ReturnValue));
+
+        goto PrintWritebackEnd;
+    }
+
+    printf("Writeback:\n");
+    Count = Size / sizeof(IO_WRITEBACK_STATISTICS);
+    for (Index = 0; Index < Count; Index += 1) {
+        printf("    Device %lld: dirty %lldKB, writeback %lldKB, "
+               "written %lldMB, bandwidth %lldKB/s\n",
+               Statistics[Index].DeviceId,
+               (ULONGLONG)Statistics[Index].DirtyPageCount * PageSize / _1KB,
+               (ULONGLONG)Statistics[Index].WritebackPageCount * PageSize /
+               _1KB,
+               Statistics[Index].BytesWritten / _1MB,
+               Statistics[Index].Bandwidth / _1KB);
+    }
+
+PrintWritebackEnd:
+    if (Statistics != NULL) {
+        free(Statistics);
+    }
+
     return ReturnValue;
 }
 
@@ -37,6 +37,7 @@ function build() {
         "drivers/acpi:acpi",
         "drivers/ahci:ahci",
         "drivers/ata:ata",
+        "drivers/cow:cow",
         "drivers/devrem:devrem",
         "drivers/fat:fat",
         "drivers/input:input_drivers",
@@ -50,6 +51,7 @@ function build() {
         "drivers/sound:sound_drivers",
         "drivers/special:special",
         "drivers/term/ser16550:ser16550",
+        "drivers/tmpfs:tmpfs",
         "drivers/usb:usb_drivers",
         "drivers/videocon:videocon"
     ];
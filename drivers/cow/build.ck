@@ -0,0 +1,50 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    Copy-on-write Overlay
+
+Abstract:
+
+    This module implements the copy-on-write overlay driver, which sits on
+    top of partitions and can redirect their writes into memory so that they
+    can be thrown away later.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+from menv import driver;
+
+function build() {
+    var drv;
+    var entries;
+    var name = "cow";
+    var sources;
+
+    sources = [
+        "cow.c"
+    ];
+
+    drv = {
+        "label": name,
+        "inputs": sources,
+    };
+
+    entries = driver(drv);
+    return entries;
+}
+
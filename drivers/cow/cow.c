@@ -0,0 +1,1498 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    cow.c
+
+Abstract:
+
+    This module implements the copy-on-write overlay driver. It sits on top of
+    partitions and raw disks, passing I/O through untouched until an overlay
+    is created. While an overlay is active, writes land in memory and reads
+    see the written data on top of the unmodified underlying device. The
+    overlay can be thrown away at any time, instantly returning the device to
+    its original contents.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include <minoca/devinfo/cow.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define COW_ALLOCATION_TAG 0x21776F43 // '!woC'
+
+//
+// The overlay tracks data in 512 byte sectors, the smallest block size a disk
+// can have. Every I/O request is aligned to the device's block size, and so
+// also to the sector size.
+//
+
+#define COW_SECTOR_SHIFT 9
+#define COW_SECTOR_SIZE (1 << COW_SECTOR_SHIFT)
+
+//
+// Sectors are grouped into chunks, which are the unit of allocation.
+//
+
+#define COW_CHUNK_SHIFT 15
+#define COW_CHUNK_SIZE (1 << COW_CHUNK_SHIFT)
+#define COW_CHUNK_SECTORS (COW_CHUNK_SIZE / COW_SECTOR_SIZE)
+#define COW_CHUNK_BITMAP_SIZE \
+    (COW_CHUNK_SECTORS / (sizeof(ULONG) * BITS_PER_BYTE))
+
+//
+// Define the fraction of physical memory an overlay can use, as a shift.
+//
+
+#define COW_LIMIT_SHIFT 1
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// This macro evaluates to non-zero if the given sector of a chunk holds
+// overlay data.
+//
+
+#define COW_IS_SECTOR_VALID(_Chunk, _Sector) \
+    (((_Chunk)->Valid[(_Sector) / (sizeof(ULONG) * BITS_PER_BYTE)] & \
+      (1 << ((_Sector) % (sizeof(ULONG) * BITS_PER_BYTE)))) != 0)
+
+//
+// This macro marks the given sector of a chunk as holding overlay data.
+//
+
+#define COW_SET_SECTOR_VALID(_Chunk, _Sector) \
+    ((_Chunk)->Valid[(_Sector) / (sizeof(ULONG) * BITS_PER_BYTE)] |= \
+     (1 << ((_Sector) % (sizeof(ULONG) * BITS_PER_BYTE))))
+
+//
+// This macro returns the data of a chunk, which directly follows the chunk
+// structure.
+//
+
+#define COW_CHUNK_DATA(_Chunk) ((PUCHAR)((_Chunk) + 1))
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure stores a chunk of overlay data. The data itself follows
+    the structure.
+
+Members:
+
+    TreeNode - Stores the node in the device's tree of chunks.
+
+    Index - Stores the index of the chunk, which is its device offset divided
+        by the chunk size.
+
+    Valid - Stores a bitmap of which sectors in the chunk hold overlay data.
+        Sectors that do not are read from the underlying device.
+
+--*/
+
+typedef struct _COW_CHUNK {
+    RED_BLACK_TREE_NODE TreeNode;
+    ULONGLONG Index;
+    ULONG Valid[COW_CHUNK_BITMAP_SIZE];
+} COW_CHUNK, *PCOW_CHUNK;
+
+/*++
+
+Structure Description:
+
+    This structure stores the state of a copy-on-write overlay device.
+
+Members:
+
+    Lock - Stores a pointer to a lock protecting the overlay. Writes and
+        overlay operations hold it exclusively, reads hold it shared.
+
+    ChunkTree - Stores the tree of overlay chunks, ordered by index.
+
+    ChunkCount - Stores the number of chunks in the tree.
+
+    ChunkLimit - Stores the maximum number of chunks the overlay can hold.
+
+    Capacity - Stores the size of the device in bytes, as reported when the
+        device was looked up.
+
+    BlockSize - Stores the block size of the device in bytes.
+
+    OpenCount - Stores the number of open handles to the device.
+
+    Active - Stores a boolean indicating whether an overlay is active.
+
+--*/
+
+typedef struct _COW_DEVICE {
+    PSHARED_EXCLUSIVE_LOCK Lock;
+    RED_BLACK_TREE ChunkTree;
+    ULONGLONG ChunkCount;
+    ULONGLONG ChunkLimit;
+    ULONGLONG Capacity;
+    ULONG BlockSize;
+    ULONG OpenCount;
+    BOOL Active;
+} COW_DEVICE, *PCOW_DEVICE;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+CowAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    );
+
+VOID
+CowDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+CowDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+CowDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+CowDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+CowDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+CowpHandleDeviceInformationRequest (
+    PIRP Irp,
+    PCOW_DEVICE Device
+    );
+
+KSTATUS
+CowpPerformOperation (
+    PCOW_DEVICE Device,
+    PDEVICE OsDevice,
+    COW_OPERATION Operation
+    );
+
+KSTATUS
+CowpWriteOverlay (
+    PCOW_DEVICE Device,
+    PIRP_READ_WRITE ReadWrite,
+    UINTN Size
+    );
+
+KSTATUS
+CowpReadOverlay (
+    PCOW_DEVICE Device,
+    PIRP_READ_WRITE ReadWrite,
+    UINTN Size,
+    PBOOL Complete
+    );
+
+PCOW_CHUNK
+CowpFindChunk (
+    PCOW_DEVICE Device,
+    ULONGLONG Index,
+    BOOL GreaterThan
+    );
+
+VOID
+CowpDestroyOverlay (
+    PCOW_DEVICE Device
+    );
+
+VOID
+CowpDestroyDevice (
+    PCOW_DEVICE Device
+    );
+
+COMPARISON_RESULT
+CowpCompareChunks (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+PDRIVER CowDriver = NULL;
+
+UUID CowDeviceInformationUuid = COW_DEVICE_INFORMATION_UUID;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+__USED
+KSTATUS
+DriverEntry (
+    PDRIVER Driver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for the copy-on-write overlay driver. It
+    registers its other dispatch functions, and performs driver-wide
+    initialization.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver object.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code on error.
+
+--*/
+
+{
+
+    DRIVER_FUNCTION_TABLE FunctionTable;
+    KSTATUS Status;
+
+    CowDriver = Driver;
+    RtlZeroMemory(&FunctionTable, sizeof(DRIVER_FUNCTION_TABLE));
+    FunctionTable.Version = DRIVER_FUNCTION_TABLE_VERSION;
+    FunctionTable.AddDevice = CowAddDevice;
+    FunctionTable.DispatchStateChange = CowDispatchStateChange;
+    FunctionTable.DispatchOpen = CowDispatchOpen;
+    FunctionTable.DispatchClose = CowDispatchClose;
+    FunctionTable.DispatchIo = CowDispatchIo;
+    FunctionTable.DispatchSystemControl = CowDispatchSystemControl;
+    Status = IoRegisterDriverFunctions(Driver, &FunctionTable);
+    return Status;
+}
+
+KSTATUS
+CowAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a partition or raw disk is detected. The
+    overlay driver attaches to it as the function driver.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver being called.
+
+    DeviceId - Supplies a pointer to a string with the device ID.
+
+    ClassId - Supplies a pointer to a string containing the device's class ID.
+
+    CompatibleIds - Supplies a pointer to a string containing device IDs
+        that would be compatible with this device.
+
+    DeviceToken - Supplies an opaque token that the driver can use to identify
+        the device in the system. This token should be used when attaching to
+        the stack.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code if the driver was unsuccessful in attaching itself.
+
+--*/
+
+{
+
+    PCOW_DEVICE Device;
+    UINTN PhysicalPages;
+    KSTATUS Status;
+
+    Device = MmAllocatePagedPool(sizeof(COW_DEVICE), COW_ALLOCATION_TAG);
+    if (Device == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto AddDeviceEnd;
+    }
+
+    RtlZeroMemory(Device, sizeof(COW_DEVICE));
+    RtlRedBlackTreeInitialize(&(Device->ChunkTree), 0, CowpCompareChunks);
+    PhysicalPages = MmGetTotalPhysicalPages() >> COW_LIMIT_SHIFT;
+    Device->ChunkLimit = ((ULONGLONG)PhysicalPages << MmPageShift()) >>
+                         COW_CHUNK_SHIFT;
+
+    Device->Lock = KeCreateSharedExclusiveLock();
+    if (Device->Lock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto AddDeviceEnd;
+    }
+
+    Status = IoAttachDriverToDevice(Driver, DeviceToken, Device);
+
+AddDeviceEnd:
+    if (!KSUCCESS(Status)) {
+        if (Device != NULL) {
+            CowpDestroyDevice(Device);
+            Device = NULL;
+        }
+    }
+
+    return Status;
+}
+
+VOID
+CowDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles State Change IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PCOW_DEVICE Device;
+
+    ASSERT(Irp->MajorCode == IrpMajorStateChange);
+
+    //
+    // Let the bus driver handle everything, and hook in on the way back up.
+    //
+
+    if (Irp->Direction != IrpUp) {
+        return;
+    }
+
+    Device = (PCOW_DEVICE)DeviceContext;
+    switch (Irp->MinorCode) {
+    case IrpMinorStartDevice:
+        if (KSUCCESS(IoGetIrpStatus(Irp))) {
+            IoRegisterDeviceInformation(Irp->Device,
+                                        &CowDeviceInformationUuid,
+                                        TRUE);
+        }
+
+        break;
+
+    case IrpMinorRemoveDevice:
+        IoRegisterDeviceInformation(Irp->Device,
+                                    &CowDeviceInformationUuid,
+                                    FALSE);
+
+        CowpDestroyDevice(Device);
+        break;
+
+    default:
+        break;
+    }
+
+    return;
+}
+
+VOID
+CowDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Open IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PCOW_DEVICE Device;
+    ULONG PagingFlags;
+    KSTATUS Status;
+
+    Device = (PCOW_DEVICE)DeviceContext;
+
+    //
+    // Count the open on the way down so that overlay operations cannot slip
+    // in while it is in flight, and undo the count if the open failed.
+    //
+
+    if (Irp->Direction == IrpDown) {
+        PagingFlags = OPEN_FLAG_PAGING_DEVICE | OPEN_FLAG_PAGE_FILE;
+        Status = STATUS_SUCCESS;
+        KeAcquireSharedExclusiveLockExclusive(Device->Lock);
+
+        //
+        // The overlay allocates memory to absorb writes, so it cannot sit in
+        // the paging path.
+        //
+
+        if ((Device->Active != FALSE) &&
+            ((Irp->U.Open.OpenFlags & PagingFlags) != 0)) {
+
+            Status = STATUS_NOT_SUPPORTED;
+
+        } else {
+            Device->OpenCount += 1;
+        }
+
+        KeReleaseSharedExclusiveLockExclusive(Device->Lock);
+        if (!KSUCCESS(Status)) {
+            IoCompleteIrp(CowDriver, Irp, Status);
+        }
+
+    } else {
+
+        ASSERT(Irp->Direction == IrpUp);
+
+        if (!KSUCCESS(IoGetIrpStatus(Irp))) {
+            KeAcquireSharedExclusiveLockExclusive(Device->Lock);
+
+            ASSERT(Device->OpenCount != 0);
+
+            Device->OpenCount -= 1;
+            KeReleaseSharedExclusiveLockExclusive(Device->Lock);
+        }
+    }
+
+    return;
+}
+
+VOID
+CowDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Close IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PCOW_DEVICE Device;
+
+    Device = (PCOW_DEVICE)DeviceContext;
+
+    //
+    // Let the close be handled by the disk, and drop the open count once it
+    // is done.
+    //
+
+    if (Irp->Direction == IrpUp) {
+        KeAcquireSharedExclusiveLockExclusive(Device->Lock);
+
+        ASSERT(Device->OpenCount != 0);
+
+        Device->OpenCount -= 1;
+        KeReleaseSharedExclusiveLockExclusive(Device->Lock);
+    }
+
+    return;
+}
+
+VOID
+CowDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles I/O IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL Complete;
+    PCOW_DEVICE Device;
+    BOOL Exclusive;
+    PIRP_READ_WRITE ReadWrite;
+    UINTN Size;
+    KSTATUS Status;
+
+    ASSERT(Irp->MajorCode == IrpMajorIo);
+
+    Complete = FALSE;
+    Device = (PCOW_DEVICE)DeviceContext;
+    ReadWrite = &(Irp->U.ReadWrite);
+    Status = STATUS_SUCCESS;
+
+    //
+    // Without an overlay, all I/O goes straight to the device. Page cache
+    // writeback can reach the device even when nothing has it open, so the
+    // overlay state is only looked at with the lock held. Writes need the
+    // lock exclusively, but only take it that way if there is an overlay.
+    //
+
+    Exclusive = FALSE;
+    KeAcquireSharedExclusiveLockShared(Device->Lock);
+    if ((Device->Active != FALSE) && (Irp->MinorCode == IrpMinorIoWrite)) {
+        KeReleaseSharedExclusiveLockShared(Device->Lock);
+        KeAcquireSharedExclusiveLockExclusive(Device->Lock);
+        Exclusive = TRUE;
+    }
+
+    if (Device->Active == FALSE) {
+        goto DispatchIoEnd;
+    }
+
+    ASSERT((IS_ALIGNED(ReadWrite->IoOffset, COW_SECTOR_SIZE)) &&
+           (IS_ALIGNED(ReadWrite->IoSizeInBytes, COW_SECTOR_SIZE)));
+
+    //
+    // Writes are absorbed entirely by the overlay and never reach the device.
+    //
+
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+
+        ASSERT(Irp->Direction == IrpDown);
+        ASSERT(Exclusive != FALSE);
+
+        ReadWrite->IoBytesCompleted = 0;
+        if (ReadWrite->IoOffset >= Device->Capacity) {
+            Status = STATUS_OUT_OF_BOUNDS;
+            goto DispatchIoEnd;
+        }
+
+        Size = ReadWrite->IoSizeInBytes;
+        if ((ReadWrite->IoOffset + Size) > Device->Capacity) {
+            Size = Device->Capacity - ReadWrite->IoOffset;
+        }
+
+        Status = CowpWriteOverlay(Device, ReadWrite, Size);
+        Complete = TRUE;
+        goto DispatchIoEnd;
+    }
+
+    ASSERT(Irp->MinorCode == IrpMinorIoRead);
+
+    //
+    // On the way down, satisfy the read from the overlay if the overlay holds
+    // all of it. Otherwise let the device read it.
+    //
+
+    if (Irp->Direction == IrpDown) {
+        ReadWrite->IoBytesCompleted = 0;
+        if ((ReadWrite->IoOffset >= Device->Capacity) ||
+            ((ReadWrite->IoOffset + ReadWrite->IoSizeInBytes) >
+             Device->Capacity)) {
+
+            goto DispatchIoEnd;
+        }
+
+        Status = CowpReadOverlay(Device,
+                                 ReadWrite,
+                                 ReadWrite->IoSizeInBytes,
+                                 &Complete);
+
+    //
+    // On the way back up, lay the overlay data over what the device read.
+    //
+
+    } else {
+
+        ASSERT(Irp->Direction == IrpUp);
+
+        if ((!KSUCCESS(IoGetIrpStatus(Irp))) ||
+            (ReadWrite->IoBytesCompleted == 0)) {
+
+            goto DispatchIoEnd;
+        }
+
+        Status = CowpReadOverlay(Device,
+                                 ReadWrite,
+                                 ReadWrite->IoBytesCompleted,
+                                 NULL);
+
+        if (!KSUCCESS(Status)) {
+            IoUpdateIrpStatus(Irp, Status);
+        }
+
+        Status = STATUS_SUCCESS;
+    }
+
+DispatchIoEnd:
+    if (Exclusive != FALSE) {
+        KeReleaseSharedExclusiveLockExclusive(Device->Lock);
+
+    } else {
+        KeReleaseSharedExclusiveLockShared(Device->Lock);
+    }
+
+    //
+    // Complete the IRP if the overlay handled it or something went wrong on
+    // the way down. Otherwise let it flow to the device.
+    //
+
+    if ((Complete != FALSE) ||
+        ((!KSUCCESS(Status)) && (Irp->Direction == IrpDown))) {
+
+        ReadWrite->NewIoOffset = ReadWrite->IoOffset +
+                                 ReadWrite->IoBytesCompleted;
+
+        IoCompleteIrp(CowDriver, Irp, Status);
+    }
+
+    return;
+}
+
+VOID
+CowDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PCOW_DEVICE Device;
+    PSYSTEM_CONTROL_LOOKUP Lookup;
+    PFILE_PROPERTIES Properties;
+
+    ASSERT(Irp->MajorCode == IrpMajorSystemControl);
+
+    Device = (PCOW_DEVICE)DeviceContext;
+    switch (Irp->MinorCode) {
+
+    //
+    // Remember the size of the device when it is looked up on the way back
+    // up. The device is always looked up before it is opened.
+    //
+
+    case IrpMinorSystemControlLookup:
+        Lookup = (PSYSTEM_CONTROL_LOOKUP)Irp->U.SystemControl.SystemContext;
+        if ((Irp->Direction == IrpUp) &&
+            (Lookup->Root != FALSE) &&
+            (KSUCCESS(IoGetIrpStatus(Irp)))) {
+
+            Properties = Lookup->Properties;
+            KeAcquireSharedExclusiveLockExclusive(Device->Lock);
+            Device->BlockSize = Properties->BlockSize;
+            Device->Capacity = Properties->Size;
+            KeReleaseSharedExclusiveLockExclusive(Device->Lock);
+        }
+
+        break;
+
+    case IrpMinorSystemControlDeviceInformation:
+        if (Irp->Direction == IrpDown) {
+            CowpHandleDeviceInformationRequest(Irp, Device);
+        }
+
+        break;
+
+    //
+    // Let everything else go down to the device.
+    //
+
+    default:
+        break;
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+CowpHandleDeviceInformationRequest (
+    PIRP Irp,
+    PCOW_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles requests to get and set the overlay device
+    information.
+
+Arguments:
+
+    Irp - Supplies a pointer to the IRP making the request.
+
+    Device - Supplies a pointer to the overlay device.
+
+Return Value:
+
+    None. Any completion status is set in the IRP.
+
+--*/
+
+{
+
+    PCOW_DEVICE_INFORMATION Information;
+    BOOL Match;
+    PSYSTEM_CONTROL_DEVICE_INFORMATION Request;
+    KSTATUS Status;
+
+    Request = Irp->U.SystemControl.SystemContext;
+
+    //
+    // If this is not a request for the overlay information, let it go down to
+    // the device.
+    //
+
+    Match = RtlAreUuidsEqual(&(Request->Uuid), &CowDeviceInformationUuid);
+    if (Match == FALSE) {
+        return;
+    }
+
+    if (Request->DataSize < sizeof(COW_DEVICE_INFORMATION)) {
+        Request->DataSize = sizeof(COW_DEVICE_INFORMATION);
+        Status = STATUS_BUFFER_TOO_SMALL;
+        goto HandleDeviceInformationRequestEnd;
+    }
+
+    Request->DataSize = sizeof(COW_DEVICE_INFORMATION);
+    Information = Request->Data;
+    Status = STATUS_SUCCESS;
+
+    //
+    // Write back whatever the page cache holds for the device before the
+    // overlay changes underneath it. Dirty pages written before an overlay is
+    // created belong on the device, and writeback must not race with the
+    // overlay being thrown away. The writes come back through this driver,
+    // so this cannot be done with the lock held.
+    //
+
+    if ((Request->Set != FALSE) &&
+        (Information->Version >= COW_DEVICE_INFORMATION_VERSION) &&
+        (Information->Operation != CowOperationNone)) {
+
+        Status = IoFlushDeviceCache(Irp->Device);
+        if (!KSUCCESS(Status)) {
+            goto HandleDeviceInformationRequestEnd;
+        }
+    }
+
+    KeAcquireSharedExclusiveLockExclusive(Device->Lock);
+    if (Request->Set != FALSE) {
+        if (Information->Version < COW_DEVICE_INFORMATION_VERSION) {
+            Status = STATUS_VERSION_MISMATCH;
+
+        } else {
+            Status = CowpPerformOperation(Device,
+                                          Irp->Device,
+                                          Information->Operation);
+        }
+    }
+
+    //
+    // Return the current state for both get and set requests.
+    //
+
+    RtlZeroMemory(Information, sizeof(COW_DEVICE_INFORMATION));
+    Information->Version = COW_DEVICE_INFORMATION_VERSION;
+    Information->Operation = CowOperationNone;
+    if (Device->Active != FALSE) {
+        Information->Flags |= COW_FLAG_ACTIVE;
+    }
+
+    Information->BlockSize = Device->BlockSize;
+    Information->Capacity = Device->Capacity;
+    Information->OverlaySize = Device->ChunkCount << COW_CHUNK_SHIFT;
+    Information->OverlayLimit = Device->ChunkLimit << COW_CHUNK_SHIFT;
+    KeReleaseSharedExclusiveLockExclusive(Device->Lock);
+
+HandleDeviceInformationRequestEnd:
+    IoCompleteIrp(CowDriver, Irp, Status);
+    return;
+}
+
+KSTATUS
+CowpPerformOperation (
+    PCOW_DEVICE Device,
+    PDEVICE OsDevice,
+    COW_OPERATION Operation
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates, resets, or discards an overlay. This routine assumes
+    the device lock is held exclusively.
+
+Arguments:
+
+    Device - Supplies a pointer to the overlay device.
+
+    OsDevice - Supplies a pointer to the OS device the overlay sits on.
+
+    Operation - Supplies the operation to perform.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_RESOURCE_IN_USE if the device is open.
+
+    STATUS_NOT_READY if the size of the device is not known yet.
+
+    STATUS_ALREADY_INITIALIZED if creating an overlay when one is active.
+
+    STATUS_NOT_INITIALIZED if resetting or discarding when there is no
+    overlay.
+
+    STATUS_INVALID_PARAMETER if the operation is not valid.
+
+--*/
+
+{
+
+    ASSERT(KeIsSharedExclusiveLockHeldExclusive(Device->Lock) != FALSE);
+
+    switch (Operation) {
+    case CowOperationNone:
+        return STATUS_SUCCESS;
+
+    case CowOperationCreate:
+    case CowOperationReset:
+    case CowOperationDiscard:
+        break;
+
+    default:
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    // Changing the data under an open device would pull it out from under the
+    // page cache and any mounted file system. The caller has already flushed
+    // the page cache, and nothing can dirty it again without opening the
+    // device.
+    //
+
+    if (Device->OpenCount != 0) {
+        return STATUS_RESOURCE_IN_USE;
+    }
+
+    if (Operation == CowOperationCreate) {
+        if (Device->Active != FALSE) {
+            return STATUS_ALREADY_INITIALIZED;
+        }
+
+        if ((Device->Capacity == 0) ||
+            (Device->BlockSize < COW_SECTOR_SIZE) ||
+            (!IS_ALIGNED(Device->Capacity, COW_SECTOR_SIZE))) {
+
+            return STATUS_NOT_READY;
+        }
+
+        ASSERT(Device->ChunkCount == 0);
+
+        Device->Active = TRUE;
+        return STATUS_SUCCESS;
+    }
+
+    if (Device->Active == FALSE) {
+        return STATUS_NOT_INITIALIZED;
+    }
+
+    //
+    // Throw away the overlay data, along with any copies of it the page cache
+    // still has.
+    //
+
+    CowpDestroyOverlay(Device);
+    IoEvictDeviceCache(OsDevice, 0, -1);
+    if (Operation == CowOperationDiscard) {
+        Device->Active = FALSE;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+CowpWriteOverlay (
+    PCOW_DEVICE Device,
+    PIRP_READ_WRITE ReadWrite,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies write data into the overlay. This routine assumes the
+    device lock is held exclusively.
+
+Arguments:
+
+    Device - Supplies a pointer to the overlay device.
+
+    ReadWrite - Supplies a pointer to the write request. The bytes completed
+        are updated as data is copied.
+
+    Size - Supplies the number of bytes to write, which must be a multiple of
+        the sector size.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_VOLUME_FULL if the overlay has reached its memory limit.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+    Other errors if the I/O buffer could not be copied.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    UINTN BytesThisRound;
+    PCOW_CHUNK Chunk;
+    ULONGLONG ChunkIndex;
+    UINTN ChunkOffset;
+    ULONGLONG Offset;
+    ULONG Sector;
+    KSTATUS Status;
+
+    ASSERT(IS_ALIGNED(Size, COW_SECTOR_SIZE));
+
+    Status = STATUS_SUCCESS;
+    while (ReadWrite->IoBytesCompleted < Size) {
+        Offset = ReadWrite->IoOffset + ReadWrite->IoBytesCompleted;
+        ChunkIndex = Offset >> COW_CHUNK_SHIFT;
+        ChunkOffset = Offset & (COW_CHUNK_SIZE - 1);
+        BytesThisRound = COW_CHUNK_SIZE - ChunkOffset;
+        if (BytesThisRound > (Size - ReadWrite->IoBytesCompleted)) {
+            BytesThisRound = Size - ReadWrite->IoBytesCompleted;
+        }
+
+        //
+        // Find or create the chunk covering this part of the write.
+        //
+
+        Chunk = CowpFindChunk(Device, ChunkIndex, FALSE);
+        if ((Chunk == NULL) || (Chunk->Index != ChunkIndex)) {
+            if (Device->ChunkCount >= Device->ChunkLimit) {
+                Status = STATUS_VOLUME_FULL;
+                break;
+            }
+
+            AllocationSize = sizeof(COW_CHUNK) + COW_CHUNK_SIZE;
+            Chunk = MmAllocatePagedPool(AllocationSize, COW_ALLOCATION_TAG);
+            if (Chunk == NULL) {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+
+            RtlZeroMemory(Chunk, sizeof(COW_CHUNK));
+            Chunk->Index = ChunkIndex;
+            RtlRedBlackTreeInsert(&(Device->ChunkTree), &(Chunk->TreeNode));
+            Device->ChunkCount += 1;
+        }
+
+        Status = MmCopyIoBufferData(ReadWrite->IoBuffer,
+                                    COW_CHUNK_DATA(Chunk) + ChunkOffset,
+                                    ReadWrite->IoBytesCompleted,
+                                    BytesThisRound,
+                                    FALSE);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        //
+        // Mark the sectors as written. A failed copy above leaves them alone,
+        // so any partial data in them is never read.
+        //
+
+        for (Sector = ChunkOffset >> COW_SECTOR_SHIFT;
+             Sector < (ChunkOffset + BytesThisRound) >> COW_SECTOR_SHIFT;
+             Sector += 1) {
+
+            COW_SET_SECTOR_VALID(Chunk, Sector);
+        }
+
+        ReadWrite->IoBytesCompleted += BytesThisRound;
+    }
+
+    return Status;
+}
+
+KSTATUS
+CowpReadOverlay (
+    PCOW_DEVICE Device,
+    PIRP_READ_WRITE ReadWrite,
+    UINTN Size,
+    PBOOL Complete
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies overlay data into a read request's I/O buffer. This
+    routine assumes the device lock is held.
+
+Arguments:
+
+    Device - Supplies a pointer to the overlay device.
+
+    ReadWrite - Supplies a pointer to the read request.
+
+    Size - Supplies the number of bytes of the request to cover.
+
+    Complete - Supplies an optional pointer that, if supplied, makes this
+        routine copy nothing unless the overlay holds the entire range. It
+        returns whether the read was satisfied entirely from the overlay, in
+        which case the bytes completed are updated.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN BufferOffset;
+    PCOW_CHUNK Chunk;
+    UINTN ChunkOffset;
+    UINTN ChunkSize;
+    ULONGLONG ChunkStart;
+    ULONGLONG End;
+    ULONGLONG Offset;
+    UINTN RunSize;
+    UINTN RunStart;
+    ULONG Sector;
+    ULONG SectorEnd;
+    KSTATUS Status;
+
+    Offset = ReadWrite->IoOffset;
+    End = Offset + Size;
+    Status = STATUS_SUCCESS;
+    if (Complete != NULL) {
+        *Complete = FALSE;
+    }
+
+    if (Device->ChunkCount == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // If the caller only wants fully covered reads, check that every sector
+    // is in the overlay before copying anything.
+    //
+
+    if (Complete != NULL) {
+        while (Offset < End) {
+            Chunk = CowpFindChunk(Device, Offset >> COW_CHUNK_SHIFT, FALSE);
+            if ((Chunk == NULL) ||
+                (Chunk->Index != (Offset >> COW_CHUNK_SHIFT))) {
+
+                return STATUS_SUCCESS;
+            }
+
+            Sector = (Offset & (COW_CHUNK_SIZE - 1)) >> COW_SECTOR_SHIFT;
+            while ((Sector < COW_CHUNK_SECTORS) && (Offset < End)) {
+                if (!COW_IS_SECTOR_VALID(Chunk, Sector)) {
+                    return STATUS_SUCCESS;
+                }
+
+                Sector += 1;
+                Offset += COW_SECTOR_SIZE;
+            }
+        }
+
+        Offset = ReadWrite->IoOffset;
+    }
+
+    //
+    // Walk the chunks in the range, copying each run of overlay sectors.
+    //
+
+    Chunk = CowpFindChunk(Device, Offset >> COW_CHUNK_SHIFT, TRUE);
+    while (Chunk != NULL) {
+        ChunkStart = Chunk->Index << COW_CHUNK_SHIFT;
+        if (ChunkStart >= End) {
+            break;
+        }
+
+        ChunkOffset = 0;
+        if (ChunkStart < Offset) {
+            ChunkOffset = Offset - ChunkStart;
+        }
+
+        ChunkSize = COW_CHUNK_SIZE;
+        if (ChunkStart + ChunkSize > End) {
+            ChunkSize = End - ChunkStart;
+        }
+
+        Sector = ChunkOffset >> COW_SECTOR_SHIFT;
+        SectorEnd = ChunkSize >> COW_SECTOR_SHIFT;
+        while (Sector < SectorEnd) {
+            if (!COW_IS_SECTOR_VALID(Chunk, Sector)) {
+                Sector += 1;
+                continue;
+            }
+
+            RunStart = Sector << COW_SECTOR_SHIFT;
+            while ((Sector < SectorEnd) &&
+                   (COW_IS_SECTOR_VALID(Chunk, Sector))) {
+
+                Sector += 1;
+            }
+
+            RunSize = (Sector << COW_SECTOR_SHIFT) - RunStart;
+            BufferOffset = ChunkStart + RunStart - ReadWrite->IoOffset;
+            Status = MmCopyIoBufferData(ReadWrite->IoBuffer,
+                                        COW_CHUNK_DATA(Chunk) + RunStart,
+                                        BufferOffset,
+                                        RunSize,
+                                        TRUE);
+
+            if (!KSUCCESS(Status)) {
+                return Status;
+            }
+        }
+
+        Chunk = (PCOW_CHUNK)RtlRedBlackTreeGetNextNode(&(Device->ChunkTree),
+                                                       FALSE,
+                                                       &(Chunk->TreeNode));
+    }
+
+    if (Complete != NULL) {
+        ReadWrite->IoBytesCompleted = Size;
+        *Complete = TRUE;
+    }
+
+    return Status;
+}
+
+PCOW_CHUNK
+CowpFindChunk (
+    PCOW_DEVICE Device,
+    ULONGLONG Index,
+    BOOL GreaterThan
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds an overlay chunk. This routine assumes the device lock
+    is held.
+
+Arguments:
+
+    Device - Supplies a pointer to the overlay device.
+
+    Index - Supplies the index of the chunk to find.
+
+    GreaterThan - Supplies a boolean indicating whether to return the closest
+        following chunk if the chunk does not exist (TRUE), or to return the
+        closest preceding chunk (FALSE).
+
+Return Value:
+
+    Returns a pointer to the chunk with the given index, or the closest chunk
+    in the given direction.
+
+    NULL if there is no such chunk.
+
+--*/
+
+{
+
+    PRED_BLACK_TREE_NODE FoundNode;
+    COW_CHUNK Search;
+
+    Search.Index = Index;
+    FoundNode = RtlRedBlackTreeSearchClosest(&(Device->ChunkTree),
+                                             &(Search.TreeNode),
+                                             GreaterThan);
+
+    if (FoundNode == NULL) {
+        return NULL;
+    }
+
+    return RED_BLACK_TREE_VALUE(FoundNode, COW_CHUNK, TreeNode);
+}
+
+VOID
+CowpDestroyOverlay (
+    PCOW_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees all overlay data. This routine assumes the device lock
+    is held exclusively, or that the device is being destroyed.
+
+Arguments:
+
+    Device - Supplies a pointer to the overlay device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PCOW_CHUNK Chunk;
+    PRED_BLACK_TREE_NODE TreeNode;
+
+    while (TRUE) {
+        TreeNode = RtlRedBlackTreeGetLowestNode(&(Device->ChunkTree));
+        if (TreeNode == NULL) {
+            break;
+        }
+
+        RtlRedBlackTreeRemove(&(Device->ChunkTree), TreeNode);
+        Chunk = RED_BLACK_TREE_VALUE(TreeNode, COW_CHUNK, TreeNode);
+        MmFreePagedPool(Chunk);
+    }
+
+    Device->ChunkCount = 0;
+    return;
+}
+
+VOID
+CowpDestroyDevice (
+    PCOW_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys an overlay device.
+
+Arguments:
+
+    Device - Supplies a pointer to the overlay device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Device->OpenCount == 0);
+
+    CowpDestroyOverlay(Device);
+    if (Device->Lock != NULL) {
+        KeDestroySharedExclusiveLock(Device->Lock);
+    }
+
+    MmFreePagedPool(Device);
+    return;
+}
+
+COMPARISON_RESULT
+CowpCompareChunks (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two overlay chunks by index.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PCOW_CHUNK FirstChunk;
+    PCOW_CHUNK SecondChunk;
+
+    FirstChunk = RED_BLACK_TREE_VALUE(FirstNode, COW_CHUNK, TreeNode);
+    SecondChunk = RED_BLACK_TREE_VALUE(SecondNode, COW_CHUNK, TreeNode);
+    if (FirstChunk->Index < SecondChunk->Index) {
+        return ComparisonResultAscending;
+    }
+
+    if (FirstChunk->Index > SecondChunk->Index) {
+        return ComparisonResultDescending;
+    }
+
+    return ComparisonResultSame;
+}
+
@@ -20,6 +20,13 @@ Module Name:
     handling. Be aware of this if using this driver as a template to write
     your own.
 
+    In addition to the RAM disks handed over by the boot environment, the
+    driver attaches to a root control device through which dynamic RAM disks
+    can be created and destroyed at runtime. Dynamic RAM disks are backed by
+    physical pages that are allocated when first written and freed when
+    discarded. The pages are only mapped, through an I/O buffer, while a
+    request is copying to or from them.
+
 Author:
 
     Evan Green 17-Oct-2012
@@ -36,6 +43,7 @@ Module Name:
 
 #include <minoca/kernel/driver.h>
 #include <minoca/kernel/sysres.h>
+#include <minoca/devinfo/ramdisk.h>
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -44,6 +52,28 @@ Module Name:
 #define RAM_DISK_ALLOCATION_TAG 0x444D4152 // 'DMAR'
 #define RAM_DISK_SECTOR_SIZE 0x200
 
+//
+// Define the size of a device ID string, which is "RamDisk" followed by the
+// hex identifier.
+//
+
+#define RAM_DISK_DEVICE_ID_SIZE 16
+
+//
+// Define the fraction of physical memory, as a shift, that a dynamic RAM disk
+// may span.
+//
+
+#define RAM_DISK_DYNAMIC_LIMIT_SHIFT 1
+
+//
+// Define the number of pages each page table of a dynamic RAM disk covers, as
+// a shift.
+//
+
+#define RAM_DISK_PAGE_TABLE_SHIFT 9
+#define RAM_DISK_PAGE_TABLE_SIZE (1 << RAM_DISK_PAGE_TABLE_SHIFT)
+
 //
 // --------------------------------------------------------------------- Macros
 //
@@ -52,6 +82,71 @@ Module Name:
 // ------------------------------------------------------ Data Type Definitions
 //
 
+typedef enum _RAM_DISK_TYPE {
+    RamDiskTypeInvalid,
+    RamDiskTypeFixed,
+    RamDiskTypeDynamic,
+    RamDiskTypeControl
+} RAM_DISK_TYPE, *PRAM_DISK_TYPE;
+
+/*++
+
+Structure Description:
+
+    This structure defines one page table of a dynamic RAM disk, which holds
+    the backing pages for a run of RAM_DISK_PAGE_TABLE_SIZE pages of the disk.
+
+Members:
+
+    ValidCount - Stores the number of pages in the table that are backed. The
+        table is freed when this drops to zero.
+
+    Pages - Stores the physical addresses of the pages backing the disk. Pages
+        that have never been written (or have been discarded) are
+        INVALID_PHYSICAL_ADDRESS and read as zeroes.
+
+--*/
+
+typedef struct _RAM_DISK_PAGE_TABLE {
+    ULONG ValidCount;
+    PHYSICAL_ADDRESS Pages[RAM_DISK_PAGE_TABLE_SIZE];
+} RAM_DISK_PAGE_TABLE, *PRAM_DISK_PAGE_TABLE;
+
+/*++
+
+Structure Description:
+
+    This structure defines the sparse backing store of a dynamic RAM disk.
+
+Members:
+
+    ReferenceCount - Stores the number of references on the store. The device
+        holds one, and each open handle holds one.
+
+    Lock - Stores a pointer to a lock protecting the page tables. Reads
+        acquire it shared, writes and discards acquire it exclusive.
+
+    Directory - Stores an array of pointers to the page tables of the disk.
+        A table is only allocated once a page it covers is written, so the
+        metadata of a disk grows with the data written to it.
+
+    DirectorySize - Stores the number of elements in the directory.
+
+    PageCount - Stores the number of pages in the disk.
+
+    AllocatedPages - Stores the number of pages currently allocated.
+
+--*/
+
+typedef struct _RAM_DISK_STORE {
+    volatile ULONG ReferenceCount;
+    PSHARED_EXCLUSIVE_LOCK Lock;
+    PRAM_DISK_PAGE_TABLE *Directory;
+    UINTN DirectorySize;
+    UINTN PageCount;
+    UINTN AllocatedPages;
+} RAM_DISK_STORE, *PRAM_DISK_STORE;
+
 /*++
 
 Structure Description:
@@ -60,18 +155,39 @@ Structure Description:
 
 Members:
 
+    ListEntry - Stores pointers to the next and previous dynamic RAM disks.
+        This is only used by dynamic RAM disks, and is NULL once the disk is
+        no longer in the list.
+
+    Type - Stores the type of RAM disk device.
+
+    Identifier - Stores the number in the device ID.
+
+    Device - Stores a pointer to the OS device of a dynamic RAM disk.
+
     PhysicalAddress - Stores the physical address of the buffer.
 
     Buffer - Stores a pointer to the buffer of the raw RAM disk.
 
     Size - Stores the total size of the RAM disk, in bytes.
 
+    Store - Stores a pointer to the backing store of a dynamic RAM disk.
+
+    Access - Stores the access the handle was opened with. This is only valid
+        in the copy made for each open handle.
+
 --*/
 
 typedef struct _RAM_DISK_DEVICE {
+    LIST_ENTRY ListEntry;
+    RAM_DISK_TYPE Type;
+    ULONG Identifier;
+    PDEVICE Device;
     PHYSICAL_ADDRESS PhysicalAddress;
     PVOID Buffer;
     ULONGLONG Size;
+    PRAM_DISK_STORE Store;
+    ULONG Access;
 } RAM_DISK_DEVICE, *PRAM_DISK_DEVICE;
 
 //
@@ -122,6 +238,85 @@ RamDiskDispatchSystemControl (
     PVOID IrpContext
     );
 
+VOID
+RamDiskDispatchUserControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+KSTATUS
+RamDiskpPerformDynamicIo (
+    PIRP Irp,
+    PRAM_DISK_STORE Store,
+    UINTN Size
+    );
+
+PHYSICAL_ADDRESS
+RamDiskpGetPage (
+    PRAM_DISK_STORE Store,
+    UINTN PageIndex
+    );
+
+KSTATUS
+RamDiskpSetPage (
+    PRAM_DISK_STORE Store,
+    UINTN PageIndex,
+    PHYSICAL_ADDRESS PhysicalAddress
+    );
+
+KSTATUS
+RamDiskpZeroPage (
+    PHYSICAL_ADDRESS PhysicalAddress,
+    UINTN Offset,
+    UINTN Size
+    );
+
+KSTATUS
+RamDiskpCopyUserControlBuffer (
+    PIRP Irp,
+    PVOID Buffer,
+    UINTN Size,
+    BOOL ToUserBuffer
+    );
+
+KSTATUS
+RamDiskpCreateDynamicDisk (
+    PRAM_DISK_DESCRIPTION Description
+    );
+
+KSTATUS
+RamDiskpDestroyDynamicDisk (
+    ULONG Identifier
+    );
+
+VOID
+RamDiskpRemoveDynamicDisk (
+    PRAM_DISK_DEVICE Disk
+    );
+
+KSTATUS
+RamDiskpDiscard (
+    PRAM_DISK_STORE Store,
+    PRAM_DISK_DISCARD Discard
+    );
+
+VOID
+RamDiskpGetDescription (
+    PRAM_DISK_DEVICE Disk,
+    PRAM_DISK_DESCRIPTION Description
+    );
+
+VOID
+RamDiskpStoreAddReference (
+    PRAM_DISK_STORE Store
+    );
+
+VOID
+RamDiskpStoreReleaseReference (
+    PRAM_DISK_STORE Store
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -138,6 +333,21 @@ PDRIVER RamDiskDriver = NULL;
 
 volatile ULONG RamDiskNextIdentifier = 0;
 
+//
+// Store the list of dynamic RAM disks, and the lock protecting it.
+//
+
+LIST_ENTRY RamDiskDynamicList;
+PQUEUED_LOCK RamDiskDynamicListLock;
+
+//
+// Store the physical address of a page of zeroes that reads of unbacked
+// pages of dynamic RAM disks copy from. It is allocated with the first
+// dynamic disk, under the list lock.
+//
+
+PHYSICAL_ADDRESS RamDiskZeroPage = INVALID_PHYSICAL_ADDRESS;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -170,7 +380,7 @@ Return Value:
 {
 
     volatile ULONG DeviceId;
-    CHAR DeviceIdString[11];
+    CHAR DeviceIdString[RAM_DISK_DEVICE_ID_SIZE];
     DRIVER_FUNCTION_TABLE FunctionTable;
     PSYSTEM_RESOURCE_HEADER GenericHeader;
     PRAM_DISK_DEVICE RamDiskDevice;
@@ -186,11 +396,19 @@ Return Value:
     FunctionTable.DispatchClose = RamDiskDispatchClose;
     FunctionTable.DispatchIo = RamDiskDispatchIo;
     FunctionTable.DispatchSystemControl = RamDiskDispatchSystemControl;
+    FunctionTable.DispatchUserControl = RamDiskDispatchUserControl;
     Status = IoRegisterDriverFunctions(Driver, &FunctionTable);
     if (!KSUCCESS(Status)) {
         goto DriverEntryEnd;
     }
 
+    INITIALIZE_LIST_HEAD(&RamDiskDynamicList);
+    RamDiskDynamicListLock = KeCreateQueuedLock();
+    if (RamDiskDynamicListLock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto DriverEntryEnd;
+    }
+
     //
     // Get all RAM disks from the boot environment. This is not normally how
     // devices are created or enumerated. The RAM disk is special in that its
@@ -219,14 +437,16 @@ Return Value:
         }
 
         RtlZeroMemory(RamDiskDevice, sizeof(RAM_DISK_DEVICE));
+        RamDiskDevice->Type = RamDiskTypeFixed;
         RamDiskDevice->PhysicalAddress =
                                        RamDiskResource->Header.PhysicalAddress;
 
         RamDiskDevice->Buffer = RamDiskResource->Header.VirtualAddress;
         RamDiskDevice->Size = RamDiskResource->Header.Size;
         DeviceId = RtlAtomicAdd32(&RamDiskNextIdentifier, 1);
+        RamDiskDevice->Identifier = DeviceId;
         RtlPrintToString(DeviceIdString,
-                         11,
+                         RAM_DISK_DEVICE_ID_SIZE,
                          CharacterEncodingDefault,
                          "RamDisk%x",
                          DeviceId);
@@ -265,7 +485,7 @@ RamDiskAddDevice (
 
 Routine Description:
 
-    This routine is called when a RAM disk is detected.
+    This routine is called when the RAM disk control device is detected.
 
 Arguments:
 
@@ -292,14 +512,35 @@ Return Value:
 
 {
 
+    PRAM_DISK_DEVICE Control;
+    KSTATUS Status;
+
     //
-    // The RAM disk is not a real device, so it is not expected to be
-    // attaching to emerging stacks. A proper driver should examine the device
-    // ID and call IoAttachDriverToDevice to connect their driver to a newly
-    // enumerated device.
+    // The RAM disks themselves are not real devices, so they are not
+    // expected to be attaching to emerging stacks. The only device the driver
+    // attaches to is the root control device used to create dynamic RAM
+    // disks.
     //
 
-    return STATUS_NOT_IMPLEMENTED;
+    if (IoAreDeviceIdsEqual(DeviceId, RAM_DISK_CONTROL_DEVICE_ID) == FALSE) {
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    Control = MmAllocateNonPagedPool(sizeof(RAM_DISK_DEVICE),
+                                     RAM_DISK_ALLOCATION_TAG);
+
+    if (Control == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Control, sizeof(RAM_DISK_DEVICE));
+    Control->Type = RamDiskTypeControl;
+    Status = IoAttachDriverToDevice(Driver, DeviceToken, Control);
+    if (!KSUCCESS(Status)) {
+        MmFreeNonPagedPool(Control);
+    }
+
+    return Status;
 }
 
 VOID
@@ -335,10 +576,13 @@ Return Value:
 {
 
     BOOL CompleteIrp;
+    PRAM_DISK_DEVICE Disk;
     KSTATUS Status;
 
     ASSERT(Irp->MajorCode == IrpMajorStateChange);
 
+    Disk = (PRAM_DISK_DEVICE)DeviceContext;
+
     //
     // The IRP is on its way down the stack. Do most processing here.
     //
@@ -361,6 +605,22 @@ Return Value:
             Status = STATUS_SUCCESS;
             break;
 
+        //
+        // Dynamic RAM disks go away when removed, taking their memory with
+        // them once the last handle is closed.
+        //
+
+        case IrpMinorRemoveDevice:
+            if (Disk->Type == RamDiskTypeDynamic) {
+                RamDiskpRemoveDynamicDisk(Disk);
+                Status = STATUS_SUCCESS;
+
+            } else {
+                CompleteIrp = FALSE;
+            }
+
+            break;
+
         //
         // Pass all other IRPs down.
         //
@@ -441,6 +701,11 @@ Return Value:
     }
 
     RtlCopyMemory(DiskCopy, Disk, sizeof(RAM_DISK_DEVICE));
+    DiskCopy->Access = Irp->U.Open.DesiredAccess;
+    if (DiskCopy->Store != NULL) {
+        RamDiskpStoreAddReference(DiskCopy->Store);
+    }
+
     Irp->U.Open.DeviceContext = DiskCopy;
     IoCompleteIrp(RamDiskDriver, Irp, STATUS_SUCCESS);
     return;
@@ -478,7 +743,14 @@ Return Value:
 
 {
 
-    MmFreePagedPool(Irp->U.Close.DeviceContext);
+    PRAM_DISK_DEVICE Disk;
+
+    Disk = Irp->U.Close.DeviceContext;
+    if (Disk->Store != NULL) {
+        RamDiskpStoreReleaseReference(Disk->Store);
+    }
+
+    MmFreePagedPool(Disk);
     IoCompleteIrp(RamDiskDriver, Irp, STATUS_SUCCESS);
     return;
 }
@@ -535,6 +807,11 @@ Return Value:
 
     Irp->U.ReadWrite.IoBytesCompleted = 0;
     IoOffset = Irp->U.ReadWrite.IoOffset;
+    if (Disk->Type == RamDiskTypeControl) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto DispatchIoEnd;
+    }
+
     if (IoOffset >= Disk->Size) {
         Status = STATUS_OUT_OF_BOUNDS;
         goto DispatchIoEnd;
@@ -568,6 +845,16 @@ Return Value:
 
     ReadWriteIrpPrepared = TRUE;
 
+    //
+    // Dynamic RAM disks are backed by individual pages rather than one
+    // contiguous buffer.
+    //
+
+    if (Disk->Type == RamDiskTypeDynamic) {
+        Status = RamDiskpPerformDynamicIo(Irp, Disk->Store, BytesToComplete);
+        goto DispatchIoEnd;
+    }
+
     //
     // Transfer the data between the disk and I/O buffer.
     //
@@ -645,7 +932,23 @@ Return Value:
     case IrpMinorSystemControlLookup:
         Lookup = (PSYSTEM_CONTROL_LOOKUP)Context;
         Status = STATUS_PATH_NOT_FOUND;
-        if (Lookup->Root != FALSE) {
+        if ((Lookup->Root != FALSE) && (Disk->Type == RamDiskTypeControl)) {
+
+            //
+            // The control device opens as a character device that only
+            // accepts user control requests.
+            //
+
+            Properties = Lookup->Properties;
+            Properties->FileId = 0;
+            Properties->Type = IoObjectCharacterDevice;
+            Properties->HardLinkCount = 1;
+            Properties->BlockSize = 1;
+            Properties->BlockCount = 0;
+            Properties->Size = 0;
+            Status = STATUS_SUCCESS;
+
+        } else if (Lookup->Root != FALSE) {
 
             //
             // Enable opening of the root as a single file.
@@ -674,7 +977,10 @@ Return Value:
         FileOperation = (PSYSTEM_CONTROL_FILE_OPERATION)Context;
         Properties = FileOperation->FileProperties;
         PropertiesFileSize = Properties->Size;
-        if ((Properties->FileId != 0) ||
+        if (Disk->Type == RamDiskTypeControl) {
+            Status = STATUS_SUCCESS;
+
+        } else if ((Properties->FileId != 0) ||
             (Properties->Type != IoObjectBlockDevice) ||
             (Properties->HardLinkCount != 1) ||
             (Properties->BlockSize != RAM_DISK_SECTOR_SIZE) ||
@@ -724,7 +1030,1104 @@ Return Value:
     return;
 }
 
+VOID
+RamDiskDispatchUserControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles User Control IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RAM_DISK_CONTROL ControlCode;
+    RAM_DISK_DESCRIPTION Description;
+    RAM_DISK_DISCARD Discard;
+    PRAM_DISK_DEVICE Disk;
+    KSTATUS Status;
+
+    ASSERT(Irp->MajorCode == IrpMajorUserControl);
+
+    ControlCode = (RAM_DISK_CONTROL)Irp->MinorCode;
+    Disk = Irp->U.UserControl.DeviceContext;
+    switch (ControlCode) {
+
+    //
+    // Creating and destroying RAM disks ties up kernel memory, so it is
+    // reserved for administrators.
+    //
+
+    case RamDiskControlCreate:
+    case RamDiskControlDestroy:
+        if (Disk->Type != RamDiskTypeControl) {
+            Status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+
+        if (Irp->U.UserControl.FromKernelMode == FALSE) {
+            Status = PsCheckPermission(PERMISSION_SYSTEM_ADMINISTRATOR);
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+        }
+
+        Status = RamDiskpCopyUserControlBuffer(Irp,
+                                               &Description,
+                                               sizeof(RAM_DISK_DESCRIPTION),
+                                               FALSE);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        if (Description.Version < RAM_DISK_DESCRIPTION_VERSION) {
+            Status = STATUS_VERSION_MISMATCH;
+            break;
+        }
+
+        if (ControlCode == RamDiskControlDestroy) {
+            Status = RamDiskpDestroyDynamicDisk(Description.Identifier);
+            break;
+        }
+
+        Status = RamDiskpCreateDynamicDisk(&Description);
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        Status = RamDiskpCopyUserControlBuffer(Irp,
+                                               &Description,
+                                               sizeof(RAM_DISK_DESCRIPTION),
+                                               TRUE);
+
+        break;
+
+    case RamDiskControlGetInformation:
+        if (Disk->Type == RamDiskTypeControl) {
+            Status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+
+        RamDiskpGetDescription(Disk, &Description);
+        Status = RamDiskpCopyUserControlBuffer(Irp,
+                                               &Description,
+                                               sizeof(RAM_DISK_DESCRIPTION),
+                                               TRUE);
+
+        break;
+
+    case RamDiskControlDiscard:
+        if (Disk->Type != RamDiskTypeDynamic) {
+            Status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+
+        if ((Disk->Access & IO_ACCESS_WRITE) == 0) {
+            Status = STATUS_ACCESS_DENIED;
+            break;
+        }
+
+        Status = RamDiskpCopyUserControlBuffer(Irp,
+                                               &Discard,
+                                               sizeof(RAM_DISK_DISCARD),
+                                               FALSE);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        //
+        // Write back the page cache first, as whole pages around the edges of
+        // the region are about to be evicted. Once the pages are gone, drop
+        // the cached copies so they neither serve the old data nor write it
+        // back later.
+        //
+
+        Status = IoFlushDeviceCache(Irp->Device);
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        Status = RamDiskpDiscard(Disk->Store, &Discard);
+        if (KSUCCESS(Status)) {
+            IoEvictDeviceCache(Irp->Device, Discard.Offset, Discard.Size);
+        }
+
+        break;
+
+    default:
+        Status = STATUS_NOT_SUPPORTED;
+        break;
+    }
+
+    IoCompleteIrp(RamDiskDriver, Irp, Status);
+    return;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
 
+KSTATUS
+RamDiskpPerformDynamicIo (
+    PIRP Irp,
+    PRAM_DISK_STORE Store,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine transfers data between a prepared read or write IRP and the
+    pages backing a dynamic RAM disk. Writes allocate any pages they touch
+    that are not yet backed. Reads of unbacked pages return zeroes.
+
+    The backing pages are gathered into a temporary I/O buffer, which maps
+    them for the copy. The pages are not handed to the caller's I/O buffer
+    directly, as nothing would keep a discard from freeing them while the
+    caller still held them.
+
+Arguments:
+
+    Irp - Supplies a pointer to the read or write IRP, which has already been
+        prepared for polled I/O.
+
+    Store - Supplies a pointer to the backing store of the disk.
+
+    Size - Supplies the number of bytes to transfer, which has already been
+        clipped to the size of the disk.
+
+Return Value:
+
+    Status code. The IRP's bytes completed is updated on both success and
+    failure.
+
+--*/
+
+{
+
+    UINTN BytesGathered;
+    UINTN CopySize;
+    KSTATUS CopyStatus;
+    UINTN FirstPage;
+    UINTN PageCount;
+    UINTN PageIndex;
+    UINTN PageOffset;
+    ULONG PageShift;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    KSTATUS Status;
+    PIO_BUFFER StoreBuffer;
+    BOOL Write;
+
+    CopySize = 0;
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    FirstPage = Irp->U.ReadWrite.IoOffset >> PageShift;
+    PageOffset = REMAINDER(Irp->U.ReadWrite.IoOffset, PageSize);
+    PageCount = ALIGN_RANGE_UP(PageOffset + Size, PageSize) >> PageShift;
+    StoreBuffer = MmAllocateUninitializedIoBuffer(PageCount << PageShift, 0);
+    if (StoreBuffer == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto PerformDynamicIoEnd;
+    }
+
+    Status = STATUS_SUCCESS;
+    Write = FALSE;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        Write = TRUE;
+        KeAcquireSharedExclusiveLockExclusive(Store->Lock);
+
+    } else {
+        KeAcquireSharedExclusiveLockShared(Store->Lock);
+    }
+
+    //
+    // Gather the pages covering the request. Holes read from the zero page.
+    //
+
+    for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+        PhysicalAddress = RamDiskpGetPage(Store, FirstPage + PageIndex);
+        if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+            if (Write == FALSE) {
+                PhysicalAddress = RamDiskZeroPage;
+
+            } else {
+
+                //
+                // Back the page on its first write. Only zero it if the
+                // write does not cover it entirely.
+                //
+
+                PhysicalAddress = MmAllocatePhysicalPage();
+                if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                    break;
+                }
+
+                if (((PageIndex == 0) && (PageOffset != 0)) ||
+                    ((PageIndex == (PageCount - 1)) &&
+                     (!IS_ALIGNED(PageOffset + Size, PageSize)))) {
+
+                    Status = RamDiskpZeroPage(PhysicalAddress, 0, PageSize);
+                    if (!KSUCCESS(Status)) {
+                        MmFreePhysicalPage(PhysicalAddress);
+                        break;
+                    }
+                }
+
+                Status = RamDiskpSetPage(Store,
+                                         FirstPage + PageIndex,
+                                         PhysicalAddress);
+
+                if (!KSUCCESS(Status)) {
+                    MmFreePhysicalPage(PhysicalAddress);
+                    break;
+                }
+            }
+        }
+
+        Status = MmAppendIoBufferData(StoreBuffer,
+                                      NULL,
+                                      PhysicalAddress,
+                                      PageSize);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+    }
+
+    //
+    // Copy as much as the gathered pages cover, even if gathering stopped
+    // early.
+    //
+
+    BytesGathered = PageIndex << PageShift;
+    if (BytesGathered > PageOffset) {
+        CopySize = BytesGathered - PageOffset;
+        if (CopySize > Size) {
+            CopySize = Size;
+        }
+
+        if (Write != FALSE) {
+            CopyStatus = MmCopyIoBuffer(StoreBuffer,
+                                        PageOffset,
+                                        Irp->U.ReadWrite.IoBuffer,
+                                        0,
+                                        CopySize);
+
+        } else {
+            CopyStatus = MmCopyIoBuffer(Irp->U.ReadWrite.IoBuffer,
+                                        0,
+                                        StoreBuffer,
+                                        PageOffset,
+                                        CopySize);
+        }
+
+        if (!KSUCCESS(CopyStatus)) {
+            Status = CopyStatus;
+            CopySize = 0;
+        }
+    }
+
+    if (Write != FALSE) {
+        KeReleaseSharedExclusiveLockExclusive(Store->Lock);
+
+    } else {
+        KeReleaseSharedExclusiveLockShared(Store->Lock);
+    }
+
+PerformDynamicIoEnd:
+    if (StoreBuffer != NULL) {
+        MmFreeIoBuffer(StoreBuffer);
+    }
+
+    Irp->U.ReadWrite.IoBytesCompleted = CopySize;
+    return Status;
+}
+
+PHYSICAL_ADDRESS
+RamDiskpGetPage (
+    PRAM_DISK_STORE Store,
+    UINTN PageIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the physical page backing a page of a dynamic RAM
+    disk. The caller must hold the store lock.
+
+Arguments:
+
+    Store - Supplies a pointer to the backing store of the disk.
+
+    PageIndex - Supplies the index of the page within the disk.
+
+Return Value:
+
+    Returns the physical address of the page backing the given page.
+
+    INVALID_PHYSICAL_ADDRESS if the page is not backed.
+
+--*/
+
+{
+
+    PRAM_DISK_PAGE_TABLE Table;
+
+    ASSERT(PageIndex < Store->PageCount);
+
+    Table = Store->Directory[PageIndex >> RAM_DISK_PAGE_TABLE_SHIFT];
+    if (Table == NULL) {
+        return INVALID_PHYSICAL_ADDRESS;
+    }
+
+    return Table->Pages[PageIndex & (RAM_DISK_PAGE_TABLE_SIZE - 1)];
+}
+
+KSTATUS
+RamDiskpSetPage (
+    PRAM_DISK_STORE Store,
+    UINTN PageIndex,
+    PHYSICAL_ADDRESS PhysicalAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets or clears the physical page backing a page of a dynamic
+    RAM disk, allocating the page table covering it or freeing the page table
+    once it is empty. The caller must hold the store lock exclusively.
+
+Arguments:
+
+    Store - Supplies a pointer to the backing store of the disk.
+
+    PageIndex - Supplies the index of the page within the disk.
+
+    PhysicalAddress - Supplies the physical address of the page now backing
+        the given page, or INVALID_PHYSICAL_ADDRESS to mark the page as no
+        longer backed. The caller is responsible for freeing the old page.
+
+Return Value:
+
+    STATUS_SUCCESS on success. Clearing a page always succeeds.
+
+    STATUS_INSUFFICIENT_RESOURCES if a page table could not be allocated.
+
+--*/
+
+{
+
+    UINTN Index;
+    PRAM_DISK_PAGE_TABLE *Slot;
+    PRAM_DISK_PAGE_TABLE Table;
+
+    ASSERT(PageIndex < Store->PageCount);
+
+    Slot = &(Store->Directory[PageIndex >> RAM_DISK_PAGE_TABLE_SHIFT]);
+    Table = *Slot;
+    PageIndex &= RAM_DISK_PAGE_TABLE_SIZE - 1;
+    if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+        if ((Table == NULL) ||
+            (Table->Pages[PageIndex] == INVALID_PHYSICAL_ADDRESS)) {
+
+            return STATUS_SUCCESS;
+        }
+
+        Table->Pages[PageIndex] = INVALID_PHYSICAL_ADDRESS;
+        Table->ValidCount -= 1;
+        Store->AllocatedPages -= 1;
+        if (Table->ValidCount == 0) {
+            MmFreePagedPool(Table);
+            *Slot = NULL;
+        }
+
+        return STATUS_SUCCESS;
+    }
+
+    if (Table == NULL) {
+        Table = MmAllocatePagedPool(sizeof(RAM_DISK_PAGE_TABLE),
+                                    RAM_DISK_ALLOCATION_TAG);
+
+        if (Table == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        Table->ValidCount = 0;
+        for (Index = 0; Index < RAM_DISK_PAGE_TABLE_SIZE; Index += 1) {
+            Table->Pages[Index] = INVALID_PHYSICAL_ADDRESS;
+        }
+
+        *Slot = Table;
+    }
+
+    if (Table->Pages[PageIndex] == INVALID_PHYSICAL_ADDRESS) {
+        Table->ValidCount += 1;
+        Store->AllocatedPages += 1;
+    }
+
+    Table->Pages[PageIndex] = PhysicalAddress;
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+RamDiskpZeroPage (
+    PHYSICAL_ADDRESS PhysicalAddress,
+    UINTN Offset,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine zeroes part of a physical page by mapping it through a
+    temporary I/O buffer.
+
+Arguments:
+
+    PhysicalAddress - Supplies the physical address of the page.
+
+    Offset - Supplies the byte offset within the page to start zeroing at.
+
+    Size - Supplies the number of bytes to zero.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PIO_BUFFER IoBuffer;
+    ULONG PageSize;
+    KSTATUS Status;
+
+    PageSize = MmPageSize();
+
+    ASSERT((Offset + Size) <= PageSize);
+
+    IoBuffer = MmAllocateUninitializedIoBuffer(PageSize, 0);
+    if (IoBuffer == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Status = MmAppendIoBufferData(IoBuffer, NULL, PhysicalAddress, PageSize);
+    if (KSUCCESS(Status)) {
+        Status = MmZeroIoBuffer(IoBuffer, Offset, Size);
+    }
+
+    MmFreeIoBuffer(IoBuffer);
+    return Status;
+}
+
+KSTATUS
+RamDiskpCopyUserControlBuffer (
+    PIRP Irp,
+    PVOID Buffer,
+    UINTN Size,
+    BOOL ToUserBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies a structure in or out of the buffer of a user control
+    IRP, accounting for whether the request came from user mode.
+
+Arguments:
+
+    Irp - Supplies a pointer to the user control IRP.
+
+    Buffer - Supplies a pointer to the kernel mode structure.
+
+    Size - Supplies the size of the structure in bytes.
+
+    ToUserBuffer - Supplies a boolean indicating whether to copy from the
+        structure into the IRP's buffer (TRUE) or from the IRP's buffer into
+        the structure (FALSE).
+
+Return Value:
+
+    STATUS_BUFFER_TOO_SMALL if the IRP's buffer is smaller than the structure.
+
+    Other status codes on failure to access user mode memory.
+
+--*/
+
+{
+
+    KSTATUS Status;
+    PVOID UserBuffer;
+
+    if (Irp->U.UserControl.UserBufferSize < Size) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    UserBuffer = Irp->U.UserControl.UserBuffer;
+    if (Irp->U.UserControl.FromKernelMode != FALSE) {
+        if (ToUserBuffer != FALSE) {
+            RtlCopyMemory(UserBuffer, Buffer, Size);
+
+        } else {
+            RtlCopyMemory(Buffer, UserBuffer, Size);
+        }
+
+        Status = STATUS_SUCCESS;
+
+    } else if (ToUserBuffer != FALSE) {
+        Status = MmCopyToUserMode(UserBuffer, Buffer, Size);
+
+    } else {
+        Status = MmCopyFromUserMode(Buffer, UserBuffer, Size);
+    }
+
+    return Status;
+}
+
+KSTATUS
+RamDiskpCreateDynamicDisk (
+    PRAM_DISK_DESCRIPTION Description
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new dynamic RAM disk. No memory is allocated to
+    back the disk until it is written, but the disk may not be larger than a
+    fraction of physical memory.
+
+Arguments:
+
+    Description - Supplies a pointer to the description of the disk to create.
+        Only the size is used. On success, this is filled out to describe the
+        new disk.
+
+Return Value:
+
+    STATUS_INVALID_PARAMETER if the size is zero or overflows.
+
+    STATUS_INSUFFICIENT_RESOURCES if the size is too large or memory could not
+    be allocated.
+
+    Other status codes on failure to create the device.
+
+--*/
+
+{
+
+    CHAR DeviceIdString[RAM_DISK_DEVICE_ID_SIZE];
+    PRAM_DISK_DEVICE Disk;
+    UINTN DirectorySize;
+    ULONGLONG Limit;
+    UINTN PageCount;
+    ULONG PageShift;
+    ULONGLONG Size;
+    KSTATUS Status;
+    PRAM_DISK_STORE Store;
+    PHYSICAL_ADDRESS ZeroPage;
+
+    Disk = NULL;
+    Store = NULL;
+    PageShift = MmPageShift();
+    Size = ALIGN_RANGE_UP(Description->Size, MmPageSize());
+    if ((Size == 0) || (Size < Description->Size)) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto CreateDynamicDiskEnd;
+    }
+
+    //
+    // Even though the disk is sparse, don't let it promise more than a
+    // fraction of memory.
+    //
+
+    Limit = MmGetTotalPhysicalPages() >> RAM_DISK_DYNAMIC_LIMIT_SHIFT;
+    Limit <<= PageShift;
+    if (Size > Limit) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateDynamicDiskEnd;
+    }
+
+    //
+    // Reads of pages that were never written copy from a shared page of
+    // zeroes. Set it up with the first dynamic disk.
+    //
+
+    KeAcquireQueuedLock(RamDiskDynamicListLock);
+    if (RamDiskZeroPage == INVALID_PHYSICAL_ADDRESS) {
+        ZeroPage = MmAllocatePhysicalPage();
+        if (ZeroPage == INVALID_PHYSICAL_ADDRESS) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+
+        } else {
+            Status = RamDiskpZeroPage(ZeroPage, 0, MmPageSize());
+            if (KSUCCESS(Status)) {
+                RamDiskZeroPage = ZeroPage;
+
+            } else {
+                MmFreePhysicalPage(ZeroPage);
+            }
+        }
+
+        if (!KSUCCESS(Status)) {
+            KeReleaseQueuedLock(RamDiskDynamicListLock);
+            goto CreateDynamicDiskEnd;
+        }
+    }
+
+    KeReleaseQueuedLock(RamDiskDynamicListLock);
+
+    PageCount = Size >> PageShift;
+    Store = MmAllocatePagedPool(sizeof(RAM_DISK_STORE),
+                                RAM_DISK_ALLOCATION_TAG);
+
+    if (Store == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateDynamicDiskEnd;
+    }
+
+    RtlZeroMemory(Store, sizeof(RAM_DISK_STORE));
+    Store->ReferenceCount = 1;
+    Store->PageCount = PageCount;
+    Store->Lock = KeCreateSharedExclusiveLock();
+    if (Store->Lock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateDynamicDiskEnd;
+    }
+
+    DirectorySize = ALIGN_RANGE_UP(PageCount, RAM_DISK_PAGE_TABLE_SIZE) >>
+                    RAM_DISK_PAGE_TABLE_SHIFT;
+
+    Store->Directory = MmAllocatePagedPool(
+                                  DirectorySize * sizeof(PRAM_DISK_PAGE_TABLE),
+                                  RAM_DISK_ALLOCATION_TAG);
+
+    if (Store->Directory == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateDynamicDiskEnd;
+    }
+
+    RtlZeroMemory(Store->Directory,
+                  DirectorySize * sizeof(PRAM_DISK_PAGE_TABLE));
+
+    Store->DirectorySize = DirectorySize;
+    Disk = MmAllocateNonPagedPool(sizeof(RAM_DISK_DEVICE),
+                                  RAM_DISK_ALLOCATION_TAG);
+
+    if (Disk == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateDynamicDiskEnd;
+    }
+
+    RtlZeroMemory(Disk, sizeof(RAM_DISK_DEVICE));
+    Disk->Type = RamDiskTypeDynamic;
+    Disk->PhysicalAddress = INVALID_PHYSICAL_ADDRESS;
+    Disk->Size = Size;
+    Disk->Store = Store;
+    Disk->Identifier = RtlAtomicAdd32(&RamDiskNextIdentifier, 1);
+    RtlPrintToString(DeviceIdString,
+                     RAM_DISK_DEVICE_ID_SIZE,
+                     CharacterEncodingDefault,
+                     "RamDisk%x",
+                     Disk->Identifier);
+
+    Status = IoCreateDevice(RamDiskDriver,
+                            Disk,
+                            NULL,
+                            DeviceIdString,
+                            DISK_CLASS_ID,
+                            NULL,
+                            &(Disk->Device));
+
+    if (!KSUCCESS(Status)) {
+        goto CreateDynamicDiskEnd;
+    }
+
+    //
+    // The device now owns the disk and its store.
+    //
+
+    RamDiskpGetDescription(Disk, Description);
+    KeAcquireQueuedLock(RamDiskDynamicListLock);
+    INSERT_BEFORE(&(Disk->ListEntry), &RamDiskDynamicList);
+    KeReleaseQueuedLock(RamDiskDynamicListLock);
+    Disk = NULL;
+    Store = NULL;
+
+CreateDynamicDiskEnd:
+    if (Store != NULL) {
+        RamDiskpStoreReleaseReference(Store);
+    }
+
+    if (Disk != NULL) {
+        MmFreeNonPagedPool(Disk);
+    }
+
+    return Status;
+}
+
+KSTATUS
+RamDiskpDestroyDynamicDisk (
+    ULONG Identifier
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a dynamic RAM disk from the system. Its memory is
+    freed once the device is removed and every handle to it is closed.
+
+Arguments:
+
+    Identifier - Supplies the identifier of the disk to destroy.
+
+Return Value:
+
+    STATUS_NO_SUCH_DEVICE if there is no dynamic RAM disk with the given
+    identifier.
+
+    Other status codes on failure to queue the removal.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PDEVICE Device;
+    PRAM_DISK_DEVICE Disk;
+    KSTATUS Status;
+
+    Device = NULL;
+    KeAcquireQueuedLock(RamDiskDynamicListLock);
+    CurrentEntry = RamDiskDynamicList.Next;
+    while (CurrentEntry != &RamDiskDynamicList) {
+        Disk = LIST_VALUE(CurrentEntry, RAM_DISK_DEVICE, ListEntry);
+        if (Disk->Identifier == Identifier) {
+            LIST_REMOVE(&(Disk->ListEntry));
+            Disk->ListEntry.Next = NULL;
+            Device = Disk->Device;
+            IoDeviceAddReference(Device);
+            break;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    KeReleaseQueuedLock(RamDiskDynamicListLock);
+    if (Device == NULL) {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    Status = IoRemoveUnreportedDevice(Device);
+    IoDeviceReleaseReference(Device);
+    return Status;
+}
+
+VOID
+RamDiskpRemoveDynamicDisk (
+    PRAM_DISK_DEVICE Disk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tears down a dynamic RAM disk whose device is being removed.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk being removed. This structure is
+        freed by this routine.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    KeAcquireQueuedLock(RamDiskDynamicListLock);
+    if (Disk->ListEntry.Next != NULL) {
+        LIST_REMOVE(&(Disk->ListEntry));
+        Disk->ListEntry.Next = NULL;
+    }
+
+    KeReleaseQueuedLock(RamDiskDynamicListLock);
+    RamDiskpStoreReleaseReference(Disk->Store);
+    MmFreeNonPagedPool(Disk);
+    return;
+}
+
+KSTATUS
+RamDiskpDiscard (
+    PRAM_DISK_STORE Store,
+    PRAM_DISK_DISCARD Discard
+    )
+
+/*++
+
+Routine Description:
+
+    This routine discards a region of a dynamic RAM disk, freeing the pages
+    that lie entirely within it and zeroing the rest of the region.
+
+Arguments:
+
+    Store - Supplies a pointer to the backing store of the disk.
+
+    Discard - Supplies a pointer to the region to discard.
+
+Return Value:
+
+    STATUS_INVALID_PARAMETER if the region is not sector aligned.
+
+    STATUS_OUT_OF_BOUNDS if the region extends beyond the end of the disk.
+
+    Other error codes if a partially covered page could not be zeroed.
+
+    STATUS_SUCCESS otherwise.
+
+--*/
+
+{
+
+    UINTN ChunkSize;
+    ULONGLONG End;
+    ULONGLONG Offset;
+    UINTN PageIndex;
+    UINTN PageOffset;
+    ULONG PageShift;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    KSTATUS Status;
+
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    Offset = Discard->Offset;
+    End = Offset + Discard->Size;
+    if ((!IS_ALIGNED(Offset, RAM_DISK_SECTOR_SIZE)) ||
+        (!IS_ALIGNED(Discard->Size, RAM_DISK_SECTOR_SIZE)) ||
+        (End < Offset)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (End > ((ULONGLONG)Store->PageCount << PageShift)) {
+        return STATUS_OUT_OF_BOUNDS;
+    }
+
+    Status = STATUS_SUCCESS;
+    KeAcquireSharedExclusiveLockExclusive(Store->Lock);
+    while (Offset < End) {
+        PageOffset = REMAINDER(Offset, PageSize);
+        ChunkSize = PageSize - PageOffset;
+        if (ChunkSize > (End - Offset)) {
+            ChunkSize = End - Offset;
+        }
+
+        PageIndex = Offset >> PageShift;
+        PhysicalAddress = RamDiskpGetPage(Store, PageIndex);
+        if (PhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
+            if (ChunkSize == PageSize) {
+                RamDiskpSetPage(Store, PageIndex, INVALID_PHYSICAL_ADDRESS);
+                MmFreePhysicalPage(PhysicalAddress);
+
+            } else {
+                Status = RamDiskpZeroPage(PhysicalAddress,
+                                          PageOffset,
+                                          ChunkSize);
+
+                if (!KSUCCESS(Status)) {
+                    break;
+                }
+            }
+        }
+
+        Offset += ChunkSize;
+    }
+
+    KeReleaseSharedExclusiveLockExclusive(Store->Lock);
+    return Status;
+}
+
+VOID
+RamDiskpGetDescription (
+    PRAM_DISK_DEVICE Disk,
+    PRAM_DISK_DESCRIPTION Description
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills out the description of a RAM disk.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+    Description - Supplies a pointer where the description will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PRAM_DISK_STORE Store;
+
+    RtlZeroMemory(Description, sizeof(RAM_DISK_DESCRIPTION));
+    Description->Version = RAM_DISK_DESCRIPTION_VERSION;
+    Description->Identifier = Disk->Identifier;
+    Description->Size = Disk->Size;
+    Store = Disk->Store;
+    if (Store != NULL) {
+        Description->Flags |= RAM_DISK_FLAG_DYNAMIC;
+        Description->AllocatedSize =
+                           (ULONGLONG)Store->AllocatedPages << MmPageShift();
+
+    } else {
+        Description->AllocatedSize = Disk->Size;
+    }
+
+    return;
+}
+
+VOID
+RamDiskpStoreAddReference (
+    PRAM_DISK_STORE Store
+    )
+
+/*++
+
+Routine Description:
+
+    This routine increments the reference count on a dynamic RAM disk's
+    backing store.
+
+Arguments:
+
+    Store - Supplies a pointer to the store.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+
+    OldReferenceCount = RtlAtomicAdd32(&(Store->ReferenceCount), 1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+
+    return;
+}
+
+VOID
+RamDiskpStoreReleaseReference (
+    PRAM_DISK_STORE Store
+    )
+
+/*++
+
+Routine Description:
+
+    This routine decrements the reference count on a dynamic RAM disk's
+    backing store, freeing the store and all of its pages if this was the last
+    reference.
+
+Arguments:
+
+    Store - Supplies a pointer to the store.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+    UINTN PageIndex;
+    PRAM_DISK_PAGE_TABLE Table;
+    UINTN TableIndex;
+
+    OldReferenceCount = RtlAtomicAdd32(&(Store->ReferenceCount), (ULONG)-1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+
+    if (OldReferenceCount != 1) {
+        return;
+    }
+
+    if (Store->Directory != NULL) {
+        for (TableIndex = 0;
+             TableIndex < Store->DirectorySize;
+             TableIndex += 1) {
+
+            Table = Store->Directory[TableIndex];
+            if (Table == NULL) {
+                continue;
+            }
+
+            for (PageIndex = 0;
+                 PageIndex < RAM_DISK_PAGE_TABLE_SIZE;
+                 PageIndex += 1) {
+
+                if (Table->Pages[PageIndex] != INVALID_PHYSICAL_ADDRESS) {
+                    MmFreePhysicalPage(Table->Pages[PageIndex]);
+                }
+            }
+
+            MmFreePagedPool(Table);
+        }
+
+        MmFreePagedPool(Store->Directory);
+    }
+
+    if (Store->Lock != NULL) {
+        KeDestroySharedExclusiveLock(Store->Lock);
+    }
+
+    MmFreePagedPool(Store);
+    return;
+}
+
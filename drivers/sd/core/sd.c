@@ -38,19 +38,12 @@ Module Name:
 #include <minoca/kernel/driver.h>
 #include <minoca/intrface/disk.h>
 #include <minoca/sd/sd.h>
+#include "sdcore.h"
 
 //
 // ---------------------------------------------------------------- Definitions
 //
 
-//
-// Define the maximum number of slots that can be on one device. On current
-// implementations this is limited by the number of PCI BARs, where each
-// slot gets a BAR.
-//
-
-#define MAX_SD_SLOTS 6
-
 //
 // Define the amount of time in microseconds to wait after an insertion event
 // to allow the card to simmer down in the slot.
@@ -58,152 +51,6 @@ Module Name:
 
 #define SD_INSERTION_SETTLE_DELAY 50000
 
-//
-// Define the set of flags for an SD disk.
-//
-
-#define SD_DISK_FLAG_DMA_SUPPORTED     0x00000001
-
-//
-// ------------------------------------------------------ Data Type Definitions
-//
-
-typedef enum _SD_DEVICE_TYPE {
-    SdDeviceInvalid,
-    SdDeviceBus,
-    SdDeviceSlot,
-    SdDeviceDisk
-} SD_DEVICE_TYPE, *PSD_DEVICE_TYPE;
-
-typedef struct _SD_BUS SD_BUS, *PSD_BUS;
-typedef struct _SD_SLOT SD_SLOT, *PSD_SLOT;
-
-/*++
-
-Structure Description:
-
-    This structure describes an SD/MMC disk context (the context used by the
-    bus driver for the disk device).
-
-Members:
-
-    Type - Stores the type identifying this as an SD disk structure.
-
-    ReferenceCount - Stores a reference count for the disk.
-
-    Device - Stores a pointer to the OS device for the disk.
-
-    Parent - Stores a pointer to the parent slot.
-
-    Controller - Stores a pointer to the SD controller structure.
-
-    ControllerLock - Stores a pointer to the lock used to serialize access to
-        the controller. This is owned by the parent slot.
-
-    Irp - Stores a pointer to the current IRP running on this disk.
-
-    Flags - Stores a bitmask of flags describing the disk state. See
-        SD_DISK_FLAG_* for definitions;
-
-    BlockShift - Stores the block size shift of the disk.
-
-    BlockCount - Stores the number of blocks on the disk.
-
-    DiskInterface - Stores the disk interface presented to the system.
-
---*/
-
-typedef struct _SD_DISK {
-    SD_DEVICE_TYPE Type;
-    volatile ULONG ReferenceCount;
-    PDEVICE Device;
-    PSD_SLOT Parent;
-    PSD_CONTROLLER Controller;
-    PQUEUED_LOCK ControllerLock;
-    PIRP Irp;
-    ULONG Flags;
-    ULONG BlockShift;
-    ULONGLONG BlockCount;
-    DISK_INTERFACE DiskInterface;
-} SD_DISK, *PSD_DISK;
-
-/*++
-
-Structure Description:
-
-    This structure describes an SD/MMC slot (the context used by the bus driver
-    for the individual SD slot).
-
-Members:
-
-    Type - Stores the type identifying this as an SD slot.
-
-    Device - Stores a pointer to the OS device for the slot.
-
-    Controller - Stores a pointer to the SD controller structure.
-
-    ControllerBase - Stores the virtual address of the base of the controller
-        registers.
-
-    Resource - Stores a pointer to the resource describing the location of the
-        controller.
-
-    ChildIndex - Stores the child index of this device.
-
-    Parent - Stores a pointer back to the parent.
-
-    Disk - Stores a pointer to the child disk context.
-
-    Lock - Stores a pointer to a lock used to serialize access to the
-        controller.
-
---*/
-
-struct _SD_SLOT {
-    SD_DEVICE_TYPE Type;
-    PDEVICE Device;
-    PSD_CONTROLLER Controller;
-    PVOID ControllerBase;
-    PRESOURCE_ALLOCATION Resource;
-    UINTN ChildIndex;
-    PSD_BUS Parent;
-    PSD_DISK Disk;
-    PQUEUED_LOCK Lock;
-};
-
-/*++
-
-Structure Description:
-
-    This structure describes an SD/MMC driver context (the function driver
-    context for the SD bus controller).
-
-Members:
-
-    Type - Stores the type identifying this as an SD controller.
-
-    Slots - Stores the array of SD slots.
-
-    Handle - Stores the connected interrupt handle.
-
-    InterruptLine - Stores ths interrupt line of the controller.
-
-    InterruptVector - Stores the interrupt vector of the controller.
-
-    InterruptResourcesFound - Stores a boolean indicating whether or not
-        interrupt resources were located for this device.
-
---*/
-
-struct _SD_BUS {
-    SD_DEVICE_TYPE Type;
-    SD_SLOT Slots[MAX_SD_SLOTS];
-    HANDLE InterruptHandle;
-    ULONGLONG InterruptLine;
-    ULONGLONG InterruptVector;
-    BOOL InterruptResourcesFound;
-};
-
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -238,13 +85,6 @@ SdDispatchClose (
     PVOID IrpContext
     );
 
-VOID
-SdDispatchIo (
-    PIRP Irp,
-    PVOID DeviceContext,
-    PVOID IrpContext
-    );
-
 VOID
 SdDispatchSystemControl (
     PIRP Irp,
@@ -310,11 +150,6 @@ SdpSlotQueryChildren (
     PSD_SLOT Slot
     );
 
-PSD_DISK
-SdpCreateDisk (
-    PSD_SLOT Slot
-    );
-
 VOID
 SdpDestroyDisk (
     PSD_DISK Disk
@@ -325,11 +160,6 @@ SdpDiskAddReference (
     PSD_DISK Disk
     );
 
-VOID
-SdpDiskReleaseReference (
-    PSD_DISK Disk
-    );
-
 VOID
 SdpDmaCompletion (
     PSD_CONTROLLER Controller,
@@ -338,6 +168,17 @@ SdpDmaCompletion (
     KSTATUS Status
     );
 
+VOID
+SdpStartDmaTransfer (
+    PSD_DISK Disk,
+    PIRP Irp
+    );
+
+VOID
+SdpStartNextIrp (
+    PSD_DISK Disk
+    );
+
 KSTATUS
 SdpDiskBlockIoReset (
     PVOID DiskToken
@@ -683,8 +524,6 @@ Return Value:
 
 {
 
-    UINTN BlockCount;
-    ULONGLONG BlockOffset;
     UINTN BytesToComplete;
     BOOL CompleteIrp;
     PSD_CONTROLLER Controller;
@@ -692,6 +531,8 @@ Return Value:
     IO_OFFSET IoOffset;
     ULONG IrpReadWriteFlags;
     KSTATUS IrpStatus;
+    RUNLEVEL OldRunLevel;
+    BOOL Start;
     KSTATUS Status;
     BOOL Write;
 
@@ -735,31 +576,37 @@ Return Value:
     }
 
     Controller = Disk->Controller;
-    if (Irp->Direction == IrpDown) {
-        Controller->Try = 0;
-    }
 
     //
-    // If the IRP is on the way up, then clean up after the DMA as this IRP is
-    // still sitting in the channel. An IRP going up is already complete.
+    // If the IRP is on the way up, then clean up after the DMA. An IRP going
+    // up is already complete. An IRP that finished successfully already
+    // handed the controller to the next IRP in the queue, but a failed IRP
+    // still owns the controller so that it can recover and try again.
     //
 
     if (Irp->Direction == IrpUp) {
 
-        ASSERT (Irp == Disk->Irp);
-
-        Disk->Irp = NULL;
-
         //
         // Try to recover on failure.
         //
 
         IrpStatus = IoGetIrpStatus(Irp);
         if (!KSUCCESS(IrpStatus)) {
-            Status = SdErrorRecovery(Controller);
-            if (!KSUCCESS(Status)) {
-                IrpStatus = Status;
-                IoUpdateIrpStatus(Irp, IrpStatus);
+
+            ASSERT(Irp == Disk->Irp);
+
+            //
+            // There is nothing to recover if the card is gone or was swapped.
+            //
+
+            if ((IrpStatus != STATUS_NO_MEDIA) &&
+                (IrpStatus != STATUS_MEDIA_CHANGED)) {
+
+                Status = SdErrorRecovery(Controller);
+                if (!KSUCCESS(Status)) {
+                    IrpStatus = Status;
+                    IoUpdateIrpStatus(Irp, IrpStatus);
+                }
             }
 
             //
@@ -767,7 +614,9 @@ Return Value:
             // attempts have been made.
             //
 
-            if (((Controller->Flags &
+            if ((IrpStatus == STATUS_NO_MEDIA) ||
+                (IrpStatus == STATUS_MEDIA_CHANGED) ||
+                ((Controller->Flags &
                   SD_CONTROLLER_FLAG_MEDIA_CHANGED) != 0) ||
                 ((Controller->Flags &
                   SD_CONTROLLER_FLAG_MEDIA_PRESENT) == 0) ||
@@ -780,7 +629,6 @@ Return Value:
             }
         }
 
-        KeReleaseQueuedLock(Disk->ControllerLock);
         Status = IoCompleteReadWriteIrp(&(Irp->U.ReadWrite),
                                         IrpReadWriteFlags);
 
@@ -789,10 +637,19 @@ Return Value:
         }
 
         //
-        // Potentially return the completed IRP.
+        // Potentially return the completed IRP. If it gave up on a failure,
+        // pass the controller on to the next IRP.
         //
 
         if (KSUCCESS(IrpStatus)) {
+            if (Irp == Disk->Irp) {
+                OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+                KeAcquireSpinLock(&(Disk->DpcLock));
+                SdpStartNextIrp(Disk);
+                KeReleaseSpinLock(&(Disk->DpcLock));
+                KeLowerRunLevel(OldRunLevel);
+            }
+
             CompleteIrp = FALSE;
             goto DispatchIoEnd;
         }
@@ -812,9 +669,9 @@ Return Value:
     ASSERT(IS_ALIGNED(BytesToComplete, 1ULL << Disk->BlockShift) != FALSE);
 
     //
-    // Before acquiring the controller's lock and starting the DMA, prepare
-    // the I/O context for SD (i.e. it must use physical addresses that
-    // are less than 4GB and be sector size aligned).
+    // Before queuing the IRP, prepare the I/O context for SD (i.e. it must
+    // use physical addresses that are less than 4GB and be sector size
+    // aligned). This happens while the IRPs ahead of it are running.
     //
 
     Status = IoPrepareReadWriteIrp(&(Irp->U.ReadWrite),
@@ -824,61 +681,77 @@ Return Value:
                                    IrpReadWriteFlags);
 
     if (!KSUCCESS(Status)) {
-        goto DispatchIoEnd;
-    }
-
-    //
-    // Lock the controller to serialize access to the hardware.
-    //
 
-    KeAcquireQueuedLock(Disk->ControllerLock);
-    if (((Controller->Flags & SD_CONTROLLER_FLAG_MEDIA_PRESENT) == 0) ||
-        ((Controller->Flags & SD_CONTROLLER_FLAG_MEDIA_CHANGED) != 0)) {
+        //
+        // A retry that cannot be prepared gives up the controller.
+        //
 
-        Status = STATUS_NO_MEDIA;
-        if ((Controller->Flags & SD_CONTROLLER_FLAG_MEDIA_CHANGED) != 0) {
-            Status = STATUS_MEDIA_CHANGED;
+        if (Irp->Direction == IrpUp) {
+            OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+            KeAcquireSpinLock(&(Disk->DpcLock));
+            SdpStartNextIrp(Disk);
+            KeReleaseSpinLock(&(Disk->DpcLock));
+            KeLowerRunLevel(OldRunLevel);
         }
 
-        KeReleaseQueuedLock(Disk->ControllerLock);
-        IoCompleteReadWriteIrp(&(Irp->U.ReadWrite), IrpReadWriteFlags);
         goto DispatchIoEnd;
     }
 
-    //
-    // Pend the IRP and fire up the DMA.
-    //
-
     Irp->U.ReadWrite.NewIoOffset = Irp->U.ReadWrite.IoOffset;
-    Disk->Irp = Irp;
-    BlockOffset = IoOffset >> Disk->BlockShift;
-    BlockCount = BytesToComplete >> Disk->BlockShift;
     CompleteIrp = FALSE;
     IoPendIrp(SdDriver, Irp);
 
     //
-    // Make sure the system isn't trying to do I/O off the end of the disk.
+    // A retried IRP still owns the controller, so send it right back out.
+    // New IRPs take the controller if it is idle and otherwise wait in the
+    // queue. The first IRP in the queue gets its DMA descriptors built now,
+    // while the transfer ahead of it runs.
     //
 
-    ASSERT(BlockOffset < Disk->BlockCount);
-    ASSERT(BlockCount >= 1);
+    Start = FALSE;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Disk->DpcLock));
+    if (Irp->Direction == IrpUp) {
 
-    SdStandardBlockIoDma(Controller,
-                         BlockOffset,
-                         BlockCount,
-                         Irp->U.ReadWrite.IoBuffer,
-                         0,
-                         Write,
-                         SdpDmaCompletion,
-                         Disk);
+        ASSERT(Irp == Disk->Irp);
+
+        SdpStartDmaTransfer(Disk, Irp);
+
+    } else if (Disk->Irp == NULL) {
+        Disk->Irp = Irp;
+        Start = TRUE;
+
+    } else {
+        if (LIST_EMPTY(&(Disk->IrpQueue)) != FALSE) {
+            SdStandardPrepareBlockIoDma(Controller,
+                                        BytesToComplete >> Disk->BlockShift,
+                                        Irp->U.ReadWrite.IoBuffer,
+                                        0,
+                                        Write);
+        }
+
+        INSERT_BEFORE(&(Irp->ListEntry), &(Disk->IrpQueue));
+    }
+
+    KeReleaseSpinLock(&(Disk->DpcLock));
+    KeLowerRunLevel(OldRunLevel);
 
     //
-    // DMA transfers are self perpetuating, so after kicking off this first
-    // transfer, return. This returns with the lock held because I/O is
-    // still in progress.
+    // The disk holds the controller lock from the time an IRP takes an idle
+    // controller until the queue drains, serializing DMA with the other
+    // users of the controller.
     //
 
-    ASSERT(KeIsQueuedLockHeld(Disk->ControllerLock) != FALSE);
+    if (Start != FALSE) {
+        KeAcquireQueuedLock(Disk->ControllerLock);
+        Controller->Try = 0;
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Disk->DpcLock));
+        SdpStartDmaTransfer(Disk, Irp);
+        KeReleaseSpinLock(&(Disk->DpcLock));
+        KeLowerRunLevel(OldRunLevel);
+    }
+
     ASSERT(CompleteIrp == FALSE);
 
 DispatchIoEnd:
@@ -1950,6 +1823,8 @@ Return Value:
     Disk->Parent = Slot;
     Disk->Controller = Slot->Controller;
     Disk->ControllerLock = Slot->Lock;
+    KeInitializeSpinLock(&(Disk->DpcLock));
+    INITIALIZE_LIST_HEAD(&(Disk->IrpQueue));
     Disk->ReferenceCount = 1;
     return Disk;
 }
@@ -1979,6 +1854,7 @@ Return Value:
 
     ASSERT(Disk->DiskInterface.DiskToken == NULL);
     ASSERT(Disk->Irp == NULL);
+    ASSERT(LIST_EMPTY(&(Disk->IrpQueue)) != FALSE);
 
     MmFreeNonPagedPool(Disk);
     return;
@@ -2087,19 +1963,21 @@ Return Value:
 
 {
 
-    UINTN BlockCount;
-    ULONGLONG BlockOffset;
     PSD_DISK Disk;
-    ULONGLONG IoOffset;
-    UINTN IoSize;
     PIRP Irp;
-    BOOL Write;
+    RUNLEVEL OldRunLevel;
 
     Disk = Context;
     Irp = Disk->Irp;
 
     ASSERT(Irp != NULL);
 
+    //
+    // A failed IRP keeps the controller and is sent back up to recover. This
+    // may be called back while the disk's DPC lock is held, if the transfer
+    // failed to start.
+    //
+
     if (!KSUCCESS(Status)) {
         RtlDebugPrint("SD Failed: %d 0x%I64x 0x%x 0x%x\n",
                       Status,
@@ -2113,18 +1991,90 @@ Return Value:
 
     Irp->U.ReadWrite.IoBytesCompleted += BytesTransferred;
     Irp->U.ReadWrite.NewIoOffset += BytesTransferred;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Disk->DpcLock));
 
     //
-    // If this transfer's over, unlock and complete the IRP.
+    // If this transfer's over, get the next IRP going before completing this
+    // one. Otherwise continue with the rest of the IRP.
     //
 
     if (Irp->U.ReadWrite.IoBytesCompleted ==
         Irp->U.ReadWrite.IoSizeInBytes) {
 
+        SdpStartNextIrp(Disk);
+        KeReleaseSpinLock(&(Disk->DpcLock));
+        KeLowerRunLevel(OldRunLevel);
         IoCompleteIrp(SdDriver, Irp, Status);
         return;
     }
 
+    SdpStartDmaTransfer(Disk, Irp);
+    KeReleaseSpinLock(&(Disk->DpcLock));
+    KeLowerRunLevel(OldRunLevel);
+    return;
+}
+
+VOID
+SdpStartDmaTransfer (
+    PSD_DISK Disk,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts the DMA transfer for the remainder of the disk's
+    current IRP, and then prepares the DMA descriptors for the next IRP in the
+    queue so they are ready when this transfer completes. This routine
+    assumes the disk's DPC lock is held.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+    Irp - Supplies a pointer to the IRP that owns the controller.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BlockCount;
+    ULONGLONG BlockOffset;
+    PSD_CONTROLLER Controller;
+    ULONGLONG IoOffset;
+    UINTN IoSize;
+    PIRP NextIrp;
+    KSTATUS Status;
+    BOOL Write;
+
+    ASSERT(Irp == Disk->Irp);
+
+    //
+    // Now that the IRP owns the controller, make sure the card it was meant
+    // for is still there. IRPs queue up behind each other, so the card may
+    // have been pulled or swapped since this one was dispatched. Fail it
+    // without touching the card; the up path hands the controller on.
+    //
+
+    Controller = Disk->Controller;
+    if (((Controller->Flags & SD_CONTROLLER_FLAG_MEDIA_PRESENT) == 0) ||
+        ((Controller->Flags & SD_CONTROLLER_FLAG_MEDIA_CHANGED) != 0)) {
+
+        Status = STATUS_NO_MEDIA;
+        if ((Controller->Flags & SD_CONTROLLER_FLAG_MEDIA_CHANGED) != 0) {
+            Status = STATUS_MEDIA_CHANGED;
+        }
+
+        SdpDmaCompletion(Controller, Disk, 0, Status);
+        return;
+    }
+
     IoOffset = Irp->U.ReadWrite.NewIoOffset;
 
     ASSERT(IoOffset ==
@@ -2138,6 +2088,13 @@ Return Value:
         Write = TRUE;
     }
 
+    //
+    // Make sure the system isn't trying to do I/O off the end of the disk.
+    //
+
+    ASSERT(BlockOffset < Disk->BlockCount);
+    ASSERT(BlockCount >= 1);
+
     SdStandardBlockIoDma(Disk->Controller,
                          BlockOffset,
                          BlockCount,
@@ -2147,6 +2104,75 @@ Return Value:
                          SdpDmaCompletion,
                          Disk);
 
+    //
+    // The IRP may already be complete, so do not touch it again. Queued IRPs
+    // cannot start until the lock is released.
+    //
+
+    if (LIST_EMPTY(&(Disk->IrpQueue)) == FALSE) {
+        NextIrp = LIST_VALUE(Disk->IrpQueue.Next, IRP, ListEntry);
+        Write = FALSE;
+        if (NextIrp->MinorCode == IrpMinorIoWrite) {
+            Write = TRUE;
+        }
+
+        BlockCount = NextIrp->U.ReadWrite.IoSizeInBytes >> Disk->BlockShift;
+        SdStandardPrepareBlockIoDma(Disk->Controller,
+                                    BlockCount,
+                                    NextIrp->U.ReadWrite.IoBuffer,
+                                    0,
+                                    Write);
+    }
+
+    return;
+}
+
+VOID
+SdpStartNextIrp (
+    PSD_DISK Disk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands the controller to the next IRP in the disk's queue and
+    starts its transfer. If the queue is empty, the controller goes idle and
+    the controller lock is released. This routine assumes the disk's DPC lock
+    is held.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIRP Irp;
+
+    ASSERT(Disk->Irp != NULL);
+
+    //
+    // Release the controller lock with the DPC lock held so that a new IRP
+    // cannot take the controller before it is released.
+    //
+
+    if (LIST_EMPTY(&(Disk->IrpQueue)) != FALSE) {
+        Disk->Irp = NULL;
+        KeReleaseQueuedLock(Disk->ControllerLock);
+        return;
+    }
+
+    Irp = LIST_VALUE(Disk->IrpQueue.Next, IRP, ListEntry);
+    LIST_REMOVE(&(Irp->ListEntry));
+    Disk->Irp = Irp;
+    Disk->Controller->Try = 0;
+    SdpStartDmaTransfer(Disk, Irp);
     return;
 }
 
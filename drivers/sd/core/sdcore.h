@@ -0,0 +1,276 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    sdcore.h
+
+Abstract:
+
+    This header contains internal definitions for the SD/MMC driver.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the maximum number of slots that can be on one device. On current
+// implementations this is limited by the number of PCI BARs, where each
+// slot gets a BAR.
+//
+
+#define MAX_SD_SLOTS 6
+
+//
+// Define the set of flags for an SD disk.
+//
+
+#define SD_DISK_FLAG_DMA_SUPPORTED     0x00000001
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _SD_DEVICE_TYPE {
+    SdDeviceInvalid,
+    SdDeviceBus,
+    SdDeviceSlot,
+    SdDeviceDisk
+} SD_DEVICE_TYPE, *PSD_DEVICE_TYPE;
+
+typedef struct _SD_BUS SD_BUS, *PSD_BUS;
+typedef struct _SD_SLOT SD_SLOT, *PSD_SLOT;
+
+/*++
+
+Structure Description:
+
+    This structure describes an SD/MMC disk context (the context used by the
+    bus driver for the disk device).
+
+Members:
+
+    Type - Stores the type identifying this as an SD disk structure.
+
+    ReferenceCount - Stores a reference count for the disk.
+
+    Device - Stores a pointer to the OS device for the disk.
+
+    Parent - Stores a pointer to the parent slot.
+
+    Controller - Stores a pointer to the SD controller structure.
+
+    ControllerLock - Stores a pointer to the lock used to serialize access to
+        the controller. This is owned by the parent slot.
+
+    Irp - Stores a pointer to the IRP that owns the controller, whose transfer
+        is running or being retried. The disk holds the controller lock for as
+        long as this is set.
+
+    DpcLock - Stores the spin lock serializing the IRP queue, the current IRP,
+        and the starting of transfers with DMA completion.
+
+    IrpQueue - Stores the list of IRPs waiting for the current IRP to finish.
+
+    Flags - Stores a bitmask of flags describing the disk state. See
+        SD_DISK_FLAG_* for definitions;
+
+    BlockShift - Stores the block size shift of the disk.
+
+    BlockCount - Stores the number of blocks on the disk.
+
+    DiskInterface - Stores the disk interface presented to the system.
+
+--*/
+
+typedef struct _SD_DISK {
+    SD_DEVICE_TYPE Type;
+    volatile ULONG ReferenceCount;
+    PDEVICE Device;
+    PSD_SLOT Parent;
+    PSD_CONTROLLER Controller;
+    PQUEUED_LOCK ControllerLock;
+    PIRP Irp;
+    KSPIN_LOCK DpcLock;
+    LIST_ENTRY IrpQueue;
+    ULONG Flags;
+    ULONG BlockShift;
+    ULONGLONG BlockCount;
+    DISK_INTERFACE DiskInterface;
+} SD_DISK, *PSD_DISK;
+
+/*++
+
+Structure Description:
+
+    This structure describes an SD/MMC slot (the context used by the bus driver
+    for the individual SD slot).
+
+Members:
+
+    Type - Stores the type identifying this as an SD slot.
+
+    Device - Stores a pointer to the OS device for the slot.
+
+    Controller - Stores a pointer to the SD controller structure.
+
+    ControllerBase - Stores the virtual address of the base of the controller
+        registers.
+
+    Resource - Stores a pointer to the resource describing the location of the
+        controller.
+
+    ChildIndex - Stores the child index of this device.
+
+    Parent - Stores a pointer back to the parent.
+
+    Disk - Stores a pointer to the child disk context.
+
+    Lock - Stores a pointer to a lock used to serialize access to the
+        controller.
+
+--*/
+
+struct _SD_SLOT {
+    SD_DEVICE_TYPE Type;
+    PDEVICE Device;
+    PSD_CONTROLLER Controller;
+    PVOID ControllerBase;
+    PRESOURCE_ALLOCATION Resource;
+    UINTN ChildIndex;
+    PSD_BUS Parent;
+    PSD_DISK Disk;
+    PQUEUED_LOCK Lock;
+};
+
+/*++
+
+Structure Description:
+
+    This structure describes an SD/MMC driver context (the function driver
+    context for the SD bus controller).
+
+Members:
+
+    Type - Stores the type identifying this as an SD controller.
+
+    Slots - Stores the array of SD slots.
+
+    Handle - Stores the connected interrupt handle.
+
+    InterruptLine - Stores ths interrupt line of the controller.
+
+    InterruptVector - Stores the interrupt vector of the controller.
+
+    InterruptResourcesFound - Stores a boolean indicating whether or not
+        interrupt resources were located for this device.
+
+--*/
+
+struct _SD_BUS {
+    SD_DEVICE_TYPE Type;
+    SD_SLOT Slots[MAX_SD_SLOTS];
+    HANDLE InterruptHandle;
+    ULONGLONG InterruptLine;
+    ULONGLONG InterruptVector;
+    BOOL InterruptResourcesFound;
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+extern PDRIVER SdDriver;
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+VOID
+SdDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+/*++
+
+Routine Description:
+
+    This routine handles I/O IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+PSD_DISK
+SdpCreateDisk (
+    PSD_SLOT Slot
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates an SD disk context.
+
+Arguments:
+
+    Slot - Supplies a pointer to the SD slot to which the disk belongs.
+
+Return Value:
+
+    Returns a pointer to the new SD disk on success or NULL on failure.
+
+--*/
+
+VOID
+SdpDiskReleaseReference (
+    PSD_DISK Disk
+    );
+
+/*++
+
+Routine Description:
+
+    This routine releases a reference from the SD disk.
+
+Arguments:
+
+    Disk - Supplies a pointer to the SD disk.
+
+Return Value:
+
+    None.
+
+--*/
+
@@ -2673,6 +2673,14 @@ Return Value:
         return STATUS_SUCCESS;
     }
 
+    //
+    // MMC cards support CMD23 (set block count) starting with version 3.1.
+    //
+
+    if (Controller->Version >= SdMmcVersion3) {
+        Controller->CardCapabilities |= SD_MODE_CMD23;
+    }
+
     //
     // Only version 4 supports high speed.
     //
@@ -99,6 +99,13 @@ Module Name:
 #define SD_ADMA2_DESCRIPTOR_TABLE_SIZE \
     (SD_ADMA2_DESCRIPTOR_COUNT * sizeof(SD_ADMA2_DESCRIPTOR))
 
+//
+// Define the number of ADMA2 descriptor tables. One table describes the
+// transfer in flight while the next transfer is prepared in the other.
+//
+
+#define SD_ADMA2_DESCRIPTOR_TABLE_COUNT 2
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -85,6 +85,15 @@ SdpMediaChangeWorker (
     PVOID Parameter
     );
 
+UINTN
+SdpFillAdmaDescriptors (
+    PSD_CONTROLLER Controller,
+    ULONG TableIndex,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset,
+    UINTN TransferSize
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -275,6 +284,7 @@ Return Value:
 
     PSD_ADMA2_DESCRIPTOR Descriptor;
     ULONG IoBufferFlags;
+    UINTN TableSize;
     ULONG Value;
 
     //
@@ -305,9 +315,14 @@ Return Value:
     if ((Controller->HostCapabilities & SD_MODE_ADMA2) != 0) {
 
         //
-        // Create the DMA descriptor table if not already done.
+        // Create the DMA descriptor tables if not already done. Leave
+        // existing tables alone, as error recovery re-initializes DMA while
+        // the next transfer may already be prepared in the idle table.
         //
 
+        TableSize = SD_ADMA2_DESCRIPTOR_TABLE_SIZE *
+                    SD_ADMA2_DESCRIPTOR_TABLE_COUNT;
+
         if (Controller->DmaDescriptorTable == NULL) {
             IoBufferFlags = IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS |
                             IO_BUFFER_FLAG_MAP_NON_CACHED;
@@ -316,7 +331,7 @@ Return Value:
                                                 0,
                                                 MAX_ULONG,
                                                 4,
-                                                SD_ADMA2_DESCRIPTOR_TABLE_SIZE,
+                                                TableSize,
                                                 IoBufferFlags);
 
             if (Controller->DmaDescriptorTable == NULL) {
@@ -324,10 +339,14 @@ Return Value:
             }
 
             ASSERT(Controller->DmaDescriptorTable->FragmentCount == 1);
-        }
 
-        Descriptor = Controller->DmaDescriptorTable->Fragment[0].VirtualAddress;
-        RtlZeroMemory(Descriptor, SD_ADMA2_DESCRIPTOR_TABLE_SIZE);
+            Descriptor =
+                     Controller->DmaDescriptorTable->Fragment[0].VirtualAddress;
+
+            RtlZeroMemory(Descriptor, TableSize);
+            Controller->DmaDescriptorTableIndex = 0;
+            Controller->PreparedSize = 0;
+        }
 
         //
         // Enable ADMA2 in the host control register.
@@ -446,22 +465,28 @@ Return Value:
     ULONG BlockLength;
     PHYSICAL_ADDRESS Boundary;
     SD_COMMAND Command;
-    ULONG DescriptorCount;
     UINTN DescriptorSize;
-    PSD_ADMA2_DESCRIPTOR DmaDescriptor;
     PIO_BUFFER DmaDescriptorTable;
     PIO_BUFFER_FRAGMENT Fragment;
     UINTN FragmentIndex;
     UINTN FragmentOffset;
     PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN PreparedSize;
     KSTATUS Status;
     ULONG TableAddress;
+    ULONG TableIndex;
     UINTN TransferSize;
     UINTN TransferSizeRemaining;
 
     ASSERT(BlockCount != 0);
     ASSERT(Controller->ControllerBase != NULL);
 
+    //
+    // A prepared transfer is only good for the very next transfer.
+    //
+
+    PreparedSize = Controller->PreparedSize;
+    Controller->PreparedSize = 0;
     if ((Controller->Flags & SD_CONTROLLER_FLAG_MEDIA_CHANGED) != 0) {
         Status = STATUS_MEDIA_CHANGED;
         goto BlockIoDmaEnd;
@@ -500,91 +525,35 @@ Return Value:
     }
 
     //
-    // Get to the correct spot in the I/O buffer.
-    //
-
-    IoBufferOffset += MmGetIoBufferCurrentOffset(IoBuffer);
-    FragmentIndex = 0;
-    FragmentOffset = 0;
-    while (IoBufferOffset != 0) {
-
-        ASSERT(FragmentIndex < IoBuffer->FragmentCount);
-
-        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
-        if (IoBufferOffset < Fragment->Size) {
-            FragmentOffset = IoBufferOffset;
-            break;
-        }
-
-        IoBufferOffset -= Fragment->Size;
-        FragmentIndex += 1;
-    }
-
-    //
-    // Fill out the DMA descriptors for ADMA2.
+    // Fill out the DMA descriptors for ADMA2, unless they were already
+    // prepared in the idle table while the previous transfer ran. The table
+    // in use by the previous transfer is free to be rebuilt now.
     //
 
     TransferSizeRemaining = TransferSize;
     if ((Controller->HostCapabilities & SD_MODE_ADMA2) != 0) {
-        DmaDescriptorTable = Controller->DmaDescriptorTable;
-        DmaDescriptor = DmaDescriptorTable->Fragment[0].VirtualAddress;
-        DescriptorCount = 0;
-        while ((TransferSizeRemaining != 0) &&
-               (DescriptorCount < SD_ADMA2_DESCRIPTOR_COUNT - 1)) {
-
-            ASSERT(FragmentIndex < IoBuffer->FragmentCount);
-
-            Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        TableIndex = Controller->DmaDescriptorTableIndex;
+        if ((PreparedSize != 0) &&
+            (Controller->PreparedIoBuffer == IoBuffer) &&
+            (Controller->PreparedIoBufferOffset == IoBufferOffset) &&
+            (Controller->PreparedTransferSize == TransferSize)) {
 
-            //
-            // This descriptor size is going to the the minimum of the total
-            // remaining size, the size that can fit in a DMA descriptor, and
-            // the remaining size of the fragment.
-            //
+            TableIndex = (TableIndex + 1) % SD_ADMA2_DESCRIPTOR_TABLE_COUNT;
+            TransferSizeRemaining -= PreparedSize;
 
-            DescriptorSize = TransferSizeRemaining;
-            if (DescriptorSize > SD_ADMA2_MAX_TRANSFER_SIZE) {
-                DescriptorSize = SD_ADMA2_MAX_TRANSFER_SIZE;
-            }
-
-            if (DescriptorSize > Fragment->Size - FragmentOffset) {
-                DescriptorSize = Fragment->Size - FragmentOffset;
-            }
-
-            TransferSizeRemaining -= DescriptorSize;
-            PhysicalAddress = Fragment->PhysicalAddress + FragmentOffset;
-
-            //
-            // Assert that the buffer is within the first 4GB.
-            //
-
-            ASSERT(((ULONG)PhysicalAddress == PhysicalAddress) &&
-                   ((ULONG)(PhysicalAddress + DescriptorSize) ==
-                    PhysicalAddress + DescriptorSize));
-
-            DmaDescriptor->Address = PhysicalAddress;
-            DmaDescriptor->Attributes = SD_ADMA2_VALID |
-                                        SD_ADMA2_ACTION_TRANSFER |
-                                        (DescriptorSize <<
-                                         SD_ADMA2_LENGTH_SHIFT);
-
-            DmaDescriptor += 1;
-            DescriptorCount += 1;
-            FragmentOffset += DescriptorSize;
-            if (FragmentOffset >= Fragment->Size) {
-                FragmentIndex += 1;
-                FragmentOffset = 0;
-            }
+        } else {
+            TransferSizeRemaining -= SdpFillAdmaDescriptors(Controller,
+                                                            TableIndex,
+                                                            IoBuffer,
+                                                            IoBufferOffset,
+                                                            TransferSize);
         }
 
-        //
-        // Mark the last DMA descriptor as the end of the transfer.
-        //
+        Controller->DmaDescriptorTableIndex = TableIndex;
+        DmaDescriptorTable = Controller->DmaDescriptorTable;
+        TableAddress = (ULONG)(DmaDescriptorTable->Fragment[0].PhysicalAddress +
+                               (TableIndex * SD_ADMA2_DESCRIPTOR_TABLE_SIZE));
 
-        DmaDescriptor -= 1;
-        DmaDescriptor->Attributes |= SD_ADMA2_INTERRUPT | SD_ADMA2_END;
-        RtlMemoryBarrier();
-        TableAddress = (ULONG)(DmaDescriptorTable->Fragment[0].PhysicalAddress);
         SD_WRITE_REGISTER(Controller, SdRegisterAdmaAddressLow, TableAddress);
 
     //
@@ -600,6 +569,28 @@ Return Value:
     //
 
     } else {
+
+        //
+        // Get to the correct spot in the I/O buffer.
+        //
+
+        IoBufferOffset += MmGetIoBufferCurrentOffset(IoBuffer);
+        FragmentIndex = 0;
+        FragmentOffset = 0;
+        while (IoBufferOffset != 0) {
+
+            ASSERT(FragmentIndex < IoBuffer->FragmentCount);
+
+            Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+            if (IoBufferOffset < Fragment->Size) {
+                FragmentOffset = IoBufferOffset;
+                break;
+            }
+
+            IoBufferOffset -= Fragment->Size;
+            FragmentIndex += 1;
+        }
+
         Fragment = &(IoBuffer->Fragment[FragmentIndex]);
         PhysicalAddress = Fragment->PhysicalAddress + FragmentOffset;
         Boundary = ALIGN_RANGE_DOWN(PhysicalAddress + SD_SDMA_MAX_TRANSFER_SIZE,
@@ -670,6 +661,86 @@ Return Value:
     return;
 }
 
+SD_API
+VOID
+SdStandardPrepareBlockIoDma (
+    PSD_CONTROLLER Controller,
+    UINTN BlockCount,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset,
+    BOOL Write
+    )
+
+/*++
+
+Routine Description:
+
+    This routine builds the ADMA2 descriptors for the next block I/O transfer
+    into the descriptor table not used by the transfer in flight, so that the
+    next transfer can be started as soon as the current one completes. The
+    preparation is used by the next call to start block I/O if its parameters
+    match, and is discarded otherwise. The caller must serialize this routine
+    with calls to start block I/O. This routine does nothing unless the
+    controller is using ADMA2.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    BlockCount - Supplies the number of blocks the next transfer will read or
+        write.
+
+    IoBuffer - Supplies a pointer to the I/O buffer of the next transfer.
+
+    IoBufferOffset - Supplies the offset from the beginning of the I/O buffer
+        where the next transfer will begin. This is relative to the I/O
+        buffer's current offset.
+
+    Write - Supplies a boolean indicating if the next transfer is a read
+        (FALSE) or a write (TRUE).
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG BlockLength;
+    ULONG TableIndex;
+    UINTN TransferSize;
+
+    ASSERT(BlockCount != 0);
+
+    Controller->PreparedSize = 0;
+    if (((Controller->HostCapabilities & SD_MODE_ADMA2) == 0) ||
+        (Controller->DmaDescriptorTable == NULL)) {
+
+        return;
+    }
+
+    BlockLength = Controller->ReadBlockLength;
+    if (Write != FALSE) {
+        BlockLength = Controller->WriteBlockLength;
+    }
+
+    TransferSize = BlockCount * BlockLength;
+    TableIndex = (Controller->DmaDescriptorTableIndex + 1) %
+                 SD_ADMA2_DESCRIPTOR_TABLE_COUNT;
+
+    Controller->PreparedIoBuffer = IoBuffer;
+    Controller->PreparedIoBufferOffset = IoBufferOffset;
+    Controller->PreparedTransferSize = TransferSize;
+    Controller->PreparedSize = SdpFillAdmaDescriptors(Controller,
+                                                      TableIndex,
+                                                      IoBuffer,
+                                                      IoBufferOffset,
+                                                      TransferSize);
+
+    return;
+}
+
 SD_API
 KSTATUS
 SdStandardInitializeController (
@@ -1045,11 +1116,17 @@ Return Value:
             SD_WRITE_REGISTER(Controller, SdRegisterBlockSizeCount, Value);
 
             //
-            // Prefer CMD23 if the card and the host support it.
+            // Prefer CMD23 if the card and the host support it. Auto CMD23
+            // takes its block count from the same register that holds the
+            // SDMA address, so it cannot be used with SDMA.
             //
 
             if (((Controller->CardCapabilities & SD_MODE_CMD23) != 0) &&
-                (Controller->HostVersion == SdHostVersion3)) {
+                (Controller->HostVersion >= SdHostVersion3) &&
+                ((Command->Dma == FALSE) ||
+                 ((Controller->HostCapabilities & SD_MODE_ADMA2) != 0) ||
+                 ((Controller->Flags &
+                   SD_CONTROLLER_FLAG_DMA_COMMAND_ENABLED) == 0))) {
 
                 Flags |= SD_COMMAND_AUTO_COMMAND23_ENABLE;
                 SD_WRITE_REGISTER(Controller, SdRegisterArgument2, BlockCount);
@@ -2063,3 +2140,135 @@ Return Value:
     return;
 }
 
+UINTN
+SdpFillAdmaDescriptors (
+    PSD_CONTROLLER Controller,
+    ULONG TableIndex,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset,
+    UINTN TransferSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills out an ADMA2 descriptor table for a transfer.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    TableIndex - Supplies the index of the descriptor table to fill out.
+
+    IoBuffer - Supplies a pointer to the I/O buffer of the transfer.
+
+    IoBufferOffset - Supplies the offset from the beginning of the I/O buffer
+        where the transfer begins. This is relative to the I/O buffer's
+        current offset.
+
+    TransferSize - Supplies the size of the transfer, in bytes.
+
+Return Value:
+
+    Returns the number of bytes described by the table, which may be less than
+    the transfer size if the table is not big enough.
+
+--*/
+
+{
+
+    ULONG DescriptorCount;
+    UINTN DescriptorSize;
+    PSD_ADMA2_DESCRIPTOR DmaDescriptor;
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
+    UINTN FragmentOffset;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN TransferSizeRemaining;
+
+    ASSERT(TransferSize != 0);
+    ASSERT(TableIndex < SD_ADMA2_DESCRIPTOR_TABLE_COUNT);
+
+    //
+    // Get to the correct spot in the I/O buffer.
+    //
+
+    IoBufferOffset += MmGetIoBufferCurrentOffset(IoBuffer);
+    FragmentIndex = 0;
+    FragmentOffset = 0;
+    while (IoBufferOffset != 0) {
+
+        ASSERT(FragmentIndex < IoBuffer->FragmentCount);
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        if (IoBufferOffset < Fragment->Size) {
+            FragmentOffset = IoBufferOffset;
+            break;
+        }
+
+        IoBufferOffset -= Fragment->Size;
+        FragmentIndex += 1;
+    }
+
+    DmaDescriptor = Controller->DmaDescriptorTable->Fragment[0].VirtualAddress;
+    DmaDescriptor += TableIndex * SD_ADMA2_DESCRIPTOR_COUNT;
+    DescriptorCount = 0;
+    TransferSizeRemaining = TransferSize;
+    while ((TransferSizeRemaining != 0) &&
+           (DescriptorCount < SD_ADMA2_DESCRIPTOR_COUNT - 1)) {
+
+        ASSERT(FragmentIndex < IoBuffer->FragmentCount);
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+
+        //
+        // This descriptor size is going to the the minimum of the total
+        // remaining size, the size that can fit in a DMA descriptor, and the
+        // remaining size of the fragment.
+        //
+
+        DescriptorSize = TransferSizeRemaining;
+        if (DescriptorSize > SD_ADMA2_MAX_TRANSFER_SIZE) {
+            DescriptorSize = SD_ADMA2_MAX_TRANSFER_SIZE;
+        }
+
+        if (DescriptorSize > Fragment->Size - FragmentOffset) {
+            DescriptorSize = Fragment->Size - FragmentOffset;
+        }
+
+        TransferSizeRemaining -= DescriptorSize;
+        PhysicalAddress = Fragment->PhysicalAddress + FragmentOffset;
+
+        //
+        // Assert that the buffer is within the first 4GB.
+        //
+
+        ASSERT(((ULONG)PhysicalAddress == PhysicalAddress) &&
+               ((ULONG)(PhysicalAddress + DescriptorSize) ==
+                PhysicalAddress + DescriptorSize));
+
+        DmaDescriptor->Address = PhysicalAddress;
+        DmaDescriptor->Attributes = SD_ADMA2_VALID |
+                                    SD_ADMA2_ACTION_TRANSFER |
+                                    (DescriptorSize << SD_ADMA2_LENGTH_SHIFT);
+
+        DmaDescriptor += 1;
+        DescriptorCount += 1;
+        FragmentOffset += DescriptorSize;
+        if (FragmentOffset >= Fragment->Size) {
+            FragmentIndex += 1;
+            FragmentOffset = 0;
+        }
+    }
+
+    //
+    // Mark the last DMA descriptor as the end of the transfer.
+    //
+
+    DmaDescriptor -= 1;
+    DmaDescriptor->Attributes |= SD_ADMA2_INTERRUPT | SD_ADMA2_END;
+    RtlMemoryBarrier();
+    return TransferSize - TransferSizeRemaining;
+}
+
@@ -0,0 +1,62 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    SD Test
+
+Abstract:
+
+    This program compiles the SD driver into a user mode application
+    against a fake host controller for the purposes of testing its disk
+    I/O queue.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Test
+
+--*/
+
+from menv import application;
+
+function build() {
+    var buildApp;
+    var buildLibs;
+    var entries;
+    var sources;
+
+    sources = [
+        "stubs.c",
+        "testsd.c",
+        "../sd.c",
+        "../sdlib.c",
+        "../sdstd.c"
+    ];
+
+    buildLibs = [
+        "lib/rtl/urtl:build_rtlc",
+        "lib/rtl/base:build_basertl"
+    ];
+
+    buildApp = {
+        "label": "build_testsd",
+        "output": "testsd",
+        "inputs": sources + buildLibs,
+        "build": true,
+        "prefix": "build"
+    };
+
+    entries = application(buildApp);
+    return entries;
+}
+
@@ -0,0 +1,1425 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    stubs.c
+
+Abstract:
+
+    This module implements stub routines so the SD driver can be compiled in
+    user-mode.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Test
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include "testsd.h"
+
+#include <stdlib.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the fake physical address where I/O buffers allocated by the driver
+// start. Everything the SD controller sees has to be below 4GB.
+//
+
+#define TEST_IO_BUFFER_PHYSICAL_BASE 0x10000000
+
+//
+// Define the fake time counter frequency.
+//
+
+#define TEST_TIME_COUNTER_FREQUENCY 1000000ULL
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store the current fake run level.
+//
+
+RUNLEVEL TestRunLevel = RunLevelLow;
+
+//
+// Store the fake time counter, which moves forward every time it is read.
+//
+
+ULONGLONG TestTimeCounter;
+
+//
+// Store the next fake physical address to hand out for an I/O buffer.
+//
+
+PHYSICAL_ADDRESS TestNextPhysicalAddress = TEST_IO_BUFFER_PHYSICAL_BASE;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+VOID
+HlBusySpin (
+    ULONG Microseconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine spins for at least the given number of microseconds by
+    repeatedly reading a hardware timer. The test does not wait on real
+    hardware, so this returns immediately.
+
+Arguments:
+
+    Microseconds - Supplies the number of microseconds to spin for.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    return;
+}
+
+ULONGLONG
+HlQueryTimeCounter (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queries the time counter hardware and returns a 64-bit
+    monotonically non-decreasing value that represents the number of timer
+    ticks since the system was started.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of timer ticks that have elapsed since the system was
+    booted.
+
+--*/
+
+{
+
+    TestTimeCounter += 1;
+    return TestTimeCounter;
+}
+
+ULONGLONG
+HlQueryTimeCounterFrequency (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the frequency of the time counter.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the frequency of the time counter, in Hertz.
+
+--*/
+
+{
+
+    return TEST_TIME_COUNTER_FREQUENCY;
+}
+
+ULONG
+HlReadRegister32 (
+    PVOID RegisterAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a 32-bit memory register read. The test's register
+    file is plain memory.
+
+Arguments:
+
+    RegisterAddress - Supplies a pointer to the register to read.
+
+Return Value:
+
+    Returns the value at the given register.
+
+--*/
+
+{
+
+    return *((volatile ULONG *)RegisterAddress);
+}
+
+VOID
+HlWriteRegister32 (
+    PVOID RegisterAddress,
+    ULONG Value
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a 32-bit memory register write. The test's register
+    file is plain memory.
+
+Arguments:
+
+    RegisterAddress - Supplies a pointer to the register to write.
+
+    Value - Supplies the value to write.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    *((volatile ULONG *)RegisterAddress) = Value;
+    return;
+}
+
+KSTATUS
+IoAttachDriverToDevice (
+    PDRIVER Driver,
+    PDEVICE Device,
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called by a driver to attach itself to a device. The test
+    drives the disk directly, so nothing attaches.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver attaching itself to the device.
+
+    Device - Supplies a pointer to the device to attach to.
+
+    Context - Supplies an optional context pointer that will be passed to the
+        driver each time it is called in relation to this device.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+KERNEL_API
+KSTATUS
+IoGetIrpStatus (
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the IRP's completion status.
+
+Arguments:
+
+    Irp - Supplies a pointer to the IRP to query.
+
+Return Value:
+
+    Returns the IRP completion status.
+
+--*/
+
+{
+
+    return Irp->Status;
+}
+
+KERNEL_API
+VOID
+IoUpdateIrpStatus (
+    PIRP Irp,
+    KSTATUS StatusCode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine updates the IRP's completion status if the current completion
+    status indicates success.
+
+Arguments:
+
+    Irp - Supplies a pointer to the IRP to query.
+
+    StatusCode - Supplies a status code to associate with the completed IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (KSUCCESS(Irp->Status)) {
+        Irp->Status = StatusCode;
+    }
+
+    return;
+}
+
+KERNEL_API
+VOID
+IoCompleteIrp (
+    PDRIVER Driver,
+    PIRP Irp,
+    KSTATUS StatusCode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called by a driver to mark an IRP as completed. Like the
+    real I/O manager, a pended IRP is not driven back up until the test pumps
+    it.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver completing the IRP.
+
+    Irp - Supplies a pointer to the IRP owned by the driver to mark as
+        completed.
+
+    StatusCode - Supplies a status code to associated with the completed IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTEST_SD_IRP TestIrp;
+
+    ASSERT(TestRunLevel <= RunLevelDispatch);
+
+    TestIrp = PARENT_STRUCTURE(Irp, TEST_SD_IRP, Irp);
+
+    ASSERT((TestIrp->Complete == FALSE) && (TestIrp->Finished == FALSE));
+
+    TestIrp->Complete = TRUE;
+    Irp->Direction = IrpUp;
+    Irp->Status = StatusCode;
+    return;
+}
+
+KERNEL_API
+VOID
+IoPendIrp (
+    PDRIVER Driver,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called by a driver to mark an IRP as pending.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver pending the IRP.
+
+    Irp - Supplies a pointer to the IRP owned by the driver to mark as pending.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTEST_SD_IRP TestIrp;
+
+    ASSERT(TestRunLevel <= RunLevelDispatch);
+
+    TestIrp = PARENT_STRUCTURE(Irp, TEST_SD_IRP, Irp);
+
+    ASSERT(TestIrp->Pending == FALSE);
+
+    TestIrp->Pending = TRUE;
+    TestIrp->Complete = FALSE;
+    return;
+}
+
+KSTATUS
+IoPrepareReadWriteIrp (
+    PIRP_READ_WRITE IrpReadWrite,
+    UINTN Alignment,
+    PHYSICAL_ADDRESS MinimumPhysicalAddress,
+    PHYSICAL_ADDRESS MaximumPhysicalAddress,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares the I/O buffer in the read/write IRP for DMA. The
+    test builds its I/O buffers ready for DMA, so there is nothing to do.
+
+Arguments:
+
+    IrpReadWrite - Supplies a pointer to the read/write context.
+
+    Alignment - Supplies the required physical alignment of the I/O buffer.
+
+    MinimumPhysicalAddress - Supplies the minimum physical address.
+
+    MaximumPhysicalAddress - Supplies the maximum physical address.
+
+    Flags - Supplies a bitmask of flags for the preparation.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    ASSERT(IrpReadWrite->IoBuffer != NULL);
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IoCompleteReadWriteIrp (
+    PIRP_READ_WRITE IrpReadWrite,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles read/write IRP completion.
+
+Arguments:
+
+    IrpReadWrite - Supplies a pointer to the read/write context.
+
+    Flags - Supplies a bitmask of flags for the completion.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IoConnectInterrupt (
+    PIO_CONNECT_INTERRUPT_PARAMETERS Parameters
+    )
+
+/*++
+
+Routine Description:
+
+    This routine connects a device's interrupt. The test raises the SD
+    controller's interrupt by hand, so nothing connects.
+
+Arguments:
+
+    Parameters - Supplies a pointer to the interrupt parameters.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+VOID
+IoDisconnectInterrupt (
+    HANDLE InterruptHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine disconnects a device's interrupt.
+
+Arguments:
+
+    InterruptHandle - Supplies the handle to the interrupt.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(FALSE);
+
+    return;
+}
+
+KSTATUS
+IoCreateAndAddInterruptVectorsForLines (
+    PRESOURCE_CONFIGURATION_LIST ConfigurationList,
+    PRESOURCE_REQUIREMENT VectorTemplate
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds interrupt vector requirements for each interrupt line
+    requested.
+
+Arguments:
+
+    ConfigurationList - Supplies a pointer to the resource configuration list.
+
+    VectorTemplate - Supplies a pointer to a template used when creating the
+        vector requirements.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+KSTATUS
+IoCreateDevice (
+    PDRIVER BusDriver,
+    PVOID BusDriverContext,
+    PDEVICE ParentDevice,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PDEVICE *NewDevice
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new device in the system. The test creates its
+    disk without an OS device.
+
+Arguments:
+
+    BusDriver - Supplies a pointer to the driver reporting this device.
+
+    BusDriverContext - Supplies the context pointer that will be passed to the
+        bus driver when IRPs are sent to the device.
+
+    ParentDevice - Supplies a pointer to the device enumerating this device.
+
+    DeviceId - Supplies a pointer to a null terminated string identifying the
+        device.
+
+    ClassId - Supplies a pointer to a null terminated string identifying the
+        device class.
+
+    CompatibleIds - Supplies a semicolon-delimited list of device IDs that
+        this device is compatible with.
+
+    NewDevice - Supplies a pointer where the new device will be returned.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+KSTATUS
+IoCreateInterface (
+    PUUID InterfaceUuid,
+    PDEVICE Device,
+    PVOID InterfaceBuffer,
+    ULONG InterfaceBufferSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a device interface.
+
+Arguments:
+
+    InterfaceUuid - Supplies a pointer to the UUID identifying the interface.
+
+    Device - Supplies a pointer to the device exposing the interface.
+
+    InterfaceBuffer - Supplies a pointer to the interface buffer.
+
+    InterfaceBufferSize - Supplies the size of the interface buffer, in bytes.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+KSTATUS
+IoDestroyInterface (
+    PUUID InterfaceUuid,
+    PDEVICE Device,
+    PVOID InterfaceBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a previously created interface.
+
+Arguments:
+
+    InterfaceUuid - Supplies a pointer to the UUID identifying the interface.
+
+    Device - Supplies a pointer to the device that exposed the interface.
+
+    InterfaceBuffer - Supplies a pointer to the interface buffer.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+PRESOURCE_ALLOCATION
+IoGetNextResourceAllocation (
+    PRESOURCE_ALLOCATION_LIST ResourceAllocationList,
+    PRESOURCE_ALLOCATION CurrentEntry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the next resource allocation in the given list.
+
+Arguments:
+
+    ResourceAllocationList - Supplies a pointer to the resource allocation
+        list.
+
+    CurrentEntry - Supplies a pointer to the current allocation entry.
+
+Return Value:
+
+    NULL always.
+
+--*/
+
+{
+
+    return NULL;
+}
+
+KSTATUS
+IoMergeChildArrays (
+    PIRP QueryChildrenIrp,
+    PDEVICE *Children,
+    ULONG ChildCount,
+    ULONG AllocationTag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine merges a device's enumerated children with the array that is
+    already present in the Query Children IRP.
+
+Arguments:
+
+    QueryChildrenIrp - Supplies a pointer to the Query Children IRP.
+
+    Children - Supplies a pointer to the device children.
+
+    ChildCount - Supplies the number of elements in the child array.
+
+    AllocationTag - Supplies the tag to use for the merged array.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+KSTATUS
+IoNotifyDeviceTopologyChange (
+    PDEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine notifies the system that the device's children have changed.
+
+Arguments:
+
+    Device - Supplies a pointer to the device whose children have changed.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IoRegisterDriverFunctions (
+    PDRIVER Driver,
+    PDRIVER_FUNCTION_TABLE FunctionTable
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called by a driver to register its dispatch functions.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver.
+
+    FunctionTable - Supplies a pointer to the function table.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    return STATUS_SUCCESS;
+}
+
+RUNLEVEL
+KeGetRunLevel (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the current run level of the fake processor.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the current run level.
+
+--*/
+
+{
+
+    return TestRunLevel;
+}
+
+RUNLEVEL
+KeRaiseRunLevel (
+    RUNLEVEL RunLevel
+    )
+
+/*++
+
+Routine Description:
+
+    This routine raises the fake processor's run level.
+
+Arguments:
+
+    RunLevel - Supplies the new run level, which must be at or above the
+        current run level.
+
+Return Value:
+
+    Returns the old run level.
+
+--*/
+
+{
+
+    RUNLEVEL OldRunLevel;
+
+    ASSERT(RunLevel >= TestRunLevel);
+
+    OldRunLevel = TestRunLevel;
+    TestRunLevel = RunLevel;
+    return OldRunLevel;
+}
+
+VOID
+KeLowerRunLevel (
+    RUNLEVEL RunLevel
+    )
+
+/*++
+
+Routine Description:
+
+    This routine lowers the fake processor's run level.
+
+Arguments:
+
+    RunLevel - Supplies the new run level, which must be at or below the
+        current run level.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(RunLevel <= TestRunLevel);
+
+    TestRunLevel = RunLevel;
+    return;
+}
+
+VOID
+KeInitializeSpinLock (
+    PKSPIN_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes a spinlock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to initialize.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Lock->LockHeld = 0;
+    Lock->OwningThread = NULL;
+    return;
+}
+
+VOID
+KeAcquireSpinLock (
+    PKSPIN_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine acquires a spinlock. The test is single threaded, so an
+    acquire of a held lock is a deadlock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to acquire.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(TestRunLevel >= RunLevelDispatch);
+    ASSERT(Lock->LockHeld == 0);
+
+    Lock->LockHeld = 1;
+    return;
+}
+
+VOID
+KeReleaseSpinLock (
+    PKSPIN_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a spinlock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Lock->LockHeld != 0);
+
+    Lock->LockHeld = 0;
+    return;
+}
+
+PQUEUED_LOCK
+KeCreateQueuedLock (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new queued lock.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a pointer to the new lock on success.
+
+    NULL on failure.
+
+--*/
+
+{
+
+    return calloc(1, sizeof(QUEUED_LOCK));
+}
+
+VOID
+KeDestroyQueuedLock (
+    PQUEUED_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a queued lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the queued lock to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Lock->OwningThread == NULL);
+
+    free(Lock);
+    return;
+}
+
+VOID
+KeAcquireQueuedLock (
+    PQUEUED_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine acquires the queued lock. The test is single threaded, so
+    an acquire of a held lock is a deadlock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the queued lock to acquire.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(TestRunLevel == RunLevelLow);
+    ASSERT(Lock->OwningThread == NULL);
+
+    Lock->OwningThread = (PKTHREAD)Lock;
+    return;
+}
+
+VOID
+KeReleaseQueuedLock (
+    PQUEUED_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a queued lock that has been previously acquired.
+
+Arguments:
+
+    Lock - Supplies a pointer to the queued lock to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(TestRunLevel <= RunLevelDispatch);
+    ASSERT(Lock->OwningThread != NULL);
+
+    Lock->OwningThread = NULL;
+    return;
+}
+
+KSTATUS
+KeCreateAndQueueWorkItem (
+    PWORK_QUEUE WorkQueue,
+    WORK_PRIORITY Priority,
+    PWORK_ITEM_ROUTINE WorkRoutine,
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates and queues a work item.
+
+Arguments:
+
+    WorkQueue - Supplies a pointer to the queue to queue the work item on.
+
+    Priority - Supplies the work priority.
+
+    WorkRoutine - Supplies the routine to execute to do the work.
+
+    Parameter - Supplies an optional parameter to pass to the worker routine.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+KSTATUS
+KeDelayExecution (
+    BOOL Interruptible,
+    BOOL TimeTicks,
+    ULONGLONG Interval
+    )
+
+/*++
+
+Routine Description:
+
+    This routine blocks the current thread for the specified amount of time.
+    The test does not wait on real hardware, so this returns immediately.
+
+Arguments:
+
+    Interruptible - Supplies a boolean indicating if the wait can be
+        interrupted.
+
+    TimeTicks - Supplies a boolean indicating if the interval parameter is
+        represented in time counter ticks (TRUE) or microseconds (FALSE).
+
+    Interval - Supplies the interval to wait.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    return STATUS_SUCCESS;
+}
+
+ULONGLONG
+KeGetRecentTimeCounter (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns a relatively recent snap of the time counter.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the fairly recent snap of the time counter.
+
+--*/
+
+{
+
+    return TestTimeCounter;
+}
+
+PVOID
+MmAllocatePool (
+    POOL_TYPE PoolType,
+    UINTN Size,
+    ULONG Tag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates memory from a kernel pool.
+
+Arguments:
+
+    PoolType - Supplies the type of pool to allocate from.
+
+    Size - Supplies the size of the allocation, in bytes.
+
+    Tag - Supplies an identifier to associate with the allocation.
+
+Return Value:
+
+    Returns the allocation on success.
+
+    NULL on failure.
+
+--*/
+
+{
+
+    return malloc(Size);
+}
+
+VOID
+MmFreePool (
+    POOL_TYPE PoolType,
+    PVOID Allocation
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees memory allocated from a kernel pool.
+
+Arguments:
+
+    PoolType - Supplies the type of pool the memory was allocated from.
+
+    Allocation - Supplies a pointer to the allocation to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    free(Allocation);
+    return;
+}
+
+PIO_BUFFER
+MmAllocateNonPagedIoBuffer (
+    PHYSICAL_ADDRESS MinimumPhysicalAddress,
+    PHYSICAL_ADDRESS MaximumPhysicalAddress,
+    UINTN Alignment,
+    UINTN Size,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates memory for use as an I/O buffer. The buffer is one
+    fragment, given a made up physical address below 4GB.
+
+Arguments:
+
+    MinimumPhysicalAddress - Supplies the minimum physical address.
+
+    MaximumPhysicalAddress - Supplies the maximum physical address.
+
+    Alignment - Supplies the required physical alignment.
+
+    Size - Supplies the minimum size of the buffer, in bytes.
+
+    Flags - Supplies a bitmask of flags used to allocate the I/O buffer.
+
+Return Value:
+
+    Returns a pointer to the I/O buffer on success.
+
+    NULL on failure.
+
+--*/
+
+{
+
+    PIO_BUFFER IoBuffer;
+
+    IoBuffer = calloc(1, sizeof(IO_BUFFER));
+    if (IoBuffer == NULL) {
+        return NULL;
+    }
+
+    IoBuffer->Fragment = &(IoBuffer->Internal.Fragment);
+    IoBuffer->FragmentCount = 1;
+    IoBuffer->Fragment[0].VirtualAddress = calloc(1, Size);
+    if (IoBuffer->Fragment[0].VirtualAddress == NULL) {
+        free(IoBuffer);
+        return NULL;
+    }
+
+    IoBuffer->Fragment[0].PhysicalAddress = TestNextPhysicalAddress;
+    IoBuffer->Fragment[0].Size = Size;
+    IoBuffer->Internal.TotalSize = Size;
+    TestNextPhysicalAddress += ALIGN_RANGE_UP(Size, 0x1000);
+    return IoBuffer;
+}
+
+UINTN
+MmGetIoBufferCurrentOffset (
+    PIO_BUFFER IoBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the given I/O buffer's current offset.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to the I/O buffer.
+
+Return Value:
+
+    Returns the I/O buffer's current offset.
+
+--*/
+
+{
+
+    return IoBuffer->Internal.CurrentOffset;
+}
+
+KSTATUS
+MmMapIoBuffer (
+    PIO_BUFFER IoBuffer,
+    BOOL WriteThrough,
+    BOOL NonCached,
+    BOOL VirtuallyContiguous
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps the given I/O buffer into memory.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to an I/O buffer.
+
+    WriteThrough - Supplies a boolean indicating if the virtual addresses
+        should be mapped write through (TRUE) or the default write back
+        (FALSE).
+
+    NonCached - Supplies a boolean indicating if the virtual addresses should
+        be mapped non-cached (TRUE) or the default, which is to map is as
+        normal cached memory (FALSE).
+
+    VirtuallyContiguous - Supplies a boolean indicating whether or not the
+        caller needs the I/O buffer to be mapped virtually contiguous (TRUE)
+        or not (FALSE).
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+PVOID
+MmMapPhysicalAddress (
+    PHYSICAL_ADDRESS PhysicalAddress,
+    UINTN SizeInBytes,
+    BOOL Writable,
+    BOOL WriteThrough,
+    BOOL CacheDisabled
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps a physical address into kernel VA space.
+
+Arguments:
+
+    PhysicalAddress - Supplies a pointer to the physical address.
+
+    SizeInBytes - Supplies the size in bytes of the mapping.
+
+    Writable - Supplies a boolean indicating if the memory is to be marked
+        writable (TRUE) or read-only (FALSE).
+
+    WriteThrough - Supplies a boolean indicating if the memory is to be marked
+        write-through (TRUE) or write-back (FALSE).
+
+    CacheDisabled - Supplies a boolean indicating if the memory is to be
+        mapped uncached.
+
+Return Value:
+
+    NULL always.
+
+--*/
+
+{
+
+    return NULL;
+}
+
@@ -0,0 +1,2012 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    testsd.c
+
+Abstract:
+
+    This module implements the tests for the SD disk I/O queue. It drives the
+    SD driver's dispatch routine against a fake standard host controller and
+    card, checking the transfers the controller is handed.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Test
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include <minoca/intrface/disk.h>
+#include "../sdp.h"
+#include "../sdcore.h"
+#include "testsd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the relative card address the fake card publishes.
+//
+
+#define TEST_CARD_ADDRESS 0x1234
+
+//
+// Define the voltages and capabilities of the fake host controller.
+//
+
+#define TEST_SD_VOLTAGES (SD_VOLTAGE_32_33 | SD_VOLTAGE_33_34)
+#define TEST_SD_HOST_CAPABILITIES (SD_MODE_ADMA2 | SD_MODE_AUTO_CMD12)
+#define TEST_SD_FUNDAMENTAL_CLOCK 50000000
+
+//
+// Define the fake card specific data. This describes a high capacity card
+// with 512 byte blocks and 128MB of space.
+//
+
+#define TEST_CSD_0 0x00000032
+#define TEST_CSD_1 (9 << SD_CARD_SPECIFIC_DATA_1_READ_BLOCK_LENGTH_SHIFT)
+#define TEST_CSD_2 0x00FF0000
+#define TEST_CSD_3 0x00000000
+
+#define TEST_BLOCK_SIZE 512
+
+//
+// Define the fake physical layout of test IRP buffers. Each IRP gets its own
+// region, and each fragment of a buffer starts on its own page so that
+// fragments are never physically contiguous.
+//
+
+#define TEST_BUFFER_PHYSICAL_BASE 0x40000000
+#define TEST_BUFFER_PHYSICAL_STRIDE 0x01000000
+#define TEST_BUFFER_FRAGMENT_STRIDE 0x1000
+
+//
+// Define the number of blocks in the IRP that needs more than one descriptor
+// table's worth of fragments.
+//
+
+#define TEST_FRAGMENTED_BLOCK_COUNT 300
+
+#define TEST_MAX_TRANSFERS 32
+#define TEST_MAX_IRPS 16
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines a data transfer the fake host controller was asked
+    to perform.
+
+Members:
+
+    Command - Stores the SD command that started the transfer.
+
+    Argument - Stores the command argument, which is the block offset.
+
+    Size - Stores the number of bytes the command said it would transfer.
+
+    TableIndex - Stores the index of the ADMA2 descriptor table the transfer
+        was started with.
+
+    DescriptorCount - Stores the number of valid descriptors.
+
+    Descriptors - Stores a copy of the descriptor table at the time the
+        transfer was started.
+
+--*/
+
+typedef struct _TEST_SD_TRANSFER {
+    SD_COMMAND_VALUE Command;
+    ULONG Argument;
+    ULONG Size;
+    ULONG TableIndex;
+    ULONG DescriptorCount;
+    SD_ADMA2_DESCRIPTOR Descriptors[SD_ADMA2_DESCRIPTOR_COUNT];
+} TEST_SD_TRANSFER, *PTEST_SD_TRANSFER;
+
+/*++
+
+Structure Description:
+
+    This structure defines a case for the prepared descriptor table test.
+
+Members:
+
+    PrepareIrp - Stores the index of the test IRP whose buffer is prepared.
+
+    PrepareOffset - Stores the I/O buffer offset that is prepared.
+
+    PrepareBlockCount - Stores the number of blocks that are prepared.
+
+    StartIrp - Stores the index of the test IRP whose buffer is transferred.
+
+    StartBlockCount - Stores the number of blocks that are transferred.
+
+    Match - Stores a boolean indicating whether the transfer should use the
+        prepared table.
+
+--*/
+
+typedef struct _TEST_PREPARE_CASE {
+    ULONG PrepareIrp;
+    UINTN PrepareOffset;
+    ULONG PrepareBlockCount;
+    ULONG StartIrp;
+    ULONG StartBlockCount;
+    BOOL Match;
+} TEST_PREPARE_CASE, *PTEST_PREPARE_CASE;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+ULONG
+TestQueueOrdering (
+    VOID
+    );
+
+ULONG
+TestPreparedTableMismatch (
+    VOID
+    );
+
+ULONG
+TestMidQueueRetry (
+    VOID
+    );
+
+ULONG
+TestExhaustedRetries (
+    VOID
+    );
+
+KSTATUS
+TestCreateDisk (
+    VOID
+    );
+
+VOID
+TestResetHost (
+    VOID
+    );
+
+ULONG
+TestCheckIdle (
+    VOID
+    );
+
+PTEST_SD_IRP
+TestCreateIrp (
+    ULONG Identifier,
+    BOOL Write,
+    ULONGLONG BlockOffset,
+    ULONG BlockCount,
+    ULONG BlocksPerFragment
+    );
+
+VOID
+TestDestroyIrp (
+    PTEST_SD_IRP TestIrp
+    );
+
+VOID
+TestSendIrp (
+    PTEST_SD_IRP TestIrp
+    );
+
+VOID
+TestPumpIrps (
+    VOID
+    );
+
+VOID
+TestFinishIrp (
+    PTEST_SD_IRP TestIrp
+    );
+
+VOID
+TestCompleteTransfer (
+    KSTATUS Status
+    );
+
+ULONG
+TestVerifyTransfer (
+    ULONG TransferIndex,
+    PTEST_SD_IRP TestIrp,
+    UINTN IoBufferOffset,
+    UINTN Size
+    );
+
+ULONG
+TestVerifyFinishOrder (
+    PTEST_SD_IRP *Irps,
+    ULONG IrpCount
+    );
+
+VOID
+TestDirectCompletion (
+    PSD_CONTROLLER Controller,
+    PVOID Context,
+    UINTN BytesTransferred,
+    KSTATUS Status
+    );
+
+KSTATUS
+TestSdInitializeController (
+    PSD_CONTROLLER Controller,
+    PVOID Context,
+    ULONG Phase
+    );
+
+KSTATUS
+TestSdResetController (
+    PSD_CONTROLLER Controller,
+    PVOID Context,
+    ULONG Flags
+    );
+
+KSTATUS
+TestSdSendCommand (
+    PSD_CONTROLLER Controller,
+    PVOID Context,
+    PSD_COMMAND Command
+    );
+
+KSTATUS
+TestSdGetSetBusParameter (
+    PSD_CONTROLLER Controller,
+    PVOID Context,
+    BOOL Set
+    );
+
+VOID
+TestSdStopDataTransfer (
+    PSD_CONTROLLER Controller,
+    PVOID Context
+    );
+
+VOID
+TestSdMediaChangeCallback (
+    PSD_CONTROLLER Controller,
+    PVOID Context,
+    BOOL Removal,
+    BOOL Insertion
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+extern RUNLEVEL TestRunLevel;
+
+//
+// Store the fake host controller's register file.
+//
+
+ULONG TestRegisters[SdRegisterSize / sizeof(ULONG)];
+
+//
+// Store the fake host controller's function table.
+//
+
+SD_FUNCTION_TABLE TestSdFunctionTable = {
+    TestSdInitializeController,
+    TestSdResetController,
+    TestSdSendCommand,
+    TestSdGetSetBusParameter,
+    TestSdGetSetBusParameter,
+    TestSdGetSetBusParameter,
+    TestSdStopDataTransfer,
+    NULL,
+    NULL,
+    TestSdMediaChangeCallback
+};
+
+//
+// Store the disk under test and the slot it hangs off of.
+//
+
+SD_SLOT TestSlot;
+PSD_DISK TestDisk;
+
+//
+// Store the transfers the fake host controller was asked to perform, and
+// whether one is in flight.
+//
+
+TEST_SD_TRANSFER TestTransfers[TEST_MAX_TRANSFERS];
+ULONG TestTransferCount;
+BOOL TestHostBusy;
+
+//
+// Store the number of problems the fake host controller ran into, like being
+// handed a transfer while another one was in flight.
+//
+
+ULONG TestHostErrors;
+
+//
+// Store the number of times the fake card was reset.
+//
+
+ULONG TestCardResetCount;
+
+//
+// Store the IRPs that are out in the SD driver, and the identifiers of the
+// IRPs that made it back out in the order they did so.
+//
+
+PTEST_SD_IRP TestOutstandingIrps[TEST_MAX_IRPS];
+ULONG TestFinishOrder[TEST_MAX_IRPS];
+ULONG TestFinishCount;
+
+//
+// Store the results handed to the direct completion routine.
+//
+
+ULONG TestDirectCompletionCount;
+KSTATUS TestDirectCompletionStatus;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INT
+main (
+    INT ArgumentCount,
+    CHAR **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for the SD disk I/O queue test program. It
+    executes the tests.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of arguments specified on the command
+        line.
+
+    Arguments - Supplies an array of strings representing the command line
+        arguments.
+
+Return Value:
+
+    returns 0 on success, or nonzero on failure.
+
+--*/
+
+{
+
+    ULONG Failures;
+    KSTATUS Status;
+    ULONG TotalTestsFailed;
+
+    TotalTestsFailed = 0;
+    Status = TestCreateDisk();
+    if (!KSUCCESS(Status)) {
+        printf("Failed to create the SD disk: %d\n", Status);
+        return 1;
+    }
+
+    Failures = TestQueueOrdering();
+    if (Failures != 0) {
+        printf("\nQueue ordering test had %d failures.\n", Failures);
+    }
+
+    TotalTestsFailed += Failures;
+    Failures = TestPreparedTableMismatch();
+    if (Failures != 0) {
+        printf("\nPrepared table test had %d failures.\n", Failures);
+    }
+
+    TotalTestsFailed += Failures;
+    Failures = TestMidQueueRetry();
+    if (Failures != 0) {
+        printf("\nMid-queue retry test had %d failures.\n", Failures);
+    }
+
+    TotalTestsFailed += Failures;
+    Failures = TestExhaustedRetries();
+    if (Failures != 0) {
+        printf("\nExhausted retry test had %d failures.\n", Failures);
+    }
+
+    TotalTestsFailed += Failures;
+
+    //
+    // Tests are over, print results.
+    //
+
+    if (TotalTestsFailed != 0) {
+        printf("*** %d Failure(s) in SD test. ***\n", TotalTestsFailed);
+        return 1;
+    }
+
+    printf("All SD tests passed.\n");
+    return 0;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+ULONG
+TestQueueOrdering (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests that IRPs sent while the controller is busy wait their
+    turn, run in the order they arrived, and run out of the descriptor table
+    that was prepared for them while the IRP ahead of them ran.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Failures;
+    ULONG Index;
+    PTEST_SD_IRP Irps[4];
+    PIRP_READ_WRITE ReadWrite;
+
+    Failures = 0;
+    TestResetHost();
+    Irps[0] = TestCreateIrp(1, FALSE, 16, 8, 8);
+    Irps[1] = TestCreateIrp(2, TRUE, 100, 16, 4);
+    Irps[2] = TestCreateIrp(3, FALSE, 7, 1, 1);
+    Irps[3] = TestCreateIrp(4, TRUE, 2000, 4, 4);
+    for (Index = 0; Index < 4; Index += 1) {
+        if (Irps[Index] == NULL) {
+            return 1;
+        }
+    }
+
+    //
+    // The first IRP takes the idle controller. The rest have to wait.
+    //
+
+    for (Index = 0; Index < 4; Index += 1) {
+        TestSendIrp(Irps[Index]);
+        if (TestTransferCount != 1) {
+            printf("IRP %d: %d transfers started, expected 1.\n",
+                   Irps[Index]->Identifier,
+                   TestTransferCount);
+
+            Failures += 1;
+        }
+    }
+
+    if (TestDisk->ControllerLock->OwningThread == NULL) {
+        printf("Busy disk does not hold the controller lock.\n");
+        Failures += 1;
+    }
+
+    //
+    // Each completion should start the next IRP in line.
+    //
+
+    for (Index = 0; Index < 4; Index += 1) {
+        ReadWrite = &(Irps[Index]->Irp.U.ReadWrite);
+        Failures += TestVerifyTransfer(Index,
+                                       Irps[Index],
+                                       0,
+                                       ReadWrite->IoSizeInBytes);
+
+        if ((Index != 0) &&
+            (TestTransfers[Index].TableIndex ==
+             TestTransfers[Index - 1].TableIndex)) {
+
+            printf("IRP %d did not use its prepared descriptor table.\n",
+                   Irps[Index]->Identifier);
+
+            Failures += 1;
+        }
+
+        if (Irps[Index]->Finished != FALSE) {
+            printf("IRP %d finished before its transfer completed.\n",
+                   Irps[Index]->Identifier);
+
+            Failures += 1;
+        }
+
+        TestCompleteTransfer(STATUS_SUCCESS);
+        if (Irps[Index]->Finished == FALSE) {
+            printf("IRP %d did not finish.\n", Irps[Index]->Identifier);
+            Failures += 1;
+
+        } else if ((!KSUCCESS(Irps[Index]->Irp.Status)) ||
+                   (ReadWrite->IoBytesCompleted != ReadWrite->IoSizeInBytes)) {
+
+            printf("IRP %d finished with %d, 0x%lx of 0x%lx bytes.\n",
+                   Irps[Index]->Identifier,
+                   Irps[Index]->Irp.Status,
+                   (long)ReadWrite->IoBytesCompleted,
+                   (long)ReadWrite->IoSizeInBytes);
+
+            Failures += 1;
+        }
+    }
+
+    if (TestTransferCount != 4) {
+        printf("%d transfers started, expected 4.\n", TestTransferCount);
+        Failures += 1;
+    }
+
+    Failures += TestVerifyFinishOrder(Irps, 4);
+    Failures += TestCheckIdle();
+    for (Index = 0; Index < 4; Index += 1) {
+        TestDestroyIrp(Irps[Index]);
+    }
+
+    return Failures;
+}
+
+ULONG
+TestPreparedTableMismatch (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests that a transfer only uses the prepared descriptor table
+    if it is for exactly the buffer, offset, and size that was prepared, and
+    that an IRP too big for one table continues correctly while the IRP behind
+    it sits prepared in the other table.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    TEST_PREPARE_CASE Cases[] = {
+        {0, 0, 8, 0, 8, TRUE},
+        {0, 0, 8, 1, 8, FALSE},
+        {0, TEST_BLOCK_SIZE, 7, 0, 8, FALSE},
+        {0, 0, 4, 0, 8, FALSE},
+        {1, 0, 8, 1, 8, TRUE},
+    };
+
+    ULONG CaseCount;
+    ULONG CaseIndex;
+    PSD_CONTROLLER Controller;
+    PTEST_PREPARE_CASE Current;
+    ULONG ExpectedTable;
+    ULONG Failures;
+    UINTN FirstSize;
+    PTEST_SD_IRP Irps[2];
+    PTEST_SD_IRP PrepareIrp;
+    PTEST_SD_IRP QueueIrps[2];
+    PTEST_SD_IRP StartIrp;
+    UINTN TotalSize;
+
+    Failures = 0;
+    TestResetHost();
+    Controller = TestDisk->Controller;
+    Irps[0] = TestCreateIrp(5, FALSE, 32, 8, 8);
+    Irps[1] = TestCreateIrp(6, FALSE, 32, 8, 2);
+    if ((Irps[0] == NULL) || (Irps[1] == NULL)) {
+        return 1;
+    }
+
+    //
+    // Drive the library directly. The disk is idle, so the controller is free.
+    //
+
+    CaseCount = sizeof(Cases) / sizeof(Cases[0]);
+    for (CaseIndex = 0; CaseIndex < CaseCount; CaseIndex += 1) {
+        Current = &(Cases[CaseIndex]);
+        PrepareIrp = Irps[Current->PrepareIrp];
+        StartIrp = Irps[Current->StartIrp];
+        ExpectedTable = Controller->DmaDescriptorTableIndex;
+        if (Current->Match != FALSE) {
+            ExpectedTable = (ExpectedTable + 1) %
+                            SD_ADMA2_DESCRIPTOR_TABLE_COUNT;
+        }
+
+        SdStandardPrepareBlockIoDma(Controller,
+                                    Current->PrepareBlockCount,
+                                    PrepareIrp->Irp.U.ReadWrite.IoBuffer,
+                                    Current->PrepareOffset,
+                                    FALSE);
+
+        SdStandardBlockIoDma(Controller,
+                             32,
+                             Current->StartBlockCount,
+                             StartIrp->Irp.U.ReadWrite.IoBuffer,
+                             0,
+                             FALSE,
+                             TestDirectCompletion,
+                             NULL);
+
+        Failures += TestVerifyTransfer(CaseIndex,
+                                       StartIrp,
+                                       0,
+                                       Current->StartBlockCount *
+                                       TEST_BLOCK_SIZE);
+
+        if (TestTransfers[CaseIndex].TableIndex != ExpectedTable) {
+            printf("Prepare case %d used table %d, expected %d.\n",
+                   CaseIndex,
+                   TestTransfers[CaseIndex].TableIndex,
+                   ExpectedTable);
+
+            Failures += 1;
+        }
+
+        if (Controller->PreparedSize != 0) {
+            printf("Prepare case %d left a preparation behind.\n", CaseIndex);
+            Failures += 1;
+        }
+
+        TestCompleteTransfer(STATUS_SUCCESS);
+        if ((TestDirectCompletionCount != CaseIndex + 1) ||
+            (!KSUCCESS(TestDirectCompletionStatus))) {
+
+            printf("Prepare case %d completed %d times with %d.\n",
+                   CaseIndex,
+                   TestDirectCompletionCount,
+                   TestDirectCompletionStatus);
+
+            Failures += 1;
+        }
+    }
+
+    TestDestroyIrp(Irps[0]);
+    TestDestroyIrp(Irps[1]);
+
+    //
+    // Now go through the disk with an IRP that has more fragments than fit
+    // in a descriptor table, with another IRP prepared behind it. The second
+    // half of the big IRP must not pick up the other IRP's descriptors.
+    //
+
+    TestResetHost();
+    QueueIrps[0] = TestCreateIrp(7, TRUE, 512, TEST_FRAGMENTED_BLOCK_COUNT, 1);
+    QueueIrps[1] = TestCreateIrp(8, FALSE, 4096, 8, 8);
+    if ((QueueIrps[0] == NULL) || (QueueIrps[1] == NULL)) {
+        return Failures + 1;
+    }
+
+    TestSendIrp(QueueIrps[0]);
+    TestSendIrp(QueueIrps[1]);
+    TotalSize = TEST_FRAGMENTED_BLOCK_COUNT * TEST_BLOCK_SIZE;
+    FirstSize = (SD_ADMA2_DESCRIPTOR_COUNT - 1) * TEST_BLOCK_SIZE;
+    Failures += TestVerifyTransfer(0, QueueIrps[0], 0, FirstSize);
+    TestCompleteTransfer(STATUS_SUCCESS);
+    Failures += TestVerifyTransfer(1,
+                                   QueueIrps[0],
+                                   FirstSize,
+                                   TotalSize - FirstSize);
+
+    if (QueueIrps[0]->Finished != FALSE) {
+        printf("Fragmented IRP finished after its first transfer.\n");
+        Failures += 1;
+    }
+
+    TestCompleteTransfer(STATUS_SUCCESS);
+    Failures += TestVerifyTransfer(2,
+                                   QueueIrps[1],
+                                   0,
+                                   QueueIrps[1]->Irp.U.ReadWrite.IoSizeInBytes);
+
+    if (TestTransfers[2].TableIndex == TestTransfers[1].TableIndex) {
+        printf("Queued IRP did not use its prepared descriptor table.\n");
+        Failures += 1;
+    }
+
+    TestCompleteTransfer(STATUS_SUCCESS);
+    Failures += TestVerifyFinishOrder(QueueIrps, 2);
+    if (QueueIrps[0]->Irp.U.ReadWrite.IoBytesCompleted != TotalSize) {
+        printf("Fragmented IRP completed 0x%lx of 0x%lx bytes.\n",
+               (long)QueueIrps[0]->Irp.U.ReadWrite.IoBytesCompleted,
+               (long)TotalSize);
+
+        Failures += 1;
+    }
+
+    Failures += TestCheckIdle();
+    TestDestroyIrp(QueueIrps[0]);
+    TestDestroyIrp(QueueIrps[1]);
+    return Failures;
+}
+
+ULONG
+TestMidQueueRetry (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests an IRP in the middle of the queue that fails once. It
+    should recover the card, retry while keeping the controller, and then
+    let the IRP behind it run.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Failures;
+    ULONG Index;
+    PTEST_SD_IRP Irps[3];
+    ULONG ResetCount;
+
+    Failures = 0;
+    TestResetHost();
+    Irps[0] = TestCreateIrp(9, FALSE, 0, 8, 8);
+    Irps[1] = TestCreateIrp(10, TRUE, 64, 8, 2);
+    Irps[2] = TestCreateIrp(11, FALSE, 128, 8, 8);
+    for (Index = 0; Index < 3; Index += 1) {
+        if (Irps[Index] == NULL) {
+            return 1;
+        }
+
+        TestSendIrp(Irps[Index]);
+    }
+
+    TestCompleteTransfer(STATUS_SUCCESS);
+    Failures += TestVerifyTransfer(1, Irps[1], 0, 8 * TEST_BLOCK_SIZE);
+
+    //
+    // Fail the middle IRP. It should go through error recovery, which resets
+    // the card, and then be sent again from the beginning.
+    //
+
+    ResetCount = TestCardResetCount;
+    TestCompleteTransfer(STATUS_DEVICE_IO_ERROR);
+    if (TestCardResetCount == ResetCount) {
+        printf("Failed IRP did not recover the card.\n");
+        Failures += 1;
+    }
+
+    if ((Irps[1]->Finished != FALSE) || (Irps[2]->Finished != FALSE)) {
+        printf("IRPs finished after a failure that should be retried.\n");
+        Failures += 1;
+    }
+
+    if (TestTransferCount != 3) {
+        printf("%d transfers after the retry, expected 3.\n",
+               TestTransferCount);
+
+        Failures += 1;
+    }
+
+    Failures += TestVerifyTransfer(2, Irps[1], 0, 8 * TEST_BLOCK_SIZE);
+    TestCompleteTransfer(STATUS_SUCCESS);
+    Failures += TestVerifyTransfer(3, Irps[2], 0, 8 * TEST_BLOCK_SIZE);
+    TestCompleteTransfer(STATUS_SUCCESS);
+    Failures += TestVerifyFinishOrder(Irps, 3);
+    for (Index = 0; Index < 3; Index += 1) {
+        if (!KSUCCESS(Irps[Index]->Irp.Status)) {
+            printf("IRP %d failed: %d\n",
+                   Irps[Index]->Identifier,
+                   Irps[Index]->Irp.Status);
+
+            Failures += 1;
+        }
+    }
+
+    if (TestDisk->Controller->Try != 0) {
+        printf("Retry count not reset for the next IRP.\n");
+        Failures += 1;
+    }
+
+    Failures += TestCheckIdle();
+    for (Index = 0; Index < 3; Index += 1) {
+        TestDestroyIrp(Irps[Index]);
+    }
+
+    return Failures;
+}
+
+ULONG
+TestExhaustedRetries (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests an IRP in the middle of the queue that keeps failing.
+    It should be retried the maximum number of times, fail, and then hand the
+    controller to the IRP behind it.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Attempt;
+    ULONG Failures;
+    ULONG Index;
+    PTEST_SD_IRP Irps[3];
+
+    Failures = 0;
+    TestResetHost();
+    Irps[0] = TestCreateIrp(12, TRUE, 8, 4, 4);
+    Irps[1] = TestCreateIrp(13, FALSE, 16, 4, 1);
+    Irps[2] = TestCreateIrp(14, TRUE, 24, 4, 4);
+    for (Index = 0; Index < 3; Index += 1) {
+        if (Irps[Index] == NULL) {
+            return 1;
+        }
+
+        TestSendIrp(Irps[Index]);
+    }
+
+    TestCompleteTransfer(STATUS_SUCCESS);
+    for (Attempt = 0; Attempt <= SD_MAX_IO_RETRIES; Attempt += 1) {
+        Failures += TestVerifyTransfer(1 + Attempt,
+                                       Irps[1],
+                                       0,
+                                       4 * TEST_BLOCK_SIZE);
+
+        if (Irps[2]->Finished != FALSE) {
+            printf("IRP behind the failing IRP finished early.\n");
+            Failures += 1;
+        }
+
+        TestCompleteTransfer(STATUS_DEVICE_IO_ERROR);
+    }
+
+    if ((Irps[1]->Finished == FALSE) || (KSUCCESS(Irps[1]->Irp.Status))) {
+        printf("IRP that kept failing did not fail: %d\n",
+               Irps[1]->Irp.Status);
+
+        Failures += 1;
+    }
+
+    Failures += TestVerifyTransfer(2 + SD_MAX_IO_RETRIES,
+                                   Irps[2],
+                                   0,
+                                   4 * TEST_BLOCK_SIZE);
+
+    TestCompleteTransfer(STATUS_SUCCESS);
+    Failures += TestVerifyFinishOrder(Irps, 3);
+    if ((!KSUCCESS(Irps[0]->Irp.Status)) || (!KSUCCESS(Irps[2]->Irp.Status))) {
+        printf("IRPs around the failing IRP failed: %d %d\n",
+               Irps[0]->Irp.Status,
+               Irps[2]->Irp.Status);
+
+        Failures += 1;
+    }
+
+    Failures += TestCheckIdle();
+    for (Index = 0; Index < 3; Index += 1) {
+        TestDestroyIrp(Irps[Index]);
+    }
+
+    return Failures;
+}
+
+KSTATUS
+TestCreateDisk (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the SD controller and disk under test, bringing up
+    the fake card the same way the slot does when it enumerates a disk.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG BlockSize;
+    PSD_CONTROLLER Controller;
+    PSD_DISK Disk;
+    SD_INITIALIZATION_BLOCK Parameters;
+    KSTATUS Status;
+
+    memset(&Parameters, 0, sizeof(SD_INITIALIZATION_BLOCK));
+    Parameters.StandardControllerBase = TestRegisters;
+    Parameters.FunctionTable = TestSdFunctionTable;
+    Parameters.Voltages = TEST_SD_VOLTAGES;
+    Parameters.FundamentalClock = TEST_SD_FUNDAMENTAL_CLOCK;
+    Parameters.HostCapabilities = TEST_SD_HOST_CAPABILITIES;
+    Controller = SdCreateController(&Parameters);
+    if (Controller == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Status = SdInitializeController(Controller, TRUE);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Status = SdStandardInitializeDma(Controller);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    TestSlot.Type = SdDeviceSlot;
+    TestSlot.Controller = Controller;
+    TestSlot.ControllerBase = TestRegisters;
+    TestSlot.Lock = KeCreateQueuedLock();
+    if (TestSlot.Lock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Disk = SdpCreateDisk(&TestSlot);
+    if (Disk == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Status = SdGetMediaParameters(Controller, &(Disk->BlockCount), &BlockSize);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Disk->BlockShift = RtlCountTrailingZeros32(BlockSize);
+    Disk->Flags |= SD_DISK_FLAG_DMA_SUPPORTED;
+    TestDisk = Disk;
+    return STATUS_SUCCESS;
+}
+
+VOID
+TestResetHost (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine forgets the transfers and IRPs recorded by the last test.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    TestTransferCount = 0;
+    TestFinishCount = 0;
+    TestDirectCompletionCount = 0;
+    TestDirectCompletionStatus = STATUS_NOT_HANDLED;
+    return;
+}
+
+ULONG
+TestCheckIdle (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine checks that the disk gave up the controller once its queue
+    drained, and that nothing was left behind.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Failures;
+    ULONG Index;
+
+    Failures = 0;
+    if ((TestDisk->Irp != NULL) ||
+        (LIST_EMPTY(&(TestDisk->IrpQueue)) == FALSE)) {
+
+        printf("Disk still has IRPs after its queue drained.\n");
+        Failures += 1;
+    }
+
+    if (TestDisk->ControllerLock->OwningThread != NULL) {
+        printf("Idle disk still holds the controller lock.\n");
+        Failures += 1;
+    }
+
+    if (TestHostBusy != FALSE) {
+        printf("Host controller still has a transfer in flight.\n");
+        Failures += 1;
+    }
+
+    if (TestHostErrors != 0) {
+        printf("Host controller hit %d errors.\n", TestHostErrors);
+        Failures += 1;
+        TestHostErrors = 0;
+    }
+
+    if ((TestRunLevel != RunLevelLow) ||
+        (TestDisk->DpcLock.LockHeld != 0)) {
+
+        printf("Run level or DPC lock left raised.\n");
+        Failures += 1;
+    }
+
+    for (Index = 0; Index < TEST_MAX_IRPS; Index += 1) {
+        if (TestOutstandingIrps[Index] != NULL) {
+            printf("IRP %d never finished.\n",
+                   TestOutstandingIrps[Index]->Identifier);
+
+            Failures += 1;
+            TestOutstandingIrps[Index] = NULL;
+        }
+    }
+
+    return Failures;
+}
+
+PTEST_SD_IRP
+TestCreateIrp (
+    ULONG Identifier,
+    BOOL Write,
+    ULONGLONG BlockOffset,
+    ULONG BlockCount,
+    ULONG BlocksPerFragment
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a disk read or write IRP with a buffer split into
+    physically discontiguous fragments.
+
+Arguments:
+
+    Identifier - Supplies the test's identifier for the IRP.
+
+    Write - Supplies a boolean indicating if this is a write (TRUE) or a read
+        (FALSE).
+
+    BlockOffset - Supplies the first block of the I/O.
+
+    BlockCount - Supplies the number of blocks to read or write.
+
+    BlocksPerFragment - Supplies the number of blocks in each fragment of the
+        I/O buffer.
+
+Return Value:
+
+    Returns a pointer to the new IRP on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    UINTN FragmentCount;
+    UINTN FragmentIndex;
+    PHYSICAL_ADDRESS FragmentStart;
+    PIO_BUFFER IoBuffer;
+    UINTN Size;
+    PTEST_SD_IRP TestIrp;
+
+    Size = BlockCount * TEST_BLOCK_SIZE;
+    FragmentCount = (BlockCount + BlocksPerFragment - 1) / BlocksPerFragment;
+    TestIrp = calloc(1, sizeof(TEST_SD_IRP));
+    IoBuffer = calloc(1, sizeof(IO_BUFFER));
+    if ((TestIrp == NULL) || (IoBuffer == NULL)) {
+        free(TestIrp);
+        free(IoBuffer);
+        return NULL;
+    }
+
+    IoBuffer->Fragment = calloc(FragmentCount, sizeof(IO_BUFFER_FRAGMENT));
+    if (IoBuffer->Fragment == NULL) {
+        free(TestIrp);
+        free(IoBuffer);
+        return NULL;
+    }
+
+    IoBuffer->FragmentCount = FragmentCount;
+    IoBuffer->Internal.TotalSize = Size;
+    FragmentStart = TEST_BUFFER_PHYSICAL_BASE +
+                    (Identifier * TEST_BUFFER_PHYSICAL_STRIDE);
+
+    for (FragmentIndex = 0; FragmentIndex < FragmentCount; FragmentIndex += 1) {
+        IoBuffer->Fragment[FragmentIndex].PhysicalAddress = FragmentStart;
+        IoBuffer->Fragment[FragmentIndex].Size = BlocksPerFragment *
+                                                 TEST_BLOCK_SIZE;
+
+        if (FragmentIndex == FragmentCount - 1) {
+            IoBuffer->Fragment[FragmentIndex].Size =
+                         Size - (FragmentIndex * BlocksPerFragment *
+                                 TEST_BLOCK_SIZE);
+        }
+
+        FragmentStart += ALIGN_RANGE_UP(BlocksPerFragment * TEST_BLOCK_SIZE,
+                                        TEST_BUFFER_FRAGMENT_STRIDE) +
+                         TEST_BUFFER_FRAGMENT_STRIDE;
+    }
+
+    TestIrp->Identifier = Identifier;
+    TestIrp->Irp.MajorCode = IrpMajorIo;
+    TestIrp->Irp.MinorCode = IrpMinorIoRead;
+    if (Write != FALSE) {
+        TestIrp->Irp.MinorCode = IrpMinorIoWrite;
+    }
+
+    TestIrp->Irp.Direction = IrpDown;
+    TestIrp->Irp.Status = STATUS_NOT_HANDLED;
+    TestIrp->Irp.U.ReadWrite.IoBuffer = IoBuffer;
+    TestIrp->Irp.U.ReadWrite.IoOffset = BlockOffset * TEST_BLOCK_SIZE;
+    TestIrp->Irp.U.ReadWrite.IoSizeInBytes = Size;
+    return TestIrp;
+}
+
+VOID
+TestDestroyIrp (
+    PTEST_SD_IRP TestIrp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a test IRP.
+
+Arguments:
+
+    TestIrp - Supplies a pointer to the IRP to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_BUFFER IoBuffer;
+
+    IoBuffer = TestIrp->Irp.U.ReadWrite.IoBuffer;
+    free(IoBuffer->Fragment);
+    free(IoBuffer);
+    free(TestIrp);
+    return;
+}
+
+VOID
+TestSendIrp (
+    PTEST_SD_IRP TestIrp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends an IRP down to the SD disk, the way the I/O manager
+    would.
+
+Arguments:
+
+    TestIrp - Supplies a pointer to the IRP to send.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    for (Index = 0; Index < TEST_MAX_IRPS; Index += 1) {
+        if (TestOutstandingIrps[Index] == NULL) {
+            TestOutstandingIrps[Index] = TestIrp;
+            break;
+        }
+    }
+
+    ASSERT(Index != TEST_MAX_IRPS);
+
+    TestIrp->Irp.Direction = IrpDown;
+    SdDispatchIo(&(TestIrp->Irp), TestDisk, NULL);
+    if (TestIrp->Pending == FALSE) {
+
+        ASSERT(TestIrp->Complete != FALSE);
+
+        TestFinishIrp(TestIrp);
+    }
+
+    TestPumpIrps();
+    return;
+}
+
+VOID
+TestPumpIrps (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends every IRP the SD disk completed back up through the
+    disk, the way the thread waiting on a pended IRP would. IRPs the disk
+    pends again are left for the next completion.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+    BOOL Progress;
+    PTEST_SD_IRP TestIrp;
+
+    ASSERT(TestRunLevel == RunLevelLow);
+
+    do {
+        Progress = FALSE;
+        for (Index = 0; Index < TEST_MAX_IRPS; Index += 1) {
+            TestIrp = TestOutstandingIrps[Index];
+            if ((TestIrp == NULL) ||
+                (TestIrp->Pending == FALSE) ||
+                (TestIrp->Complete == FALSE)) {
+
+                continue;
+            }
+
+            ASSERT(TestIrp->Irp.Direction == IrpUp);
+
+            TestIrp->Pending = FALSE;
+            TestIrp->Complete = FALSE;
+            SdDispatchIo(&(TestIrp->Irp), TestDisk, NULL);
+            if (TestIrp->Pending == FALSE) {
+                TestFinishIrp(TestIrp);
+            }
+
+            Progress = TRUE;
+        }
+
+    } while (Progress != FALSE);
+
+    return;
+}
+
+VOID
+TestFinishIrp (
+    PTEST_SD_IRP TestIrp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records that an IRP made it back out of the SD disk.
+
+Arguments:
+
+    TestIrp - Supplies a pointer to the finished IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    ASSERT(TestIrp->Finished == FALSE);
+
+    TestIrp->Finished = TRUE;
+    if (TestFinishCount < TEST_MAX_IRPS) {
+        TestFinishOrder[TestFinishCount] = TestIrp->Identifier;
+        TestFinishCount += 1;
+    }
+
+    for (Index = 0; Index < TEST_MAX_IRPS; Index += 1) {
+        if (TestOutstandingIrps[Index] == TestIrp) {
+            TestOutstandingIrps[Index] = NULL;
+            break;
+        }
+    }
+
+    return;
+}
+
+VOID
+TestCompleteTransfer (
+    KSTATUS Status
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finishes the transfer in flight on the fake host controller
+    by raising its interrupt, and then drives any IRPs that completed.
+
+Arguments:
+
+    Status - Supplies STATUS_SUCCESS to complete the transfer successfully,
+        or a failing status code to report a data error.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Bits;
+    PSD_CONTROLLER Controller;
+    RUNLEVEL OldRunLevel;
+
+    ASSERT(TestHostBusy != FALSE);
+
+    TestHostBusy = FALSE;
+    Controller = TestDisk->Controller;
+    Bits = SD_INTERRUPT_STATUS_TRANSFER_COMPLETE;
+    if (!KSUCCESS(Status)) {
+        Bits = SD_INTERRUPT_STATUS_DATA_CRC_ERROR;
+    }
+
+    RtlAtomicOr32(&(Controller->PendingStatusBits), Bits);
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    SdStandardInterruptServiceDispatch(Controller);
+    KeLowerRunLevel(OldRunLevel);
+    TestPumpIrps();
+    return;
+}
+
+ULONG
+TestVerifyTransfer (
+    ULONG TransferIndex,
+    PTEST_SD_IRP TestIrp,
+    UINTN IoBufferOffset,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine checks that a transfer the host controller was handed
+    covers the given part of an IRP, and that its descriptor table describes
+    exactly the physical pages of that part of the IRP's buffer.
+
+Arguments:
+
+    TransferIndex - Supplies the index of the transfer to check.
+
+    TestIrp - Supplies a pointer to the IRP the transfer should be for.
+
+    IoBufferOffset - Supplies the offset into the IRP the transfer should
+        start at.
+
+    Size - Supplies the number of bytes the transfer should cover.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONGLONG BlockOffset;
+    PSD_ADMA2_DESCRIPTOR Descriptor;
+    ULONG DescriptorIndex;
+    UINTN DescriptorSize;
+    PHYSICAL_ADDRESS Expected;
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
+    UINTN FragmentOffset;
+    PIO_BUFFER IoBuffer;
+    UINTN Offset;
+    PTEST_SD_TRANSFER Transfer;
+    BOOL Write;
+
+    if (TransferIndex >= TestTransferCount) {
+        printf("IRP %d: transfer %d never started (%d started).\n",
+               TestIrp->Identifier,
+               TransferIndex,
+               TestTransferCount);
+
+        return 1;
+    }
+
+    Transfer = &(TestTransfers[TransferIndex]);
+    BlockOffset = (TestIrp->Irp.U.ReadWrite.IoOffset + IoBufferOffset) /
+                  TEST_BLOCK_SIZE;
+
+    Write = FALSE;
+    if ((Transfer->Command == SdCommandWriteSingleBlock) ||
+        (Transfer->Command == SdCommandWriteMultipleBlocks)) {
+
+        Write = TRUE;
+    }
+
+    if ((Transfer->Argument != BlockOffset) ||
+        (Transfer->Size != Size) ||
+        (Write != (TestIrp->Irp.MinorCode == IrpMinorIoWrite))) {
+
+        printf("IRP %d: transfer %d was command %d block 0x%x size 0x%x, "
+               "expected block 0x%llx size 0x%lx.\n",
+               TestIrp->Identifier,
+               TransferIndex,
+               Transfer->Command,
+               Transfer->Argument,
+               Transfer->Size,
+               BlockOffset,
+               (long)Size);
+
+        return 1;
+    }
+
+    //
+    // Walk the IRP's buffer alongside the descriptors. Each descriptor has to
+    // pick up exactly where the last one left off.
+    //
+
+    IoBuffer = TestIrp->Irp.U.ReadWrite.IoBuffer;
+    Offset = 0;
+    for (DescriptorIndex = 0;
+         DescriptorIndex < Transfer->DescriptorCount;
+         DescriptorIndex += 1) {
+
+        Descriptor = &(Transfer->Descriptors[DescriptorIndex]);
+        DescriptorSize = Descriptor->Attributes >> SD_ADMA2_LENGTH_SHIFT;
+        FragmentOffset = IoBufferOffset + Offset;
+        FragmentIndex = 0;
+        while ((FragmentIndex < IoBuffer->FragmentCount) &&
+               (FragmentOffset >= IoBuffer->Fragment[FragmentIndex].Size)) {
+
+            FragmentOffset -= IoBuffer->Fragment[FragmentIndex].Size;
+            FragmentIndex += 1;
+        }
+
+        if (FragmentIndex == IoBuffer->FragmentCount) {
+            printf("IRP %d: transfer %d describes past the buffer end.\n",
+                   TestIrp->Identifier,
+                   TransferIndex);
+
+            return 1;
+        }
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        Expected = Fragment->PhysicalAddress + FragmentOffset;
+        if ((Descriptor->Address != Expected) ||
+            (DescriptorSize == 0) ||
+            (DescriptorSize > Fragment->Size - FragmentOffset) ||
+            ((Descriptor->Attributes & SD_ADMA2_VALID) == 0)) {
+
+            printf("IRP %d: transfer %d descriptor %d is 0x%x+0x%lx, "
+                   "expected 0x%llx.\n",
+                   TestIrp->Identifier,
+                   TransferIndex,
+                   DescriptorIndex,
+                   Descriptor->Address,
+                   (long)DescriptorSize,
+                   Expected);
+
+            return 1;
+        }
+
+        Offset += DescriptorSize;
+    }
+
+    if ((Offset != Size) || (Transfer->DescriptorCount == 0)) {
+        printf("IRP %d: transfer %d descriptors cover 0x%lx of 0x%lx.\n",
+               TestIrp->Identifier,
+               TransferIndex,
+               (long)Offset,
+               (long)Size);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+ULONG
+TestVerifyFinishOrder (
+    PTEST_SD_IRP *Irps,
+    ULONG IrpCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine checks that the IRPs made it back out of the disk in the
+    given order.
+
+Arguments:
+
+    Irps - Supplies the IRPs in the order they should have finished.
+
+    IrpCount - Supplies the number of IRPs in the array.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    if (TestFinishCount != IrpCount) {
+        printf("%d IRPs finished, expected %d.\n", TestFinishCount, IrpCount);
+        return 1;
+    }
+
+    for (Index = 0; Index < IrpCount; Index += 1) {
+        if (TestFinishOrder[Index] != Irps[Index]->Identifier) {
+            printf("IRP %d finished in position %d, expected IRP %d.\n",
+                   TestFinishOrder[Index],
+                   Index,
+                   Irps[Index]->Identifier);
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+VOID
+TestDirectCompletion (
+    PSD_CONTROLLER Controller,
+    PVOID Context,
+    UINTN BytesTransferred,
+    KSTATUS Status
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a transfer started directly by the test
+    completes.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Context - Supplies the unused context pointer.
+
+    BytesTransferred - Supplies the number of bytes transferred.
+
+    Status - Supplies the status of the transfer.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    TestDirectCompletionCount += 1;
+    TestDirectCompletionStatus = Status;
+    return;
+}
+
+KSTATUS
+TestSdInitializeController (
+    PSD_CONTROLLER Controller,
+    PVOID Context,
+    ULONG Phase
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs any controller specific initialization steps for
+    the fake host controller, of which there are none.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Context - Supplies the context pointer passed when creating the
+        controller.
+
+    Phase - Supplies the phase of initialization.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+TestSdResetController (
+    PSD_CONTROLLER Controller,
+    PVOID Context,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets the fake host controller, abandoning any transfer in
+    flight.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Context - Supplies the context pointer passed when creating the
+        controller.
+
+    Flags - Supplies a bitmask of reset flags. See SD_RESET_FLAG_* for
+        definitions.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    TestHostBusy = FALSE;
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+TestSdSendCommand (
+    PSD_CONTROLLER Controller,
+    PVOID Context,
+    PSD_COMMAND Command
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends a command to the fake card. Data transfers are
+    recorded and left in flight until the test completes them.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Context - Supplies the context pointer passed when creating the
+        controller.
+
+    Command - Supplies a pointer to the command parameters.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PSD_ADMA2_DESCRIPTOR Descriptor;
+    ULONG DescriptorIndex;
+    PSD_ADMA2_DESCRIPTOR Snapshot;
+    PIO_BUFFER Table;
+    UINTN TableOffset;
+    PTEST_SD_TRANSFER Transfer;
+
+    memset(Command->Response, 0, sizeof(Command->Response));
+    switch (Command->Command) {
+    case SdCommandReset:
+        TestCardResetCount += 1;
+        break;
+
+    case SdCommandSendInterfaceCondition:
+        Command->Response[0] = Command->CommandArgument;
+        break;
+
+    case SdCommandApplicationSpecific:
+    case SdCommandSelectCard:
+    case SdCommandAllSendCardIdentification:
+    case SdCommandSetBlockLength:
+        break;
+
+    case SdCommandSendSdOperatingCondition:
+        Command->Response[0] = TEST_SD_VOLTAGES |
+                               SD_OPERATING_CONDITION_BUSY |
+                               SD_OPERATING_CONDITION_HIGH_CAPACITY;
+
+        break;
+
+    case SdCommandSetRelativeAddress:
+        Command->Response[0] = TEST_CARD_ADDRESS << 16;
+        break;
+
+    case SdCommandSendCardSpecificData:
+        Command->Response[0] = TEST_CSD_0;
+        Command->Response[1] = TEST_CSD_1;
+        Command->Response[2] = TEST_CSD_2;
+        Command->Response[3] = TEST_CSD_3;
+        break;
+
+    case SdCommandSendStatus:
+        Command->Response[0] = SD_STATUS_READY_FOR_DATA |
+                               SD_STATUS_STATE_TRANSFER;
+
+        break;
+
+    //
+    // An all zero configuration register describes a version 1.0 card,
+    // which keeps the fake card at the default speed and bus width.
+    //
+
+    case SdCommandSendSdConfigurationRegister:
+        memset(Command->BufferVirtual, 0, Command->BufferSize);
+        break;
+
+    case SdCommandReadSingleBlock:
+    case SdCommandReadMultipleBlocks:
+    case SdCommandWriteSingleBlock:
+    case SdCommandWriteMultipleBlocks:
+        if ((Command->Dma == FALSE) ||
+            (TestHostBusy != FALSE) ||
+            (TestTransferCount == TEST_MAX_TRANSFERS)) {
+
+            printf("Host handed transfer %d while busy or not DMA.\n",
+                   TestTransferCount);
+
+            TestHostErrors += 1;
+            return STATUS_DEVICE_IO_ERROR;
+        }
+
+        Transfer = &(TestTransfers[TestTransferCount]);
+        TestTransferCount += 1;
+        Transfer->Command = Command->Command;
+        Transfer->Argument = Command->CommandArgument;
+        Transfer->Size = Command->BufferSize;
+
+        //
+        // Snapshot the descriptor table the controller was pointed at, as it
+        // will be rebuilt for later transfers.
+        //
+
+        Table = Controller->DmaDescriptorTable;
+        TableOffset = TestRegisters[SdRegisterAdmaAddressLow / sizeof(ULONG)] -
+                      Table->Fragment[0].PhysicalAddress;
+
+        Transfer->TableIndex = TableOffset / SD_ADMA2_DESCRIPTOR_TABLE_SIZE;
+        Descriptor = Table->Fragment[0].VirtualAddress + TableOffset;
+        Snapshot = Transfer->Descriptors;
+        for (DescriptorIndex = 0;
+             DescriptorIndex < SD_ADMA2_DESCRIPTOR_COUNT;
+             DescriptorIndex += 1) {
+
+            Snapshot[DescriptorIndex] = Descriptor[DescriptorIndex];
+            if ((Descriptor[DescriptorIndex].Attributes & SD_ADMA2_END) != 0) {
+                break;
+            }
+        }
+
+        Transfer->DescriptorCount = DescriptorIndex + 1;
+        if (DescriptorIndex == SD_ADMA2_DESCRIPTOR_COUNT) {
+            Transfer->DescriptorCount = 0;
+        }
+
+        TestHostBusy = TRUE;
+        break;
+
+    default:
+        printf("Fake card got unexpected command %d.\n", Command->Command);
+        TestHostErrors += 1;
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+TestSdGetSetBusParameter (
+    PSD_CONTROLLER Controller,
+    PVOID Context,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the bus width, clock speed, or voltage of the
+    fake host controller, which accepts anything.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Context - Supplies the context pointer passed when creating the
+        controller.
+
+    Set - Supplies a boolean indicating whether the parameter should be read
+        from the controller (FALSE) or written to the controller (TRUE).
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+TestSdStopDataTransfer (
+    PSD_CONTROLLER Controller,
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine stops any data transfer in flight on the fake host
+    controller.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Context - Supplies the context pointer passed when creating the
+        controller.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    TestHostBusy = FALSE;
+    return;
+}
+
+VOID
+TestSdMediaChangeCallback (
+    PSD_CONTROLLER Controller,
+    PVOID Context,
+    BOOL Removal,
+    BOOL Insertion
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when the SD library notices the card changed. The
+    fake card never changes, so this is a failure.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Context - Supplies the context pointer passed when creating the
+        controller.
+
+    Removal - Supplies a boolean indicating if a removal event occurred.
+
+    Insertion - Supplies a boolean indicating if an insertion event occurred.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    printf("Unexpected media change: removal %d insertion %d.\n",
+           Removal,
+           Insertion);
+
+    TestHostErrors += 1;
+    return;
+}
+
@@ -0,0 +1,76 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    testsd.h
+
+Abstract:
+
+    This header contains definitions for the SD disk I/O queue test.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines an IRP sent to the SD disk by the test. It stands
+    in for the kernel's internal IRP, tracking what the real I/O manager would
+    track.
+
+Members:
+
+    Irp - Stores the IRP handed to the SD driver.
+
+    Identifier - Stores the test's identifier for the IRP.
+
+    Pending - Stores a boolean indicating whether the SD driver pended the IRP
+        and still owns it.
+
+    Complete - Stores a boolean indicating whether the SD driver completed the
+        IRP.
+
+    Finished - Stores a boolean indicating whether the IRP has made its way
+        back up out of the SD driver.
+
+--*/
+
+typedef struct _TEST_SD_IRP {
+    IRP Irp;
+    ULONG Identifier;
+    BOOL Pending;
+    BOOL Complete;
+    BOOL Finished;
+} TEST_SD_IRP, *PTEST_SD_IRP;
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
@@ -0,0 +1,3172 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    tmpfs.c
+
+Abstract:
+
+    This module implements the temporary file system driver, an in-memory
+    file system. File data lives only in the page cache, like shared memory
+    objects. Writes back to the file system are discarded unless the page
+    cache needs to evict the page, in which case the data is saved in the page
+    file. Directories are hash tables held entirely in memory.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// This macro returns a dirty bitmap mask covering the given number of pages.
+// A full region has as many pages as the bitmap has bits, and shifting by the
+// full width is undefined.
+//
+
+#define TMPFS_PAGE_MASK(_PageCount) \
+    (((_PageCount) >= 32) ? MAX_ULONG : ((1UL << (_PageCount)) - 1))
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define TMPFS_ALLOCATION_TAG 0x73466D54 // 'TmFs'
+
+//
+// Define the device ID of the device on which the temporary file system is
+// mounted.
+//
+
+#define TMPFS_DEVICE_ID "TmpFs"
+
+//
+// Define the file ID of the root directory.
+//
+
+#define TMPFS_ROOT_FILE_ID 1
+
+//
+// Define the number of hash buckets a directory starts with, and the average
+// number of entries per bucket at which the table is doubled.
+//
+
+#define TMPFS_INITIAL_BUCKET_COUNT 8
+#define TMPFS_MAX_LOAD_FACTOR 2
+
+//
+// Define the fraction of physical memory, as a shift, that the file system's
+// data and the number of its files is limited to.
+//
+
+#define TMPFS_LIMIT_SHIFT 1
+
+//
+// Define the maximum size of a region of the page file backing a file. See
+// the shared memory object backing regions, which these mirror. Keep this at
+// or below 128KB so the dirty bitmap fits in a ULONG.
+//
+
+#define TMPFS_MAX_BACKING_REGION_SIZE _128KB
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _TMPFS_OBJECT_TYPE {
+    TmpFsObjectInvalid,
+    TmpFsObjectDevice,
+    TmpFsObjectVolume
+} TMPFS_OBJECT_TYPE, *PTMPFS_OBJECT_TYPE;
+
+typedef struct _TMPFS_ENTRY TMPFS_ENTRY, *PTMPFS_ENTRY;
+
+/*++
+
+Structure Description:
+
+    This structure stores the context of the device a temporary file system is
+    mounted on.
+
+Members:
+
+    Type - Stores the object type, TmpFsObjectDevice.
+
+    CreationTime - Stores the system time when the device was created.
+
+--*/
+
+typedef struct _TMPFS_DEVICE {
+    TMPFS_OBJECT_TYPE Type;
+    SYSTEM_TIME CreationTime;
+} TMPFS_DEVICE, *PTMPFS_DEVICE;
+
+/*++
+
+Structure Description:
+
+    This structure stores a region of the page file that holds evicted data
+    for a file.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous backing regions of
+        the file, in offset order.
+
+    ImageBacking - Stores the page file space of the region.
+
+    Offset - Stores the file offset where the region starts.
+
+    Size - Stores the size of the region, in bytes.
+
+    DirtyBitmap - Stores a bitmap of which pages in the region have actually
+        been written to the page file. Clean pages hold garbage.
+
+--*/
+
+typedef struct _TMPFS_BACKING_REGION {
+    LIST_ENTRY ListEntry;
+    IMAGE_BACKING ImageBacking;
+    IO_OFFSET Offset;
+    ULONG Size;
+    ULONG DirtyBitmap;
+} TMPFS_BACKING_REGION, *PTMPFS_BACKING_REGION;
+
+/*++
+
+Structure Description:
+
+    This structure stores a file or directory in the temporary file system.
+
+Members:
+
+    TreeNode - Stores the node in the volume's tree of files, keyed by file ID.
+
+    Entry - Stores a pointer to the directory entry naming this file, or NULL
+        once the file has been unlinked.
+
+    Properties - Stores the file's properties.
+
+    ChargedSize - Stores the number of bytes of data charged against the
+        volume's size limit for this file.
+
+    DataLock - Stores a pointer to the lock that protects the backing region
+        list. Only regular files and symbolic links have one.
+
+    BackingRegionList - Stores the list of page file regions holding data
+        evicted from the page cache.
+
+    Buckets - Stores the hash table of directory entries, for directories.
+
+    BucketCount - Stores the number of buckets in the hash table.
+
+    EntryCount - Stores the number of entries in the directory.
+
+    EntryTree - Stores the tree of directory entries, keyed by offset, used to
+        enumerate the directory.
+
+    NextOffset - Stores the offset to give to the next entry added to the
+        directory.
+
+--*/
+
+typedef struct _TMPFS_NODE {
+    RED_BLACK_TREE_NODE TreeNode;
+    PTMPFS_ENTRY Entry;
+    FILE_PROPERTIES Properties;
+    ULONGLONG ChargedSize;
+    PSHARED_EXCLUSIVE_LOCK DataLock;
+    LIST_ENTRY BackingRegionList;
+    PLIST_ENTRY Buckets;
+    ULONG BucketCount;
+    ULONG EntryCount;
+    RED_BLACK_TREE EntryTree;
+    ULONGLONG NextOffset;
+} TMPFS_NODE, *PTMPFS_NODE;
+
+/*++
+
+Structure Description:
+
+    This structure stores a name within a temporary file system directory. The
+    null terminated name immediately follows this structure.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous entries in the hash
+        bucket.
+
+    TreeNode - Stores the node in the directory's tree of entries.
+
+    Directory - Stores a pointer to the directory containing the entry.
+
+    Node - Stores a pointer to the file the entry names.
+
+    Offset - Stores the directory offset of the entry, which is stable for as
+        long as the entry exists.
+
+    Hash - Stores the hash of the name.
+
+    NameLength - Stores the length of the name, not including the null
+        terminator.
+
+    Name - Stores a pointer to the name.
+
+--*/
+
+struct _TMPFS_ENTRY {
+    LIST_ENTRY ListEntry;
+    RED_BLACK_TREE_NODE TreeNode;
+    PTMPFS_NODE Directory;
+    PTMPFS_NODE Node;
+    ULONGLONG Offset;
+    ULONG Hash;
+    ULONG NameLength;
+    PSTR Name;
+};
+
+/*++
+
+Structure Description:
+
+    This structure stores a temporary file system volume.
+
+Members:
+
+    Type - Stores the object type, TmpFsObjectVolume.
+
+    Attached - Stores a boolean indicating whether the volume is attached.
+
+    ReferenceCount - Stores the reference count of the volume.
+
+    Lock - Stores a pointer to the lock that protects the file tree, every
+        directory, and the properties and charges of every file.
+
+    NodeTree - Stores the tree of files, keyed by file ID.
+
+    Root - Stores a pointer to the root directory.
+
+    NextFileId - Stores the file ID to give the next file created.
+
+    Size - Stores the number of bytes of data charged against the volume.
+
+    SizeLimit - Stores the maximum number of bytes of data the volume holds.
+
+    NodeCount - Stores the number of files on the volume.
+
+    NodeLimit - Stores the maximum number of files on the volume.
+
+--*/
+
+typedef struct _TMPFS_VOLUME {
+    TMPFS_OBJECT_TYPE Type;
+    BOOL Attached;
+    volatile ULONG ReferenceCount;
+    PSHARED_EXCLUSIVE_LOCK Lock;
+    RED_BLACK_TREE NodeTree;
+    PTMPFS_NODE Root;
+    FILE_ID NextFileId;
+    ULONGLONG Size;
+    ULONGLONG SizeLimit;
+    UINTN NodeCount;
+    UINTN NodeLimit;
+} TMPFS_VOLUME, *PTMPFS_VOLUME;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+TmpFsAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    );
+
+VOID
+TmpFsDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpFsDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpFsDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpFsDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpFsDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpFspDispatchDeviceSystemControl (
+    PIRP Irp,
+    PTMPFS_DEVICE Device
+    );
+
+KSTATUS
+TmpFspCreateVolume (
+    PTMPFS_VOLUME *NewVolume
+    );
+
+VOID
+TmpFspRemoveVolume (
+    PTMPFS_VOLUME Volume
+    );
+
+VOID
+TmpFspVolumeAddReference (
+    PTMPFS_VOLUME Volume
+    );
+
+VOID
+TmpFspVolumeReleaseReference (
+    PTMPFS_VOLUME Volume
+    );
+
+VOID
+TmpFspDestroyVolume (
+    PTMPFS_VOLUME Volume
+    );
+
+KSTATUS
+TmpFspLookup (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_LOOKUP Lookup
+    );
+
+KSTATUS
+TmpFspCreate (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_CREATE Create
+    );
+
+KSTATUS
+TmpFspUnlink (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_UNLINK Unlink
+    );
+
+KSTATUS
+TmpFspRename (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_RENAME Rename
+    );
+
+KSTATUS
+TmpFspTruncate (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_TRUNCATE Truncate
+    );
+
+KSTATUS
+TmpFspEnumerateDirectory (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Directory,
+    PIRP Irp
+    );
+
+KSTATUS
+TmpFspPerformIo (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    PIRP Irp
+    );
+
+KSTATUS
+TmpFspChargeNode (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    ULONGLONG NewSize,
+    BOOL Truncate
+    );
+
+KSTATUS
+TmpFspCreateNode (
+    PTMPFS_VOLUME Volume,
+    PFILE_PROPERTIES Properties,
+    PTMPFS_NODE *NewNode
+    );
+
+VOID
+TmpFspDestroyNode (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node
+    );
+
+PTMPFS_NODE
+TmpFspGetNode (
+    PTMPFS_VOLUME Volume,
+    FILE_ID FileId
+    );
+
+PTMPFS_ENTRY
+TmpFspCreateEntry (
+    PCSTR Name,
+    ULONG NameSize
+    );
+
+VOID
+TmpFspDestroyEntry (
+    PTMPFS_ENTRY Entry
+    );
+
+PTMPFS_ENTRY
+TmpFspFindEntry (
+    PTMPFS_NODE Directory,
+    PCSTR Name,
+    ULONG NameSize
+    );
+
+VOID
+TmpFspInsertEntry (
+    PTMPFS_NODE Directory,
+    PTMPFS_ENTRY Entry,
+    PTMPFS_NODE Node
+    );
+
+VOID
+TmpFspRemoveEntry (
+    PTMPFS_ENTRY Entry
+    );
+
+VOID
+TmpFspGrowDirectory (
+    PTMPFS_NODE Directory
+    );
+
+ULONG
+TmpFspMeasureName (
+    PCSTR Name,
+    ULONG NameSize
+    );
+
+PTMPFS_BACKING_REGION
+TmpFspCreateBackingRegion (
+    PTMPFS_NODE Node,
+    IO_OFFSET Offset,
+    PTMPFS_BACKING_REGION NextRegion
+    );
+
+VOID
+TmpFspDestroyBackingRegion (
+    PTMPFS_BACKING_REGION Region
+    );
+
+VOID
+TmpFspTruncateBackingRegions (
+    PTMPFS_NODE Node,
+    ULONGLONG NewSize
+    );
+
+COMPARISON_RESULT
+TmpFspCompareNodes (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+COMPARISON_RESULT
+TmpFspCompareEntries (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+PDRIVER TmpFsDriver = NULL;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+__USED
+KSTATUS
+DriverEntry (
+    PDRIVER Driver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for the temporary file system driver. It
+    registers its other dispatch functions, and performs driver-wide
+    initialization.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver object.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code on error.
+
+--*/
+
+{
+
+    DRIVER_FUNCTION_TABLE FunctionTable;
+    KSTATUS Status;
+
+    TmpFsDriver = Driver;
+    RtlZeroMemory(&FunctionTable, sizeof(DRIVER_FUNCTION_TABLE));
+    FunctionTable.Version = DRIVER_FUNCTION_TABLE_VERSION;
+    FunctionTable.AddDevice = TmpFsAddDevice;
+    FunctionTable.DispatchStateChange = TmpFsDispatchStateChange;
+    FunctionTable.DispatchOpen = TmpFsDispatchOpen;
+    FunctionTable.DispatchClose = TmpFsDispatchClose;
+    FunctionTable.DispatchIo = TmpFsDispatchIo;
+    FunctionTable.DispatchSystemControl = TmpFsDispatchSystemControl;
+    Status = IoRegisterDriverFunctions(Driver, &FunctionTable);
+    if (!KSUCCESS(Status)) {
+        goto DriverEntryEnd;
+    }
+
+    Status = IoRegisterFileSystem(Driver);
+    if (!KSUCCESS(Status)) {
+        goto DriverEntryEnd;
+    }
+
+DriverEntryEnd:
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+TmpFsAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called both when the temporary file system device is
+    enumerated, in which case the driver becomes its function driver, and when
+    a volume is created on any device, in which case the driver mounts the
+    volume if it sits on the temporary file system device.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver being called.
+
+    DeviceId - Supplies a pointer to a string with the device ID.
+
+    ClassId - Supplies a pointer to a string containing the device's class ID.
+
+    CompatibleIds - Supplies a pointer to a string containing device IDs
+        that would be compatible with this device.
+
+    DeviceToken - Supplies an opaque token that the driver can use to identify
+        the device in the system. This token should be used when attaching to
+        the stack.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code if the driver was unsuccessful in attaching itself.
+
+--*/
+
+{
+
+    PTMPFS_DEVICE Device;
+    KSTATUS Status;
+    PDEVICE TargetDevice;
+    PTMPFS_VOLUME Volume;
+
+    Device = NULL;
+    Volume = NULL;
+
+    //
+    // Become the function driver of the device itself. It is marked mountable
+    // when it starts.
+    //
+
+    if (IoAreDeviceIdsEqual(DeviceId, TMPFS_DEVICE_ID) != FALSE) {
+        Device = MmAllocatePagedPool(sizeof(TMPFS_DEVICE),
+                                     TMPFS_ALLOCATION_TAG);
+
+        if (Device == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto AddDeviceEnd;
+        }
+
+        RtlZeroMemory(Device, sizeof(TMPFS_DEVICE));
+        Device->Type = TmpFsObjectDevice;
+        KeGetSystemTime(&(Device->CreationTime));
+        Status = IoAttachDriverToDevice(Driver, DeviceToken, Device);
+        goto AddDeviceEnd;
+    }
+
+    //
+    // Otherwise this is a volume looking for a file system. Only mount the
+    // volumes that sit on the temporary file system device.
+    //
+
+    TargetDevice = IoGetTargetDevice(DeviceToken);
+    if ((TargetDevice == NULL) ||
+        (IoAreDeviceIdsEqual(IoGetDeviceId(TargetDevice), TMPFS_DEVICE_ID) ==
+         FALSE)) {
+
+        Status = STATUS_NOT_SUPPORTED;
+        goto AddDeviceEnd;
+    }
+
+    Status = TmpFspCreateVolume(&Volume);
+    if (!KSUCCESS(Status)) {
+        goto AddDeviceEnd;
+    }
+
+    Status = IoAttachDriverToDevice(Driver, DeviceToken, Volume);
+    if (!KSUCCESS(Status)) {
+        goto AddDeviceEnd;
+    }
+
+    Volume->ReferenceCount = 1;
+    Volume->Attached = TRUE;
+
+AddDeviceEnd:
+    if (!KSUCCESS(Status)) {
+        if (Device != NULL) {
+            MmFreePagedPool(Device);
+        }
+
+        if (Volume != NULL) {
+            TmpFspDestroyVolume(Volume);
+        }
+    }
+
+    return Status;
+}
+
+VOID
+TmpFsDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles State Change IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_OBJECT_TYPE Type;
+
+    ASSERT(Irp->MajorCode == IrpMajorStateChange);
+
+    Type = DeviceContext;
+
+    //
+    // The device is enumerated by the root, so handle its IRPs on the way
+    // back up. Mark it mountable when it starts so that the system creates a
+    // volume on it.
+    //
+
+    if (*Type == TmpFsObjectDevice) {
+        switch (Irp->MinorCode) {
+        case IrpMinorQueryResources:
+        case IrpMinorQueryChildren:
+            if (Irp->Direction == IrpUp) {
+                IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+            }
+
+            break;
+
+        case IrpMinorStartDevice:
+            if (Irp->Direction == IrpUp) {
+                IoSetDeviceMountable(Irp->Device);
+                IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+            }
+
+            break;
+
+        case IrpMinorRemoveDevice:
+            if (Irp->Direction == IrpUp) {
+                MmFreePagedPool(DeviceContext);
+                IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+            }
+
+            break;
+
+        default:
+            break;
+        }
+
+        return;
+    }
+
+    ASSERT(*Type == TmpFsObjectVolume);
+
+    if (Irp->Direction == IrpDown) {
+        switch (Irp->MinorCode) {
+        case IrpMinorQueryResources:
+        case IrpMinorStartDevice:
+            IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        case IrpMinorQueryChildren:
+            Irp->U.QueryChildren.ChildCount = 0;
+            Irp->U.QueryChildren.Children = NULL;
+            IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        case IrpMinorRemoveDevice:
+            TmpFspRemoveVolume(DeviceContext);
+            IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        default:
+
+            ASSERT(FALSE);
+
+            IoCompleteIrp(TmpFsDriver, Irp, STATUS_NOT_SUPPORTED);
+            break;
+        }
+    }
+
+    return;
+}
+
+VOID
+TmpFsDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Open IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_NODE Node;
+    ULONG OpenFlags;
+    KSTATUS Status;
+    PTMPFS_OBJECT_TYPE Type;
+    PTMPFS_VOLUME Volume;
+
+    ASSERT(Irp->MajorCode == IrpMajorOpen);
+    ASSERT(Irp->MinorCode == IrpMinorOpen);
+
+    //
+    // The device itself holds no data to open.
+    //
+
+    Type = DeviceContext;
+    if (*Type != TmpFsObjectVolume) {
+        IoCompleteIrp(TmpFsDriver, Irp, STATUS_NOT_SUPPORTED);
+        return;
+    }
+
+    Volume = DeviceContext;
+
+    ASSERT(Volume->Attached != FALSE);
+
+    //
+    // The data only exists in the page cache, so it cannot be bypassed, and
+    // there is no disk to page to.
+    //
+
+    OpenFlags = Irp->U.Open.OpenFlags;
+    if ((OpenFlags & OPEN_FLAG_PAGE_FILE) != 0) {
+        Status = STATUS_NO_ELIGIBLE_DEVICES;
+        goto DispatchOpenEnd;
+    }
+
+    if (((OpenFlags & OPEN_FLAG_NO_PAGE_CACHE) != 0) &&
+        (Irp->U.Open.FileProperties->Type != IoObjectRegularDirectory)) {
+
+        Status = STATUS_NOT_SUPPORTED;
+        goto DispatchOpenEnd;
+    }
+
+    KeAcquireSharedExclusiveLockShared(Volume->Lock);
+    Node = TmpFspGetNode(Volume, Irp->U.Open.FileProperties->FileId);
+    KeReleaseSharedExclusiveLockShared(Volume->Lock);
+    if (Node == NULL) {
+        Status = STATUS_PATH_NOT_FOUND;
+        goto DispatchOpenEnd;
+    }
+
+    TmpFspVolumeAddReference(Volume);
+    Irp->U.Open.DeviceContext = Node;
+    Status = STATUS_SUCCESS;
+
+DispatchOpenEnd:
+    IoCompleteIrp(TmpFsDriver, Irp, Status);
+    return;
+}
+
+VOID
+TmpFsDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Close IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Irp->MajorCode == IrpMajorClose);
+    ASSERT(Irp->MinorCode == IrpMinorClose);
+    ASSERT(*((PTMPFS_OBJECT_TYPE)DeviceContext) == TmpFsObjectVolume);
+
+    TmpFspVolumeReleaseReference(DeviceContext);
+    IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+    return;
+}
+
+VOID
+TmpFsDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles I/O IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+    PTMPFS_VOLUME Volume;
+
+    ASSERT(Irp->Direction == IrpDown);
+    ASSERT(Irp->MajorCode == IrpMajorIo);
+    ASSERT(Irp->U.ReadWrite.IoBuffer != NULL);
+
+    Volume = DeviceContext;
+    if ((Volume->Type != TmpFsObjectVolume) || (Volume->Attached == FALSE)) {
+        IoCompleteIrp(TmpFsDriver, Irp, STATUS_DEVICE_NOT_CONNECTED);
+        return;
+    }
+
+    Node = Irp->U.ReadWrite.DeviceContext;
+    if (Node->Properties.Type == IoObjectRegularDirectory) {
+        if (Irp->MinorCode == IrpMinorIoWrite) {
+            Status = STATUS_ACCESS_DENIED;
+
+        } else {
+            KeAcquireSharedExclusiveLockShared(Volume->Lock);
+            Status = TmpFspEnumerateDirectory(Volume, Node, Irp);
+            KeReleaseSharedExclusiveLockShared(Volume->Lock);
+        }
+
+    } else {
+        Status = TmpFspPerformIo(Volume, Node, Irp);
+    }
+
+    IoCompleteIrp(TmpFsDriver, Irp, Status);
+    return;
+}
+
+VOID
+TmpFsDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID Context;
+    PSYSTEM_CONTROL_FILE_OPERATION FileOperation;
+    PTMPFS_NODE Node;
+    PFILE_PROPERTIES Properties;
+    KSTATUS Status;
+    PTMPFS_VOLUME Volume;
+
+    Volume = DeviceContext;
+    if (Volume->Type == TmpFsObjectDevice) {
+        TmpFspDispatchDeviceSystemControl(Irp, DeviceContext);
+        return;
+    }
+
+    ASSERT(Volume->Type == TmpFsObjectVolume);
+    ASSERT(Volume->Attached != FALSE);
+
+    Context = Irp->U.SystemControl.SystemContext;
+    switch (Irp->MinorCode) {
+    case IrpMinorSystemControlLookup:
+        Status = TmpFspLookup(Volume, Context);
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    case IrpMinorSystemControlCreate:
+        Status = TmpFspCreate(Volume, Context);
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    //
+    // Free the file now that nothing links to or uses it.
+    //
+
+    case IrpMinorSystemControlDelete:
+        FileOperation = (PSYSTEM_CONTROL_FILE_OPERATION)Context;
+
+        ASSERT(FileOperation->FileProperties->HardLinkCount == 0);
+        ASSERT(FileOperation->FileProperties->FileId != TMPFS_ROOT_FILE_ID);
+
+        KeAcquireSharedExclusiveLockExclusive(Volume->Lock);
+        Node = TmpFspGetNode(Volume, FileOperation->FileProperties->FileId);
+        Status = STATUS_PATH_NOT_FOUND;
+        if (Node != NULL) {
+            TmpFspDestroyNode(Volume, Node);
+            Status = STATUS_SUCCESS;
+        }
+
+        KeReleaseSharedExclusiveLockExclusive(Volume->Lock);
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    //
+    // The properties are only kept in memory, so just save a copy for the
+    // next lookup.
+    //
+
+    case IrpMinorSystemControlWriteFileProperties:
+        FileOperation = (PSYSTEM_CONTROL_FILE_OPERATION)Context;
+        Properties = FileOperation->FileProperties;
+        KeAcquireSharedExclusiveLockExclusive(Volume->Lock);
+        Node = TmpFspGetNode(Volume, Properties->FileId);
+        Status = STATUS_PATH_NOT_FOUND;
+        if (Node != NULL) {
+
+            ASSERT(Node->Properties.Type == Properties->Type);
+
+            RtlCopyMemory(&(Node->Properties),
+                          Properties,
+                          sizeof(FILE_PROPERTIES));
+
+            Status = STATUS_SUCCESS;
+        }
+
+        KeReleaseSharedExclusiveLockExclusive(Volume->Lock);
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    case IrpMinorSystemControlUnlink:
+        Status = TmpFspUnlink(Volume, Context);
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    case IrpMinorSystemControlRename:
+        Status = TmpFspRename(Volume, Context);
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    case IrpMinorSystemControlTruncate:
+        Status = TmpFspTruncate(Volume, Context);
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    //
+    // There are no blocks to report, as the data has no fixed home.
+    //
+
+    case IrpMinorSystemControlGetBlockInformation:
+    case IrpMinorSystemControlDeviceInformation:
+        IoCompleteIrp(TmpFsDriver, Irp, STATUS_NOT_SUPPORTED);
+        break;
+
+    case IrpMinorSystemControlSynchronize:
+        IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+        break;
+
+    //
+    // Ignore everything unrecognized.
+    //
+
+    default:
+        break;
+    }
+
+    return;
+}
+
+VOID
+TmpFspDispatchDeviceSystemControl (
+    PIRP Irp,
+    PTMPFS_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs sent to the device the temporary
+    file system mounts on. The device presents itself as an empty block
+    device so that it can be named as the target of a mount.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Device - Supplies a pointer to the device context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PSYSTEM_CONTROL_LOOKUP Lookup;
+    PFILE_PROPERTIES Properties;
+    KSTATUS Status;
+
+    switch (Irp->MinorCode) {
+    case IrpMinorSystemControlLookup:
+        Lookup = (PSYSTEM_CONTROL_LOOKUP)Irp->U.SystemControl.SystemContext;
+        Status = STATUS_PATH_NOT_FOUND;
+        if (Lookup->Root != FALSE) {
+            Properties = Lookup->Properties;
+            Properties->FileId = 0;
+            Properties->Type = IoObjectBlockDevice;
+            Properties->HardLinkCount = 1;
+            Properties->BlockSize = MmPageSize();
+            Properties->BlockCount = 0;
+            Properties->Size = 0;
+            Properties->UserId = 0;
+            Properties->GroupId = 0;
+            Properties->StatusChangeTime = Device->CreationTime;
+            Properties->ModifiedTime = Properties->StatusChangeTime;
+            Properties->AccessTime = Properties->StatusChangeTime;
+            Properties->Permissions = FILE_PERMISSION_USER_READ |
+                                      FILE_PERMISSION_USER_WRITE;
+
+            Lookup->Flags = LOOKUP_FLAG_NO_PAGE_CACHE;
+            Status = STATUS_SUCCESS;
+        }
+
+        break;
+
+    case IrpMinorSystemControlWriteFileProperties:
+    case IrpMinorSystemControlSynchronize:
+        Status = STATUS_SUCCESS;
+        break;
+
+    default:
+        Status = STATUS_NOT_SUPPORTED;
+        break;
+    }
+
+    IoCompleteIrp(TmpFsDriver, Irp, Status);
+    return;
+}
+
+KSTATUS
+TmpFspCreateVolume (
+    PTMPFS_VOLUME *NewVolume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates an empty temporary file system volume.
+
+Arguments:
+
+    NewVolume - Supplies a pointer where a pointer to the new volume will be
+        returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN PhysicalPages;
+    FILE_PROPERTIES Properties;
+    KSTATUS Status;
+    PTMPFS_VOLUME Volume;
+
+    Volume = MmAllocatePagedPool(sizeof(TMPFS_VOLUME), TMPFS_ALLOCATION_TAG);
+    if (Volume == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateVolumeEnd;
+    }
+
+    RtlZeroMemory(Volume, sizeof(TMPFS_VOLUME));
+    Volume->Type = TmpFsObjectVolume;
+    RtlRedBlackTreeInitialize(&(Volume->NodeTree), 0, TmpFspCompareNodes);
+    Volume->NextFileId = TMPFS_ROOT_FILE_ID;
+    PhysicalPages = MmGetTotalPhysicalPages() >> TMPFS_LIMIT_SHIFT;
+    Volume->SizeLimit = (ULONGLONG)PhysicalPages << MmPageShift();
+    Volume->NodeLimit = PhysicalPages;
+    Volume->Lock = KeCreateSharedExclusiveLock();
+    if (Volume->Lock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateVolumeEnd;
+    }
+
+    //
+    // Create the root directory. It is sticky and world writable, as befits a
+    // scratch area.
+    //
+
+    RtlZeroMemory(&Properties, sizeof(FILE_PROPERTIES));
+    Properties.Type = IoObjectRegularDirectory;
+    Properties.Permissions = FILE_PERMISSION_ALL | FILE_PERMISSION_RESTRICTED;
+    Properties.HardLinkCount = 1;
+    KeGetSystemTime(&(Properties.AccessTime));
+    Properties.ModifiedTime = Properties.AccessTime;
+    Properties.StatusChangeTime = Properties.AccessTime;
+    Properties.CreationTime = Properties.AccessTime;
+    Status = TmpFspCreateNode(Volume, &Properties, &(Volume->Root));
+    if (!KSUCCESS(Status)) {
+        goto CreateVolumeEnd;
+    }
+
+    ASSERT(Volume->Root->Properties.FileId == TMPFS_ROOT_FILE_ID);
+
+CreateVolumeEnd:
+    if (!KSUCCESS(Status)) {
+        if (Volume != NULL) {
+            TmpFspDestroyVolume(Volume);
+            Volume = NULL;
+        }
+    }
+
+    *NewVolume = Volume;
+    return Status;
+}
+
+VOID
+TmpFspRemoveVolume (
+    PTMPFS_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a temporary file system volume from the system.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume being removed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Volume->Attached != FALSE);
+
+    //
+    // Release the original reference. Files still open keep the volume alive
+    // until they close.
+    //
+
+    Volume->Attached = FALSE;
+    TmpFspVolumeReleaseReference(Volume);
+    return;
+}
+
+VOID
+TmpFspVolumeAddReference (
+    PTMPFS_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine increments the reference count on a volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+
+    OldReferenceCount = RtlAtomicAdd32(&(Volume->ReferenceCount), 1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+
+    return;
+}
+
+VOID
+TmpFspVolumeReleaseReference (
+    PTMPFS_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine decrements the reference count on a volume, destroying it
+    and all of its files when the count hits zero.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+
+    OldReferenceCount = RtlAtomicAdd32(&(Volume->ReferenceCount), (ULONG)-1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+
+    if (OldReferenceCount == 1) {
+        TmpFspDestroyVolume(Volume);
+    }
+
+    return;
+}
+
+VOID
+TmpFspDestroyVolume (
+    PTMPFS_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a volume and every file on it.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY Bucket;
+    ULONG BucketIndex;
+    PTMPFS_ENTRY Entry;
+    PTMPFS_NODE Node;
+    PRED_BLACK_TREE_NODE TreeNode;
+
+    //
+    // Tear down every directory first so that the files are free of their
+    // names, then destroy the files.
+    //
+
+    TreeNode = RtlRedBlackTreeGetLowestNode(&(Volume->NodeTree));
+    while (TreeNode != NULL) {
+        Node = RED_BLACK_TREE_VALUE(TreeNode, TMPFS_NODE, TreeNode);
+        for (BucketIndex = 0;
+             BucketIndex < Node->BucketCount;
+             BucketIndex += 1) {
+
+            Bucket = &(Node->Buckets[BucketIndex]);
+            while (LIST_EMPTY(Bucket) == FALSE) {
+                Entry = LIST_VALUE(Bucket->Next, TMPFS_ENTRY, ListEntry);
+                TmpFspRemoveEntry(Entry);
+                TmpFspDestroyEntry(Entry);
+            }
+        }
+
+        TreeNode = RtlRedBlackTreeGetNextNode(&(Volume->NodeTree),
+                                              FALSE,
+                                              TreeNode);
+    }
+
+    while (TRUE) {
+        TreeNode = RtlRedBlackTreeGetLowestNode(&(Volume->NodeTree));
+        if (TreeNode == NULL) {
+            break;
+        }
+
+        Node = RED_BLACK_TREE_VALUE(TreeNode, TMPFS_NODE, TreeNode);
+        TmpFspDestroyNode(Volume, Node);
+    }
+
+    ASSERT((Volume->NodeCount == 0) && (Volume->Size == 0));
+
+    if (Volume->Lock != NULL) {
+        KeDestroySharedExclusiveLock(Volume->Lock);
+    }
+
+    MmFreePagedPool(Volume);
+    return;
+}
+
+KSTATUS
+TmpFspLookup (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_LOOKUP Lookup
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up a file by name in a directory.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Lookup - Supplies a pointer to the lookup request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE Directory;
+    PTMPFS_ENTRY Entry;
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+
+    KeAcquireSharedExclusiveLockShared(Volume->Lock);
+    if (Lookup->Root != FALSE) {
+        Node = Volume->Root;
+
+    } else {
+        Directory = TmpFspGetNode(Volume, Lookup->DirectoryProperties->FileId);
+        if ((Directory == NULL) ||
+            (Directory->Properties.Type != IoObjectRegularDirectory)) {
+
+            Status = STATUS_NOT_A_DIRECTORY;
+            goto LookupEnd;
+        }
+
+        Entry = TmpFspFindEntry(Directory,
+                                Lookup->FileName,
+                                Lookup->FileNameSize);
+
+        if (Entry == NULL) {
+            Status = STATUS_PATH_NOT_FOUND;
+            goto LookupEnd;
+        }
+
+        Node = Entry->Node;
+    }
+
+    RtlCopyMemory(Lookup->Properties,
+                  &(Node->Properties),
+                  sizeof(FILE_PROPERTIES));
+
+    Lookup->Flags = LOOKUP_FLAG_HARD_FLUSH_REQUIRED;
+    Status = STATUS_SUCCESS;
+
+LookupEnd:
+    KeReleaseSharedExclusiveLockShared(Volume->Lock);
+    return Status;
+}
+
+KSTATUS
+TmpFspCreate (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_CREATE Create
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new file or directory.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Create - Supplies a pointer to the create request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE Directory;
+    PTMPFS_ENTRY Entry;
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+
+    Entry = TmpFspCreateEntry(Create->Name, Create->NameSize);
+    if (Entry == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeAcquireSharedExclusiveLockExclusive(Volume->Lock);
+    Directory = TmpFspGetNode(Volume, Create->DirectoryProperties->FileId);
+    if ((Directory == NULL) ||
+        (Directory->Properties.Type != IoObjectRegularDirectory)) {
+
+        Status = STATUS_NOT_A_DIRECTORY;
+        goto CreateEnd;
+    }
+
+    ASSERT(Directory->Entry != NULL || Directory == Volume->Root);
+
+    if (TmpFspFindEntry(Directory, Create->Name, Create->NameSize) != NULL) {
+        Status = STATUS_FILE_EXISTS;
+        goto CreateEnd;
+    }
+
+    Status = TmpFspCreateNode(Volume, &(Create->FileProperties), &Node);
+    if (!KSUCCESS(Status)) {
+        goto CreateEnd;
+    }
+
+    TmpFspInsertEntry(Directory, Entry, Node);
+    Entry = NULL;
+    RtlCopyMemory(&(Create->FileProperties),
+                  &(Node->Properties),
+                  sizeof(FILE_PROPERTIES));
+
+    Create->DirectorySize = Directory->NextOffset;
+    Create->Flags = LOOKUP_FLAG_HARD_FLUSH_REQUIRED;
+
+CreateEnd:
+    KeReleaseSharedExclusiveLockExclusive(Volume->Lock);
+    if (Entry != NULL) {
+        TmpFspDestroyEntry(Entry);
+    }
+
+    return Status;
+}
+
+KSTATUS
+TmpFspUnlink (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_UNLINK Unlink
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a name from a directory. The file itself lives on
+    until the system sends the delete request.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Unlink - Supplies a pointer to the unlink request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE Directory;
+    PTMPFS_ENTRY Entry;
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+
+    ASSERT(Unlink->FileProperties->FileId != TMPFS_ROOT_FILE_ID);
+
+    Entry = NULL;
+    KeAcquireSharedExclusiveLockExclusive(Volume->Lock);
+    Directory = TmpFspGetNode(Volume, Unlink->DirectoryProperties->FileId);
+    if (Directory == NULL) {
+        Status = STATUS_PATH_NOT_FOUND;
+        goto UnlinkEnd;
+    }
+
+    Entry = TmpFspFindEntry(Directory, Unlink->Name, Unlink->NameSize);
+    if ((Entry == NULL) ||
+        (Entry->Node->Properties.FileId != Unlink->FileProperties->FileId)) {
+
+        Entry = NULL;
+        Status = STATUS_PATH_NOT_FOUND;
+        goto UnlinkEnd;
+    }
+
+    Node = Entry->Node;
+    if (Node->EntryCount != 0) {
+        Entry = NULL;
+        Status = STATUS_DIRECTORY_NOT_EMPTY;
+        goto UnlinkEnd;
+    }
+
+    TmpFspRemoveEntry(Entry);
+    Node->Properties.HardLinkCount -= 1;
+    Unlink->Unlinked = TRUE;
+    Status = STATUS_SUCCESS;
+
+UnlinkEnd:
+    KeReleaseSharedExclusiveLockExclusive(Volume->Lock);
+    if (KSUCCESS(Status)) {
+        TmpFspDestroyEntry(Entry);
+    }
+
+    return Status;
+}
+
+KSTATUS
+TmpFspRename (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_RENAME Rename
+    )
+
+/*++
+
+Routine Description:
+
+    This routine renames a file or directory, replacing whatever sits at the
+    destination.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Rename - Supplies a pointer to the rename request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE Destination;
+    PTMPFS_NODE DestinationDirectory;
+    PTMPFS_ENTRY DestinationEntry;
+    PFILE_PROPERTIES DirectoryProperties;
+    PTMPFS_ENTRY NewEntry;
+    PTMPFS_NODE Source;
+    PTMPFS_ENTRY SourceEntry;
+    KSTATUS Status;
+
+    ASSERT(Rename->SourceFileProperties != Rename->DestinationFileProperties);
+    ASSERT(Rename->DestinationFileUnlinked == FALSE);
+
+    DestinationEntry = NULL;
+    SourceEntry = NULL;
+    Rename->SourceFileHardLinkDelta = 0;
+    NewEntry = TmpFspCreateEntry(Rename->Name, Rename->NameSize);
+    if (NewEntry == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeAcquireSharedExclusiveLockExclusive(Volume->Lock);
+    Source = TmpFspGetNode(Volume, Rename->SourceFileProperties->FileId);
+    DirectoryProperties = Rename->DestinationDirectoryProperties;
+    DestinationDirectory = TmpFspGetNode(Volume, DirectoryProperties->FileId);
+
+    if ((Source == NULL) || (Source->Entry == NULL) ||
+        (Source->Entry->Directory->Properties.FileId !=
+         Rename->SourceDirectoryProperties->FileId)) {
+
+        Status = STATUS_PATH_NOT_FOUND;
+        goto RenameEnd;
+    }
+
+    if ((DestinationDirectory == NULL) ||
+        (DestinationDirectory->Properties.Type != IoObjectRegularDirectory)) {
+
+        Status = STATUS_NOT_A_DIRECTORY;
+        goto RenameEnd;
+    }
+
+    //
+    // Unlink whatever currently sits at the destination.
+    //
+
+    DestinationEntry = TmpFspFindEntry(DestinationDirectory,
+                                       Rename->Name,
+                                       Rename->NameSize);
+
+    if (DestinationEntry != NULL) {
+        Destination = DestinationEntry->Node;
+        if ((Rename->DestinationFileProperties == NULL) ||
+            (Destination->Properties.FileId !=
+             Rename->DestinationFileProperties->FileId)) {
+
+            DestinationEntry = NULL;
+            Status = STATUS_FILE_EXISTS;
+            goto RenameEnd;
+        }
+
+        if (Destination->EntryCount != 0) {
+            DestinationEntry = NULL;
+            Status = STATUS_DIRECTORY_NOT_EMPTY;
+            goto RenameEnd;
+        }
+
+        TmpFspRemoveEntry(DestinationEntry);
+        Destination->Properties.HardLinkCount -= 1;
+        Rename->DestinationFileUnlinked = TRUE;
+    }
+
+    //
+    // Move the source over to its new name.
+    //
+
+    SourceEntry = Source->Entry;
+    TmpFspRemoveEntry(SourceEntry);
+    TmpFspInsertEntry(DestinationDirectory, NewEntry, Source);
+    NewEntry = NULL;
+    Rename->DestinationDirectorySize = DestinationDirectory->NextOffset;
+    Status = STATUS_SUCCESS;
+
+RenameEnd:
+    KeReleaseSharedExclusiveLockExclusive(Volume->Lock);
+    if (NewEntry != NULL) {
+        TmpFspDestroyEntry(NewEntry);
+    }
+
+    if (DestinationEntry != NULL) {
+        TmpFspDestroyEntry(DestinationEntry);
+    }
+
+    if (SourceEntry != NULL) {
+        TmpFspDestroyEntry(SourceEntry);
+    }
+
+    return Status;
+}
+
+KSTATUS
+TmpFspTruncate (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_TRUNCATE Truncate
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the size of a file, charging any growth against the
+    volume and releasing the page file space of any data cut off.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Truncate - Supplies a pointer to the truncate request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONGLONG NewSize;
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+
+    ASSERT(Truncate->FileProperties->Type == IoObjectRegularFile);
+
+    NewSize = Truncate->NewSize;
+    KeAcquireSharedExclusiveLockExclusive(Volume->Lock);
+    Node = TmpFspGetNode(Volume, Truncate->FileProperties->FileId);
+    if (Node == NULL) {
+        Status = STATUS_PATH_NOT_FOUND;
+        goto TruncateEnd;
+    }
+
+    Status = TmpFspChargeNode(Volume, Node, NewSize, TRUE);
+    if (!KSUCCESS(Status)) {
+        goto TruncateEnd;
+    }
+
+    if (NewSize < Truncate->FileProperties->Size) {
+        TmpFspTruncateBackingRegions(Node, NewSize);
+    }
+
+    Node->Properties.Size = NewSize;
+    Truncate->FileProperties->Size = NewSize;
+
+TruncateEnd:
+    KeReleaseSharedExclusiveLockExclusive(Volume->Lock);
+    return Status;
+}
+
+KSTATUS
+TmpFspEnumerateDirectory (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Directory,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads directory entries out of a directory, in offset order.
+    The volume lock must be held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Directory - Supplies a pointer to the directory to read.
+
+    Irp - Supplies a pointer to the read IRP. The system may have already put
+        the dot entries in the buffer, which the bytes completed reflects.
+
+Return Value:
+
+    STATUS_SUCCESS if entries were read.
+
+    STATUS_MORE_PROCESSING_REQUIRED if the buffer filled up.
+
+    STATUS_END_OF_FILE if the buffer is empty and there are no more entries.
+
+    Other error codes on failure to copy into the buffer.
+
+--*/
+
+{
+
+    UINTN BytesRead;
+    DIRECTORY_ENTRY DirectoryEntry;
+    PTMPFS_ENTRY Entry;
+    UINTN EntrySize;
+    IO_OFFSET NextOffset;
+    TMPFS_ENTRY Search;
+    KSTATUS Status;
+    PRED_BLACK_TREE_NODE TreeNode;
+
+    ASSERT(Irp->U.ReadWrite.IoOffset >= DIRECTORY_CONTENTS_OFFSET);
+
+    BytesRead = Irp->U.ReadWrite.IoBytesCompleted;
+    NextOffset = Irp->U.ReadWrite.IoOffset;
+    Search.Offset = NextOffset;
+    TreeNode = RtlRedBlackTreeSearchClosest(&(Directory->EntryTree),
+                                            &(Search.TreeNode),
+                                            TRUE);
+
+    Status = STATUS_SUCCESS;
+    while (TreeNode != NULL) {
+        Entry = RED_BLACK_TREE_VALUE(TreeNode, TMPFS_ENTRY, TreeNode);
+        EntrySize = ALIGN_RANGE_UP(sizeof(DIRECTORY_ENTRY) +
+                                   Entry->NameLength + 1,
+                                   8);
+
+        if (BytesRead + EntrySize > Irp->U.ReadWrite.IoSizeInBytes) {
+            Status = STATUS_MORE_PROCESSING_REQUIRED;
+            break;
+        }
+
+        DirectoryEntry.FileId = Entry->Node->Properties.FileId;
+        DirectoryEntry.NextOffset = Entry->Offset + 1;
+        DirectoryEntry.Size = EntrySize;
+        DirectoryEntry.Type = Entry->Node->Properties.Type;
+        Status = MmCopyIoBufferData(Irp->U.ReadWrite.IoBuffer,
+                                    &DirectoryEntry,
+                                    BytesRead,
+                                    sizeof(DIRECTORY_ENTRY),
+                                    TRUE);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        Status = MmCopyIoBufferData(Irp->U.ReadWrite.IoBuffer,
+                                    Entry->Name,
+                                    BytesRead + sizeof(DIRECTORY_ENTRY),
+                                    Entry->NameLength + 1,
+                                    TRUE);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        BytesRead += EntrySize;
+        NextOffset = Entry->Offset + 1;
+        TreeNode = RtlRedBlackTreeGetNextNode(&(Directory->EntryTree),
+                                              FALSE,
+                                              TreeNode);
+    }
+
+    if ((TreeNode == NULL) && (BytesRead == 0)) {
+        Status = STATUS_END_OF_FILE;
+    }
+
+    Irp->U.ReadWrite.IoBytesCompleted = BytesRead;
+    Irp->U.ReadWrite.NewIoOffset = NextOffset;
+    return Status;
+}
+
+KSTATUS
+TmpFspPerformIo (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs I/O to a file on behalf of the page cache. Reads
+    return data previously saved to the page file, or zeros. Writes are
+    discarded, as the page cache holds the data, unless they are hard flushes
+    of pages about to be evicted, which are saved to the page file.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Node - Supplies a pointer to the file.
+
+    Irp - Supplies a pointer to the I/O IRP.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AlignedSize;
+    UINTN BytesCompleted;
+    UINTN BytesCompletedThisRound;
+    UINTN BytesRemaining;
+    UINTN BytesThisRound;
+    PLIST_ENTRY CurrentEntry;
+    IO_OFFSET CurrentOffset;
+    PIO_BUFFER IoBuffer;
+    IO_OFFSET IoEnd;
+    ULONG IoFlags;
+    IO_OFFSET IoOffset;
+    UINTN IoSize;
+    BOOL LockHeld;
+    UINTN OriginalIoBufferOffset;
+    ULONG PageCount;
+    ULONG PageIndex;
+    ULONG PageMask;
+    ULONG PageShift;
+    ULONG PageSize;
+    PTMPFS_BACKING_REGION Region;
+    IO_OFFSET RegionEnd;
+    ULONG RegionOffset;
+    KSTATUS Status;
+    BOOL Write;
+
+    ASSERT(Node->DataLock != NULL);
+
+    BytesCompleted = 0;
+    IoBuffer = Irp->U.ReadWrite.IoBuffer;
+    IoFlags = Irp->U.ReadWrite.IoFlags;
+    IoOffset = Irp->U.ReadWrite.IoOffset;
+    IoSize = Irp->U.ReadWrite.IoSizeInBytes;
+    LockHeld = FALSE;
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    OriginalIoBufferOffset = MmGetIoBufferCurrentOffset(IoBuffer);
+    AlignedSize = ALIGN_RANGE_UP(IoSize, PageSize);
+    Write = FALSE;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        Write = TRUE;
+    }
+
+    //
+    // The file system is only ever reached through the page cache.
+    //
+
+    ASSERT(IS_ALIGNED(IoOffset, PageSize) != FALSE);
+
+    //
+    // Charge any growth against the volume, then drop writes that are not
+    // hard flushes. The page cache keeps the data.
+    //
+
+    if (Write != FALSE) {
+        KeAcquireSharedExclusiveLockExclusive(Volume->Lock);
+        Status = TmpFspChargeNode(Volume, Node, IoOffset + IoSize, FALSE);
+        KeReleaseSharedExclusiveLockExclusive(Volume->Lock);
+        if (!KSUCCESS(Status)) {
+            goto PerformIoEnd;
+        }
+
+        if ((IoFlags & IO_FLAG_HARD_FLUSH) == 0) {
+            BytesCompleted = IoSize;
+            Status = STATUS_SUCCESS;
+            goto PerformIoEnd;
+        }
+
+        //
+        // The page file write is a no-allocate path. Make sure the buffer is
+        // mapped before going there.
+        //
+
+        MmMapIoBuffer(IoBuffer, FALSE, FALSE, FALSE);
+        KeAcquireSharedExclusiveLockExclusive(Node->DataLock);
+
+    //
+    // Zero the buffer, as the page file read cannot fill in the gaps.
+    //
+
+    } else {
+        MmZeroIoBuffer(IoBuffer, 0, AlignedSize);
+        KeAcquireSharedExclusiveLockShared(Node->DataLock);
+    }
+
+    LockHeld = TRUE;
+    Status = STATUS_SUCCESS;
+    BytesRemaining = AlignedSize;
+    CurrentOffset = IoOffset;
+    CurrentEntry = Node->BackingRegionList.Next;
+    IoEnd = CurrentOffset + BytesRemaining;
+    while (BytesRemaining != 0) {
+
+        //
+        // If the end of the list has been reached, there are no more backing
+        // regions. Reads are done, and writes need a new one.
+        //
+
+        if (CurrentEntry == &(Node->BackingRegionList)) {
+            Region = NULL;
+            BytesThisRound = BytesRemaining;
+
+        } else {
+            Region = LIST_VALUE(CurrentEntry, TMPFS_BACKING_REGION, ListEntry);
+            RegionEnd = Region->Offset + Region->Size;
+            if (CurrentOffset >= RegionEnd) {
+                CurrentEntry = CurrentEntry->Next;
+                continue;
+            }
+
+            if (RegionEnd < IoEnd) {
+                BytesThisRound = RegionEnd - CurrentOffset;
+
+            } else {
+                BytesThisRound = IoEnd - CurrentOffset;
+            }
+        }
+
+        ASSERT(IS_ALIGNED(BytesThisRound, PageSize) != FALSE);
+
+        //
+        // Skip gaps in the backing regions on read, as the buffer is already
+        // zeroed. Fill them with a new region on write.
+        //
+
+        if ((Region == NULL) || (CurrentOffset < Region->Offset)) {
+            if (Write == FALSE) {
+                if ((Region != NULL) &&
+                    ((CurrentOffset + BytesThisRound) > Region->Offset)) {
+
+                    BytesThisRound = Region->Offset - CurrentOffset;
+                }
+
+                MmIoBufferIncrementOffset(IoBuffer, BytesThisRound);
+                BytesRemaining -= BytesThisRound;
+                BytesCompleted += BytesThisRound;
+                CurrentOffset += BytesThisRound;
+
+            } else {
+                Region = TmpFspCreateBackingRegion(Node,
+                                                   CurrentOffset,
+                                                   Region);
+
+                if (Region == NULL) {
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                    goto PerformIoEnd;
+                }
+
+                CurrentEntry = &(Region->ListEntry);
+            }
+
+            continue;
+        }
+
+        RegionOffset = (ULONG)(CurrentOffset - Region->Offset);
+
+        //
+        // On read, only read the pages previously written out. Skip clean
+        // pages, which were zeroed above, then read the run of dirty pages
+        // after them.
+        //
+
+        if (Write == FALSE) {
+            PageIndex = RegionOffset >> PageShift;
+            PageCount = BytesThisRound >> PageShift;
+            PageMask = TMPFS_PAGE_MASK(PageCount);
+            PageMask &= (Region->DirtyBitmap >> PageIndex);
+            if (PageMask != 0) {
+                PageCount = RtlCountTrailingZeros32(PageMask);
+            }
+
+            BytesThisRound = PageCount << PageShift;
+            MmIoBufferIncrementOffset(IoBuffer, BytesThisRound);
+            BytesRemaining -= BytesThisRound;
+            BytesCompleted += BytesThisRound;
+            CurrentOffset += BytesThisRound;
+            RegionOffset += BytesThisRound;
+            BytesThisRound = 0;
+            if (PageMask != 0) {
+                PageMask >>= RtlCountTrailingZeros32(PageMask);
+                PageCount = 32;
+                if (PageMask != MAX_ULONG) {
+                    PageCount = RtlCountTrailingZeros32(~PageMask);
+                }
+
+                BytesThisRound = PageCount << PageShift;
+            }
+
+            if (BytesThisRound == 0) {
+                CurrentEntry = CurrentEntry->Next;
+                continue;
+            }
+        }
+
+        Status = MmPageFilePerformIo(&(Region->ImageBacking),
+                                     IoBuffer,
+                                     RegionOffset,
+                                     BytesThisRound,
+                                     IoFlags,
+                                     Irp->U.ReadWrite.TimeoutInMilliseconds,
+                                     Write,
+                                     &BytesCompletedThisRound);
+
+        if (!KSUCCESS(Status)) {
+            goto PerformIoEnd;
+        }
+
+        ASSERT(BytesThisRound == BytesCompletedThisRound);
+
+        if (Write != FALSE) {
+            PageIndex = RegionOffset >> PageShift;
+            PageMask = TMPFS_PAGE_MASK(BytesCompletedThisRound >> PageShift);
+            Region->DirtyBitmap |= (PageMask << PageIndex);
+        }
+
+        MmIoBufferIncrementOffset(IoBuffer, BytesCompletedThisRound);
+        BytesRemaining -= BytesCompletedThisRound;
+        BytesCompleted += BytesCompletedThisRound;
+        CurrentOffset += BytesCompletedThisRound;
+        if (CurrentOffset >= RegionEnd) {
+            CurrentEntry = CurrentEntry->Next;
+        }
+    }
+
+PerformIoEnd:
+    if (LockHeld != FALSE) {
+        if (Write != FALSE) {
+            KeReleaseSharedExclusiveLockExclusive(Node->DataLock);
+
+        } else {
+            KeReleaseSharedExclusiveLockShared(Node->DataLock);
+        }
+    }
+
+    if (BytesCompleted > IoSize) {
+        BytesCompleted = IoSize;
+    }
+
+    MmSetIoBufferCurrentOffset(IoBuffer, OriginalIoBufferOffset);
+    Irp->U.ReadWrite.IoBytesCompleted = BytesCompleted;
+    Irp->U.ReadWrite.NewIoOffset = IoOffset + BytesCompleted;
+    return Status;
+}
+
+KSTATUS
+TmpFspChargeNode (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    ULONGLONG NewSize,
+    BOOL Truncate
+    )
+
+/*++
+
+Routine Description:
+
+    This routine charges a file's data against the volume's size limit.
+    Writes only ever grow the charge, as writing back part of a file says
+    nothing about the rest of it. Only truncation shrinks the charge. The
+    volume lock must be held exclusively.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Node - Supplies a pointer to the file.
+
+    NewSize - Supplies the end of the write, or the new size on truncate.
+
+    Truncate - Supplies a boolean indicating whether this is a truncate, which
+        sets the charge outright (TRUE), or a write, which can only grow it
+        (FALSE).
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_VOLUME_FULL if the growth would exceed the volume's size limit.
+
+--*/
+
+{
+
+    ULONGLONG Charge;
+
+    ASSERT(KeIsSharedExclusiveLockHeldExclusive(Volume->Lock) != FALSE);
+
+    Charge = ALIGN_RANGE_UP(NewSize, MmPageSize());
+    if ((Truncate == FALSE) && (Charge <= Node->ChargedSize)) {
+        return STATUS_SUCCESS;
+    }
+
+    if (Charge > Node->ChargedSize) {
+        if ((Volume->Size + (Charge - Node->ChargedSize)) > Volume->SizeLimit) {
+            return STATUS_VOLUME_FULL;
+        }
+    }
+
+    Volume->Size = Volume->Size - Node->ChargedSize + Charge;
+    Node->ChargedSize = Charge;
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+TmpFspCreateNode (
+    PTMPFS_VOLUME Volume,
+    PFILE_PROPERTIES Properties,
+    PTMPFS_NODE *NewNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new file and gives it a file ID. The volume lock
+    must be held exclusively, unless the volume is being created.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Properties - Supplies a pointer to the initial properties of the file.
+
+    NewNode - Supplies a pointer where a pointer to the new file will be
+        returned on success.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_VOLUME_FULL if the volume already holds as many files as allowed.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+--*/
+
+{
+
+    ULONG BucketIndex;
+    UINTN BucketsSize;
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+
+    *NewNode = NULL;
+    if (Volume->NodeCount >= Volume->NodeLimit) {
+        return STATUS_VOLUME_FULL;
+    }
+
+    Node = MmAllocatePagedPool(sizeof(TMPFS_NODE), TMPFS_ALLOCATION_TAG);
+    if (Node == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateNodeEnd;
+    }
+
+    RtlZeroMemory(Node, sizeof(TMPFS_NODE));
+    INITIALIZE_LIST_HEAD(&(Node->BackingRegionList));
+    RtlCopyMemory(&(Node->Properties), Properties, sizeof(FILE_PROPERTIES));
+    Node->Properties.Size = 0;
+    Node->Properties.BlockSize = MmPageSize();
+    Node->Properties.BlockCount = 0;
+    switch (Properties->Type) {
+    case IoObjectRegularDirectory:
+        BucketsSize = TMPFS_INITIAL_BUCKET_COUNT * sizeof(LIST_ENTRY);
+        Node->Buckets = MmAllocatePagedPool(BucketsSize, TMPFS_ALLOCATION_TAG);
+        if (Node->Buckets == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto CreateNodeEnd;
+        }
+
+        Node->BucketCount = TMPFS_INITIAL_BUCKET_COUNT;
+        for (BucketIndex = 0;
+             BucketIndex < Node->BucketCount;
+             BucketIndex += 1) {
+
+            INITIALIZE_LIST_HEAD(&(Node->Buckets[BucketIndex]));
+        }
+
+        RtlRedBlackTreeInitialize(&(Node->EntryTree), 0, TmpFspCompareEntries);
+        Node->NextOffset = DIRECTORY_CONTENTS_OFFSET;
+        break;
+
+    case IoObjectRegularFile:
+    case IoObjectSymbolicLink:
+        Node->DataLock = KeCreateSharedExclusiveLock();
+        if (Node->DataLock == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto CreateNodeEnd;
+        }
+
+        break;
+
+    default:
+        break;
+    }
+
+    Node->Properties.FileId = Volume->NextFileId;
+    Volume->NextFileId += 1;
+    RtlRedBlackTreeInsert(&(Volume->NodeTree), &(Node->TreeNode));
+    Volume->NodeCount += 1;
+    Status = STATUS_SUCCESS;
+
+CreateNodeEnd:
+    if (!KSUCCESS(Status)) {
+        if (Node != NULL) {
+            if (Node->Buckets != NULL) {
+                MmFreePagedPool(Node->Buckets);
+            }
+
+            MmFreePagedPool(Node);
+            Node = NULL;
+        }
+    }
+
+    *NewNode = Node;
+    return Status;
+}
+
+VOID
+TmpFspDestroyNode (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a file along with the page file space holding its
+    data. The volume lock must be held exclusively, unless the volume is being
+    destroyed.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Node - Supplies a pointer to the file. It must no longer be linked into
+        any directory, and a directory must be empty.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_BACKING_REGION Region;
+
+    ASSERT(Node->Entry == NULL);
+    ASSERT(Node->EntryCount == 0);
+
+    RtlRedBlackTreeRemove(&(Volume->NodeTree), &(Node->TreeNode));
+    Volume->NodeCount -= 1;
+    Volume->Size -= Node->ChargedSize;
+    while (LIST_EMPTY(&(Node->BackingRegionList)) == FALSE) {
+        Region = LIST_VALUE(Node->BackingRegionList.Next,
+                            TMPFS_BACKING_REGION,
+                            ListEntry);
+
+        LIST_REMOVE(&(Region->ListEntry));
+        Region->ListEntry.Next = NULL;
+        TmpFspDestroyBackingRegion(Region);
+    }
+
+    if (Node->DataLock != NULL) {
+        KeDestroySharedExclusiveLock(Node->DataLock);
+    }
+
+    if (Node->Buckets != NULL) {
+        MmFreePagedPool(Node->Buckets);
+    }
+
+    MmFreePagedPool(Node);
+    return;
+}
+
+PTMPFS_NODE
+TmpFspGetNode (
+    PTMPFS_VOLUME Volume,
+    FILE_ID FileId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds a file by its ID. The volume lock must be held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    FileId - Supplies the ID of the file to find.
+
+Return Value:
+
+    Returns a pointer to the file, or NULL if there is no such file.
+
+--*/
+
+{
+
+    PRED_BLACK_TREE_NODE FoundNode;
+    TMPFS_NODE Search;
+
+    Search.Properties.FileId = FileId;
+    FoundNode = RtlRedBlackTreeSearch(&(Volume->NodeTree),
+                                      &(Search.TreeNode));
+
+    if (FoundNode == NULL) {
+        return NULL;
+    }
+
+    return RED_BLACK_TREE_VALUE(FoundNode, TMPFS_NODE, TreeNode);
+}
+
+PTMPFS_ENTRY
+TmpFspCreateEntry (
+    PCSTR Name,
+    ULONG NameSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a directory entry for the given name.
+
+Arguments:
+
+    Name - Supplies a pointer to the name, which may not be null terminated.
+
+    NameSize - Supplies the size of the name buffer including space for a null
+        terminator.
+
+Return Value:
+
+    Returns a pointer to the new entry, or NULL on allocation failure.
+
+--*/
+
+{
+
+    PTMPFS_ENTRY Entry;
+    ULONG NameLength;
+
+    NameLength = TmpFspMeasureName(Name, NameSize);
+    Entry = MmAllocatePagedPool(sizeof(TMPFS_ENTRY) + NameLength + 1,
+                                TMPFS_ALLOCATION_TAG);
+
+    if (Entry == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(Entry, sizeof(TMPFS_ENTRY));
+    Entry->Name = (PSTR)(Entry + 1);
+    RtlCopyMemory(Entry->Name, Name, NameLength);
+    Entry->Name[NameLength] = '\0';
+    Entry->NameLength = NameLength;
+    Entry->Hash = RtlComputeCrc32(0, Name, NameLength);
+    return Entry;
+}
+
+VOID
+TmpFspDestroyEntry (
+    PTMPFS_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a directory entry that is not in any directory.
+
+Arguments:
+
+    Entry - Supplies a pointer to the entry.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Entry->Directory == NULL);
+
+    MmFreePagedPool(Entry);
+    return;
+}
+
+PTMPFS_ENTRY
+TmpFspFindEntry (
+    PTMPFS_NODE Directory,
+    PCSTR Name,
+    ULONG NameSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up a name in a directory's hash table. The volume lock
+    must be held.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory to search.
+
+    Name - Supplies a pointer to the name, which may not be null terminated.
+
+    NameSize - Supplies the size of the name buffer including space for a null
+        terminator.
+
+Return Value:
+
+    Returns a pointer to the matching entry, or NULL if there is none.
+
+--*/
+
+{
+
+    PLIST_ENTRY Bucket;
+    PLIST_ENTRY CurrentEntry;
+    PTMPFS_ENTRY Entry;
+    ULONG Hash;
+    ULONG NameLength;
+
+    ASSERT(Directory->Properties.Type == IoObjectRegularDirectory);
+
+    NameLength = TmpFspMeasureName(Name, NameSize);
+    Hash = RtlComputeCrc32(0, Name, NameLength);
+    Bucket = &(Directory->Buckets[Hash & (Directory->BucketCount - 1)]);
+    CurrentEntry = Bucket->Next;
+    while (CurrentEntry != Bucket) {
+        Entry = LIST_VALUE(CurrentEntry, TMPFS_ENTRY, ListEntry);
+        if ((Entry->Hash == Hash) &&
+            (Entry->NameLength == NameLength) &&
+            (RtlCompareMemory(Entry->Name, Name, NameLength) != FALSE)) {
+
+            return Entry;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    return NULL;
+}
+
+VOID
+TmpFspInsertEntry (
+    PTMPFS_NODE Directory,
+    PTMPFS_ENTRY Entry,
+    PTMPFS_NODE Node
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds an entry naming the given file to a directory. The
+    volume lock must be held exclusively.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory.
+
+    Entry - Supplies a pointer to the entry, which is not in any directory.
+
+    Node - Supplies a pointer to the file the entry names.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY Bucket;
+
+    ASSERT(Entry->Directory == NULL);
+    ASSERT(Node->Entry == NULL);
+
+    if (Directory->EntryCount >=
+        (Directory->BucketCount * TMPFS_MAX_LOAD_FACTOR)) {
+
+        TmpFspGrowDirectory(Directory);
+    }
+
+    Entry->Directory = Directory;
+    Entry->Node = Node;
+    Entry->Offset = Directory->NextOffset;
+    Directory->NextOffset += 1;
+    Bucket = &(Directory->Buckets[Entry->Hash & (Directory->BucketCount - 1)]);
+    INSERT_BEFORE(&(Entry->ListEntry), Bucket);
+    RtlRedBlackTreeInsert(&(Directory->EntryTree), &(Entry->TreeNode));
+    Directory->EntryCount += 1;
+    Node->Entry = Entry;
+    return;
+}
+
+VOID
+TmpFspRemoveEntry (
+    PTMPFS_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes an entry from its directory, leaving the file it
+    named without a name. The volume lock must be held exclusively.
+
+Arguments:
+
+    Entry - Supplies a pointer to the entry.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_NODE Directory;
+
+    Directory = Entry->Directory;
+
+    ASSERT(Directory->EntryCount != 0);
+    ASSERT(Entry->Node->Entry == Entry);
+
+    LIST_REMOVE(&(Entry->ListEntry));
+    RtlRedBlackTreeRemove(&(Directory->EntryTree), &(Entry->TreeNode));
+    Directory->EntryCount -= 1;
+    Entry->Node->Entry = NULL;
+    Entry->Directory = NULL;
+    Entry->Node = NULL;
+    return;
+}
+
+VOID
+TmpFspGrowDirectory (
+    PTMPFS_NODE Directory
+    )
+
+/*++
+
+Routine Description:
+
+    This routine doubles the size of a directory's hash table. If the
+    allocation fails the directory simply keeps its longer chains.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG BucketCount;
+    ULONG BucketIndex;
+    PLIST_ENTRY Buckets;
+    PTMPFS_ENTRY Entry;
+    PLIST_ENTRY OldBucket;
+
+    BucketCount = Directory->BucketCount * 2;
+    Buckets = MmAllocatePagedPool(BucketCount * sizeof(LIST_ENTRY),
+                                  TMPFS_ALLOCATION_TAG);
+
+    if (Buckets == NULL) {
+        return;
+    }
+
+    for (BucketIndex = 0; BucketIndex < BucketCount; BucketIndex += 1) {
+        INITIALIZE_LIST_HEAD(&(Buckets[BucketIndex]));
+    }
+
+    for (BucketIndex = 0;
+         BucketIndex < Directory->BucketCount;
+         BucketIndex += 1) {
+
+        OldBucket = &(Directory->Buckets[BucketIndex]);
+        while (LIST_EMPTY(OldBucket) == FALSE) {
+            Entry = LIST_VALUE(OldBucket->Next, TMPFS_ENTRY, ListEntry);
+            LIST_REMOVE(&(Entry->ListEntry));
+            INSERT_BEFORE(&(Entry->ListEntry),
+                          &(Buckets[Entry->Hash & (BucketCount - 1)]));
+        }
+    }
+
+    MmFreePagedPool(Directory->Buckets);
+    Directory->Buckets = Buckets;
+    Directory->BucketCount = BucketCount;
+    return;
+}
+
+ULONG
+TmpFspMeasureName (
+    PCSTR Name,
+    ULONG NameSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines the length of a name that may not be null
+    terminated.
+
+Arguments:
+
+    Name - Supplies a pointer to the name.
+
+    NameSize - Supplies the size of the name buffer including space for a null
+        terminator, which may be a garbage character.
+
+Return Value:
+
+    Returns the length of the name, not including a terminator.
+
+--*/
+
+{
+
+    ULONG Length;
+
+    ASSERT(NameSize != 0);
+
+    Length = 0;
+    while ((Length < NameSize - 1) && (Name[Length] != '\0')) {
+        Length += 1;
+    }
+
+    return Length;
+}
+
+PTMPFS_BACKING_REGION
+TmpFspCreateBackingRegion (
+    PTMPFS_NODE Node,
+    IO_OFFSET Offset,
+    PTMPFS_BACKING_REGION NextRegion
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates page file space to hold a file's data at the given
+    offset. The region is inserted before the given next region. The file's
+    data lock must be held exclusively.
+
+Arguments:
+
+    Node - Supplies a pointer to the file.
+
+    Offset - Supplies the file offset that needs backing.
+
+    NextRegion - Supplies a pointer to the region before which the new region
+        goes, or NULL to put it at the end of the list.
+
+Return Value:
+
+    Returns a pointer to the new region, or NULL if no page file space is
+    available.
+
+--*/
+
+{
+
+    PTMPFS_BACKING_REGION NewRegion;
+    ULONG PageSize;
+    IO_OFFSET PreviousEnd;
+    PTMPFS_BACKING_REGION PreviousRegion;
+    IO_OFFSET RegionEnd;
+    PLIST_ENTRY RegionList;
+    IO_OFFSET RegionOffset;
+    UINTN RegionSize;
+    ULONG RetryCount;
+    KSTATUS Status;
+
+    ASSERT(KeIsSharedExclusiveLockHeldExclusive(Node->DataLock) != FALSE);
+
+    NewRegion = MmAllocatePagedPool(sizeof(TMPFS_BACKING_REGION),
+                                    TMPFS_ALLOCATION_TAG);
+
+    if (NewRegion == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(NewRegion, sizeof(TMPFS_BACKING_REGION));
+    NewRegion->ImageBacking.DeviceHandle = INVALID_HANDLE;
+    RegionList = &(Node->BackingRegionList);
+    PreviousRegion = NULL;
+    if (NextRegion == NULL) {
+        if (LIST_EMPTY(RegionList) == FALSE) {
+            PreviousRegion = LIST_VALUE(RegionList->Previous,
+                                        TMPFS_BACKING_REGION,
+                                        ListEntry);
+        }
+
+    } else if (NextRegion->ListEntry.Previous != RegionList) {
+        PreviousRegion = LIST_VALUE(NextRegion->ListEntry.Previous,
+                                    TMPFS_BACKING_REGION,
+                                    ListEntry);
+    }
+
+    //
+    // Try for the largest region that fits between the neighbors, shrinking
+    // it if page file space is tight.
+    //
+
+    RetryCount = 0;
+    RegionSize = TMPFS_MAX_BACKING_REGION_SIZE;
+    PageSize = MmPageSize();
+    Status = STATUS_INSUFFICIENT_RESOURCES;
+    while (RegionSize >= PageSize) {
+        RegionOffset = ALIGN_RANGE_DOWN(Offset, RegionSize);
+        if (PreviousRegion != NULL) {
+            PreviousEnd = PreviousRegion->Offset + PreviousRegion->Size;
+            if (PreviousEnd > RegionOffset) {
+                RegionSize -= (PreviousEnd - RegionOffset);
+                RegionOffset = PreviousEnd;
+            }
+        }
+
+        if (NextRegion != NULL) {
+            RegionEnd = RegionOffset + RegionSize;
+            if (NextRegion->Offset < RegionEnd) {
+                RegionSize -= (RegionEnd - NextRegion->Offset);
+            }
+        }
+
+        ASSERT(RegionSize >= PageSize);
+
+        Status = MmAllocatePageFileSpace(&(NewRegion->ImageBacking),
+                                         RegionSize);
+
+        if ((KSUCCESS(Status)) || (Status != STATUS_INSUFFICIENT_RESOURCES)) {
+            break;
+        }
+
+        RetryCount += 1;
+        RegionSize = TMPFS_MAX_BACKING_REGION_SIZE >> RetryCount;
+    }
+
+    if (!KSUCCESS(Status)) {
+        MmFreePagedPool(NewRegion);
+        return NULL;
+    }
+
+    NewRegion->Offset = RegionOffset;
+    NewRegion->Size = RegionSize;
+    if (NextRegion != NULL) {
+        INSERT_BEFORE(&(NewRegion->ListEntry), &(NextRegion->ListEntry));
+
+    } else {
+        INSERT_BEFORE(&(NewRegion->ListEntry), RegionList);
+    }
+
+    return NewRegion;
+}
+
+VOID
+TmpFspDestroyBackingRegion (
+    PTMPFS_BACKING_REGION Region
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a backing region and its page file space.
+
+Arguments:
+
+    Region - Supplies a pointer to the region, which is not on any list.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Region->ListEntry.Next == NULL);
+
+    MmFreePageFileSpace(&(Region->ImageBacking), Region->Size);
+    MmFreePagedPool(Region);
+    return;
+}
+
+VOID
+TmpFspTruncateBackingRegions (
+    PTMPFS_NODE Node,
+    ULONGLONG NewSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases the page file space holding data beyond the new end
+    of a file.
+
+Arguments:
+
+    Node - Supplies a pointer to the file.
+
+    NewSize - Supplies the new file size.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    ULONG PageCount;
+    PTMPFS_BACKING_REGION Region;
+    ULONG RegionSize;
+
+    KeAcquireSharedExclusiveLockExclusive(Node->DataLock);
+    CurrentEntry = Node->BackingRegionList.Next;
+    while (CurrentEntry != &(Node->BackingRegionList)) {
+        Region = LIST_VALUE(CurrentEntry, TMPFS_BACKING_REGION, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (Region->Offset >= NewSize) {
+            LIST_REMOVE(&(Region->ListEntry));
+            Region->ListEntry.Next = NULL;
+            TmpFspDestroyBackingRegion(Region);
+
+        //
+        // Keep a region straddling the end in case the file grows again, but
+        // forget the pages past the end so they read back as zeros.
+        //
+
+        } else if ((Region->Offset + Region->Size) > NewSize) {
+            RegionSize = (ULONG)(NewSize - Region->Offset);
+            RegionSize = ALIGN_RANGE_UP(RegionSize, MmPageSize());
+            PageCount = RegionSize >> MmPageShift();
+            Region->DirtyBitmap &= TMPFS_PAGE_MASK(PageCount);
+        }
+    }
+
+    KeReleaseSharedExclusiveLockExclusive(Node->DataLock);
+    return;
+}
+
+COMPARISON_RESULT
+TmpFspCompareNodes (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two files by file ID.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PTMPFS_NODE First;
+    PTMPFS_NODE Second;
+
+    First = RED_BLACK_TREE_VALUE(FirstNode, TMPFS_NODE, TreeNode);
+    Second = RED_BLACK_TREE_VALUE(SecondNode, TMPFS_NODE, TreeNode);
+    if (First->Properties.FileId < Second->Properties.FileId) {
+        return ComparisonResultAscending;
+
+    } else if (First->Properties.FileId > Second->Properties.FileId) {
+        return ComparisonResultDescending;
+    }
+
+    return ComparisonResultSame;
+}
+
+COMPARISON_RESULT
+TmpFspCompareEntries (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two directory entries by offset.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PTMPFS_ENTRY First;
+    PTMPFS_ENTRY Second;
+
+    First = RED_BLACK_TREE_VALUE(FirstNode, TMPFS_ENTRY, TreeNode);
+    Second = RED_BLACK_TREE_VALUE(SecondNode, TMPFS_ENTRY, TreeNode);
+    if (First->Offset < Second->Offset) {
+        return ComparisonResultAscending;
+
+    } else if (First->Offset > Second->Offset) {
+        return ComparisonResultDescending;
+    }
+
+    return ComparisonResultSame;
+}
+
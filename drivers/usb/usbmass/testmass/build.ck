@@ -0,0 +1,61 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    USB Mass Storage Test
+
+Abstract:
+
+    This program compiles the USB mass storage driver into a user mode
+    application against a fake Bulk-Only Transport device for the purposes
+    of testing its I/O queue and error recovery.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Test
+
+--*/
+
+from menv import application;
+
+function build() {
+    var buildApp;
+    var buildLibs;
+    var entries;
+    var sources;
+
+    sources = [
+        "stubs.c",
+        "fakebot.c",
+        "testmass.c",
+        "../usbmass.c"
+    ];
+
+    buildLibs = [
+        "lib/rtl/urtl:build_rtlc",
+        "lib/rtl/base:build_basertl"
+    ];
+
+    buildApp = {
+        "label": "build_testmass",
+        "output": "testmass",
+        "inputs": sources + buildLibs,
+        "build": true,
+        "prefix": "build"
+    };
+
+    entries = application(buildApp);
+    return entries;
+}
+
@@ -0,0 +1,829 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    fakebot.c
+
+Abstract:
+
+    This module implements a fake USB mass storage device speaking the
+    Bulk-Only Transport protocol. It stands in for the USB core's transfer
+    routines, performing each transfer the driver submits when the test asks
+    it to, and checking that the driver follows the protocol.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Test
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include <minoca/intrface/disk.h>
+#include <minoca/usb/usb.h>
+#include "../usbmass.h"
+#include "testmass.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _TEST_BOT_PHASE {
+    TestBotPhaseCommand,
+    TestBotPhaseDataIn,
+    TestBotPhaseDataOut,
+    TestBotPhaseStatus,
+    TestBotPhaseResetRequired
+} TEST_BOT_PHASE, *PTEST_BOT_PHASE;
+
+/*++
+
+Structure Description:
+
+    This structure defines a transfer allocated from the fake device.
+
+Members:
+
+    Transfer - Stores the USB transfer handed to the driver.
+
+    Endpoint - Stores the endpoint number the transfer was allocated for.
+
+--*/
+
+typedef struct _TEST_BOT_TRANSFER {
+    USB_TRANSFER Transfer;
+    UCHAR Endpoint;
+} TEST_BOT_TRANSFER, *PTEST_BOT_TRANSFER;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+TestBotProtocolError (
+    PCSTR Message
+    );
+
+VOID
+TestBotReceiveCommand (
+    PUSB_TRANSFER Transfer
+    );
+
+VOID
+TestBotSendStatus (
+    PUSB_TRANSFER Transfer
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+TEST_BOT_STATE TestBot;
+
+//
+// Store the stage of the Bulk-Only Transport protocol the device is in.
+//
+
+TEST_BOT_PHASE TestBotPhase;
+
+//
+// Store the command block wrapper of the command in progress.
+//
+
+SCSI_COMMAND_BLOCK TestBotCommandBlock;
+
+//
+// Store the transfer the host has submitted, which the device has not yet
+// performed.
+//
+
+PTEST_BOT_TRANSFER TestBotSubmitted;
+
+//
+// Store whether each bulk endpoint is halted, indexed by direction.
+//
+
+BOOL TestBotHalted[UsbTransferBidirectional];
+
+//
+// Store the storage for each logical unit.
+//
+
+ULONG TestBotLunCount;
+PUCHAR TestBotStorage[TEST_BOT_MAX_LUNS];
+
+//
+// Store the fault to inject, the number of commands to let through before
+// injecting it, and the number of commands to inject it into.
+//
+
+TEST_BOT_FAULT TestBotFault;
+ULONG TestBotFaultDelay;
+ULONG TestBotFaultCount;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+VOID
+TestBotInitialize (
+    ULONG LunCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets the fake device, clearing its logical units, its
+    command log, and any faults waiting to be injected.
+
+Arguments:
+
+    LunCount - Supplies the number of logical units the device has.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Lun;
+
+    ASSERT((LunCount != 0) && (LunCount <= TEST_BOT_MAX_LUNS));
+    ASSERT(TestBotSubmitted == NULL);
+
+    for (Lun = 0; Lun < TEST_BOT_MAX_LUNS; Lun += 1) {
+        free(TestBotStorage[Lun]);
+        TestBotStorage[Lun] = NULL;
+        if (Lun < LunCount) {
+            TestBotStorage[Lun] = calloc(TEST_BOT_BLOCK_COUNT,
+                                         TEST_BOT_BLOCK_SIZE);
+
+            ASSERT(TestBotStorage[Lun] != NULL);
+        }
+    }
+
+    memset(&TestBot, 0, sizeof(TEST_BOT_STATE));
+    TestBotLunCount = LunCount;
+    TestBotPhase = TestBotPhaseCommand;
+    TestBotHalted[UsbTransferDirectionIn] = FALSE;
+    TestBotHalted[UsbTransferDirectionOut] = FALSE;
+    TestBotFault = TestBotFaultNone;
+    TestBotFaultDelay = 0;
+    TestBotFaultCount = 0;
+    return;
+}
+
+VOID
+TestBotInjectFault (
+    TEST_BOT_FAULT Fault,
+    ULONG Delay,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine arranges for the fake device to break the status stage of
+    upcoming commands.
+
+Arguments:
+
+    Fault - Supplies the fault to inject.
+
+    Delay - Supplies the number of commands to let through before the first
+        fault.
+
+    Count - Supplies the number of consecutive commands to fault.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    TestBotFault = Fault;
+    TestBotFaultDelay = Delay;
+    TestBotFaultCount = Count;
+    return;
+}
+
+BOOL
+TestBotCompleteTransfer (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the transfer the host has submitted to the fake
+    device, and calls its completion routine.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    TRUE if a transfer was completed.
+
+    FALSE if the host had no transfer submitted.
+
+--*/
+
+{
+
+    PUCHAR Data;
+    PTEST_BOT_COMMAND LastCommand;
+    PUSB_TRANSFER Transfer;
+
+    if (TestBotSubmitted == NULL) {
+        return FALSE;
+    }
+
+    Transfer = &(TestBotSubmitted->Transfer);
+    TestBotSubmitted = NULL;
+    Transfer->Status = STATUS_SUCCESS;
+    Transfer->Error = UsbErrorNone;
+    Transfer->LengthTransferred = Transfer->Length;
+    switch (TestBotPhase) {
+    case TestBotPhaseCommand:
+        TestBotReceiveCommand(Transfer);
+        break;
+
+    case TestBotPhaseDataIn:
+    case TestBotPhaseDataOut:
+        LastCommand = &(TestBot.Commands[TestBot.CommandCount - 1]);
+        Data = TestBotGetBlock(LastCommand->Lun, LastCommand->Block);
+        if (TestBotPhase == TestBotPhaseDataIn) {
+            memcpy(Transfer->Buffer, Data, Transfer->Length);
+
+        } else {
+            memcpy(Data, Transfer->Buffer, Transfer->Length);
+        }
+
+        TestBotPhase = TestBotPhaseStatus;
+        break;
+
+    case TestBotPhaseStatus:
+        TestBotSendStatus(Transfer);
+        break;
+
+    default:
+
+        ASSERT(FALSE);
+
+        break;
+    }
+
+    Transfer->CallbackRoutine(Transfer);
+    return TRUE;
+}
+
+PUCHAR
+TestBotGetBlock (
+    ULONG Lun,
+    ULONG Block
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the fake device's storage for a block.
+
+Arguments:
+
+    Lun - Supplies the logical unit.
+
+    Block - Supplies the logical block address.
+
+Return Value:
+
+    Returns a pointer to the block's data.
+
+--*/
+
+{
+
+    ASSERT((Lun < TestBotLunCount) && (Block < TEST_BOT_BLOCK_COUNT));
+
+    return TestBotStorage[Lun] + (Block * TEST_BOT_BLOCK_SIZE);
+}
+
+USB_API
+PUSB_TRANSFER
+UsbAllocateTransfer (
+    HANDLE UsbDeviceHandle,
+    UCHAR EndpointNumber,
+    ULONG MaxTransferSize,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a new USB transfer structure. This routine must be
+    used to allocate transfers.
+
+Arguments:
+
+    UsbDeviceHandle - Supplies a handle to the USB device the transfer will be
+        sent to.
+
+    EndpointNumber - Supplies the endpoint number that the transfer will go to.
+
+    MaxTransferSize - Supplies the maximum length, in bytes, of the transfer.
+
+    Flags - Supplies a bitfield of flags regarding the transaction. See
+        USB_TRANSFER_FLAG_* definitions.
+
+Return Value:
+
+    Returns a pointer to the new USB transfer on success.
+
+    NULL when there are insufficient resources to complete the request.
+
+--*/
+
+{
+
+    PTEST_BOT_TRANSFER BotTransfer;
+
+    BotTransfer = calloc(1, sizeof(TEST_BOT_TRANSFER));
+    if (BotTransfer == NULL) {
+        return NULL;
+    }
+
+    BotTransfer->Endpoint = EndpointNumber;
+    return &(BotTransfer->Transfer);
+}
+
+USB_API
+VOID
+UsbDestroyTransfer (
+    PUSB_TRANSFER Transfer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys an allocated transfer. This transfer must not be
+    actively transferring.
+
+Arguments:
+
+    Transfer - Supplies a pointer to the transfer to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTEST_BOT_TRANSFER BotTransfer;
+
+    BotTransfer = PARENT_STRUCTURE(Transfer, TEST_BOT_TRANSFER, Transfer);
+
+    ASSERT(BotTransfer != TestBotSubmitted);
+
+    free(BotTransfer);
+    return;
+}
+
+USB_API
+KSTATUS
+UsbSubmitTransfer (
+    PUSB_TRANSFER Transfer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine submits a USB transfer. The routine returns immediately,
+    indicating only whether the transfer was submitted successfully. When the
+    transfer actually completes, the callback routine will be called. The fake
+    device checks that the transfer is the one the protocol calls for next.
+
+Arguments:
+
+    Transfer - Supplies a pointer to the transfer to submit.
+
+Return Value:
+
+    STATUS_SUCCESS if the transfer was submitted to the USB host controller's
+    queue.
+
+    STATUS_RESOURCE_IN_USE if another transfer is already submitted.
+
+    STATUS_INVALID_PARAMETER if the transfer breaks the protocol.
+
+--*/
+
+{
+
+    PTEST_BOT_TRANSFER BotTransfer;
+    USB_TRANSFER_DIRECTION Direction;
+    UCHAR Endpoint;
+    ULONG Length;
+
+    BotTransfer = PARENT_STRUCTURE(Transfer, TEST_BOT_TRANSFER, Transfer);
+    if (TestBotSubmitted != NULL) {
+        TestBotProtocolError("Transfer submitted while another is in flight");
+        return STATUS_RESOURCE_IN_USE;
+    }
+
+    Direction = UsbTransferDirectionIn;
+    Endpoint = TEST_BOT_IN_ENDPOINT;
+    Length = TestBotCommandBlock.DataTransferLength;
+    switch (TestBotPhase) {
+    case TestBotPhaseCommand:
+        if ((TestBotHalted[UsbTransferDirectionIn] != FALSE) ||
+            (TestBotHalted[UsbTransferDirectionOut] != FALSE)) {
+
+            TestBotProtocolError("Command sent before the halts were cleared");
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        Direction = UsbTransferDirectionOut;
+        Endpoint = TEST_BOT_OUT_ENDPOINT;
+        Length = sizeof(SCSI_COMMAND_BLOCK);
+        break;
+
+    case TestBotPhaseDataOut:
+        Direction = UsbTransferDirectionOut;
+        Endpoint = TEST_BOT_OUT_ENDPOINT;
+        break;
+
+    case TestBotPhaseDataIn:
+        break;
+
+    case TestBotPhaseStatus:
+        Length = sizeof(SCSI_COMMAND_STATUS);
+        break;
+
+    default:
+        TestBotProtocolError("Transfer sent before reset recovery");
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if ((BotTransfer->Endpoint != Endpoint) ||
+        (Transfer->Direction != Direction) ||
+        (Transfer->Length != Length)) {
+
+        printf("Phase %d expected endpoint 0x%x length 0x%x, got 0x%x "
+               "length 0x%x.\n",
+               TestBotPhase,
+               Endpoint,
+               Length,
+               BotTransfer->Endpoint,
+               Transfer->Length);
+
+        TestBotProtocolError("Transfer does not match the protocol phase");
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    TestBotSubmitted = BotTransfer;
+    return STATUS_SUCCESS;
+}
+
+USB_API
+KSTATUS
+UsbSendControlTransfer (
+    HANDLE UsbDeviceHandle,
+    USB_TRANSFER_DIRECTION TransferDirection,
+    PUSB_SETUP_PACKET SetupPacket,
+    PVOID Buffer,
+    ULONG BufferLength,
+    PULONG LengthTransferred
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends a synchronous control transfer to the given USB device.
+    The fake device only understands the bulk-only mass storage reset, which
+    leaves both bulk endpoints halted until the host clears them.
+
+Arguments:
+
+    UsbDeviceHandle - Supplies the handle returned when the device was opened.
+
+    TransferDirection - Supplies the direction of the transfer.
+
+    SetupPacket - Supplies a pointer to the setup packet.
+
+    Buffer - Supplies a pointer to the buffer to be sent or received. This does
+        not include the setup packet, this is the optional data portion only.
+
+    BufferLength - Supplies the length of the buffer, not including the setup
+        packet.
+
+    LengthTransferred - Supplies a pointer where the number of bytes that were
+        actually transfered (not including the setup packet) will be returned.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UCHAR RequestType;
+
+    RequestType = USB_SETUP_REQUEST_TO_DEVICE |
+                  USB_SETUP_REQUEST_CLASS |
+                  USB_SETUP_REQUEST_INTERFACE_RECIPIENT;
+
+    if ((TransferDirection != UsbTransferDirectionOut) ||
+        (SetupPacket->RequestType != RequestType) ||
+        (SetupPacket->Request != USB_MASS_REQUEST_RESET_DEVICE) ||
+        (SetupPacket->Index != TEST_BOT_INTERFACE) ||
+        (SetupPacket->Length != 0) ||
+        (BufferLength != 0)) {
+
+        TestBotProtocolError("Unexpected control transfer");
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    if (TestBotSubmitted != NULL) {
+        TestBotProtocolError("Reset sent with a bulk transfer in flight");
+        TestBotSubmitted = NULL;
+    }
+
+    TestBot.ResetCount += 1;
+    TestBotPhase = TestBotPhaseCommand;
+    TestBotHalted[UsbTransferDirectionIn] = TRUE;
+    TestBotHalted[UsbTransferDirectionOut] = TRUE;
+    if (LengthTransferred != NULL) {
+        *LengthTransferred = 0;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+USB_API
+KSTATUS
+UsbClearFeature (
+    HANDLE UsbDeviceHandle,
+    UCHAR RequestType,
+    USHORT FeatureSelector,
+    USHORT Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine clears a feature on the device. The fake device only
+    understands clearing the halt on its bulk endpoints.
+
+Arguments:
+
+    UsbDeviceHandle - Supplies the handle returned when the device was opened.
+
+    RequestType - Supplies the type of feature to clear (device, interface,
+        or endpoint).
+
+    FeatureSelector - Supplies the feature to clear.
+
+    Index - Supplies the index of the endpoint or interface to clear.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    USB_TRANSFER_DIRECTION Direction;
+
+    if ((RequestType != USB_SETUP_REQUEST_ENDPOINT_RECIPIENT) ||
+        (FeatureSelector != USB_FEATURE_ENDPOINT_HALT)) {
+
+        TestBotProtocolError("Unexpected clear feature");
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    if (Index == TEST_BOT_IN_ENDPOINT) {
+        Direction = UsbTransferDirectionIn;
+
+    } else if (Index == TEST_BOT_OUT_ENDPOINT) {
+        Direction = UsbTransferDirectionOut;
+
+    } else {
+        TestBotProtocolError("Clear halt on an unknown endpoint");
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    TestBot.ClearHaltCount[Direction] += 1;
+    TestBotHalted[Direction] = FALSE;
+    return STATUS_SUCCESS;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+TestBotProtocolError (
+    PCSTR Message
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records that the host broke the Bulk-Only Transport
+    protocol.
+
+Arguments:
+
+    Message - Supplies a description of what went wrong.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    printf("Fake BOT device: %s.\n", Message);
+    TestBot.ProtocolErrors += 1;
+    return;
+}
+
+VOID
+TestBotReceiveCommand (
+    PUSB_TRANSFER Transfer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine receives a command block wrapper, logs the command, and
+    moves on to the data stage.
+
+Arguments:
+
+    Transfer - Supplies a pointer to the command transfer.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Block;
+    ULONG BlockCount;
+    PTEST_BOT_COMMAND Command;
+    PUCHAR CommandBytes;
+    UCHAR Flags;
+
+    memcpy(&TestBotCommandBlock, Transfer->Buffer, sizeof(SCSI_COMMAND_BLOCK));
+    CommandBytes = TestBotCommandBlock.Command;
+    Block = (CommandBytes[2] << 24) | (CommandBytes[3] << 16) |
+            (CommandBytes[4] << 8) | CommandBytes[5];
+
+    BlockCount = (CommandBytes[7] << 8) | CommandBytes[8];
+    Flags = 0;
+    if (CommandBytes[0] == SCSI_COMMAND_READ_10) {
+        Flags = SCSI_COMMAND_BLOCK_FLAG_DATA_IN;
+    }
+
+    if ((TestBotCommandBlock.Signature != SCSI_COMMAND_BLOCK_SIGNATURE) ||
+        (TestBotCommandBlock.LunNumber >= TestBotLunCount) ||
+        ((CommandBytes[0] != SCSI_COMMAND_READ_10) &&
+         (CommandBytes[0] != SCSI_COMMAND_WRITE_10)) ||
+        ((CommandBytes[1] >> SCSI_COMMAND_LUN_SHIFT) !=
+         TestBotCommandBlock.LunNumber) ||
+        (TestBotCommandBlock.Flags != Flags) ||
+        (BlockCount == 0) ||
+        (Block + BlockCount > TEST_BOT_BLOCK_COUNT) ||
+        (TestBotCommandBlock.DataTransferLength !=
+         BlockCount * TEST_BOT_BLOCK_SIZE) ||
+        (TestBot.CommandCount == TEST_BOT_MAX_COMMANDS)) {
+
+        TestBotProtocolError("Invalid command block wrapper");
+        TestBotPhase = TestBotPhaseResetRequired;
+        return;
+    }
+
+    Command = &(TestBot.Commands[TestBot.CommandCount]);
+    TestBot.CommandCount += 1;
+    Command->Lun = TestBotCommandBlock.LunNumber;
+    Command->Operation = CommandBytes[0];
+    Command->Block = Block;
+    Command->BlockCount = BlockCount;
+    Command->Fault = TestBotFaultNone;
+    if (TestBotFaultCount != 0) {
+        if (TestBotFaultDelay != 0) {
+            TestBotFaultDelay -= 1;
+
+        } else {
+            Command->Fault = TestBotFault;
+            TestBotFaultCount -= 1;
+        }
+    }
+
+    TestBotPhase = TestBotPhaseDataOut;
+    if (Flags == SCSI_COMMAND_BLOCK_FLAG_DATA_IN) {
+        TestBotPhase = TestBotPhaseDataIn;
+    }
+
+    return;
+}
+
+VOID
+TestBotSendStatus (
+    PUSB_TRANSFER Transfer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills out the command status wrapper for the command in
+    progress, injecting the command's fault if it has one. A faulted status
+    leaves the device waiting for reset recovery.
+
+Arguments:
+
+    Transfer - Supplies a pointer to the status transfer.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTEST_BOT_COMMAND Command;
+    PSCSI_COMMAND_STATUS CommandStatus;
+
+    Command = &(TestBot.Commands[TestBot.CommandCount - 1]);
+    CommandStatus = Transfer->Buffer;
+    CommandStatus->Signature = SCSI_COMMAND_STATUS_SIGNATURE;
+    CommandStatus->Tag = TestBotCommandBlock.Tag;
+    CommandStatus->DataResidue = 0;
+    CommandStatus->Status = SCSI_STATUS_SUCCESS;
+    TestBotPhase = TestBotPhaseCommand;
+    switch (Command->Fault) {
+    case TestBotFaultShortStatus:
+        Transfer->LengthTransferred = sizeof(SCSI_COMMAND_STATUS) - 1;
+        TestBotPhase = TestBotPhaseResetRequired;
+        break;
+
+    case TestBotFaultPhaseError:
+        CommandStatus->Status = SCSI_STATUS_PHASE_ERROR;
+        TestBotPhase = TestBotPhaseResetRequired;
+        break;
+
+    default:
+        break;
+    }
+
+    return;
+}
+
@@ -0,0 +1,1964 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    stubs.c
+
+Abstract:
+
+    This module implements stub routines so the USB mass storage driver can be
+    compiled in user-mode.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Test
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include <minoca/usb/usb.h>
+#include "testmass.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the fake physical address where I/O buffers allocated by the driver
+// start. Everything the USB host controller sees has to be below 4GB.
+//
+
+#define TEST_IO_BUFFER_PHYSICAL_BASE 0x10000000
+
+//
+// Define the page size I/O buffers allocated by the driver are aligned to,
+// both virtually and physically.
+//
+
+#define TEST_IO_BUFFER_PAGE_SIZE 0x1000
+
+//
+// Define the fake time counter frequency.
+//
+
+#define TEST_TIME_COUNTER_FREQUENCY 1000000ULL
+
+//
+// Define the fake data cache line size.
+//
+
+#define TEST_IO_BUFFER_ALIGNMENT 64
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines a kernel event in the single threaded test.
+
+Members:
+
+    Signaled - Stores a boolean indicating whether the event is signaled.
+
+--*/
+
+typedef struct _TEST_EVENT {
+    BOOL Signaled;
+} TEST_EVENT, *PTEST_EVENT;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+PVOID
+TestGetIoBufferAddress (
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    PUINTN Size
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store the current fake run level.
+//
+
+RUNLEVEL TestRunLevel = RunLevelLow;
+
+//
+// Store the fake time counter, which moves forward every time it is read.
+//
+
+ULONGLONG TestTimeCounter;
+
+//
+// Store the next fake physical address to hand out for an I/O buffer.
+//
+
+PHYSICAL_ADDRESS TestNextPhysicalAddress = TEST_IO_BUFFER_PHYSICAL_BASE;
+
+//
+// Store the number of device errors the driver reported.
+//
+
+ULONG TestDriverErrorCount;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+ULONGLONG
+HlQueryTimeCounterFrequency (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the frequency of the time counter.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the frequency of the time counter, in Hertz.
+
+--*/
+
+{
+
+    return TEST_TIME_COUNTER_FREQUENCY;
+}
+
+KSTATUS
+IoAttachDriverToDevice (
+    PDRIVER Driver,
+    PDEVICE Device,
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called by a driver to attach itself to a device. The test
+    drives the disk directly, so nothing attaches.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver attaching itself to the device.
+
+    Device - Supplies a pointer to the device to attach to.
+
+    Context - Supplies an optional context pointer that will be passed to the
+        driver each time it is called in relation to this device.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+KERNEL_API
+VOID
+IoUpdateIrpStatus (
+    PIRP Irp,
+    KSTATUS StatusCode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine updates the IRP's completion status if the current completion
+    status indicates success.
+
+Arguments:
+
+    Irp - Supplies a pointer to the IRP to query.
+
+    StatusCode - Supplies a status code to associate with the completed IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (KSUCCESS(Irp->Status)) {
+        Irp->Status = StatusCode;
+    }
+
+    return;
+}
+
+KERNEL_API
+VOID
+IoCompleteIrp (
+    PDRIVER Driver,
+    PIRP Irp,
+    KSTATUS StatusCode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called by a driver to mark an IRP as completed. Like the
+    real I/O manager, a pended IRP is not driven back up until the test pumps
+    it.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver completing the IRP.
+
+    Irp - Supplies a pointer to the IRP owned by the driver to mark as
+        completed.
+
+    StatusCode - Supplies a status code to associated with the completed IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTEST_MASS_IRP TestIrp;
+
+    ASSERT(TestRunLevel <= RunLevelDispatch);
+
+    TestIrp = PARENT_STRUCTURE(Irp, TEST_MASS_IRP, Irp);
+
+    ASSERT((TestIrp->Complete == FALSE) && (TestIrp->Finished == FALSE));
+
+    TestIrp->Complete = TRUE;
+    Irp->Direction = IrpUp;
+    Irp->Status = StatusCode;
+    return;
+}
+
+KERNEL_API
+VOID
+IoPendIrp (
+    PDRIVER Driver,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called by a driver to mark an IRP as pending.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver pending the IRP.
+
+    Irp - Supplies a pointer to the IRP owned by the driver to mark as pending.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTEST_MASS_IRP TestIrp;
+
+    ASSERT(TestRunLevel <= RunLevelDispatch);
+
+    TestIrp = PARENT_STRUCTURE(Irp, TEST_MASS_IRP, Irp);
+
+    ASSERT(TestIrp->Pending == FALSE);
+
+    TestIrp->Pending = TRUE;
+    TestIrp->Complete = FALSE;
+    return;
+}
+
+KSTATUS
+IoPrepareReadWriteIrp (
+    PIRP_READ_WRITE IrpReadWrite,
+    UINTN Alignment,
+    PHYSICAL_ADDRESS MinimumPhysicalAddress,
+    PHYSICAL_ADDRESS MaximumPhysicalAddress,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares the I/O buffer in the read/write IRP for DMA. The
+    test builds its I/O buffers ready for DMA, so there is nothing to do.
+
+Arguments:
+
+    IrpReadWrite - Supplies a pointer to the read/write context.
+
+    Alignment - Supplies the required physical alignment of the I/O buffer.
+
+    MinimumPhysicalAddress - Supplies the minimum physical address.
+
+    MaximumPhysicalAddress - Supplies the maximum physical address.
+
+    Flags - Supplies a bitmask of flags for the preparation.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    ASSERT(IrpReadWrite->IoBuffer != NULL);
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IoCompleteReadWriteIrp (
+    PIRP_READ_WRITE IrpReadWrite,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles read/write IRP completion.
+
+Arguments:
+
+    IrpReadWrite - Supplies a pointer to the read/write context.
+
+    Flags - Supplies a bitmask of flags for the completion.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IoCreateDevice (
+    PDRIVER BusDriver,
+    PVOID BusDriverContext,
+    PDEVICE ParentDevice,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PDEVICE *NewDevice
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new device in the system. The test creates its
+    disk without an OS device.
+
+Arguments:
+
+    BusDriver - Supplies a pointer to the driver reporting this device.
+
+    BusDriverContext - Supplies the context pointer that will be passed to the
+        bus driver when IRPs are sent to the device.
+
+    ParentDevice - Supplies a pointer to the device enumerating this device.
+
+    DeviceId - Supplies a pointer to a null terminated string identifying the
+        device.
+
+    ClassId - Supplies a pointer to a null terminated string identifying the
+        device class.
+
+    CompatibleIds - Supplies a semicolon-delimited list of device IDs that
+        this device is compatible with.
+
+    NewDevice - Supplies a pointer where the new device will be returned.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+KSTATUS
+IoCreateInterface (
+    PUUID InterfaceUuid,
+    PDEVICE Device,
+    PVOID InterfaceBuffer,
+    ULONG InterfaceBufferSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a device interface.
+
+Arguments:
+
+    InterfaceUuid - Supplies a pointer to the UUID identifying the interface.
+
+    Device - Supplies a pointer to the device exposing the interface.
+
+    InterfaceBuffer - Supplies a pointer to the interface buffer.
+
+    InterfaceBufferSize - Supplies the size of the interface buffer, in bytes.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+KSTATUS
+IoDestroyInterface (
+    PUUID InterfaceUuid,
+    PDEVICE Device,
+    PVOID InterfaceBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a previously created interface.
+
+Arguments:
+
+    InterfaceUuid - Supplies a pointer to the UUID identifying the interface.
+
+    Device - Supplies a pointer to the device that exposed the interface.
+
+    InterfaceBuffer - Supplies a pointer to the interface buffer.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+KSTATUS
+IoRegisterDriverFunctions (
+    PDRIVER Driver,
+    PDRIVER_FUNCTION_TABLE FunctionTable
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called by a driver to register its dispatch functions.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver.
+
+    FunctionTable - Supplies a pointer to the function table.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    return STATUS_SUCCESS;
+}
+
+KERNEL_API
+VOID
+IoSetDeviceDriverErrorEx (
+    PDEVICE Device,
+    KSTATUS Status,
+    PDRIVER Driver,
+    ULONG DriverCode,
+    PCSTR SourceFile,
+    ULONG LineNumber
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets a driver specific error code on a given device. This
+    problem is preventing a device from making forward progress. Avoid calling
+    this function directly, use the non-Ex version. The test counts
+    these, as the driver only reports errors it could not recover from.
+
+Arguments:
+
+    Device - Supplies a pointer to the device with the error.
+
+    Status - Supplies the failure status generated by the error.
+
+    Driver - Supplies a pointer to the driver reporting the error.
+
+    DriverError - Supplies an optional driver specific error code.
+
+    SourceFile - Supplies a pointer to the source file where the problem
+        occurred. This is usually automatically generated by the compiler.
+
+    LineNumber - Supplies the line number in the source file where the problem
+        occurred. This is usually automatically generated by the compiler.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    TestDriverErrorCount += 1;
+    return;
+}
+
+RUNLEVEL
+KeGetRunLevel (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the current run level of the fake processor.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the current run level.
+
+--*/
+
+{
+
+    return TestRunLevel;
+}
+
+RUNLEVEL
+KeRaiseRunLevel (
+    RUNLEVEL RunLevel
+    )
+
+/*++
+
+Routine Description:
+
+    This routine raises the fake processor's run level.
+
+Arguments:
+
+    RunLevel - Supplies the new run level, which must be at or above the
+        current run level.
+
+Return Value:
+
+    Returns the old run level.
+
+--*/
+
+{
+
+    RUNLEVEL OldRunLevel;
+
+    ASSERT(RunLevel >= TestRunLevel);
+
+    OldRunLevel = TestRunLevel;
+    TestRunLevel = RunLevel;
+    return OldRunLevel;
+}
+
+VOID
+KeLowerRunLevel (
+    RUNLEVEL RunLevel
+    )
+
+/*++
+
+Routine Description:
+
+    This routine lowers the fake processor's run level.
+
+Arguments:
+
+    RunLevel - Supplies the new run level, which must be at or below the
+        current run level.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(RunLevel <= TestRunLevel);
+
+    TestRunLevel = RunLevel;
+    return;
+}
+
+VOID
+KeInitializeSpinLock (
+    PKSPIN_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes a spinlock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to initialize.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Lock->LockHeld = 0;
+    Lock->OwningThread = NULL;
+    return;
+}
+
+VOID
+KeAcquireSpinLock (
+    PKSPIN_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine acquires a spinlock. The test is single threaded, so an
+    acquire of a held lock is a deadlock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to acquire.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(TestRunLevel >= RunLevelDispatch);
+    ASSERT(Lock->LockHeld == 0);
+
+    Lock->LockHeld = 1;
+    return;
+}
+
+VOID
+KeReleaseSpinLock (
+    PKSPIN_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a spinlock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Lock->LockHeld != 0);
+
+    Lock->LockHeld = 0;
+    return;
+}
+
+PQUEUED_LOCK
+KeCreateQueuedLock (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new queued lock.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a pointer to the new lock on success.
+
+    NULL on failure.
+
+--*/
+
+{
+
+    return calloc(1, sizeof(QUEUED_LOCK));
+}
+
+VOID
+KeDestroyQueuedLock (
+    PQUEUED_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a queued lock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the queued lock to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Lock->OwningThread == NULL);
+
+    free(Lock);
+    return;
+}
+
+VOID
+KeAcquireQueuedLock (
+    PQUEUED_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine acquires the queued lock. The test is single threaded, so
+    an acquire of a held lock is a deadlock.
+
+Arguments:
+
+    Lock - Supplies a pointer to the queued lock to acquire.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(TestRunLevel == RunLevelLow);
+    ASSERT(Lock->OwningThread == NULL);
+
+    Lock->OwningThread = (PKTHREAD)Lock;
+    return;
+}
+
+VOID
+KeReleaseQueuedLock (
+    PQUEUED_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a queued lock that has been previously acquired.
+
+Arguments:
+
+    Lock - Supplies a pointer to the queued lock to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(TestRunLevel <= RunLevelDispatch);
+    ASSERT(Lock->OwningThread != NULL);
+
+    Lock->OwningThread = NULL;
+    return;
+}
+
+KERNEL_API
+BOOL
+KeIsQueuedLockHeld (
+    PQUEUED_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a queued lock is acquired or free.
+
+Arguments:
+
+    Lock - Supplies a pointer to the queued lock.
+
+Return Value:
+
+    TRUE if the queued lock is held.
+
+    FALSE if the queued lock is free.
+
+--*/
+
+{
+
+    if (Lock->OwningThread != NULL) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+KERNEL_API
+PKEVENT
+KeCreateEvent (
+    PVOID ParentObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a kernel event. It comes initialized to Not
+    Signaled. The test is single threaded, so an event is just a signal
+    state.
+
+Arguments:
+
+    ParentObject - Supplies an optional parent object to create the event
+        under.
+
+Return Value:
+
+    Returns a pointer to the event, or NULL if the event could not be created.
+
+--*/
+
+{
+
+    return calloc(1, sizeof(TEST_EVENT));
+}
+
+KERNEL_API
+VOID
+KeDestroyEvent (
+    PKEVENT Event
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys an event created with KeCreateEvent. The event is no
+    longer valid after this call.
+
+Arguments:
+
+    Event - Supplies a pointer to the event to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    free(Event);
+    return;
+}
+
+KERNEL_API
+VOID
+KeSignalEvent (
+    PKEVENT Event,
+    SIGNAL_OPTION Option
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets an event to the given signal state.
+
+Arguments:
+
+    Event - Supplies a pointer to the event to signal or unsignal.
+
+    Option - Supplies the signaling behavior to apply.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTEST_EVENT TestEvent;
+
+    TestEvent = (PTEST_EVENT)Event;
+    TestEvent->Signaled = FALSE;
+    if (Option != SignalOptionUnsignal) {
+        TestEvent->Signaled = TRUE;
+    }
+
+    return;
+}
+
+KERNEL_API
+KSTATUS
+KeWaitForEvent (
+    PKEVENT Event,
+    BOOL Interruptible,
+    ULONG TimeoutInMilliseconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits until an event enters a signaled state. The test is
+    single threaded, so the event had better already be signaled.
+
+Arguments:
+
+    Event - Supplies a pointer to the event to wait for.
+
+    Interruptible - Supplies a boolean indicating whether or not the wait can
+        be interrupted if a signal is sent to the process on which this thread
+        runs. If TRUE is supplied, the caller must check the return status
+        code to find out if the wait was really satisfied or just interrupted.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds that the given
+        objects should be waited on before timing out. Use WAIT_TIME_INDEFINITE
+        to wait forever on these objects.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    PTEST_EVENT TestEvent;
+
+    TestEvent = (PTEST_EVENT)Event;
+
+    ASSERT(TestEvent->Signaled != FALSE);
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+KeDelayExecution (
+    BOOL Interruptible,
+    BOOL TimeTicks,
+    ULONGLONG Interval
+    )
+
+/*++
+
+Routine Description:
+
+    This routine blocks the current thread for the specified amount of time.
+    The test does not wait on real hardware, so this returns immediately.
+
+Arguments:
+
+    Interruptible - Supplies a boolean indicating if the wait can be
+        interrupted.
+
+    TimeTicks - Supplies a boolean indicating if the interval parameter is
+        represented in time counter ticks (TRUE) or microseconds (FALSE).
+
+    Interval - Supplies the interval to wait.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    return STATUS_SUCCESS;
+}
+
+ULONGLONG
+KeGetRecentTimeCounter (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns a relatively recent snap of the time counter.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the fairly recent snap of the time counter.
+
+--*/
+
+{
+
+    TestTimeCounter += 1;
+    return TestTimeCounter;
+}
+
+PVOID
+MmAllocatePool (
+    POOL_TYPE PoolType,
+    UINTN Size,
+    ULONG Tag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates memory from a kernel pool.
+
+Arguments:
+
+    PoolType - Supplies the type of pool to allocate from.
+
+    Size - Supplies the size of the allocation, in bytes.
+
+    Tag - Supplies an identifier to associate with the allocation.
+
+Return Value:
+
+    Returns the allocation on success.
+
+    NULL on failure.
+
+--*/
+
+{
+
+    return malloc(Size);
+}
+
+VOID
+MmFreePool (
+    POOL_TYPE PoolType,
+    PVOID Allocation
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees memory allocated from a kernel pool.
+
+Arguments:
+
+    PoolType - Supplies the type of pool the memory was allocated from.
+
+    Allocation - Supplies a pointer to the allocation to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    free(Allocation);
+    return;
+}
+
+PIO_BUFFER
+MmAllocateNonPagedIoBuffer (
+    PHYSICAL_ADDRESS MinimumPhysicalAddress,
+    PHYSICAL_ADDRESS MaximumPhysicalAddress,
+    UINTN Alignment,
+    UINTN Size,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates memory for use as an I/O buffer. The buffer is one
+    fragment, given a made up physical address below 4GB.
+
+Arguments:
+
+    MinimumPhysicalAddress - Supplies the minimum physical address.
+
+    MaximumPhysicalAddress - Supplies the maximum physical address.
+
+    Alignment - Supplies the required physical alignment.
+
+    Size - Supplies the minimum size of the buffer, in bytes.
+
+    Flags - Supplies a bitmask of flags used to allocate the I/O buffer.
+
+Return Value:
+
+    Returns a pointer to the I/O buffer on success.
+
+    NULL on failure.
+
+--*/
+
+{
+
+    UINTN AlignedSize;
+    PVOID Buffer;
+    PIO_BUFFER IoBuffer;
+
+    IoBuffer = calloc(1, sizeof(IO_BUFFER));
+    if (IoBuffer == NULL) {
+        return NULL;
+    }
+
+    IoBuffer->Fragment = &(IoBuffer->Internal.Fragment);
+    IoBuffer->FragmentCount = 1;
+    AlignedSize = ALIGN_RANGE_UP(Size, TEST_IO_BUFFER_PAGE_SIZE);
+    Buffer = aligned_alloc(TEST_IO_BUFFER_PAGE_SIZE, AlignedSize);
+    if (Buffer == NULL) {
+        free(IoBuffer);
+        return NULL;
+    }
+
+    memset(Buffer, 0, AlignedSize);
+    IoBuffer->Fragment[0].VirtualAddress = Buffer;
+    IoBuffer->Fragment[0].PhysicalAddress = TestNextPhysicalAddress;
+    IoBuffer->Fragment[0].Size = Size;
+    IoBuffer->Internal.TotalSize = Size;
+    TestNextPhysicalAddress += AlignedSize;
+    return IoBuffer;
+}
+
+KERNEL_API
+VOID
+MmFreeIoBuffer (
+    PIO_BUFFER IoBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys an I/O buffer. If the memory was allocated when the
+    I/O buffer was created, then the memory will be released at this time as
+    well.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to the I/O buffer to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(IoBuffer->Fragment == &(IoBuffer->Internal.Fragment));
+
+    free(IoBuffer->Fragment[0].VirtualAddress);
+    free(IoBuffer);
+    return;
+}
+
+KERNEL_API
+KSTATUS
+MmCopyIoBuffer (
+    PIO_BUFFER Destination,
+    UINTN DestinationOffset,
+    PIO_BUFFER Source,
+    UINTN SourceOffset,
+    UINTN ByteCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies the contents of the source I/O buffer starting at the
+    source offset to the destination I/O buffer starting at the destination
+    offset. It assumes that the arguments are correct such that the copy can
+    succeed.
+
+Arguments:
+
+    Destination - Supplies a pointer to the destination I/O buffer that is to
+        be copied into.
+
+    DestinationOffset - Supplies the offset into the destination I/O buffer
+        where the copy should begin.
+
+    Source - Supplies a pointer to the source I/O buffer whose contents will be
+        copied to the destination.
+
+    SourceOffset - Supplies the offset into the source I/O buffer where the
+        copy should begin.
+
+    ByteCount - Supplies the size of the requested copy in bytes.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    UINTN CopySize;
+    PUCHAR DestinationBytes;
+    PUCHAR SourceBytes;
+    UINTN SourceSize;
+
+    while (ByteCount != 0) {
+        DestinationBytes = TestGetIoBufferAddress(Destination,
+                                                  DestinationOffset,
+                                                  &CopySize);
+
+        if (CopySize > ByteCount) {
+            CopySize = ByteCount;
+        }
+
+        SourceBytes = TestGetIoBufferAddress(Source, SourceOffset, &SourceSize);
+        if (CopySize > SourceSize) {
+            CopySize = SourceSize;
+        }
+
+        memcpy(DestinationBytes, SourceBytes, CopySize);
+        DestinationOffset += CopySize;
+        SourceOffset += CopySize;
+        ByteCount -= CopySize;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KERNEL_API
+ULONG
+MmGetIoBufferAlignment (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the required alignment for all flush operations.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the size of a data cache line, in bytes.
+
+--*/
+
+{
+
+    return TEST_IO_BUFFER_ALIGNMENT;
+}
+
+UINTN
+MmGetIoBufferCurrentOffset (
+    PIO_BUFFER IoBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the given I/O buffer's current offset.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to the I/O buffer.
+
+Return Value:
+
+    Returns the I/O buffer's current offset.
+
+--*/
+
+{
+
+    return IoBuffer->Internal.CurrentOffset;
+}
+
+KSTATUS
+MmMapIoBuffer (
+    PIO_BUFFER IoBuffer,
+    BOOL WriteThrough,
+    BOOL NonCached,
+    BOOL VirtuallyContiguous
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps the given I/O buffer into memory. The test's I/O
+    buffers are always mapped.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to an I/O buffer.
+
+    WriteThrough - Supplies a boolean indicating if the virtual addresses
+        should be mapped write through (TRUE) or the default write back
+        (FALSE).
+
+    NonCached - Supplies a boolean indicating if the virtual addresses should
+        be mapped non-cached (TRUE) or the default, which is to map is as
+        normal cached memory (FALSE).
+
+    VirtuallyContiguous - Supplies a boolean indicating whether or not the
+        caller needs the I/O buffer to be mapped virtually contiguous (TRUE)
+        or not (FALSE).
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    ASSERT(IoBuffer->Fragment[0].VirtualAddress != NULL);
+
+    return STATUS_SUCCESS;
+}
+
+USB_API
+KSTATUS
+UsbClaimInterface (
+    HANDLE UsbDeviceHandle,
+    UCHAR InterfaceNumber
+    )
+
+/*++
+
+Routine Description:
+
+    This routine claims an interface, preparing it for I/O use. An interface
+    can be claimed more than once. This routine must be called at low level.
+
+Arguments:
+
+    UsbDeviceHandle - Supplies the handle returned when the device was opened.
+
+    InterfaceNumber - Supplies the number of the interface to claim.
+
+Return Value:
+
+    STATUS_SUCCESS always.
+
+--*/
+
+{
+
+    return STATUS_SUCCESS;
+}
+
+USB_API
+VOID
+UsbReleaseInterface (
+    HANDLE UsbDeviceHandle,
+    UCHAR InterfaceNumber
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases an interface that was previously claimed for I/O.
+    After this call, the caller that had claimed the interface should not use
+    it again without reclaiming it.
+
+Arguments:
+
+    UsbDeviceHandle - Supplies the handle returned when the device was opened.
+
+    InterfaceNumber - Supplies the number of the interface to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    return;
+}
+
+USB_API
+VOID
+UsbDetachDevice (
+    HANDLE UsbCoreHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine detaches a USB device from the USB core by marking it as
+    disconnected, and cancelling all active transfers belonging to the device.
+    It does not close the device.
+
+Arguments:
+
+    UsbCoreHandle - Supplies the core handle to the device that is to be
+        removed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    return;
+}
+
+USB_API
+VOID
+UsbDeviceClose (
+    HANDLE UsbDeviceHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine closes an open USB handle.
+
+Arguments:
+
+    UsbDeviceHandle - Supplies the handle returned when the device was opened.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    return;
+}
+
+USB_API
+KSTATUS
+UsbDriverAttach (
+    PDEVICE Device,
+    PDRIVER Driver,
+    PHANDLE UsbCoreHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attaches a USB driver to a USB device, and returns a USB
+    core handle to the device, used for all USB communications. This routine
+    must be called at low level.
+
+Arguments:
+
+    Device - Supplies a pointer to the OS device object representation of the
+        USB device.
+
+    Driver - Supplies a pointer to the driver that will take ownership of the
+        device.
+
+    UsbCoreHandle - Supplies a pointer where the USB Core device handle will
+        be returned.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+USB_API
+KSTATUS
+UsbFlushEndpoint (
+    HANDLE UsbDeviceHandle,
+    UCHAR EndpointNumber,
+    PULONG TransferCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine flushes the given endpoint for the given USB device. This
+    includes busily waiting for all active transfers to complete. This is only
+    meant to be used at high run level when preparing to write a crash dump
+    file using USB Mass Storage.
+
+Arguments:
+
+    UsbDeviceHandle - Supplies the handle returned when the device was opened.
+
+    EndpointNumber - Supplies the number of the endpoint to be reset.
+
+    TransferCount - Supplies a pointer that receives the total number of
+        transfers that were flushed.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+USB_API
+PUSB_CONFIGURATION_DESCRIPTION
+UsbGetActiveConfiguration (
+    HANDLE UsbDeviceHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the currently active configuration set in the device.
+
+Arguments:
+
+    UsbDeviceHandle - Supplies the handle returned when the device was opened.
+
+Return Value:
+
+    NULL always.
+
+--*/
+
+{
+
+    return NULL;
+}
+
+USB_API
+PUSB_INTERFACE_DESCRIPTION
+UsbGetDesignatedInterface (
+    PDEVICE Device,
+    HANDLE UsbCoreHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the interface for which the given pseudo-device was
+    enumerated. This routine is used by general class drivers (like Hub or
+    Mass Storage) that can interact with an interface without necessarily
+    taking responsibility for the entire device.
+
+Arguments:
+
+    Device - Supplies a pointer to the OS device object representation of the
+        USB device.
+
+    UsbCoreHandle - Supplies the core handle to the device.
+
+Return Value:
+
+    NULL always.
+
+--*/
+
+{
+
+    return NULL;
+}
+
+USB_API
+PVOID
+UsbGetDeviceToken (
+    PUSB_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the system device token associated with the given USB
+    device.
+
+Arguments:
+
+    Device - Supplies a pointer to a USB device.
+
+Return Value:
+
+    NULL always.
+
+--*/
+
+{
+
+    return NULL;
+}
+
+USB_API
+KSTATUS
+UsbInitializePagingDeviceTransfers (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes the USB core to handle special paging device
+    transfers that are serviced on their own work queue.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+USB_API
+BOOL
+UsbIsPolledIoSupported (
+    HANDLE UsbDeviceHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns a boolean indicating whether or not the given USB
+    device's controller supports polled I/O mode. Polled I/O should only be
+    used in dire circumstances. That is, during system failure when a crash
+    dump file needs to be written over USB Mass Storage at high run level with
+    interrupts disabled.
+
+Arguments:
+
+    UsbDeviceHandle - Supplies the handle returned when the device was opened.
+
+Return Value:
+
+    FALSE always.
+
+--*/
+
+{
+
+    return FALSE;
+}
+
+USB_API
+KSTATUS
+UsbResetEndpoint (
+    HANDLE UsbDeviceHandle,
+    UCHAR EndpointNumber
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets the given endpoint for the given USB device. This
+    includes resetting the data toggle to DATA 0.
+
+Arguments:
+
+    UsbDeviceHandle - Supplies the handle returned when the device was opened.
+
+    EndpointNumber - Supplies the number of the endpoint to be reset.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+USB_API
+KSTATUS
+UsbSetConfiguration (
+    HANDLE UsbDeviceHandle,
+    UCHAR ConfigurationNumber,
+    BOOL NumberIsIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the configuration to the given configuration value. This
+    routine must be called at low level.
+
+Arguments:
+
+    UsbDeviceHandle - Supplies the handle returned when the device was opened.
+
+    ConfigurationNumber - Supplies the configuration index or value to set.
+
+    NumberIsIndex - Supplies a boolean indicating whether the configuration
+        number is an index (TRUE) or a specific configuration value (FALSE).
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+USB_API
+KSTATUS
+UsbSubmitPolledTransfer (
+    PUSB_TRANSFER Transfer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine submits a USB transfer, and does not return until the transfer
+    is completed successfully or with an error. This routine is meant to be
+    called in critical code paths at high level.
+
+Arguments:
+
+    Transfer - Supplies a pointer to the transfer to submit.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+USB_API
+KSTATUS
+UsbSubmitSynchronousTransfer (
+    PUSB_TRANSFER Transfer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine submits a USB transfer, and does not return until the transfer
+    is completed successfully or with an error. This routine must be called at
+    low level.
+
+Arguments:
+
+    Transfer - Supplies a pointer to the transfer to destroy.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+PVOID
+TestGetIoBufferAddress (
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    PUINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the virtual address of a byte in an I/O buffer.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to the I/O buffer.
+
+    Offset - Supplies the offset of the byte from the I/O buffer's current
+        offset.
+
+    Size - Supplies a pointer where the number of bytes left in the fragment
+        containing the byte is returned.
+
+Return Value:
+
+    Returns the virtual address of the byte.
+
+--*/
+
+{
+
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
+
+    Offset += IoBuffer->Internal.CurrentOffset;
+    for (FragmentIndex = 0;
+         FragmentIndex < IoBuffer->FragmentCount;
+         FragmentIndex += 1) {
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        if (Offset < Fragment->Size) {
+            *Size = Fragment->Size - Offset;
+            return Fragment->VirtualAddress + Offset;
+        }
+
+        Offset -= Fragment->Size;
+    }
+
+    ASSERT(FALSE);
+
+    *Size = 0;
+    return NULL;
+}
+
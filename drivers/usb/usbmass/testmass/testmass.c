@@ -0,0 +1,1318 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    testmass.c
+
+Abstract:
+
+    This module implements the tests for the USB mass storage driver's I/O
+    queue. It drives the driver's dispatch routine against a fake Bulk-Only
+    Transport device, checking the commands the device receives and the data
+    that moves.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Test
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include <minoca/intrface/disk.h>
+#include <minoca/usb/usb.h>
+#include "../usbmass.h"
+#include "testmass.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the number of logical units on the fake device.
+//
+
+#define TEST_LUN_COUNT 3
+
+//
+// Define the fake physical layout of test IRP buffers. Each IRP gets its own
+// region. The fragments of a fragmented buffer are virtually contiguous but
+// never physically contiguous.
+//
+
+#define TEST_IRP_PHYSICAL_BASE 0x40000000
+#define TEST_IRP_PHYSICAL_STRIDE 0x01000000
+#define TEST_IRP_FRAGMENT_GAP 0x1000
+
+//
+// Define the size of the fragments of a fragmented test buffer.
+//
+
+#define TEST_FRAGMENT_SIZE 0x800
+
+//
+// Define the number of blocks in an IRP that takes two commands.
+//
+
+#define TEST_LARGE_BLOCK_COUNT 384
+#define TEST_COMMAND_BLOCK_COUNT \
+    (USB_MASS_MAX_DATA_TRANSFER / TEST_BOT_BLOCK_SIZE)
+
+#define TEST_MAX_IRPS 16
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+ULONG
+TestMultipleLunFairness (
+    VOID
+    );
+
+ULONG
+TestShortStatus (
+    VOID
+    );
+
+ULONG
+TestPhaseError (
+    VOID
+    );
+
+KSTATUS
+TestCreateDevice (
+    ULONG LunCount
+    );
+
+ULONG
+TestCheckIdle (
+    VOID
+    );
+
+PTEST_MASS_IRP
+TestCreateIrp (
+    ULONG Identifier,
+    ULONG Lun,
+    BOOL Write,
+    ULONG Block,
+    ULONG BlockCount,
+    BOOL Fragmented
+    );
+
+VOID
+TestDestroyIrp (
+    PTEST_MASS_IRP TestIrp
+    );
+
+VOID
+TestSendIrp (
+    PTEST_MASS_IRP TestIrp
+    );
+
+VOID
+TestRunDevice (
+    VOID
+    );
+
+VOID
+TestPumpIrps (
+    VOID
+    );
+
+VOID
+TestFinishIrp (
+    PTEST_MASS_IRP TestIrp
+    );
+
+ULONG
+TestVerifyCommands (
+    PTEST_BOT_COMMAND Commands,
+    ULONG CommandCount
+    );
+
+ULONG
+TestVerifyFinishOrder (
+    PTEST_MASS_IRP *Irps,
+    ULONG IrpCount
+    );
+
+ULONG
+TestVerifyIrp (
+    PTEST_MASS_IRP TestIrp,
+    BOOL Success
+    );
+
+ULONG
+TestVerifyRecovery (
+    ULONG ResetCount
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+extern RUNLEVEL TestRunLevel;
+extern ULONG TestDriverErrorCount;
+
+//
+// Store the mass storage device under test and its logical disks.
+//
+
+PUSB_MASS_STORAGE_DEVICE TestDevice;
+PUSB_DISK TestDisks[TEST_BOT_MAX_LUNS];
+
+//
+// Store the IRPs that are out in the driver, and the identifiers of the IRPs
+// that made it back out in the order they did so.
+//
+
+PTEST_MASS_IRP TestOutstandingIrps[TEST_MAX_IRPS];
+ULONG TestFinishOrder[TEST_MAX_IRPS];
+ULONG TestFinishCount;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INT
+main (
+    INT ArgumentCount,
+    CHAR **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for the USB mass storage test program. It
+    executes the tests.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of arguments specified on the command
+        line.
+
+    Arguments - Supplies an array of strings representing the command line
+        arguments.
+
+Return Value:
+
+    returns 0 on success, or nonzero on failure.
+
+--*/
+
+{
+
+    ULONG Failures;
+    KSTATUS Status;
+    ULONG TotalTestsFailed;
+
+    TotalTestsFailed = 0;
+    Status = TestCreateDevice(TEST_LUN_COUNT);
+    if (!KSUCCESS(Status)) {
+        printf("Failed to create the USB mass storage device: %d\n", Status);
+        return 1;
+    }
+
+    Failures = TestMultipleLunFairness();
+    if (Failures != 0) {
+        printf("\nMulti-LUN fairness test had %d failures.\n", Failures);
+    }
+
+    TotalTestsFailed += Failures;
+    Failures = TestShortStatus();
+    if (Failures != 0) {
+        printf("\nShort status test had %d failures.\n", Failures);
+    }
+
+    TotalTestsFailed += Failures;
+    Failures = TestPhaseError();
+    if (Failures != 0) {
+        printf("\nPhase error test had %d failures.\n", Failures);
+    }
+
+    TotalTestsFailed += Failures;
+
+    //
+    // Tests are over, print results.
+    //
+
+    if (TotalTestsFailed != 0) {
+        printf("*** %d Failure(s) in USB mass storage test. ***\n",
+               TotalTestsFailed);
+
+        return 1;
+    }
+
+    printf("All USB mass storage tests passed.\n");
+    return 0;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+ULONG
+TestMultipleLunFairness (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests that IRPs queued on several logical units behind a
+    busy device are served round-robin by LUN, one command at a time, and
+    that an IRP larger than one command finishes before the device moves on.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    TEST_BOT_COMMAND Commands[] = {
+        {0, SCSI_COMMAND_WRITE_10, 0, TEST_COMMAND_BLOCK_COUNT},
+        {0,
+         SCSI_COMMAND_WRITE_10,
+         TEST_COMMAND_BLOCK_COUNT,
+         TEST_LARGE_BLOCK_COUNT - TEST_COMMAND_BLOCK_COUNT},
+
+        {1, SCSI_COMMAND_WRITE_10, 10, 16},
+        {2, SCSI_COMMAND_WRITE_10, 1000, 4},
+        {0, SCSI_COMMAND_READ_10, 0, 8},
+        {1, SCSI_COMMAND_READ_10, 10, 16},
+        {0, SCSI_COMMAND_WRITE_10, 600, 8},
+        {0, SCSI_COMMAND_READ_10, 600, 8},
+    };
+
+    ULONG Failures;
+    ULONG Index;
+    PTEST_MASS_IRP Irps[7];
+    PTEST_MASS_IRP Order[7];
+
+    Failures = 0;
+    TestBotInitialize(TEST_LUN_COUNT);
+    Irps[0] = TestCreateIrp(1, 0, TRUE, 0, TEST_LARGE_BLOCK_COUNT, FALSE);
+    Irps[1] = TestCreateIrp(2, 0, FALSE, 0, 8, FALSE);
+    Irps[2] = TestCreateIrp(3, 0, TRUE, 600, 8, FALSE);
+    Irps[3] = TestCreateIrp(4, 0, FALSE, 600, 8, FALSE);
+    Irps[4] = TestCreateIrp(5, 1, TRUE, 10, 16, TRUE);
+    Irps[5] = TestCreateIrp(6, 1, FALSE, 10, 16, TRUE);
+    Irps[6] = TestCreateIrp(7, 2, TRUE, 1000, 4, FALSE);
+    for (Index = 0; Index < 7; Index += 1) {
+        if (Irps[Index] == NULL) {
+            return 1;
+        }
+    }
+
+    //
+    // The first IRP takes the idle device. Everything else queues up behind
+    // it, the later LUNs arriving last.
+    //
+
+    for (Index = 0; Index < 7; Index += 1) {
+        TestSendIrp(Irps[Index]);
+        if (TestBot.CommandCount != 0) {
+            printf("IRP %d: device received a command before it ran.\n",
+                   Irps[Index]->Identifier);
+
+            Failures += 1;
+        }
+    }
+
+    TestRunDevice();
+    Failures += TestVerifyCommands(Commands,
+                                   sizeof(Commands) / sizeof(Commands[0]));
+
+    Order[0] = Irps[0];
+    Order[1] = Irps[4];
+    Order[2] = Irps[6];
+    Order[3] = Irps[1];
+    Order[4] = Irps[5];
+    Order[5] = Irps[2];
+    Order[6] = Irps[3];
+    Failures += TestVerifyFinishOrder(Order, 7);
+    for (Index = 0; Index < 7; Index += 1) {
+        Failures += TestVerifyIrp(Irps[Index], TRUE);
+    }
+
+    if (TestBot.ResetCount != 0) {
+        printf("Device was reset %d times.\n", TestBot.ResetCount);
+        Failures += 1;
+    }
+
+    Failures += TestCheckIdle();
+    for (Index = 0; Index < 7; Index += 1) {
+        TestDestroyIrp(Irps[Index]);
+    }
+
+    return Failures;
+}
+
+ULONG
+TestShortStatus (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests command status wrappers that come back short. Each one
+    should put the device through reset recovery and retry the command. An
+    IRP whose status keeps coming back short should eventually fail without
+    holding up the IRP behind it.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    TEST_BOT_COMMAND Commands[] = {
+        {1, SCSI_COMMAND_WRITE_10, 50, 8, TestBotFaultShortStatus},
+        {1, SCSI_COMMAND_WRITE_10, 50, 8},
+        {0, SCSI_COMMAND_READ_10, 0, 8},
+    };
+
+    PTEST_BOT_COMMAND Command;
+    ULONG Failures;
+    ULONG Index;
+    PTEST_MASS_IRP Irps[4];
+
+    Failures = 0;
+    TestBotInitialize(TEST_LUN_COUNT);
+    Irps[0] = TestCreateIrp(8, 1, TRUE, 50, 8, FALSE);
+    Irps[1] = TestCreateIrp(9, 0, FALSE, 0, 8, FALSE);
+    Irps[2] = TestCreateIrp(10, 2, FALSE, 1000, 4, FALSE);
+    Irps[3] = TestCreateIrp(11, 1, FALSE, 50, 8, TRUE);
+    for (Index = 0; Index < 4; Index += 1) {
+        if (Irps[Index] == NULL) {
+            return 1;
+        }
+    }
+
+    //
+    // Send a write whose first status comes back one byte short, with a read
+    // on another LUN queued behind it.
+    //
+
+    TestBotInjectFault(TestBotFaultShortStatus, 0, 1);
+    TestSendIrp(Irps[0]);
+    TestSendIrp(Irps[1]);
+    TestRunDevice();
+    Failures += TestVerifyCommands(Commands,
+                                   sizeof(Commands) / sizeof(Commands[0]));
+
+    Failures += TestVerifyFinishOrder(Irps, 2);
+    Failures += TestVerifyIrp(Irps[0], TRUE);
+    Failures += TestVerifyIrp(Irps[1], TRUE);
+    Failures += TestVerifyRecovery(1);
+    Failures += TestCheckIdle();
+
+    //
+    // Now send a read whose status always comes back short. It gets the
+    // original attempt plus the retries, then fails, and the read queued
+    // behind it on another LUN goes ahead.
+    //
+
+    TestBotInitialize(TEST_LUN_COUNT);
+    TestFinishCount = 0;
+    TestBotInjectFault(TestBotFaultShortStatus,
+                       0,
+                       USB_MASS_IO_REQUEST_RETRY_COUNT + 1);
+
+    TestSendIrp(Irps[2]);
+    TestSendIrp(Irps[3]);
+    TestRunDevice();
+    if (TestBot.CommandCount != USB_MASS_IO_REQUEST_RETRY_COUNT + 2) {
+        printf("Device received %d commands, expected %d.\n",
+               TestBot.CommandCount,
+               USB_MASS_IO_REQUEST_RETRY_COUNT + 2);
+
+        Failures += 1;
+
+    } else {
+        for (Index = 0; Index < TestBot.CommandCount; Index += 1) {
+            Command = &(TestBot.Commands[Index]);
+            if ((Index <= USB_MASS_IO_REQUEST_RETRY_COUNT) &&
+                ((Command->Lun != 2) || (Command->Block != 1000) ||
+                 (Command->Fault != TestBotFaultShortStatus))) {
+
+                printf("Command %d was not a retry of the failing read.\n",
+                       Index);
+
+                Failures += 1;
+            }
+        }
+
+        Command = &(TestBot.Commands[TestBot.CommandCount - 1]);
+        if ((Command->Lun != 1) || (Command->Block != 50) ||
+            (Command->Fault != TestBotFaultNone)) {
+
+            printf("Last command was not the queued read.\n");
+            Failures += 1;
+        }
+    }
+
+    Failures += TestVerifyFinishOrder(&(Irps[2]), 2);
+    Failures += TestVerifyIrp(Irps[2], FALSE);
+    Failures += TestVerifyIrp(Irps[3], TRUE);
+    Failures += TestVerifyRecovery(USB_MASS_IO_REQUEST_RETRY_COUNT + 1);
+    Failures += TestCheckIdle();
+    for (Index = 0; Index < 4; Index += 1) {
+        TestDestroyIrp(Irps[Index]);
+    }
+
+    return Failures;
+}
+
+ULONG
+TestPhaseError (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests a phase error in the middle of an IRP that takes two
+    commands. The device should go through reset recovery, the second command
+    should be retried without redoing the first, and then the IRP queued
+    behind should run.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    TEST_BOT_COMMAND Commands[] = {
+        {0, SCSI_COMMAND_READ_10, 0, TEST_COMMAND_BLOCK_COUNT},
+        {0,
+         SCSI_COMMAND_READ_10,
+         TEST_COMMAND_BLOCK_COUNT,
+         TEST_LARGE_BLOCK_COUNT - TEST_COMMAND_BLOCK_COUNT,
+         TestBotFaultPhaseError},
+
+        {0,
+         SCSI_COMMAND_READ_10,
+         TEST_COMMAND_BLOCK_COUNT,
+         TEST_LARGE_BLOCK_COUNT - TEST_COMMAND_BLOCK_COUNT},
+
+        {2, SCSI_COMMAND_WRITE_10, 900, 4},
+    };
+
+    ULONG Block;
+    ULONG Failures;
+    ULONG Index;
+    PTEST_MASS_IRP Irps[2];
+
+    Failures = 0;
+    TestBotInitialize(TEST_LUN_COUNT);
+    TestFinishCount = 0;
+    for (Block = 0; Block < TEST_LARGE_BLOCK_COUNT; Block += 1) {
+        memset(TestBotGetBlock(0, Block), Block, TEST_BOT_BLOCK_SIZE);
+    }
+
+    Irps[0] = TestCreateIrp(12, 0, FALSE, 0, TEST_LARGE_BLOCK_COUNT, FALSE);
+    Irps[1] = TestCreateIrp(13, 2, TRUE, 900, 4, TRUE);
+    if ((Irps[0] == NULL) || (Irps[1] == NULL)) {
+        return 1;
+    }
+
+    TestBotInjectFault(TestBotFaultPhaseError, 1, 1);
+    TestSendIrp(Irps[0]);
+    TestSendIrp(Irps[1]);
+    TestRunDevice();
+    Failures += TestVerifyCommands(Commands,
+                                   sizeof(Commands) / sizeof(Commands[0]));
+
+    Failures += TestVerifyFinishOrder(Irps, 2);
+    Failures += TestVerifyIrp(Irps[0], TRUE);
+    Failures += TestVerifyIrp(Irps[1], TRUE);
+    Failures += TestVerifyRecovery(1);
+    Failures += TestCheckIdle();
+    for (Index = 0; Index < 2; Index += 1) {
+        TestDestroyIrp(Irps[Index]);
+    }
+
+    return Failures;
+}
+
+KSTATUS
+TestCreateDevice (
+    ULONG LunCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the mass storage device and its logical disks, as
+    if the device had been started and each disk had been enumerated.
+
+Arguments:
+
+    LunCount - Supplies the number of logical units on the device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PUSB_MASS_STORAGE_DEVICE Device;
+    PUSB_DISK Disk;
+    KSTATUS Status;
+
+    TestBotInitialize(LunCount);
+    Device = calloc(1, sizeof(USB_MASS_STORAGE_DEVICE));
+    if (Device == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Device->Type = UsbMassStorageDevice;
+    Device->ReferenceCount = 1;
+    Device->UsbCoreHandle = (HANDLE)&TestBot;
+    Device->Lock = KeCreateQueuedLock();
+    if (Device->Lock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    INITIALIZE_LIST_HEAD(&(Device->LogicalDiskList));
+    KeInitializeSpinLock(&(Device->IrpQueueLock));
+    Device->LunCount = LunCount;
+    Device->InEndpoint = TEST_BOT_IN_ENDPOINT;
+    Device->OutEndpoint = TEST_BOT_OUT_ENDPOINT;
+    Device->InterfaceNumber = TEST_BOT_INTERFACE;
+    Status = UsbMasspCreateLogicalDisks(Device, LunCount);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    CurrentEntry = Device->LogicalDiskList.Next;
+    while (CurrentEntry != &(Device->LogicalDiskList)) {
+        Disk = LIST_VALUE(CurrentEntry, USB_DISK, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        Disk->BlockShift = TEST_BOT_BLOCK_SHIFT;
+        Disk->BlockCount = TEST_BOT_BLOCK_COUNT;
+        Disk->Connected = TRUE;
+        TestDisks[Disk->LunNumber] = Disk;
+    }
+
+    TestDevice = Device;
+    return STATUS_SUCCESS;
+}
+
+ULONG
+TestCheckIdle (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine checks that the device went idle once its queues drained,
+    that nothing was left behind, and that the device never saw the protocol
+    broken.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Failures;
+    ULONG Index;
+
+    Failures = 0;
+    if (TestDevice->ActiveDisk != NULL) {
+        printf("Device still has an active disk.\n");
+        Failures += 1;
+    }
+
+    if (KeIsQueuedLockHeld(TestDevice->Lock) != FALSE) {
+        printf("Idle device is still locked.\n");
+        Failures += 1;
+    }
+
+    for (Index = 0; Index < TestDevice->LunCount; Index += 1) {
+        if ((TestDisks[Index]->Irp != NULL) ||
+            (LIST_EMPTY(&(TestDisks[Index]->IrpQueue)) == FALSE)) {
+
+            printf("LUN %d still has IRPs.\n", Index);
+            Failures += 1;
+        }
+    }
+
+    if (TestBotCompleteTransfer() != FALSE) {
+        printf("Idle device still had a transfer submitted.\n");
+        Failures += 1;
+    }
+
+    if (TestBot.ProtocolErrors != 0) {
+        printf("Device saw %d protocol errors.\n", TestBot.ProtocolErrors);
+        Failures += 1;
+    }
+
+    if (TestDriverErrorCount != 0) {
+        printf("Driver reported %d device errors.\n", TestDriverErrorCount);
+        Failures += 1;
+        TestDriverErrorCount = 0;
+    }
+
+    if ((TestRunLevel != RunLevelLow) ||
+        (TestDevice->IrpQueueLock.LockHeld != 0)) {
+
+        printf("Run level or IRP queue lock left raised.\n");
+        Failures += 1;
+    }
+
+    for (Index = 0; Index < TEST_MAX_IRPS; Index += 1) {
+        if (TestOutstandingIrps[Index] != NULL) {
+            printf("IRP %d never finished.\n",
+                   TestOutstandingIrps[Index]->Identifier);
+
+            Failures += 1;
+            TestOutstandingIrps[Index] = NULL;
+        }
+    }
+
+    return Failures;
+}
+
+PTEST_MASS_IRP
+TestCreateIrp (
+    ULONG Identifier,
+    ULONG Lun,
+    BOOL Write,
+    ULONG Block,
+    ULONG BlockCount,
+    BOOL Fragmented
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a disk read or write IRP. Write buffers are filled
+    with a pattern unique to the IRP.
+
+Arguments:
+
+    Identifier - Supplies the test's identifier for the IRP.
+
+    Lun - Supplies the logical unit to send the IRP to.
+
+    Write - Supplies a boolean indicating if this is a write (TRUE) or a read
+        (FALSE).
+
+    Block - Supplies the first block of the I/O.
+
+    BlockCount - Supplies the number of blocks to read or write.
+
+    Fragmented - Supplies a boolean indicating whether the buffer should be
+        split into small, physically discontiguous fragments (TRUE) or be one
+        fragment (FALSE).
+
+Return Value:
+
+    Returns a pointer to the new IRP on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    PUCHAR Buffer;
+    UINTN ByteIndex;
+    UINTN FragmentCount;
+    UINTN FragmentIndex;
+    UINTN FragmentSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PIO_BUFFER IoBuffer;
+    UINTN Size;
+    PTEST_MASS_IRP TestIrp;
+
+    Size = BlockCount * TEST_BOT_BLOCK_SIZE;
+    FragmentSize = Size;
+    if (Fragmented != FALSE) {
+        FragmentSize = TEST_FRAGMENT_SIZE;
+    }
+
+    FragmentCount = (Size + FragmentSize - 1) / FragmentSize;
+    TestIrp = calloc(1, sizeof(TEST_MASS_IRP));
+    IoBuffer = calloc(1, sizeof(IO_BUFFER));
+    Buffer = calloc(1, Size);
+    if ((TestIrp == NULL) || (IoBuffer == NULL) || (Buffer == NULL)) {
+        goto CreateIrpEnd;
+    }
+
+    IoBuffer->Fragment = calloc(FragmentCount, sizeof(IO_BUFFER_FRAGMENT));
+    if (IoBuffer->Fragment == NULL) {
+        goto CreateIrpEnd;
+    }
+
+    IoBuffer->FragmentCount = FragmentCount;
+    IoBuffer->Internal.TotalSize = Size;
+    PhysicalAddress = TEST_IRP_PHYSICAL_BASE +
+                      (Identifier * TEST_IRP_PHYSICAL_STRIDE);
+
+    for (FragmentIndex = 0; FragmentIndex < FragmentCount; FragmentIndex += 1) {
+        IoBuffer->Fragment[FragmentIndex].PhysicalAddress = PhysicalAddress;
+        IoBuffer->Fragment[FragmentIndex].VirtualAddress =
+                                       Buffer + (FragmentIndex * FragmentSize);
+
+        IoBuffer->Fragment[FragmentIndex].Size = FragmentSize;
+        PhysicalAddress += FragmentSize + TEST_IRP_FRAGMENT_GAP;
+    }
+
+    if (Write != FALSE) {
+        for (ByteIndex = 0; ByteIndex < Size; ByteIndex += 1) {
+            Buffer[ByteIndex] = (UCHAR)((Identifier << 4) +
+                                        (ByteIndex / TEST_BOT_BLOCK_SIZE) +
+                                        ByteIndex);
+        }
+    }
+
+    TestIrp->Identifier = Identifier;
+    TestIrp->Lun = Lun;
+    TestIrp->Irp.MajorCode = IrpMajorIo;
+    TestIrp->Irp.MinorCode = IrpMinorIoRead;
+    if (Write != FALSE) {
+        TestIrp->Irp.MinorCode = IrpMinorIoWrite;
+    }
+
+    TestIrp->Irp.Direction = IrpDown;
+    TestIrp->Irp.Status = STATUS_NOT_HANDLED;
+    TestIrp->Irp.U.ReadWrite.IoBuffer = IoBuffer;
+    TestIrp->Irp.U.ReadWrite.IoOffset = (ULONGLONG)Block * TEST_BOT_BLOCK_SIZE;
+    TestIrp->Irp.U.ReadWrite.IoSizeInBytes = Size;
+    return TestIrp;
+
+CreateIrpEnd:
+    if (IoBuffer != NULL) {
+        free(IoBuffer->Fragment);
+    }
+
+    free(Buffer);
+    free(IoBuffer);
+    free(TestIrp);
+    return NULL;
+}
+
+VOID
+TestDestroyIrp (
+    PTEST_MASS_IRP TestIrp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a test IRP.
+
+Arguments:
+
+    TestIrp - Supplies a pointer to the IRP to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_BUFFER IoBuffer;
+
+    IoBuffer = TestIrp->Irp.U.ReadWrite.IoBuffer;
+    free(IoBuffer->Fragment[0].VirtualAddress);
+    free(IoBuffer->Fragment);
+    free(IoBuffer);
+    free(TestIrp);
+    return;
+}
+
+VOID
+TestSendIrp (
+    PTEST_MASS_IRP TestIrp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends an IRP down to its USB disk, the way the I/O manager
+    would.
+
+Arguments:
+
+    TestIrp - Supplies a pointer to the IRP to send.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    for (Index = 0; Index < TEST_MAX_IRPS; Index += 1) {
+        if (TestOutstandingIrps[Index] == NULL) {
+            TestOutstandingIrps[Index] = TestIrp;
+            break;
+        }
+    }
+
+    ASSERT(Index != TEST_MAX_IRPS);
+
+    TestIrp->Irp.Direction = IrpDown;
+    UsbMassDispatchIo(&(TestIrp->Irp), TestDisks[TestIrp->Lun], NULL);
+    if (TestIrp->Pending == FALSE) {
+
+        ASSERT(TestIrp->Complete != FALSE);
+
+        TestFinishIrp(TestIrp);
+    }
+
+    TestPumpIrps();
+    return;
+}
+
+VOID
+TestRunDevice (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine lets the fake device perform transfers until the driver
+    stops submitting them, driving IRPs back up as they complete.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    while (TestBotCompleteTransfer() != FALSE) {
+        TestPumpIrps();
+    }
+
+    return;
+}
+
+VOID
+TestPumpIrps (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends every IRP the driver completed back up through its
+    disk, the way the thread waiting on a pended IRP would.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+    BOOL Progress;
+    PTEST_MASS_IRP TestIrp;
+
+    ASSERT(TestRunLevel == RunLevelLow);
+
+    do {
+        Progress = FALSE;
+        for (Index = 0; Index < TEST_MAX_IRPS; Index += 1) {
+            TestIrp = TestOutstandingIrps[Index];
+            if ((TestIrp == NULL) ||
+                (TestIrp->Pending == FALSE) ||
+                (TestIrp->Complete == FALSE)) {
+
+                continue;
+            }
+
+            ASSERT(TestIrp->Irp.Direction == IrpUp);
+
+            TestIrp->Pending = FALSE;
+            TestIrp->Complete = FALSE;
+            UsbMassDispatchIo(&(TestIrp->Irp), TestDisks[TestIrp->Lun], NULL);
+            if (TestIrp->Pending == FALSE) {
+                TestFinishIrp(TestIrp);
+            }
+
+            Progress = TRUE;
+        }
+
+    } while (Progress != FALSE);
+
+    return;
+}
+
+VOID
+TestFinishIrp (
+    PTEST_MASS_IRP TestIrp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records that an IRP made it back out of the driver.
+
+Arguments:
+
+    TestIrp - Supplies a pointer to the finished IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    ASSERT(TestIrp->Finished == FALSE);
+
+    TestIrp->Finished = TRUE;
+    if (TestFinishCount < TEST_MAX_IRPS) {
+        TestFinishOrder[TestFinishCount] = TestIrp->Identifier;
+        TestFinishCount += 1;
+    }
+
+    for (Index = 0; Index < TEST_MAX_IRPS; Index += 1) {
+        if (TestOutstandingIrps[Index] == TestIrp) {
+            TestOutstandingIrps[Index] = NULL;
+            break;
+        }
+    }
+
+    return;
+}
+
+ULONG
+TestVerifyCommands (
+    PTEST_BOT_COMMAND Commands,
+    ULONG CommandCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine checks the commands the fake device received.
+
+Arguments:
+
+    Commands - Supplies the commands the device should have received, in
+        order.
+
+    CommandCount - Supplies the number of commands in the array.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    PTEST_BOT_COMMAND Actual;
+    PTEST_BOT_COMMAND Expected;
+    ULONG Index;
+
+    if (TestBot.CommandCount != CommandCount) {
+        printf("Device received %d commands, expected %d.\n",
+               TestBot.CommandCount,
+               CommandCount);
+
+        return 1;
+    }
+
+    for (Index = 0; Index < CommandCount; Index += 1) {
+        Actual = &(TestBot.Commands[Index]);
+        Expected = &(Commands[Index]);
+        if ((Actual->Lun != Expected->Lun) ||
+            (Actual->Operation != Expected->Operation) ||
+            (Actual->Block != Expected->Block) ||
+            (Actual->BlockCount != Expected->BlockCount) ||
+            (Actual->Fault != Expected->Fault)) {
+
+            printf("Command %d was LUN %d op 0x%x block %d count %d fault %d, "
+                   "expected LUN %d op 0x%x block %d count %d fault %d.\n",
+                   Index,
+                   Actual->Lun,
+                   Actual->Operation,
+                   Actual->Block,
+                   Actual->BlockCount,
+                   Actual->Fault,
+                   Expected->Lun,
+                   Expected->Operation,
+                   Expected->Block,
+                   Expected->BlockCount,
+                   Expected->Fault);
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+ULONG
+TestVerifyFinishOrder (
+    PTEST_MASS_IRP *Irps,
+    ULONG IrpCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine checks that the IRPs made it back out of the driver in the
+    given order.
+
+Arguments:
+
+    Irps - Supplies the IRPs in the order they should have finished.
+
+    IrpCount - Supplies the number of IRPs in the array.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    if (TestFinishCount != IrpCount) {
+        printf("%d IRPs finished, expected %d.\n", TestFinishCount, IrpCount);
+        return 1;
+    }
+
+    for (Index = 0; Index < IrpCount; Index += 1) {
+        if (TestFinishOrder[Index] != Irps[Index]->Identifier) {
+            printf("IRP %d finished in position %d, expected IRP %d.\n",
+                   TestFinishOrder[Index],
+                   Index,
+                   Irps[Index]->Identifier);
+
+            return 1;
+        }
+    }
+
+    TestFinishCount = 0;
+    return 0;
+}
+
+ULONG
+TestVerifyIrp (
+    PTEST_MASS_IRP TestIrp,
+    BOOL Success
+    )
+
+/*++
+
+Routine Description:
+
+    This routine checks how an IRP finished. A successful IRP must have moved
+    all of its bytes, and its buffer must match the device's storage.
+
+Arguments:
+
+    TestIrp - Supplies a pointer to the IRP to check.
+
+    Success - Supplies a boolean indicating whether the IRP should have
+        succeeded (TRUE) or failed (FALSE).
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Block;
+    PUCHAR Buffer;
+    ULONG FirstBlock;
+    PIRP_READ_WRITE ReadWrite;
+
+    ReadWrite = &(TestIrp->Irp.U.ReadWrite);
+    if (TestIrp->Finished == FALSE) {
+        printf("IRP %d did not finish.\n", TestIrp->Identifier);
+        return 1;
+    }
+
+    if (Success == FALSE) {
+        if ((KSUCCESS(TestIrp->Irp.Status)) ||
+            (ReadWrite->IoBytesCompleted != 0)) {
+
+            printf("IRP %d should have failed, but finished with %d, 0x%lx "
+                   "bytes.\n",
+                   TestIrp->Identifier,
+                   TestIrp->Irp.Status,
+                   (long)ReadWrite->IoBytesCompleted);
+
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if ((!KSUCCESS(TestIrp->Irp.Status)) ||
+        (ReadWrite->IoBytesCompleted != ReadWrite->IoSizeInBytes)) {
+
+        printf("IRP %d finished with %d, 0x%lx of 0x%lx bytes.\n",
+               TestIrp->Identifier,
+               TestIrp->Irp.Status,
+               (long)ReadWrite->IoBytesCompleted,
+               (long)ReadWrite->IoSizeInBytes);
+
+        return 1;
+    }
+
+    Buffer = ReadWrite->IoBuffer->Fragment[0].VirtualAddress;
+    FirstBlock = ReadWrite->IoOffset / TEST_BOT_BLOCK_SIZE;
+    for (Block = 0;
+         Block < ReadWrite->IoSizeInBytes / TEST_BOT_BLOCK_SIZE;
+         Block += 1) {
+
+        if (memcmp(Buffer + (Block * TEST_BOT_BLOCK_SIZE),
+                   TestBotGetBlock(TestIrp->Lun, FirstBlock + Block),
+                   TEST_BOT_BLOCK_SIZE) != 0) {
+
+            printf("IRP %d block %d does not match LUN %d block %d.\n",
+                   TestIrp->Identifier,
+                   Block,
+                   TestIrp->Lun,
+                   FirstBlock + Block);
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+ULONG
+TestVerifyRecovery (
+    ULONG ResetCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine checks that the device went through the given number of
+    reset recoveries, each a mass storage reset followed by clearing the halt
+    on both bulk endpoints.
+
+Arguments:
+
+    ResetCount - Supplies the number of reset recoveries expected.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    if ((TestBot.ResetCount != ResetCount) ||
+        (TestBot.ClearHaltCount[UsbTransferDirectionIn] != ResetCount) ||
+        (TestBot.ClearHaltCount[UsbTransferDirectionOut] != ResetCount)) {
+
+        printf("Device saw %d resets and %d/%d halts cleared, expected %d.\n",
+               TestBot.ResetCount,
+               TestBot.ClearHaltCount[UsbTransferDirectionIn],
+               TestBot.ClearHaltCount[UsbTransferDirectionOut],
+               ResetCount);
+
+        return 1;
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,272 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    testmass.h
+
+Abstract:
+
+    This header contains definitions for the USB mass storage test and its
+    fake Bulk-Only Transport device.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the endpoints and interface of the fake device.
+//
+
+#define TEST_BOT_IN_ENDPOINT 0x81
+#define TEST_BOT_OUT_ENDPOINT 0x02
+#define TEST_BOT_INTERFACE 0
+
+//
+// Define the geometry of each of the fake device's logical units.
+//
+
+#define TEST_BOT_BLOCK_SHIFT 9
+#define TEST_BOT_BLOCK_SIZE (1 << TEST_BOT_BLOCK_SHIFT)
+#define TEST_BOT_BLOCK_COUNT 1024
+
+//
+// Define the maximum number of logical units and logged commands.
+//
+
+#define TEST_BOT_MAX_LUNS 4
+#define TEST_BOT_MAX_COMMANDS 64
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _TEST_BOT_FAULT {
+    TestBotFaultNone,
+    TestBotFaultShortStatus,
+    TestBotFaultPhaseError
+} TEST_BOT_FAULT, *PTEST_BOT_FAULT;
+
+/*++
+
+Structure Description:
+
+    This structure defines an IRP sent to a USB disk by the test. It stands
+    in for the kernel's internal IRP, tracking what the real I/O manager would
+    track.
+
+Members:
+
+    Irp - Stores the IRP handed to the mass storage driver.
+
+    Identifier - Stores the test's identifier for the IRP.
+
+    Lun - Stores the logical unit the IRP was sent to.
+
+    Pending - Stores a boolean indicating whether the driver pended the IRP
+        and still owns it.
+
+    Complete - Stores a boolean indicating whether the driver completed the
+        IRP.
+
+    Finished - Stores a boolean indicating whether the IRP has made its way
+        back up out of the driver.
+
+--*/
+
+typedef struct _TEST_MASS_IRP {
+    IRP Irp;
+    ULONG Identifier;
+    ULONG Lun;
+    BOOL Pending;
+    BOOL Complete;
+    BOOL Finished;
+} TEST_MASS_IRP, *PTEST_MASS_IRP;
+
+/*++
+
+Structure Description:
+
+    This structure defines a command the fake device received in a command
+    block wrapper.
+
+Members:
+
+    Lun - Stores the logical unit the command was sent to.
+
+    Operation - Stores the SCSI operation code.
+
+    Block - Stores the logical block address of the command.
+
+    BlockCount - Stores the number of blocks the command transfers.
+
+    Fault - Stores the fault the device injected into the command's status
+        stage.
+
+--*/
+
+typedef struct _TEST_BOT_COMMAND {
+    UCHAR Lun;
+    UCHAR Operation;
+    ULONG Block;
+    ULONG BlockCount;
+    TEST_BOT_FAULT Fault;
+} TEST_BOT_COMMAND, *PTEST_BOT_COMMAND;
+
+/*++
+
+Structure Description:
+
+    This structure defines the observable state of the fake device.
+
+Members:
+
+    Commands - Stores the log of commands the device received.
+
+    CommandCount - Stores the number of valid entries in the command log.
+
+    ResetCount - Stores the number of bulk-only mass storage resets the
+        device received.
+
+    ClearHaltCount - Stores the number of endpoint halts cleared on the IN
+        and OUT endpoints, indexed by direction.
+
+    ProtocolErrors - Stores the number of times the host broke the Bulk-Only
+        Transport protocol, like sending a command block wrapper before the
+        previous command's status was read or before reset recovery finished.
+
+--*/
+
+typedef struct _TEST_BOT_STATE {
+    TEST_BOT_COMMAND Commands[TEST_BOT_MAX_COMMANDS];
+    ULONG CommandCount;
+    ULONG ResetCount;
+    ULONG ClearHaltCount[UsbTransferBidirectional];
+    ULONG ProtocolErrors;
+} TEST_BOT_STATE, *PTEST_BOT_STATE;
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+extern TEST_BOT_STATE TestBot;
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+VOID
+TestBotInitialize (
+    ULONG LunCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine resets the fake device, clearing its logical units, its
+    command log, and any faults waiting to be injected.
+
+Arguments:
+
+    LunCount - Supplies the number of logical units the device has.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+TestBotInjectFault (
+    TEST_BOT_FAULT Fault,
+    ULONG Delay,
+    ULONG Count
+    );
+
+/*++
+
+Routine Description:
+
+    This routine arranges for the fake device to break the status stage of
+    upcoming commands.
+
+Arguments:
+
+    Fault - Supplies the fault to inject.
+
+    Delay - Supplies the number of commands to let through before the first
+        fault.
+
+    Count - Supplies the number of consecutive commands to fault.
+
+Return Value:
+
+    None.
+
+--*/
+
+BOOL
+TestBotCompleteTransfer (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the transfer the host has submitted to the fake
+    device, and calls its completion routine.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    TRUE if a transfer was completed.
+
+    FALSE if the host had no transfer submitted.
+
+--*/
+
+PUCHAR
+TestBotGetBlock (
+    ULONG Lun,
+    ULONG Block
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the fake device's storage for a block.
+
+Arguments:
+
+    Lun - Supplies the logical unit.
+
+    Block - Supplies the logical block address.
+
+Return Value:
+
+    Returns a pointer to the block's data.
+
+--*/
+
@@ -32,549 +32,7 @@ Module Name:
 #include <minoca/kernel/driver.h>
 #include <minoca/intrface/disk.h>
 #include <minoca/usb/usb.h>
-
-//
-// --------------------------------------------------------------------- Macros
-//
-
-#define CONVERT_BIG_ENDIAN_TO_CPU32(_Value) \
-    ((((_Value) << 24) & 0xFF000000) |      \
-     (((_Value) << 8) & 0x00FF0000) |       \
-     (((_Value) >> 8) & 0x0000FF00) |       \
-     (((_Value) >> 24) & 0x000000FF))
-
-//
-// ---------------------------------------------------------------- Definitions
-//
-
-//
-// Define the allocation tag used throughout the mass storage driver.
-//
-
-#define USB_MASS_ALLOCATION_TAG 0x4D627355 // 'MbsU'
-
-//
-// Define the interface protocol numbers used by Mass Storage.
-//
-
-#define USB_MASS_BULK_ONLY_PROTOCOL 0x50
-
-//
-// Define the class-specific mass storage request codes.
-//
-
-#define USB_MASS_REQUEST_GET_MAX_LUN  0xFE
-#define USB_MASS_REQUEST_RESET_DEVICE 0xFF
-
-//
-// Define the maximum size of the buffer used for command headers and data
-// transfers.
-//
-
-#define USB_MASS_COMMAND_BUFFER_SIZE 0x200
-#define USB_MASS_MAX_DATA_TRANSFER (64 * 1024)
-
-//
-// Define the limit of how many times the status transfer can be sent when the
-// IN endpoint is stalling.
-//
-
-#define USB_MASS_STATUS_TRANSFER_ATTEMPT_LIMIT 2
-
-//
-// Define the number of times to retry an I/O request before giving up on the
-// IRP.
-//
-
-#define USB_MASS_IO_REQUEST_RETRY_COUNT 3
-
-//
-// Define the SCSI command block and command status signatures.
-//
-
-#define SCSI_COMMAND_BLOCK_SIGNATURE  0x43425355
-#define SCSI_COMMAND_STATUS_SIGNATURE 0x53425355
-
-//
-// Define SCSI result status codes returned in the command status wrapper.
-//
-
-#define SCSI_STATUS_SUCCESS     0x00
-#define SCSI_STATUS_FAILED      0x01
-#define SCSI_STATUS_PHASE_ERROR 0x02
-
-//
-// Define the number of bits the LUN is shifted in most SCSI commands.
-//
-
-#define SCSI_COMMAND_LUN_SHIFT 5
-
-//
-// Define the flags in the command block wrapper.
-//
-
-#define SCSI_COMMAND_BLOCK_FLAG_DATA_IN 0x80
-
-//
-// Define SCSI commands.
-//
-
-#define SCSI_COMMAND_TEST_UNIT_READY        0x00
-#define SCSI_COMMAND_REQUEST_SENSE          0x03
-#define SCSI_COMMAND_INQUIRY                0x12
-#define SCSI_COMMAND_MODE_SENSE_6           0x1A
-#define SCSI_COMMAND_READ_FORMAT_CAPACITIES 0x23
-#define SCSI_COMMAND_READ_CAPACITY          0x25
-#define SCSI_COMMAND_READ_10                0x28
-#define SCSI_COMMAND_WRITE_10               0x2A
-
-//
-// Define command sizes.
-//
-
-#define SCSI_COMMAND_TEST_UNIT_READY_SIZE             12
-#define SCSI_COMMAND_REQUEST_SENSE_SIZE               12
-#define SCSI_COMMAND_INQUIRY_SIZE                     12
-#define SCSI_COMMAND_MODE_SENSE_6_SIZE                6
-#define SCSI_COMMAND_READ_FORMAT_CAPACITIES_SIZE      10
-#define SCSI_COMMAND_READ_CAPACITY_SIZE               10
-#define SCSI_COMMAND_READ_10_SIZE                     12
-#define SCSI_COMMAND_WRITE_10_SIZE                    12
-
-//
-// Define command data sizes.
-//
-
-#define SCSI_COMMAND_REQUEST_SENSE_DATA_SIZE 18
-#define SCSI_COMMAND_READ_FORMAT_CAPACITIES_DATA_SIZE 0xFC
-#define SCSI_COMMAND_MODE_SENSE_6_DATA_SIZE 0xC0
-
-//
-// Define USB Mass storage driver errors that can be reported back to the
-// system.
-//
-
-#define USB_MASS_ERROR_FAILED_RESET_RECOVERY 0x00000001
-
-//
-// Set this flag if the USB mass storage device has claimed an interface.
-//
-
-#define USB_MASS_STORAGE_FLAG_INTERFACE_CLAIMED 0x00000001
-
-//
-// Set this flag if the USB mass storage device owns the paging disk and has
-// prepared the USB core for handling paging.
-//
-
-#define USB_MASS_STORAGE_FLAG_PAGING_ENABLED 0x00000002
-
-//
-// Define the number of times a command is repeated.
-//
-
-#define USB_MASS_RETRY_COUNT 3
-
-//
-// Define the number of seconds to wait to get the capacities information.
-//
-
-#define USB_MASS_READ_CAPACITY_TIMEOUT 5
-
-//
-// Define the number of seconds to wait for the unit to become ready.
-//
-
-#define USB_MASS_UNIT_READY_TIMEOUT 30
-
-//
-// ------------------------------------------------------ Data Type Definitions
-//
-
-typedef enum _USB_MASS_STORAGE_TYPE {
-    UsbMassStorageInvalid,
-    UsbMassStorageDevice,
-    UsbMassStorageLogicalDisk
-} USB_MASS_STORAGE_TYPE, *PUSB_MASS_STORAGE_TYPE;
-
-/*++
-
-Structure Description:
-
-    This structure defines the set of buffers and transfers required to send
-    USB mass storage requests.
-
-Members:
-
-    CommandBuffer - Stores a pointer to an I/O buffer used as scratch space
-        for status and command transfers and small data transfers.
-
-    StatusTransfer - Stores a pointer to the IN USB transfer used for SCSI
-        command status results.
-
-    CommandTransfer - Stores a pointer to the OUT USB transfer used for SCSI
-        commands.
-
-    DataInTransfer - Stores a pointer to the USB transfer used when a
-        command needs to read additional data from the device.
-
-    DataOutTransfer - Stores a pointer to the USB transfer used to write data
-        out to the disk.
-
---*/
-
-typedef struct _USB_MASS_STORAGE_TRANSFERS {
-    PIO_BUFFER CommandBuffer;
-    PUSB_TRANSFER StatusTransfer;
-    PUSB_TRANSFER CommandTransfer;
-    PUSB_TRANSFER DataInTransfer;
-    PUSB_TRANSFER DataOutTransfer;
-} USB_MASS_STORAGE_TRANSFERS, *PUSB_MASS_STORAGE_TRANSFERS;
-
-/*++
-
-Structure Description:
-
-    This structure stores the state necessary to complete polled I/O to a USB
-    mass storage device. It is meant to be used at high run level during
-    critical code paths (e.g. system failure).
-
-Members:
-
-    IoTransfers - Stores a pointer to the set of transfers used to complete
-        I/O requests in polled mode.
-
-    ControlTransfer - Stores a pointer to a control transfer that can be used
-        in polled mode.
-
-    ResetRequired - Stores a boolean indicating if a reset is required on all
-        endpoints before executing polled transfers.
-
---*/
-
-typedef struct _USB_MASS_STORAGE_POLLED_IO_STATE {
-    USB_MASS_STORAGE_TRANSFERS IoTransfers;
-    PUSB_TRANSFER ControlTransfer;
-    BOOL ResetRequired;
-} USB_MASS_STORAGE_POLLED_IO_STATE, *PUSB_MASS_STORAGE_POLLED_IO_STATE;
-
-/*++
-
-Structure Description:
-
-    This structure stores context about a USB Mass storage device.
-
-Members:
-
-    Type - Stores a tag used to differentiate devices from disks.
-
-    ReferenceCount - Stores a reference count for the device.
-
-    UsbCoreHandle - Stores the handle to the device as identified by the USB
-        core library.
-
-    Lock - Stores a pointer to a lock that synchronizes the LUNs' access to the
-        device, and serializes transfers.
-
-    LogicalDiskList - Stores the list of logical disks on this device.
-
-    PolledIoState - Stores a pointer to an optional I/O state used for polled
-        I/O communications with the USB mass storage device during critical
-        code paths.
-
-    LunCount - Stores the maximum number of LUNs on this device.
-
-    InEndpoint - Stores the endpoint number for the bulk IN endpoint.
-
-    OutEndpoint - Stores the endpointer number for the bulk OUT endpoint.
-
-    InterfaceNumber - Stores the USB Mass Storage interface number that this
-        driver instance is attached to.
-
-    Flags - Stores a bitmask of flags for this device.
-        See USB_MASS_STORAGE_FLAG_* for definitions.
-
---*/
-
-typedef struct _USB_MASS_STORAGE_DEVICE {
-    USB_MASS_STORAGE_TYPE Type;
-    volatile ULONG ReferenceCount;
-    HANDLE UsbCoreHandle;
-    PQUEUED_LOCK Lock;
-    LIST_ENTRY LogicalDiskList;
-    volatile PUSB_MASS_STORAGE_POLLED_IO_STATE PolledIoState;
-    UCHAR LunCount;
-    UCHAR InEndpoint;
-    UCHAR OutEndpoint;
-    UCHAR InterfaceNumber;
-    ULONG Flags;
-} USB_MASS_STORAGE_DEVICE, *PUSB_MASS_STORAGE_DEVICE;
-
-/*++
-
-Structure Description:
-
-    This structure stores context about a USB Mass storage logical disk.
-
-Members:
-
-    Type - Stores a tag used to differentiate devices from disks.
-
-    ReferenceCount - Stores a reference count for the disk.
-
-    ListEntry - Stores pointers to the next and previous logical disks in the
-        device.
-
-    OsDevice - Stores a pointer to the OS device.
-
-    Transfers - Stores the default set of transfers used to communicate with
-        the USB mass storage device.
-
-    LunNumber - Stores this logical disk's LUN number (a SCSI term).
-
-    Device - Stores a pointer back to the device that this logical disk lives
-        on.
-
-    IoRequestAttempts - Stores the number of attempts that have been made
-        to complete the current I/O request.
-
-    StatusTransferAttempts - Stores the number of attempts that have been made
-        to receive the status transfer.
-
-    Event - Stores a pointer to an event to wait for in the case of
-        synchronous commands.
-
-    Irp - Stores a pointer to the IRP that the disk is currently serving.
-        Whether this is NULL or non-NULL also serves to tell the callback
-        routine whether to signal the IRP or the event.
-
-    BlockCount - Stores the maximum number of blocks in the device.
-
-    BlockShift - Stores the number of bits to shift to convert from bytes to
-        blocks. This means the block size must be a power of two.
-
-    CurrentFragment - Stores the current fragment number in a long transfer.
-
-    CurrentFragmentOffset - Stores the offset (in bytes) into the current
-        fragment in a long transfer.
-
-    CurrentBytesTransferred - Stores the number of bytes that have been
-        tranferred on behalf of the current I/O IRP.
-
-    Connected - Stores a boolean indicating the disk's connection status.
-
-    DiskInterface - Stores the disk interface published for this disk.
-
---*/
-
-typedef struct _USB_DISK {
-    USB_MASS_STORAGE_TYPE Type;
-    volatile ULONG ReferenceCount;
-    LIST_ENTRY ListEntry;
-    PDEVICE OsDevice;
-    UCHAR LunNumber;
-    PUSB_MASS_STORAGE_DEVICE Device;
-    USB_MASS_STORAGE_TRANSFERS Transfers;
-    ULONG IoRequestAttempts;
-    ULONG StatusTransferAttempts;
-    PKEVENT Event;
-    PIRP Irp;
-    ULONG BlockCount;
-    ULONG BlockShift;
-    UINTN CurrentFragment;
-    UINTN CurrentFragmentOffset;
-    UINTN CurrentBytesTransferred;
-    BOOL Connected;
-    DISK_INTERFACE DiskInterface;
-} USB_DISK, *PUSB_DISK;
-
-/*++
-
-Structure Description:
-
-    This structure defines a SCSI Command Block Wrapper (CBW), which contains
-    the command format used to communicate with disks.
-
-Members:
-
-    Signature - Stores a magic constant value. Use SCSI_COMMAND_BLOCK_SIGNATURE.
-
-    Tag - Stores a unique value used to identify this command among others. The
-        tag value in the ending command status word will be set to this value to
-        signify which command is being acknowledged. The hardware does not
-        interpret this value other than to copy it into the CSW at the end.
-
-    DataTransferLength - Store the number of bytes the host expects to transfer
-        on the Bulk-In or Bulk-Out endpoint (as indicated by the direction bit)
-        during the execution of this command. If this field is zero, the device
-        and host shall transfer no data between the CBW and CSW, and the device
-        shall ignore the value of the Direction bit in the flags.
-
-    Flags - Stores pretty much just one flag, the direction of the transfer
-        (in or out).
-
-    LunNumber - Stores the Logical Unit Number (disk index) to which the
-        command block is being sent.
-
-    CommandLength - Stores the valid length of the Command portion in bytes. The
-        only legcal values are 1 through 16.
-
---*/
-
-#pragma pack(push, 1)
-
-typedef struct _SCSI_COMMAND_BLOCK {
-    ULONG Signature;
-    ULONG Tag;
-    ULONG DataTransferLength;
-    UCHAR Flags;
-    UCHAR LunNumber;
-    UCHAR CommandLength;
-    UCHAR Command[16];
-} PACKED SCSI_COMMAND_BLOCK, *PSCSI_COMMAND_BLOCK;
-
-/*++
-
-Structure Description:
-
-    This structure defines a SCSI Command Status Wrapper (CSW), which is sent
-    by the disk to contain the ending status of the command just sent.
-
-Members:
-
-    Signature - Stores a magic constant value. Use
-        SCSI_COMMAND_STATUS_SIGNATURE.
-
-    Tag - Stores the unique tag value supplied by the host when the command
-        was issued. This allows the host to match up statuses with their
-        corresponding commands
-
-    DataResidue - Stores a value for Data-Out transfers that represents the
-        difference between the amount of data expected as stated in the
-        data transfer length and the actual amount of data processed by the
-        device. For Data-In the device shall report the difference between the
-        amount of data expected as stated in the data transfer length field of
-        the command and the actual amount of relevant data sent by the device.
-        This shall not exceed the value sent in the transfer length.
-
-    Status - Stores the status code representing the result of the procedure.
-        See SCSI_STATUS_* definitions.
-
---*/
-
-typedef struct _SCSI_COMMAND_STATUS {
-    ULONG Signature;
-    ULONG Tag;
-    ULONG DataResidue;
-    UCHAR Status;
-} PACKED SCSI_COMMAND_STATUS, *PSCSI_COMMAND_STATUS;
-
-/*++
-
-Structure Description:
-
-    This structure defines tHe result returned from the device of an INQUIRY
-    command for page 0.
-
-Members:
-
-    PeripheralDeviceType - Stores the device currently connected to the logical
-        unit.
-
-    RemovableFlag - Stores a flag indicating if the device is removable (0x80
-        if removable).
-
-    VersionInformation - Stores the ISO, ECMA, and ANSI versions.
-
-    ResponseDataFormat - Stores the response data format.
-
-    AdditionalLength - Stores 31, the number of additional bytes in the
-        information.
-
-    Reserved - Stores reserved fields that should be set to 0.
-
-    VendorInformation - Stores the vendor ID string.
-
-    ProductInformation - Stores the product ID string.
-
-    ProductRevision - Stores the product revision string, which should be in an
-        "n.nn" type format.
-
-    VendorData - Stores the first byte of the vendor-specific data. Disks like
-        to transmit at least 36 bytes, and get fussy when they can't.
-
---*/
-
-typedef struct _SCSI_INQUIRY_PAGE0 {
-    UCHAR PeripheralDeviceType;
-    UCHAR RemovableFlag;
-    UCHAR VersionInformation;
-    UCHAR ResponseDataFormat;
-    UCHAR AdditionalLength;
-    UCHAR Reserved[2];
-    UCHAR VendorInformation[8];
-    UCHAR ProductInformation[16];
-    UCHAR ProductRevision[4];
-    UCHAR VendorData;
-} PACKED SCSI_INQUIRY_PAGE0, *PSCSI_INQUIRY_PAGE0;
-
-/*++
-
-Structure Description:
-
-    This structure defines tje result returned from the device of a READ
-    FORMAT CAPACITIES command.
-
-Members:
-
-    Reserved - Stores three unused bytes.
-
-    CapacityListLength - Stores the size of the remaining structure (not
-        counting this byte). This value should be at least 8 to contain the
-        rest of this structure.
-
-    BlockCount - Stores the number of blocks on the device.
-
-    DescriptorCode - Stores whether this descriptor defines the maximum
-        formattable capacity for this cartridge, the current media capacity, or
-        the maximum formattable capacity for any cartridge.
-
-    BlockLength - Stores the length of one block, in bytes. This value is
-        commonly 512.
-
---*/
-
-typedef struct _SCSI_FORMAT_CAPACITIES {
-    UCHAR Reserved[3];
-    UCHAR CapacityListLength;
-    ULONG BlockCount;
-    UCHAR DescriptorCode;
-    ULONG BlockLength;
-} PACKED SCSI_FORMAT_CAPACITIES, *PSCSI_FORMAT_CAPACITIES;
-
-/*++
-
-Structure Description:
-
-    This structure defines tje result returned from the device of a READ
-    CAPACITY command.
-
-Members:
-
-    LastValidBlockAddress - Stores the last valid logical block address for
-        media access commands.
-
-    BlockLength - Stores the length of one block, in bytes. This value is
-        commonly 512.
-
---*/
-
-typedef struct _SCSI_CAPACITY {
-    ULONG LastValidBlockAddress;
-    ULONG BlockLength;
-} PACKED SCSI_CAPACITY, *PSCSI_CAPACITY;
-
-#pragma pack(pop)
+#include "usbmass.h"
 
 //
 // ----------------------------------------------- Internal Function Prototypes
@@ -610,13 +68,6 @@ UsbMassDispatchClose (
     PVOID IrpContext
     );
 
-VOID
-UsbMassDispatchIo (
-    PIRP Irp,
-    PVOID DeviceContext,
-    PVOID IrpContext
-    );
-
 VOID
 UsbMassDispatchSystemControl (
     PIRP Irp,
@@ -674,12 +125,6 @@ UsbMasspGetLunCount (
     PUCHAR LunCount
     );
 
-KSTATUS
-UsbMasspCreateLogicalDisks (
-    PUSB_MASS_STORAGE_DEVICE Device,
-    ULONG DiskCount
-    );
-
 VOID
 UsbMasspDestroyLogicalDisks (
     PUSB_MASS_STORAGE_DEVICE Device
@@ -801,6 +246,18 @@ UsbMasspSendNextIoRequest (
     PUSB_DISK Disk
     );
 
+KSTATUS
+UsbMasspStartIrp (
+    PUSB_DISK Disk,
+    PIRP Irp
+    );
+
+VOID
+UsbMasspStartNextIrp (
+    PUSB_MASS_STORAGE_DEVICE Device,
+    PUSB_DISK PreviousDisk
+    );
+
 KSTATUS
 UsbMasspResetRecovery (
     PUSB_MASS_STORAGE_DEVICE Device,
@@ -1005,6 +462,7 @@ Return Value:
     NewDevice->ReferenceCount = 1;
     NewDevice->UsbCoreHandle = INVALID_HANDLE;
     INITIALIZE_LIST_HEAD(&(NewDevice->LogicalDiskList));
+    KeInitializeSpinLock(&(NewDevice->IrpQueueLock));
     NewDevice->Lock = KeCreateQueuedLock();
     if (NewDevice->Lock == NULL) {
         Status = STATUS_INSUFFICIENT_RESOURCES;
@@ -1307,20 +765,17 @@ Return Value:
 {
 
     BOOL CompleteIrp;
+    PUSB_MASS_STORAGE_DEVICE Device;
     PUSB_DISK Disk;
-    PIO_BUFFER_FRAGMENT Fragment;
-    UINTN FragmentIndex;
-    UINTN FragmentOffset;
-    PIO_BUFFER IoBuffer;
-    UINTN IoBufferOffset;
     ULONG IrpReadWriteFlags;
-    BOOL LockHeld;
+    RUNLEVEL OldRunLevel;
     BOOL ReadWriteIrpPrepared;
+    BOOL StartIrp;
     KSTATUS Status;
 
     CompleteIrp = TRUE;
     Disk = (PUSB_DISK)DeviceContext;
-    LockHeld = FALSE;
+    Device = Disk->Device;
     ReadWriteIrpPrepared = FALSE;
 
     ASSERT(Disk->Type == UsbMassStorageLogicalDisk);
@@ -1337,16 +792,15 @@ Return Value:
 
     //
     // If the IRP is on the way up, then clean up after the DMA as this IRP is
-    // still sitting in the channel. An IRP going up is already complete.
+    // still sitting in the channel. An IRP going up is already complete, and
+    // the device has already moved on to the next queued IRP.
     //
 
     if (Irp->Direction != IrpDown) {
         CompleteIrp = FALSE;
 
-        ASSERT(Irp == Disk->Irp);
+        ASSERT(Irp != Disk->Irp);
 
-        Disk->Irp = NULL;
-        KeReleaseQueuedLock(Disk->Device->Lock);
         Status = IoCompleteReadWriteIrp(&(Irp->U.ReadWrite), IrpReadWriteFlags);
         if (!KSUCCESS(Status)) {
             IoUpdateIrpStatus(Irp, Status);
@@ -1357,9 +811,9 @@ Return Value:
         ASSERT(Irp->U.ReadWrite.IoBuffer != NULL);
 
         //
-        // Before acquiring the device's lock and starting the transfer,
-        // prepare the I/O context for USB Mass Storage (i.e. it must use
-        // physical addresses that are less than 4GB and be cache aligned).
+        // Before queuing the IRP, prepare the I/O context for USB Mass
+        // Storage (i.e. it must use physical addresses that are less than 4GB
+        // and be cache aligned).
         //
 
         Status = IoPrepareReadWriteIrp(&(Irp->U.ReadWrite),
@@ -1373,7 +827,6 @@ Return Value:
         }
 
         ReadWriteIrpPrepared = TRUE;
-        IoBuffer = Irp->U.ReadWrite.IoBuffer;
 
         //
         // Map the I/O buffer.
@@ -1381,52 +834,11 @@ Return Value:
         // TODO: Make sure USB Mass does not need the I/O buffer mapped.
         //
 
-        Status = MmMapIoBuffer(IoBuffer, FALSE, FALSE, FALSE);
+        Status = MmMapIoBuffer(Irp->U.ReadWrite.IoBuffer, FALSE, FALSE, FALSE);
         if (!KSUCCESS(Status)) {
             goto DispatchIoEnd;
         }
 
-        //
-        // Find the starting fragment based on the current offset.
-        //
-
-        IoBufferOffset = MmGetIoBufferCurrentOffset(IoBuffer);
-        FragmentIndex = 0;
-        FragmentOffset = 0;
-        while (IoBufferOffset != 0) {
-
-            ASSERT(FragmentIndex < IoBuffer->FragmentCount);
-
-            Fragment = &(IoBuffer->Fragment[FragmentIndex]);
-            if (IoBufferOffset < Fragment->Size) {
-                FragmentOffset = IoBufferOffset;
-                break;
-            }
-
-            IoBufferOffset -= Fragment->Size;
-            FragmentIndex += 1;
-        }
-
-        //
-        // Lock the disk to serialize all I/O access to the device.
-        //
-
-        KeAcquireQueuedLock(Disk->Device->Lock);
-        LockHeld = TRUE;
-        if (Disk->Connected == FALSE) {
-            Status = STATUS_DEVICE_NOT_CONNECTED;
-            goto DispatchIoEnd;
-        }
-
-        //
-        // Otherwise start the I/O on a connected device.
-        //
-
-        Disk->CurrentFragment = FragmentIndex;
-        Disk->CurrentFragmentOffset = FragmentOffset;
-        Disk->CurrentBytesTransferred = 0;
-        Disk->Irp = Irp;
-
         ASSERT(Irp->U.ReadWrite.IoSizeInBytes != 0);
         ASSERT(IS_ALIGNED(Irp->U.ReadWrite.IoSizeInBytes,
                           (1ULL << Disk->BlockShift)));
@@ -1436,34 +848,59 @@ Return Value:
 
         //
         // Pend the IRP first so that the request can't complete in between
-        // submitting it and marking it pended.
+        // submitting it and marking it pended. From here on, failures complete
+        // the pended IRP and the up path cleans up the I/O context.
         //
 
         CompleteIrp = FALSE;
         IoPendIrp(UsbMassDriver, Irp);
 
         //
-        // Fire the first I/O request off to the disk. If this fails, expect to
-        // get called on the way up, as the IRP has already been pended. Thus,
-        // act like the lock is not held and the context was not prepared.
+        // If the device is busy, queue the IRP on the disk. The transfer
+        // completion routine starts it as soon as the device is free, without
+        // waking this thread. Otherwise this IRP takes the device on behalf of
+        // the queues.
         //
 
-        Disk->IoRequestAttempts = 0;
-        Status = UsbMasspSendNextIoRequest(Disk);
+        StartIrp = FALSE;
+        Status = STATUS_SUCCESS;
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Device->IrpQueueLock));
+        if (Disk->Connected == FALSE) {
+            Status = STATUS_DEVICE_NOT_CONNECTED;
+
+        } else if (Device->ActiveDisk == NULL) {
+            Device->ActiveDisk = Disk;
+            StartIrp = TRUE;
+
+        } else {
+            INSERT_BEFORE(&(Irp->ListEntry), &(Disk->IrpQueue));
+        }
+
+        KeReleaseSpinLock(&(Device->IrpQueueLock));
+        KeLowerRunLevel(OldRunLevel);
+
+        //
+        // Lock the device to serialize all I/O access to it, and fire the
+        // first I/O request off to the disk. If the IRP fails to start, hand
+        // the device to the next queued IRP.
+        //
+
+        if (StartIrp != FALSE) {
+            KeAcquireQueuedLock(Device->Lock);
+            Status = UsbMasspStartIrp(Disk, Irp);
+            if (!KSUCCESS(Status)) {
+                UsbMasspStartNextIrp(Device, Disk);
+            }
+        }
+
         if (!KSUCCESS(Status)) {
-            CompleteIrp = TRUE;
-            LockHeld = FALSE;
-            ReadWriteIrpPrepared = FALSE;
-            goto DispatchIoEnd;
+            IoCompleteIrp(UsbMassDriver, Irp, Status);
         }
     }
 
 DispatchIoEnd:
     if (CompleteIrp != FALSE) {
-        if (LockHeld != FALSE) {
-            KeReleaseQueuedLock(Disk->Device->Lock);
-        }
-
         if (ReadWriteIrpPrepared != FALSE) {
             IoCompleteReadWriteIrp(&(Irp->U.ReadWrite), IrpReadWriteFlags);
         }
@@ -2006,6 +1443,8 @@ Return Value:
     // Destroy the lock if necessary.
     //
 
+    ASSERT(Device->ActiveDisk == NULL);
+
     if (Device->Lock != NULL) {
 
         ASSERT(KeIsQueuedLockHeld(Device->Lock) == FALSE);
@@ -2428,12 +1867,18 @@ Return Value:
 
 {
 
+    ULONG Alignment;
+    PIO_BUFFER DataBuffer;
     PUSB_DISK Disk;
     ULONG DiskIndex;
+    ULONG IoBufferFlags;
     KSTATUS Status;
 
     ASSERT(LIST_EMPTY(&(Device->LogicalDiskList)) != FALSE);
 
+    Alignment = MmGetIoBufferAlignment();
+    IoBufferFlags = IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS;
+
     Disk = NULL;
     for (DiskIndex = 0; DiskIndex < DiskCount; DiskIndex += 1) {
         Disk = MmAllocateNonPagedPool(sizeof(USB_DISK),
@@ -2449,6 +1894,7 @@ Return Value:
         Disk->ReferenceCount = 1;
         Disk->LunNumber = DiskIndex;
         Disk->Device = Device;
+        INITIALIZE_LIST_HEAD(&(Disk->IrpQueue));
         UsbMasspDeviceAddReference(Device);
 
         //
@@ -2474,6 +1920,21 @@ Return Value:
             goto CreateLogicalDisksEnd;
         }
 
+        //
+        // Try to create the bounce buffer for fragmented I/O. Without it,
+        // fragmented I/O buffers are just sent in smaller commands.
+        //
+
+        DataBuffer = MmAllocateNonPagedIoBuffer(0,
+                                                MAX_ULONG,
+                                                Alignment,
+                                                USB_MASS_MAX_DATA_TRANSFER,
+                                                IoBufferFlags);
+
+        ASSERT((DataBuffer == NULL) || (DataBuffer->FragmentCount == 1));
+
+        Disk->DataBuffer = DataBuffer;
+
         ASSERT(Disk->Connected == FALSE);
 
         //
@@ -3057,6 +2518,7 @@ Return Value:
 {
 
     PUSB_MASS_STORAGE_DEVICE Device;
+    RUNLEVEL OldRunLevel;
 
     //
     // Tear down the disk interface if it was brought up.
@@ -3080,22 +2542,24 @@ Return Value:
     KeAcquireQueuedLock(Device->Lock);
 
     //
-    // Assert that there is no active IRP.
+    // Assert that there is no active or queued IRP.
     //
 
     ASSERT(Disk->Irp == NULL);
+    ASSERT(LIST_EMPTY(&(Disk->IrpQueue)) != FALSE);
 
     //
-    // Mark the disk as removed to prevent further IO.
+    // Mark the disk as removed to prevent further IO, and remove the disk
+    // from the parent device's list. The IRP queue lock is also held so that
+    // no IRP can be queued on a disk that the queues no longer visit.
     //
 
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Device->IrpQueueLock));
     Disk->Connected = FALSE;
-
-    //
-    // Remove the disk from the parents device list while holding the lock.
-    //
-
     LIST_REMOVE(&(Disk->ListEntry));
+    KeReleaseSpinLock(&(Device->IrpQueueLock));
+    KeLowerRunLevel(OldRunLevel);
     KeReleaseQueuedLock(Device->Lock);
 
     //
@@ -3135,12 +2599,17 @@ Return Value:
     //
 
     ASSERT(Disk->ReferenceCount == 0);
+    ASSERT(LIST_EMPTY(&(Disk->IrpQueue)) != FALSE);
 
     //
     // Destroy all structures that were created.
     //
 
     UsbMasspDestroyTransfers(&(Disk->Transfers));
+    if (Disk->DataBuffer != NULL) {
+        MmFreeIoBuffer(Disk->DataBuffer);
+    }
+
     if (Disk->Event != NULL) {
         KeDestroyEvent(Disk->Event);
     }
@@ -4208,7 +3677,26 @@ Return Value:
                                            FALSE,
                                            &BytesTransferred);
 
-    Disk->CurrentFragmentOffset += BytesTransferred;
+    //
+    // Copy read data out of the bounce buffer if it was used.
+    //
+
+    if ((KSUCCESS(Status)) &&
+        (Disk->DataBufferInUse != FALSE) &&
+        (Irp->MinorCode == IrpMinorIoRead) &&
+        (BytesTransferred != 0)) {
+
+        Status = MmCopyIoBuffer(Irp->U.ReadWrite.IoBuffer,
+                                Disk->CurrentBytesTransferred,
+                                Disk->DataBuffer,
+                                0,
+                                BytesTransferred);
+
+        if (!KSUCCESS(Status)) {
+            BytesTransferred = 0;
+        }
+    }
+
     Disk->CurrentBytesTransferred += BytesTransferred;
 
     ASSERT(Disk->CurrentBytesTransferred <= Irp->U.ReadWrite.IoSizeInBytes);
@@ -4261,6 +3749,13 @@ Return Value:
         Irp->U.ReadWrite.NewIoOffset = Irp->U.ReadWrite.IoOffset +
                                        Irp->U.ReadWrite.IoBytesCompleted;
 
+        //
+        // Start the next queued IRP before completing this one so that the
+        // device does not sit idle while the IRP makes its way back up.
+        //
+
+        Disk->Irp = NULL;
+        UsbMasspStartNextIrp(Disk->Device, Disk);
         IoCompleteIrp(UsbMassDriver, Irp, Status);
     }
 
@@ -4457,7 +3952,10 @@ Return Value:
     PUCHAR CommandBuffer;
     BOOL CommandIn;
     UCHAR CommandLength;
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
     PIO_BUFFER IoBuffer;
+    UINTN IoBufferOffset;
     PIRP Irp;
     PHYSICAL_ADDRESS PhysicalAddress;
     UINTN RequestSize;
@@ -4471,64 +3969,86 @@ Return Value:
     ASSERT(Irp != NULL);
     ASSERT(IoBuffer != NULL);
     ASSERT(Disk->CurrentBytesTransferred < Irp->U.ReadWrite.IoSizeInBytes);
-    ASSERT(Disk->CurrentFragment < IoBuffer->FragmentCount);
-    ASSERT(Disk->CurrentFragmentOffset <=
-           IoBuffer->Fragment[Disk->CurrentFragment].Size);
+
+    Disk->DataBufferInUse = FALSE;
+    BytesToTransfer = Irp->U.ReadWrite.IoSizeInBytes -
+                      Disk->CurrentBytesTransferred;
+
+    if (BytesToTransfer > USB_MASS_MAX_DATA_TRANSFER) {
+        BytesToTransfer = USB_MASS_MAX_DATA_TRANSFER;
+    }
 
     //
-    // Advance to the next fragment if the end of the previous one was reached.
+    // Find the fragment holding the next byte to transfer.
     //
 
-    if (Disk->CurrentFragmentOffset ==
-        IoBuffer->Fragment[Disk->CurrentFragment].Size) {
+    IoBufferOffset = MmGetIoBufferCurrentOffset(IoBuffer) +
+                     Disk->CurrentBytesTransferred;
 
-        Disk->CurrentFragment += 1;
-        Disk->CurrentFragmentOffset = 0;
+    FragmentIndex = 0;
+    while (IoBufferOffset >= IoBuffer->Fragment[FragmentIndex].Size) {
+        IoBufferOffset -= IoBuffer->Fragment[FragmentIndex].Size;
+        FragmentIndex += 1;
 
-        //
-        // End if this was the last fragment.
-        //
+        ASSERT(FragmentIndex < IoBuffer->FragmentCount);
+    }
 
-        if (Disk->CurrentFragment == IoBuffer->FragmentCount) {
+    Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+    PhysicalAddress = Fragment->PhysicalAddress + IoBufferOffset;
+    VirtualAddress = Fragment->VirtualAddress + IoBufferOffset;
+    RequestSize = Fragment->Size - IoBufferOffset;
 
-            ASSERT(Disk->CurrentBytesTransferred ==
-                   Irp->U.ReadWrite.IoSizeInBytes);
+    //
+    // Grow the request across the following fragments as long as they are
+    // both physically and virtually contiguous with it.
+    //
 
-            Status = STATUS_SUCCESS;
-            goto SendNextIoRequestEnd;
+    FragmentIndex += 1;
+    while ((RequestSize < BytesToTransfer) &&
+           (FragmentIndex < IoBuffer->FragmentCount)) {
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        if ((Fragment->PhysicalAddress != PhysicalAddress + RequestSize) ||
+            (Fragment->VirtualAddress != VirtualAddress + RequestSize)) {
+
+            break;
         }
+
+        RequestSize += Fragment->Size;
+        FragmentIndex += 1;
+    }
+
+    if (RequestSize > BytesToTransfer) {
+        RequestSize = BytesToTransfer;
     }
 
     //
-    // Transfer the rest of the fragment, but cap it to the max of what the
-    // allocated USB transfer can do and on how many bytes have already been
-    // transferred and/or need to be transferred.
+    // If the I/O buffer is too fragmented to fill the command, go through the
+    // bounce buffer. Copying the data is much cheaper than the extra
+    // command and status round trips of several small commands.
     //
 
-    RequestSize = IoBuffer->Fragment[Disk->CurrentFragment].Size -
-                  Disk->CurrentFragmentOffset;
-
-    BytesToTransfer = Irp->U.ReadWrite.IoSizeInBytes -
-                      Disk->CurrentBytesTransferred;
-
-    if (BytesToTransfer < RequestSize) {
+    if ((RequestSize < BytesToTransfer) && (Disk->DataBuffer != NULL)) {
         RequestSize = BytesToTransfer;
-    }
+        PhysicalAddress = Disk->DataBuffer->Fragment[0].PhysicalAddress;
+        VirtualAddress = Disk->DataBuffer->Fragment[0].VirtualAddress;
+        Disk->DataBufferInUse = TRUE;
+        if (Irp->MinorCode == IrpMinorIoWrite) {
+            Status = MmCopyIoBuffer(Disk->DataBuffer,
+                                    0,
+                                    IoBuffer,
+                                    Disk->CurrentBytesTransferred,
+                                    RequestSize);
 
-    if (RequestSize > USB_MASS_MAX_DATA_TRANSFER) {
-        RequestSize = USB_MASS_MAX_DATA_TRANSFER;
+            if (!KSUCCESS(Status)) {
+                goto SendNextIoRequestEnd;
+            }
+        }
     }
 
     ASSERT(RequestSize != 0);
     ASSERT(IS_ALIGNED(RequestSize, MmGetIoBufferAlignment()) != FALSE);
 
-    PhysicalAddress =
-                    IoBuffer->Fragment[Disk->CurrentFragment].PhysicalAddress +
-                    Disk->CurrentFragmentOffset;
-
-    VirtualAddress = IoBuffer->Fragment[Disk->CurrentFragment].VirtualAddress +
-                     Disk->CurrentFragmentOffset;
-
     //
     // Compute the block offset and size.
     //
@@ -4607,6 +4127,163 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+UsbMasspStartIrp (
+    PUSB_DISK Disk,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts an I/O IRP on the given disk. This routine assumes the
+    device lock is held on behalf of the IRP queues.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk the IRP was sent to.
+
+    Irp - Supplies a pointer to the pended I/O IRP to start.
+
+Return Value:
+
+    Status code. On failure, the caller is responsible for completing the IRP.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    ASSERT(KeIsQueuedLockHeld(Disk->Device->Lock) != FALSE);
+    ASSERT(Disk->Irp == NULL);
+
+    if (Disk->Connected == FALSE) {
+        return STATUS_DEVICE_NOT_CONNECTED;
+    }
+
+    Disk->CurrentBytesTransferred = 0;
+    Disk->IoRequestAttempts = 0;
+    Disk->Irp = Irp;
+    Status = UsbMasspSendNextIoRequest(Disk);
+    if (!KSUCCESS(Status)) {
+        Disk->Irp = NULL;
+    }
+
+    return Status;
+}
+
+VOID
+UsbMasspStartNextIrp (
+    PUSB_MASS_STORAGE_DEVICE Device,
+    PUSB_DISK PreviousDisk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands the device to the next queued I/O IRP. The logical
+    disks are served round-robin so that a busy LUN cannot starve the others.
+    If no IRPs are queued, the device lock is released. This routine assumes
+    the device lock is held on behalf of the IRP queues.
+
+Arguments:
+
+    Device - Supplies a pointer to the mass storage device.
+
+    PreviousDisk - Supplies a pointer to the disk that was last served. This
+        disk may have already been removed from the device's list.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PUSB_DISK Disk;
+    PUSB_DISK FirstDisk;
+    PIRP Irp;
+    UCHAR LunNumber;
+    PUSB_DISK NextDisk;
+    RUNLEVEL OldRunLevel;
+    KSTATUS Status;
+
+    ASSERT(KeIsQueuedLockHeld(Device->Lock) != FALSE);
+
+    LunNumber = PreviousDisk->LunNumber;
+    while (TRUE) {
+        FirstDisk = NULL;
+        Irp = NULL;
+        NextDisk = NULL;
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Device->IrpQueueLock));
+
+        //
+        // Find the first disk after the previous one with a queued IRP,
+        // wrapping around to the start of the list. The list is in LUN order.
+        //
+
+        CurrentEntry = Device->LogicalDiskList.Next;
+        while (CurrentEntry != &(Device->LogicalDiskList)) {
+            Disk = LIST_VALUE(CurrentEntry, USB_DISK, ListEntry);
+            CurrentEntry = CurrentEntry->Next;
+            if (LIST_EMPTY(&(Disk->IrpQueue)) != FALSE) {
+                continue;
+            }
+
+            if (FirstDisk == NULL) {
+                FirstDisk = Disk;
+            }
+
+            if (Disk->LunNumber > LunNumber) {
+                NextDisk = Disk;
+                break;
+            }
+        }
+
+        if (NextDisk == NULL) {
+            NextDisk = FirstDisk;
+        }
+
+        //
+        // If nothing is queued, the device goes idle. Release the device lock
+        // with the queue lock still held so that the lock is free by the time
+        // another IRP can take the device.
+        //
+
+        if (NextDisk == NULL) {
+            Device->ActiveDisk = NULL;
+            KeReleaseQueuedLock(Device->Lock);
+
+        } else {
+            Irp = LIST_VALUE(NextDisk->IrpQueue.Next, IRP, ListEntry);
+            LIST_REMOVE(&(Irp->ListEntry));
+            Device->ActiveDisk = NextDisk;
+        }
+
+        KeReleaseSpinLock(&(Device->IrpQueueLock));
+        KeLowerRunLevel(OldRunLevel);
+        if (Irp == NULL) {
+            break;
+        }
+
+        Status = UsbMasspStartIrp(NextDisk, Irp);
+        if (KSUCCESS(Status)) {
+            break;
+        }
+
+        IoCompleteIrp(UsbMassDriver, Irp, Status);
+        LunNumber = NextDisk->LunNumber;
+    }
+
+    return;
+}
+
 KSTATUS
 UsbMasspResetRecovery (
     PUSB_MASS_STORAGE_DEVICE Device,
@@ -0,0 +1,649 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    usbmass.h
+
+Abstract:
+
+    This header contains internal definitions for the USB Mass Storage driver.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+#define CONVERT_BIG_ENDIAN_TO_CPU32(_Value) \
+    ((((_Value) << 24) & 0xFF000000) |      \
+     (((_Value) << 8) & 0x00FF0000) |       \
+     (((_Value) >> 8) & 0x0000FF00) |       \
+     (((_Value) >> 24) & 0x000000FF))
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the allocation tag used throughout the mass storage driver.
+//
+
+#define USB_MASS_ALLOCATION_TAG 0x4D627355 // 'MbsU'
+
+//
+// Define the interface protocol numbers used by Mass Storage.
+//
+
+#define USB_MASS_BULK_ONLY_PROTOCOL 0x50
+
+//
+// Define the class-specific mass storage request codes.
+//
+
+#define USB_MASS_REQUEST_GET_MAX_LUN  0xFE
+#define USB_MASS_REQUEST_RESET_DEVICE 0xFF
+
+//
+// Define the maximum size of the buffer used for command headers and data
+// transfers.
+//
+
+#define USB_MASS_COMMAND_BUFFER_SIZE 0x200
+#define USB_MASS_MAX_DATA_TRANSFER (128 * 1024)
+
+//
+// Define the limit of how many times the status transfer can be sent when the
+// IN endpoint is stalling.
+//
+
+#define USB_MASS_STATUS_TRANSFER_ATTEMPT_LIMIT 2
+
+//
+// Define the number of times to retry an I/O request before giving up on the
+// IRP.
+//
+
+#define USB_MASS_IO_REQUEST_RETRY_COUNT 3
+
+//
+// Define the SCSI command block and command status signatures.
+//
+
+#define SCSI_COMMAND_BLOCK_SIGNATURE  0x43425355
+#define SCSI_COMMAND_STATUS_SIGNATURE 0x53425355
+
+//
+// Define SCSI result status codes returned in the command status wrapper.
+//
+
+#define SCSI_STATUS_SUCCESS     0x00
+#define SCSI_STATUS_FAILED      0x01
+#define SCSI_STATUS_PHASE_ERROR 0x02
+
+//
+// Define the number of bits the LUN is shifted in most SCSI commands.
+//
+
+#define SCSI_COMMAND_LUN_SHIFT 5
+
+//
+// Define the flags in the command block wrapper.
+//
+
+#define SCSI_COMMAND_BLOCK_FLAG_DATA_IN 0x80
+
+//
+// Define SCSI commands.
+//
+
+#define SCSI_COMMAND_TEST_UNIT_READY        0x00
+#define SCSI_COMMAND_REQUEST_SENSE          0x03
+#define SCSI_COMMAND_INQUIRY                0x12
+#define SCSI_COMMAND_MODE_SENSE_6           0x1A
+#define SCSI_COMMAND_READ_FORMAT_CAPACITIES 0x23
+#define SCSI_COMMAND_READ_CAPACITY          0x25
+#define SCSI_COMMAND_READ_10                0x28
+#define SCSI_COMMAND_WRITE_10               0x2A
+
+//
+// Define command sizes.
+//
+
+#define SCSI_COMMAND_TEST_UNIT_READY_SIZE             12
+#define SCSI_COMMAND_REQUEST_SENSE_SIZE               12
+#define SCSI_COMMAND_INQUIRY_SIZE                     12
+#define SCSI_COMMAND_MODE_SENSE_6_SIZE                6
+#define SCSI_COMMAND_READ_FORMAT_CAPACITIES_SIZE      10
+#define SCSI_COMMAND_READ_CAPACITY_SIZE               10
+#define SCSI_COMMAND_READ_10_SIZE                     12
+#define SCSI_COMMAND_WRITE_10_SIZE                    12
+
+//
+// Define command data sizes.
+//
+
+#define SCSI_COMMAND_REQUEST_SENSE_DATA_SIZE 18
+#define SCSI_COMMAND_READ_FORMAT_CAPACITIES_DATA_SIZE 0xFC
+#define SCSI_COMMAND_MODE_SENSE_6_DATA_SIZE 0xC0
+
+//
+// Define USB Mass storage driver errors that can be reported back to the
+// system.
+//
+
+#define USB_MASS_ERROR_FAILED_RESET_RECOVERY 0x00000001
+
+//
+// Set this flag if the USB mass storage device has claimed an interface.
+//
+
+#define USB_MASS_STORAGE_FLAG_INTERFACE_CLAIMED 0x00000001
+
+//
+// Set this flag if the USB mass storage device owns the paging disk and has
+// prepared the USB core for handling paging.
+//
+
+#define USB_MASS_STORAGE_FLAG_PAGING_ENABLED 0x00000002
+
+//
+// Define the number of times a command is repeated.
+//
+
+#define USB_MASS_RETRY_COUNT 3
+
+//
+// Define the number of seconds to wait to get the capacities information.
+//
+
+#define USB_MASS_READ_CAPACITY_TIMEOUT 5
+
+//
+// Define the number of seconds to wait for the unit to become ready.
+//
+
+#define USB_MASS_UNIT_READY_TIMEOUT 30
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _USB_MASS_STORAGE_TYPE {
+    UsbMassStorageInvalid,
+    UsbMassStorageDevice,
+    UsbMassStorageLogicalDisk
+} USB_MASS_STORAGE_TYPE, *PUSB_MASS_STORAGE_TYPE;
+
+/*++
+
+Structure Description:
+
+    This structure defines the set of buffers and transfers required to send
+    USB mass storage requests.
+
+Members:
+
+    CommandBuffer - Stores a pointer to an I/O buffer used as scratch space
+        for status and command transfers and small data transfers.
+
+    StatusTransfer - Stores a pointer to the IN USB transfer used for SCSI
+        command status results.
+
+    CommandTransfer - Stores a pointer to the OUT USB transfer used for SCSI
+        commands.
+
+    DataInTransfer - Stores a pointer to the USB transfer used when a
+        command needs to read additional data from the device.
+
+    DataOutTransfer - Stores a pointer to the USB transfer used to write data
+        out to the disk.
+
+--*/
+
+typedef struct _USB_MASS_STORAGE_TRANSFERS {
+    PIO_BUFFER CommandBuffer;
+    PUSB_TRANSFER StatusTransfer;
+    PUSB_TRANSFER CommandTransfer;
+    PUSB_TRANSFER DataInTransfer;
+    PUSB_TRANSFER DataOutTransfer;
+} USB_MASS_STORAGE_TRANSFERS, *PUSB_MASS_STORAGE_TRANSFERS;
+
+/*++
+
+Structure Description:
+
+    This structure stores the state necessary to complete polled I/O to a USB
+    mass storage device. It is meant to be used at high run level during
+    critical code paths (e.g. system failure).
+
+Members:
+
+    IoTransfers - Stores a pointer to the set of transfers used to complete
+        I/O requests in polled mode.
+
+    ControlTransfer - Stores a pointer to a control transfer that can be used
+        in polled mode.
+
+    ResetRequired - Stores a boolean indicating if a reset is required on all
+        endpoints before executing polled transfers.
+
+--*/
+
+typedef struct _USB_MASS_STORAGE_POLLED_IO_STATE {
+    USB_MASS_STORAGE_TRANSFERS IoTransfers;
+    PUSB_TRANSFER ControlTransfer;
+    BOOL ResetRequired;
+} USB_MASS_STORAGE_POLLED_IO_STATE, *PUSB_MASS_STORAGE_POLLED_IO_STATE;
+
+/*++
+
+Structure Description:
+
+    This structure stores context about a USB Mass storage device.
+
+Members:
+
+    Type - Stores a tag used to differentiate devices from disks.
+
+    ReferenceCount - Stores a reference count for the device.
+
+    UsbCoreHandle - Stores the handle to the device as identified by the USB
+        core library.
+
+    Lock - Stores a pointer to a lock that synchronizes the LUNs' access to the
+        device, and serializes transfers.
+
+    LogicalDiskList - Stores the list of logical disks on this device.
+
+    IrpQueueLock - Stores a spin lock that protects the logical disks' IRP
+        queues and the active disk.
+
+    ActiveDisk - Stores a pointer to the logical disk whose IRP is being
+        serviced, or NULL if no IRPs are running. While this is set, the
+        device lock is held on behalf of the IRP queues.
+
+    PolledIoState - Stores a pointer to an optional I/O state used for polled
+        I/O communications with the USB mass storage device during critical
+        code paths.
+
+    LunCount - Stores the maximum number of LUNs on this device.
+
+    InEndpoint - Stores the endpoint number for the bulk IN endpoint.
+
+    OutEndpoint - Stores the endpointer number for the bulk OUT endpoint.
+
+    InterfaceNumber - Stores the USB Mass Storage interface number that this
+        driver instance is attached to.
+
+    Flags - Stores a bitmask of flags for this device.
+        See USB_MASS_STORAGE_FLAG_* for definitions.
+
+--*/
+
+typedef struct _USB_MASS_STORAGE_DEVICE {
+    USB_MASS_STORAGE_TYPE Type;
+    volatile ULONG ReferenceCount;
+    HANDLE UsbCoreHandle;
+    PQUEUED_LOCK Lock;
+    LIST_ENTRY LogicalDiskList;
+    KSPIN_LOCK IrpQueueLock;
+    struct _USB_DISK *ActiveDisk;
+    volatile PUSB_MASS_STORAGE_POLLED_IO_STATE PolledIoState;
+    UCHAR LunCount;
+    UCHAR InEndpoint;
+    UCHAR OutEndpoint;
+    UCHAR InterfaceNumber;
+    ULONG Flags;
+} USB_MASS_STORAGE_DEVICE, *PUSB_MASS_STORAGE_DEVICE;
+
+/*++
+
+Structure Description:
+
+    This structure stores context about a USB Mass storage logical disk.
+
+Members:
+
+    Type - Stores a tag used to differentiate devices from disks.
+
+    ReferenceCount - Stores a reference count for the disk.
+
+    ListEntry - Stores pointers to the next and previous logical disks in the
+        device.
+
+    OsDevice - Stores a pointer to the OS device.
+
+    Transfers - Stores the default set of transfers used to communicate with
+        the USB mass storage device.
+
+    LunNumber - Stores this logical disk's LUN number (a SCSI term).
+
+    Device - Stores a pointer back to the device that this logical disk lives
+        on.
+
+    IoRequestAttempts - Stores the number of attempts that have been made
+        to complete the current I/O request.
+
+    StatusTransferAttempts - Stores the number of attempts that have been made
+        to receive the status transfer.
+
+    Event - Stores a pointer to an event to wait for in the case of
+        synchronous commands.
+
+    Irp - Stores a pointer to the IRP that the disk is currently serving.
+        Whether this is NULL or non-NULL also serves to tell the callback
+        routine whether to signal the IRP or the event.
+
+    BlockCount - Stores the maximum number of blocks in the device.
+
+    BlockShift - Stores the number of bits to shift to convert from bytes to
+        blocks. This means the block size must be a power of two.
+
+    IrpQueue - Stores the list of I/O IRPs waiting for the device. This is
+        protected by the device's IRP queue lock.
+
+    DataBuffer - Stores an optional physically contiguous bounce buffer used
+        to transfer fragmented I/O buffers in full sized commands.
+
+    DataBufferInUse - Stores a boolean indicating whether the current I/O
+        request is going through the bounce buffer.
+
+    CurrentBytesTransferred - Stores the number of bytes that have been
+        tranferred on behalf of the current I/O IRP.
+
+    Connected - Stores a boolean indicating the disk's connection status.
+
+    DiskInterface - Stores the disk interface published for this disk.
+
+--*/
+
+typedef struct _USB_DISK {
+    USB_MASS_STORAGE_TYPE Type;
+    volatile ULONG ReferenceCount;
+    LIST_ENTRY ListEntry;
+    PDEVICE OsDevice;
+    UCHAR LunNumber;
+    PUSB_MASS_STORAGE_DEVICE Device;
+    USB_MASS_STORAGE_TRANSFERS Transfers;
+    ULONG IoRequestAttempts;
+    ULONG StatusTransferAttempts;
+    PKEVENT Event;
+    PIRP Irp;
+    ULONG BlockCount;
+    ULONG BlockShift;
+    LIST_ENTRY IrpQueue;
+    PIO_BUFFER DataBuffer;
+    BOOL DataBufferInUse;
+    UINTN CurrentBytesTransferred;
+    BOOL Connected;
+    DISK_INTERFACE DiskInterface;
+} USB_DISK, *PUSB_DISK;
+
+/*++
+
+Structure Description:
+
+    This structure defines a SCSI Command Block Wrapper (CBW), which contains
+    the command format used to communicate with disks.
+
+Members:
+
+    Signature - Stores a magic constant value. Use SCSI_COMMAND_BLOCK_SIGNATURE.
+
+    Tag - Stores a unique value used to identify this command among others. The
+        tag value in the ending command status word will be set to this value to
+        signify which command is being acknowledged. The hardware does not
+        interpret this value other than to copy it into the CSW at the end.
+
+    DataTransferLength - Store the number of bytes the host expects to transfer
+        on the Bulk-In or Bulk-Out endpoint (as indicated by the direction bit)
+        during the execution of this command. If this field is zero, the device
+        and host shall transfer no data between the CBW and CSW, and the device
+        shall ignore the value of the Direction bit in the flags.
+
+    Flags - Stores pretty much just one flag, the direction of the transfer
+        (in or out).
+
+    LunNumber - Stores the Logical Unit Number (disk index) to which the
+        command block is being sent.
+
+    CommandLength - Stores the valid length of the Command portion in bytes. The
+        only legcal values are 1 through 16.
+
+--*/
+
+#pragma pack(push, 1)
+
+typedef struct _SCSI_COMMAND_BLOCK {
+    ULONG Signature;
+    ULONG Tag;
+    ULONG DataTransferLength;
+    UCHAR Flags;
+    UCHAR LunNumber;
+    UCHAR CommandLength;
+    UCHAR Command[16];
+} PACKED SCSI_COMMAND_BLOCK, *PSCSI_COMMAND_BLOCK;
+
+/*++
+
+Structure Description:
+
+    This structure defines a SCSI Command Status Wrapper (CSW), which is sent
+    by the disk to contain the ending status of the command just sent.
+
+Members:
+
+    Signature - Stores a magic constant value. Use
+        SCSI_COMMAND_STATUS_SIGNATURE.
+
+    Tag - Stores the unique tag value supplied by the host when the command
+        was issued. This allows the host to match up statuses with their
+        corresponding commands
+
+    DataResidue - Stores a value for Data-Out transfers that represents the
+        difference between the amount of data expected as stated in the
+        data transfer length and the actual amount of data processed by the
+        device. For Data-In the device shall report the difference between the
+        amount of data expected as stated in the data transfer length field of
+        the command and the actual amount of relevant data sent by the device.
+        This shall not exceed the value sent in the transfer length.
+
+    Status - Stores the status code representing the result of the procedure.
+        See SCSI_STATUS_* definitions.
+
+--*/
+
+typedef struct _SCSI_COMMAND_STATUS {
+    ULONG Signature;
+    ULONG Tag;
+    ULONG DataResidue;
+    UCHAR Status;
+} PACKED SCSI_COMMAND_STATUS, *PSCSI_COMMAND_STATUS;
+
+/*++
+
+Structure Description:
+
+    This structure defines tHe result returned from the device of an INQUIRY
+    command for page 0.
+
+Members:
+
+    PeripheralDeviceType - Stores the device currently connected to the logical
+        unit.
+
+    RemovableFlag - Stores a flag indicating if the device is removable (0x80
+        if removable).
+
+    VersionInformation - Stores the ISO, ECMA, and ANSI versions.
+
+    ResponseDataFormat - Stores the response data format.
+
+    AdditionalLength - Stores 31, the number of additional bytes in the
+        information.
+
+    Reserved - Stores reserved fields that should be set to 0.
+
+    VendorInformation - Stores the vendor ID string.
+
+    ProductInformation - Stores the product ID string.
+
+    ProductRevision - Stores the product revision string, which should be in an
+        "n.nn" type format.
+
+    VendorData - Stores the first byte of the vendor-specific data. Disks like
+        to transmit at least 36 bytes, and get fussy when they can't.
+
+--*/
+
+typedef struct _SCSI_INQUIRY_PAGE0 {
+    UCHAR PeripheralDeviceType;
+    UCHAR RemovableFlag;
+    UCHAR VersionInformation;
+    UCHAR ResponseDataFormat;
+    UCHAR AdditionalLength;
+    UCHAR Reserved[2];
+    UCHAR VendorInformation[8];
+    UCHAR ProductInformation[16];
+    UCHAR ProductRevision[4];
+    UCHAR VendorData;
+} PACKED SCSI_INQUIRY_PAGE0, *PSCSI_INQUIRY_PAGE0;
+
+/*++
+
+Structure Description:
+
+    This structure defines tje result returned from the device of a READ
+    FORMAT CAPACITIES command.
+
+Members:
+
+    Reserved - Stores three unused bytes.
+
+    CapacityListLength - Stores the size of the remaining structure (not
+        counting this byte). This value should be at least 8 to contain the
+        rest of this structure.
+
+    BlockCount - Stores the number of blocks on the device.
+
+    DescriptorCode - Stores whether this descriptor defines the maximum
+        formattable capacity for this cartridge, the current media capacity, or
+        the maximum formattable capacity for any cartridge.
+
+    BlockLength - Stores the length of one block, in bytes. This value is
+        commonly 512.
+
+--*/
+
+typedef struct _SCSI_FORMAT_CAPACITIES {
+    UCHAR Reserved[3];
+    UCHAR CapacityListLength;
+    ULONG BlockCount;
+    UCHAR DescriptorCode;
+    ULONG BlockLength;
+} PACKED SCSI_FORMAT_CAPACITIES, *PSCSI_FORMAT_CAPACITIES;
+
+/*++
+
+Structure Description:
+
+    This structure defines tje result returned from the device of a READ
+    CAPACITY command.
+
+Members:
+
+    LastValidBlockAddress - Stores the last valid logical block address for
+        media access commands.
+
+    BlockLength - Stores the length of one block, in bytes. This value is
+        commonly 512.
+
+--*/
+
+typedef struct _SCSI_CAPACITY {
+    ULONG LastValidBlockAddress;
+    ULONG BlockLength;
+} PACKED SCSI_CAPACITY, *PSCSI_CAPACITY;
+
+#pragma pack(pop)
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+extern PDRIVER UsbMassDriver;
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+VOID
+UsbMassDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+/*++
+
+Routine Description:
+
+    This routine handles I/O IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+UsbMasspCreateLogicalDisks (
+    PUSB_MASS_STORAGE_DEVICE Device,
+    ULONG DiskCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a number of logical disks to live under the given
+    mass storage device. These disks will be added to the device.
+
+Arguments:
+
+    Device - Supplies a pointer to this mass storage device.
+
+    DiskCount - Supplies the number of logical disks to create.
+
+Return Value:
+
+    Status code.
+
+--*/
+
@@ -0,0 +1,111 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    cow.h
+
+Abstract:
+
+    This header contains definitions for copy-on-write overlay devices, which
+    redirect writes to a block device into memory so that the device can be
+    reset to its original contents instantly.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define COW_DEVICE_INFORMATION_UUID \
+    {{0x5F3A8C21, 0x7E4B11F1, 0x9A2D0242, 0xAC120003}}
+
+#define COW_DEVICE_INFORMATION_VERSION 0x00010000
+
+//
+// This flag is set if an overlay is active on the device.
+//
+
+#define COW_FLAG_ACTIVE 0x00000001
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _COW_OPERATION {
+    CowOperationNone,
+    CowOperationCreate,
+    CowOperationReset,
+    CowOperationDiscard
+} COW_OPERATION, *PCOW_OPERATION;
+
+/*++
+
+Structure Description:
+
+    This structure stores the device information published by a device that
+    supports copy-on-write overlays. Setting this information performs the
+    given operation and returns the resulting state. Operations fail with
+    STATUS_RESOURCE_IN_USE while the device is open (e.g. mounted).
+
+Members:
+
+    Version - Stores the table version. Future revisions will be backwards
+        compatible. Set to COW_DEVICE_INFORMATION_VERSION.
+
+    Operation - Stores the operation to perform on a set request:
+
+        CowOperationCreate starts a new, empty overlay. From then on writes
+        go to memory and the underlying device is left untouched.
+
+        CowOperationReset throws away everything written to the overlay,
+        returning the device to its contents when the overlay was created. The
+        overlay stays active.
+
+        CowOperationDiscard throws away the overlay and its contents, and lets
+        writes go to the underlying device again.
+
+    Flags - Stores a bitmask of flags. See COW_FLAG_* for definitions.
+
+    BlockSize - Stores the block size of the device, in bytes.
+
+    Capacity - Stores the size of the device, in bytes.
+
+    OverlaySize - Stores the number of bytes of memory holding overlay data.
+
+    OverlayLimit - Stores the maximum number of bytes of memory the overlay
+        can use. Writes that need more memory fail.
+
+--*/
+
+typedef struct _COW_DEVICE_INFORMATION {
+    ULONG Version;
+    COW_OPERATION Operation;
+    ULONG Flags;
+    ULONG BlockSize;
+    ULONGLONG Capacity;
+    ULONGLONG OverlaySize;
+    ULONGLONG OverlayLimit;
+} COW_DEVICE_INFORMATION, *PCOW_DEVICE_INFORMATION;
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
@@ -0,0 +1,129 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ramdisk.h
+
+Abstract:
+
+    This header contains definitions for controlling RAM disks, including
+    creating and destroying dynamic RAM disks at runtime.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the device ID of the RAM disk control device. Create and destroy
+// requests are sent to this device, which shows up as /Device/RamDiskControl.
+//
+
+#define RAM_DISK_CONTROL_DEVICE_ID "RamDiskControl"
+
+#define RAM_DISK_DESCRIPTION_VERSION 0x00010000
+
+//
+// This flag is set if the RAM disk is a dynamic RAM disk, whose memory is
+// allocated as it is written and freed as it is discarded. RAM disks handed
+// over by the boot environment are not dynamic.
+//
+
+#define RAM_DISK_FLAG_DYNAMIC 0x00000001
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// Define the RAM disk user control (IOCTL) codes. Create and destroy are sent
+// to the control device, the others are sent to an open RAM disk.
+//
+
+typedef enum _RAM_DISK_CONTROL {
+    RamDiskControlCreate = 0x5200,
+    RamDiskControlDestroy = 0x5201,
+    RamDiskControlGetInformation = 0x5202,
+    RamDiskControlDiscard = 0x5203,
+} RAM_DISK_CONTROL, *PRAM_DISK_CONTROL;
+
+/*++
+
+Structure Description:
+
+    This structure describes a RAM disk. It is passed in and out of the create,
+    destroy, and get information requests.
+
+Members:
+
+    Version - Stores the structure version. Set to
+        RAM_DISK_DESCRIPTION_VERSION.
+
+    Identifier - Stores the RAM disk number. The disk's device ID is "RamDisk"
+        followed by this number in hex. This is returned by create, and
+        supplied to destroy.
+
+    Flags - Stores a bitmask of flags. See RAM_DISK_FLAG_* for definitions.
+
+    Size - Stores the size of the RAM disk in bytes. This is supplied to
+        create, and is rounded up to a page. Create fails if this is more
+        than half of physical memory.
+
+    AllocatedSize - Stores the number of bytes of memory currently backing the
+        disk.
+
+--*/
+
+typedef struct _RAM_DISK_DESCRIPTION {
+    ULONG Version;
+    ULONG Identifier;
+    ULONG Flags;
+    ULONGLONG Size;
+    ULONGLONG AllocatedSize;
+} RAM_DISK_DESCRIPTION, *PRAM_DISK_DESCRIPTION;
+
+/*++
+
+Structure Description:
+
+    This structure describes a region of a dynamic RAM disk whose contents are
+    no longer needed. Whole pages in the region are freed, and any partial
+    pages are zeroed. The region reads back as zeroes.
+
+Members:
+
+    Offset - Stores the byte offset of the region. This must be sector aligned.
+
+    Size - Stores the size of the region in bytes. This must be sector aligned.
+
+--*/
+
+typedef struct _RAM_DISK_DISCARD {
+    ULONGLONG Offset;
+    ULONGLONG Size;
+} RAM_DISK_DISCARD, *PRAM_DISK_DISCARD;
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
@@ -40,6 +40,8 @@ Module Name:
 #define SSDT_SIGNATURE 0x54445353 // 'SSDT'
 #define DBG2_SIGNATURE 0x32474244 // 'DBG2'
 #define GTDT_SIGNATURE 0x54445447 // 'GTDT'
+#define SRAT_SIGNATURE 0x54415253 // 'SRAT'
+#define SLIT_SIGNATURE 0x54494C53 // 'SLIT'
 
 #define ACPI_20_RSDP_REVISION 0x02
 #define ACPI_30_RSDT_REVISION 0x01
@@ -76,6 +78,13 @@ typedef enum _MADT_ENTRY_TYPE {
     MadtEntryTypeGicDistributor           = 0xC,
 } MADT_ENTRY_TYPE, *PMADT_ENTRY_TYPE;
 
+typedef enum _SRAT_ENTRY_TYPE {
+    SratEntryTypeLocalApicAffinity   = 0x0,
+    SratEntryTypeMemoryAffinity      = 0x1,
+    SratEntryTypeLocalX2ApicAffinity = 0x2,
+    SratEntryTypeGiccAffinity        = 0x3,
+} SRAT_ENTRY_TYPE, *PSRAT_ENTRY_TYPE;
+
 //
 // Define the frequency of the ACPI PM timer.
 //
@@ -779,6 +788,23 @@ typedef enum _MADT_ENTRY_TYPE {
 #define GTDT_TIMER_FLAG_INTERRUPT_POLARITY_ACTIVE_LOW  0x00000002
 #define GTDT_TIMER_FLAG_INTERRUPT_POLARITY_ACTIVE_HIGH 0x00000000
 
+//
+// Define the SRAT affinity structure flags. The enabled flag has the same
+// value for the processor and memory affinity structures.
+//
+
+#define SRAT_AFFINITY_FLAG_ENABLED             0x00000001
+#define SRAT_MEMORY_AFFINITY_FLAG_HOT_PLUGGABLE 0x00000002
+#define SRAT_MEMORY_AFFINITY_FLAG_NON_VOLATILE  0x00000004
+
+//
+// Define the normalized SLIT distance from a locality to itself, and the
+// distance assumed between two different localities when there is no SLIT.
+//
+
+#define SLIT_LOCAL_DISTANCE 10
+#define SLIT_DEFAULT_REMOTE_DISTANCE 20
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -1666,6 +1692,228 @@ typedef struct _GTDT {
     ULONG NonSecurePl2Flags;
 } PACKED GTDT, *PGTDT;
 
+/*++
+
+Structure Description:
+
+    This structure describes the System Resource Affinity Table, which
+    associates processors and memory ranges with proximity domains.
+
+Members:
+
+    Header - Stores the table header, including the signature 'SRAT'.
+
+    Reserved1 - Stores a reserved value that must be set to 1 for backwards
+        compatibility.
+
+    Reserved2 - Stores a reserved value.
+
+    AffinityStructures - Stores the list of static resource allocation
+        structures. See SRAT_ENTRY_TYPE.
+
+--*/
+
+typedef struct _SRAT {
+    DESCRIPTION_HEADER Header;
+    ULONG Reserved1;
+    ULONGLONG Reserved2;
+    // AffinityStructures[n].
+} PACKED SRAT, *PSRAT;
+
+/*++
+
+Structure Description:
+
+    This structure describes the common header of each entry in the SRAT.
+
+Members:
+
+    Type - Stores the type of entry. See SRAT_ENTRY_TYPE.
+
+    Length - Stores the size of the entry, in bytes.
+
+--*/
+
+typedef struct _SRAT_GENERIC_ENTRY {
+    UCHAR Type;
+    UCHAR Length;
+} PACKED SRAT_GENERIC_ENTRY, *PSRAT_GENERIC_ENTRY;
+
+/*++
+
+Structure Description:
+
+    This structure associates a local APIC with a proximity domain.
+
+Members:
+
+    Type - Stores 0 to indicate a Processor Local APIC/SAPIC affinity
+        structure.
+
+    Length - Stores 16, the size of this structure.
+
+    ProximityDomainLow - Stores bits 0-7 of the proximity domain.
+
+    ApicId - Stores the processor's local APIC ID.
+
+    Flags - Stores a bitfield of flags. See SRAT_AFFINITY_FLAG_*.
+
+    LocalSapicEid - Stores the processor's local SAPIC EID.
+
+    ProximityDomainHigh - Stores bits 8-31 of the proximity domain.
+
+    ClockDomain - Stores the clock domain the processor belongs to.
+
+--*/
+
+typedef struct _SRAT_LOCAL_APIC_AFFINITY {
+    UCHAR Type;
+    UCHAR Length;
+    UCHAR ProximityDomainLow;
+    UCHAR ApicId;
+    ULONG Flags;
+    UCHAR LocalSapicEid;
+    UCHAR ProximityDomainHigh[3];
+    ULONG ClockDomain;
+} PACKED SRAT_LOCAL_APIC_AFFINITY, *PSRAT_LOCAL_APIC_AFFINITY;
+
+/*++
+
+Structure Description:
+
+    This structure associates a range of physical memory with a proximity
+    domain.
+
+Members:
+
+    Type - Stores 1 to indicate a Memory Affinity structure.
+
+    Length - Stores 40, the size of this structure.
+
+    ProximityDomain - Stores the proximity domain the memory belongs to.
+
+    Reserved1 - Stores a reserved value.
+
+    BaseAddress - Stores the physical base address of the memory range.
+
+    RangeLength - Stores the length of the memory range, in bytes.
+
+    Reserved2 - Stores a reserved value.
+
+    Flags - Stores a bitfield of flags. See SRAT_AFFINITY_FLAG_ENABLED and
+        SRAT_MEMORY_AFFINITY_FLAG_*.
+
+    Reserved3 - Stores a reserved value.
+
+--*/
+
+typedef struct _SRAT_MEMORY_AFFINITY {
+    UCHAR Type;
+    UCHAR Length;
+    ULONG ProximityDomain;
+    USHORT Reserved1;
+    ULONGLONG BaseAddress;
+    ULONGLONG RangeLength;
+    ULONG Reserved2;
+    ULONG Flags;
+    ULONGLONG Reserved3;
+} PACKED SRAT_MEMORY_AFFINITY, *PSRAT_MEMORY_AFFINITY;
+
+/*++
+
+Structure Description:
+
+    This structure associates a local x2APIC with a proximity domain.
+
+Members:
+
+    Type - Stores 2 to indicate a Processor Local x2APIC affinity structure.
+
+    Length - Stores 24, the size of this structure.
+
+    Reserved1 - Stores a reserved value.
+
+    ProximityDomain - Stores the proximity domain the processor belongs to.
+
+    X2ApicId - Stores the processor's local x2APIC ID.
+
+    Flags - Stores a bitfield of flags. See SRAT_AFFINITY_FLAG_*.
+
+    ClockDomain - Stores the clock domain the processor belongs to.
+
+    Reserved2 - Stores a reserved value.
+
+--*/
+
+typedef struct _SRAT_LOCAL_X2APIC_AFFINITY {
+    UCHAR Type;
+    UCHAR Length;
+    USHORT Reserved1;
+    ULONG ProximityDomain;
+    ULONG X2ApicId;
+    ULONG Flags;
+    ULONG ClockDomain;
+    ULONG Reserved2;
+} PACKED SRAT_LOCAL_X2APIC_AFFINITY, *PSRAT_LOCAL_X2APIC_AFFINITY;
+
+/*++
+
+Structure Description:
+
+    This structure associates a GIC CPU interface with a proximity domain.
+
+Members:
+
+    Type - Stores 3 to indicate a GICC affinity structure.
+
+    Length - Stores 18, the size of this structure.
+
+    ProximityDomain - Stores the proximity domain the processor belongs to.
+
+    AcpiProcessorUid - Stores the ACPI processor UID of the GICC entry in the
+        MADT.
+
+    Flags - Stores a bitfield of flags. See SRAT_AFFINITY_FLAG_*.
+
+    ClockDomain - Stores the clock domain the processor belongs to.
+
+--*/
+
+typedef struct _SRAT_GICC_AFFINITY {
+    UCHAR Type;
+    UCHAR Length;
+    ULONG ProximityDomain;
+    ULONG AcpiProcessorUid;
+    ULONG Flags;
+    ULONG ClockDomain;
+} PACKED SRAT_GICC_AFFINITY, *PSRAT_GICC_AFFINITY;
+
+/*++
+
+Structure Description:
+
+    This structure describes the System Locality Information Table, which
+    gives the relative distance between each pair of proximity domains.
+
+Members:
+
+    Header - Stores the table header, including the signature 'SLIT'.
+
+    LocalityCount - Stores the number of system localities.
+
+    Entries - Stores a LocalityCount by LocalityCount matrix of one byte
+        relative distances. The entry at row i, column j is the distance from
+        locality i to locality j. A value of 10 is the local distance, and
+        0xFF means the locality is unreachable.
+
+--*/
+
+typedef struct _SLIT {
+    DESCRIPTION_HEADER Header;
+    ULONGLONG LocalityCount;
+    // Entries[LocalityCount][LocalityCount].
+} PACKED SLIT, *PSLIT;
+
 #pragma pack(pop)
 
 //
@@ -44,6 +44,13 @@ Module Name:
 
 #define ACPI_RESOURCE_ALLOCATION_TAG 0x52706341
 
+//
+// Define the maximum number of NUMA nodes the system tracks. Proximity
+// domains at or above this value are folded into the last node.
+//
+
+#define ACPI_MAX_NUMA_NODES 64
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -86,3 +93,109 @@ Return Value:
 
 --*/
 
+ULONG
+AcpiGetNumaNodeCount (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the number of NUMA nodes described by the firmware.
+    This routine does not allocate memory, and can be called before the memory
+    manager is initialized.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of NUMA nodes in the system. This is always at least
+    one, and at most ACPI_MAX_NUMA_NODES.
+
+--*/
+
+ULONG
+AcpiGetMemoryNode (
+    ULONGLONG Address,
+    PULONGLONG RangeEnd
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines which NUMA node the given physical address belongs
+    to. This routine does not allocate memory, and can be called before the
+    memory manager is initialized.
+
+Arguments:
+
+    Address - Supplies the physical address to look up.
+
+    RangeEnd - Supplies a pointer where the first physical address after the
+        given address at which the node may change will be returned. Callers
+        can use this to walk a physical range node by node.
+
+Return Value:
+
+    Returns the NUMA node the address belongs to. Addresses not described by
+    the firmware belong to node zero.
+
+--*/
+
+ULONG
+AcpiGetProcessorNode (
+    ULONGLONG PhysicalId
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines which NUMA node the given processor belongs to.
+    This routine does not allocate memory.
+
+Arguments:
+
+    PhysicalId - Supplies the physical identifier of the processor. This is
+        the local APIC or x2APIC ID on PCs, and the ACPI processor UID on GIC
+        based systems.
+
+Return Value:
+
+    Returns the NUMA node the processor belongs to. Processors not described
+    by the firmware belong to node zero.
+
+--*/
+
+ULONG
+AcpiGetNumaDistance (
+    ULONG FromNode,
+    ULONG ToNode
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the relative distance between two NUMA nodes, as
+    described by the SLIT.
+
+Arguments:
+
+    FromNode - Supplies the node the access originates from.
+
+    ToNode - Supplies the node being accessed.
+
+Return Value:
+
+    Returns the relative distance between the two nodes, where
+    SLIT_LOCAL_DISTANCE is the distance from a node to itself. If the firmware
+    does not describe the distance, SLIT_LOCAL_DISTANCE or
+    SLIT_DEFAULT_REMOTE_DISTANCE is returned.
+
+--*/
+
@@ -495,6 +495,33 @@ Return Value:
 
 --*/
 
+BOOL
+HlQueryProcessorCounterTimeOffset (
+    PULONGLONG Offset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not the time counter is simply the raw
+    processor counter plus a fixed offset, and returns that offset if so. This
+    is only the case if the processor counter is 64-bits wide, does not vary
+    with power states, and backs the time counter directly.
+
+Arguments:
+
+    Offset - Supplies a pointer where the value to add to a raw processor
+        counter read to get the time counter will be returned on success.
+
+Return Value:
+
+    TRUE if the time counter can be computed from the raw processor counter.
+
+    FALSE if the time counter must be queried through the hardware layer.
+
+--*/
+
 KERNEL_API
 ULONGLONG
 HlQueryTimeCounterFrequency (
@@ -244,6 +244,14 @@ Module Name:
 
 #define OPEN_FLAG_ASYNCHRONOUS 0x00000800
 
+//
+// Set this flag to have reads and writes of cacheable objects bypass the page
+// cache and go straight to the file system or device. The offset and size of
+// each request must be page aligned.
+//
+
+#define OPEN_FLAG_DIRECT 0x00001000
+
 //
 // Set this flag if mount points should not be followed on the final component.
 //
@@ -832,6 +840,24 @@ Module Name:
 
 #define PIPE_ATOMIC_WRITE_SIZE 4096
 
+//
+// Define stream buffer flags.
+//
+
+//
+// This flag is set if the stream buffer may grow beyond its initial size when
+// writes don't fit.
+//
+
+#define STREAM_BUFFER_FLAG_GROWABLE 0x00000001
+
+//
+// This flag is set if large blocking writes may hand their pages directly to
+// readers rather than copying through the buffer.
+//
+
+#define STREAM_BUFFER_FLAG_GIFT_PAGES 0x00000002
+
 //
 // Define I/O test hook bits.
 //
@@ -865,6 +891,14 @@ Module Name:
 
 #define LOOKUP_FLAG_NON_PAGED_IO_STATE 0x00000002
 
+//
+// Set this flag if the file system does not preserve the file's data when it
+// is written back, only when the page cache performs a hard flush to evict
+// it. This is used by memory-backed file systems.
+//
+
+#define LOOKUP_FLAG_HARD_FLUSH_REQUIRED 0x00000004
+
 //
 // Define the version number for the I/O cache statistics.
 //
@@ -879,6 +913,45 @@ Module Name:
 #define IO_GLOBAL_STATISTICS_VERSION 0x1
 #define IO_GLOBAL_STATISTICS_MAX_VERSION 0x10000000
 
+//
+// Define the number of buckets in a device latency histogram. Bucket N counts
+// requests that took at least 2^N and less than 2^(N+1) microseconds, except
+// that the first bucket also counts anything faster and the last bucket
+// counts anything slower.
+//
+
+#define IO_LATENCY_HISTOGRAM_SIZE 24
+
+//
+// Define the size of the device name buffer in the device statistics.
+//
+
+#define IO_DEVICE_STATISTICS_NAME_SIZE 32
+
+//
+// Define the version of the I/O trace information structure.
+//
+
+#define IO_TRACE_INFORMATION_VERSION 0x1
+
+//
+// Define the largest number of records the I/O trace buffer can hold.
+//
+
+#define IO_TRACE_MAX_CAPACITY 0x00100000
+
+//
+// This flag is set in the I/O trace information if tracing is enabled.
+//
+
+#define IO_TRACE_FLAG_ENABLED 0x00000001
+
+//
+// Define I/O trace record flags.
+//
+
+#define IO_TRACE_RECORD_FLAG_WRITE 0x00000001
+
 //
 // Define the device ID given to the object manager.
 //
@@ -1047,6 +1120,9 @@ typedef enum _IO_INFORMATION_TYPE {
     IoInformationBoot,
     IoInformationMountPoints,
     IoInformationCacheStatistics,
+    IoInformationWritebackStatistics,
+    IoInformationDeviceStatistics,
+    IoInformationTrace,
 } IO_INFORMATION_TYPE, *PIO_INFORMATION_TYPE;
 
 typedef enum _SHARED_MEMORY_COMMAND {
@@ -1516,6 +1592,7 @@ typedef enum _IO_OBJECT_TYPE {
     IoObjectTerminalSlave,
     IoObjectSharedMemoryObject,
     IoObjectSymbolicLink,
+    IoObjectIoRing,
     IoObjectTypeCount
 } IO_OBJECT_TYPE, *PIO_OBJECT_TYPE;
 
@@ -2294,6 +2371,9 @@ Structure Description:
         permissions, object type, user ID, group ID, and access times are all
         valid from the system.
 
+    Flags - Stores a bitmask of flags returned by create. See LOOKUP_FLAG_*
+        for definitions.
+
 --*/
 
 typedef struct _SYSTEM_CONTROL_CREATE {
@@ -2302,6 +2382,7 @@ typedef struct _SYSTEM_CONTROL_CREATE {
     PCSTR Name;
     ULONG NameSize;
     FILE_PROPERTIES FileProperties;
+    ULONG Flags;
 } SYSTEM_CONTROL_CREATE, *PSYSTEM_CONTROL_CREATE;
 
 /*++
@@ -2652,6 +2733,186 @@ typedef struct _IO_CACHE_STATISTICS {
 
 /*++
 
+Structure Description:
+
+    This structure defines the writeback statistics of one device or volume.
+    The writeback statistics information type returns an array of these.
+
+Members:
+
+    DeviceId - Stores the ID of the device, or 0 for the entry that covers all
+        file objects that are not cached.
+
+    DirtyPageCount - Stores the number of dirty page cache pages belonging to
+        the device.
+
+    WritebackPageCount - Stores the number of pages currently being written
+        out to the device.
+
+    BytesWritten - Stores the total number of bytes written back to the
+        device.
+
+    Bandwidth - Stores the estimated writeback bandwidth of the device in
+        bytes per second, or 0 if no estimate has been made yet.
+
+--*/
+
+typedef struct _IO_WRITEBACK_STATISTICS {
+    DEVICE_ID DeviceId;
+    UINTN DirtyPageCount;
+    UINTN WritebackPageCount;
+    ULONGLONG BytesWritten;
+    ULONGLONG Bandwidth;
+} IO_WRITEBACK_STATISTICS, *PIO_WRITEBACK_STATISTICS;
+
+/*++
+
+Structure Description:
+
+    This structure defines the statistics of one direction of I/O to a device.
+
+Members:
+
+    Count - Stores the number of requests completed.
+
+    Bytes - Stores the number of bytes transferred.
+
+    Microseconds - Stores the total time the requests took, from dispatch to
+        completion.
+
+    Histogram - Stores the number of requests that completed in each latency
+        range. See IO_LATENCY_HISTOGRAM_SIZE.
+
+--*/
+
+typedef struct _IO_DEVICE_OPERATION_STATISTICS {
+    ULONGLONG Count;
+    ULONGLONG Bytes;
+    ULONGLONG Microseconds;
+    ULONGLONG Histogram[IO_LATENCY_HISTOGRAM_SIZE];
+} IO_DEVICE_OPERATION_STATISTICS, *PIO_DEVICE_OPERATION_STATISTICS;
+
+/*++
+
+Structure Description:
+
+    This structure defines the I/O statistics of one device. The device
+    statistics information type returns an array of these, one for each
+    device that has received I/O.
+
+Members:
+
+    DeviceId - Stores the ID of the device.
+
+    DeviceName - Stores the name of the device, truncated if needed.
+
+    InFlight - Stores the number of requests currently outstanding to the
+        device.
+
+    Read - Stores the statistics of reads from the device.
+
+    Write - Stores the statistics of writes to the device.
+
+--*/
+
+typedef struct _IO_DEVICE_STATISTICS {
+    DEVICE_ID DeviceId;
+    CHAR DeviceName[IO_DEVICE_STATISTICS_NAME_SIZE];
+    ULONG InFlight;
+    IO_DEVICE_OPERATION_STATISTICS Read;
+    IO_DEVICE_OPERATION_STATISTICS Write;
+} IO_DEVICE_STATISTICS, *PIO_DEVICE_STATISTICS;
+
+/*++
+
+Structure Description:
+
+    This structure defines a single traced I/O request to a device.
+
+Members:
+
+    Sequence - Stores the sequence number of the record. Records are numbered
+        from one in the order the requests completed.
+
+    DeviceId - Stores the ID of the device the request was sent to.
+
+    Offset - Stores the byte offset of the request.
+
+    Size - Stores the number of bytes requested.
+
+    BytesCompleted - Stores the number of bytes actually transferred.
+
+    IssueTime - Stores the time counter value when the request was sent.
+
+    CompleteTime - Stores the time counter value when the request completed.
+
+    Flags - Stores a bitmask of flags. See IO_TRACE_RECORD_FLAG_* definitions.
+
+    Status - Stores the completion status of the request.
+
+--*/
+
+typedef struct _IO_TRACE_RECORD {
+    ULONGLONG Sequence;
+    DEVICE_ID DeviceId;
+    ULONGLONG Offset;
+    ULONGLONG Size;
+    ULONGLONG BytesCompleted;
+    ULONGLONG IssueTime;
+    ULONGLONG CompleteTime;
+    ULONG Flags;
+    KSTATUS Status;
+} IO_TRACE_RECORD, *PIO_TRACE_RECORD;
+
+/*++
+
+Structure Description:
+
+    This structure controls the I/O trace buffer and retrieves records from
+    it. A set request with a non-zero capacity starts tracing into a new
+    buffer, and a set with a capacity of zero stops tracing. A get request
+    returns this structure followed by as many records as fit in the
+    remaining buffer.
+
+Members:
+
+    Version - Stores the structure version. Set to
+        IO_TRACE_INFORMATION_VERSION.
+
+    Flags - Stores a bitmask of flags. See IO_TRACE_FLAG_* definitions.
+
+    Capacity - Stores the number of records the trace buffer holds. On set,
+        this is rounded up to a power of two and capped at
+        IO_TRACE_MAX_CAPACITY.
+
+    RecordCount - Stores the number of records returned after this structure
+        on a get request.
+
+    NextSequence - Stores on input to a get request the sequence number of
+        the first record wanted, or zero to start at the oldest record
+        available. On output, stores the sequence number to ask for on the
+        next request.
+
+    LostRecords - Stores the number of wanted records that were overwritten
+        before they could be returned.
+
+    TimeCounterFrequency - Stores the frequency of the time counter used for
+        record times, in Hertz.
+
+--*/
+
+typedef struct _IO_TRACE_INFORMATION {
+    ULONG Version;
+    ULONG Flags;
+    ULONG Capacity;
+    ULONG RecordCount;
+    ULONGLONG NextSequence;
+    ULONGLONG LostRecords;
+    ULONGLONG TimeCounterFrequency;
+} IO_TRACE_INFORMATION, *PIO_TRACE_INFORMATION;
+
+/*++
+
 Structure Description:
 
     This structure defines a set of I/O cache statistics.
@@ -4412,6 +4673,62 @@ Return Value:
 
 --*/
 
+KERNEL_API
+KSTATUS
+IoFlushDeviceCache (
+    PDEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine writes all of a device's dirty data in the page cache back to
+    the device.
+
+Arguments:
+
+    Device - Supplies a pointer to the device to flush.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KERNEL_API
+VOID
+IoEvictDeviceCache (
+    PDEVICE Device,
+    IO_OFFSET Offset,
+    ULONGLONG Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine evicts a region of a device's data from the page cache, dirty
+    or not. Block device drivers call this when the data behind a device
+    changes without going through the page cache. Pages that partially overlap
+    the region are evicted as well. The caller must make sure nothing is using
+    the region.
+
+Arguments:
+
+    Device - Supplies a pointer to the device to evict.
+
+    Offset - Supplies the byte offset of the region to evict.
+
+    Size - Supplies the size of the region in bytes. Supply -1 to evict
+        everything from the given offset to the end of the device.
+
+Return Value:
+
+    None.
+
+--*/
+
 KERNEL_API
 KSTATUS
 IoSeek (
@@ -6445,6 +6762,58 @@ Return Value:
 
 --*/
 
+INTN
+IoSysCreateIoRing (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the user mode system call for creating an I/O
+    submission and completion ring.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+INTN
+IoSysSubmitIoRing (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the user mode system call for submitting the
+    pending entries of an I/O ring and waiting for completions.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    Returns the number of submissions consumed on success.
+
+    Error status code on failure.
+
+--*/
+
 VOID
 IoIoHandleAddReference (
     PIO_HANDLE IoHandle
@@ -165,6 +165,17 @@ Module Name:
 
 #define ARM_FEATURE_NEON32     0x00000008
 
+//
+// Define user shared data time counter flags.
+//
+
+//
+// This bit is set if the time counter can be computed in user mode by reading
+// the processor counter directly and adding the processor counter time offset.
+//
+
+#define USER_TIME_COUNTER_FLAG_PROCESSOR_COUNTER 0x00000001
+
 //
 // Define the set of DCP flags.
 //
@@ -647,6 +658,8 @@ Structure Description:
 
     CpuVersion - Stores the processor identification information for this CPU.
 
+    NumaNode - Stores the NUMA node this processor belongs to.
+
 --*/
 
 typedef struct _PROCESSOR_BLOCK PROCESSOR_BLOCK, *PPROCESSOR_BLOCK;
@@ -682,6 +695,7 @@ struct _PROCESSOR_BLOCK {
     PVOID SwapPage;
     UINTN NmiCount;
     PROCESSOR_IDENTIFICATION CpuVersion;
+    ULONG NumaNode;
 };
 
 /*++
@@ -974,6 +988,16 @@ Structure Description:
     ProcessorFeatures - Stores a bitfield of architecture-specific feature
         flags.
 
+    TimeCounterFlags - Stores a bitfield of flags describing how user mode can
+        read the time counter. See USER_TIME_COUNTER_FLAG_* definitions. This
+        value won't change once the system is booted.
+
+    ProcessorCounterTimeOffset - Stores the value to add to a raw read of the
+        processor counter to get the current time counter. This is only valid
+        if USER_TIME_COUNTER_FLAG_PROCESSOR_COUNTER is set. It is published
+        under the tick count scheme, so readers should snap it between reads
+        of the two tick count values.
+
 --*/
 
 typedef struct _USER_SHARED_DATA {
@@ -988,6 +1012,8 @@ typedef struct _USER_SHARED_DATA {
     volatile ULONGLONG TickCount;
     volatile ULONGLONG TickCount2;
     ULONG ProcessorFeatures;
+    ULONG TimeCounterFlags;
+    volatile ULONGLONG ProcessorCounterTimeOffset;
 } USER_SHARED_DATA, *PUSER_SHARED_DATA;
 
 //
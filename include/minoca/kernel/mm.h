@@ -377,6 +377,8 @@ typedef enum _MEMORY_WARNING_LEVEL {
 typedef enum _MM_INFORMATION_TYPE {
     MmInformationInvalid,
     MmInformationSystemMemory,
+    MmInformationNumaNodes,
+    MmInformationPageMerge,
 } MM_INFORMATION_TYPE, *PMM_INFORMATION_TYPE;
 
 /*++
@@ -691,6 +693,80 @@ typedef struct _MM_STATISTICS {
 
 /*++
 
+Structure Description:
+
+    This structure defines the physical memory statistics for one NUMA node.
+    The NUMA node information type returns an array of these, one per node.
+
+Members:
+
+    Node - Stores the node number.
+
+    PhysicalPages - Stores the number of physical pages in the node.
+
+    FreePhysicalPages - Stores the number of physical pages in the node that
+        are not currently allocated.
+
+    LocalAllocations - Stores the number of single page allocations made on
+        behalf of processors in this node that were satisfied from this node.
+
+    RemoteAllocations - Stores the number of single page allocations made on
+        behalf of processors in this node that had to be satisfied from
+        another node.
+
+--*/
+
+typedef struct _MM_NUMA_NODE_STATISTICS {
+    ULONG Node;
+    UINTN PhysicalPages;
+    UINTN FreePhysicalPages;
+    UINTN LocalAllocations;
+    UINTN RemoteAllocations;
+} MM_NUMA_NODE_STATISTICS, *PMM_NUMA_NODE_STATISTICS;
+
+/*++
+
+Structure Description:
+
+    This structure defines the state of the background page merge scanner.
+    The scanner does fork page re-sharing and zero page reclaim only: it
+    returns a forked section's private page to the page it was copied from
+    when the two are still identical, and frees private pages that contain
+    only zeros. It does not look for identical pages across unrelated
+    sections. Setting this information type only looks at the enabled
+    member. The counts are cumulative since boot.
+
+Members:
+
+    Enabled - Stores a boolean indicating whether or not the scanner is
+        running.
+
+    PagesScanned - Stores the number of physical pages the scanner has looked
+        at.
+
+    ForkPagesReshared - Stores the number of private pages of forked
+        sections found identical to the page they were copied from, and
+        shared with it again.
+
+    ZeroPagesFreed - Stores the number of private pages found to contain only
+        zeros, which were released to be zero-filled again on the next touch.
+
+    PagesSaved - Stores the total number of physical pages released by the
+        scanner. Pages that are later written to are copied again and are not
+        subtracted from this count.
+
+--*/
+
+typedef struct _MM_PAGE_MERGE_INFORMATION {
+    BOOL Enabled;
+    UINTN PagesScanned;
+    UINTN ForkPagesReshared;
+    UINTN ZeroPagesFreed;
+    UINTN PagesSaved;
+} MM_PAGE_MERGE_INFORMATION, *PMM_PAGE_MERGE_INFORMATION;
+
+/*++
+
 Structure Description:
 
     This structure defines an I/O vector, a structure used in kernel mode that
@@ -3455,6 +3531,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 KSTATUS
 MmAllocatePageFileSpace (
     PIMAGE_BACKING ImageBacking,
@@ -3483,6 +3560,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 VOID
 MmFreePageFileSpace (
     PIMAGE_BACKING ImageBacking,
@@ -3537,6 +3615,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 KSTATUS
 MmPageFilePerformIo (
     PIMAGE_BACKING ImageBacking,
@@ -4037,6 +4116,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 UINTN
 MmGetTotalPhysicalPages (
     VOID
@@ -4079,6 +4159,32 @@ Return Value:
 
 --*/
 
+KERNEL_API
+PHYSICAL_ADDRESS
+MmAllocatePhysicalPage (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine allocates a single non-paged physical page of memory for a
+    driver's own use. The page is not mapped. It must be freed with
+    MmFreePhysicalPage. This routine must be called at low level.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the physical address of the allocated page on success, or
+    INVALID_PHYSICAL_ADDRESS on failure.
+
+--*/
+
+KERNEL_API
 VOID
 MmFreePhysicalPages (
     PHYSICAL_ADDRESS PhysicalAddress,
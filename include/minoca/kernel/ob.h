@@ -127,6 +127,7 @@ typedef enum _OBJECT_TYPE {
     ObjectTerminalMaster,
     ObjectTerminalSlave,
     ObjectSharedMemoryObject,
+    ObjectIoRing,
     ObjectMaxTypes
 } OBJECT_TYPE, *POBJECT_TYPE;
 
@@ -225,8 +226,9 @@ VOID
 
 Routine Description:
 
-    This routine is called whenever a handle is looked up. It is called with
-    the handle table lock still held.
+    This routine is called whenever a handle is looked up. It is called
+    without the handle table lock held, but the handle cannot be closed or
+    replaced until it returns.
 
 Arguments:
 
@@ -1139,7 +1141,9 @@ ObGetHandleValue (
 Routine Description:
 
     This routine looks up the given handle and returns the value associated
-    with that handle.
+    with that handle. This routine does not acquire the handle table lock. The
+    entry is pinned while the lookup callback runs, so a concurrent close or
+    replace of the handle waits for the callback to finish.
 
 Arguments:
 
@@ -63,6 +63,16 @@ Module Name:
 #define IS_SYSTEM_CALL_RESULT_RESTARTABLE_NO_SIGNAL(_SystemCallResult) \
     IS_SYSTEM_CALL_RESULT_RESTARTABLE(_SystemCallResult)
 
+//
+// This macro returns the size of the buffer needed to back an I/O ring with
+// the given number of submission and completion entries.
+//
+
+#define IO_RING_BUFFER_SIZE(_SubmitEntryCount, _CompleteEntryCount) \
+    (sizeof(IO_RING_HEADER) +                                       \
+     ((_SubmitEntryCount) * sizeof(IO_RING_SUBMISSION)) +           \
+     ((_CompleteEntryCount) * sizeof(IO_RING_COMPLETION)))
+
 //
 // ---------------------------------------------------------------- Definitions
 //
@@ -93,6 +103,7 @@ Module Name:
 #define SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL 0x00000200
 #define SYS_OPEN_FLAG_NO_ACCESS_TIME          0x00000400
 #define SYS_OPEN_FLAG_ASYNCHRONOUS            0x00000800
+#define SYS_OPEN_FLAG_DIRECT                  0x00001000
 
 #define SYS_OPEN_ACCESS_SHIFT 29
 #define SYS_OPEN_FLAG_READ    (IO_ACCESS_READ << SYS_OPEN_ACCESS_SHIFT)
@@ -118,14 +129,16 @@ Module Name:
      SYS_OPEN_FLAG_SYNCHRONIZED |               \
      SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL |    \
      SYS_OPEN_FLAG_NO_ACCESS_TIME |             \
-     SYS_OPEN_FLAG_ASYNCHRONOUS)
+     SYS_OPEN_FLAG_ASYNCHRONOUS |               \
+     SYS_OPEN_FLAG_DIRECT)
 
 #define SYS_FILE_CONTROL_EDITABLE_STATUS_FLAGS \
     (SYS_OPEN_FLAG_APPEND |                    \
      SYS_OPEN_FLAG_NON_BLOCKING |              \
      SYS_OPEN_FLAG_SYNCHRONIZED |              \
      SYS_OPEN_FLAG_NO_ACCESS_TIME |            \
-     SYS_OPEN_FLAG_ASYNCHRONOUS)
+     SYS_OPEN_FLAG_ASYNCHRONOUS |              \
+     SYS_OPEN_FLAG_DIRECT)
 
 //
 // Define delete flags.
@@ -153,6 +166,21 @@ Module Name:
 #define SYS_IO_FLAG_WRITE 0x00000001
 #define SYS_IO_FLAG_MASK  0x00000001
 
+//
+// Define the maximum number of entries in either queue of an I/O ring. The
+// entry counts must be powers of two.
+//
+
+#define IO_RING_MAX_ENTRIES 4096
+
+//
+// Set this flag in an I/O ring submission to have a write operation
+// synchronized to the backing device before it completes.
+//
+
+#define IO_RING_SUBMISSION_FLAG_DATA_SYNCHRONIZED 0x00000001
+#define IO_RING_SUBMISSION_FLAG_MASK              0x00000001
+
 //
 // Define flush flags.
 //
@@ -357,6 +385,8 @@ typedef enum _SYSTEM_CALL_NUMBER {
     SystemCallSetITimer,
     SystemCallSetResourceLimit,
     SystemCallSetBreak,
+    SystemCallCreateIoRing,
+    SystemCallSubmitIoRing,
     SystemCallCount
 } SYSTEM_CALL_NUMBER, *PSYSTEM_CALL_NUMBER;
 
@@ -435,6 +465,140 @@ typedef enum _RESOURCE_USAGE_REQUEST {
     ResourceUsageRequestThread,
 } RESOURCE_USAGE_REQUEST, *PRESOURCE_USAGE_REQUEST;
 
+typedef enum _IO_RING_OPERATION {
+    IoRingOperationNop,
+    IoRingOperationRead,
+    IoRingOperationWrite,
+    IoRingOperationFlush,
+    IoRingOperationPoll,
+    IoRingOperationCount
+} IO_RING_OPERATION, *PIO_RING_OPERATION;
+
+/*++
+
+Structure Description:
+
+    This structure defines the header at the start of an I/O ring buffer. The
+    buffer is shared between user mode and the kernel. User mode produces
+    submissions and consumes completions, the kernel consumes submissions and
+    produces completions. Indices run freely and are reduced modulo the entry
+    count when indexing into the arrays.
+
+Members:
+
+    SubmitHead - Stores the index of the next submission the kernel will
+        consume. Only the kernel writes this value.
+
+    SubmitTail - Stores the index one beyond the last submission user mode
+        has filled in. Only user mode writes this value.
+
+    CompleteHead - Stores the index of the next completion user mode will
+        consume. Only user mode writes this value.
+
+    CompleteTail - Stores the index one beyond the last completion the kernel
+        has posted. Only the kernel writes this value, so user mode can reap
+        completions by watching it without making a system call.
+
+    SubmitEntryCount - Stores the number of entries in the submission array,
+        filled in by the kernel when the ring is created.
+
+    CompleteEntryCount - Stores the number of entries in the completion array,
+        filled in by the kernel when the ring is created.
+
+    SubmitOffset - Stores the offset in bytes from the start of the header to
+        the submission array, filled in by the kernel.
+
+    CompleteOffset - Stores the offset in bytes from the start of the header to
+        the completion array, filled in by the kernel.
+
+--*/
+
+typedef struct _IO_RING_HEADER {
+    volatile ULONG SubmitHead;
+    volatile ULONG SubmitTail;
+    volatile ULONG CompleteHead;
+    volatile ULONG CompleteTail;
+    ULONG SubmitEntryCount;
+    ULONG CompleteEntryCount;
+    ULONG SubmitOffset;
+    ULONG CompleteOffset;
+} IO_RING_HEADER, *PIO_RING_HEADER;
+
+/*++
+
+Structure Description:
+
+    This structure defines a single I/O ring submission entry.
+
+Members:
+
+    UserData - Stores an opaque value that is copied into the completion.
+
+    Offset - Stores the offset to perform the I/O at. Supply -1 to use and
+        move the handle's current file position.
+
+    Buffer - Stores a pointer to the user mode data buffer for reads and
+        writes.
+
+    Size - Stores the size of the buffer in bytes.
+
+    Handle - Stores the handle to perform the operation on.
+
+    Operation - Stores the operation to perform. See IO_RING_OPERATION.
+
+    Flags - Stores a bitfield of flags. See IO_RING_SUBMISSION_FLAG_*
+        definitions.
+
+    Events - Stores the poll events to wait for on poll operations.
+
+    TimeoutInMilliseconds - Stores the number of milliseconds the operation
+        may block for. Set to SYS_WAIT_TIME_INDEFINITE to wait forever.
+
+    Reserved - Stores a reserved value, which should be zero.
+
+--*/
+
+typedef struct _IO_RING_SUBMISSION {
+    ULONGLONG UserData;
+    LONGLONG Offset;
+    PVOID Buffer;
+    UINTN Size;
+    HANDLE Handle;
+    ULONG Operation;
+    ULONG Flags;
+    ULONG Events;
+    ULONG TimeoutInMilliseconds;
+    ULONG Reserved;
+} IO_RING_SUBMISSION, *PIO_RING_SUBMISSION;
+
+/*++
+
+Structure Description:
+
+    This structure defines a single I/O ring completion entry.
+
+Members:
+
+    UserData - Stores the user data value from the corresponding submission.
+
+    BytesCompleted - Stores the number of bytes transferred.
+
+    Status - Stores the status code of the operation.
+
+    Events - Stores the returned events for poll operations.
+
+    Reserved - Stores a reserved value.
+
+--*/
+
+typedef struct _IO_RING_COMPLETION {
+    ULONGLONG UserData;
+    UINTN BytesCompleted;
+    KSTATUS Status;
+    ULONG Events;
+    ULONG Reserved;
+} IO_RING_COMPLETION, *PIO_RING_COMPLETION;
+
 //
 // System call parameter structures
 //
@@ -2512,6 +2676,74 @@ typedef struct _SYSTEM_CALL_SET_RESOURCE_LIMIT {
 
 /*++
 
+Structure Description:
+
+    This structure defines the system call parameters for creating an I/O
+    ring.
+
+Members:
+
+    Buffer - Stores a pointer to the page aligned user mode buffer that backs
+        the ring. The kernel locks this buffer in memory for the life of the
+        ring and initializes the header.
+
+    BufferSize - Stores the size of the buffer in bytes. This must be at least
+        the value returned by IO_RING_BUFFER_SIZE for the given entry counts.
+
+    SubmitEntryCount - Stores the number of submission entries. This must be a
+        power of two no greater than IO_RING_MAX_ENTRIES.
+
+    CompleteEntryCount - Stores the number of completion entries. This must be
+        a power of two at least as large as the submission entry count and no
+        greater than IO_RING_MAX_ENTRIES.
+
+    OpenFlags - Stores the set of open flags associated with the handle. Only
+        SYS_OPEN_FLAG_CLOSE_ON_EXECUTE is accepted.
+
+    Handle - Stores the returned handle to the ring.
+
+--*/
+
+typedef struct _SYSTEM_CALL_CREATE_IO_RING {
+    PVOID Buffer;
+    UINTN BufferSize;
+    ULONG SubmitEntryCount;
+    ULONG CompleteEntryCount;
+    ULONG OpenFlags;
+    HANDLE Handle;
+} SYSCALL_STRUCT SYSTEM_CALL_CREATE_IO_RING, *PSYSTEM_CALL_CREATE_IO_RING;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for submitting the
+    pending entries of an I/O ring and optionally waiting for completions.
+
+Members:
+
+    Handle - Stores the handle to the I/O ring.
+
+    SubmitCount - Stores the maximum number of pending submissions to
+        consume. Supply zero to only wait.
+
+    WaitCount - Stores the number of unconsumed completions to wait for
+        before returning. Supply zero to return without waiting.
+
+    TimeoutInMilliseconds - Stores the number of milliseconds to wait for the
+        completions. Set to SYS_WAIT_TIME_INDEFINITE to wait forever.
+
+--*/
+
+typedef struct _SYSTEM_CALL_SUBMIT_IO_RING {
+    HANDLE Handle;
+    ULONG SubmitCount;
+    ULONG WaitCount;
+    ULONG TimeoutInMilliseconds;
+} SYSCALL_STRUCT SYSTEM_CALL_SUBMIT_IO_RING, *PSYSTEM_CALL_SUBMIT_IO_RING;
+
+/*++
+
 Structure Description:
 
     This structure defines a union of all possible system call parameter
@@ -2589,6 +2821,8 @@ typedef union _SYSTEM_CALL_PARAMETER_UNION {
     SYSTEM_CALL_SET_ITIMER SetITimer;
     SYSTEM_CALL_SET_RESOURCE_LIMIT SetResourceLimit;
     SYSTEM_CALL_SET_BREAK SetBreak;
+    SYSTEM_CALL_CREATE_IO_RING CreateIoRing;
+    SYSTEM_CALL_SUBMIT_IO_RING SubmitIoRing;
 } SYSCALL_STRUCT SYSTEM_CALL_PARAMETER_UNION, *PSYSTEM_CALL_PARAMETER_UNION;
 
 typedef
@@ -571,6 +571,91 @@ Return Value:
 
 --*/
 
+OS_API
+KSTATUS
+OsCreateIoRing (
+    PVOID Buffer,
+    UINTN BufferSize,
+    ULONG SubmitEntryCount,
+    ULONG CompleteEntryCount,
+    ULONG Flags,
+    PHANDLE Handle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates an I/O submission and completion ring backed by the
+    given buffer. The kernel initializes the ring header at the start of the
+    buffer and keeps the buffer locked in memory until the ring is closed.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the page aligned buffer backing the ring.
+
+    BufferSize - Supplies the size of the buffer in bytes. This must be at
+        least IO_RING_BUFFER_SIZE of the given entry counts.
+
+    SubmitEntryCount - Supplies the number of submission entries, which must
+        be a power of two.
+
+    CompleteEntryCount - Supplies the number of completion entries, which must
+        be a power of two no smaller than the submission entry count.
+
+    Flags - Supplies a bitfield of flags governing the new handle. Only
+        SYS_OPEN_FLAG_CLOSE_ON_EXECUTE is permitted.
+
+    Handle - Supplies a pointer where the handle to the ring will be returned
+        on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+OS_API
+KSTATUS
+OsSubmitIoRing (
+    HANDLE Handle,
+    ULONG SubmitCount,
+    ULONG WaitCount,
+    ULONG TimeoutInMilliseconds,
+    PULONG Submitted
+    );
+
+/*++
+
+Routine Description:
+
+    This routine hands the pending submissions of an I/O ring to the kernel
+    and optionally waits for completions. Completions can be reaped directly
+    from the ring without calling this routine.
+
+Arguments:
+
+    Handle - Supplies the handle to the I/O ring.
+
+    SubmitCount - Supplies the maximum number of pending submissions to hand
+        to the kernel. Supply zero to only wait.
+
+    WaitCount - Supplies the number of unconsumed completions to wait for.
+        Supply zero to return without waiting.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds to wait for.
+        Use SYS_WAIT_TIME_INDEFINITE to wait forever.
+
+    Submitted - Supplies a pointer where the number of submissions the kernel
+        consumed will be returned. Fewer than requested are consumed if the
+        completion array would otherwise overflow.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 OS_API
 VOID
 OsExitThread (
@@ -676,7 +676,22 @@ Structure Description:
         register).
 
     DmaDescriptorTable - Stores a pointer to the I/O buffer of the DMA
-        descriptor table.
+        descriptor tables.
+
+    DmaDescriptorTableIndex - Stores the index of the DMA descriptor table
+        used by the transfer in flight.
+
+    PreparedIoBuffer - Stores a pointer to the I/O buffer of the transfer
+        whose descriptors were prepared in the idle DMA descriptor table.
+
+    PreparedIoBufferOffset - Stores the I/O buffer offset of the prepared
+        transfer.
+
+    PreparedTransferSize - Stores the requested size of the prepared transfer,
+        in bytes.
+
+    PreparedSize - Stores the number of bytes the prepared descriptors cover,
+        or 0 if no transfer has been prepared.
 
     IoCompletionRoutine - Stores a pointer to a routine called when DMA I/O
         completes.
@@ -727,6 +742,11 @@ struct _SD_CONTROLLER {
     ULONG MaxBlocksPerTransfer;
     ULONG EnabledInterrupts;
     PIO_BUFFER DmaDescriptorTable;
+    ULONG DmaDescriptorTableIndex;
+    PIO_BUFFER PreparedIoBuffer;
+    UINTN PreparedIoBufferOffset;
+    UINTN PreparedTransferSize;
+    UINTN PreparedSize;
     PSD_IO_COMPLETION_ROUTINE IoCompletionRoutine;
     PVOID IoCompletionContext;
     UINTN IoRequestSize;
@@ -1246,6 +1266,50 @@ Return Value:
 
 --*/
 
+SD_API
+VOID
+SdStandardPrepareBlockIoDma (
+    PSD_CONTROLLER Controller,
+    UINTN BlockCount,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset,
+    BOOL Write
+    );
+
+/*++
+
+Routine Description:
+
+    This routine builds the ADMA2 descriptors for the next block I/O transfer
+    into the descriptor table not used by the transfer in flight, so that the
+    next transfer can be started as soon as the current one completes. The
+    preparation is used by the next call to start block I/O if its parameters
+    match, and is discarded otherwise. The caller must serialize this routine
+    with calls to start block I/O. This routine does nothing unless the
+    controller is using ADMA2.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    BlockCount - Supplies the number of blocks the next transfer will read or
+        write.
+
+    IoBuffer - Supplies a pointer to the I/O buffer of the next transfer.
+
+    IoBufferOffset - Supplies the offset from the beginning of the I/O buffer
+        where the next transfer will begin. This is relative to the I/O
+        buffer's current offset.
+
+    Write - Supplies a boolean indicating if the next transfer is a read
+        (FALSE) or a write (TRUE).
+
+Return Value:
+
+    None.
+
+--*/
+
 SD_API
 KSTATUS
 SdStandardInitializeController (
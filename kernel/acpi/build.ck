@@ -35,6 +35,7 @@ function build() {
     var sources;
 
     sources = [
+        "numa.c",
         "tables.c"
     ];
 
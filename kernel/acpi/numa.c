@@ -0,0 +1,444 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    numa.c
+
+Abstract:
+
+    This module implements support for reading the system's NUMA topology out
+    of the SRAT and SLIT firmware tables.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+BOOL
+AcpipGetSratEntryNode (
+    PSRAT_GENERIC_ENTRY Entry,
+    PULONG Node
+    );
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+ULONG
+AcpiGetNumaNodeCount (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the number of NUMA nodes described by the firmware.
+    This routine does not allocate memory, and can be called before the memory
+    manager is initialized.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of NUMA nodes in the system. This is always at least
+    one, and at most ACPI_MAX_NUMA_NODES.
+
+--*/
+
+{
+
+    PSRAT_GENERIC_ENTRY CurrentEntry;
+    ULONG Node;
+    ULONG NodeCount;
+    PSRAT Srat;
+
+    NodeCount = 1;
+    Srat = AcpiFindTable(SRAT_SIGNATURE, NULL);
+    if (Srat == NULL) {
+        return NodeCount;
+    }
+
+    CurrentEntry = (PSRAT_GENERIC_ENTRY)(Srat + 1);
+    while ((UINTN)CurrentEntry + sizeof(SRAT_GENERIC_ENTRY) <=
+           ((UINTN)Srat + Srat->Header.Length)) {
+
+        if (CurrentEntry->Length < sizeof(SRAT_GENERIC_ENTRY)) {
+            break;
+        }
+
+        if (AcpipGetSratEntryNode(CurrentEntry, &Node) != FALSE) {
+            if (Node >= NodeCount) {
+                NodeCount = Node + 1;
+            }
+        }
+
+        CurrentEntry = (PSRAT_GENERIC_ENTRY)((PUCHAR)CurrentEntry +
+                                             CurrentEntry->Length);
+    }
+
+    return NodeCount;
+}
+
+ULONG
+AcpiGetMemoryNode (
+    ULONGLONG Address,
+    PULONGLONG RangeEnd
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines which NUMA node the given physical address belongs
+    to. This routine does not allocate memory, and can be called before the
+    memory manager is initialized.
+
+Arguments:
+
+    Address - Supplies the physical address to look up.
+
+    RangeEnd - Supplies a pointer where the first physical address after the
+        given address at which the node may change will be returned. Callers
+        can use this to walk a physical range node by node.
+
+Return Value:
+
+    Returns the NUMA node the address belongs to. Addresses not described by
+    the firmware belong to node zero.
+
+--*/
+
+{
+
+    ULONGLONG BaseAddress;
+    PSRAT_GENERIC_ENTRY CurrentEntry;
+    ULONGLONG EndAddress;
+    PSRAT_MEMORY_AFFINITY Memory;
+    ULONG Node;
+    PSRAT Srat;
+
+    *RangeEnd = MAX_ULONGLONG;
+    Srat = AcpiFindTable(SRAT_SIGNATURE, NULL);
+    if (Srat == NULL) {
+        return 0;
+    }
+
+    CurrentEntry = (PSRAT_GENERIC_ENTRY)(Srat + 1);
+    while ((UINTN)CurrentEntry + sizeof(SRAT_GENERIC_ENTRY) <=
+           ((UINTN)Srat + Srat->Header.Length)) {
+
+        if (CurrentEntry->Length < sizeof(SRAT_GENERIC_ENTRY)) {
+            break;
+        }
+
+        if ((CurrentEntry->Type == SratEntryTypeMemoryAffinity) &&
+            (CurrentEntry->Length == sizeof(SRAT_MEMORY_AFFINITY)) &&
+            (AcpipGetSratEntryNode(CurrentEntry, &Node) != FALSE)) {
+
+            Memory = (PSRAT_MEMORY_AFFINITY)CurrentEntry;
+            BaseAddress = Memory->BaseAddress;
+            EndAddress = BaseAddress + Memory->RangeLength;
+            if (EndAddress < BaseAddress) {
+                EndAddress = MAX_ULONGLONG;
+            }
+
+            if ((Address >= BaseAddress) && (Address < EndAddress)) {
+                *RangeEnd = EndAddress;
+                return Node;
+            }
+
+            //
+            // Keep track of the closest range above the address, as that is
+            // where the unowned gap ends.
+            //
+
+            if ((BaseAddress > Address) && (BaseAddress < *RangeEnd)) {
+                *RangeEnd = BaseAddress;
+            }
+        }
+
+        CurrentEntry = (PSRAT_GENERIC_ENTRY)((PUCHAR)CurrentEntry +
+                                             CurrentEntry->Length);
+    }
+
+    return 0;
+}
+
+ULONG
+AcpiGetProcessorNode (
+    ULONGLONG PhysicalId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines which NUMA node the given processor belongs to.
+    This routine does not allocate memory.
+
+Arguments:
+
+    PhysicalId - Supplies the physical identifier of the processor. This is
+        the local APIC or x2APIC ID on PCs, and the ACPI processor UID on GIC
+        based systems.
+
+Return Value:
+
+    Returns the NUMA node the processor belongs to. Processors not described
+    by the firmware belong to node zero.
+
+--*/
+
+{
+
+    PSRAT_GENERIC_ENTRY CurrentEntry;
+    PSRAT_GICC_AFFINITY Gicc;
+    PSRAT_LOCAL_APIC_AFFINITY LocalApic;
+    ULONG Node;
+    PSRAT Srat;
+    PSRAT_LOCAL_X2APIC_AFFINITY X2Apic;
+
+    Srat = AcpiFindTable(SRAT_SIGNATURE, NULL);
+    if (Srat == NULL) {
+        return 0;
+    }
+
+    CurrentEntry = (PSRAT_GENERIC_ENTRY)(Srat + 1);
+    while ((UINTN)CurrentEntry + sizeof(SRAT_GENERIC_ENTRY) <=
+           ((UINTN)Srat + Srat->Header.Length)) {
+
+        if (CurrentEntry->Length < sizeof(SRAT_GENERIC_ENTRY)) {
+            break;
+        }
+
+        if (AcpipGetSratEntryNode(CurrentEntry, &Node) != FALSE) {
+            switch (CurrentEntry->Type) {
+            case SratEntryTypeLocalApicAffinity:
+                LocalApic = (PSRAT_LOCAL_APIC_AFFINITY)CurrentEntry;
+                if (LocalApic->ApicId == PhysicalId) {
+                    return Node;
+                }
+
+                break;
+
+            case SratEntryTypeLocalX2ApicAffinity:
+                X2Apic = (PSRAT_LOCAL_X2APIC_AFFINITY)CurrentEntry;
+                if (X2Apic->X2ApicId == PhysicalId) {
+                    return Node;
+                }
+
+                break;
+
+            case SratEntryTypeGiccAffinity:
+                Gicc = (PSRAT_GICC_AFFINITY)CurrentEntry;
+                if (Gicc->AcpiProcessorUid == PhysicalId) {
+                    return Node;
+                }
+
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        CurrentEntry = (PSRAT_GENERIC_ENTRY)((PUCHAR)CurrentEntry +
+                                             CurrentEntry->Length);
+    }
+
+    return 0;
+}
+
+ULONG
+AcpiGetNumaDistance (
+    ULONG FromNode,
+    ULONG ToNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the relative distance between two NUMA nodes, as
+    described by the SLIT.
+
+Arguments:
+
+    FromNode - Supplies the node the access originates from.
+
+    ToNode - Supplies the node being accessed.
+
+Return Value:
+
+    Returns the relative distance between the two nodes, where
+    SLIT_LOCAL_DISTANCE is the distance from a node to itself. If the firmware
+    does not describe the distance, SLIT_LOCAL_DISTANCE or
+    SLIT_DEFAULT_REMOTE_DISTANCE is returned.
+
+--*/
+
+{
+
+    PUCHAR Entries;
+    ULONGLONG LocalityCount;
+    PSLIT Slit;
+
+    Slit = AcpiFindTable(SLIT_SIGNATURE, NULL);
+    if (Slit != NULL) {
+        LocalityCount = Slit->LocalityCount;
+        if ((FromNode < LocalityCount) &&
+            (ToNode < LocalityCount) &&
+            (sizeof(SLIT) + (LocalityCount * LocalityCount) <=
+             Slit->Header.Length)) {
+
+            Entries = (PUCHAR)(Slit + 1);
+            return Entries[(FromNode * LocalityCount) + ToNode];
+        }
+    }
+
+    if (FromNode == ToNode) {
+        return SLIT_LOCAL_DISTANCE;
+    }
+
+    return SLIT_DEFAULT_REMOTE_DISTANCE;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+BOOL
+AcpipGetSratEntryNode (
+    PSRAT_GENERIC_ENTRY Entry,
+    PULONG Node
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the NUMA node of an enabled SRAT affinity entry. The
+    proximity domain is used as the node number directly, limited to the
+    maximum number of nodes the system tracks.
+
+Arguments:
+
+    Entry - Supplies a pointer to the SRAT entry.
+
+    Node - Supplies a pointer where the node number will be returned.
+
+Return Value:
+
+    TRUE if the entry is a recognized, enabled affinity entry.
+
+    FALSE if the entry is disabled or of an unknown type.
+
+--*/
+
+{
+
+    ULONG Domain;
+    ULONG Flags;
+    PSRAT_GICC_AFFINITY Gicc;
+    PSRAT_LOCAL_APIC_AFFINITY LocalApic;
+    PSRAT_MEMORY_AFFINITY Memory;
+    PSRAT_LOCAL_X2APIC_AFFINITY X2Apic;
+
+    switch (Entry->Type) {
+    case SratEntryTypeLocalApicAffinity:
+        if (Entry->Length < sizeof(SRAT_LOCAL_APIC_AFFINITY)) {
+            return FALSE;
+        }
+
+        LocalApic = (PSRAT_LOCAL_APIC_AFFINITY)Entry;
+        Domain = LocalApic->ProximityDomainLow |
+                 (LocalApic->ProximityDomainHigh[0] << 8) |
+                 (LocalApic->ProximityDomainHigh[1] << 16) |
+                 (LocalApic->ProximityDomainHigh[2] << 24);
+
+        Flags = LocalApic->Flags;
+        break;
+
+    case SratEntryTypeMemoryAffinity:
+        if (Entry->Length < sizeof(SRAT_MEMORY_AFFINITY)) {
+            return FALSE;
+        }
+
+        Memory = (PSRAT_MEMORY_AFFINITY)Entry;
+        Domain = Memory->ProximityDomain;
+        Flags = Memory->Flags;
+        break;
+
+    case SratEntryTypeLocalX2ApicAffinity:
+        if (Entry->Length < sizeof(SRAT_LOCAL_X2APIC_AFFINITY)) {
+            return FALSE;
+        }
+
+        X2Apic = (PSRAT_LOCAL_X2APIC_AFFINITY)Entry;
+        Domain = X2Apic->ProximityDomain;
+        Flags = X2Apic->Flags;
+        break;
+
+    case SratEntryTypeGiccAffinity:
+        if (Entry->Length < sizeof(SRAT_GICC_AFFINITY)) {
+            return FALSE;
+        }
+
+        Gicc = (PSRAT_GICC_AFFINITY)Entry;
+        Domain = Gicc->ProximityDomain;
+        Flags = Gicc->Flags;
+        break;
+
+    default:
+        return FALSE;
+    }
+
+    if ((Flags & SRAT_AFFINITY_FLAG_ENABLED) == 0) {
+        return FALSE;
+    }
+
+    if (Domain >= ACPI_MAX_NUMA_NODES) {
+        Domain = ACPI_MAX_NUMA_NODES - 1;
+    }
+
+    *Node = Domain;
+    return TRUE;
+}
+
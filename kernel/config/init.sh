@@ -99,6 +99,14 @@ rm -rf "$WORLD/tmp" "$WORLD/dev"
 mkdir -p "$WORLD/dev"
 mkdir -p -m1777 "$WORLD/tmp"
 
+##
+## Put tmp in memory if the temporary file system is available.
+##
+
+if test -b "/Device/TmpFs"; then
+    mount "/Device/TmpFs" "$WORLD/tmp"
+fi
+
 ##
 ## Symlink swiss binaries.
 ##
@@ -2188,6 +2188,12 @@ Return Value:
         goto InterruptInitializeLocalUnitEnd;
     }
 
+    //
+    // Now that the processor's physical identifier is known, figure out which
+    // NUMA node it lives on.
+    //
+
+    KeGetCurrentProcessorBlock()->NumaNode = AcpiGetProcessorNode(Identifier);
     Status = HlpSetupProcessorAddressing(Identifier);
     if (!KSUCCESS(Status)) {
         goto InterruptInitializeLocalUnitEnd;
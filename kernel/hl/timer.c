@@ -261,6 +261,56 @@ Return Value:
     return HlProcessorCounter->CounterFrequency;
 }
 
+BOOL
+HlQueryProcessorCounterTimeOffset (
+    PULONGLONG Offset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not the time counter is simply the raw
+    processor counter plus a fixed offset, and returns that offset if so. This
+    is only the case if the processor counter is 64-bits wide, does not vary
+    with power states, and backs the time counter directly.
+
+Arguments:
+
+    Offset - Supplies a pointer where the value to add to a raw processor
+        counter read to get the time counter will be returned on success.
+
+Return Value:
+
+    TRUE if the time counter can be computed from the raw processor counter.
+
+    FALSE if the time counter must be queried through the hardware layer.
+
+--*/
+
+{
+
+    PHARDWARE_TIMER Timer;
+
+    Timer = HlTimeCounter;
+    if ((Timer == NULL) ||
+        (Timer != HlProcessorCounter) ||
+        (Timer->CounterBitWidth < 64) ||
+        ((Timer->Features & TIMER_FEATURE_PROCESSOR_COUNTER) == 0) ||
+        ((Timer->Features & TIMER_FEATURE_VARIANT) != 0)) {
+
+        return FALSE;
+    }
+
+    //
+    // The software offset is only set once when the time counter is zeroed at
+    // boot, so there is no need to synchronize with a writer here.
+    //
+
+    READ_INT64_SYNC(&(Timer->SoftwareOffset), Offset);
+    return TRUE;
+}
+
 KERNEL_API
 VOID
 HlBusySpin (
@@ -34,6 +34,7 @@ function build() {
     var arch = mconfig.arch;
     var archSources;
     var baseSources;
+    var buildLib;
     var entries;
     var lib;
 
@@ -43,6 +44,7 @@ function build() {
         "cstate.c",
         "device.c",
         "devinfo.c",
+        "devio.c",
         "devrem.c",
         "devres.c",
         "driver.c",
@@ -55,10 +57,13 @@ function build() {
         "intrupt.c",
         "iobase.c",
         "iohandle.c",
+        "ioring.c",
+        "iotrace.c",
         "irp.c",
         "mount.c",
         "obfs.c",
         "pagecach.c",
+        "pcindex.c",
         "path.c",
         "perm.c",
         "pipe.c",
@@ -72,7 +77,8 @@ function build() {
         "stream.c",
         "testhook.c",
         "unsocket.c",
-        "userio.c"
+        "userio.c",
+        "writebk.c"
     ];
 
     if ((arch == "armv7") || (arch == "armv6")) {
@@ -94,7 +100,20 @@ function build() {
         "inputs": baseSources + archSources,
     };
 
+    //
+    // Build the page cache index for the build machine so it can be tested.
+    //
+
+    buildLib = {
+        "label": "build_pcindex",
+        "output": "pcindex",
+        "inputs": ["pcindex.c"],
+        "build": true,
+        "prefix": "build"
+    };
+
     entries = kernelLibrary(lib);
+    entries += kernelLibrary(buildLib);
     return entries;
 }
 
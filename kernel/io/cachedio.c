@@ -37,6 +37,12 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define the number of pages a cached read looks up in the page cache at once.
+//
+
+#define CACHED_READ_LOOKUP_BATCH 16
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -139,6 +145,26 @@ IopPerformCachedIoBufferWrite (
     BOOL WriteOutNow
     );
 
+KSTATUS
+IopPerformDirectRead (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext,
+    PVOID DeviceContext
+    );
+
+KSTATUS
+IopPerformDirectWrite (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext,
+    PVOID DeviceContext
+    );
+
+BOOL
+IopIsDirectIoAligned (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext
+    );
+
 KSTATUS
 IopPerformDefaultNonCachedRead (
     PFILE_OBJECT FileObject,
@@ -198,6 +224,7 @@ Return Value:
 
 {
 
+    BOOL Direct;
     PFILE_OBJECT FileObject;
     UINTN FlushCount;
     BOOL LockHeldExclusive;
@@ -217,6 +244,19 @@ Return Value:
     OriginalOffset = IoContext->Offset;
     StartOffset = OriginalOffset;
 
+    //
+    // Direct I/O bypasses this file object's page cache entirely. It has no
+    // meaning for shared memory objects, which live in the page cache.
+    //
+
+    Direct = FALSE;
+    if (((Handle->OpenFlags & OPEN_FLAG_DIRECT) != 0) &&
+        (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) &&
+        (FileObject->Properties.Type != IoObjectSharedMemoryObject)) {
+
+        Direct = TRUE;
+    }
+
     //
     // Assuming this call is going to generate more pages, ask this thread to
     // do some trimming if things are too big. If this is the file system
@@ -225,7 +265,9 @@ Return Value:
     // trimming.
     //
 
-    if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
+    if ((Direct == FALSE) &&
+        (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE)) {
+
         TimidTrim = FALSE;
         if ((IoContext->Flags & IO_FLAG_FS_DATA) != 0) {
             TimidTrim = TRUE;
@@ -249,11 +291,14 @@ Return Value:
         //    up to a far offset.
         // 2) Otherwise if the FS flags are set, let the write go through
         //    unimpeded.
-        // 3) Otherwise go clean some entries.
+        // 3) Otherwise go clean some of this device's entries. Each device
+        //    gets a share of the dirty limit proportional to how fast it
+        //    writes back, so only writers to a device over its share pay.
         //
 
-        if ((IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) &&
-            (IopIsPageCacheTooDirty() != FALSE)) {
+        if ((Direct == FALSE) &&
+            (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) &&
+            (IopIsPageCacheTooDirty(FileObject->Writeback) != FALSE)) {
 
             if (FileObject->Properties.Type == IoObjectBlockDevice) {
                 IoContext->Flags |= IO_FLAG_DATA_SYNCHRONIZED;
@@ -265,7 +310,11 @@ Return Value:
                     FlushCount = (IoContext->SizeInBytes >> PageShift) + 1;
                 }
 
-                Status = IopFlushFileObjects(0, 0, &FlushCount);
+                IopWakeWritebackWorker(FileObject->Writeback);
+                Status = IopFlushWritebackContext(FileObject->Writeback,
+                                                  0,
+                                                  &FlushCount);
+
                 if (!KSUCCESS(Status)) {
                     return Status;
                 }
@@ -289,7 +338,12 @@ Return Value:
             IoContext->Offset = FileObject->Properties.Size;
         }
 
-        if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
+        if (Direct != FALSE) {
+            Status = IopPerformDirectWrite(FileObject,
+                                           IoContext,
+                                           Handle->DeviceContext);
+
+        } else if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
             Status = IopPerformCachedWrite(FileObject, IoContext);
 
         } else {
@@ -315,7 +369,12 @@ Return Value:
         }
 
         LockHeldExclusive = FALSE;
-        if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
+        if (Direct != FALSE) {
+            Status = IopPerformDirectRead(FileObject,
+                                          IoContext,
+                                          Handle->DeviceContext);
+
+        } else if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
             Status = IopPerformCachedRead(FileObject,
                                           IoContext,
                                           &LockHeldExclusive);
@@ -528,6 +587,9 @@ Return Value:
     ULONG DestinationByteOffset;
     PIO_BUFFER DestinationIoBuffer;
     ULONGLONG FileSize;
+    ULONG LookupCount;
+    PPAGE_CACHE_ENTRY LookupEntries[CACHED_READ_LOOKUP_BATCH];
+    ULONG LookupIndex;
     IO_CONTEXT MissContext;
     UINTN MissSize;
     PIO_BUFFER PageAlignedIoBuffer;
@@ -547,6 +609,8 @@ Return Value:
 
     IoContext->BytesCompleted = 0;
     DestinationIoBuffer = IoContext->IoBuffer;
+    LookupCount = 0;
+    LookupIndex = 0;
     PageAlignedIoBuffer = NULL;
     PageCacheEntry = NULL;
     PageSize = MmPageSize();
@@ -622,7 +686,8 @@ Return Value:
     //
     // Iterate over each page, searching for page cache entries or creating
     // new page cache entries if there is a cache miss. Batch any missed reads
-    // to limit the calls to the file system.
+    // to limit the calls to the file system, and look up runs of pages at once
+    // to limit the walks of the page cache index.
     //
 
     CacheMiss = FALSE;
@@ -644,7 +709,24 @@ Return Value:
 
         ASSERT(IS_ALIGNED(CurrentOffset, PageSize) != FALSE);
 
-        PageCacheEntry = IopLookupPageCacheEntry(FileObject, CurrentOffset);
+        if (LookupIndex == LookupCount) {
+            LookupCount = CACHED_READ_LOOKUP_BATCH;
+            if (BytesRemaining < (LookupCount * PageSize)) {
+                LookupCount = ALIGN_RANGE_UP(BytesRemaining, PageSize) /
+                              PageSize;
+            }
+
+            IopLookupPageCacheEntries(FileObject,
+                                      CurrentOffset,
+                                      LookupCount,
+                                      LookupEntries);
+
+            LookupIndex = 0;
+        }
+
+        PageCacheEntry = LookupEntries[LookupIndex];
+        LookupEntries[LookupIndex] = NULL;
+        LookupIndex += 1;
         if (PageCacheEntry != NULL) {
 
             //
@@ -714,11 +796,22 @@ Return Value:
             CacheMiss = TRUE;
 
             //
-            // Cache misses are going to modify the page cache tree, so
-            // the lock needs to be held exclusive.
+            // Cache misses are going to modify the page cache index, so
+            // the lock needs to be held exclusive. The conversion may drop
+            // the lock, so the rest of the batch is stale and the next pages
+            // need to be looked up again.
             //
 
             if (*LockHeldExclusive == FALSE) {
+                while (LookupIndex != LookupCount) {
+                    if (LookupEntries[LookupIndex] != NULL) {
+                        IoPageCacheEntryReleaseReference(
+                                                  LookupEntries[LookupIndex]);
+                    }
+
+                    LookupIndex += 1;
+                }
+
                 KeSharedExclusiveLockConvertToExclusive(FileObject->Lock);
                 *LockHeldExclusive = TRUE;
             }
@@ -795,6 +888,14 @@ Return Value:
         IoPageCacheEntryReleaseReference(PageCacheEntry);
     }
 
+    while (LookupIndex != LookupCount) {
+        if (LookupEntries[LookupIndex] != NULL) {
+            IoPageCacheEntryReleaseReference(LookupEntries[LookupIndex]);
+        }
+
+        LookupIndex += 1;
+    }
+
     if ((PageAlignedIoBuffer != NULL) &&
         (PageAlignedIoBuffer != DestinationIoBuffer)) {
 
@@ -1082,7 +1183,7 @@ Return Value:
 
     if (!KSUCCESS(Status)) {
         FileSize = FileObject->Properties.Size;
-        IopEvictFileObject(FileObject, FileSize, EVICTION_FLAG_TRUNCATE);
+        IopEvictFileObject(FileObject, FileSize, -1, EVICTION_FLAG_TRUNCATE);
     }
 
     //
@@ -1836,7 +1937,10 @@ Return Value:
         if (IoContext->BytesCompleted < IoContext->SizeInBytes) {
             FileOffset = IoContext->Offset + IoContext->BytesCompleted;
             FileOffset = ALIGN_RANGE_DOWN(FileOffset, PageSize);
-            IopEvictFileObject(FileObject, FileOffset, EVICTION_FLAG_TRUNCATE);
+            IopEvictFileObject(FileObject,
+                               FileOffset,
+                               -1,
+                               EVICTION_FLAG_TRUNCATE);
         }
 
     //
@@ -1852,6 +1956,193 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+IopPerformDirectRead (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext,
+    PVOID DeviceContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads from a cacheable file object without going through its
+    page cache, transferring data straight into the caller's buffer. Any
+    dirty page cache entries in the range are flushed first so the read sees
+    them. It is assumed that the file lock is held in shared mode.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object for the device or file.
+
+    IoContext - Supplies a pointer to the I/O context.
+
+    DeviceContext - Supplies a pointer to the device context to use when
+        reading from the backing device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    ASSERT(KeIsSharedExclusiveLockHeldShared(FileObject->Lock) != FALSE);
+
+    IoContext->BytesCompleted = 0;
+    if (IopIsDirectIoAligned(FileObject, IoContext) == FALSE) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (IoContext->SizeInBytes == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Push any dirty cached data in the range down to the next layer. For
+    // files that is the block device's cache, which the file system reads
+    // through, and for block devices it is the disk.
+    //
+
+    if (PAGE_CACHE_INDEX_EMPTY(&(FileObject->PageCacheIndex)) == FALSE) {
+        Status = IopFlushPageCacheEntries(FileObject,
+                                          IoContext->Offset,
+                                          IoContext->SizeInBytes,
+                                          0,
+                                          NULL);
+
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
+    Status = IopPerformNonCachedRead(FileObject, IoContext, DeviceContext);
+    return Status;
+}
+
+KSTATUS
+IopPerformDirectWrite (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext,
+    PVOID DeviceContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes to a cacheable file object without going through its
+    page cache, sending the caller's buffer straight down. Any page cache
+    entries in the range are evicted first, as the write replaces them
+    entirely. It is assumed that the file lock is held exclusively.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object for the device or file.
+
+    IoContext - Supplies a pointer to the I/O context.
+
+    DeviceContext - Supplies a pointer to the device context to use when
+        writing to the backing device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock) != FALSE);
+
+    IoContext->BytesCompleted = 0;
+    if (IopIsDirectIoAligned(FileObject, IoContext) == FALSE) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (IoContext->SizeInBytes == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Cached pages in the range would go stale, and dirty ones would later
+    // overwrite the new data. Since the range covers whole pages, drop them
+    // without writing them out. Mappings of those pages have to go first.
+    //
+
+    if (PAGE_CACHE_INDEX_EMPTY(&(FileObject->PageCacheIndex)) == FALSE) {
+        if (FileObject->ImageSectionList != NULL) {
+            MmUnmapImageSectionList(FileObject->ImageSectionList,
+                                    IoContext->Offset,
+                                    IoContext->SizeInBytes,
+                                    IMAGE_SECTION_UNMAP_FLAG_PAGE_CACHE_ONLY);
+        }
+
+        IopEvictPageCacheEntries(FileObject,
+                                 IoContext->Offset,
+                                 IoContext->SizeInBytes,
+                                 0);
+    }
+
+    Status = IopPerformNonCachedWrite(FileObject, IoContext, DeviceContext);
+    return Status;
+}
+
+BOOL
+IopIsDirectIoAligned (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a direct I/O request is suitably aligned.
+    Direct requests must cover whole pages, so that the page cache entries
+    they overlap can be flushed or evicted whole, and whole blocks of the
+    device.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object for the device or file.
+
+    IoContext - Supplies a pointer to the I/O context.
+
+Return Value:
+
+    TRUE if the offset and size of the request are aligned.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    ULONG Alignment;
+
+    Alignment = MmPageSize();
+    if ((FileObject->Properties.Type == IoObjectBlockDevice) &&
+        (FileObject->Properties.BlockSize > Alignment)) {
+
+        Alignment = FileObject->Properties.BlockSize;
+    }
+
+    if ((IS_ALIGNED(IoContext->Offset, Alignment) == FALSE) ||
+        (IS_ALIGNED(IoContext->SizeInBytes, Alignment) == FALSE)) {
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 KSTATUS
 IopPerformDefaultNonCachedRead (
     PFILE_OBJECT FileObject,
@@ -0,0 +1,409 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    devio.c
+
+Abstract:
+
+    This module implements per-device I/O statistics. Each device that
+    receives I/O requests counts its reads and writes, the time they took, and
+    a log-scale histogram of their latencies, which tools like iostat sample
+    to compute throughput, service times and queue depth.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define DEVICE_IO_ALLOCATION_TAG 0x53496544 // 'SIeD'
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines the I/O statistics kept for a device. All members
+    are updated with atomic operations, so that recording a request never
+    takes a lock.
+
+Members:
+
+    InFlight - Stores the number of requests currently outstanding to the
+        device.
+
+    Read - Stores the statistics of reads from the device.
+
+    Write - Stores the statistics of writes to the device.
+
+--*/
+
+struct _DEVICE_IO_STATISTICS {
+    volatile ULONG InFlight;
+    IO_DEVICE_OPERATION_STATISTICS Read;
+    IO_DEVICE_OPERATION_STATISTICS Write;
+};
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+IopCopyDeviceOperationStatistics (
+    PIO_DEVICE_OPERATION_STATISTICS Destination,
+    PIO_DEVICE_OPERATION_STATISTICS Source
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+PDEVICE_IO_STATISTICS
+IopStartDeviceIo (
+    PDEVICE Device,
+    PULONGLONG StartTime
+    )
+
+/*++
+
+Routine Description:
+
+    This routine accounts for an I/O request being dispatched to a device.
+
+Arguments:
+
+    Device - Supplies a pointer to the device receiving the request.
+
+    StartTime - Supplies a pointer where the time counter value at dispatch
+        will be returned. This is returned even if the statistics could not
+        be allocated, so the request can still be traced.
+
+Return Value:
+
+    Returns a pointer to the device's statistics, which must be passed to the
+    end routine when the request completes.
+
+    NULL if the statistics could not be allocated. The request simply goes
+    uncounted in the statistics.
+
+--*/
+
+{
+
+    PDEVICE_IO_STATISTICS NewStatistics;
+    PDEVICE_IO_STATISTICS Statistics;
+
+    *StartTime = HlQueryTimeCounter();
+    Statistics = Device->IoStatistics;
+    if (Statistics == NULL) {
+
+        //
+        // This may be on the paging path, so keep the statistics out of paged
+        // pool. Race to install them.
+        //
+
+        NewStatistics = MmAllocateNonPagedPool(sizeof(DEVICE_IO_STATISTICS),
+                                               DEVICE_IO_ALLOCATION_TAG);
+
+        if (NewStatistics == NULL) {
+            return NULL;
+        }
+
+        RtlZeroMemory(NewStatistics, sizeof(DEVICE_IO_STATISTICS));
+        Statistics = (PDEVICE_IO_STATISTICS)RtlAtomicCompareExchange(
+                                                (PUINTN)&(Device->IoStatistics),
+                                                (UINTN)NewStatistics,
+                                                (UINTN)NULL);
+
+        if (Statistics == NULL) {
+            Statistics = NewStatistics;
+
+        } else {
+            MmFreeNonPagedPool(NewStatistics);
+        }
+    }
+
+    RtlAtomicAdd32(&(Statistics->InFlight), 1);
+    return Statistics;
+}
+
+VOID
+IopEndDeviceIo (
+    PDEVICE_IO_STATISTICS Statistics,
+    BOOL Write,
+    UINTN BytesCompleted,
+    ULONGLONG StartTime
+    )
+
+/*++
+
+Routine Description:
+
+    This routine accounts for the completion of an I/O request to a device.
+
+Arguments:
+
+    Statistics - Supplies a pointer to the statistics returned when the
+        request was dispatched.
+
+    Write - Supplies a boolean indicating if the request was a write (TRUE) or
+        a read (FALSE).
+
+    BytesCompleted - Supplies the number of bytes the request transferred.
+
+    StartTime - Supplies the time counter value at dispatch.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    ULONGLONG Microseconds;
+    PIO_DEVICE_OPERATION_STATISTICS Operation;
+
+    Microseconds = (HlQueryTimeCounter() - StartTime) *
+                   MICROSECONDS_PER_SECOND /
+                   HlQueryTimeCounterFrequency();
+
+    Operation = &(Statistics->Read);
+    if (Write != FALSE) {
+        Operation = &(Statistics->Write);
+    }
+
+    //
+    // The bucket is the index of the highest bit set in the latency.
+    //
+
+    Bucket = 0;
+    if (Microseconds > 1) {
+        Bucket = 63 - RtlCountLeadingZeros64(Microseconds);
+        if (Bucket >= IO_LATENCY_HISTOGRAM_SIZE) {
+            Bucket = IO_LATENCY_HISTOGRAM_SIZE - 1;
+        }
+    }
+
+    RtlAtomicAdd64(&(Operation->Count), 1);
+    RtlAtomicAdd64(&(Operation->Bytes), BytesCompleted);
+    RtlAtomicAdd64(&(Operation->Microseconds), Microseconds);
+    RtlAtomicAdd64(&(Operation->Histogram[Bucket]), 1);
+    RtlAtomicAdd32(&(Statistics->InFlight), -1);
+    return;
+}
+
+VOID
+IopDestroyDeviceIoStatistics (
+    PDEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the I/O statistics of a device being destroyed.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Device->IoStatistics != NULL) {
+
+        ASSERT(Device->IoStatistics->InFlight == 0);
+
+        MmFreeNonPagedPool(Device->IoStatistics);
+        Device->IoStatistics = NULL;
+    }
+
+    return;
+}
+
+KSTATUS
+IopGetDeviceStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the I/O statistics of each device that has received I/O.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN Copied;
+    UINTN Count;
+    PLIST_ENTRY CurrentEntry;
+    PDEVICE Device;
+    PDEVICE_IO_STATISTICS DeviceStatistics;
+    UINTN RequiredSize;
+    PIO_DEVICE_STATISTICS Statistics;
+    KSTATUS Status;
+
+    if (Set != FALSE) {
+        *DataSize = 0;
+        return STATUS_ACCESS_DENIED;
+    }
+
+    Count = 0;
+    Statistics = Data;
+    Status = STATUS_SUCCESS;
+    KeAcquireQueuedLock(IoDeviceListLock);
+    CurrentEntry = IoDeviceList.Next;
+    while (CurrentEntry != &IoDeviceList) {
+        Device = LIST_VALUE(CurrentEntry, DEVICE, ListEntry);
+        if (Device->IoStatistics != NULL) {
+            Count += 1;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    RequiredSize = Count * sizeof(IO_DEVICE_STATISTICS);
+    if (*DataSize < RequiredSize) {
+        Status = STATUS_BUFFER_TOO_SMALL;
+        goto GetDeviceStatisticsEnd;
+    }
+
+    //
+    // Statistics are attached to devices without the list lock held, so more
+    // devices may have them now than were counted. Stop once the space that
+    // was sized for is full.
+    //
+
+    Copied = 0;
+    CurrentEntry = IoDeviceList.Next;
+    while ((CurrentEntry != &IoDeviceList) && (Copied < Count)) {
+        Device = LIST_VALUE(CurrentEntry, DEVICE, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        DeviceStatistics = Device->IoStatistics;
+        if (DeviceStatistics == NULL) {
+            continue;
+        }
+
+        Statistics->DeviceId = Device->DeviceId;
+        RtlStringCopy(Statistics->DeviceName,
+                      Device->Header.Name,
+                      IO_DEVICE_STATISTICS_NAME_SIZE);
+
+        Statistics->InFlight = DeviceStatistics->InFlight;
+        IopCopyDeviceOperationStatistics(&(Statistics->Read),
+                                         &(DeviceStatistics->Read));
+
+        IopCopyDeviceOperationStatistics(&(Statistics->Write),
+                                         &(DeviceStatistics->Write));
+
+        Statistics += 1;
+        Copied += 1;
+    }
+
+GetDeviceStatisticsEnd:
+    KeReleaseQueuedLock(IoDeviceListLock);
+    *DataSize = RequiredSize;
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+IopCopyDeviceOperationStatistics (
+    PIO_DEVICE_OPERATION_STATISTICS Destination,
+    PIO_DEVICE_OPERATION_STATISTICS Source
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a snapshot of one direction of a device's statistics.
+    Each counter is read atomically so that it cannot tear on 32-bit
+    machines, though the counters may be slightly out of step with each other.
+
+Arguments:
+
+    Destination - Supplies a pointer where the snapshot will be returned.
+
+    Source - Supplies a pointer to the live statistics.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Bucket;
+
+    Destination->Count = RtlAtomicOr64(&(Source->Count), 0);
+    Destination->Bytes = RtlAtomicOr64(&(Source->Bytes), 0);
+    Destination->Microseconds = RtlAtomicOr64(&(Source->Microseconds), 0);
+    for (Bucket = 0; Bucket < IO_LATENCY_HISTOGRAM_SIZE; Bucket += 1) {
+        Destination->Histogram[Bucket] =
+                                 RtlAtomicOr64(&(Source->Histogram[Bucket]), 0);
+    }
+
+    return;
+}
+
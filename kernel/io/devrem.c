@@ -320,7 +320,7 @@ Return Value:
     // should have flushed block devices by this point.
     //
 
-    IopEvictFileObjects(Device->DeviceId, EVICTION_FLAG_REMOVE);
+    IopEvictFileObjects(Device->DeviceId, 0, -1, EVICTION_FLAG_REMOVE);
 
     //
     // Flush the file objects for the device. Eviction should have removed all
@@ -706,6 +706,7 @@ Return Value:
     //
 
     PmpDestroyDevice(Device);
+    IopDestroyDeviceIoStatistics(Device);
 
     //
     // Delete the arbiter list and the various resource lists.
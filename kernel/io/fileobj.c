@@ -40,10 +40,82 @@ Module Name:
 #define FILE_OBJECT_ALLOCATION_TAG 0x624F6946 // 'bOiF'
 #define FILE_OBJECT_MAX_REFERENCE_COUNT 0x10000000
 
+//
+// Define the number of independently locked buckets the file object table is
+// split into. This must be a power of two.
+//
+
+#define FILE_OBJECT_BUCKET_COUNT 64
+
+//
+// Define the number of dirty file object lists. Dirty file objects are spread
+// across these by device ID so that flushing one device does not contend
+// with others. This must be a power of two.
+//
+
+#define DIRTY_FILE_OBJECT_LIST_COUNT 16
+
+//
+// Define the multiplier used to hash file object keys.
+//
+
+#define FILE_OBJECT_HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines one bucket of the global file object table.
+
+Members:
+
+    Lock - Stores a pointer to the lock protecting the bucket's tree and
+        orphaned list, as well as the reference count transitions of the file
+        objects in it.
+
+    Tree - Stores the tree of file objects that hash to this bucket, keyed by
+        device and file ID.
+
+    OrphanedList - Stores the list of file objects in this bucket that failed
+        to close and are waiting to be cleaned up.
+
+--*/
+
+typedef struct _FILE_OBJECT_BUCKET {
+    PQUEUED_LOCK Lock;
+    RED_BLACK_TREE Tree;
+    LIST_ENTRY OrphanedList;
+} FILE_OBJECT_BUCKET, *PFILE_OBJECT_BUCKET;
+
+/*++
+
+Structure Description:
+
+    This structure defines a list of dirty file objects.
+
+Members:
+
+    Lock - Stores a pointer to the lock protecting the lists.
+
+    FileList - Stores the list of dirty file objects that are not block
+        devices.
+
+    BlockDeviceList - Stores the list of dirty block device file objects.
+        These are kept apart so that flushing everything can push the upper
+        layers down to the block devices before flushing the block devices.
+
+--*/
+
+typedef struct _DIRTY_FILE_OBJECT_LIST {
+    PQUEUED_LOCK Lock;
+    LIST_ENTRY FileList;
+    LIST_ENTRY BlockDeviceList;
+} DIRTY_FILE_OBJECT_LIST, *PDIRTY_FILE_OBJECT_LIST;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -63,9 +135,40 @@ IopCompareFileObjectNodes (
 
 PFILE_OBJECT
 IopLookupFileObjectByProperties (
+    PFILE_OBJECT_BUCKET Bucket,
     PFILE_PROPERTIES Properties
     );
 
+PFILE_OBJECT_BUCKET
+IopGetFileObjectBucket (
+    DEVICE_ID DeviceId,
+    FILE_ID FileId
+    );
+
+PDIRTY_FILE_OBJECT_LIST
+IopGetDirtyFileObjectList (
+    DEVICE_ID DeviceId
+    );
+
+KSTATUS
+IopFlushDirtyFileObjectList (
+    PDIRTY_FILE_OBJECT_LIST DirtyList,
+    PLIST_ENTRY ListHead,
+    DEVICE_ID DeviceId,
+    ULONG Flags,
+    BOOL FlushExclusive,
+    PUINTN PageCount,
+    PWRITEBACK_CONTEXT Writeback
+    );
+
+PFILE_OBJECT
+IopFindDirtyFileObject (
+    PLIST_ENTRY ListHead,
+    PLIST_ENTRY CurrentEntry,
+    DEVICE_ID DeviceId,
+    PWRITEBACK_CONTEXT Writeback
+    );
+
 VOID
 IopDestroyAsyncState (
     PIO_ASYNC_STATE Async
@@ -83,34 +186,22 @@ IopSendIoSignal (
 //
 
 //
-// Store the global tree of file objects.
-//
-
-RED_BLACK_TREE IoFileObjectsTree;
-
-//
-// Store the global list of dirty file objects.
-//
-
-LIST_ENTRY IoFileObjectsDirtyList;
-
-//
-// Store the lock synchronizing access to the dirty file objects list.
+// Store the global table of file objects.
 //
 
-PQUEUED_LOCK IoFileObjectsDirtyListLock;
+FILE_OBJECT_BUCKET IoFileObjectBuckets[FILE_OBJECT_BUCKET_COUNT];
 
 //
-// Store the global list of orphaned file objects.
+// Store the lists of dirty file objects.
 //
 
-LIST_ENTRY IoFileObjectsOrphanedList;
+DIRTY_FILE_OBJECT_LIST IoDirtyFileObjectLists[DIRTY_FILE_OBJECT_LIST_COUNT];
 
 //
-// Store a queued lock that protects both the tree and the list.
+// Store the number of file objects on the dirty lists.
 //
 
-PQUEUED_LOCK IoFileObjectsLock;
+volatile ULONG IoDirtyFileObjectCount;
 
 //
 // Store a lock that can serialize flush operations.
@@ -521,6 +612,94 @@ Return Value:
     return;
 }
 
+KERNEL_API
+KSTATUS
+IoFlushDeviceCache (
+    PDEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes all of a device's dirty data in the page cache back to
+    the device.
+
+Arguments:
+
+    Device - Supplies a pointer to the device to flush.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    return IopFlushFileObjects(Device->DeviceId, 0, NULL);
+}
+
+KERNEL_API
+VOID
+IoEvictDeviceCache (
+    PDEVICE Device,
+    IO_OFFSET Offset,
+    ULONGLONG Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine evicts a region of a device's data from the page cache, dirty
+    or not. Block device drivers call this when the data behind a device
+    changes without going through the page cache. Pages that partially overlap
+    the region are evicted as well. The caller must make sure nothing is using
+    the region.
+
+Arguments:
+
+    Device - Supplies a pointer to the device to evict.
+
+    Offset - Supplies the byte offset of the region to evict.
+
+    Size - Supplies the size of the region in bytes. Supply -1 to evict
+        everything from the given offset to the end of the device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG End;
+    ULONG PageSize;
+
+    PageSize = IoGetCacheEntryDataSize();
+    if (Size != -1ULL) {
+        if (Size == 0) {
+            return;
+        }
+
+        End = ALIGN_RANGE_UP(Offset + Size, PageSize);
+        Offset = ALIGN_RANGE_DOWN(Offset, PageSize);
+        Size = End - Offset;
+
+    } else {
+        Offset = ALIGN_RANGE_DOWN(Offset, PageSize);
+    }
+
+    IopEvictFileObjects(Device->DeviceId,
+                        Offset,
+                        Size,
+                        EVICTION_FLAG_TRUNCATE);
+
+    return;
+}
+
 PVOID
 IoReferenceFileObjectForHandle (
     PIO_HANDLE IoHandle
@@ -704,17 +883,31 @@ Return Value:
 
 {
 
-    RtlRedBlackTreeInitialize(&IoFileObjectsTree, 0, IopCompareFileObjectNodes);
-    INITIALIZE_LIST_HEAD(&IoFileObjectsDirtyList);
-    INITIALIZE_LIST_HEAD(&IoFileObjectsOrphanedList);
-    IoFileObjectsLock = KeCreateQueuedLock();
-    if (IoFileObjectsLock == NULL) {
-        return STATUS_INSUFFICIENT_RESOURCES;
+    PFILE_OBJECT_BUCKET Bucket;
+    PDIRTY_FILE_OBJECT_LIST DirtyList;
+    ULONG Index;
+
+    for (Index = 0; Index < FILE_OBJECT_BUCKET_COUNT; Index += 1) {
+        Bucket = &(IoFileObjectBuckets[Index]);
+        RtlRedBlackTreeInitialize(&(Bucket->Tree),
+                                  0,
+                                  IopCompareFileObjectNodes);
+
+        INITIALIZE_LIST_HEAD(&(Bucket->OrphanedList));
+        Bucket->Lock = KeCreateQueuedLock();
+        if (Bucket->Lock == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
     }
 
-    IoFileObjectsDirtyListLock = KeCreateQueuedLock();
-    if (IoFileObjectsDirtyListLock == NULL) {
-        return STATUS_INSUFFICIENT_RESOURCES;
+    for (Index = 0; Index < DIRTY_FILE_OBJECT_LIST_COUNT; Index += 1) {
+        DirtyList = &(IoDirtyFileObjectLists[Index]);
+        INITIALIZE_LIST_HEAD(&(DirtyList->FileList));
+        INITIALIZE_LIST_HEAD(&(DirtyList->BlockDeviceList));
+        DirtyList->Lock = KeCreateQueuedLock();
+        if (DirtyList->Lock == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
     }
 
     IoFlushLock = KeCreateSharedExclusiveLock();
@@ -774,6 +967,7 @@ Return Value:
 
 {
 
+    PFILE_OBJECT_BUCKET Bucket;
     BOOL Created;
     BOOL LockHeld;
     PFILE_OBJECT NewObject;
@@ -784,6 +978,7 @@ Return Value:
     ASSERT(Properties->DeviceId != 0);
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
+    Bucket = IopGetFileObjectBucket(Properties->DeviceId, Properties->FileId);
     Created = FALSE;
     LockHeld = FALSE;
     NewObject = NULL;
@@ -795,16 +990,16 @@ Return Value:
         // See if the file object already exists.
         //
 
-        KeAcquireQueuedLock(IoFileObjectsLock);
+        KeAcquireQueuedLock(Bucket->Lock);
         LockHeld = TRUE;
-        Object = IopLookupFileObjectByProperties(Properties);
+        Object = IopLookupFileObjectByProperties(Bucket, Properties);
         if (Object == NULL) {
 
             //
             // There's no object, so drop the lock and go allocate one.
             //
 
-            KeReleaseQueuedLock(IoFileObjectsLock);
+            KeReleaseQueuedLock(Bucket->Lock);
             LockHeld = FALSE;
             if (NewObject == NULL) {
                 NewObject = MmAllocatePagedPool(sizeof(FILE_OBJECT),
@@ -816,12 +1011,8 @@ Return Value:
                 }
 
                 RtlZeroMemory(NewObject, sizeof(FILE_OBJECT));
-                INITIALIZE_LIST_HEAD(&(NewObject->FileLockList));
                 INITIALIZE_LIST_HEAD(&(NewObject->DirtyPageList));
-                RtlRedBlackTreeInitialize(&(NewObject->PageCacheTree),
-                                          0,
-                                          IopComparePageCacheEntries);
-
+                INITIALIZE_PAGE_CACHE_INDEX(&(NewObject->PageCacheIndex));
                 NewObject->Lock = KeCreateSharedExclusiveLock();
                 if (NewObject->Lock == NULL) {
                     Status = STATUS_INSUFFICIENT_RESOURCES;
@@ -863,6 +1054,14 @@ Return Value:
                 NewObject->MapFlags = MapFlags;
                 NewObject->Device = Device;
                 ObAddReference(Device);
+                NewObject->Writeback = IopGetWritebackContext(
+                                                        Properties->DeviceId,
+                                                        Properties->Type);
+
+                if (NewObject->Writeback == NULL) {
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                    goto CreateOrLookupFileObjectEnd;
+                }
 
                 //
                 // If the device is a special device, then more state needs to
@@ -876,6 +1075,7 @@ Return Value:
                 case IoObjectTerminalMaster:
                 case IoObjectTerminalSlave:
                 case IoObjectSharedMemoryObject:
+                case IoObjectIoRing:
                     break;
 
                 default:
@@ -904,12 +1104,11 @@ Return Value:
             // added this entry since the lock was dropped, so check once more.
             //
 
-            KeAcquireQueuedLock(IoFileObjectsLock);
+            KeAcquireQueuedLock(Bucket->Lock);
             LockHeld = TRUE;
-            Object = IopLookupFileObjectByProperties(Properties);
+            Object = IopLookupFileObjectByProperties(Bucket, Properties);
             if (Object == NULL) {
-                RtlRedBlackTreeInsert(&IoFileObjectsTree,
-                                      &(NewObject->TreeEntry));
+                RtlRedBlackTreeInsert(&(Bucket->Tree), &(NewObject->TreeEntry));
 
                 ASSERT(NewObject->ListEntry.Next == NULL);
 
@@ -919,7 +1118,7 @@ Return Value:
             }
         }
 
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Bucket->Lock);
         LockHeld = FALSE;
 
         //
@@ -957,7 +1156,7 @@ Return Value:
 
 CreateOrLookupFileObjectEnd:
     if (LockHeld != FALSE) {
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Bucket->Lock);
     }
 
     if (!KSUCCESS(Status)) {
@@ -985,6 +1184,10 @@ Return Value:
             KeDestroyEvent(NewObject->ReadyEvent);
         }
 
+        if (NewObject->Writeback != NULL) {
+            IopReleaseWritebackContext(NewObject->Writeback);
+        }
+
         ObReleaseReference(NewObject->Device);
         MmFreePagedPool(NewObject);
     }
@@ -1062,6 +1265,7 @@ Return Value:
 
 {
 
+    PFILE_OBJECT_BUCKET Bucket;
     IRP_CLOSE CloseIrp;
     PDEVICE Device;
     IRP_MINOR_CODE MinorCode;
@@ -1070,6 +1274,8 @@ Return Value:
     KSTATUS Status;
 
     Status = STATUS_SUCCESS;
+    Bucket = IopGetFileObjectBucket(Object->Properties.DeviceId,
+                                    Object->Properties.FileId);
 
     //
     // Acquire the lock before decrementing the reference count. This is needed
@@ -1078,11 +1284,11 @@ Return Value:
     // count thinking the file object was good to use, and then this function
     // would close it down on them. It's assumed that people calling add
     // reference on the file object already had some other valid reference,
-    // otherwise the global lock would have to be acquired in the add reference
+    // otherwise the bucket lock would have to be acquired in the add reference
     // routine as well.
     //
 
-    KeAcquireQueuedLock(IoFileObjectsLock);
+    KeAcquireQueuedLock(Bucket->Lock);
     OldCount = RtlAtomicAdd32(&(Object->ReferenceCount), -1);
 
     ASSERT((OldCount != 0) && (OldCount < FILE_OBJECT_MAX_REFERENCE_COUNT));
@@ -1102,7 +1308,7 @@ Return Value:
         //
 
         if ((Object->Flags & FILE_OBJECT_FLAG_CLOSING) != 0) {
-            KeReleaseQueuedLock(IoFileObjectsLock);
+            KeReleaseQueuedLock(Bucket->Lock);
             goto FileObjectReleaseReferenceEnd;
         }
 
@@ -1136,7 +1342,7 @@ Return Value:
         //      deadlock with the failed file clean-up.
         //
 
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Bucket->Lock);
 
         //
         // As dirty file objects sit on the dirty file object list with a
@@ -1192,13 +1398,13 @@ Return Value:
 
         //
         // The file system is officially disengaged from this file object,
-        // remove the file object from the global tree, allowing new callers to
-        // recreate the file object.
+        // remove the file object from the global table, allowing new callers
+        // to recreate the file object.
         //
 
-        KeAcquireQueuedLock(IoFileObjectsLock);
-        RtlRedBlackTreeRemove(&IoFileObjectsTree, &(Object->TreeEntry));
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeAcquireQueuedLock(Bucket->Lock);
+        RtlRedBlackTreeRemove(&(Bucket->Tree), &(Object->TreeEntry));
+        KeReleaseQueuedLock(Bucket->Lock);
 
         //
         // Now release everyone who got stuck while trying to open this closing
@@ -1215,12 +1421,11 @@ Return Value:
     //
 
     } else if (OldCount == 1) {
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Bucket->Lock);
 
         ASSERT(Object->ListEntry.Next == NULL);
         ASSERT((Object->Flags & FILE_OBJECT_FLAG_CLOSING) != 0);
         ASSERT(Object->PathEntryCount == 0);
-        ASSERT(LIST_EMPTY(&(Object->FileLockList)) != FALSE);
 
         //
         // If this was an object manager object, release the reference on the
@@ -1244,6 +1449,7 @@ Return Value:
             case IoObjectTerminalMaster:
             case IoObjectTerminalSlave:
             case IoObjectSharedMemoryObject:
+            case IoObjectIoRing:
                 ObReleaseReference(Object->SpecialIo);
                 break;
 
@@ -1260,11 +1466,12 @@ Return Value:
         //
 
         ObReleaseReference(Object->Device);
+        IopReleaseWritebackContext(Object->Writeback);
         if (Object->ImageSectionList != NULL) {
             MmDestroyImageSectionList(Object->ImageSectionList);
         }
 
-        ASSERT(RED_BLACK_TREE_EMPTY(&(Object->PageCacheTree)));
+        ASSERT(PAGE_CACHE_INDEX_EMPTY(&(Object->PageCacheIndex)));
         ASSERT(LIST_EMPTY(&(Object->DirtyPageList)));
 
         if (Object->Lock != NULL) {
@@ -1286,9 +1493,7 @@ Return Value:
             KeDestroyEvent(Object->ReadyEvent);
         }
 
-        if (Object->FileLockEvent != NULL) {
-            KeDestroyEvent(Object->FileLockEvent);
-        }
+        IopDestroyFileLockState(Object);
 
         MmFreePagedPool(Object);
         Object = NULL;
@@ -1299,7 +1504,7 @@ Return Value:
     //
 
     } else {
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Bucket->Lock);
     }
 
 FileObjectReleaseReferenceEnd:
@@ -1320,12 +1525,12 @@ Return Value:
         // orphaned objects.
         //
 
-        KeAcquireQueuedLock(IoFileObjectsLock);
+        KeAcquireQueuedLock(Bucket->Lock);
         if (Object->ReferenceCount == 1) {
-            INSERT_BEFORE(&(Object->ListEntry), &IoFileObjectsOrphanedList);
+            INSERT_BEFORE(&(Object->ListEntry), &(Bucket->OrphanedList));
         }
 
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Bucket->Lock);
 
         //
         // The signal event acts as a memory barrier still protecting this
@@ -1473,7 +1678,7 @@ Return Value:
 
         KeSharedExclusiveLockConvertToExclusive(FileObject->Lock);
         Exclusive = TRUE;
-        IopEvictFileObject(FileObject, 0, EVICTION_FLAG_REMOVE);
+        IopEvictFileObject(FileObject, 0, -1, EVICTION_FLAG_REMOVE);
         ClearFlags = FILE_OBJECT_FLAG_DIRTY_PROPERTIES |
                      FILE_OBJECT_FLAG_DIRTY_DATA;
 
@@ -1527,9 +1732,9 @@ IopFlushFileObjects (
 
 Routine Description:
 
-    This routine iterates over file objects in the global dirty file objects
-    list, flushing each one that belongs to the given device or to all entries
-    if a device ID of 0 is specified.
+    This routine iterates over file objects in the dirty file object lists,
+    flushing each one that belongs to the given device or to all entries if a
+    device ID of 0 is specified.
 
 Arguments:
 
@@ -1555,16 +1760,18 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
-    PFILE_OBJECT CurrentObject;
+    PDIRTY_FILE_OBJECT_LIST DirtyList;
+    ULONG FirstList;
     ULONG FlushCount;
     BOOL FlushExclusive;
     ULONG FlushIndex;
-    PFILE_OBJECT NextObject;
+    ULONG LastList;
+    PLIST_ENTRY ListHead;
+    ULONG ListIndex;
+    ULONG Pass;
     KSTATUS Status;
     KSTATUS TotalStatus;
 
-    CurrentObject = NULL;
     TotalStatus = STATUS_SUCCESS;
 
     //
@@ -1593,157 +1800,161 @@ Return Value:
         }
 
     //
-    // Non-synchronized flushes that encounter an empty list can just exit. Any
+    // Non-synchronized flushes that encounter empty lists can just exit. Any
     // necessary work is already being done. But if a specific device is
     // supplied acquire the lock to make sure any other thread has finished
     // flushing the device's data.
     //
 
-    } else if ((DeviceId == 0) &&
-               (LIST_EMPTY(&IoFileObjectsDirtyList) != FALSE)) {
-
+    } else if ((DeviceId == 0) && (IoDirtyFileObjectCount == 0)) {
         return STATUS_SUCCESS;
     }
 
+    //
+    // A specific device only needs the one list its file objects hash to.
+    //
+
+    FirstList = 0;
+    LastList = DIRTY_FILE_OBJECT_LIST_COUNT - 1;
+    if (DeviceId != 0) {
+        DirtyList = IopGetDirtyFileObjectList(DeviceId);
+        FirstList = DirtyList - IoDirtyFileObjectLists;
+        LastList = FirstList;
+    }
+
     //
     // Now make several attempts at performing the requested clean operation.
+    // Each attempt flushes the regular file objects on every list before any
+    // block device file objects, so that data written down from the upper
+    // layers makes it out in the same attempt.
     //
 
-    Status = STATUS_SUCCESS;
     for (FlushIndex = 0; FlushIndex < FlushCount; FlushIndex += 1) {
+        for (Pass = 0; Pass < 2; Pass += 1) {
+            for (ListIndex = FirstList; ListIndex <= LastList; ListIndex += 1) {
+                DirtyList = &(IoDirtyFileObjectLists[ListIndex]);
+                ListHead = &(DirtyList->FileList);
+                if (Pass != 0) {
+                    ListHead = &(DirtyList->BlockDeviceList);
+                }
 
-        //
-        // Get the first entry on the list, or the first file object for the
-        // specific device in question.
-        //
-
-        KeAcquireQueuedLock(IoFileObjectsDirtyListLock);
-        CurrentEntry = IoFileObjectsDirtyList.Next;
-        if (DeviceId == 0) {
-            CurrentObject = LIST_VALUE(CurrentEntry, FILE_OBJECT, ListEntry);
+                if (LIST_EMPTY(ListHead) != FALSE) {
+                    continue;
+                }
 
-        } else {
-            while (CurrentEntry != &IoFileObjectsDirtyList) {
-                CurrentObject = LIST_VALUE(CurrentEntry,
-                                           FILE_OBJECT,
-                                           ListEntry);
+                Status = IopFlushDirtyFileObjectList(DirtyList,
+                                                     ListHead,
+                                                     DeviceId,
+                                                     Flags,
+                                                     FlushExclusive,
+                                                     PageCount,
+                                                     NULL);
 
-                if (CurrentObject->Properties.DeviceId == DeviceId) {
-                    break;
+                if ((!KSUCCESS(Status)) && (KSUCCESS(TotalStatus))) {
+                    TotalStatus = Status;
                 }
 
-                CurrentEntry = CurrentEntry->Next;
+                if ((PageCount != NULL) && (*PageCount == 0)) {
+                    return TotalStatus;
+                }
             }
         }
+    }
 
-        if (CurrentEntry == &IoFileObjectsDirtyList) {
-            CurrentObject = NULL;
+    return TotalStatus;
+}
 
-        } else {
-            IopFileObjectAddReference(CurrentObject);
-        }
+KSTATUS
+IopFlushWritebackContext (
+    PWRITEBACK_CONTEXT Context,
+    ULONG Flags,
+    PUINTN PageCount
+    )
 
-        KeReleaseQueuedLock(IoFileObjectsDirtyListLock);
+/*++
 
-        //
-        // If a device ID was supplied, but no file objects were found to
-        // belong to that device, then the flush was successful!
-        //
+Routine Description:
 
-        if ((CurrentObject == NULL) && (DeviceId != 0)) {
-            TotalStatus = STATUS_SUCCESS;
-            break;
-        }
+    This routine flushes the dirty file objects that use the given writeback
+    context.
 
-        //
-        // Loop cleaning file objects.
-        //
+Arguments:
 
-        while (CurrentObject != NULL) {
-            Status = IopFlushFileObject(CurrentObject,
-                                        0,
-                                        -1,
-                                        Flags,
-                                        FlushExclusive,
-                                        PageCount);
+    Context - Supplies a pointer to the writeback context.
 
-            if (!KSUCCESS(Status)) {
-                if (KSUCCESS(TotalStatus)) {
-                    TotalStatus = Status;
-                }
-            }
+    Flags - Supplies a bitmask of I/O flags. See IO_FLAG_* for definitions.
 
-            if ((PageCount != NULL) && (*PageCount == 0)) {
-                break;
-            }
+    PageCount - Supplies an optional pointer describing how many pages to flush.
+        On output this value will be decreased by the number of pages actually
+        flushed. Supply NULL to flush all pages.
 
-            //
-            // Re-lock the list, and get the next object.
-            //
+Return Value:
 
-            NextObject = NULL;
-            KeAcquireQueuedLock(IoFileObjectsDirtyListLock);
-            if (CurrentObject->ListEntry.Next != NULL) {
-                CurrentEntry = CurrentObject->ListEntry.Next;
+    STATUS_SUCCESS if every file object was flushed.
 
-            } else {
-                CurrentEntry = IoFileObjectsDirtyList.Next;
-            }
+    Otherwise returns the first failing status code.
 
-            if (DeviceId == 0) {
-                if (CurrentEntry != &IoFileObjectsDirtyList) {
-                    NextObject = LIST_VALUE(CurrentEntry,
-                                            FILE_OBJECT,
-                                            ListEntry);
-                }
+--*/
 
-            } else {
-                while (CurrentEntry != &IoFileObjectsDirtyList) {
-                    NextObject = LIST_VALUE(CurrentEntry,
-                                            FILE_OBJECT,
-                                            ListEntry);
+{
 
-                    if (NextObject->Properties.DeviceId == DeviceId) {
-                        break;
-                    }
+    PDIRTY_FILE_OBJECT_LIST DirtyList;
+    ULONG FirstList;
+    ULONG LastList;
+    PLIST_ENTRY ListHead;
+    ULONG ListIndex;
+    ULONG Pass;
+    KSTATUS Status;
+    KSTATUS TotalStatus;
 
-                    CurrentEntry = CurrentEntry->Next;
-                }
+    TotalStatus = STATUS_SUCCESS;
+    if (Context->DirtyFileObjectCount == 0) {
+        return STATUS_SUCCESS;
+    }
 
-                if (CurrentEntry == &IoFileObjectsDirtyList) {
-                    NextObject = NULL;
-                }
-            }
+    //
+    // A device's context only has file objects on the one list its device
+    // hashes to. The shared context's file objects could be on any list.
+    //
 
-            //
-            // Remove the file object from the list if it is clean now.
-            //
+    FirstList = 0;
+    LastList = DIRTY_FILE_OBJECT_LIST_COUNT - 1;
+    if (Context->DeviceId != 0) {
+        DirtyList = IopGetDirtyFileObjectList(Context->DeviceId);
+        FirstList = DirtyList - IoDirtyFileObjectLists;
+        LastList = FirstList;
+    }
 
-            if (IS_FILE_OBJECT_CLEAN(CurrentObject)) {
-                if (CurrentObject->ListEntry.Next != NULL) {
-                    LIST_REMOVE(&(CurrentObject->ListEntry));
-                    CurrentObject->ListEntry.Next = NULL;
-                    IopFileObjectReleaseReference(CurrentObject);
-                }
+    for (Pass = 0; Pass < 2; Pass += 1) {
+        for (ListIndex = FirstList; ListIndex <= LastList; ListIndex += 1) {
+            DirtyList = &(IoDirtyFileObjectLists[ListIndex]);
+            ListHead = &(DirtyList->FileList);
+            if (Pass != 0) {
+                ListHead = &(DirtyList->BlockDeviceList);
             }
 
-            if (NextObject != NULL) {
-                IopFileObjectAddReference(NextObject);
+            if (LIST_EMPTY(ListHead) != FALSE) {
+                continue;
             }
 
-            KeReleaseQueuedLock(IoFileObjectsDirtyListLock);
-            IopFileObjectReleaseReference(CurrentObject);
-            CurrentObject = NextObject;
-        }
+            Status = IopFlushDirtyFileObjectList(DirtyList,
+                                                 ListHead,
+                                                 Context->DeviceId,
+                                                 Flags,
+                                                 FALSE,
+                                                 PageCount,
+                                                 Context);
 
-        if (CurrentObject != NULL) {
-            IopFileObjectReleaseReference(CurrentObject);
-            CurrentObject = NULL;
+            if ((!KSUCCESS(Status)) && (KSUCCESS(TotalStatus))) {
+                TotalStatus = Status;
+            }
+
+            if ((PageCount != NULL) && (*PageCount == 0)) {
+                return TotalStatus;
+            }
         }
     }
 
-    ASSERT(CurrentObject == NULL);
-
     return TotalStatus;
 }
 
@@ -1751,6 +1962,7 @@ VOID
 IopEvictFileObject (
     PFILE_OBJECT FileObject,
     IO_OFFSET Offset,
+    ULONGLONG Size,
     ULONG Flags
     )
 
@@ -1758,12 +1970,12 @@ IopEvictFileObject (
 
 Routine Description:
 
-    This routine evicts the tail of a file object from the system. It unmaps
-    all page cache entries used by image sections after the given offset and
-    evicts all page cache entries after the given offset. If the remove or
-    truncate flags are specified, this routine actually unmaps all mappings for
-    the image sections after the given offset, not just the mapped page cache
-    entries. This routine assumes the file object's lock is held exclusively.
+    This routine evicts a region of a file object from the system. It unmaps
+    all page cache entries used by image sections in the region and evicts
+    all page cache entries in the region. If the remove or truncate flags are
+    specified, this routine actually unmaps all mappings for the image
+    sections in the region, not just the mapped page cache entries. This
+    routine assumes the file object's lock is held exclusively.
 
 Arguments:
 
@@ -1773,6 +1985,9 @@ Routine Description:
         all page cache entries should be evicted and all image sections should
         be unmapped.
 
+    Size - Supplies the size of the region to evict, in bytes. Supply -1 to
+        evict the whole tail of the file object from the given offset.
+
     Flags - Supplies a bitmask of eviction flags. See EVICTION_FLAG_* for
         definitions.
 
@@ -1810,7 +2025,7 @@ Return Value:
 
         MmUnmapImageSectionList(FileObject->ImageSectionList,
                                 Offset,
-                                -1,
+                                Size,
                                 UnmapFlags);
     }
 
@@ -1818,13 +2033,15 @@ Return Value:
     // Evict the page cache entries for the file object.
     //
 
-    IopEvictPageCacheEntries(FileObject, Offset, Flags);
+    IopEvictPageCacheEntries(FileObject, Offset, Size, Flags);
     return;
 }
 
 VOID
 IopEvictFileObjects (
     DEVICE_ID DeviceId,
+    IO_OFFSET Offset,
+    ULONGLONG Size,
     ULONG Flags
     )
 
@@ -1840,6 +2057,11 @@ Routine Description:
     DeviceId - Supplies an optional device ID filter. Supply 0 to iterate over
         file objects for all devices.
 
+    Offset - Supplies the starting offset of the region to evict.
+
+    Size - Supplies the size of the region to evict, in bytes. Supply -1 to
+        evict everything from the given offset onwards.
+
     Flags - Supplies a bitmask of eviction flags. See EVICTION_FLAG_* for
         definitions.
 
@@ -1851,6 +2073,8 @@ Return Value:
 
 {
 
+    PFILE_OBJECT_BUCKET Bucket;
+    ULONG BucketIndex;
     PFILE_OBJECT CurrentObject;
     PRED_BLACK_TREE_NODE Node;
     PFILE_OBJECT ReleaseObject;
@@ -1860,79 +2084,85 @@ Return Value:
     ReleaseObject = NULL;
 
     //
-    // Grab the global file objects lock and iterate over the file objects that
-    // belong to the given device.
+    // Go through each bucket of the file object table, grabbing its lock and
+    // iterating over the file objects that belong to the given device.
     //
 
-    KeAcquireQueuedLock(IoFileObjectsLock);
-    Node = RtlRedBlackTreeGetLowestNode(&IoFileObjectsTree);
-    while (Node != NULL) {
-        CurrentObject = RED_BLACK_TREE_VALUE(Node, FILE_OBJECT, TreeEntry);
+    for (BucketIndex = 0;
+         BucketIndex < FILE_OBJECT_BUCKET_COUNT;
+         BucketIndex += 1) {
 
-        //
-        // Skip file objects that do not match the device ID. Also skip any
-        // file objects that only have 1 reference. This means that they are
-        // about to get removed from the tree if close/delete are successful.
-        // As such, they don't have any page cache entries, as a page cache
-        // entry takes a reference on the file object.
-        //
+        Bucket = &(IoFileObjectBuckets[BucketIndex]);
+        KeAcquireQueuedLock(Bucket->Lock);
+        Node = RtlRedBlackTreeGetLowestNode(&(Bucket->Tree));
+        while (Node != NULL) {
+            CurrentObject = RED_BLACK_TREE_VALUE(Node, FILE_OBJECT, TreeEntry);
 
-        if ((CurrentObject->Properties.DeviceId != DeviceId) ||
-            (CurrentObject->ReferenceCount == 1)) {
+            //
+            // Skip file objects that do not match the device ID. Also skip
+            // any file objects that only have 1 reference. This means that
+            // they are about to get removed from the tree if close/delete are
+            // successful. As such, they don't have any page cache entries, as
+            // a page cache entry takes a reference on the file object.
+            //
 
-            Node = RtlRedBlackTreeGetNextNode(&(IoFileObjectsTree),
-                                              FALSE,
-                                              Node);
+            if ((CurrentObject->Properties.DeviceId != DeviceId) ||
+                (CurrentObject->ReferenceCount == 1)) {
 
-            CurrentObject = NULL;
-            continue;
-        }
+                Node = RtlRedBlackTreeGetNextNode(&(Bucket->Tree),
+                                                  FALSE,
+                                                  Node);
 
-        //
-        // Take a reference on this object so it does not disappear when the
-        // lock is released.
-        //
+                CurrentObject = NULL;
+                continue;
+            }
 
-        IopFileObjectAddReference(CurrentObject);
-        KeReleaseQueuedLock(IoFileObjectsLock);
-        KeAcquireSharedExclusiveLockExclusive(CurrentObject->Lock);
+            //
+            // Take a reference on this object so it does not disappear when
+            // the lock is released.
+            //
 
-        //
-        // Call the eviction routine for the current file object.
-        //
+            IopFileObjectAddReference(CurrentObject);
+            KeReleaseQueuedLock(Bucket->Lock);
+            KeAcquireSharedExclusiveLockExclusive(CurrentObject->Lock);
 
-        IopEvictFileObject(CurrentObject, 0, Flags);
+            //
+            // Call the eviction routine for the current file object.
+            //
 
-        //
-        // Release the reference taken on the release object.
-        //
+            IopEvictFileObject(CurrentObject, Offset, Size, Flags);
 
-        if (ReleaseObject != NULL) {
+            //
+            // Release the reference taken on the release object.
+            //
 
-            ASSERT(ReleaseObject->ReferenceCount >= 2);
+            if (ReleaseObject != NULL) {
 
-            IopFileObjectReleaseReference(ReleaseObject);
-            ReleaseObject = NULL;
-        }
+                ASSERT(ReleaseObject->ReferenceCount >= 2);
 
-        KeReleaseSharedExclusiveLockExclusive(CurrentObject->Lock);
-        KeAcquireQueuedLock(IoFileObjectsLock);
+                IopFileObjectReleaseReference(ReleaseObject);
+                ReleaseObject = NULL;
+            }
 
-        //
-        // The current object and node should match.
-        //
+            KeReleaseSharedExclusiveLockExclusive(CurrentObject->Lock);
+            KeAcquireQueuedLock(Bucket->Lock);
 
-        ASSERT(&(CurrentObject->TreeEntry) == Node);
+            //
+            // The current object and node should match.
+            //
 
-        Node = RtlRedBlackTreeGetNextNode(&(IoFileObjectsTree),
-                                          FALSE,
-                                          Node);
+            ASSERT(&(CurrentObject->TreeEntry) == Node);
 
-        ReleaseObject = CurrentObject;
-        CurrentObject = NULL;
-    }
+            Node = RtlRedBlackTreeGetNextNode(&(Bucket->Tree),
+                                              FALSE,
+                                              Node);
 
-    KeReleaseQueuedLock(IoFileObjectsLock);
+            ReleaseObject = CurrentObject;
+            CurrentObject = NULL;
+        }
+
+        KeReleaseQueuedLock(Bucket->Lock);
+    }
 
     //
     // Release any lingering references.
@@ -2161,7 +2391,7 @@ Return Value:
 
     if (NewFileSize < FileSize) {
         Offset = ALIGN_RANGE_UP(NewFileSize, IoGetCacheEntryDataSize());
-        IopEvictFileObject(FileObject, Offset, EVICTION_FLAG_TRUNCATE);
+        IopEvictFileObject(FileObject, Offset, -1, EVICTION_FLAG_TRUNCATE);
     }
 
 ModifyFileObjectSizeEnd:
@@ -2256,45 +2486,55 @@ Return Value:
 
 {
 
+    PFILE_OBJECT_BUCKET Bucket;
+    ULONG BucketIndex;
     PFILE_OBJECT CurrentObject;
     LIST_ENTRY LocalList;
 
-    //
-    // Exit immediately if there are no orphaned file objects.
-    //
+    for (BucketIndex = 0;
+         BucketIndex < FILE_OBJECT_BUCKET_COUNT;
+         BucketIndex += 1) {
 
-    if (LIST_EMPTY(&IoFileObjectsOrphanedList) != FALSE) {
-        return;
-    }
+        //
+        // Skip buckets without orphaned file objects.
+        //
 
-    //
-    // Grab the global file objects lock, migrate the global orphaned file
-    // object list to a local list head and iterate over it. All objects on the
-    // list should have only 1 reference. If another thread resurrects any
-    // object during iteration, it will remove it from the local list and this
-    // routine will not see it. For those file objects processed, just add an
-    // extra reference with the lock held and release it with the lock released.
-    // This should kick off another attempt at closing out the file object.
-    //
+        Bucket = &(IoFileObjectBuckets[BucketIndex]);
+        if (LIST_EMPTY(&(Bucket->OrphanedList)) != FALSE) {
+            continue;
+        }
 
-    INITIALIZE_LIST_HEAD(&LocalList);
-    KeAcquireQueuedLock(IoFileObjectsLock);
-    MOVE_LIST(&IoFileObjectsOrphanedList, &LocalList);
-    INITIALIZE_LIST_HEAD(&IoFileObjectsOrphanedList);
-    while (LIST_EMPTY(&LocalList) == FALSE) {
-        CurrentObject = LIST_VALUE(LocalList.Next, FILE_OBJECT, ListEntry);
-        LIST_REMOVE(&(CurrentObject->ListEntry));
-        CurrentObject->ListEntry.Next = NULL;
+        //
+        // Grab the bucket lock, migrate the bucket's orphaned file object
+        // list to a local list head and iterate over it. All objects on the
+        // list should have only 1 reference. If another thread resurrects any
+        // object during iteration, it will remove it from the local list and
+        // this routine will not see it. For those file objects processed,
+        // just add an extra reference with the lock held and release it with
+        // the lock released. This should kick off another attempt at closing
+        // out the file object.
+        //
 
-        ASSERT(CurrentObject->ReferenceCount == 1);
+        INITIALIZE_LIST_HEAD(&LocalList);
+        KeAcquireQueuedLock(Bucket->Lock);
+        MOVE_LIST(&(Bucket->OrphanedList), &LocalList);
+        INITIALIZE_LIST_HEAD(&(Bucket->OrphanedList));
+        while (LIST_EMPTY(&LocalList) == FALSE) {
+            CurrentObject = LIST_VALUE(LocalList.Next, FILE_OBJECT, ListEntry);
+            LIST_REMOVE(&(CurrentObject->ListEntry));
+            CurrentObject->ListEntry.Next = NULL;
 
-        IopFileObjectAddReference(CurrentObject);
-        KeReleaseQueuedLock(IoFileObjectsLock);
-        IopFileObjectReleaseReference(CurrentObject);
-        KeAcquireQueuedLock(IoFileObjectsLock);
+            ASSERT(CurrentObject->ReferenceCount == 1);
+
+            IopFileObjectAddReference(CurrentObject);
+            KeReleaseQueuedLock(Bucket->Lock);
+            IopFileObjectReleaseReference(CurrentObject);
+            KeAcquireQueuedLock(Bucket->Lock);
+        }
+
+        KeReleaseQueuedLock(Bucket->Lock);
     }
 
-    KeReleaseQueuedLock(IoFileObjectsLock);
     return;
 }
 
@@ -2438,28 +2678,33 @@ Return Value:
 
 {
 
+    PDIRTY_FILE_OBJECT_LIST DirtyList;
+
     if ((FileObject->Flags & FILE_OBJECT_FLAG_DIRTY_DATA) == 0) {
-        KeAcquireQueuedLock(IoFileObjectsDirtyListLock);
+        DirtyList = IopGetDirtyFileObjectList(FileObject->Properties.DeviceId);
+        KeAcquireQueuedLock(DirtyList->Lock);
         RtlAtomicOr32(&(FileObject->Flags), FILE_OBJECT_FLAG_DIRTY_DATA);
         if (FileObject->ListEntry.Next == NULL) {
             IopFileObjectAddReference(FileObject);
+            RtlAtomicAdd32(&IoDirtyFileObjectCount, 1);
+            RtlAtomicAdd32(&(FileObject->Writeback->DirtyFileObjectCount), 1);
 
             //
-            // The lower layer file objects go at the end of the list. This
-            // allows flush to only traverse the list once to get all the data
-            // out to the block devices.
+            // The lower layer file objects go on their own list. This allows
+            // flush to get all the data from the upper layers out to the block
+            // devices before flushing the block devices.
             //
 
             if (FileObject->Properties.Type == IoObjectBlockDevice) {
                 INSERT_BEFORE(&(FileObject->ListEntry),
-                              &IoFileObjectsDirtyList);
+                              &(DirtyList->BlockDeviceList));
 
             } else {
-                INSERT_AFTER(&(FileObject->ListEntry), &IoFileObjectsDirtyList);
+                INSERT_AFTER(&(FileObject->ListEntry), &(DirtyList->FileList));
             }
         }
 
-        KeReleaseQueuedLock(IoFileObjectsDirtyListLock);
+        KeReleaseQueuedLock(DirtyList->Lock);
         IopSchedulePageCacheThread();
     }
 
@@ -2539,32 +2784,46 @@ Return Value:
 
 {
 
+    PFILE_OBJECT_BUCKET Bucket;
+    ULONG BucketIndex;
+    PDIRTY_FILE_OBJECT_LIST DirtyList;
     PFILE_OBJECT FileObject;
     PRED_BLACK_TREE_NODE Node;
 
-    KeAcquireQueuedLock(IoFileObjectsLock);
-    KeAcquireQueuedLock(IoFileObjectsDirtyListLock);
-    Node = RtlRedBlackTreeGetLowestNode(&IoFileObjectsTree);
-    while (Node != NULL) {
-        FileObject = RED_BLACK_TREE_VALUE(Node, FILE_OBJECT, TreeEntry);
-        if (!LIST_EMPTY(&(FileObject->DirtyPageList))) {
-            if (IS_FILE_OBJECT_CLEAN(FileObject)) {
-                RtlDebugPrint("FILE_OBJECT 0x%x marked as clean with "
-                              "non-empty dirty list.\n",
-                              FileObject);
-            }
+    for (BucketIndex = 0;
+         BucketIndex < FILE_OBJECT_BUCKET_COUNT;
+         BucketIndex += 1) {
+
+        Bucket = &(IoFileObjectBuckets[BucketIndex]);
+        KeAcquireQueuedLock(Bucket->Lock);
+        Node = RtlRedBlackTreeGetLowestNode(&(Bucket->Tree));
+        while (Node != NULL) {
+            FileObject = RED_BLACK_TREE_VALUE(Node, FILE_OBJECT, TreeEntry);
+            DirtyList = IopGetDirtyFileObjectList(
+                                              FileObject->Properties.DeviceId);
+
+            KeAcquireQueuedLock(DirtyList->Lock);
+            if (!LIST_EMPTY(&(FileObject->DirtyPageList))) {
+                if (IS_FILE_OBJECT_CLEAN(FileObject)) {
+                    RtlDebugPrint("FILE_OBJECT 0x%x marked as clean with "
+                                  "non-empty dirty list.\n",
+                                  FileObject);
+                }
 
-            if (FileObject->ListEntry.Next == NULL) {
-                RtlDebugPrint("FILE_OBJECT 0x%x dirty but not in dirty list.\n",
-                              FileObject);
+                if (FileObject->ListEntry.Next == NULL) {
+                    RtlDebugPrint("FILE_OBJECT 0x%x dirty but not in dirty "
+                                  "list.\n",
+                                  FileObject);
+                }
             }
+
+            KeReleaseQueuedLock(DirtyList->Lock);
+            Node = RtlRedBlackTreeGetNextNode(&(Bucket->Tree), FALSE, Node);
         }
 
-        Node = RtlRedBlackTreeGetNextNode(&IoFileObjectsTree, FALSE, Node);
+        KeReleaseQueuedLock(Bucket->Lock);
     }
 
-    KeReleaseQueuedLock(IoFileObjectsDirtyListLock);
-    KeReleaseQueuedLock(IoFileObjectsLock);
     return;
 }
 
@@ -2782,6 +3041,7 @@ Return Value:
 
 PFILE_OBJECT
 IopLookupFileObjectByProperties (
+    PFILE_OBJECT_BUCKET Bucket,
     PFILE_PROPERTIES Properties
     )
 
@@ -2790,11 +3050,14 @@ IopLookupFileObjectByProperties (
 Routine Description:
 
     This routine attempts to look up a file object with the given properties
-    (specifically the device and file IDs). It assumes the global file objects
-    lock is already held.
+    (specifically the device and file IDs). It assumes the lock of the bucket
+    the properties hash to is already held.
 
 Arguments:
 
+    Bucket - Supplies a pointer to the file object table bucket the
+        properties hash to.
+
     Properties - Supplies a pointer to the file object properties.
 
 Return Value:
@@ -2818,7 +3081,7 @@ Return Value:
     Object = NULL;
     SearchObject.Properties.FileId = Properties->FileId;
     SearchObject.Properties.DeviceId = Properties->DeviceId;
-    FoundNode = RtlRedBlackTreeSearch(&IoFileObjectsTree,
+    FoundNode = RtlRedBlackTreeSearch(&(Bucket->Tree),
                                       &(SearchObject.TreeEntry));
 
     if (FoundNode != NULL) {
@@ -2828,7 +3091,8 @@ Return Value:
         // Increment the reference count. If this ends up resurrecting an
         // orphaned or about to be closed file object, then make sure it is not
         // on the orphaned list (or any list for that matter) as it could be
-        // used and made dirty.
+        // used and made dirty. Objects with a single reference are never on a
+        // dirty list, so this list is the bucket's orphaned list.
         //
 
         OldReferenceCount = IopFileObjectAddReference(Object);
@@ -2843,6 +3107,283 @@ Return Value:
     return Object;
 }
 
+PFILE_OBJECT_BUCKET
+IopGetFileObjectBucket (
+    DEVICE_ID DeviceId,
+    FILE_ID FileId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the bucket of the global file object table that the
+    given device and file IDs hash to.
+
+Arguments:
+
+    DeviceId - Supplies the device ID of the file object.
+
+    FileId - Supplies the file ID of the file object.
+
+Return Value:
+
+    Returns a pointer to the bucket.
+
+--*/
+
+{
+
+    ULONGLONG Hash;
+
+    Hash = (FileId ^ (DeviceId * FILE_OBJECT_HASH_MULTIPLIER)) *
+           FILE_OBJECT_HASH_MULTIPLIER;
+
+    Hash = (Hash >> 32) & (FILE_OBJECT_BUCKET_COUNT - 1);
+    return &(IoFileObjectBuckets[Hash]);
+}
+
+PDIRTY_FILE_OBJECT_LIST
+IopGetDirtyFileObjectList (
+    DEVICE_ID DeviceId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the dirty file object list used by file objects of
+    the given device.
+
+Arguments:
+
+    DeviceId - Supplies the device ID of the file objects.
+
+Return Value:
+
+    Returns a pointer to the dirty file object list.
+
+--*/
+
+{
+
+    ULONGLONG Hash;
+
+    Hash = DeviceId * FILE_OBJECT_HASH_MULTIPLIER;
+    Hash = (Hash >> 32) & (DIRTY_FILE_OBJECT_LIST_COUNT - 1);
+    return &(IoDirtyFileObjectLists[Hash]);
+}
+
+KSTATUS
+IopFlushDirtyFileObjectList (
+    PDIRTY_FILE_OBJECT_LIST DirtyList,
+    PLIST_ENTRY ListHead,
+    DEVICE_ID DeviceId,
+    ULONG Flags,
+    BOOL FlushExclusive,
+    PUINTN PageCount,
+    PWRITEBACK_CONTEXT Writeback
+    )
+
+/*++
+
+Routine Description:
+
+    This routine flushes the file objects on one dirty file object list,
+    removing those that come out clean.
+
+Arguments:
+
+    DirtyList - Supplies a pointer to the dirty file object list.
+
+    ListHead - Supplies a pointer to the head of the list to flush, either
+        the regular file list or the block device list.
+
+    DeviceId - Supplies an optional device ID filter. Supply 0 to flush all
+        file objects on the list.
+
+    Flags - Supplies a bitmask of I/O flags. See IO_FLAG_* for definitions.
+
+    FlushExclusive - Supplies a boolean indicating whether each file object
+        should be flushed with its lock held exclusively.
+
+    PageCount - Supplies an optional pointer describing how many pages to flush.
+        On output this value will be decreased by the number of pages actually
+        flushed. Supply NULL to flush all pages.
+
+    Writeback - Supplies an optional writeback context filter. Supply NULL to
+        flush file objects regardless of their writeback context.
+
+Return Value:
+
+    STATUS_SUCCESS if every file object was flushed.
+
+    Otherwise returns the first failing status code.
+
+--*/
+
+{
+
+    PWRITEBACK_CONTEXT Context;
+    PLIST_ENTRY CurrentEntry;
+    PFILE_OBJECT CurrentObject;
+    PFILE_OBJECT NextObject;
+    BOOL RemovedFromList;
+    KSTATUS Status;
+    KSTATUS TotalStatus;
+
+    TotalStatus = STATUS_SUCCESS;
+
+    //
+    // Get the first entry on the list, or the first file object for the
+    // specific device in question.
+    //
+
+    KeAcquireQueuedLock(DirtyList->Lock);
+    CurrentObject = IopFindDirtyFileObject(ListHead,
+                                           ListHead->Next,
+                                           DeviceId,
+                                           Writeback);
+
+    if (CurrentObject != NULL) {
+        IopFileObjectAddReference(CurrentObject);
+    }
+
+    KeReleaseQueuedLock(DirtyList->Lock);
+
+    //
+    // Loop cleaning file objects.
+    //
+
+    while (CurrentObject != NULL) {
+        Status = IopFlushFileObject(CurrentObject,
+                                    0,
+                                    -1,
+                                    Flags,
+                                    FlushExclusive,
+                                    PageCount);
+
+        if ((!KSUCCESS(Status)) && (KSUCCESS(TotalStatus))) {
+            TotalStatus = Status;
+        }
+
+        if ((PageCount != NULL) && (*PageCount == 0)) {
+            break;
+        }
+
+        //
+        // Re-lock the list, and get the next object.
+        //
+
+        KeAcquireQueuedLock(DirtyList->Lock);
+        if (CurrentObject->ListEntry.Next != NULL) {
+            CurrentEntry = CurrentObject->ListEntry.Next;
+
+        } else {
+            CurrentEntry = ListHead->Next;
+        }
+
+        NextObject = IopFindDirtyFileObject(ListHead,
+                                            CurrentEntry,
+                                            DeviceId,
+                                            Writeback);
+
+
+        //
+        // Remove the file object from the list if it is clean now. The list's
+        // reference is released after the list lock is dropped, as releasing
+        // a file object reference may need its bucket lock.
+        //
+
+        RemovedFromList = FALSE;
+        if (IS_FILE_OBJECT_CLEAN(CurrentObject)) {
+            if (CurrentObject->ListEntry.Next != NULL) {
+                LIST_REMOVE(&(CurrentObject->ListEntry));
+                CurrentObject->ListEntry.Next = NULL;
+                RtlAtomicAdd32(&IoDirtyFileObjectCount, -1);
+                Context = CurrentObject->Writeback;
+                RtlAtomicAdd32(&(Context->DirtyFileObjectCount), -1);
+
+                RemovedFromList = TRUE;
+            }
+        }
+
+        if (NextObject != NULL) {
+            IopFileObjectAddReference(NextObject);
+        }
+
+        KeReleaseQueuedLock(DirtyList->Lock);
+        if (RemovedFromList != FALSE) {
+            IopFileObjectReleaseReference(CurrentObject);
+        }
+
+        IopFileObjectReleaseReference(CurrentObject);
+        CurrentObject = NextObject;
+    }
+
+    if (CurrentObject != NULL) {
+        IopFileObjectReleaseReference(CurrentObject);
+    }
+
+    return TotalStatus;
+}
+
+PFILE_OBJECT
+IopFindDirtyFileObject (
+    PLIST_ENTRY ListHead,
+    PLIST_ENTRY CurrentEntry,
+    DEVICE_ID DeviceId,
+    PWRITEBACK_CONTEXT Writeback
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the next file object on a dirty list that belongs to
+    the given device and writeback context. This routine assumes the dirty
+    list lock is held.
+
+Arguments:
+
+    ListHead - Supplies a pointer to the head of the dirty list.
+
+    CurrentEntry - Supplies a pointer to the list entry to start searching
+        from, inclusive.
+
+    DeviceId - Supplies an optional device ID filter. Supply 0 to match any
+        file object.
+
+    Writeback - Supplies an optional writeback context filter. Supply NULL to
+        match any file object.
+
+Return Value:
+
+    Returns a pointer to the next matching file object.
+
+    NULL if the end of the list was reached.
+
+--*/
+
+{
+
+    PFILE_OBJECT FileObject;
+
+    while (CurrentEntry != ListHead) {
+        FileObject = LIST_VALUE(CurrentEntry, FILE_OBJECT, ListEntry);
+        if (((DeviceId == 0) ||
+             (FileObject->Properties.DeviceId == DeviceId)) &&
+            ((Writeback == NULL) || (FileObject->Writeback == Writeback))) {
+
+            return FileObject;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    return NULL;
+}
+
 VOID
 IopDestroyAsyncState (
     PIO_ASYNC_STATE Async
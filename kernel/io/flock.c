@@ -32,6 +32,16 @@ Module Name:
 #include <minoca/kernel/kernel.h>
 #include "iop.h"
 
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// This macro returns the height of a lock tree node, which may be NULL.
+//
+
+#define FILE_LOCK_HEIGHT(_Entry) (((_Entry) != NULL) ? (_Entry)->Height : 0)
+
 //
 // ---------------------------------------------------------------- Definitions
 //
@@ -44,16 +54,53 @@ Module Name:
 
 Structure Description:
 
-    This structure defines an active file lock.
+    This structure defines the set of locks one process holds on a file.
 
 Members:
 
-    ListEntry - Stores pointers to the next and previous lock entries in the
-        file object.
+    ListEntry - Stores pointers to the next and previous owners of locks on
+        the file.
 
-    Type - Stores the lock type.
+    Process - Stores a pointer to the process that owns the locks.
+
+    LockList - Stores the head of the list of locks the process holds on the
+        file.
+
+--*/
+
+typedef struct _FILE_LOCK_OWNER {
+    LIST_ENTRY ListEntry;
+    PKPROCESS Process;
+    LIST_ENTRY LockList;
+} FILE_LOCK_OWNER, *PFILE_LOCK_OWNER;
+
+/*++
 
-    Process - Stores a pointer to the process that owns the file lock.
+Structure Description:
+
+    This structure defines an active file lock. Locks live in an interval tree
+    ordered by offset, where each node also records the highest end of any
+    lock beneath it so that overlap searches can skip whole subtrees.
+
+Members:
+
+    Parent - Stores a pointer to the parent node in the lock tree.
+
+    Left - Stores a pointer to the child with lower offsets.
+
+    Right - Stores a pointer to the child with equal or higher offsets.
+
+    Height - Stores the height of the subtree rooted at this node.
+
+    SubtreeEnd - Stores the highest end offset of any lock in the subtree
+        rooted at this node.
+
+    OwnerListEntry - Stores pointers to the next and previous locks held by
+        the same owner.
+
+    Owner - Stores a pointer to the owner of the lock.
+
+    Type - Stores the lock type.
 
     Offset - Stores the offset into the file where the lock begins.
 
@@ -62,31 +109,155 @@ Structure Description:
 
 --*/
 
-typedef struct _FILE_LOCK_ENTRY {
-    LIST_ENTRY ListEntry;
+typedef struct _FILE_LOCK_ENTRY FILE_LOCK_ENTRY, *PFILE_LOCK_ENTRY;
+struct _FILE_LOCK_ENTRY {
+    PFILE_LOCK_ENTRY Parent;
+    PFILE_LOCK_ENTRY Left;
+    PFILE_LOCK_ENTRY Right;
+    LONG Height;
+    ULONGLONG SubtreeEnd;
+    LIST_ENTRY OwnerListEntry;
+    PFILE_LOCK_OWNER Owner;
     FILE_LOCK_TYPE Type;
-    PKPROCESS Process;
     ULONGLONG Offset;
     ULONGLONG Size;
-} FILE_LOCK_ENTRY, *PFILE_LOCK_ENTRY;
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines a thread blocked waiting to lock a region of a file.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous waiters on the file.
+
+    Offset - Stores the offset where the wanted region begins.
+
+    End - Stores the offset where the wanted region ends.
+
+    Event - Stores a pointer to the event signaled when a lock overlapping the
+        region is released or shrunk.
+
+--*/
+
+typedef struct _FILE_LOCK_WAITER {
+    LIST_ENTRY ListEntry;
+    ULONGLONG Offset;
+    ULONGLONG End;
+    PKEVENT Event;
+} FILE_LOCK_WAITER, *PFILE_LOCK_WAITER;
+
+/*++
+
+Structure Description:
+
+    This structure defines the byte-range lock state of a file object. It is
+    protected by the file object lock.
+
+Members:
+
+    Root - Stores a pointer to the root of the lock tree.
+
+    LockCount - Stores the number of locks in the tree.
+
+    OwnerList - Stores the head of the list of lock owners.
+
+    WaiterList - Stores the head of the list of blocked waiters.
+
+--*/
+
+struct _FILE_LOCK_STATE {
+    PFILE_LOCK_ENTRY Root;
+    volatile ULONG LockCount;
+    LIST_ENTRY OwnerList;
+    LIST_ENTRY WaiterList;
+};
 
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+PFILE_LOCK_STATE
+IopGetFileLockState (
+    PFILE_OBJECT FileObject
+    );
+
 KSTATUS
 IopTryToSetFileLock (
-    PFILE_OBJECT FileObject,
+    PFILE_LOCK_STATE State,
     PFILE_LOCK_ENTRY NewEntry,
+    PKPROCESS Process,
+    PFILE_LOCK_OWNER *Owner,
     PLIST_ENTRY FreeList,
     BOOL DryRun
     );
 
-BOOL
-IopDoFileLocksOverlap (
-    ULONGLONG IncomingOffset,
-    ULONGLONG IncomingSize,
-    PFILE_LOCK_ENTRY LockEntry
+PFILE_LOCK_OWNER
+IopFindFileLockOwner (
+    PFILE_LOCK_STATE State,
+    PKPROCESS Process
+    );
+
+VOID
+IopWakeFileLockWaiters (
+    PFILE_LOCK_STATE State,
+    ULONGLONG Offset,
+    ULONGLONG End
+    );
+
+PFILE_LOCK_ENTRY
+IopFindFileLock (
+    PFILE_LOCK_ENTRY Node,
+    ULONGLONG Offset,
+    ULONGLONG End,
+    PKPROCESS Process,
+    FILE_LOCK_TYPE Type
+    );
+
+ULONGLONG
+IopGetFileLockEnd (
+    ULONGLONG Offset,
+    ULONGLONG Size
+    );
+
+VOID
+IopInsertFileLockEntry (
+    PFILE_LOCK_STATE State,
+    PFILE_LOCK_ENTRY Entry
+    );
+
+VOID
+IopRemoveFileLockEntry (
+    PFILE_LOCK_STATE State,
+    PFILE_LOCK_ENTRY Entry
+    );
+
+VOID
+IopRebalanceFileLocks (
+    PFILE_LOCK_STATE State,
+    PFILE_LOCK_ENTRY Entry
+    );
+
+PFILE_LOCK_ENTRY
+IopRotateFileLocks (
+    PFILE_LOCK_STATE State,
+    PFILE_LOCK_ENTRY Entry,
+    BOOL Right
+    );
+
+VOID
+IopReplaceFileLockChild (
+    PFILE_LOCK_STATE State,
+    PFILE_LOCK_ENTRY Parent,
+    PFILE_LOCK_ENTRY OldChild,
+    PFILE_LOCK_ENTRY NewChild
+    );
+
+VOID
+IopUpdateFileLockNode (
+    PFILE_LOCK_ENTRY Entry
     );
 
 //
@@ -126,11 +297,9 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
     PFILE_OBJECT FileObject;
     PFILE_LOCK_ENTRY FoundEntry;
-    PFILE_LOCK_ENTRY LockEntry;
-    BOOL Overlap;
+    PFILE_LOCK_STATE State;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
@@ -141,31 +310,21 @@ Return Value:
     FileObject = IoHandle->FileObject;
     FoundEntry = NULL;
     KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
-    CurrentEntry = FileObject->FileLockList.Next;
-    while (CurrentEntry != &(FileObject->FileLockList)) {
-        LockEntry = LIST_VALUE(CurrentEntry, FILE_LOCK_ENTRY, ListEntry);
-        CurrentEntry = CurrentEntry->Next;
-
-        //
-        // If the caller only wants write locks, then skip read locks.
-        //
-
-        if ((Lock->Type == FileLockRead) && (LockEntry->Type == FileLockRead)) {
-            continue;
-        }
-
-        Overlap = IopDoFileLocksOverlap(Lock->Offset, Lock->Size, LockEntry);
-        if (Overlap != FALSE) {
-            FoundEntry = LockEntry;
-            break;
-        }
+    State = FileObject->FileLocks;
+    if (State != NULL) {
+        FoundEntry = IopFindFileLock(State->Root,
+                                     Lock->Offset,
+                                     IopGetFileLockEnd(Lock->Offset,
+                                                       Lock->Size),
+                                     NULL,
+                                     Lock->Type);
     }
 
     if (FoundEntry != NULL) {
         Lock->Type = FoundEntry->Type;
         Lock->Offset = FoundEntry->Offset;
         Lock->Size = FoundEntry->Size;
-        Lock->ProcessId = FoundEntry->Process->Identifiers.ProcessId;
+        Lock->ProcessId = FoundEntry->Owner->Process->Identifiers.ProcessId;
 
     } else {
         Lock->Type = FileLockUnlock;
@@ -212,19 +371,24 @@ Return Value:
     LIST_ENTRY FreeList;
     BOOL LockHeld;
     PFILE_LOCK_ENTRY NewEntry;
-    PKEVENT NewEvent;
-    PKEVENT PreviousEvent;
+    PFILE_LOCK_OWNER Owner;
+    PKPROCESS Process;
     FILE_LOCK_ENTRY RemoveEntry;
     PFILE_LOCK_ENTRY SplitEntry;
+    PFILE_LOCK_STATE State;
     KSTATUS Status;
+    FILE_LOCK_WAITER Waiter;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
     FileObject = IoHandle->FileObject;
     INITIALIZE_LIST_HEAD(&FreeList);
     NewEntry = NULL;
+    Owner = NULL;
+    Process = PsGetCurrentProcess();
     SplitEntry = NULL;
     LockHeld = FALSE;
+    Waiter.Event = NULL;
     if ((Lock->Type == FileLockInvalid) || (Lock->Type >= FileLockTypeCount)) {
         Status = STATUS_INVALID_PARAMETER;
         goto SetFileLockEnd;
@@ -266,12 +430,25 @@ Return Value:
             Status = STATUS_INSUFFICIENT_RESOURCES;
             goto SetFileLockEnd;
         }
+
+        //
+        // Allocate an owner in case this is the process's first lock on the
+        // file.
+        //
+
+        Owner = MmAllocateNonPagedPool(sizeof(FILE_LOCK_OWNER),
+                                       FILE_LOCK_ALLOCATION_TAG);
+
+        if (Owner == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto SetFileLockEnd;
+        }
     }
 
     NewEntry->Type = Lock->Type;
     NewEntry->Offset = Lock->Offset;
     NewEntry->Size = Lock->Size;
-    NewEntry->Process = PsGetCurrentProcess();
+    NewEntry->Owner = NULL;
     SplitEntry = MmAllocateNonPagedPool(sizeof(FILE_LOCK_ENTRY),
                                         FILE_LOCK_ALLOCATION_TAG);
 
@@ -280,27 +457,11 @@ Return Value:
         goto SetFileLockEnd;
     }
 
-    INSERT_BEFORE(&(SplitEntry->ListEntry), &FreeList);
-
-    //
-    // Race to create the event if not created.
-    //
-
-    if (FileObject->FileLockEvent == NULL) {
-        NewEvent = KeCreateEvent(NULL);
-        if (NewEvent == NULL) {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto SetFileLockEnd;
-        }
-
-        PreviousEvent = (PKEVENT)RtlAtomicCompareExchange(
-                                          (PUINTN)&(FileObject->FileLockEvent),
-                                          (UINTN)NewEvent,
-                                          (UINTN)NULL);
-
-        if (PreviousEvent != NULL) {
-            KeDestroyEvent(NewEvent);
-        }
+    INSERT_BEFORE(&(SplitEntry->OwnerListEntry), &FreeList);
+    State = IopGetFileLockState(FileObject);
+    if (State == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto SetFileLockEnd;
     }
 
     while (TRUE) {
@@ -315,24 +476,46 @@ Return Value:
         //
 
         if (Lock->Type != FileLockUnlock) {
-            Status = IopTryToSetFileLock(FileObject,
+            Status = IopTryToSetFileLock(State,
                                          NewEntry,
+                                         Process,
+                                         NULL,
                                          NULL,
                                          TRUE);
 
             if (!KSUCCESS(Status)) {
 
                 //
-                // Wait for something to unlock.
+                // Wait for a lock overlapping the region to go away. Register
+                // as a waiter before dropping the lock so that the release
+                // can't be missed.
                 //
 
                 if (Blocking != FALSE) {
+                    if (Waiter.Event == NULL) {
+                        Waiter.Event = KeCreateEvent(NULL);
+                        if (Waiter.Event == NULL) {
+                            Status = STATUS_INSUFFICIENT_RESOURCES;
+                            goto SetFileLockEnd;
+                        }
+
+                        Waiter.Offset = NewEntry->Offset;
+                        Waiter.End = IopGetFileLockEnd(NewEntry->Offset,
+                                                       NewEntry->Size);
+                    }
+
+                    KeSignalEvent(Waiter.Event, SignalOptionUnsignal);
+                    INSERT_BEFORE(&(Waiter.ListEntry), &(State->WaiterList));
                     KeReleaseSharedExclusiveLockExclusive(FileObject->Lock);
                     LockHeld = FALSE;
-                    Status = KeWaitForEvent(FileObject->FileLockEvent,
+                    Status = KeWaitForEvent(Waiter.Event,
                                             TRUE,
                                             WAIT_TIME_INDEFINITE);
 
+                    KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
+                    LockHeld = TRUE;
+                    LIST_REMOVE(&(Waiter.ListEntry));
+
                     //
                     // The thread was interrupted.
                     //
@@ -362,7 +545,12 @@ Return Value:
         // have happened during the dry run.
         //
 
-        Status = IopTryToSetFileLock(FileObject, NewEntry, &FreeList, FALSE);
+        Status = IopTryToSetFileLock(State,
+                                     NewEntry,
+                                     Process,
+                                     &Owner,
+                                     &FreeList,
+                                     FALSE);
 
         ASSERT(KSUCCESS(Status));
 
@@ -375,13 +563,21 @@ Return Value:
         KeReleaseSharedExclusiveLockExclusive(FileObject->Lock);
     }
 
+    if (Waiter.Event != NULL) {
+        KeDestroyEvent(Waiter.Event);
+    }
+
     if ((NewEntry != NULL) && (NewEntry != &RemoveEntry)) {
         MmFreeNonPagedPool(NewEntry);
     }
 
+    if (Owner != NULL) {
+        MmFreeNonPagedPool(Owner);
+    }
+
     while (LIST_EMPTY(&FreeList) == FALSE) {
-        Entry = LIST_VALUE(FreeList.Next, FILE_LOCK_ENTRY, ListEntry);
-        LIST_REMOVE(&(Entry->ListEntry));
+        Entry = LIST_VALUE(FreeList.Next, FILE_LOCK_ENTRY, OwnerListEntry);
+        LIST_REMOVE(&(Entry->OwnerListEntry));
         MmFreeNonPagedPool(Entry);
     }
 
@@ -417,10 +613,10 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
     PFILE_OBJECT FileObject;
-    LIST_ENTRY FreeList;
     PFILE_LOCK_ENTRY LockEntry;
+    PFILE_LOCK_OWNER Owner;
+    PFILE_LOCK_STATE State;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
@@ -429,47 +625,82 @@ Return Value:
     //
 
     FileObject = IoHandle->FileObject;
-    if (LIST_EMPTY(&(FileObject->FileLockList)) != FALSE) {
+    State = FileObject->FileLocks;
+    if ((State == NULL) || (State->LockCount == 0)) {
         return;
     }
 
-    INITIALIZE_LIST_HEAD(&FreeList);
     KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
 
     //
-    // Loop through and remove any active locks belonging to this process.
+    // Pull the process's locks out of the tree, waking anyone waiting on the
+    // regions they covered.
     //
 
-    CurrentEntry = FileObject->FileLockList.Next;
-    while (CurrentEntry != &(FileObject->FileLockList)) {
-        LockEntry = LIST_VALUE(CurrentEntry, FILE_LOCK_ENTRY, ListEntry);
-        CurrentEntry = CurrentEntry->Next;
-        if (LockEntry->Process == Process) {
-            LIST_REMOVE(&(LockEntry->ListEntry));
-            INSERT_BEFORE(&(LockEntry->ListEntry), &FreeList);
+    Owner = IopFindFileLockOwner(State, Process);
+    if (Owner != NULL) {
+        LIST_REMOVE(&(Owner->ListEntry));
+        while (LIST_EMPTY(&(Owner->LockList)) == FALSE) {
+            LockEntry = LIST_VALUE(Owner->LockList.Next,
+                                   FILE_LOCK_ENTRY,
+                                   OwnerListEntry);
+
+            LIST_REMOVE(&(LockEntry->OwnerListEntry));
+            IopRemoveFileLockEntry(State, LockEntry);
+            IopWakeFileLockWaiters(State,
+                                   LockEntry->Offset,
+                                   IopGetFileLockEnd(LockEntry->Offset,
+                                                     LockEntry->Size));
+
+            MmFreeNonPagedPool(LockEntry);
         }
     }
 
-    //
-    // If locks were removed, signal anyone blocked on this file.
-    //
-
-    if (LIST_EMPTY(&FreeList) == FALSE) {
-        KeSignalEvent(FileObject->FileLockEvent, SignalOptionSignalAll);
+    KeReleaseSharedExclusiveLockExclusive(FileObject->Lock);
+    if (Owner != NULL) {
+        MmFreeNonPagedPool(Owner);
     }
 
-    KeReleaseSharedExclusiveLockExclusive(FileObject->Lock);
+    return;
+}
 
-    //
-    // Free any removed entries now that the lock is released.
-    //
+VOID
+IopDestroyFileLockState (
+    PFILE_OBJECT FileObject
+    )
 
-    while (LIST_EMPTY(&FreeList) == FALSE) {
-        LockEntry = LIST_VALUE(FreeList.Next, FILE_LOCK_ENTRY, ListEntry);
-        LIST_REMOVE(&(LockEntry->ListEntry));
-        MmFreeNonPagedPool(LockEntry);
+/*++
+
+Routine Description:
+
+    This routine destroys the byte-range lock state of a file object that is
+    being torn down.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFILE_LOCK_STATE State;
+
+    State = FileObject->FileLocks;
+    if (State == NULL) {
+        return;
     }
 
+    ASSERT((State->Root == NULL) && (State->LockCount == 0));
+    ASSERT(LIST_EMPTY(&(State->OwnerList)) != FALSE);
+    ASSERT(LIST_EMPTY(&(State->WaiterList)) != FALSE);
+
+    FileObject->FileLocks = NULL;
+    MmFreeNonPagedPool(State);
     return;
 }
 
@@ -477,10 +708,72 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+PFILE_LOCK_STATE
+IopGetFileLockState (
+    PFILE_OBJECT FileObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the byte-range lock state of a file object, creating
+    it if this is the first lock on the file.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object.
+
+Return Value:
+
+    Returns a pointer to the lock state on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    PFILE_LOCK_STATE NewState;
+    PFILE_LOCK_STATE PreviousState;
+
+    if (FileObject->FileLocks != NULL) {
+        return FileObject->FileLocks;
+    }
+
+    //
+    // Race to create the state.
+    //
+
+    NewState = MmAllocateNonPagedPool(sizeof(FILE_LOCK_STATE),
+                                      FILE_LOCK_ALLOCATION_TAG);
+
+    if (NewState == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(NewState, sizeof(FILE_LOCK_STATE));
+    INITIALIZE_LIST_HEAD(&(NewState->OwnerList));
+    INITIALIZE_LIST_HEAD(&(NewState->WaiterList));
+    PreviousState = (PFILE_LOCK_STATE)RtlAtomicCompareExchange(
+                                              (PUINTN)&(FileObject->FileLocks),
+                                              (UINTN)NewState,
+                                              (UINTN)NULL);
+
+    if (PreviousState != NULL) {
+        MmFreeNonPagedPool(NewState);
+        return PreviousState;
+    }
+
+    return NewState;
+}
+
 KSTATUS
 IopTryToSetFileLock (
-    PFILE_OBJECT FileObject,
+    PFILE_LOCK_STATE State,
     PFILE_LOCK_ENTRY NewEntry,
+    PKPROCESS Process,
+    PFILE_LOCK_OWNER *Owner,
     PLIST_ENTRY FreeList,
     BOOL DryRun
     )
@@ -492,19 +785,27 @@ Routine Description:
     This routine attempts to lock or unlocks a portion of a file. If the
     process already has a lock on any part of the region, the old lock is
     replaced with this new region. Remove a lock by specifying a lock type of
-    unlock. This routine assumes the file properties lock is already held.
+    unlock. This routine assumes the file object lock is already held.
 
 Arguments:
 
-    FileObject - Supplies a pointer to the file object.
+    State - Supplies a pointer to the file's lock state.
 
     NewEntry - Supplies a pointer to the new lock to add.
 
+    Process - Supplies a pointer to the process setting the lock.
+
+    Owner - Supplies a pointer that on input contains a spare owner structure
+        to use if the process has no locks on the file yet. On output, this
+        contains an owner structure that needs to be freed, if any. This is
+        only used if this is not a dry run.
+
     FreeList - Supplies a pointer to a list head that on input contains one
         free entry, needed to potentially split an entry. On output, entries
-        that need to be freed will be put on this list.
+        that need to be freed will be put on this list. This is only used if
+        this is not a dry run.
 
-    DryRun - Supplies a pointer indicating if the lock should actually be
+    DryRun - Supplies a boolean indicating if the lock should actually be
         created/destroyed or just checked.
 
 Return Value:
@@ -515,231 +816,741 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
+    ULONGLONG EntryEnd;
     PFILE_LOCK_ENTRY LockEntry;
     BOOL LocksRemoved;
     ULONGLONG NewEnd;
-    BOOL Overlap;
-    PKPROCESS Process;
+    PFILE_LOCK_OWNER ProcessOwner;
     PFILE_LOCK_ENTRY SplitEntry;
-    KSTATUS Status;
-
-    LocksRemoved = FALSE;
-    NewEnd = NewEntry->Offset + NewEntry->Size;
-    Process = PsGetCurrentProcess();
-    Status = STATUS_SUCCESS;
-    CurrentEntry = FileObject->FileLockList.Next;
-    while (CurrentEntry != &(FileObject->FileLockList)) {
-        LockEntry = LIST_VALUE(CurrentEntry, FILE_LOCK_ENTRY, ListEntry);
-        CurrentEntry = CurrentEntry->Next;
 
-        //
-        // If the lock belongs to the current process and overlaps the given
-        // region, it is to be removed.
-        //
+    NewEnd = IopGetFileLockEnd(NewEntry->Offset, NewEntry->Size);
 
-        if (LockEntry->Process == Process) {
-            Overlap = IopDoFileLocksOverlap(NewEntry->Offset,
-                                            NewEntry->Size,
-                                            LockEntry);
+    //
+    // A dry run just checks for locks held by other processes that conflict
+    // with the new one.
+    //
 
-            if ((Overlap != FALSE) && (DryRun == FALSE)) {
-                LocksRemoved = TRUE;
+    if (DryRun != FALSE) {
+        if (NewEntry->Type == FileLockUnlock) {
+            return STATUS_SUCCESS;
+        }
 
-                //
-                // If the existing entry starts before the new one, it needs to
-                // be shrunk or split.
-                //
+        LockEntry = IopFindFileLock(State->Root,
+                                    NewEntry->Offset,
+                                    NewEnd,
+                                    Process,
+                                    NewEntry->Type);
 
-                if (LockEntry->Offset < NewEntry->Offset) {
+        if (LockEntry != NULL) {
+            return STATUS_RESOURCE_IN_USE;
+        }
 
-                    //
-                    // If it ends after the new one, split it.
-                    //
+        return STATUS_SUCCESS;
+    }
 
-                    if ((NewEntry->Size != 0) &&
-                        ((LockEntry->Offset + LockEntry->Size > NewEnd) ||
-                         (LockEntry->Size == 0))) {
+    //
+    // Searching with the unlock type finds the process's own locks, which an
+    // unlock is expected to overlap, so only check conflicts for real locks.
+    //
 
-                        ASSERT(LIST_EMPTY(FreeList) == FALSE);
+    ASSERT((NewEntry->Type == FileLockUnlock) ||
+           (IopFindFileLock(State->Root,
+                            NewEntry->Offset,
+                            NewEnd,
+                            Process,
+                            NewEntry->Type) == NULL));
 
-                        SplitEntry = LIST_VALUE(FreeList->Next,
-                                                FILE_LOCK_ENTRY,
-                                                ListEntry);
+    //
+    // Carve the new region out of any of the process's own locks that
+    // overlap it. Whatever survives of each lock no longer overlaps the
+    // region, so the search always makes progress.
+    //
 
-                        LIST_REMOVE(&(SplitEntry->ListEntry));
-                        SplitEntry->Type = LockEntry->Type;
-                        SplitEntry->Offset = NewEnd;
-                        if (LockEntry->Size == 0) {
-                            SplitEntry->Size = 0;
+    LocksRemoved = FALSE;
+    while (TRUE) {
+        LockEntry = IopFindFileLock(State->Root,
+                                    NewEntry->Offset,
+                                    NewEnd,
+                                    Process,
+                                    FileLockUnlock);
 
-                        } else {
-                            SplitEntry->Size = LockEntry->Offset +
-                                               LockEntry->Size - NewEnd;
-                        }
+        if (LockEntry == NULL) {
+            break;
+        }
 
-                        INSERT_AFTER(&(SplitEntry->ListEntry),
-                                     &(LockEntry->ListEntry));
-                    }
+        LocksRemoved = TRUE;
+        EntryEnd = IopGetFileLockEnd(LockEntry->Offset, LockEntry->Size);
+        IopRemoveFileLockEntry(State, LockEntry);
 
-                    //
-                    // Shrink its length.
-                    //
+        //
+        // If the existing entry starts before the new one, it needs to be
+        // shrunk or split.
+        //
 
-                    LockEntry->Size = NewEntry->Offset - LockEntry->Offset;
+        if (LockEntry->Offset < NewEntry->Offset) {
 
-                //
-                // The current entry starts within the new entry. If it
-                // ends after the new entry, shrink it.
-                //
+            //
+            // If it ends after the new one, split it.
+            //
 
-                } else if ((NewEntry->Size != 0) &&
-                           ((LockEntry->Offset + LockEntry->Size > NewEnd) ||
-                            (LockEntry->Size == 0))) {
+            if (EntryEnd > NewEnd) {
 
-                    if (LockEntry->Size != 0) {
-                        LockEntry->Size = LockEntry->Offset + LockEntry->Size -
-                                          NewEnd;
-                    }
+                ASSERT(LIST_EMPTY(FreeList) == FALSE);
 
-                    LockEntry->Offset = NewEnd;
+                SplitEntry = LIST_VALUE(FreeList->Next,
+                                        FILE_LOCK_ENTRY,
+                                        OwnerListEntry);
 
-                //
-                // The new entry completely swallows the existing one.
-                //
+                LIST_REMOVE(&(SplitEntry->OwnerListEntry));
+                SplitEntry->Owner = LockEntry->Owner;
+                SplitEntry->Type = LockEntry->Type;
+                SplitEntry->Offset = NewEnd;
+                if (LockEntry->Size == 0) {
+                    SplitEntry->Size = 0;
 
                 } else {
-                    LIST_REMOVE(&(LockEntry->ListEntry));
-                    INSERT_BEFORE(&(LockEntry->ListEntry), FreeList);
+                    SplitEntry->Size = EntryEnd - NewEnd;
                 }
-            }
 
-        //
-        // Another process owns this lock.
-        //
+                INSERT_AFTER(&(SplitEntry->OwnerListEntry),
+                             &(LockEntry->OwnerListEntry));
 
-        } else if (NewEntry->Type != FileLockUnlock) {
+                IopInsertFileLockEntry(State, SplitEntry);
+            }
 
             //
-            // Read locks can coexist.
+            // Shrink its length.
             //
 
-            if ((NewEntry->Type == FileLockRead) &&
-                (LockEntry->Type == FileLockRead)) {
+            LockEntry->Size = NewEntry->Offset - LockEntry->Offset;
+            IopInsertFileLockEntry(State, LockEntry);
 
-                continue;
-            }
+        //
+        // The current entry starts within the new entry. If it ends after the
+        // new entry, shrink it.
+        //
 
-            //
-            // If the file lock overlaps with the incoming one, then fail.
-            //
+        } else if (EntryEnd > NewEnd) {
+            if (LockEntry->Size != 0) {
+                LockEntry->Size = EntryEnd - NewEnd;
+            }
 
-            Overlap = IopDoFileLocksOverlap(NewEntry->Offset,
-                                            NewEntry->Size,
-                                            LockEntry);
+            LockEntry->Offset = NewEnd;
+            IopInsertFileLockEntry(State, LockEntry);
 
-            //
-            // This routine should not be discovering overlaps on the real
-            // deal.
-            //
+        //
+        // The new entry completely swallows the existing one.
+        //
 
-            ASSERT((Overlap == FALSE) || (DryRun != FALSE));
-
-            if (Overlap != FALSE) {
-                Status = STATUS_RESOURCE_IN_USE;
-                KeSignalEvent(FileObject->FileLockEvent, SignalOptionUnsignal);
-                break;
-            }
+        } else {
+            LIST_REMOVE(&(LockEntry->OwnerListEntry));
+            INSERT_BEFORE(&(LockEntry->OwnerListEntry), FreeList);
         }
     }
 
     //
-    // Add the new entry if conditions are right.
+    // Add the new entry if this is a lock, creating the owner if needed.
+    //
+
+    ProcessOwner = IopFindFileLockOwner(State, Process);
+    if (NewEntry->Type != FileLockUnlock) {
+        if (ProcessOwner == NULL) {
+            ProcessOwner = *Owner;
+            *Owner = NULL;
+
+            ASSERT(ProcessOwner != NULL);
+
+            ProcessOwner->Process = Process;
+            INITIALIZE_LIST_HEAD(&(ProcessOwner->LockList));
+            INSERT_BEFORE(&(ProcessOwner->ListEntry), &(State->OwnerList));
+        }
+
+        NewEntry->Owner = ProcessOwner;
+        INSERT_BEFORE(&(NewEntry->OwnerListEntry), &(ProcessOwner->LockList));
+        IopInsertFileLockEntry(State, NewEntry);
+
+    //
+    // Get rid of the owner if it just lost its last lock.
     //
 
-    if ((KSUCCESS(Status)) && (DryRun == FALSE) &&
-        (NewEntry->Type != FileLockUnlock)) {
+    } else if ((ProcessOwner != NULL) &&
+               (LIST_EMPTY(&(ProcessOwner->LockList)) != FALSE)) {
+
+        ASSERT(*Owner == NULL);
 
-        INSERT_AFTER(&(NewEntry->ListEntry), &(FileObject->FileLockList));
+        LIST_REMOVE(&(ProcessOwner->ListEntry));
+        *Owner = ProcessOwner;
     }
 
+    //
+    // Wake anyone waiting on a region that just opened up. Downgrading a
+    // write lock to a read lock opens it up to readers too.
+    //
+
     if (LocksRemoved != FALSE) {
-        KeSignalEvent(FileObject->FileLockEvent, SignalOptionSignalAll);
+        IopWakeFileLockWaiters(State, NewEntry->Offset, NewEnd);
     }
 
-    return Status;
+    return STATUS_SUCCESS;
+}
+
+PFILE_LOCK_OWNER
+IopFindFileLockOwner (
+    PFILE_LOCK_STATE State,
+    PKPROCESS Process
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the set of locks a process holds on a file. This
+    routine assumes the file object lock is already held.
+
+Arguments:
+
+    State - Supplies a pointer to the file's lock state.
+
+    Process - Supplies a pointer to the process.
+
+Return Value:
+
+    Returns a pointer to the owner structure for the process, or NULL if the
+    process holds no locks on the file.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PFILE_LOCK_OWNER Owner;
+
+    CurrentEntry = State->OwnerList.Next;
+    while (CurrentEntry != &(State->OwnerList)) {
+        Owner = LIST_VALUE(CurrentEntry, FILE_LOCK_OWNER, ListEntry);
+        if (Owner->Process == Process) {
+            return Owner;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    return NULL;
 }
 
-BOOL
-IopDoFileLocksOverlap (
-    ULONGLONG IncomingOffset,
-    ULONGLONG IncomingSize,
-    PFILE_LOCK_ENTRY LockEntry
+VOID
+IopWakeFileLockWaiters (
+    PFILE_LOCK_STATE State,
+    ULONGLONG Offset,
+    ULONGLONG End
     )
 
 /*++
 
 Routine Description:
 
-    This routine checks to see if the given lock entry overlaps with the
-    incoming lock. The lock types are not checked by this routine, only the
-    regions.
+    This routine wakes the threads waiting on regions of a file that overlap
+    the given region. This routine assumes the file object lock is already
+    held.
 
 Arguments:
 
-    IncomingOffset - Supplies the file offset of the incoming lock.
+    State - Supplies a pointer to the file's lock state.
 
-    IncomingSize - Supplies the file size of the incoming lock.
+    Offset - Supplies the offset where the released region begins.
 
-    LockEntry - Supplies a pointer to the existing lock entry.
+    End - Supplies the offset where the released region ends.
 
 Return Value:
 
-    TRUE if the lock entry overlaps the incoming lock.
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PFILE_LOCK_WAITER Waiter;
+
+    CurrentEntry = State->WaiterList.Next;
+    while (CurrentEntry != &(State->WaiterList)) {
+        Waiter = LIST_VALUE(CurrentEntry, FILE_LOCK_WAITER, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if ((Waiter->Offset < End) && (Offset < Waiter->End)) {
+            KeSignalEvent(Waiter->Event, SignalOptionSignalAll);
+        }
+    }
 
-    FALSE if the lock entry does not overlap.
+    return;
+}
+
+PFILE_LOCK_ENTRY
+IopFindFileLock (
+    PFILE_LOCK_ENTRY Node,
+    ULONGLONG Offset,
+    ULONGLONG End,
+    PKPROCESS Process,
+    FILE_LOCK_TYPE Type
+    )
+
+/*++
+
+Routine Description:
+
+    This routine searches a lock tree for a lock overlapping the given region.
+    Subtrees that end before the region or start after it are skipped. This
+    routine assumes the file object lock is already held.
+
+Arguments:
+
+    Node - Supplies a pointer to the root of the subtree to search.
+
+    Offset - Supplies the offset where the region begins.
+
+    End - Supplies the offset where the region ends.
+
+    Process - Supplies an optional pointer to a process. When searching for
+        conflicts, locks owned by this process are skipped.
+
+    Type - Supplies the type of lock being searched for. If this is unlock,
+        then only locks owned by the given process are returned. Otherwise,
+        only locks that conflict with a lock of this type are returned.
+
+Return Value:
+
+    Returns a pointer to a matching lock, or NULL if there is none.
 
 --*/
 
 {
 
-    //
-    // If the incoming lock goes to the end of the file, then this lock
-    // overlaps if it has an offset greater than the incoming one or its
-    // size is also zero.
-    //
+    PFILE_LOCK_ENTRY Found;
 
-    if (IncomingSize == 0) {
-        if ((LockEntry->Size == 0) || (LockEntry->Offset >= IncomingOffset)) {
-            return TRUE;
+    while ((Node != NULL) && (Node->SubtreeEnd > Offset)) {
+        Found = IopFindFileLock(Node->Left, Offset, End, Process, Type);
+        if (Found != NULL) {
+            return Found;
         }
 
+        //
+        // This node and everything to the right start at or after its
+        // offset.
+        //
+
+        if (Node->Offset >= End) {
+            break;
+        }
+
+        if (IopGetFileLockEnd(Node->Offset, Node->Size) > Offset) {
+            if (Type == FileLockUnlock) {
+                if (Node->Owner->Process == Process) {
+                    return Node;
+                }
+
+            //
+            // Read locks can coexist.
+            //
+
+            } else if ((Node->Owner->Process != Process) &&
+                       ((Type != FileLockRead) ||
+                        (Node->Type != FileLockRead))) {
+
+                return Node;
+            }
+        }
+
+        Node = Node->Right;
+    }
+
+    return NULL;
+}
+
+ULONGLONG
+IopGetFileLockEnd (
+    ULONGLONG Offset,
+    ULONGLONG Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the offset just beyond a lock region.
+
+Arguments:
+
+    Offset - Supplies the offset where the region begins.
+
+    Size - Supplies the size of the region, or zero if it extends to the end
+        of the file.
+
+Return Value:
+
+    Returns the end offset, which is the maximum value for regions that extend
+    to the end of the file.
+
+--*/
+
+{
+
+    if ((Size == 0) || (Offset + Size < Offset)) {
+        return MAX_ULONGLONG;
+    }
+
+    return Offset + Size;
+}
+
+VOID
+IopInsertFileLockEntry (
+    PFILE_LOCK_STATE State,
+    PFILE_LOCK_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine inserts a lock into the lock tree.
+
+Arguments:
+
+    State - Supplies a pointer to the file's lock state.
+
+    Entry - Supplies a pointer to the lock to insert.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFILE_LOCK_ENTRY *Link;
+    PFILE_LOCK_ENTRY Parent;
+
+    Entry->Left = NULL;
+    Entry->Right = NULL;
+    IopUpdateFileLockNode(Entry);
+    Parent = NULL;
+    Link = &(State->Root);
+    while (*Link != NULL) {
+        Parent = *Link;
+        if (Entry->Offset < Parent->Offset) {
+            Link = &(Parent->Left);
+
+        } else {
+            Link = &(Parent->Right);
+        }
+    }
+
+    Entry->Parent = Parent;
+    *Link = Entry;
+    State->LockCount += 1;
+    IopRebalanceFileLocks(State, Parent);
+    return;
+}
+
+VOID
+IopRemoveFileLockEntry (
+    PFILE_LOCK_STATE State,
+    PFILE_LOCK_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a lock from the lock tree.
+
+Arguments:
+
+    State - Supplies a pointer to the file's lock state.
+
+    Entry - Supplies a pointer to the lock to remove.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFILE_LOCK_ENTRY Child;
+    PFILE_LOCK_ENTRY Start;
+    PFILE_LOCK_ENTRY Successor;
+
     //
-    // The incoming lock spans a specific region. This lock overlaps if
-    // one of these conditions is met:
-    // 1. Size == 0 and the offset starts before the incoming lock's end.
-    // 2. Offset <= IncomingOffset and Offset + Size > IncomingOffset.
-    // 3. Offset > IncomingOffset and Offset < IncomingOffset + IncomingSize.
+    // A node with two children is replaced by the lowest node of its right
+    // subtree.
     //
 
-    } else {
-        if (LockEntry->Size == 0) {
-            if (LockEntry->Offset < IncomingOffset + IncomingSize) {
-                return TRUE;
+    if ((Entry->Left != NULL) && (Entry->Right != NULL)) {
+        Successor = Entry->Right;
+        while (Successor->Left != NULL) {
+            Successor = Successor->Left;
+        }
+
+        if (Successor->Parent == Entry) {
+            Start = Successor;
+
+        } else {
+            Start = Successor->Parent;
+            Start->Left = Successor->Right;
+            if (Successor->Right != NULL) {
+                Successor->Right->Parent = Start;
             }
 
-        } else if (LockEntry->Offset <= IncomingOffset) {
-            if (LockEntry->Offset + LockEntry->Size > IncomingOffset) {
-                return TRUE;
+            Successor->Right = Entry->Right;
+            Entry->Right->Parent = Successor;
+        }
+
+        Successor->Left = Entry->Left;
+        Entry->Left->Parent = Successor;
+        Successor->Parent = Entry->Parent;
+        IopReplaceFileLockChild(State, Entry->Parent, Entry, Successor);
+
+    } else {
+        Child = Entry->Left;
+        if (Child == NULL) {
+            Child = Entry->Right;
+        }
+
+        if (Child != NULL) {
+            Child->Parent = Entry->Parent;
+        }
+
+        IopReplaceFileLockChild(State, Entry->Parent, Entry, Child);
+        Start = Entry->Parent;
+    }
+
+    Entry->Parent = NULL;
+    Entry->Left = NULL;
+    Entry->Right = NULL;
+
+    ASSERT(State->LockCount != 0);
+
+    State->LockCount -= 1;
+    IopRebalanceFileLocks(State, Start);
+    return;
+}
+
+VOID
+IopRebalanceFileLocks (
+    PFILE_LOCK_STATE State,
+    PFILE_LOCK_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks from the given node up to the root of the lock tree,
+    updating each node and rotating any that have become unbalanced.
+
+Arguments:
+
+    State - Supplies a pointer to the file's lock state.
+
+    Entry - Supplies a pointer to the lowest node that changed, or NULL if
+        the tree is empty.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    LONG Balance;
+    PFILE_LOCK_ENTRY Child;
+
+    while (Entry != NULL) {
+        IopUpdateFileLockNode(Entry);
+        Balance = FILE_LOCK_HEIGHT(Entry->Left) -
+                  FILE_LOCK_HEIGHT(Entry->Right);
+
+        if (Balance > 1) {
+            Child = Entry->Left;
+            if (FILE_LOCK_HEIGHT(Child->Left) <
+                FILE_LOCK_HEIGHT(Child->Right)) {
+
+                IopRotateFileLocks(State, Child, FALSE);
             }
 
-        } else {
-            if (LockEntry->Offset < IncomingOffset + IncomingSize) {
-                return TRUE;
+            Entry = IopRotateFileLocks(State, Entry, TRUE);
+
+        } else if (Balance < -1) {
+            Child = Entry->Right;
+            if (FILE_LOCK_HEIGHT(Child->Right) <
+                FILE_LOCK_HEIGHT(Child->Left)) {
+
+                IopRotateFileLocks(State, Child, TRUE);
             }
+
+            Entry = IopRotateFileLocks(State, Entry, FALSE);
         }
+
+        Entry = Entry->Parent;
     }
 
-    return FALSE;
+    return;
+}
+
+PFILE_LOCK_ENTRY
+IopRotateFileLocks (
+    PFILE_LOCK_STATE State,
+    PFILE_LOCK_ENTRY Entry,
+    BOOL Right
+    )
+
+/*++
+
+Routine Description:
+
+    This routine rotates a subtree of the lock tree.
+
+Arguments:
+
+    State - Supplies a pointer to the file's lock state.
+
+    Entry - Supplies a pointer to the root of the subtree to rotate.
+
+    Right - Supplies a boolean indicating whether to rotate right, lifting the
+        left child (TRUE), or left, lifting the right child (FALSE).
+
+Return Value:
+
+    Returns a pointer to the new root of the subtree.
+
+--*/
+
+{
+
+    PFILE_LOCK_ENTRY Pivot;
+
+    if (Right != FALSE) {
+        Pivot = Entry->Left;
+        Entry->Left = Pivot->Right;
+        if (Entry->Left != NULL) {
+            Entry->Left->Parent = Entry;
+        }
+
+        Pivot->Right = Entry;
+
+    } else {
+        Pivot = Entry->Right;
+        Entry->Right = Pivot->Left;
+        if (Entry->Right != NULL) {
+            Entry->Right->Parent = Entry;
+        }
+
+        Pivot->Left = Entry;
+    }
+
+    Pivot->Parent = Entry->Parent;
+    IopReplaceFileLockChild(State, Entry->Parent, Entry, Pivot);
+    Entry->Parent = Pivot;
+    IopUpdateFileLockNode(Entry);
+    IopUpdateFileLockNode(Pivot);
+    return Pivot;
+}
+
+VOID
+IopReplaceFileLockChild (
+    PFILE_LOCK_STATE State,
+    PFILE_LOCK_ENTRY Parent,
+    PFILE_LOCK_ENTRY OldChild,
+    PFILE_LOCK_ENTRY NewChild
+    )
+
+/*++
+
+Routine Description:
+
+    This routine points the link to a lock tree node at a different node.
+
+Arguments:
+
+    State - Supplies a pointer to the file's lock state.
+
+    Parent - Supplies a pointer to the parent of the old node, or NULL if it
+        is the root.
+
+    OldChild - Supplies a pointer to the node being replaced.
+
+    NewChild - Supplies a pointer to the node taking its place, which may be
+        NULL.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Parent == NULL) {
+        State->Root = NewChild;
+
+    } else if (Parent->Left == OldChild) {
+        Parent->Left = NewChild;
+
+    } else {
+
+        ASSERT(Parent->Right == OldChild);
+
+        Parent->Right = NewChild;
+    }
+
+    return;
+}
+
+VOID
+IopUpdateFileLockNode (
+    PFILE_LOCK_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine recomputes the height and subtree end of a lock tree node
+    from its children.
+
+Arguments:
+
+    Entry - Supplies a pointer to the node.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    LONG Height;
+    ULONGLONG SubtreeEnd;
+
+    Height = FILE_LOCK_HEIGHT(Entry->Left);
+    if (FILE_LOCK_HEIGHT(Entry->Right) > Height) {
+        Height = FILE_LOCK_HEIGHT(Entry->Right);
+    }
+
+    Entry->Height = Height + 1;
+    SubtreeEnd = IopGetFileLockEnd(Entry->Offset, Entry->Size);
+    if ((Entry->Left != NULL) && (Entry->Left->SubtreeEnd > SubtreeEnd)) {
+        SubtreeEnd = Entry->Left->SubtreeEnd;
+    }
+
+    if ((Entry->Right != NULL) && (Entry->Right->SubtreeEnd > SubtreeEnd)) {
+        SubtreeEnd = Entry->Right->SubtreeEnd;
+    }
+
+    Entry->SubtreeEnd = SubtreeEnd;
+    return;
 }
 
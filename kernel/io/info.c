@@ -128,6 +128,18 @@ Return Value:
         Status = IopGetCacheStatistics(Data, DataSize, Set);
         break;
 
+    case IoInformationWritebackStatistics:
+        Status = IopGetWritebackStatistics(Data, DataSize, Set);
+        break;
+
+    case IoInformationDeviceStatistics:
+        Status = IopGetDeviceStatistics(Data, DataSize, Set);
+        break;
+
+    case IoInformationTrace:
+        Status = IopGetSetIoTrace(Data, DataSize, Set);
+        break;
+
     default:
         Status = STATUS_INVALID_PARAMETER;
         *DataSize = 0;
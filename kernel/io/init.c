@@ -343,6 +343,15 @@ Return Value:
         goto InitializeEnd;
     }
 
+    //
+    // Initialize support for I/O tracing.
+    //
+
+    Status = IopInitializeIoTraceSupport();
+    if (!KSUCCESS(Status)) {
+        goto InitializeEnd;
+    }
+
     //
     // Initialize the device database.
     //
@@ -3550,6 +3550,10 @@ Return Value:
         Status = STATUS_SUCCESS;
         break;
 
+    case IoObjectIoRing:
+        Status = STATUS_SUCCESS;
+        break;
+
     default:
 
         ASSERT(FALSE);
@@ -3732,6 +3736,10 @@ Return Value:
 
         break;
 
+    case IoObjectIoRing:
+        Status = IopCreateIoRing(FromKernelMode, Create, FileObject);
+        break;
+
     default:
 
         ASSERT(FALSE);
@@ -3822,6 +3830,10 @@ Return Value:
             Status = IopTerminalCloseSlave(IoHandle);
             break;
 
+        case IoObjectIoRing:
+            Status = IopCloseIoRing(IoHandle);
+            break;
+
         default:
             Status = STATUS_SUCCESS;
             break;
@@ -4328,6 +4340,10 @@ Return Value:
         *Flags |= FILE_OBJECT_FLAG_NON_PAGED_IO_STATE;
     }
 
+    if ((Request.Flags & LOOKUP_FLAG_HARD_FLUSH_REQUIRED) != 0) {
+        *Flags |= FILE_OBJECT_FLAG_HARD_FLUSH_REQUIRED;
+    }
+
     *MapFlags = Request.MapFlags;
     return Status;
 }
@@ -4338,7 +4354,8 @@ IopSendCreateRequest (
     PFILE_OBJECT Directory,
     PCSTR Name,
     ULONG NameSize,
-    PFILE_PROPERTIES Properties
+    PFILE_PROPERTIES Properties,
+    PULONG Flags
     )
 
 /*++
@@ -4366,6 +4383,9 @@ Routine Description:
         on success. The permissions, object type, user ID, group ID, and access
         times are all valid from the system.
 
+    Flags - Supplies a pointer where the translated file object flags will be
+        returned. See FILE_OBJECT_FLAG_* definitions.
+
 Return Value:
 
     Status code.
@@ -4396,6 +4416,11 @@ Return Value:
                   &(Request.FileProperties),
                   sizeof(FILE_PROPERTIES));
 
+    *Flags = 0;
+    if ((Request.Flags & LOOKUP_FLAG_HARD_FLUSH_REQUIRED) != 0) {
+        *Flags |= FILE_OBJECT_FLAG_HARD_FLUSH_REQUIRED;
+    }
+
     //
     // Update the access time and modified time if file was created.
     //
@@ -5390,6 +5415,15 @@ Return Value:
         Status = IopPerformObjectIoOperation(Handle, Context);
         break;
 
+    //
+    // I/O rings are driven through their own system calls, not read and
+    // write.
+    //
+
+    case IoObjectIoRing:
+        Status = STATUS_NOT_SUPPORTED;
+        goto PerformIoOperationEnd;
+
     default:
 
         ASSERT(FALSE);
@@ -47,6 +47,19 @@ Module Name:
     (((_FileObject)->Flags &                \
      (FILE_OBJECT_FLAG_DIRTY_DATA | FILE_OBJECT_FLAG_DIRTY_PROPERTIES)) == 0)
 
+//
+// This macro initializes a page cache index to be empty.
+//
+
+#define INITIALIZE_PAGE_CACHE_INDEX(_Index) ((_Index)->Root = NULL)
+
+//
+// This macro evaluates to non-zero if the given page cache index has no
+// entries.
+//
+
+#define PAGE_CACHE_INDEX_EMPTY(_Index) ((_Index)->Root == NULL)
+
 //
 // ---------------------------------------------------------------- Definitions
 //
@@ -130,6 +143,13 @@ Module Name:
 
 #define IRP_ACTIVE 0x00000004
 
+//
+// This flag is set in a read or write IRP whose dispatch to a device has been
+// recorded in the device statistics and trace, and whose completion has not.
+//
+
+#define IRP_IO_ACCOUNTED 0x00000008
+
 //
 // This flag is used during processing Query Children to mark pre-existing
 // devices and notice missing ones.
@@ -342,6 +362,97 @@ typedef enum _FILE_OBJECT_TIME_TYPE {
 } FILE_OBJECT_TIME_TYPE, *PFILE_OBJECT_TIME_TYPE;
 
 typedef struct _DEVICE_POWER DEVICE_POWER, *PDEVICE_POWER;
+typedef struct _DEVICE_IO_STATISTICS
+    DEVICE_IO_STATISTICS, *PDEVICE_IO_STATISTICS;
+typedef struct _FILE_LOCK_STATE FILE_LOCK_STATE, *PFILE_LOCK_STATE;
+
+typedef struct _PAGE_CACHE_INDEX_NODE
+    PAGE_CACHE_INDEX_NODE, *PPAGE_CACHE_INDEX_NODE;
+
+/*++
+
+Structure Description:
+
+    This structure defines the root of a radix tree that indexes page cache
+    entries by page number.
+
+Members:
+
+    Root - Stores a pointer to the top node of the tree, or NULL if the tree
+        is empty.
+
+--*/
+
+typedef struct _PAGE_CACHE_INDEX {
+    PPAGE_CACHE_INDEX_NODE Root;
+} PAGE_CACHE_INDEX, *PPAGE_CACHE_INDEX;
+
+/*++
+
+Structure Description:
+
+    This structure defines the writeback state for one device or volume. Each
+    context has its own worker so that flushing a slow device does not hold
+    up writeback to the others.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous writeback contexts.
+        This is protected by the writeback context list lock.
+
+    DeviceId - Stores the ID of the device whose file objects this context
+        covers, or 0 for the shared context used by file objects that are not
+        cacheable.
+
+    ReferenceCount - Stores the number of file objects using this context.
+        This is protected by the writeback context list lock.
+
+    DirtyFileObjectCount - Stores the number of file objects on a dirty list
+        that use this context.
+
+    DirtyPageCount - Stores the number of dirty page cache entries owned by
+        file objects using this context.
+
+    WritebackPageCount - Stores the number of pages currently being written
+        out for file objects using this context.
+
+    BytesWritten - Stores the total number of bytes written back.
+
+    Bandwidth - Stores the estimated writeback bandwidth of the device, in
+        bytes per second. This is 0 until a full sample has been taken.
+
+    SampleBytes - Stores the number of bytes written in the current
+        bandwidth sample.
+
+    SampleTime - Stores the number of time counter ticks spent writing in the
+        current bandwidth sample.
+
+    SampleLock - Stores a pointer to the lock that serializes folding a
+        finished sample into the bandwidth estimate.
+
+    WorkQueue - Stores a pointer to the work queue whose thread runs this
+        context's writeback.
+
+    WorkItem - Stores a pointer to the work item that flushes the dirty file
+        objects using this context.
+
+--*/
+
+typedef struct _WRITEBACK_CONTEXT {
+    LIST_ENTRY ListEntry;
+    DEVICE_ID DeviceId;
+    ULONG ReferenceCount;
+    volatile ULONG DirtyFileObjectCount;
+    volatile UINTN DirtyPageCount;
+    volatile UINTN WritebackPageCount;
+    volatile ULONGLONG BytesWritten;
+    volatile ULONGLONG Bandwidth;
+    volatile ULONGLONG SampleBytes;
+    volatile ULONGLONG SampleTime;
+    PQUEUED_LOCK SampleLock;
+    PWORK_QUEUE WorkQueue;
+    PWORK_ITEM WorkItem;
+} WRITEBACK_CONTEXT, *PWRITEBACK_CONTEXT;
 
 /*++
 
@@ -356,8 +467,10 @@ Structure Description:
 
     ListEntry - Stores an entry into the list of file objects.
 
-    PageCacheTree - Stores a tree root for the page cache entries that
-        belong to this file object.
+    PageCacheIndex - Stores the radix tree index of the page cache entries
+        that belong to this file object, keyed by page number. Changing the
+        shape of the index requires the file object lock held exclusive and
+        the page cache list lock. Tags are changed with the list lock held.
 
     DirtyPageList - Stores the head of the list of dirty page cache entries
         in this file object. This list is synchronized by the global page
@@ -403,11 +516,11 @@ Structure Description:
 
     Properties - Stores the characteristics for this file.
 
-    FileLockList - Stores the head of the list of file locks held on this
-        file object. This is a user mode thing.
+    FileLocks - Stores a pointer to the byte-range lock state for this file
+        object, created on first use. This is a user mode thing.
 
-    FileLockEvent - Stores a pointer to the event that's signalled when a file
-        object lock is released.
+    Writeback - Stores a pointer to the writeback context that flushes this
+        file object and accounts for its dirty pages.
 
 --*/
 
@@ -415,7 +528,7 @@ typedef struct _FILE_OBJECT FILE_OBJECT, *PFILE_OBJECT;
 struct _FILE_OBJECT {
     RED_BLACK_TREE_NODE TreeEntry;
     LIST_ENTRY ListEntry;
-    RED_BLACK_TREE PageCacheTree;
+    PAGE_CACHE_INDEX PageCacheIndex;
     LIST_ENTRY DirtyPageList;
     volatile ULONG ReferenceCount;
     volatile ULONG PathEntryCount;
@@ -429,8 +542,8 @@ struct _FILE_OBJECT {
     volatile ULONG Flags;
     ULONG MapFlags;
     FILE_PROPERTIES Properties;
-    LIST_ENTRY FileLockList;
-    PKEVENT FileLockEvent;
+    PFILE_LOCK_STATE FileLocks;
+    PWRITEBACK_CONTEXT Writeback;
 };
 
 /*++
@@ -989,6 +1102,9 @@ Structure Description:
 
     Power - Stores the power management information for the device.
 
+    IoStatistics - Stores a pointer to the I/O counters and latency histograms
+        of the device, created when the device receives its first I/O request.
+
 --*/
 
 struct _DEVICE {
@@ -1020,6 +1136,7 @@ struct _DEVICE {
     PRESOURCE_ALLOCATION_LIST ProcessorLocalResources;
     PRESOURCE_ALLOCATION_LIST BootResources;
     PDEVICE_POWER Power;
+    PDEVICE_IO_STATISTICS volatile IoStatistics;
 };
 
 /*++
@@ -2167,7 +2284,8 @@ IopSendCreateRequest (
     PFILE_OBJECT Directory,
     PCSTR Name,
     ULONG NameSize,
-    PFILE_PROPERTIES Properties
+    PFILE_PROPERTIES Properties,
+    PULONG Flags
     );
 
 /*++
@@ -2194,6 +2312,9 @@ Routine Description:
         on success. The permissions, object type, user ID, group ID, and access
         times are all valid from the system.
 
+    Flags - Supplies a pointer where the translated file object flags will be
+        returned. See FILE_OBJECT_FLAG_* definitions.
+
 Return Value:
 
     Status code.
@@ -2648,10 +2769,43 @@ Return Value:
 
 --*/
 
+KSTATUS
+IopFlushWritebackContext (
+    PWRITEBACK_CONTEXT Context,
+    ULONG Flags,
+    PUINTN PageCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine flushes the dirty file objects that use the given writeback
+    context.
+
+Arguments:
+
+    Context - Supplies a pointer to the writeback context.
+
+    Flags - Supplies a bitmask of I/O flags. See IO_FLAG_* for definitions.
+
+    PageCount - Supplies an optional pointer describing how many pages to flush.
+        On output this value will be decreased by the number of pages actually
+        flushed. Supply NULL to flush all pages.
+
+Return Value:
+
+    STATUS_SUCCESS if every file object was flushed.
+
+    Otherwise returns the first failing status code.
+
+--*/
+
 VOID
 IopEvictFileObject (
     PFILE_OBJECT FileObject,
     IO_OFFSET Offset,
+    ULONGLONG Size,
     ULONG Flags
     );
 
@@ -2659,12 +2813,12 @@ IopEvictFileObject (
 
 Routine Description:
 
-    This routine evicts the tail of a file object from the system. It unmaps
-    all page cache entries used by image sections after the given offset and
-    evicts all page cache entries after the given offset. If the remove or
-    truncate flags are specified, this routine actually unmaps all mappings for
-    the image sections after the given offset, not just the mapped page cache
-    entries. This routine assumes the file object's lock is held exclusively.
+    This routine evicts a region of a file object from the system. It unmaps
+    all page cache entries used by image sections in the region and evicts
+    all page cache entries in the region. If the remove or truncate flags are
+    specified, this routine actually unmaps all mappings for the image
+    sections in the region, not just the mapped page cache entries. This
+    routine assumes the file object's lock is held exclusively.
 
 Arguments:
 
@@ -2674,6 +2828,9 @@ Routine Description:
         all page cache entries should be evicted and all image sections should
         be unmapped.
 
+    Size - Supplies the size of the region to evict, in bytes. Supply -1 to
+        evict the whole tail of the file object from the given offset.
+
     Flags - Supplies a bitmask of eviction flags. See EVICTION_FLAG_* for
         definitions.
 
@@ -2686,6 +2843,8 @@ Return Value:
 VOID
 IopEvictFileObjects (
     DEVICE_ID DeviceId,
+    IO_OFFSET Offset,
+    ULONGLONG Size,
     ULONG Flags
     );
 
@@ -2701,6 +2860,11 @@ Routine Description:
     DeviceId - Supplies an optional device ID filter. Supply 0 to iterate over
         file objects for all devices.
 
+    Offset - Supplies the starting offset of the region to evict.
+
+    Size - Supplies the size of the region to evict, in bytes. Supply -1 to
+        evict everything from the given offset onwards.
+
     Flags - Supplies a bitmask of eviction flags. See EVICTION_FLAG_* for
         definitions.
 
@@ -3210,6 +3374,59 @@ Return Value:
 
 --*/
 
+KSTATUS
+IopCreateIoRing (
+    BOOL FromKernelMode,
+    PCREATE_PARAMETERS Create,
+    PFILE_OBJECT *FileObject
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new I/O ring, locking down and mapping the user
+    mode buffer that backs it.
+
+Arguments:
+
+    FromKernelMode - Supplies a boolean indicating whether or not the request
+        originated from kernel mode (TRUE) or user mode (FALSE). I/O rings can
+        only be created from user mode.
+
+    Create - Supplies a pointer to the creation parameters.
+
+    FileObject - Supplies a pointer where a pointer to a newly created ring
+        file object will be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+IopCloseIoRing (
+    PIO_HANDLE IoHandle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is called when the last handle to an I/O ring is closed. It
+    cancels every request still waiting on the ring.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle being closed.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 KSTATUS
 IopInitializeTerminalSupport (
     VOID
@@ -4838,6 +5055,28 @@ Return Value:
 
 --*/
 
+VOID
+IopDestroyFileLockState (
+    PFILE_OBJECT FileObject
+    );
+
+/*++
+
+Routine Description:
+
+    This routine destroys the byte-range lock state of a file object that is
+    being torn down.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object.
+
+Return Value:
+
+    None.
+
+--*/
+
 KSTATUS
 IopSynchronizeBlockDevice (
     PDEVICE Device
@@ -4861,3 +5100,451 @@ Return Value:
 
 --*/
 
+//
+// Writeback functions.
+//
+
+KSTATUS
+IopInitializeWriteback (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes writeback support.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+PWRITEBACK_CONTEXT
+IopGetWritebackContext (
+    DEVICE_ID DeviceId,
+    IO_OBJECT_TYPE Type
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds or creates the writeback context for a new file object
+    and adds a reference to it. Cacheable file objects get the context of
+    their device. All others share one context.
+
+Arguments:
+
+    DeviceId - Supplies the ID of the device that owns the file object.
+
+    Type - Supplies the type of the file object.
+
+Return Value:
+
+    Returns a pointer to the writeback context on success.
+
+    NULL on allocation failure.
+
+--*/
+
+VOID
+IopReleaseWritebackContext (
+    PWRITEBACK_CONTEXT Context
+    );
+
+/*++
+
+Routine Description:
+
+    This routine releases a file object's reference on a writeback context.
+    Unreferenced contexts are destroyed later by the page cache thread.
+
+Arguments:
+
+    Context - Supplies a pointer to the writeback context.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+IopWakeWritebackWorker (
+    PWRITEBACK_CONTEXT Context
+    );
+
+/*++
+
+Routine Description:
+
+    This routine queues the writeback worker for the given context if it is
+    not already queued.
+
+Arguments:
+
+    Context - Supplies a pointer to the writeback context.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+IopWakeWritebackWorkers (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine queues the writeback worker of every context that has dirty
+    file objects, and destroys any contexts no longer in use. This routine
+    must only be called from the page cache thread.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+ULONGLONG
+IopBeginWritebackIo (
+    PWRITEBACK_CONTEXT Context,
+    UINTN Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine notes that a write of dirty pages to the device is starting.
+
+Arguments:
+
+    Context - Supplies a pointer to the writeback context.
+
+    Size - Supplies the number of bytes about to be written.
+
+Return Value:
+
+    Returns the time counter value when the write started, to be passed to
+    the end routine.
+
+--*/
+
+VOID
+IopEndWritebackIo (
+    PWRITEBACK_CONTEXT Context,
+    UINTN Size,
+    UINTN BytesCompleted,
+    ULONGLONG StartTime
+    );
+
+/*++
+
+Routine Description:
+
+    This routine notes that a write of dirty pages to the device is complete,
+    and updates the bandwidth estimate of the device.
+
+Arguments:
+
+    Context - Supplies a pointer to the writeback context.
+
+    Size - Supplies the number of bytes supplied to the begin routine.
+
+    BytesCompleted - Supplies the number of bytes actually written.
+
+    StartTime - Supplies the time counter value returned by the begin
+        routine.
+
+Return Value:
+
+    None.
+
+--*/
+
+BOOL
+IopIsWritebackOverLimit (
+    PWRITEBACK_CONTEXT Context,
+    UINTN DirtyLimit
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a device has more than its share of the
+    page cache's dirty pages. The share of each device is proportional to how
+    fast it has been writing back, so that a slow device cannot fill the cache
+    with dirty pages at the expense of faster ones.
+
+Arguments:
+
+    Context - Supplies a pointer to the writeback context of the device.
+
+    DirtyLimit - Supplies the number of dirty pages allowed in the page cache
+        as a whole.
+
+Return Value:
+
+    TRUE if the device has used up its share of dirty pages.
+
+    FALSE if the device is under its share.
+
+--*/
+
+KSTATUS
+IopGetWritebackStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+/*++
+
+Routine Description:
+
+    This routine gets the writeback statistics of each device.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+//
+// Device I/O statistics functions.
+//
+
+PDEVICE_IO_STATISTICS
+IopStartDeviceIo (
+    PDEVICE Device,
+    PULONGLONG StartTime
+    );
+
+/*++
+
+Routine Description:
+
+    This routine accounts for an I/O request being dispatched to a device.
+
+Arguments:
+
+    Device - Supplies a pointer to the device receiving the request.
+
+    StartTime - Supplies a pointer where the time counter value at dispatch
+        will be returned. This is returned even if the statistics could not
+        be allocated, so the request can still be traced.
+
+Return Value:
+
+    Returns a pointer to the device's statistics, which must be passed to the
+    end routine when the request completes.
+
+    NULL if the statistics could not be allocated. The request simply goes
+    uncounted in the statistics.
+
+--*/
+
+VOID
+IopEndDeviceIo (
+    PDEVICE_IO_STATISTICS Statistics,
+    BOOL Write,
+    UINTN BytesCompleted,
+    ULONGLONG StartTime
+    );
+
+/*++
+
+Routine Description:
+
+    This routine accounts for the completion of an I/O request to a device.
+
+Arguments:
+
+    Statistics - Supplies a pointer to the statistics returned when the
+        request was dispatched.
+
+    Write - Supplies a boolean indicating if the request was a write (TRUE) or
+        a read (FALSE).
+
+    BytesCompleted - Supplies the number of bytes the request transferred.
+
+    StartTime - Supplies the time counter value at dispatch.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+IopDestroyDeviceIoStatistics (
+    PDEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine frees the I/O statistics of a device being destroyed.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+IopGetDeviceStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+/*++
+
+Routine Description:
+
+    This routine gets the I/O statistics of each device that has received I/O.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+//
+// I/O trace functions.
+//
+
+KSTATUS
+IopInitializeIoTraceSupport (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is called during system initialization to set up support for
+    I/O tracing. Tracing starts disabled.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VOID
+IopTraceDeviceIo (
+    PDEVICE Device,
+    PIRP Irp,
+    IO_OFFSET Offset,
+    UINTN Size,
+    KSTATUS Status,
+    ULONGLONG IssueTime
+    );
+
+/*++
+
+Routine Description:
+
+    This routine records a completed read or write IRP in the I/O trace, if
+    tracing is enabled.
+
+Arguments:
+
+    Device - Supplies a pointer to the device the IRP was sent to.
+
+    Irp - Supplies a pointer to the completed I/O IRP.
+
+    Offset - Supplies the device offset of the request as it was sent. Drivers
+        in the stack may have adjusted the offset in the IRP since.
+
+    Size - Supplies the size of the request as it was sent.
+
+    Status - Supplies the completion status of the IRP.
+
+    IssueTime - Supplies the time counter value when the IRP was sent.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+IopGetSetIoTrace (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+/*++
+
+Routine Description:
+
+    This routine enables, disables or reads the I/O trace.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
@@ -0,0 +1,1665 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ioring.c
+
+Abstract:
+
+    This module implements I/O rings, which allow user mode to queue batches
+    of I/O requests with a single system call and collect their completions
+    from shared memory.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the number of work queues (and therefore worker threads) each ring
+// uses to carry out its requests. Requests that wait for a pipe, socket, or
+// terminal to become ready never block these queues, they wait on a thread of
+// their own instead.
+//
+
+#define IO_RING_WORK_QUEUE_COUNT 4
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines an I/O submission and completion ring.
+
+Members:
+
+    Header - Stores the standard object header.
+
+    Lock - Stores a pointer to the lock that serializes posting completions.
+
+    SubmitLock - Stores a pointer to the lock that serializes consuming
+        submissions.
+
+    IoState - Stores a pointer to the I/O object state of the ring's file
+        object. The in event is set when completions are posted.
+
+    IoBuffer - Stores a pointer to the locked and mapped I/O buffer backing
+        the ring.
+
+    SharedHeader - Stores the kernel mapping of the shared ring header.
+
+    Submissions - Stores the kernel mapping of the submission array.
+
+    Completions - Stores the kernel mapping of the completion array.
+
+    SubmitEntryCount - Stores the number of submission entries.
+
+    CompleteEntryCount - Stores the number of completion entries.
+
+    SubmitHead - Stores the kernel's private copy of the submission head.
+
+    CompleteTail - Stores the kernel's private copy of the completion tail.
+
+    InFlightCount - Stores the number of requests consumed from the
+        submission array that have not yet posted a completion.
+
+    NextWorkQueue - Stores the index of the work queue the next request will
+        be queued to.
+
+    WorkQueues - Stores the work queues that run the ring's requests.
+
+    CancelEvent - Stores a pointer to the event signaled when the ring is
+        closed, which wakes every request waiting for its target to become
+        ready.
+
+    Closed - Stores a boolean indicating whether the last handle to the ring
+        has been closed. Requests that have not finished yet are cancelled.
+
+--*/
+
+typedef struct _IO_RING {
+    OBJECT_HEADER Header;
+    PQUEUED_LOCK Lock;
+    PQUEUED_LOCK SubmitLock;
+    PIO_OBJECT_STATE IoState;
+    PIO_BUFFER IoBuffer;
+    PIO_RING_HEADER SharedHeader;
+    PIO_RING_SUBMISSION Submissions;
+    PIO_RING_COMPLETION Completions;
+    ULONG SubmitEntryCount;
+    ULONG CompleteEntryCount;
+    ULONG SubmitHead;
+    ULONG CompleteTail;
+    ULONG InFlightCount;
+    volatile ULONG NextWorkQueue;
+    PWORK_QUEUE WorkQueues[IO_RING_WORK_QUEUE_COUNT];
+    PKEVENT CancelEvent;
+    volatile BOOL Closed;
+} IO_RING, *PIO_RING;
+
+/*++
+
+Structure Description:
+
+    This structure defines the parameters needed to create an I/O ring.
+
+Members:
+
+    Buffer - Stores the user mode buffer backing the ring.
+
+    BufferSize - Stores the size of the buffer in bytes.
+
+    SubmitEntryCount - Stores the number of submission entries.
+
+    CompleteEntryCount - Stores the number of completion entries.
+
+--*/
+
+typedef struct _IO_RING_CREATION_PARAMETERS {
+    PVOID Buffer;
+    UINTN BufferSize;
+    ULONG SubmitEntryCount;
+    ULONG CompleteEntryCount;
+} IO_RING_CREATION_PARAMETERS, *PIO_RING_CREATION_PARAMETERS;
+
+/*++
+
+Structure Description:
+
+    This structure defines a single request consumed from an I/O ring.
+
+Members:
+
+    RingFileObject - Stores a pointer to the file object of the ring. The
+        request holds a reference on the file object rather than on the ring's
+        handle, so that closing the handle can cancel the request.
+
+    Ring - Stores a pointer to the ring the request belongs to.
+
+    Handle - Stores a pointer to the referenced I/O handle the operation
+        targets.
+
+    IoBuffer - Stores a pointer to the locked I/O buffer describing the user
+        data buffer for reads and writes.
+
+    EndTime - Stores the time counter value at which a request waiting for
+        its target to become ready times out.
+
+    BytesCompleted - Stores the number of bytes transferred so far.
+
+    Submission - Stores a copy of the submission entry.
+
+--*/
+
+typedef struct _IO_RING_REQUEST {
+    PFILE_OBJECT RingFileObject;
+    PIO_RING Ring;
+    PIO_HANDLE Handle;
+    PIO_BUFFER IoBuffer;
+    ULONGLONG EndTime;
+    UINTN BytesCompleted;
+    IO_RING_SUBMISSION Submission;
+} IO_RING_REQUEST, *PIO_RING_REQUEST;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+IopDestroyIoRing (
+    PVOID IoRingObject
+    );
+
+VOID
+IopStartIoRingRequest (
+    PIO_HANDLE RingHandle,
+    PIO_RING_SUBMISSION Submission
+    );
+
+VOID
+IopIoRingWorker (
+    PVOID Parameter
+    );
+
+VOID
+IopIoRingWaiter (
+    PVOID Parameter
+    );
+
+BOOL
+IopIsIoRingRequestReadinessBased (
+    PIO_RING_REQUEST Request
+    );
+
+KSTATUS
+IopAttemptIoRingRequest (
+    PIO_RING_REQUEST Request,
+    PULONG Events
+    );
+
+KSTATUS
+IopWaitForIoRingRequest (
+    PIO_RING_REQUEST Request
+    );
+
+VOID
+IopCompleteIoRingRequest (
+    PIO_RING_REQUEST Request,
+    KSTATUS Status,
+    UINTN BytesCompleted,
+    ULONG Events
+    );
+
+VOID
+IopPostIoRingCompletion (
+    PIO_RING Ring,
+    ULONGLONG UserData,
+    KSTATUS Status,
+    UINTN BytesCompleted,
+    ULONG Events
+    );
+
+KSTATUS
+IopLockIoRingBuffer (
+    PVOID Buffer,
+    UINTN Size,
+    PIO_BUFFER *IoBuffer
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INTN
+IoSysCreateIoRing (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the user mode system call for creating an I/O
+    submission and completion ring.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    CREATE_PARAMETERS Create;
+    PKPROCESS CurrentProcess;
+    ULONG HandleFlags;
+    PIO_HANDLE IoHandle;
+    PSYSTEM_CALL_CREATE_IO_RING Parameters;
+    IO_RING_CREATION_PARAMETERS RingParameters;
+    KSTATUS Status;
+
+    CurrentProcess = PsGetCurrentProcess();
+
+    ASSERT(CurrentProcess != PsGetKernelProcess());
+
+    IoHandle = NULL;
+    Parameters = (PSYSTEM_CALL_CREATE_IO_RING)SystemCallParameter;
+    Parameters->Handle = INVALID_HANDLE;
+    if ((Parameters->OpenFlags & ~SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto SysCreateIoRingEnd;
+    }
+
+    RingParameters.Buffer = Parameters->Buffer;
+    RingParameters.BufferSize = Parameters->BufferSize;
+    RingParameters.SubmitEntryCount = Parameters->SubmitEntryCount;
+    RingParameters.CompleteEntryCount = Parameters->CompleteEntryCount;
+    Create.Type = IoObjectIoRing;
+    Create.Context = &RingParameters;
+    Create.Permissions = FILE_PERMISSION_USER_READ | FILE_PERMISSION_USER_WRITE;
+    Create.Created = FALSE;
+    Status = IopOpen(FALSE,
+                     NULL,
+                     NULL,
+                     0,
+                     IO_ACCESS_READ | IO_ACCESS_WRITE,
+                     OPEN_FLAG_CREATE | OPEN_FLAG_FAIL_IF_EXISTS,
+                     &Create,
+                     &IoHandle);
+
+    if (!KSUCCESS(Status)) {
+        goto SysCreateIoRingEnd;
+    }
+
+    HandleFlags = 0;
+    if ((Parameters->OpenFlags & SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+        HandleFlags |= FILE_DESCRIPTOR_CLOSE_ON_EXECUTE;
+    }
+
+    Status = ObCreateHandle(CurrentProcess->HandleTable,
+                            IoHandle,
+                            HandleFlags,
+                            &(Parameters->Handle));
+
+    if (!KSUCCESS(Status)) {
+        goto SysCreateIoRingEnd;
+    }
+
+SysCreateIoRingEnd:
+    if (!KSUCCESS(Status)) {
+        if (IoHandle != NULL) {
+            IoClose(IoHandle);
+        }
+    }
+
+    return Status;
+}
+
+INTN
+IoSysSubmitIoRing (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the user mode system call for submitting the
+    pending entries of an I/O ring and waiting for completions.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    Returns the number of submissions consumed on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    ULONG Available;
+    PKPROCESS CurrentProcess;
+    ULONG Index;
+    ULONG Outstanding;
+    PSYSTEM_CALL_SUBMIT_IO_RING Parameters;
+    ULONG Pending;
+    ULONG ReturnedEvents;
+    PIO_RING Ring;
+    PIO_HANDLE RingHandle;
+    KSTATUS Status;
+    IO_RING_SUBMISSION Submission;
+    ULONG Submitted;
+    ULONG WaitCount;
+
+    ASSERT(SYS_WAIT_TIME_INDEFINITE == WAIT_TIME_INDEFINITE);
+
+    CurrentProcess = PsGetCurrentProcess();
+    Parameters = (PSYSTEM_CALL_SUBMIT_IO_RING)SystemCallParameter;
+    Submitted = 0;
+    RingHandle = ObGetHandleValue(CurrentProcess->HandleTable,
+                                  Parameters->Handle,
+                                  NULL);
+
+    if (RingHandle == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto SysSubmitIoRingEnd;
+    }
+
+    if (RingHandle->FileObject->Properties.Type != IoObjectIoRing) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto SysSubmitIoRingEnd;
+    }
+
+    Ring = RingHandle->FileObject->SpecialIo;
+
+    //
+    // Consume submissions. Each one reserves a completion slot first so that
+    // the completion array can never overflow.
+    //
+
+    if (Parameters->SubmitCount != 0) {
+        KeAcquireQueuedLock(Ring->SubmitLock);
+        Pending = Ring->SharedHeader->SubmitTail - Ring->SubmitHead;
+        RtlMemoryBarrier();
+        if (Pending > Ring->SubmitEntryCount) {
+            KeReleaseQueuedLock(Ring->SubmitLock);
+            Status = STATUS_INVALID_PARAMETER;
+            goto SysSubmitIoRingEnd;
+        }
+
+        if (Pending > Parameters->SubmitCount) {
+            Pending = Parameters->SubmitCount;
+        }
+
+        while (Submitted < Pending) {
+            KeAcquireQueuedLock(Ring->Lock);
+            Outstanding = Ring->CompleteTail -
+                          Ring->SharedHeader->CompleteHead +
+                          Ring->InFlightCount;
+
+            if (Outstanding >= Ring->CompleteEntryCount) {
+                KeReleaseQueuedLock(Ring->Lock);
+                break;
+            }
+
+            Ring->InFlightCount += 1;
+            KeReleaseQueuedLock(Ring->Lock);
+
+            //
+            // Copy the entry out of shared memory before looking at it so
+            // user mode cannot change it underneath the validation.
+            //
+
+            Index = Ring->SubmitHead & (Ring->SubmitEntryCount - 1);
+            RtlCopyMemory(&Submission,
+                          &(Ring->Submissions[Index]),
+                          sizeof(IO_RING_SUBMISSION));
+
+            Ring->SubmitHead += 1;
+            Ring->SharedHeader->SubmitHead = Ring->SubmitHead;
+            Submitted += 1;
+            IopStartIoRingRequest(RingHandle, &Submission);
+        }
+
+        KeReleaseQueuedLock(Ring->SubmitLock);
+    }
+
+    //
+    // Wait for the requested number of completions to be available.
+    //
+
+    Status = STATUS_SUCCESS;
+    WaitCount = Parameters->WaitCount;
+    if (WaitCount > Ring->CompleteEntryCount) {
+        WaitCount = Ring->CompleteEntryCount;
+    }
+
+    if (WaitCount != 0) {
+        while (TRUE) {
+            KeAcquireQueuedLock(Ring->Lock);
+            Available = Ring->CompleteTail - Ring->SharedHeader->CompleteHead;
+            if (Available >= WaitCount) {
+                KeReleaseQueuedLock(Ring->Lock);
+                break;
+            }
+
+            IoSetIoObjectState(Ring->IoState, POLL_EVENT_IN, FALSE);
+            KeReleaseQueuedLock(Ring->Lock);
+            Status = IoWaitForIoObjectState(Ring->IoState,
+                                            POLL_EVENT_IN,
+                                            TRUE,
+                                            Parameters->TimeoutInMilliseconds,
+                                            &ReturnedEvents);
+
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+        }
+    }
+
+SysSubmitIoRingEnd:
+    if (RingHandle != NULL) {
+        IoIoHandleReleaseReference(RingHandle);
+    }
+
+    //
+    // Entries that were consumed cannot be put back, so report them even if
+    // the wait failed.
+    //
+
+    if (Submitted != 0) {
+        return Submitted;
+    }
+
+    if (Status == STATUS_INTERRUPTED) {
+        Status = STATUS_RESTART_AFTER_SIGNAL;
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopCreateIoRing (
+    BOOL FromKernelMode,
+    PCREATE_PARAMETERS Create,
+    PFILE_OBJECT *FileObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new I/O ring, locking down and mapping the user
+    mode buffer that backs it.
+
+Arguments:
+
+    FromKernelMode - Supplies a boolean indicating whether or not the request
+        originated from kernel mode (TRUE) or user mode (FALSE). I/O rings can
+        only be created from user mode.
+
+    Create - Supplies a pointer to the creation parameters.
+
+    FileObject - Supplies a pointer where a pointer to a newly created ring
+        file object will be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    BOOL Created;
+    FILE_PROPERTIES FileProperties;
+    ULONG Index;
+    PFILE_OBJECT NewFileObject;
+    PIO_RING NewRing;
+    PIO_RING_CREATION_PARAMETERS Parameters;
+    PIO_RING_HEADER RingHeader;
+    KSTATUS Status;
+    PKTHREAD Thread;
+
+    NewFileObject = NULL;
+    NewRing = NULL;
+    Parameters = Create->Context;
+    if ((FromKernelMode != FALSE) || (Parameters == NULL)) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto CreateIoRingEnd;
+    }
+
+    if ((Parameters->SubmitEntryCount == 0) ||
+        (Parameters->SubmitEntryCount > Parameters->CompleteEntryCount) ||
+        (Parameters->CompleteEntryCount > IO_RING_MAX_ENTRIES) ||
+        (!POWER_OF_2(Parameters->SubmitEntryCount)) ||
+        (!POWER_OF_2(Parameters->CompleteEntryCount)) ||
+        (!IS_POINTER_ALIGNED(Parameters->Buffer, MmPageSize())) ||
+        (Parameters->BufferSize <
+         IO_RING_BUFFER_SIZE(Parameters->SubmitEntryCount,
+                             Parameters->CompleteEntryCount))) {
+
+        Status = STATUS_INVALID_PARAMETER;
+        goto CreateIoRingEnd;
+    }
+
+    //
+    // Create the ring object. This reference is transferred to the file
+    // object's special I/O member on success.
+    //
+
+    NewRing = ObCreateObject(ObjectIoRing,
+                             NULL,
+                             NULL,
+                             0,
+                             sizeof(IO_RING),
+                             IopDestroyIoRing,
+                             0,
+                             IO_ALLOCATION_TAG);
+
+    if (NewRing == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateIoRingEnd;
+    }
+
+    NewRing->Lock = KeCreateQueuedLock();
+    NewRing->SubmitLock = KeCreateQueuedLock();
+    NewRing->CancelEvent = KeCreateEvent(NULL);
+    if ((NewRing->Lock == NULL) || (NewRing->SubmitLock == NULL) ||
+        (NewRing->CancelEvent == NULL)) {
+
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateIoRingEnd;
+    }
+
+    for (Index = 0; Index < IO_RING_WORK_QUEUE_COUNT; Index += 1) {
+        NewRing->WorkQueues[Index] = KeCreateWorkQueue(0, "IoRingWorker");
+        if (NewRing->WorkQueues[Index] == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto CreateIoRingEnd;
+        }
+    }
+
+    //
+    // Lock the shared buffer in memory and map it into the kernel so that
+    // the worker threads can post completions to it from any process.
+    //
+
+    Status = IopLockIoRingBuffer(Parameters->Buffer,
+                                 Parameters->BufferSize,
+                                 &(NewRing->IoBuffer));
+
+    if (!KSUCCESS(Status)) {
+        goto CreateIoRingEnd;
+    }
+
+    Status = MmMapIoBuffer(NewRing->IoBuffer, FALSE, FALSE, TRUE);
+    if (!KSUCCESS(Status)) {
+        goto CreateIoRingEnd;
+    }
+
+    RingHeader = NewRing->IoBuffer->Fragment[0].VirtualAddress;
+    NewRing->SharedHeader = RingHeader;
+    NewRing->SubmitEntryCount = Parameters->SubmitEntryCount;
+    NewRing->CompleteEntryCount = Parameters->CompleteEntryCount;
+    RingHeader->SubmitHead = 0;
+    RingHeader->SubmitTail = 0;
+    RingHeader->CompleteHead = 0;
+    RingHeader->CompleteTail = 0;
+    RingHeader->SubmitEntryCount = NewRing->SubmitEntryCount;
+    RingHeader->CompleteEntryCount = NewRing->CompleteEntryCount;
+    RingHeader->SubmitOffset = sizeof(IO_RING_HEADER);
+    RingHeader->CompleteOffset = RingHeader->SubmitOffset +
+                                 (NewRing->SubmitEntryCount *
+                                  sizeof(IO_RING_SUBMISSION));
+
+    NewRing->Submissions = (PVOID)RingHeader + RingHeader->SubmitOffset;
+    NewRing->Completions = (PVOID)RingHeader + RingHeader->CompleteOffset;
+
+    //
+    // Create a file object if needed.
+    //
+
+    if (*FileObject == NULL) {
+        Thread = KeGetCurrentThread();
+        IopFillOutFilePropertiesForObject(&FileProperties, &(NewRing->Header));
+        FileProperties.Permissions = Create->Permissions;
+        FileProperties.Type = IoObjectIoRing;
+        FileProperties.UserId = Thread->Identity.EffectiveUserId;
+        FileProperties.GroupId = Thread->Identity.EffectiveGroupId;
+        Status = IopCreateOrLookupFileObject(&FileProperties,
+                                             ObGetRootObject(),
+                                             0,
+                                             0,
+                                             &NewFileObject,
+                                             &Created);
+
+        if (!KSUCCESS(Status)) {
+
+            //
+            // Release the references added by filling out the file properties.
+            //
+
+            ObReleaseReference(NewRing);
+            goto CreateIoRingEnd;
+        }
+
+        ASSERT(Created != FALSE);
+
+        *FileObject = NewFileObject;
+    }
+
+    ASSERT((*FileObject)->Properties.Type == IoObjectIoRing);
+    ASSERT((*FileObject)->IoState != NULL);
+
+    NewRing->IoState = (*FileObject)->IoState;
+    IoSetIoObjectState(NewRing->IoState, POLL_EVENT_OUT, TRUE);
+
+    ASSERT(((*FileObject)->SpecialIo == NULL) &&
+           ((KeGetEventState((*FileObject)->ReadyEvent) == NotSignaled) ||
+            (KeGetEventState((*FileObject)->ReadyEvent) ==
+             NotSignaledWithWaiters)));
+
+    (*FileObject)->SpecialIo = NewRing;
+    NewRing = NULL;
+    Create->Created = TRUE;
+    Status = STATUS_SUCCESS;
+
+CreateIoRingEnd:
+
+    //
+    // On both success and failure, the file object's ready event needs to be
+    // signaled. Other threads may be waiting on the event.
+    //
+
+    if (*FileObject != NULL) {
+        KeSignalEvent((*FileObject)->ReadyEvent, SignalOptionSignalAll);
+    }
+
+    if (!KSUCCESS(Status)) {
+        if (NewFileObject != NULL) {
+            *FileObject = NULL;
+            IopFileObjectReleaseReference(NewFileObject);
+        }
+
+        if (NewRing != NULL) {
+            ObReleaseReference(NewRing);
+            NewRing = NULL;
+        }
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopCloseIoRing (
+    PIO_HANDLE IoHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when the last handle to an I/O ring is closed. It
+    cancels every request still waiting on the ring.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle being closed.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PIO_RING Ring;
+
+    ASSERT(IoHandle->FileObject->Properties.Type == IoObjectIoRing);
+
+    Ring = IoHandle->FileObject->SpecialIo;
+    if (Ring == NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Requests still sitting in a work queue see the flag when they start.
+    // Requests waiting for readiness are woken by the event.
+    //
+
+    Ring->Closed = TRUE;
+    RtlMemoryBarrier();
+    KeSignalEvent(Ring->CancelEvent, SignalOptionSignalAll);
+    return STATUS_SUCCESS;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+IopDestroyIoRing (
+    PVOID IoRingObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys all resources associated with an I/O ring. Every
+    request holds a reference on the ring's file object, so none can be
+    outstanding here.
+
+Arguments:
+
+    IoRingObject - Supplies a pointer to the I/O ring object being destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+    PIO_RING Ring;
+
+    Ring = (PIO_RING)IoRingObject;
+
+    ASSERT(Ring->InFlightCount == 0);
+
+    //
+    // Destroying a work queue is asynchronous, so this is safe even if the
+    // last reference was dropped by one of the ring's own workers.
+    //
+
+    for (Index = 0; Index < IO_RING_WORK_QUEUE_COUNT; Index += 1) {
+        if (Ring->WorkQueues[Index] != NULL) {
+            KeDestroyWorkQueue(Ring->WorkQueues[Index]);
+        }
+    }
+
+    if (Ring->IoBuffer != NULL) {
+        MmFreeIoBuffer(Ring->IoBuffer);
+    }
+
+    if (Ring->CancelEvent != NULL) {
+        KeDestroyEvent(Ring->CancelEvent);
+    }
+
+    if (Ring->SubmitLock != NULL) {
+        KeDestroyQueuedLock(Ring->SubmitLock);
+    }
+
+    if (Ring->Lock != NULL) {
+        KeDestroyQueuedLock(Ring->Lock);
+    }
+
+    return;
+}
+
+VOID
+IopStartIoRingRequest (
+    PIO_HANDLE RingHandle,
+    PIO_RING_SUBMISSION Submission
+    )
+
+/*++
+
+Routine Description:
+
+    This routine validates a submission consumed from an I/O ring and queues
+    it to one of the ring's workers. Requests that fail validation or need no
+    work are completed immediately. The caller must have already accounted
+    for the request in the ring's in-flight count.
+
+Arguments:
+
+    RingHandle - Supplies a pointer to the I/O handle of the ring.
+
+    Submission - Supplies a pointer to a kernel copy of the submission.
+
+Return Value:
+
+    None. The outcome is reported through the completion array.
+
+--*/
+
+{
+
+    PKPROCESS CurrentProcess;
+    ULONG Index;
+    PIO_RING_REQUEST Request;
+    PIO_RING Ring;
+    KSTATUS Status;
+
+    CurrentProcess = PsGetCurrentProcess();
+    Ring = RingHandle->FileObject->SpecialIo;
+    Request = MmAllocatePagedPool(sizeof(IO_RING_REQUEST), IO_ALLOCATION_TAG);
+    if (Request == NULL) {
+
+        //
+        // There is nowhere to stash the request, so post the failure directly.
+        //
+
+        IopPostIoRingCompletion(Ring,
+                                Submission->UserData,
+                                STATUS_INSUFFICIENT_RESOURCES,
+                                0,
+                                0);
+
+        return;
+    }
+
+    RtlZeroMemory(Request, sizeof(IO_RING_REQUEST));
+    RtlCopyMemory(&(Request->Submission),
+                  Submission,
+                  sizeof(IO_RING_SUBMISSION));
+
+    IopFileObjectAddReference(RingHandle->FileObject);
+    Request->RingFileObject = RingHandle->FileObject;
+    Request->Ring = Ring;
+    if ((Submission->Operation >= IoRingOperationCount) ||
+        ((Submission->Flags & ~IO_RING_SUBMISSION_FLAG_MASK) != 0)) {
+
+        Status = STATUS_INVALID_PARAMETER;
+        goto StartIoRingRequestEnd;
+    }
+
+    if (Submission->Operation == IoRingOperationNop) {
+        Status = STATUS_SUCCESS;
+        goto StartIoRingRequestEnd;
+    }
+
+    Request->Handle = ObGetHandleValue(CurrentProcess->HandleTable,
+                                       Submission->Handle,
+                                       NULL);
+
+    if (Request->Handle == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto StartIoRingRequestEnd;
+    }
+
+    //
+    // Lock the data buffer now, while still in the context of the owning
+    // process. The worker only ever touches the physical pages.
+    //
+
+    if (((Submission->Operation == IoRingOperationRead) ||
+         (Submission->Operation == IoRingOperationWrite)) &&
+        (Submission->Size != 0)) {
+
+        if (Submission->Size > (UINTN)MAX_INTN) {
+            Status = STATUS_INVALID_PARAMETER;
+            goto StartIoRingRequestEnd;
+        }
+
+        Status = IopLockIoRingBuffer(Submission->Buffer,
+                                     Submission->Size,
+                                     &(Request->IoBuffer));
+
+        if (!KSUCCESS(Status)) {
+            goto StartIoRingRequestEnd;
+        }
+    }
+
+    Index = RtlAtomicAdd32(&(Ring->NextWorkQueue), 1) %
+            IO_RING_WORK_QUEUE_COUNT;
+
+    Status = KeCreateAndQueueWorkItem(Ring->WorkQueues[Index],
+                                      WorkPriorityNormal,
+                                      IopIoRingWorker,
+                                      Request);
+
+    if (!KSUCCESS(Status)) {
+        goto StartIoRingRequestEnd;
+    }
+
+    Request = NULL;
+
+StartIoRingRequestEnd:
+    if (Request != NULL) {
+        IopCompleteIoRingRequest(Request, Status, 0, 0);
+    }
+
+    return;
+}
+
+VOID
+IopIoRingWorker (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a single I/O ring request on a worker thread.
+    Requests that have to wait for their target to become ready are handed
+    off to a thread of their own so they cannot hold up the work queue.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the I/O ring request.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Events;
+    ULONG Flags;
+    PIO_RING_REQUEST Request;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+    ULONG Timeout;
+
+    Request = Parameter;
+    Submission = &(Request->Submission);
+    Events = 0;
+    Status = STATUS_SUCCESS;
+    if (Request->Ring->Closed != FALSE) {
+        Status = STATUS_OPERATION_CANCELLED;
+        goto IoRingWorkerEnd;
+    }
+
+    //
+    // Try readiness based requests without blocking first. Most of them are
+    // satisfied right away and never need a thread of their own.
+    //
+
+    if (IopIsIoRingRequestReadinessBased(Request) != FALSE) {
+        Status = IopAttemptIoRingRequest(Request, &Events);
+        if (Status != STATUS_TRY_AGAIN) {
+            goto IoRingWorkerEnd;
+        }
+
+        Timeout = Submission->TimeoutInMilliseconds;
+        if (Timeout == 0) {
+            Status = STATUS_TIMEOUT;
+            goto IoRingWorkerEnd;
+        }
+
+        if (Timeout != WAIT_TIME_INDEFINITE) {
+            Request->EndTime = KeGetRecentTimeCounter() +
+                               KeConvertMicrosecondsToTimeTicks(
+                                   Timeout * MICROSECONDS_PER_MILLISECOND);
+        }
+
+        Status = PsCreateKernelThread(IopIoRingWaiter,
+                                      Request,
+                                      "IoRingWaiter");
+
+        if (!KSUCCESS(Status)) {
+            goto IoRingWorkerEnd;
+        }
+
+        return;
+    }
+
+    switch (Submission->Operation) {
+    case IoRingOperationRead:
+        if (Request->IoBuffer == NULL) {
+            break;
+        }
+
+        Status = IoReadAtOffset(Request->Handle,
+                                Request->IoBuffer,
+                                Submission->Offset,
+                                Submission->Size,
+                                0,
+                                Submission->TimeoutInMilliseconds,
+                                &(Request->BytesCompleted),
+                                NULL);
+
+        break;
+
+    case IoRingOperationWrite:
+        if (Request->IoBuffer == NULL) {
+            break;
+        }
+
+        Flags = 0;
+        if ((Submission->Flags & IO_RING_SUBMISSION_FLAG_DATA_SYNCHRONIZED) !=
+            0) {
+
+            Flags |= IO_FLAG_DATA_SYNCHRONIZED;
+        }
+
+        Status = IoWriteAtOffset(Request->Handle,
+                                 Request->IoBuffer,
+                                 Submission->Offset,
+                                 Submission->Size,
+                                 Flags,
+                                 Submission->TimeoutInMilliseconds,
+                                 &(Request->BytesCompleted),
+                                 NULL);
+
+        break;
+
+    case IoRingOperationFlush:
+        Status = IoFlush(Request->Handle, 0, -1, 0);
+        break;
+
+    default:
+
+        ASSERT(FALSE);
+
+        Status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+
+IoRingWorkerEnd:
+    IopCompleteIoRingRequest(Request, Status, Request->BytesCompleted, Events);
+    return;
+}
+
+VOID
+IopIoRingWaiter (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for a thread that waits for the target of
+    an I/O ring request to become ready and then retries the request. It runs
+    until the request completes, times out, or the ring is closed.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the I/O ring request.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Events;
+    PIO_RING_REQUEST Request;
+    KSTATUS Status;
+
+    Request = Parameter;
+    Events = 0;
+    while (TRUE) {
+        Status = IopWaitForIoRingRequest(Request);
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        Status = IopAttemptIoRingRequest(Request, &Events);
+        if (Status != STATUS_TRY_AGAIN) {
+            break;
+        }
+    }
+
+    IopCompleteIoRingRequest(Request, Status, Request->BytesCompleted, Events);
+    return;
+}
+
+BOOL
+IopIsIoRingRequestReadinessBased (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether an I/O ring request may have to wait an
+    unbounded amount of time for its target to become ready. Polls, and reads
+    and writes on pipes, sockets, and terminals fall into this category.
+
+Arguments:
+
+    Request - Supplies a pointer to the I/O ring request.
+
+Return Value:
+
+    TRUE if the request waits for readiness.
+
+    FALSE if the request completes in bounded time.
+
+--*/
+
+{
+
+    IO_RING_OPERATION Operation;
+
+    Operation = Request->Submission.Operation;
+    if (Operation == IoRingOperationPoll) {
+        return TRUE;
+    }
+
+    if (((Operation != IoRingOperationRead) &&
+         (Operation != IoRingOperationWrite)) ||
+        (Request->IoBuffer == NULL)) {
+
+        return FALSE;
+    }
+
+    switch (Request->Handle->FileObject->Properties.Type) {
+    case IoObjectPipe:
+    case IoObjectSocket:
+    case IoObjectTerminalMaster:
+    case IoObjectTerminalSlave:
+        return TRUE;
+
+    default:
+        break;
+    }
+
+    return FALSE;
+}
+
+KSTATUS
+IopAttemptIoRingRequest (
+    PIO_RING_REQUEST Request,
+    PULONG Events
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes one non-blocking attempt at a readiness based I/O ring
+    request. Writes that only partially complete advance the request's I/O
+    buffer so the next attempt picks up where this one left off.
+
+Arguments:
+
+    Request - Supplies a pointer to the I/O ring request.
+
+    Events - Supplies a pointer where the returned poll events will be
+        returned.
+
+Return Value:
+
+    STATUS_TRY_AGAIN if the target was not ready and the request should wait.
+
+    Other status codes if the request is finished.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    ULONG Flags;
+    PIO_OBJECT_STATE IoState;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+
+    *Events = 0;
+    Submission = &(Request->Submission);
+    BytesCompleted = 0;
+    switch (Submission->Operation) {
+    case IoRingOperationRead:
+        Status = IoReadAtOffset(Request->Handle,
+                                Request->IoBuffer,
+                                Submission->Offset,
+                                Submission->Size,
+                                0,
+                                0,
+                                &BytesCompleted,
+                                NULL);
+
+        Request->BytesCompleted = BytesCompleted;
+        break;
+
+    case IoRingOperationWrite:
+        Flags = 0;
+        if ((Submission->Flags & IO_RING_SUBMISSION_FLAG_DATA_SYNCHRONIZED) !=
+            0) {
+
+            Flags |= IO_FLAG_DATA_SYNCHRONIZED;
+        }
+
+        Status = IoWriteAtOffset(Request->Handle,
+                                 Request->IoBuffer,
+                                 Submission->Offset,
+                                 Submission->Size - Request->BytesCompleted,
+                                 Flags,
+                                 0,
+                                 &BytesCompleted,
+                                 NULL);
+
+        if (BytesCompleted != 0) {
+            Request->BytesCompleted += BytesCompleted;
+            MmIoBufferIncrementOffset(Request->IoBuffer, BytesCompleted);
+        }
+
+        //
+        // Keep going until the whole buffer is written, like a blocking write
+        // would.
+        //
+
+        if ((KSUCCESS(Status)) &&
+            (BytesCompleted != 0) &&
+            (Request->BytesCompleted < Submission->Size)) {
+
+            Status = STATUS_TRY_AGAIN;
+        }
+
+        break;
+
+    //
+    // Objects without I/O state (regular files) are always ready.
+    //
+
+    case IoRingOperationPoll:
+        IoState = Request->Handle->FileObject->IoState;
+        if (IoState == NULL) {
+            *Events = Submission->Events & (POLL_EVENT_IN | POLL_EVENT_OUT);
+            return STATUS_SUCCESS;
+        }
+
+        *Events = IoState->Events &
+                  (Submission->Events | POLL_NONMASKABLE_EVENTS);
+
+        if (*Events == 0) {
+            return STATUS_TRY_AGAIN;
+        }
+
+        return STATUS_SUCCESS;
+
+    default:
+
+        ASSERT(FALSE);
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    // A read that got some data is done. Anything else that was turned away
+    // for lack of readiness has to wait.
+    //
+
+    if ((Status == STATUS_TIMEOUT) ||
+        (Status == STATUS_OPERATION_WOULD_BLOCK) ||
+        (Status == STATUS_TRY_AGAIN)) {
+
+        Status = STATUS_TRY_AGAIN;
+        if ((Submission->Operation == IoRingOperationRead) &&
+            (Request->BytesCompleted != 0)) {
+
+            Status = STATUS_SUCCESS;
+        }
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopWaitForIoRingRequest (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits until the target of a readiness based I/O ring request
+    signals the events the request needs, the request's timeout expires, or
+    the ring is closed.
+
+Arguments:
+
+    Request - Supplies a pointer to the I/O ring request.
+
+Return Value:
+
+    STATUS_SUCCESS if the target may be ready and the request should be
+    attempted again.
+
+    STATUS_TIMEOUT if the request's timeout expired.
+
+    STATUS_OPERATION_CANCELLED if the ring was closed.
+
+    Other error codes on failure.
+
+--*/
+
+{
+
+    ULONGLONG CurrentTime;
+    ULONG Events;
+    PIO_OBJECT_STATE IoState;
+    PIO_RING Ring;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+    PVOID WaitObjectArray[6];
+    ULONG WaitObjectCount;
+    ULONG WaitTime;
+
+    Ring = Request->Ring;
+    Submission = &(Request->Submission);
+    IoState = Request->Handle->FileObject->IoState;
+
+    ASSERT(IoState != NULL);
+
+    switch (Submission->Operation) {
+    case IoRingOperationRead:
+        Events = POLL_EVENT_IN;
+        break;
+
+    case IoRingOperationWrite:
+        Events = POLL_EVENT_OUT;
+        break;
+
+    default:
+        Events = Submission->Events;
+        break;
+    }
+
+    //
+    // Always wait on the ring being closed and on the error state.
+    //
+
+    WaitObjectArray[0] = Ring->CancelEvent;
+    WaitObjectArray[1] = IoState->ErrorEvent;
+    WaitObjectCount = 2;
+    if ((Events & POLL_EVENT_IN) != 0) {
+        WaitObjectArray[WaitObjectCount] = IoState->ReadEvent;
+        WaitObjectCount += 1;
+    }
+
+    if ((Events & POLL_EVENT_IN_HIGH_PRIORITY) != 0) {
+        if (IoState->ReadHighPriorityEvent == NULL) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        WaitObjectArray[WaitObjectCount] = IoState->ReadHighPriorityEvent;
+        WaitObjectCount += 1;
+    }
+
+    if ((Events & POLL_EVENT_OUT) != 0) {
+        WaitObjectArray[WaitObjectCount] = IoState->WriteEvent;
+        WaitObjectCount += 1;
+    }
+
+    if ((Events & POLL_EVENT_OUT_HIGH_PRIORITY) != 0) {
+        if (IoState->WriteHighPriorityEvent == NULL) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        WaitObjectArray[WaitObjectCount] = IoState->WriteHighPriorityEvent;
+        WaitObjectCount += 1;
+    }
+
+    WaitTime = WAIT_TIME_INDEFINITE;
+    if (Submission->TimeoutInMilliseconds != WAIT_TIME_INDEFINITE) {
+        CurrentTime = KeGetRecentTimeCounter();
+        if (CurrentTime >= Request->EndTime) {
+            return STATUS_TIMEOUT;
+        }
+
+        WaitTime = (Request->EndTime - CurrentTime) * MILLISECONDS_PER_SECOND /
+                   HlQueryTimeCounterFrequency();
+    }
+
+    Status = ObWaitOnObjects(WaitObjectArray,
+                             WaitObjectCount,
+                             0,
+                             WaitTime,
+                             NULL,
+                             NULL);
+
+    if (Ring->Closed != FALSE) {
+        Status = STATUS_OPERATION_CANCELLED;
+    }
+
+    return Status;
+}
+
+VOID
+IopCompleteIoRingRequest (
+    PIO_RING_REQUEST Request,
+    KSTATUS Status,
+    UINTN BytesCompleted,
+    ULONG Events
+    )
+
+/*++
+
+Routine Description:
+
+    This routine posts the completion for an I/O ring request and destroys
+    the request.
+
+Arguments:
+
+    Request - Supplies a pointer to the request to complete.
+
+    Status - Supplies the final status of the request.
+
+    BytesCompleted - Supplies the number of bytes transferred.
+
+    Events - Supplies the returned poll events.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING Ring;
+
+    Ring = Request->Ring;
+    IopPostIoRingCompletion(Ring,
+                            Request->Submission.UserData,
+                            Status,
+                            BytesCompleted,
+                            Events);
+
+    if (Request->IoBuffer != NULL) {
+        MmFreeIoBuffer(Request->IoBuffer);
+    }
+
+    if (Request->Handle != NULL) {
+        IoIoHandleReleaseReference(Request->Handle);
+    }
+
+    //
+    // Release the ring last, as this may be what tears it down.
+    //
+
+    IopFileObjectReleaseReference(Request->RingFileObject);
+    MmFreePagedPool(Request);
+    return;
+}
+
+VOID
+IopPostIoRingCompletion (
+    PIO_RING Ring,
+    ULONGLONG UserData,
+    KSTATUS Status,
+    UINTN BytesCompleted,
+    ULONG Events
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes a completion entry into an I/O ring and retires one
+    in-flight request.
+
+Arguments:
+
+    Ring - Supplies a pointer to the I/O ring.
+
+    UserData - Supplies the user data value from the submission.
+
+    Status - Supplies the final status of the request.
+
+    BytesCompleted - Supplies the number of bytes transferred.
+
+    Events - Supplies the returned poll events.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_COMPLETION Completion;
+
+    KeAcquireQueuedLock(Ring->Lock);
+
+    ASSERT(Ring->InFlightCount != 0);
+
+    Completion = &(Ring->Completions[Ring->CompleteTail &
+                                     (Ring->CompleteEntryCount - 1)]);
+
+    Completion->UserData = UserData;
+    Completion->BytesCompleted = BytesCompleted;
+    Completion->Status = Status;
+    Completion->Events = Events;
+
+    //
+    // Make sure the entry is visible before the new tail is.
+    //
+
+    RtlMemoryBarrier();
+    Ring->CompleteTail += 1;
+    Ring->SharedHeader->CompleteTail = Ring->CompleteTail;
+    Ring->InFlightCount -= 1;
+    IoSetIoObjectState(Ring->IoState, POLL_EVENT_IN, TRUE);
+    KeReleaseQueuedLock(Ring->Lock);
+    return;
+}
+
+KSTATUS
+IopLockIoRingBuffer (
+    PVOID Buffer,
+    UINTN Size,
+    PIO_BUFFER *IoBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates an I/O buffer for a region of the current process'
+    user mode address space and locks its pages in memory. The resulting I/O
+    buffer does not depend on the process' address space and can be used
+    from any thread.
+
+Arguments:
+
+    Buffer - Supplies the user mode buffer.
+
+    Size - Supplies the size of the buffer in bytes.
+
+    IoBuffer - Supplies a pointer where a pointer to the locked I/O buffer
+        will be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    BOOL LockedCopy;
+    PIO_BUFFER LockedIoBuffer;
+    KSTATUS Status;
+    PIO_BUFFER UserIoBuffer;
+
+    *IoBuffer = NULL;
+    Status = MmCreateIoBuffer(Buffer, Size, 0, &UserIoBuffer);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    LockedIoBuffer = UserIoBuffer;
+    Status = MmValidateIoBuffer(0,
+                                MAX_ULONGLONG,
+                                1,
+                                Size,
+                                FALSE,
+                                &LockedIoBuffer,
+                                &LockedCopy);
+
+    if (KSUCCESS(Status)) {
+
+        //
+        // Anything other than a locked copy of the same pages would not share
+        // data with user mode.
+        //
+
+        if ((LockedIoBuffer != UserIoBuffer) && (LockedCopy == FALSE)) {
+            MmFreeIoBuffer(LockedIoBuffer);
+            Status = STATUS_INVALID_PARAMETER;
+
+        } else {
+            *IoBuffer = LockedIoBuffer;
+        }
+    }
+
+    if (*IoBuffer != UserIoBuffer) {
+        MmFreeIoBuffer(UserIoBuffer);
+    }
+
+    return Status;
+}
+
@@ -0,0 +1,495 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    iotrace.c
+
+Abstract:
+
+    This module implements block-level I/O tracing. While enabled, every read
+    and write IRP sent to a device is recorded in a ring buffer with its
+    device, offset, size, direction, and issue and completion times. Tools
+    drain the ring through the I/O trace information type to capture
+    workloads that can be replayed later.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define IO_TRACE_ALLOCATION_TAG 0x63725449 // 'crTI'
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines the I/O trace ring buffer.
+
+Members:
+
+    NextSequence - Stores the sequence number the next record will get.
+        Writers claim a slot by atomically incrementing this.
+
+    Mask - Stores the capacity of the ring minus one. The capacity is always a
+        power of two.
+
+    Records - Stores the ring of records. A record's sequence number is zero
+        while it is being written, and its final sequence number once it is
+        complete, which lets readers detect records that are not yet written
+        or that were overwritten while being copied.
+
+--*/
+
+typedef struct _IO_TRACE_BUFFER {
+    volatile ULONGLONG NextSequence;
+    ULONGLONG Mask;
+    IO_TRACE_RECORD Records[ANYSIZE_ARRAY];
+} IO_TRACE_BUFFER, *PIO_TRACE_BUFFER;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+IopSetIoTraceCapacity (
+    ULONG Capacity
+    );
+
+KSTATUS
+IopReadIoTrace (
+    PIO_TRACE_INFORMATION Information,
+    UINTN DataSize
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store a pointer to the active trace buffer, or NULL if tracing is off.
+//
+
+PIO_TRACE_BUFFER volatile IoTraceBuffer;
+
+//
+// Store the number of threads currently writing a record. The buffer is not
+// freed until this drops to zero.
+//
+
+volatile ULONG IoTraceWriters;
+
+//
+// Store the lock that serializes enabling, disabling and reading the trace.
+//
+
+PQUEUED_LOCK IoTraceLock;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+IopInitializeIoTraceSupport (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called during system initialization to set up support for
+    I/O tracing. Tracing starts disabled.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    IoTraceLock = KeCreateQueuedLock();
+    if (IoTraceLock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopTraceDeviceIo (
+    PDEVICE Device,
+    PIRP Irp,
+    IO_OFFSET Offset,
+    UINTN Size,
+    KSTATUS Status,
+    ULONGLONG IssueTime
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records a completed read or write IRP in the I/O trace, if
+    tracing is enabled.
+
+Arguments:
+
+    Device - Supplies a pointer to the device the IRP was sent to.
+
+    Irp - Supplies a pointer to the completed I/O IRP.
+
+    Offset - Supplies the device offset of the request as it was sent. Drivers
+        in the stack may have adjusted the offset in the IRP since.
+
+    Size - Supplies the size of the request as it was sent.
+
+    Status - Supplies the completion status of the IRP.
+
+    IssueTime - Supplies the time counter value when the IRP was sent.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_TRACE_BUFFER Buffer;
+    PIO_TRACE_RECORD Record;
+    ULONGLONG Sequence;
+
+    if (IoTraceBuffer == NULL) {
+        return;
+    }
+
+    //
+    // Register as a writer before looking at the buffer again, so that it
+    // cannot be freed out from under the record.
+    //
+
+    RtlAtomicAdd32(&IoTraceWriters, 1);
+    Buffer = IoTraceBuffer;
+    if (Buffer != NULL) {
+        Sequence = RtlAtomicAdd64(&(Buffer->NextSequence), 1);
+        Record = &(Buffer->Records[Sequence & Buffer->Mask]);
+        Record->Sequence = 0;
+        RtlMemoryBarrier();
+        Record->DeviceId = Device->DeviceId;
+        Record->Offset = Offset;
+        Record->Size = Size;
+        Record->BytesCompleted = Irp->U.ReadWrite.IoBytesCompleted;
+        Record->IssueTime = IssueTime;
+        Record->CompleteTime = HlQueryTimeCounter();
+        Record->Flags = 0;
+        if (Irp->MinorCode == IrpMinorIoWrite) {
+            Record->Flags |= IO_TRACE_RECORD_FLAG_WRITE;
+        }
+
+        Record->Status = Status;
+        RtlMemoryBarrier();
+        Record->Sequence = Sequence;
+    }
+
+    RtlAtomicAdd32(&IoTraceWriters, -1);
+    return;
+}
+
+KSTATUS
+IopGetSetIoTrace (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine enables, disables or reads the I/O trace.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PIO_TRACE_INFORMATION Information;
+    KSTATUS Status;
+
+    if (*DataSize < sizeof(IO_TRACE_INFORMATION)) {
+        *DataSize = sizeof(IO_TRACE_INFORMATION);
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    Information = Data;
+    if (Information->Version < IO_TRACE_INFORMATION_VERSION) {
+        *DataSize = 0;
+        return STATUS_VERSION_MISMATCH;
+    }
+
+    if (Set != FALSE) {
+        *DataSize = sizeof(IO_TRACE_INFORMATION);
+        Status = PsCheckPermission(PERMISSION_SYSTEM_ADMINISTRATOR);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
+    KeAcquireQueuedLock(IoTraceLock);
+    if (Set != FALSE) {
+        Status = IopSetIoTraceCapacity(Information->Capacity);
+        Information->RecordCount = 0;
+        Information->NextSequence = 1;
+        Information->LostRecords = 0;
+
+    } else {
+        Status = IopReadIoTrace(Information, *DataSize);
+        *DataSize = sizeof(IO_TRACE_INFORMATION) +
+                    (Information->RecordCount * sizeof(IO_TRACE_RECORD));
+    }
+
+    Information->Flags = 0;
+    Information->Capacity = 0;
+    if (IoTraceBuffer != NULL) {
+        Information->Flags |= IO_TRACE_FLAG_ENABLED;
+        Information->Capacity = IoTraceBuffer->Mask + 1;
+    }
+
+    Information->TimeCounterFrequency = HlQueryTimeCounterFrequency();
+    KeReleaseQueuedLock(IoTraceLock);
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+IopSetIoTraceCapacity (
+    ULONG Capacity
+    )
+
+/*++
+
+Routine Description:
+
+    This routine replaces the I/O trace buffer, discarding any records in the
+    old one. The caller must hold the trace lock.
+
+Arguments:
+
+    Capacity - Supplies the number of records the new buffer should hold, or
+        zero to stop tracing.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    PIO_TRACE_BUFFER NewBuffer;
+    PIO_TRACE_BUFFER OldBuffer;
+    ULONG RoundedCapacity;
+
+    NewBuffer = NULL;
+    if (Capacity != 0) {
+        if (Capacity > IO_TRACE_MAX_CAPACITY) {
+            Capacity = IO_TRACE_MAX_CAPACITY;
+        }
+
+        RoundedCapacity = 1;
+        while (RoundedCapacity < Capacity) {
+            RoundedCapacity <<= 1;
+        }
+
+        //
+        // Records are written on the paging path, so keep them in non-paged
+        // pool.
+        //
+
+        AllocationSize = sizeof(IO_TRACE_BUFFER) +
+                         ((RoundedCapacity - ANYSIZE_ARRAY) *
+                          sizeof(IO_TRACE_RECORD));
+
+        NewBuffer = MmAllocateNonPagedPool(AllocationSize,
+                                           IO_TRACE_ALLOCATION_TAG);
+
+        if (NewBuffer == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(NewBuffer, AllocationSize);
+        NewBuffer->NextSequence = 1;
+        NewBuffer->Mask = RoundedCapacity - 1;
+    }
+
+    //
+    // Swap in the new buffer, then wait for anyone still writing into the old
+    // one to finish before freeing it.
+    //
+
+    OldBuffer = IoTraceBuffer;
+    IoTraceBuffer = NewBuffer;
+    RtlMemoryBarrier();
+    if (OldBuffer != NULL) {
+        while (IoTraceWriters != 0) {
+            KeYield();
+        }
+
+        MmFreeNonPagedPool(OldBuffer);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IopReadIoTrace (
+    PIO_TRACE_INFORMATION Information,
+    UINTN DataSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies records out of the I/O trace buffer. The caller must
+    hold the trace lock.
+
+Arguments:
+
+    Information - Supplies a pointer to the trace information, which is
+        followed by space for the records. On input, the next sequence member
+        holds the first record wanted. On output, the record count, next
+        sequence and lost records members are filled in.
+
+    DataSize - Supplies the size of the information buffer in bytes.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PIO_TRACE_BUFFER Buffer;
+    ULONGLONG Capacity;
+    PIO_TRACE_RECORD Destination;
+    ULONGLONG Lost;
+    UINTN MaxRecords;
+    ULONGLONG NextSequence;
+    ULONGLONG Oldest;
+    UINTN RecordCount;
+    ULONGLONG Sequence;
+    PIO_TRACE_RECORD Source;
+
+    Lost = 0;
+    RecordCount = 0;
+    Sequence = Information->NextSequence;
+    Buffer = IoTraceBuffer;
+    if (Buffer == NULL) {
+        goto ReadIoTraceEnd;
+    }
+
+    Capacity = Buffer->Mask + 1;
+    MaxRecords = (DataSize - sizeof(IO_TRACE_INFORMATION)) /
+                 sizeof(IO_TRACE_RECORD);
+
+    Destination = (PIO_TRACE_RECORD)(Information + 1);
+    NextSequence = RtlAtomicOr64(&(Buffer->NextSequence), 0);
+    Oldest = 1;
+    if (NextSequence > Capacity) {
+        Oldest = NextSequence - Capacity;
+    }
+
+    if ((Sequence == 0) || (Sequence > NextSequence)) {
+        Sequence = Oldest;
+
+    } else if (Sequence < Oldest) {
+        Lost += Oldest - Sequence;
+        Sequence = Oldest;
+    }
+
+    while ((Sequence < NextSequence) && (RecordCount < MaxRecords)) {
+        Source = &(Buffer->Records[Sequence & Buffer->Mask]);
+
+        //
+        // Stop at a record still being written. Skip a record that was
+        // overwritten by a newer one, either before or during the copy.
+        //
+
+        if (Source->Sequence < Sequence) {
+            break;
+        }
+
+        RtlCopyMemory(Destination, Source, sizeof(IO_TRACE_RECORD));
+        RtlMemoryBarrier();
+        if ((Destination->Sequence != Sequence) ||
+            (Source->Sequence != Sequence)) {
+
+            Lost += 1;
+
+        } else {
+            Destination += 1;
+            RecordCount += 1;
+        }
+
+        Sequence += 1;
+    }
+
+ReadIoTraceEnd:
+    Information->RecordCount = RecordCount;
+    Information->NextSequence = Sequence;
+    Information->LostRecords = Lost;
+    return STATUS_SUCCESS;
+}
+
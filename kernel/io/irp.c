@@ -98,6 +98,17 @@ Structure Description:
     Flags - Stores a set of informational flags about the IRP. See IRP_*
         definitions.
 
+    IoStatistics - Stores a pointer to the device statistics a read or write
+        IRP was counted against when it was sent, if any.
+
+    IoStartTime - Stores the time counter value when a read or write IRP was
+        sent.
+
+    IoOffset - Stores the device offset of a read or write IRP when it was
+        sent, as drivers in the stack may change the offset on the way down.
+
+    IoSize - Stores the size of a read or write IRP when it was sent.
+
 --*/
 
 typedef struct _IRP_INTERNAL {
@@ -109,6 +120,10 @@ typedef struct _IRP_INTERNAL {
     ULONG StackIndex;
     ULONG StackSize;
     ULONG Flags;
+    PDEVICE_IO_STATISTICS IoStatistics;
+    ULONGLONG IoStartTime;
+    IO_OFFSET IoOffset;
+    UINTN IoSize;
 } IRP_INTERNAL, *PIRP_INTERNAL;
 
 //
@@ -130,6 +145,16 @@ IopAdvanceIrpStackLocation (
     PIRP_INTERNAL Irp
     );
 
+VOID
+IopStartIrpIo (
+    PIRP_INTERNAL Irp
+    );
+
+VOID
+IopEndIrpIo (
+    PIRP_INTERNAL Irp
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -265,6 +290,16 @@ Return Value:
         Irp->Direction = IrpUp;
         Irp->Status = StatusCode;
 
+        //
+        // Record the completion of device reads and writes here, where the
+        // device finished them, rather than when the sender gets around to
+        // noticing.
+        //
+
+        if ((InternalIrp->Flags & IRP_IO_ACCOUNTED) != 0) {
+            IopEndIrpIo(InternalIrp);
+        }
+
         //
         // If the IRP is pending, nothing else is driving it. Signal the IRP to
         // wake the sending thread to continue driving the IRP. Do not clear
@@ -826,6 +861,14 @@ Return Value:
 
     Status = STATUS_SUCCESS;
     InternalIrp->Flags |= IRP_ACTIVE;
+    if ((Irp->MajorCode == IrpMajorIo) &&
+        ((Irp->MinorCode == IrpMinorIoRead) ||
+         (Irp->MinorCode == IrpMinorIoWrite)) &&
+        (Irp->Device->Header.Type == ObjectDevice)) {
+
+        IopStartIrpIo(InternalIrp);
+    }
+
     while (TRUE) {
         ObSignalObject(Irp, SignalOptionUnsignal);
         IrpDone = IopPumpIrpThroughStack(InternalIrp);
@@ -848,6 +891,14 @@ Return Value:
         InternalIrp->Flags &= ~IRP_PENDING;
     }
 
+    //
+    // If no driver completed the IRP, record it now that it is back.
+    //
+
+    if ((InternalIrp->Flags & IRP_IO_ACCOUNTED) != 0) {
+        IopEndIrpIo(InternalIrp);
+    }
+
     InternalIrp->Flags &= ~IRP_ACTIVE;
 
 SendSynchronousIrpEnd:
@@ -1942,3 +1993,85 @@ Return Value:
     return FALSE;
 }
 
+VOID
+IopStartIrpIo (
+    PIRP_INTERNAL Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records a read or write IRP being sent to a device in the
+    device's I/O statistics.
+
+Arguments:
+
+    Irp - Supplies a pointer to the IRP being sent.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT((Irp->Flags & IRP_IO_ACCOUNTED) == 0);
+
+    Irp->IoOffset = Irp->Public.U.ReadWrite.IoOffset;
+    Irp->IoSize = Irp->Public.U.ReadWrite.IoSizeInBytes;
+    Irp->IoStatistics = IopStartDeviceIo(Irp->Device, &(Irp->IoStartTime));
+    Irp->Flags |= IRP_IO_ACCOUNTED;
+    return;
+}
+
+VOID
+IopEndIrpIo (
+    PIRP_INTERNAL Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records the completion of a read or write IRP in the device's
+    I/O statistics and in the I/O trace. This may run at dispatch level.
+
+Arguments:
+
+    Irp - Supplies a pointer to the completed IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIRP_READ_WRITE ReadWrite;
+
+    ASSERT((Irp->Flags & IRP_IO_ACCOUNTED) != 0);
+
+    Irp->Flags &= ~IRP_IO_ACCOUNTED;
+    ReadWrite = &(Irp->Public.U.ReadWrite);
+    if (Irp->IoStatistics != NULL) {
+        IopEndDeviceIo(Irp->IoStatistics,
+                       (Irp->Public.MinorCode == IrpMinorIoWrite),
+                       ReadWrite->IoBytesCompleted,
+                       Irp->IoStartTime);
+
+        Irp->IoStatistics = NULL;
+    }
+
+    IopTraceDeviceIo(Irp->Device,
+                     &(Irp->Public),
+                     Irp->IoOffset,
+                     Irp->IoSize,
+                     Irp->Public.Status,
+                     Irp->IoStartTime);
+
+    return;
+}
+
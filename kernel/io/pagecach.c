@@ -124,6 +124,13 @@ Module Name:
 
 #define PAGE_CACHE_ENTRY_FLAG_HARD_FLUSH_REQUESTED 0x00000040
 
+//
+// Set this flag if the page cache entry is in its file object's page cache
+// index. This is changed with the page cache list lock held.
+//
+
+#define PAGE_CACHE_ENTRY_FLAG_INDEXED 0x00000080
+
 //
 // If any of the dirty mask bits are set, then the page cache entry needs to
 // be cleaned and flushed.
@@ -157,6 +164,13 @@ Module Name:
 
 #define PAGE_CACHE_FLUSH_MAX_CLEAN_STREAK 4
 
+//
+// Define the number of entries gathered from a file object's page cache index
+// at a time when evicting.
+//
+
+#define PAGE_CACHE_EVICT_BATCH_SIZE 32
+
 //
 // Define the block expansion count for the page cache entry block allocator.
 //
@@ -207,6 +221,13 @@ Module Name:
      (_IoObjectType == IoObjectSharedMemoryObject) || \
      (_IoObjectType == IoObjectBlockDevice))
 
+//
+// This macro returns the page cache index key for the given file or device
+// offset.
+//
+
+#define PAGE_CACHE_INDEX_KEY(_Offset) ((ULONGLONG)(_Offset) >> MmPageShift())
+
 //
 // This macro determines whether or not a hard flush is required based on the
 // given page cache entry flags.
@@ -244,9 +265,6 @@ Structure Description:
 
 Members:
 
-    Node - Stores the Red-Black tree node information for this page cache
-        entry.
-
     ListEntry - Stores this page cache entry's list entry in an LRU list, local
         list, or dirty list. This list entry is protected by the global page
         cache list lock.
@@ -273,7 +291,6 @@ Structure Description:
 --*/
 
 struct _PAGE_CACHE_ENTRY {
-    RED_BLACK_TREE_NODE Node;
     LIST_ENTRY ListEntry;
     PFILE_OBJECT FileObject;
     IO_OFFSET Offset;
@@ -306,7 +323,7 @@ IopDestroyPageCacheEntry (
     PPAGE_CACHE_ENTRY Entry
     );
 
-VOID
+KSTATUS
 IopInsertPageCacheEntry (
     PPAGE_CACHE_ENTRY NewEntry,
     PPAGE_CACHE_ENTRY LinkEntry
@@ -318,6 +335,13 @@ IopLookupPageCacheEntryHelper (
     IO_OFFSET Offset
     );
 
+PPAGE_CACHE_ENTRY
+IopGetNextPageCacheEntry (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset,
+    BOOL DirtyOnly
+    );
+
 VOID
 IopPageCacheThread (
     PVOID Parameter
@@ -368,7 +392,7 @@ IopRemovePageCacheEntryVirtualAddress (
     );
 
 VOID
-IopRemovePageCacheEntryFromTree (
+IopRemovePageCacheEntryFromIndex (
     PPAGE_CACHE_ENTRY Entry
     );
 
@@ -466,8 +490,8 @@ UINTN IoPageCacheLowMemoryCleanPageMinimum = 0;
 
 //
 // The physical page count tracks the current number of physical pages in use
-// by the cache. This includes pages that are active in the tree and pages that
-// are not in the tree, awaiting destruction.
+// by the cache. This includes pages that are active in the index and pages
+// that are not in the index, awaiting destruction.
 //
 
 volatile UINTN IoPageCachePhysicalPageCount = 0;
@@ -1008,6 +1032,19 @@ Return Value:
             INSERT_BEFORE(&(DirtyEntry->ListEntry),
                           &(DirtyEntry->FileObject->DirtyPageList));
 
+            //
+            // Tag the entry in the index too, so that flushes walking the
+            // index for dirty entries find it. The list lock synchronizes
+            // this with removal from the index.
+            //
+
+            if ((DirtyEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0) {
+                IopSetPageCacheIndexTag(
+                                &(DirtyEntry->FileObject->PageCacheIndex),
+                                PAGE_CACHE_INDEX_KEY(DirtyEntry->Offset),
+                                PageCacheIndexTagDirty);
+            }
+
             MarkDirty = TRUE;
         }
 
@@ -1093,6 +1130,15 @@ Return Value:
     }
 
     IoPageCacheBlockAllocator = BlockAllocator;
+    Status = IopInitializePageCacheIndexAllocator();
+    if (!KSUCCESS(Status)) {
+        goto InitializePageCacheEnd;
+    }
+
+    Status = IopInitializeWriteback();
+    if (!KSUCCESS(Status)) {
+        goto InitializePageCacheEnd;
+    }
 
     //
     // Determine an appropriate limit on the size of the page cache based on
@@ -1223,6 +1269,8 @@ Return Value:
             MmDestroyBlockAllocator(IoPageCacheBlockAllocator);
             IoPageCacheBlockAllocator = NULL;
         }
+
+        IopDestroyPageCacheIndexAllocator();
     }
 
     return Status;
@@ -1289,6 +1337,96 @@ Return Value:
     return FoundEntry;
 }
 
+ULONG
+IopLookupPageCacheEntries (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset,
+    ULONG PageCount,
+    PPAGE_CACHE_ENTRY *Entries
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up the page cache entries for a run of consecutive
+    pages with a single walk of the file object's page cache index. A
+    reference is taken on each entry found.
+
+Arguments:
+
+    FileObject - Supplies a pointer to a file object for the device or file.
+
+    Offset - Supplies the page aligned offset of the first page.
+
+    PageCount - Supplies the number of pages to look up.
+
+    Entries - Supplies an array of PageCount elements. Each element receives
+        the entry for the corresponding page, or NULL if that page is not in
+        the cache.
+
+Return Value:
+
+    Returns the number of entries found.
+
+--*/
+
+{
+
+    PPAGE_CACHE_ENTRY Entry;
+    ULONGLONG FirstKey;
+    ULONG Found;
+    ULONG Index;
+    ULONG Position;
+
+    ASSERT(KeIsSharedExclusiveLockHeld(FileObject->Lock));
+    ASSERT(IS_ALIGNED(Offset, MmPageSize()) != FALSE);
+    ASSERT(PageCount != 0);
+
+    FirstKey = PAGE_CACHE_INDEX_KEY(Offset);
+    Found = IopGatherPageCacheIndexEntries(&(FileObject->PageCacheIndex),
+                                           FirstKey,
+                                           FirstKey + PageCount - 1,
+                                           PAGE_CACHE_INDEX_NO_TAG,
+                                           (PVOID *)Entries,
+                                           PageCount);
+
+    //
+    // The entries come back packed at the front of the array in page order.
+    // Spread them out to their positions, working backwards so that nothing
+    // is overwritten before it is moved.
+    //
+
+    for (Index = Found; Index < PageCount; Index += 1) {
+        Entries[Index] = NULL;
+    }
+
+    Index = Found;
+    while (Index != 0) {
+        Index -= 1;
+        Entry = Entries[Index];
+        Entries[Index] = NULL;
+        Position = (ULONG)(PAGE_CACHE_INDEX_KEY(Entry->Offset) - FirstKey);
+
+        ASSERT((Position >= Index) && (Position < PageCount));
+
+        Entries[Position] = Entry;
+        IoPageCacheEntryAddReference(Entry);
+        IopUpdatePageCacheEntryList(Entry, FALSE);
+    }
+
+    if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_LOOKUP) != 0) {
+        RtlDebugPrint("PAGE CACHE: Lookup for file object (0x%08x) at "
+                      "offset 0x%I64x found %d of %d pages.\n",
+                      FileObject,
+                      Offset,
+                      Found,
+                      PageCount);
+    }
+
+    return Found;
+}
+
 PPAGE_CACHE_ENTRY
 IopCreateOrLookupPageCacheEntry (
     PFILE_OBJECT FileObject,
@@ -1337,6 +1475,7 @@ Return Value:
 
     BOOL Created;
     PPAGE_CACHE_ENTRY NewEntry;
+    KSTATUS Status;
 
     ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock));
     ASSERT((LinkEntry == NULL) ||
@@ -1365,7 +1504,14 @@ Return Value:
         // sneak into the cache. Insert this new entry.
         //
 
-        IopInsertPageCacheEntry(NewEntry, LinkEntry);
+        Status = IopInsertPageCacheEntry(NewEntry, LinkEntry);
+        if (!KSUCCESS(Status)) {
+            NewEntry->ReferenceCount = 0;
+            IopDestroyPageCacheEntry(NewEntry);
+            NewEntry = NULL;
+            goto CreateOrLookupPageCacheEntryEnd;
+        }
+
         Created = TRUE;
     }
 
@@ -1451,6 +1597,7 @@ Return Value:
 {
 
     PPAGE_CACHE_ENTRY NewEntry;
+    KSTATUS Status;
 
     ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock) != FALSE);
     ASSERT((LinkEntry == NULL) ||
@@ -1473,9 +1620,16 @@ Return Value:
     // Insert the entry. Nothing should beat this to the punch.
     //
 
-    ASSERT(IopLookupPageCacheEntryHelper(FileObject, Offset) == NULL);
+    ASSERT(IopLookupPageCacheIndexEntry(&(FileObject->PageCacheIndex),
+                                        PAGE_CACHE_INDEX_KEY(Offset)) == NULL);
 
-    IopInsertPageCacheEntry(NewEntry, LinkEntry);
+    Status = IopInsertPageCacheEntry(NewEntry, LinkEntry);
+    if (!KSUCCESS(Status)) {
+        NewEntry->ReferenceCount = 0;
+        IopDestroyPageCacheEntry(NewEntry);
+        NewEntry = NULL;
+        goto CreateAndInsertPageCacheEntryEnd;
+    }
 
     //
     // Add the newly created page cach entry to the appropriate list.
@@ -1737,17 +1891,18 @@ Return Value:
     BOOL BytesFlushed;
     PPAGE_CACHE_ENTRY CacheEntry;
     UINTN CleanStreak;
+    BOOL DirtyOnly;
     PIO_BUFFER FlushBuffer;
     IO_OFFSET FlushNextOffset;
     UINTN FlushSize;
-    BOOL GetNextNode;
+    BOOL GetNextEntry;
     LIST_ENTRY LocalList;
-    PRED_BLACK_TREE_NODE Node;
+    PPAGE_CACHE_ENTRY NextEntry;
     BOOL PageCacheThread;
     UINTN PagesFlushed;
     ULONG PageShift;
     ULONG PageSize;
-    PAGE_CACHE_ENTRY SearchEntry;
+    IO_OFFSET SearchOffset;
     BOOL SkipEntry;
     KSTATUS Status;
     KSTATUS TotalStatus;
@@ -1827,30 +1982,40 @@ Return Value:
 
     PageSize = MmPageSize();
 
+    //
+    // Only dirty entries need to be visited unless this is a synchronized
+    // flush of a file, where clean entries may sit on top of dirty block
+    // device entries. When possible, walk the index's dirty tags to skip
+    // over runs of clean entries.
+    //
+
+    DirtyOnly = FALSE;
+    if (((Flags & IO_FLAG_DATA_SYNCHRONIZED) == 0) ||
+        (IO_IS_CACHEABLE_FILE(FileObject->Properties.Type) == FALSE)) {
+
+        DirtyOnly = TRUE;
+    }
+
     //
     // Determine which page cache entry the flush should start on.
     //
 
-    SearchEntry.FileObject = FileObject;
     FlushNextOffset = Offset;
     FlushSize = 0;
     CleanStreak = 0;
-    SearchEntry.Offset = Offset;
-    SearchEntry.Flags = 0;
-    Node = NULL;
+    NextEntry = NULL;
+    SearchOffset = Offset;
 
     //
     // Loop over page cache entries. For non-synchronized flush-all operations,
     // iteration grabs the first entry in the dirty list, then iterates using
-    // the tree to maximize contiguous runs. Starting from the list avoids
-    // chewing up CPU time scanning through the tree. For explicit flush
-    // operations of a specific region, iterate using only the tree.
+    // the index to maximize contiguous runs. Starting from the list avoids
+    // chewing up CPU time scanning through the index. For explicit flush
+    // operations of a specific region, iterate using only the index.
     //
 
     if (UseDirtyPageList == FALSE) {
-        Node = RtlRedBlackTreeSearchClosest(&(FileObject->PageCacheTree),
-                                            &(SearchEntry.Node),
-                                            TRUE);
+        NextEntry = IopGetNextPageCacheEntry(FileObject, Offset, DirtyOnly);
 
     //
     // Move all dirty entries over to a local list to avoid processing them
@@ -1868,42 +2033,58 @@ Return Value:
     }
 
     //
-    // Either the first node was selected, or the node will be taken from the
-    // list. Don't move to the next node.
+    // Either the first entry was selected, or the entry will be taken from the
+    // list. Don't move to the next entry.
     //
 
-    GetNextNode = FALSE;
+    GetNextEntry = FALSE;
     while (TRUE) {
 
         //
-        // Get the next greatest node in the tree if necessary.
+        // Get the next greatest entry in the index if necessary. When only
+        // dirty entries are being visited, still pick up the clean entry
+        // directly after the current run, as a few of those are tolerated to
+        // batch up writes.
         //
 
-        if ((Node != NULL) && (GetNextNode != FALSE)) {
-            Node = RtlRedBlackTreeGetNextNode(&(FileObject->PageCacheTree),
-                                              FALSE,
-                                              Node);
+        if (GetNextEntry != FALSE) {
+            NextEntry = NULL;
+            if ((DirtyOnly != FALSE) &&
+                (FlushSize != 0) &&
+                (SearchOffset == FlushNextOffset) &&
+                (CleanStreak < PAGE_CACHE_FLUSH_MAX_CLEAN_STREAK)) {
+
+                NextEntry = IopLookupPageCacheIndexEntry(
+                                         &(FileObject->PageCacheIndex),
+                                         PAGE_CACHE_INDEX_KEY(FlushNextOffset));
+            }
+
+            if (NextEntry == NULL) {
+                NextEntry = IopGetNextPageCacheEntry(FileObject,
+                                                     SearchOffset,
+                                                     DirtyOnly);
+            }
         }
 
-        if ((Node == NULL) && (UseDirtyPageList != FALSE)) {
+        if ((NextEntry == NULL) && (UseDirtyPageList != FALSE)) {
             KeAcquireQueuedLock(IoPageCacheListLock);
             while (!LIST_EMPTY(&LocalList)) {
                 CacheEntry = LIST_VALUE(LocalList.Next,
                                         PAGE_CACHE_ENTRY,
                                         ListEntry);
 
-                Node = &(CacheEntry->Node);
+                NextEntry = CacheEntry;
 
                 //
-                // The node might have been pulled from the tree while the file
-                // object lock was dropped, but that routine didn't yet get
-                // far enough to pull it off the list. Do it for them.
+                // The entry might have been pulled from the index while the
+                // file object lock was dropped, but that routine didn't yet
+                // get far enough to pull it off the list. Do it for them.
                 //
 
-                if (Node->Parent == NULL) {
+                if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0) {
                     LIST_REMOVE(&(CacheEntry->ListEntry));
                     CacheEntry->ListEntry.Next = NULL;
-                    Node = NULL;
+                    NextEntry = NULL;
                     continue;
                 }
 
@@ -1917,21 +2098,22 @@ Return Value:
         // Stop if there's nothing left.
         //
 
-        if (Node == NULL) {
+        if (NextEntry == NULL) {
             break;
         }
 
-        CacheEntry = RED_BLACK_TREE_VALUE(Node, PAGE_CACHE_ENTRY, Node);
+        CacheEntry = NextEntry;
+        SearchOffset = CacheEntry->Offset + PageSize;
         if ((Size != -1ULL) && (CacheEntry->Offset >= (Offset + Size))) {
             break;
         }
 
         //
         // Determine if the current entry can be skipped and plan to iterate to
-        // the next node on the next loop.
+        // the next entry on the next loop.
         //
 
-        GetNextNode = TRUE;
+        GetNextEntry = TRUE;
         SkipEntry = FALSE;
         BackingEntry = CacheEntry->BackingEntry;
 
@@ -2000,7 +2182,8 @@ Return Value:
 
         if (SkipEntry != FALSE) {
             if (UseDirtyPageList != FALSE) {
-                Node = NULL;
+                NextEntry = NULL;
+                GetNextEntry = FALSE;
             }
 
             continue;
@@ -2083,10 +2266,12 @@ Return Value:
         //
         // If this cache entry has not been dealt with, add it to the buffer
         // now. As the flush routine may release the lock (for block devices),
-        // also check to make sure the cache entry is still in the tree.
+        // also check to make sure the cache entry is still in the index.
         //
 
-        if ((CacheEntry != NULL) && (CacheEntry->Node.Parent != NULL)) {
+        if ((CacheEntry != NULL) &&
+            ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0)) {
+
             MmIoBufferAppendPage(FlushBuffer,
                                  CacheEntry,
                                  NULL,
@@ -2100,32 +2285,22 @@ Return Value:
         //
 
         } else if (UseDirtyPageList != FALSE) {
-            Node = NULL;
+            NextEntry = NULL;
+            GetNextEntry = FALSE;
 
         //
-        // If the node was ripped out of the tree while the lock was dropped
-        // during the flush, search for the next closest node. Make sure not to
-        // get the next node on the next loop, or else this one would be
-        // skipped.
+        // If the entry was ripped out of the index while the lock was dropped
+        // during the flush, search again from its offset in case another entry
+        // took its place.
         //
 
-        } else if (Node->Parent == NULL) {
-            if (CacheEntry == NULL) {
-                CacheEntry = RED_BLACK_TREE_VALUE(Node, PAGE_CACHE_ENTRY, Node);
-            }
-
-            ASSERT(&(CacheEntry->Node) == Node);
-
-            Node = RtlRedBlackTreeSearchClosest(&(FileObject->PageCacheTree),
-                                                &(CacheEntry->Node),
-                                                TRUE);
-
-            GetNextNode = FALSE;
+        } else if (CacheEntry != NULL) {
+            SearchOffset = CacheEntry->Offset;
         }
 
         //
-        // Now that the next node has been found, release the reference taken
-        // on the next cache entry.
+        // Now that the next search offset is known, release the reference
+        // taken on the next cache entry.
         //
 
         if (CacheEntry != NULL) {
@@ -2249,6 +2424,7 @@ VOID
 IopEvictPageCacheEntries (
     PFILE_OBJECT FileObject,
     IO_OFFSET Offset,
+    ULONGLONG Size,
     ULONG Flags
     )
 
@@ -2260,7 +2436,7 @@ Routine Description:
     device, as specified by the file object. The flags specify how aggressive
     this routine should be. The file object lock must already be held
     exclusively and this routine assumes that the file object has been unmapped
-    from all image sections starting at the offset.
+    from all image sections in the range being evicted.
 
 Arguments:
 
@@ -2269,6 +2445,11 @@ Routine Description:
     Offset - Supplies the starting offset into the file or device after which
         all page cache entries should be evicted.
 
+    Size - Supplies the size, in bytes, of the region to evict. Supply a value
+        of -1 to evict from the given offset to the end of the file. Entries
+        that start within the region are evicted, so the end of the region
+        should be page aligned.
+
     Flags - Supplies a bitmask of eviction flags. See EVICTION_FLAG_* for
         definitions.
 
@@ -2281,13 +2462,16 @@ Return Value:
 {
 
     PPAGE_CACHE_ENTRY CacheEntry;
+    ULONG Count;
     BOOL Destroyed;
     LIST_ENTRY DestroyListHead;
-    PRED_BLACK_TREE_NODE Node;
-    PAGE_CACHE_ENTRY SearchEntry;
+    PPAGE_CACHE_ENTRY Entries[PAGE_CACHE_EVICT_BATCH_SIZE];
+    ULONGLONG FirstKey;
+    ULONG Index;
+    ULONGLONG LastKey;
 
     //
-    // The tree is being modified, so the file object lock must be held
+    // The index is being modified, so the file object lock must be held
     // exclusively.
     //
 
@@ -2312,33 +2496,52 @@ Return Value:
     // Quickly exit if there is nothing to evict.
     //
 
-    if (RED_BLACK_TREE_EMPTY(&(FileObject->PageCacheTree)) != FALSE) {
+    if (PAGE_CACHE_INDEX_EMPTY(&(FileObject->PageCacheIndex)) != FALSE) {
         return;
     }
 
-    //
-    // Iterate over the file object's tree of page cache entries.
-    //
-
     INITIALIZE_LIST_HEAD(&DestroyListHead);
 
     //
-    // Find the page cache entry in the file object's tree that is closest (but
-    // greater than or equal) to the given eviction offset.
+    // Gather batches of the entries at or after the first page that starts at
+    // or beyond the eviction offset. Every entry gathered is removed from the
+    // index, so each batch starts from the same key.
     //
 
-    SearchEntry.FileObject = FileObject;
-    SearchEntry.Offset = Offset;
-    SearchEntry.Flags = 0;
-    Node = RtlRedBlackTreeSearchClosest(&(FileObject->PageCacheTree),
-                                        &(SearchEntry.Node),
-                                        TRUE);
+    FirstKey = PAGE_CACHE_INDEX_KEY(ALIGN_RANGE_UP(Offset, MmPageSize()));
+    LastKey = MAX_ULONGLONG;
+    if (Size != -1ULL) {
+        if (Size == 0) {
+            return;
+        }
+
+        LastKey = PAGE_CACHE_INDEX_KEY(Offset + Size - 1);
+        if (LastKey < FirstKey) {
+            return;
+        }
+    }
+
+    Index = 0;
+    Count = 0;
+    while (TRUE) {
+        if (Index == Count) {
+            Count = IopGatherPageCacheIndexEntries(
+                                              &(FileObject->PageCacheIndex),
+                                              FirstKey,
+                                              LastKey,
+                                              PAGE_CACHE_INDEX_NO_TAG,
+                                              (PVOID *)Entries,
+                                              PAGE_CACHE_EVICT_BATCH_SIZE);
+
+            if (Count == 0) {
+                break;
+            }
+
+            Index = 0;
+        }
 
-    while (Node != NULL) {
-        CacheEntry = LIST_VALUE(Node, PAGE_CACHE_ENTRY, Node);
-        Node = RtlRedBlackTreeGetNextNode(&(FileObject->PageCacheTree),
-                                          FALSE,
-                                          Node);
+        CacheEntry = Entries[Index];
+        Index += 1;
 
         //
         // Assert this is a cache entry after the eviction offset.
@@ -2347,13 +2550,13 @@ Return Value:
         ASSERT(CacheEntry->Offset >= Offset);
 
         //
-        // Remove the node from the page cache tree. It should not be found on
-        // look-up again.
+        // Remove the entry from the page cache index. It should not be found
+        // on look-up again.
         //
 
-        ASSERT(CacheEntry->Node.Parent != NULL);
+        ASSERT((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0);
 
-        IopRemovePageCacheEntryFromTree(CacheEntry);
+        IopRemovePageCacheEntryFromIndex(CacheEntry);
 
         //
         // Remove the cache entry from its current list. If it has no
@@ -2634,6 +2837,9 @@ Return Value:
             ASSERT((OldFlags & PAGE_CACHE_ENTRY_FLAG_OWNER) != 0);
 
             RtlAtomicAdd(&IoPageCacheDirtyPageCount, (UINTN)-1);
+            RtlAtomicAdd(&(Entry->FileObject->Writeback->DirtyPageCount),
+                         (UINTN)-1);
+
             if ((OldFlags & PAGE_CACHE_ENTRY_FLAG_MAPPED) != 0) {
                 RtlAtomicAdd(&IoPageCacheMappedDirtyPageCount, (UINTN)-1);
             }
@@ -2660,6 +2866,12 @@ Return Value:
         //
 
         if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_PENDING) == 0) {
+            if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0) {
+                IopClearPageCacheIndexTag(
+                                    &(Entry->FileObject->PageCacheIndex),
+                                    PAGE_CACHE_INDEX_KEY(Entry->Offset),
+                                    PageCacheIndexTagDirty);
+            }
 
             //
             // If requested, move the page cache entry to the back of the LRU
@@ -2771,6 +2983,7 @@ Return Value:
                (Entry->VirtualAddress == NULL));
 
         RtlAtomicAdd(&IoPageCacheDirtyPageCount, 1);
+        RtlAtomicAdd(&(FileObject->Writeback->DirtyPageCount), 1);
         if ((OldFlags & PAGE_CACHE_ENTRY_FLAG_MAPPED) != 0) {
             RtlAtomicAdd(&IoPageCacheMappedDirtyPageCount, 1);
         }
@@ -2793,6 +3006,12 @@ Return Value:
         INSERT_BEFORE(&(DirtyEntry->ListEntry),
                       &(FileObject->DirtyPageList));
 
+        if ((DirtyEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0) {
+            IopSetPageCacheIndexTag(&(FileObject->PageCacheIndex),
+                                    PAGE_CACHE_INDEX_KEY(DirtyEntry->Offset),
+                                    PageCacheIndexTagDirty);
+        }
+
         KeReleaseQueuedLock(IoPageCacheListLock);
         IopMarkFileObjectDirty(DirtyEntry->FileObject);
 
@@ -3292,7 +3511,7 @@ Return Value:
 
 BOOL
 IopIsPageCacheTooDirty (
-    VOID
+    PWRITEBACK_CONTEXT Context
     )
 
 /*++
@@ -3305,12 +3524,14 @@ Routine Description:
 
 Arguments:
 
-    None.
+    Context - Supplies an optional pointer to the writeback context of the
+        device about to be dirtied. If supplied, the device is also checked
+        against its share of the dirty limit.
 
 Return Value:
 
-    TRUE if the page cache has too many dirty entries and adding new ones
-    should generally be avoided.
+    TRUE if the page cache, or the given device's share of it, has too many
+    dirty entries and adding new ones should generally be avoided.
 
     FALSE if the page cache is relatively clean.
 
@@ -3351,56 +3572,15 @@ Return Value:
         return TRUE;
     }
 
-    return FALSE;
-}
-
-COMPARISON_RESULT
-IopComparePageCacheEntries (
-    PRED_BLACK_TREE Tree,
-    PRED_BLACK_TREE_NODE FirstNode,
-    PRED_BLACK_TREE_NODE SecondNode
-    )
-
-/*++
-
-Routine Description:
-
-    This routine compares two Red-Black tree nodes contained inside file
-    objects.
-
-Arguments:
-
-    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
-
-    FirstNode - Supplies a pointer to the left side of the comparison.
-
-    SecondNode - Supplies a pointer to the second side of the comparison.
-
-Return Value:
-
-    Same if the two nodes have the same value.
-
-    Ascending if the first node is less than the second node.
-
-    Descending if the second node is less than the first node.
-
---*/
-
-{
-
-    PPAGE_CACHE_ENTRY FirstEntry;
-    PPAGE_CACHE_ENTRY SecondEntry;
-
-    FirstEntry = RED_BLACK_TREE_VALUE(FirstNode, PAGE_CACHE_ENTRY, Node);
-    SecondEntry = RED_BLACK_TREE_VALUE(SecondNode, PAGE_CACHE_ENTRY, Node);
-    if (FirstEntry->Offset < SecondEntry->Offset) {
-        return ComparisonResultAscending;
+    if (Context != NULL) {
+        if (MaxDirty > IoPageCacheMaxDirtyPages) {
+            MaxDirty = IoPageCacheMaxDirtyPages;
+        }
 
-    } else if (FirstEntry->Offset > SecondEntry->Offset) {
-        return ComparisonResultDescending;
+        return IopIsWritebackOverLimit(Context, MaxDirty);
     }
 
-    return ComparisonResultSame;
+    return FALSE;
 }
 
 //
@@ -3518,7 +3698,7 @@ Return Value:
         CurrentEntry->Next = NULL;
 
         ASSERT(CacheEntry->ReferenceCount == 0);
-        ASSERT(CacheEntry->Node.Parent == NULL);
+        ASSERT((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0);
 
         if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_EVICTION) != 0) {
             RtlDebugPrint("PAGE CACHE: Destroy entry 0x%08x: file object "
@@ -3585,7 +3765,7 @@ Return Value:
     ASSERT((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_WAS_DIRTY) == 0);
     ASSERT(Entry->ListEntry.Next == NULL);
     ASSERT(Entry->ReferenceCount == 0);
-    ASSERT(Entry->Node.Parent == NULL);
+    ASSERT((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0);
 
     //
     // If this is the page owner, then free the physical page.
@@ -3642,7 +3822,7 @@ Return Value:
     return;
 }
 
-VOID
+KSTATUS
 IopInsertPageCacheEntry (
     PPAGE_CACHE_ENTRY NewEntry,
     PPAGE_CACHE_ENTRY LinkEntry
@@ -3654,8 +3834,8 @@ Routine Description:
 
     This routine inserts the new page cache entry into the page cache and links
     it to the link entry once it is inserted. This routine assumes that the
-    page cache tree lock is held exclusively and that there is not already an
-    entry for the same file and offset in the tree.
+    file object lock is held exclusively and that there is not already an
+    entry for the same file and offset in the index.
 
 Arguments:
 
@@ -3667,26 +3847,47 @@ Routine Description:
 
 Return Value:
 
-    None.
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if the index could not be expanded. The
+    entry is left untouched in this case.
 
 --*/
 
 {
 
     ULONG ClearFlags;
+    PPAGE_CACHE_INDEX Index;
+    ULONGLONG Key;
     IO_OBJECT_TYPE LinkType;
     IO_OBJECT_TYPE NewType;
     ULONG OldFlags;
+    PAGE_CACHE_INDEX_RESERVE Reserve;
+    KSTATUS Status;
     PVOID VirtualAddress;
 
     ASSERT(KeIsSharedExclusiveLockHeldExclusive(NewEntry->FileObject->Lock));
 
     //
-    // Insert the new entry into its file object's tree.
+    // Insert the new entry into its file object's index. Allocate any nodes
+    // needed first so that the list lock is not held while allocating. The
+    // file object lock keeps anyone else from changing the index's shape in
+    // the meantime.
     //
 
-    RtlRedBlackTreeInsert(&(NewEntry->FileObject->PageCacheTree),
-                          &(NewEntry->Node));
+    Index = &(NewEntry->FileObject->PageCacheIndex);
+    Key = PAGE_CACHE_INDEX_KEY(NewEntry->Offset);
+    Status = IopReservePageCacheIndexNodes(Index, Key, &Reserve);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    KeAcquireQueuedLock(IoPageCacheListLock);
+    IopInsertPageCacheIndexEntry(Index, Key, NewEntry, &Reserve);
+    RtlAtomicOr32(&(NewEntry->Flags), PAGE_CACHE_ENTRY_FLAG_INDEXED);
+    KeReleaseQueuedLock(IoPageCacheListLock);
+
+    ASSERT(Reserve.Count == 0);
 
     //
     // Now link the new entry to the supplied link entry based on their I/O
@@ -3776,7 +3977,7 @@ Return Value:
                                               NewEntry);
     }
 
-    return;
+    return STATUS_SUCCESS;
 }
 
 PPAGE_CACHE_ENTRY
@@ -3809,24 +4010,76 @@ Return Value:
 {
 
     PPAGE_CACHE_ENTRY FoundEntry;
-    PRED_BLACK_TREE_NODE FoundNode;
-    PAGE_CACHE_ENTRY SearchEntry;
 
-    SearchEntry.FileObject = FileObject;
-    SearchEntry.Offset = Offset;
-    SearchEntry.Flags = 0;
-    FoundNode = RtlRedBlackTreeSearch(&(FileObject->PageCacheTree),
-                                      &(SearchEntry.Node));
+    FoundEntry = IopLookupPageCacheIndexEntry(&(FileObject->PageCacheIndex),
+                                              PAGE_CACHE_INDEX_KEY(Offset));
 
-    if (FoundNode == NULL) {
+    if (FoundEntry == NULL) {
         return NULL;
     }
 
-    FoundEntry = RED_BLACK_TREE_VALUE(FoundNode, PAGE_CACHE_ENTRY, Node);
     IoPageCacheEntryAddReference(FoundEntry);
     return FoundEntry;
 }
 
+PPAGE_CACHE_ENTRY
+IopGetNextPageCacheEntry (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset,
+    BOOL DirtyOnly
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the first page cache entry whose page ends after the
+    given offset. No reference is taken on the entry, so the file object lock
+    must be held and the entry must not be used once the lock is dropped.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object for the file or device.
+
+    Offset - Supplies the offset to search from.
+
+    DirtyOnly - Supplies a boolean indicating whether to only return entries
+        that are tagged dirty in the index.
+
+Return Value:
+
+    Returns a pointer to the next page cache entry, or NULL if there are no
+    more entries.
+
+--*/
+
+{
+
+    ULONG Count;
+    PPAGE_CACHE_ENTRY Entry;
+    ULONG Tag;
+
+    ASSERT(KeIsSharedExclusiveLockHeld(FileObject->Lock));
+
+    Tag = PAGE_CACHE_INDEX_NO_TAG;
+    if (DirtyOnly != FALSE) {
+        Tag = PageCacheIndexTagDirty;
+    }
+
+    Count = IopGatherPageCacheIndexEntries(&(FileObject->PageCacheIndex),
+                                           PAGE_CACHE_INDEX_KEY(Offset),
+                                           MAX_ULONGLONG,
+                                           Tag,
+                                           (PVOID *)&Entry,
+                                           1);
+
+    if (Count == 0) {
+        return NULL;
+    }
+
+    return Entry;
+}
+
 VOID
 IopPageCacheThread (
     PVOID Parameter
@@ -3908,60 +4161,47 @@ Return Value:
         WRITE_INT64_SYNC(&IoPageCacheLastCleanTime, CurrentTime);
 
         //
-        // Loop over the process of removing excess entries and flushing
-        // dirty entries. The flush code may decided to loop back and remove
-        // more excess entries.
+        // Blast away the list of page cache entries that are ready for
+        // removal.
         //
 
-        while (TRUE) {
-
-            //
-            // Blast away the list of page cache entries that are ready for
-            // removal.
-            //
-
-            IopTrimRemovalPageCacheList();
-
-            //
-            // Attempt to trim out some clean page cache entries from the LRU
-            // list. This routine should only do any work if memory is tight.
-            // This is the root of the page cache thread, so there's never
-            // recursive I/O to worry about (so go ahead and destroy file
-            // objects).
-            //
-
-            IopTrimPageCache(FALSE);
+        IopTrimRemovalPageCacheList();
 
-            //
-            // Flush some dirty file objects.
-            //
+        //
+        // Attempt to trim out some clean page cache entries from the LRU
+        // list. This routine should only do any work if memory is tight.
+        // This is the root of the page cache thread, so there's never
+        // recursive I/O to worry about (so go ahead and destroy file
+        // objects).
+        //
 
-            Status = IopFlushFileObjects(0, IO_FLAG_HARD_FLUSH_ALLOWED, NULL);
-            if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_DIRTY_LISTS) != 0) {
-                IopCheckDirtyFileObjectsList();
-            }
+        IopTrimPageCache(FALSE);
 
-            if (Status == STATUS_TRY_AGAIN) {
-                continue;
-            }
+        //
+        // Hand the dirty file objects to the writeback worker of each device,
+        // so that a slow device doesn't hold up writeback to the others.
+        //
 
-            //
-            // If the page cache appears to be completely clean, try to kill the
-            // timer and go dormant. Kill the timer, change the state to clean,
-            // and then see if any dirtiness snuck in while that was happening.
-            // If so, set it back to dirty (racing with everyone else that
-            // may have already done that).
-            //
+        IopWakeWritebackWorkers();
+        if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_DIRTY_LISTS) != 0) {
+            IopCheckDirtyFileObjectsList();
+        }
 
-            KeCancelTimer(IoPageCacheWorkTimer);
-            RtlAtomicExchange32(&IoPageCacheState, PageCacheStateClean);
-            if ((!LIST_EMPTY(&IoFileObjectsDirtyList)) ||
-                (IoPageCacheDirtyPageCount != 0)) {
+        //
+        // If the page cache appears to be completely clean, try to kill the
+        // timer and go dormant. Kill the timer, change the state to clean,
+        // and then see if any dirtiness snuck in while that was happening.
+        // If so, set it back to dirty (racing with everyone else that may
+        // have already done that). The workers are likely still flushing, in
+        // which case this comes back around after the clean interval.
+        //
 
-                IopSchedulePageCacheThread();
-            }
+        KeCancelTimer(IoPageCacheWorkTimer);
+        RtlAtomicExchange32(&IoPageCacheState, PageCacheStateClean);
+        if ((IoDirtyFileObjectCount != 0) ||
+            (IoPageCacheDirtyPageCount != 0)) {
 
-            break;
+            IopSchedulePageCacheThread();
         }
     }
 
@@ -4012,6 +4252,7 @@ Return Value:
     BOOL MarkedClean;
     ULONG OldFlags;
     ULONG PageSize;
+    ULONGLONG StartTime;
     KSTATUS Status;
 
     CacheEntry = MmGetIoBufferPageCacheEntry(FlushBuffer, 0);
@@ -4046,7 +4287,7 @@ Return Value:
         // Evicted entries should never be in a flush buffer.
         //
 
-        ASSERT(CacheEntry->Node.Parent != NULL);
+        ASSERT((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0);
 
         MarkedClean = IopMarkPageCacheEntryClean(CacheEntry, TRUE);
         if (MarkedClean != FALSE) {
@@ -4122,7 +4363,13 @@ Return Value:
     IoContext.Flags = Flags;
     IoContext.TimeoutInMilliseconds = WAIT_TIME_INDEFINITE;
     IoContext.Write = TRUE;
+    StartTime = IopBeginWritebackIo(FileObject->Writeback, FlushSize);
     Status = IopPerformNonCachedWrite(FileObject, &IoContext, NULL);
+    IopEndWritebackIo(FileObject->Writeback,
+                      FlushSize,
+                      IoContext.BytesCompleted,
+                      StartTime);
+
     if (FileObject->Properties.Type == IoObjectBlockDevice) {
         KeAcquireSharedExclusiveLockShared(FileObject->Lock);
     }
@@ -4264,10 +4511,10 @@ IopRemovePageCacheEntriesFromList (
 Routine Description:
 
     This routine processes page cache entries in the given list, removing them
-    from the tree and the list, if possible. If a target remove count is
+    from the index and the list, if possible. If a target remove count is
     supplied, then the removal process will stop as soon as the removal count
     reaches 0 or the end of the list is reached. This routine assumes that the
-    page cache tree lock is held exclusively.
+    page cache list lock is held.
 
 Arguments:
 
@@ -4330,7 +4577,7 @@ Return Value:
         // If the page cache entry has not been evicted, potentially skip it.
         //
 
-        if (CacheEntry->Node.Parent != NULL) {
+        if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0) {
 
             //
             // Remove anything with a reference to avoid iterating through it
@@ -4382,7 +4629,7 @@ Return Value:
         if (TimidEffort != FALSE) {
             if (KeTryToAcquireSharedExclusiveLockExclusive(Lock) == FALSE) {
                 LIST_REMOVE(&(CacheEntry->ListEntry));
-                if (CacheEntry->Node.Parent != NULL) {
+                if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0) {
                     INSERT_BEFORE(&(CacheEntry->ListEntry),
                                   &IoPageCacheCleanList);
 
@@ -4415,11 +4662,11 @@ Return Value:
         if (CacheEntry->ReferenceCount == 1) {
 
             //
-            // If the page cache entry is already removed from the tree, then
+            // If the page cache entry is already removed from the index, then
             // just mark it clean and grab the flags.
             //
 
-            if (CacheEntry->Node.Parent == NULL) {
+            if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0) {
                 IopMarkPageCacheEntryClean(CacheEntry, FALSE);
                 RtlAtomicAnd32(&(CacheEntry->Flags),
                                ~PAGE_CACHE_ENTRY_FLAG_WAS_DIRTY);
@@ -4455,7 +4702,7 @@ Return Value:
                     } else if ((CacheEntry->Flags &
                                 PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0) {
 
-                        IopRemovePageCacheEntryFromTree(CacheEntry);
+                        IopRemovePageCacheEntryFromIndex(CacheEntry);
                         RtlAtomicAnd32(&(CacheEntry->Flags),
                                        ~PAGE_CACHE_ENTRY_FLAG_WAS_DIRTY);
 
@@ -4503,7 +4750,7 @@ Return Value:
         // If the page cache has been evicted, move it to the removal list.
         //
 
-        } else if (CacheEntry->Node.Parent == NULL) {
+        } else if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0) {
             MoveList = &IoPageCacheRemovalList;
 
         //
@@ -4789,7 +5036,7 @@ Return Value:
         //
 
         MoveList = NULL;
-        if (CacheEntry->Node.Parent == NULL) {
+        if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0) {
             MoveList = &IoPageCacheRemovalList;
 
         } else {
@@ -4938,7 +5185,7 @@ Return Value:
         CacheEntry = MmGetIoBufferPageCacheEntry(IoBuffer, BufferOffset);
         if ((CacheEntry == NULL) ||
             (CacheEntry->FileObject != FileObject) ||
-            (CacheEntry->Node.Parent == NULL) ||
+            ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0) ||
             (CacheEntry->Offset != FileOffset)) {
 
             return FALSE;
@@ -5137,7 +5384,7 @@ Return Value:
 }
 
 VOID
-IopRemovePageCacheEntryFromTree (
+IopRemovePageCacheEntryFromIndex (
     PPAGE_CACHE_ENTRY Entry
     )
 
@@ -5145,8 +5392,9 @@ IopRemovePageCacheEntryFromTree (
 
 Routine Description:
 
-    This routine removes a page cache entry from the page cache tree. This
-    routine assumes that the page cache's tree lock is held exclusively.
+    This routine removes a page cache entry from its file object's page cache
+    index. This routine assumes that the file object lock is held
+    exclusively.
 
 Arguments:
 
@@ -5161,7 +5409,7 @@ Return Value:
 {
 
     ASSERT(KeIsSharedExclusiveLockHeldExclusive(Entry->FileObject->Lock));
-    ASSERT(Entry->Node.Parent != NULL);
+    ASSERT((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0);
 
     //
     // If a backing entry exists, then MM needs to know that the backing entry
@@ -5173,8 +5421,12 @@ Return Value:
                                               Entry->BackingEntry);
     }
 
-    RtlRedBlackTreeRemove(&(Entry->FileObject->PageCacheTree), &(Entry->Node));
-    Entry->Node.Parent = NULL;
+    KeAcquireQueuedLock(IoPageCacheListLock);
+    IopRemovePageCacheIndexEntry(&(Entry->FileObject->PageCacheIndex),
+                                 PAGE_CACHE_INDEX_KEY(Entry->Offset));
+
+    RtlAtomicAnd32(&(Entry->Flags), ~PAGE_CACHE_ENTRY_FLAG_INDEXED);
+    KeReleaseQueuedLock(IoPageCacheListLock);
     if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_EVICTION) != 0) {
         RtlDebugPrint("PAGE CACHE: Remove PAGE_CACHE_ENTRY 0x%08x: FILE_OBJECT "
                       "0x%08x, offset 0x%I64x, physical address "
@@ -5404,7 +5656,7 @@ Return Value:
 
     PLIST_ENTRY CurrentEntry;
     PPAGE_CACHE_ENTRY Entry;
-    PRED_BLACK_TREE_NODE TreeNode;
+    ULONGLONG Key;
 
     //
     // This routine produces a lot of false negatives for block devices because
@@ -5417,9 +5669,14 @@ Return Value:
 
     KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
     KeAcquireQueuedLock(IoPageCacheListLock);
-    TreeNode = RtlRedBlackTreeGetLowestNode(&(FileObject->PageCacheTree));
-    while (TreeNode != NULL) {
-        Entry = RED_BLACK_TREE_VALUE(TreeNode, PAGE_CACHE_ENTRY, Node);
+    Key = 0;
+    while (IopGatherPageCacheIndexEntries(&(FileObject->PageCacheIndex),
+                                          Key,
+                                          MAX_ULONGLONG,
+                                          PAGE_CACHE_INDEX_NO_TAG,
+                                          (PVOID *)&Entry,
+                                          1) != 0) {
+
         if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) != 0) {
             if (Entry->ListEntry.Next == NULL) {
                 RtlDebugPrint("PAGE_CACHE_ENTRY 0x%x for FILE_OBJECT 0x%x "
@@ -5447,9 +5704,10 @@ Return Value:
             }
         }
 
-        TreeNode = RtlRedBlackTreeGetNextNode(&(FileObject->PageCacheTree),
-                                              FALSE,
-                                              TreeNode);
+        Key = PAGE_CACHE_INDEX_KEY(Entry->Offset) + 1;
+        if (Key == 0) {
+            break;
+        }
     }
 
     KeReleaseQueuedLock(IoPageCacheListLock);
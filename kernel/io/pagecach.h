@@ -37,19 +37,68 @@ Module Name:
 
 #define PAGE_CACHE_DIRTY_PENANCE_PAGES 128
 
+//
+// Define the number of key bits each page cache index node resolves, and the
+// resulting maximum height of an index.
+//
+
+#define PAGE_CACHE_INDEX_NODE_SHIFT 6
+#define PAGE_CACHE_INDEX_MAX_HEIGHT \
+    ((64 + PAGE_CACHE_INDEX_NODE_SHIFT - 1) / PAGE_CACHE_INDEX_NODE_SHIFT)
+
+//
+// Define the largest number of nodes a single index insert can need. Growing
+// the root and then filling in the path beneath it can take up to twice the
+// height.
+//
+
+#define PAGE_CACHE_INDEX_RESERVE_COUNT (2 * PAGE_CACHE_INDEX_MAX_HEIGHT)
+
+//
+// Supply this value as the tag when gathering index entries to collect every
+// entry regardless of its tags.
+//
+
+#define PAGE_CACHE_INDEX_NO_TAG PageCacheIndexTagCount
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+typedef enum _PAGE_CACHE_INDEX_TAG {
+    PageCacheIndexTagDirty,
+    PageCacheIndexTagCount
+} PAGE_CACHE_INDEX_TAG, *PPAGE_CACHE_INDEX_TAG;
+
+/*++
+
+Structure Description:
+
+    This structure stores the nodes allocated ahead of time for a page cache
+    index insert, so that the insert itself cannot fail.
+
+Members:
+
+    Count - Stores the number of nodes in the array.
+
+    Nodes - Stores the reserved nodes.
+
+--*/
+
+typedef struct _PAGE_CACHE_INDEX_RESERVE {
+    ULONG Count;
+    PPAGE_CACHE_INDEX_NODE Nodes[PAGE_CACHE_INDEX_RESERVE_COUNT];
+} PAGE_CACHE_INDEX_RESERVE, *PPAGE_CACHE_INDEX_RESERVE;
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 //
-// Store the global list of dirty file objects.
+// Store the number of file objects on the dirty lists.
 //
 
-extern LIST_ENTRY IoFileObjectsDirtyList;
+extern volatile ULONG IoDirtyFileObjectCount;
 
 //
 // -------------------------------------------------------- Function Prototypes
@@ -102,6 +151,40 @@ Return Value:
 
 --*/
 
+ULONG
+IopLookupPageCacheEntries (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset,
+    ULONG PageCount,
+    PPAGE_CACHE_ENTRY *Entries
+    );
+
+/*++
+
+Routine Description:
+
+    This routine looks up the page cache entries for a run of consecutive
+    pages with a single walk of the file object's page cache index. A
+    reference is taken on each entry found.
+
+Arguments:
+
+    FileObject - Supplies a pointer to a file object for the device or file.
+
+    Offset - Supplies the page aligned offset of the first page.
+
+    PageCount - Supplies the number of pages to look up.
+
+    Entries - Supplies an array of PageCount elements. Each element receives
+        the entry for the corresponding page, or NULL if that page is not in
+        the cache.
+
+Return Value:
+
+    Returns the number of entries found.
+
+--*/
+
 PPAGE_CACHE_ENTRY
 IopCreateOrLookupPageCacheEntry (
     PFILE_OBJECT FileObject,
@@ -280,6 +363,7 @@ VOID
 IopEvictPageCacheEntries (
     PFILE_OBJECT FileObject,
     IO_OFFSET Offset,
+    ULONGLONG Size,
     ULONG Flags
     );
 
@@ -291,7 +375,7 @@ Routine Description:
     device, as specified by the file object. The flags specify how aggressive
     this routine should be. The file object lock must already be held
     exclusively and this routine assumes that the file object has been unmapped
-    from all image sections starting at the offset.
+    from all image sections in the range being evicted.
 
 Arguments:
 
@@ -300,6 +384,11 @@ Routine Description:
     Offset - Supplies the starting offset into the file or device after which
         all page cache entries should be evicted.
 
+    Size - Supplies the size, in bytes, of the region to evict. Supply a value
+        of -1 to evict from the given offset to the end of the file. Entries
+        that start within the region are evicted, so the end of the region
+        should be page aligned.
+
     Flags - Supplies a bitmask of eviction flags. See EVICTION_FLAG_* for
         definitions.
 
@@ -559,7 +648,7 @@ Return Value:
 
 BOOL
 IopIsPageCacheTooDirty (
-    VOID
+    PWRITEBACK_CONTEXT Context
     );
 
 /*++
@@ -572,46 +661,283 @@ Routine Description:
 
 Arguments:
 
-    None.
+    Context - Supplies an optional pointer to the writeback context of the
+        device about to be dirtied. If supplied, the device is also checked
+        against its share of the dirty limit.
 
 Return Value:
 
-    TRUE if the page cache has too many dirty entries and adding new ones
-    should generally be avoided.
+    TRUE if the page cache, or the given device's share of it, has too many
+    dirty entries and adding new ones should generally be avoided.
 
     FALSE if the page cache is relatively clean.
 
 --*/
 
-COMPARISON_RESULT
-IopComparePageCacheEntries (
-    PRED_BLACK_TREE Tree,
-    PRED_BLACK_TREE_NODE FirstNode,
-    PRED_BLACK_TREE_NODE SecondNode
+KSTATUS
+IopInitializePageCacheIndexAllocator (
+    VOID
     );
 
 /*++
 
 Routine Description:
 
-    This routine compares two Red-Black tree nodes contained inside file
-    objects.
+    This routine creates the allocator used for page cache index nodes.
 
 Arguments:
 
-    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+    None.
 
-    FirstNode - Supplies a pointer to the left side of the comparison.
+Return Value:
 
-    SecondNode - Supplies a pointer to the second side of the comparison.
+    Status code.
+
+--*/
+
+VOID
+IopDestroyPageCacheIndexAllocator (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine destroys the allocator used for page cache index nodes. It is
+    only used if page cache initialization fails.
+
+Arguments:
+
+    None.
 
 Return Value:
 
-    Same if the two nodes have the same value.
+    None.
+
+--*/
+
+KSTATUS
+IopReservePageCacheIndexNodes (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PPAGE_CACHE_INDEX_RESERVE Reserve
+    );
+
+/*++
+
+Routine Description:
+
+    This routine allocates the nodes needed to insert the given key into the
+    index. The caller must prevent the shape of the index from changing until
+    the insert is done.
+
+Arguments:
 
-    Ascending if the first node is less than the second node.
+    Index - Supplies a pointer to the index.
 
-    Descending if the second node is less than the first node.
+    Key - Supplies the key that is about to be inserted.
+
+    Reserve - Supplies a pointer where the allocated nodes are returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if the nodes could not be allocated.
+
+--*/
+
+VOID
+IopReleasePageCacheIndexNodes (
+    PPAGE_CACHE_INDEX_RESERVE Reserve
+    );
+
+/*++
+
+Routine Description:
+
+    This routine frees any reserved nodes that were not consumed by an insert.
+
+Arguments:
+
+    Reserve - Supplies a pointer to the reserved nodes.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+IopInsertPageCacheIndexEntry (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PVOID Entry,
+    PPAGE_CACHE_INDEX_RESERVE Reserve
+    );
+
+/*++
+
+Routine Description:
+
+    This routine inserts an entry into the index. The key must not already be
+    present, and the needed nodes must have been reserved for this key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the key to insert the entry at.
+
+    Entry - Supplies the entry to insert.
+
+    Reserve - Supplies a pointer to the nodes reserved for the insert.
+
+Return Value:
+
+    None.
+
+--*/
+
+PVOID
+IopRemovePageCacheIndexEntry (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    );
+
+/*++
+
+Routine Description:
+
+    This routine removes the entry at the given key from the index, freeing
+    any nodes that become empty.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the key of the entry to remove.
+
+Return Value:
+
+    Returns the removed entry, or NULL if there was no entry at the key.
+
+--*/
+
+PVOID
+IopLookupPageCacheIndexEntry (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds the entry at the given key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the key to look up.
+
+Return Value:
+
+    Returns the entry at the key, or NULL if there is none.
+
+--*/
+
+ULONG
+IopGatherPageCacheIndexEntries (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG FirstKey,
+    ULONGLONG LastKey,
+    ULONG Tag,
+    PVOID *Entries,
+    ULONG Count
+    );
+
+/*++
+
+Routine Description:
+
+    This routine collects the entries in a range of keys in ascending key
+    order, optionally skipping entries that do not have the given tag.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    FirstKey - Supplies the first key in the range.
+
+    LastKey - Supplies the last key in the range, inclusive.
+
+    Tag - Supplies the tag entries must have to be collected, or
+        PAGE_CACHE_INDEX_NO_TAG to collect all entries.
+
+    Entries - Supplies an array where the collected entries are returned.
+
+    Count - Supplies the maximum number of entries to collect.
+
+Return Value:
+
+    Returns the number of entries collected.
+
+--*/
+
+VOID
+IopSetPageCacheIndexTag (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    ULONG Tag
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets a tag on the entry at the given key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the key of the entry to tag. An entry must exist there.
+
+    Tag - Supplies the tag to set.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+IopClearPageCacheIndexTag (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    ULONG Tag
+    );
+
+/*++
+
+Routine Description:
+
+    This routine clears a tag from the entry at the given key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the key of the entry to clear the tag from.
+
+    Tag - Supplies the tag to clear.
+
+Return Value:
+
+    None.
 
 --*/
 
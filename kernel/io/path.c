@@ -2662,11 +2662,13 @@ Return Value:
             KeGetSystemTime(&(Properties.AccessTime));
             Properties.ModifiedTime = Properties.AccessTime;
             Properties.StatusChangeTime = Properties.AccessTime;
+            FileObjectFlags = 0;
             Status = IopSendCreateRequest(PathRoot,
                                           DirectoryFileObject,
                                           Name,
                                           NameSize,
-                                          &Properties);
+                                          &Properties,
+                                          &FileObjectFlags);
 
             //
             // If the create request worked, create a file object for it. If
@@ -2680,7 +2682,6 @@ Return Value:
 
                 ASSERT(Properties.DeviceId == PathRoot->DeviceId);
 
-                FileObjectFlags = 0;
                 if ((OpenFlags & OPEN_FLAG_NO_PAGE_CACHE) != 0) {
                     FileObjectFlags |= FILE_OBJECT_FLAG_NO_PAGE_CACHE;
                 }
@@ -0,0 +1,996 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    pcindex.c
+
+Abstract:
+
+    This module implements the radix tree that indexes a file object's page
+    cache entries by page number. Each node resolves six bits of the page
+    number, keeps a bitmap of its occupied slots, and keeps a bitmap per tag
+    recording which slots lead to tagged entries. This lets range lookups skip
+    empty or untagged subtrees without visiting them.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+#include "pagecach.h"
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// This macro returns the slot within a node at the given shift that the given
+// key falls into.
+//
+
+#define PAGE_CACHE_INDEX_SLOT(_Key, _Shift) \
+    ((ULONG)(((_Key) >> (_Shift)) & PAGE_CACHE_INDEX_NODE_MASK))
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PAGE_CACHE_INDEX_ALLOCATION_TAG 0x78496350 // 'xIcP'
+
+//
+// Define the number of slots in each node, and the mask to get a slot from a
+// shifted key.
+//
+
+#define PAGE_CACHE_INDEX_NODE_SLOTS (1 << PAGE_CACHE_INDEX_NODE_SHIFT)
+#define PAGE_CACHE_INDEX_NODE_MASK (PAGE_CACHE_INDEX_NODE_SLOTS - 1)
+
+//
+// Define the block expansion count for the index node block allocator.
+//
+
+#define PAGE_CACHE_INDEX_BLOCK_ALLOCATOR_EXPANSION_COUNT 0x20
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines a node in a page cache index.
+
+Members:
+
+    Present - Stores a bitmap of the slots that are in use.
+
+    Tags - Stores a bitmap for each tag. In a leaf node, a set bit means the
+        entry in that slot is tagged. In an interior node, a set bit means the
+        child in that slot has at least one tagged entry beneath it.
+
+    Shift - Stores the number of key bits resolved beneath this node. Leaf
+        nodes have a shift of zero.
+
+    Slots - Stores the child nodes for interior nodes or the entries for leaf
+        nodes.
+
+--*/
+
+struct _PAGE_CACHE_INDEX_NODE {
+    ULONGLONG Present;
+    ULONGLONG Tags[PageCacheIndexTagCount];
+    ULONG Shift;
+    PVOID Slots[PAGE_CACHE_INDEX_NODE_SLOTS];
+};
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+ULONGLONG
+IopGetPageCacheIndexMaxKey (
+    ULONG Shift
+    );
+
+PPAGE_CACHE_INDEX_NODE
+IopTakeReservedPageCacheIndexNode (
+    PPAGE_CACHE_INDEX_RESERVE Reserve,
+    ULONG Shift
+    );
+
+ULONG
+IopGetPageCacheIndexPath (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PPAGE_CACHE_INDEX_NODE *Path
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store the block allocator for index nodes.
+//
+
+PBLOCK_ALLOCATOR IoPageCacheIndexNodeAllocator;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+IopInitializePageCacheIndexAllocator (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the allocator used for page cache index nodes.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PBLOCK_ALLOCATOR BlockAllocator;
+
+    ASSERT(IoPageCacheIndexNodeAllocator == NULL);
+
+    BlockAllocator = MmCreateBlockAllocator(
+                              sizeof(PAGE_CACHE_INDEX_NODE),
+                              0,
+                              PAGE_CACHE_INDEX_BLOCK_ALLOCATOR_EXPANSION_COUNT,
+                              BLOCK_ALLOCATOR_FLAG_TRIM,
+                              PAGE_CACHE_INDEX_ALLOCATION_TAG);
+
+    if (BlockAllocator == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    IoPageCacheIndexNodeAllocator = BlockAllocator;
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopDestroyPageCacheIndexAllocator (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys the allocator used for page cache index nodes. It is
+    only used if page cache initialization fails.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (IoPageCacheIndexNodeAllocator != NULL) {
+        MmDestroyBlockAllocator(IoPageCacheIndexNodeAllocator);
+        IoPageCacheIndexNodeAllocator = NULL;
+    }
+
+    return;
+}
+
+KSTATUS
+IopReservePageCacheIndexNodes (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PPAGE_CACHE_INDEX_RESERVE Reserve
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates the nodes needed to insert the given key into the
+    index. The caller must prevent the shape of the index from changing until
+    the insert is done.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the key that is about to be inserted.
+
+    Reserve - Supplies a pointer where the allocated nodes are returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if the nodes could not be allocated.
+
+--*/
+
+{
+
+    PPAGE_CACHE_INDEX_NODE Child;
+    ULONG Count;
+    PPAGE_CACHE_INDEX_NODE Node;
+    ULONG Shift;
+
+    Count = 0;
+    Reserve->Count = 0;
+    Node = Index->Root;
+
+    //
+    // An empty index needs a full path of nodes down to the key.
+    //
+
+    if (Node == NULL) {
+        Shift = 0;
+        while (Key > IopGetPageCacheIndexMaxKey(Shift)) {
+            Shift += PAGE_CACHE_INDEX_NODE_SHIFT;
+        }
+
+        Count = (Shift / PAGE_CACHE_INDEX_NODE_SHIFT) + 1;
+
+    //
+    // If the key is beyond the reach of the root, new roots are stacked on
+    // top of the old one. The key lands in a non-zero slot of the topmost
+    // root, so everything beneath that slot is new as well.
+    //
+
+    } else if (Key > IopGetPageCacheIndexMaxKey(Node->Shift)) {
+        Shift = Node->Shift;
+        while (Key > IopGetPageCacheIndexMaxKey(Shift)) {
+            Shift += PAGE_CACHE_INDEX_NODE_SHIFT;
+            Count += 1;
+        }
+
+        Count += Shift / PAGE_CACHE_INDEX_NODE_SHIFT;
+
+    //
+    // Otherwise walk down until a missing child is found. Everything beneath
+    // it needs to be created.
+    //
+
+    } else {
+        while (Node->Shift != 0) {
+            Child = Node->Slots[PAGE_CACHE_INDEX_SLOT(Key, Node->Shift)];
+            if (Child == NULL) {
+                Count = Node->Shift / PAGE_CACHE_INDEX_NODE_SHIFT;
+                break;
+            }
+
+            Node = Child;
+        }
+    }
+
+    ASSERT(Count <= PAGE_CACHE_INDEX_RESERVE_COUNT);
+
+    while (Reserve->Count < Count) {
+        Node = MmAllocateBlock(IoPageCacheIndexNodeAllocator, NULL);
+        if (Node == NULL) {
+            IopReleasePageCacheIndexNodes(Reserve);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(Node, sizeof(PAGE_CACHE_INDEX_NODE));
+        Reserve->Nodes[Reserve->Count] = Node;
+        Reserve->Count += 1;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopReleasePageCacheIndexNodes (
+    PPAGE_CACHE_INDEX_RESERVE Reserve
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees any reserved nodes that were not consumed by an insert.
+
+Arguments:
+
+    Reserve - Supplies a pointer to the reserved nodes.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    while (Reserve->Count != 0) {
+        Reserve->Count -= 1;
+        MmFreeBlock(IoPageCacheIndexNodeAllocator,
+                    Reserve->Nodes[Reserve->Count]);
+    }
+
+    return;
+}
+
+VOID
+IopInsertPageCacheIndexEntry (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PVOID Entry,
+    PPAGE_CACHE_INDEX_RESERVE Reserve
+    )
+
+/*++
+
+Routine Description:
+
+    This routine inserts an entry into the index. The key must not already be
+    present, and the needed nodes must have been reserved for this key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the key to insert the entry at.
+
+    Entry - Supplies the entry to insert.
+
+    Reserve - Supplies a pointer to the nodes reserved for the insert.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPAGE_CACHE_INDEX_NODE Child;
+    PPAGE_CACHE_INDEX_NODE Node;
+    ULONG Shift;
+    ULONG Slot;
+    ULONG Tag;
+
+    ASSERT(Entry != NULL);
+
+    Node = Index->Root;
+    if (Node == NULL) {
+        Shift = 0;
+        while (Key > IopGetPageCacheIndexMaxKey(Shift)) {
+            Shift += PAGE_CACHE_INDEX_NODE_SHIFT;
+        }
+
+        Node = IopTakeReservedPageCacheIndexNode(Reserve, Shift);
+        Index->Root = Node;
+
+    } else {
+
+        //
+        // Grow the tree upwards until the root covers the key. The old root
+        // always sits in the first slot of the new one.
+        //
+
+        while (Key > IopGetPageCacheIndexMaxKey(Node->Shift)) {
+            Child = Node;
+            Node = IopTakeReservedPageCacheIndexNode(
+                                    Reserve,
+                                    Child->Shift + PAGE_CACHE_INDEX_NODE_SHIFT);
+
+            Node->Slots[0] = Child;
+            Node->Present = 1;
+            for (Tag = 0; Tag < PageCacheIndexTagCount; Tag += 1) {
+                if (Child->Tags[Tag] != 0) {
+                    Node->Tags[Tag] = 1;
+                }
+            }
+
+            Index->Root = Node;
+        }
+    }
+
+    //
+    // Walk down to the leaf, filling in any missing nodes along the way.
+    //
+
+    while (Node->Shift != 0) {
+        Slot = PAGE_CACHE_INDEX_SLOT(Key, Node->Shift);
+        Child = Node->Slots[Slot];
+        if (Child == NULL) {
+            Child = IopTakeReservedPageCacheIndexNode(
+                                    Reserve,
+                                    Node->Shift - PAGE_CACHE_INDEX_NODE_SHIFT);
+
+            Node->Slots[Slot] = Child;
+            Node->Present |= 1ULL << Slot;
+        }
+
+        Node = Child;
+    }
+
+    Slot = PAGE_CACHE_INDEX_SLOT(Key, 0);
+
+    ASSERT(Node->Slots[Slot] == NULL);
+
+    Node->Slots[Slot] = Entry;
+    Node->Present |= 1ULL << Slot;
+    return;
+}
+
+PVOID
+IopRemovePageCacheIndexEntry (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes the entry at the given key from the index, freeing
+    any nodes that become empty.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the key of the entry to remove.
+
+Return Value:
+
+    Returns the removed entry, or NULL if there was no entry at the key.
+
+--*/
+
+{
+
+    PPAGE_CACHE_INDEX_NODE Child;
+    ULONG Depth;
+    PVOID Entry;
+    PPAGE_CACHE_INDEX_NODE Node;
+    PPAGE_CACHE_INDEX_NODE Parent;
+    PPAGE_CACHE_INDEX_NODE Path[PAGE_CACHE_INDEX_MAX_HEIGHT];
+    ULONGLONG SlotMask;
+    ULONG Tag;
+
+    Depth = IopGetPageCacheIndexPath(Index, Key, Path);
+    if (Depth == 0) {
+        return NULL;
+    }
+
+    Depth -= 1;
+    Node = Path[Depth];
+    SlotMask = 1ULL << PAGE_CACHE_INDEX_SLOT(Key, 0);
+    Entry = Node->Slots[PAGE_CACHE_INDEX_SLOT(Key, 0)];
+    Node->Slots[PAGE_CACHE_INDEX_SLOT(Key, 0)] = NULL;
+    Node->Present &= ~SlotMask;
+    for (Tag = 0; Tag < PageCacheIndexTagCount; Tag += 1) {
+        Node->Tags[Tag] &= ~SlotMask;
+    }
+
+    //
+    // Walk back up the path, clearing tags that no longer lead anywhere and
+    // freeing nodes that became empty.
+    //
+
+    while (Depth != 0) {
+        Child = Path[Depth];
+        Parent = Path[Depth - 1];
+        SlotMask = 1ULL << PAGE_CACHE_INDEX_SLOT(Key, Parent->Shift);
+        for (Tag = 0; Tag < PageCacheIndexTagCount; Tag += 1) {
+            if (Child->Tags[Tag] == 0) {
+                Parent->Tags[Tag] &= ~SlotMask;
+            }
+        }
+
+        if (Child->Present == 0) {
+            Parent->Slots[PAGE_CACHE_INDEX_SLOT(Key, Parent->Shift)] = NULL;
+            Parent->Present &= ~SlotMask;
+            MmFreeBlock(IoPageCacheIndexNodeAllocator, Child);
+        }
+
+        Depth -= 1;
+    }
+
+    //
+    // Free the root if the index is now empty. Otherwise shrink the tree while
+    // the root only holds its first slot.
+    //
+
+    Node = Index->Root;
+    if (Node->Present == 0) {
+        Index->Root = NULL;
+        MmFreeBlock(IoPageCacheIndexNodeAllocator, Node);
+
+    } else {
+        while ((Node->Shift != 0) && (Node->Present == 1)) {
+            Index->Root = Node->Slots[0];
+            MmFreeBlock(IoPageCacheIndexNodeAllocator, Node);
+            Node = Index->Root;
+        }
+    }
+
+    return Entry;
+}
+
+PVOID
+IopLookupPageCacheIndexEntry (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the entry at the given key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the key to look up.
+
+Return Value:
+
+    Returns the entry at the key, or NULL if there is none.
+
+--*/
+
+{
+
+    PPAGE_CACHE_INDEX_NODE Node;
+
+    Node = Index->Root;
+    if ((Node == NULL) || (Key > IopGetPageCacheIndexMaxKey(Node->Shift))) {
+        return NULL;
+    }
+
+    while (Node->Shift != 0) {
+        Node = Node->Slots[PAGE_CACHE_INDEX_SLOT(Key, Node->Shift)];
+        if (Node == NULL) {
+            return NULL;
+        }
+    }
+
+    return Node->Slots[PAGE_CACHE_INDEX_SLOT(Key, 0)];
+}
+
+ULONG
+IopGatherPageCacheIndexEntries (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG FirstKey,
+    ULONGLONG LastKey,
+    ULONG Tag,
+    PVOID *Entries,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine collects the entries in a range of keys in ascending key
+    order, optionally skipping entries that do not have the given tag.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    FirstKey - Supplies the first key in the range.
+
+    LastKey - Supplies the last key in the range, inclusive.
+
+    Tag - Supplies the tag entries must have to be collected, or
+        PAGE_CACHE_INDEX_NO_TAG to collect all entries.
+
+    Entries - Supplies an array where the collected entries are returned.
+
+    Count - Supplies the maximum number of entries to collect.
+
+Return Value:
+
+    Returns the number of entries collected.
+
+--*/
+
+{
+
+    ULONGLONG Bitmap;
+    ULONG Found;
+    ULONGLONG Key;
+    ULONGLONG NextKey;
+    ULONG NextSlot;
+    PPAGE_CACHE_INDEX_NODE Node;
+    ULONG Slot;
+    ULONG Span;
+
+    ASSERT(Tag <= PAGE_CACHE_INDEX_NO_TAG);
+
+    Found = 0;
+    Key = FirstKey;
+    while ((Key <= LastKey) && (Found < Count)) {
+        Node = Index->Root;
+        if ((Node == NULL) ||
+            (Key > IopGetPageCacheIndexMaxKey(Node->Shift))) {
+
+            break;
+        }
+
+        //
+        // Descend towards the key. At each level, skip forward to the next
+        // slot that leads somewhere interesting. If there isn't one, move the
+        // key past this node and start over from the root.
+        //
+
+        while (TRUE) {
+            Slot = PAGE_CACHE_INDEX_SLOT(Key, Node->Shift);
+            if (Tag == PAGE_CACHE_INDEX_NO_TAG) {
+                Bitmap = Node->Present;
+
+            } else {
+                Bitmap = Node->Tags[Tag];
+            }
+
+            Bitmap &= ~((1ULL << Slot) - 1);
+            if (Bitmap == 0) {
+                Span = Node->Shift + PAGE_CACHE_INDEX_NODE_SHIFT;
+                if (Span >= 64) {
+                    goto GatherPageCacheIndexEntriesEnd;
+                }
+
+                NextKey = ((Key >> Span) + 1) << Span;
+                if (NextKey <= Key) {
+                    goto GatherPageCacheIndexEntriesEnd;
+                }
+
+                Key = NextKey;
+                break;
+            }
+
+            //
+            // Only move the key if the next interesting slot is past the
+            // key's own slot. Within its own slot the key's low bits still
+            // matter, as entries below it are not in the range.
+            //
+
+            NextSlot = RtlCountTrailingZeros64(Bitmap);
+            if (NextSlot != Slot) {
+                Key &= ~IopGetPageCacheIndexMaxKey(Node->Shift);
+                Key |= (ULONGLONG)NextSlot << Node->Shift;
+                Slot = NextSlot;
+            }
+
+            if (Key > LastKey) {
+                goto GatherPageCacheIndexEntriesEnd;
+            }
+
+            if (Node->Shift != 0) {
+                Node = Node->Slots[Slot];
+
+                ASSERT(Node != NULL);
+
+                continue;
+            }
+
+            //
+            // This is a leaf. Collect everything interesting in it, then move
+            // on to the next leaf.
+            //
+
+            while (Bitmap != 0) {
+                Slot = RtlCountTrailingZeros64(Bitmap);
+                Key = (Key & ~(ULONGLONG)PAGE_CACHE_INDEX_NODE_MASK) | Slot;
+                if (Key > LastKey) {
+                    goto GatherPageCacheIndexEntriesEnd;
+                }
+
+                if (Node->Slots[Slot] != NULL) {
+                    Entries[Found] = Node->Slots[Slot];
+                    Found += 1;
+                    if (Found == Count) {
+                        goto GatherPageCacheIndexEntriesEnd;
+                    }
+                }
+
+                Bitmap &= Bitmap - 1;
+            }
+
+            NextKey = (Key | PAGE_CACHE_INDEX_NODE_MASK) + 1;
+            if (NextKey <= Key) {
+                goto GatherPageCacheIndexEntriesEnd;
+            }
+
+            Key = NextKey;
+            break;
+        }
+    }
+
+GatherPageCacheIndexEntriesEnd:
+    return Found;
+}
+
+VOID
+IopSetPageCacheIndexTag (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    ULONG Tag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets a tag on the entry at the given key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the key of the entry to tag. An entry must exist there.
+
+    Tag - Supplies the tag to set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Depth;
+    PPAGE_CACHE_INDEX_NODE Node;
+    PPAGE_CACHE_INDEX_NODE Path[PAGE_CACHE_INDEX_MAX_HEIGHT];
+    ULONGLONG SlotMask;
+
+    ASSERT(Tag < PageCacheIndexTagCount);
+
+    Depth = IopGetPageCacheIndexPath(Index, Key, Path);
+
+    ASSERT(Depth != 0);
+
+    //
+    // Set the bit at each level from the leaf up. Once a level already has
+    // the bit set, all the levels above it do too.
+    //
+
+    while (Depth != 0) {
+        Depth -= 1;
+        Node = Path[Depth];
+        SlotMask = 1ULL << PAGE_CACHE_INDEX_SLOT(Key, Node->Shift);
+        if ((Node->Tags[Tag] & SlotMask) != 0) {
+            break;
+        }
+
+        Node->Tags[Tag] |= SlotMask;
+    }
+
+    return;
+}
+
+VOID
+IopClearPageCacheIndexTag (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    ULONG Tag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine clears a tag from the entry at the given key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the key of the entry to clear the tag from.
+
+    Tag - Supplies the tag to clear.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Depth;
+    PPAGE_CACHE_INDEX_NODE Node;
+    PPAGE_CACHE_INDEX_NODE Path[PAGE_CACHE_INDEX_MAX_HEIGHT];
+    ULONGLONG SlotMask;
+
+    ASSERT(Tag < PageCacheIndexTagCount);
+
+    Depth = IopGetPageCacheIndexPath(Index, Key, Path);
+
+    //
+    // Clear the bit at each level from the leaf up, stopping at the first
+    // node that still has other tagged slots.
+    //
+
+    while (Depth != 0) {
+        Depth -= 1;
+        Node = Path[Depth];
+        SlotMask = 1ULL << PAGE_CACHE_INDEX_SLOT(Key, Node->Shift);
+        Node->Tags[Tag] &= ~SlotMask;
+        if (Node->Tags[Tag] != 0) {
+            break;
+        }
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+ULONGLONG
+IopGetPageCacheIndexMaxKey (
+    ULONG Shift
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the largest key that a root node with the given shift
+    can hold.
+
+Arguments:
+
+    Shift - Supplies the shift of the node.
+
+Return Value:
+
+    Returns the largest key the node covers.
+
+--*/
+
+{
+
+    if ((Shift + PAGE_CACHE_INDEX_NODE_SHIFT) >= 64) {
+        return MAX_ULONGLONG;
+    }
+
+    return (1ULL << (Shift + PAGE_CACHE_INDEX_NODE_SHIFT)) - 1;
+}
+
+PPAGE_CACHE_INDEX_NODE
+IopTakeReservedPageCacheIndexNode (
+    PPAGE_CACHE_INDEX_RESERVE Reserve,
+    ULONG Shift
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pulls a node out of the reserve.
+
+Arguments:
+
+    Reserve - Supplies a pointer to the reserved nodes.
+
+    Shift - Supplies the shift of the node being created.
+
+Return Value:
+
+    Returns a pointer to the zeroed node.
+
+--*/
+
+{
+
+    PPAGE_CACHE_INDEX_NODE Node;
+
+    ASSERT(Reserve->Count != 0);
+
+    Reserve->Count -= 1;
+    Node = Reserve->Nodes[Reserve->Count];
+    Node->Shift = Shift;
+    return Node;
+}
+
+ULONG
+IopGetPageCacheIndexPath (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PPAGE_CACHE_INDEX_NODE *Path
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records the nodes between the root and the entry at the given
+    key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the key to find.
+
+    Path - Supplies an array of PAGE_CACHE_INDEX_MAX_HEIGHT elements that
+        receives the nodes from the root down to the leaf.
+
+Return Value:
+
+    Returns the number of nodes in the path, or 0 if there is no entry at the
+    given key.
+
+--*/
+
+{
+
+    ULONG Depth;
+    PPAGE_CACHE_INDEX_NODE Node;
+
+    Node = Index->Root;
+    if ((Node == NULL) || (Key > IopGetPageCacheIndexMaxKey(Node->Shift))) {
+        return 0;
+    }
+
+    Depth = 0;
+    while (TRUE) {
+
+        ASSERT(Depth < PAGE_CACHE_INDEX_MAX_HEIGHT);
+
+        Path[Depth] = Node;
+        Depth += 1;
+        if (Node->Shift == 0) {
+            break;
+        }
+
+        Node = Node->Slots[PAGE_CACHE_INDEX_SLOT(Key, Node->Shift)];
+        if (Node == NULL) {
+            return 0;
+        }
+    }
+
+    if (Node->Slots[PAGE_CACHE_INDEX_SLOT(Key, 0)] == NULL) {
+        return 0;
+    }
+
+    return Depth;
+}
+
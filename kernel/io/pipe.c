@@ -385,10 +385,12 @@ Return Value:
 
     ASSERT((*FileObject)->IoState != NULL);
 
-    NewPipe->StreamBuffer = IoCreateStreamBuffer((*FileObject)->IoState,
-                                                 0,
-                                                 0,
-                                                 PIPE_ATOMIC_WRITE_SIZE);
+    NewPipe->StreamBuffer = IoCreateStreamBuffer(
+                                           (*FileObject)->IoState,
+                                           STREAM_BUFFER_FLAG_GROWABLE |
+                                           STREAM_BUFFER_FLAG_GIFT_PAGES,
+                                           0,
+                                           PIPE_ATOMIC_WRITE_SIZE);
 
     if (NewPipe->StreamBuffer == NULL) {
         Status = STATUS_INSUFFICIENT_RESOURCES;
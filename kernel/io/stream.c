@@ -32,22 +32,66 @@ Module Name:
 #include <minoca/kernel/kernel.h>
 #include "iop.h"
 
+
 //
 // ---------------------------------------------------------------- Definitions
 //
 
 #define DEFAULT_STREAM_BUFFER_SIZE 8192
 
+//
+// Define the size a growable stream buffer can reach, including the wasted
+// byte.
+//
+
+#define STREAM_BUFFER_MAX_GROWN_SIZE (64 * 1024)
+
+//
+// Define the smallest amount of data worth handing to readers directly from
+// the writer's pages.
+//
+
+#define STREAM_BUFFER_MINIMUM_GIFT_SIZE (16 * 1024)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
 /*++
 
+Structure Description:
+
+    This structure describes data a writer is handing directly to readers of
+    a stream buffer. It lives on the writer's stack while the writer waits.
+
+Members:
+
+    IoBuffer - Stores a pointer to the writer's locked I/O buffer.
+
+    Offset - Stores the offset into the I/O buffer of the next byte to be read.
+
+    Size - Stores the number of bytes remaining to be read.
+
+--*/
+
+typedef struct _STREAM_BUFFER_GIFT {
+    PIO_BUFFER IoBuffer;
+    UINTN Offset;
+    UINTN Size;
+} STREAM_BUFFER_GIFT, *PSTREAM_BUFFER_GIFT;
+
+/*++
+
 Structure Description:
 
     This structure describes characteristics about a data stream buffer.
 
+    Readers only take the read lock and writers only take the write lock, so
+    a single reader and a single writer never contend with each other. Each
+    side publishes its offset only after its copy is complete, and re-checks
+    the other side's offset after clearing an event so that wakeups are never
+    lost. Anything that needs both locks takes the write lock first.
+
 Members:
 
     Flags - Stores a bitfield of flags governing the state of the stream buffer.
@@ -55,39 +99,103 @@ Structure Description:
 
     Size - Stores the size of the buffer, in bytes.
 
+    MaxSize - Stores the size the buffer can grow to, in bytes.
+
     Buffer - Stores a pointer to the actual stream buffer.
 
     NextReadOffset - Stores the offset from the beginning of the buffer where
-        the next read should occur (points to the first unread byte).
+        the next read should occur (points to the first unread byte). This is
+        only modified with the read lock held.
 
     NextWriteOffset - Stores the offset from the beginning of the buffer where
-        the next write should occur (points to the first unused offset).
+        the next write should occur (points to the first unused offset). This
+        is only modified with the write lock held.
 
     AtomicWriteSize - Stores the number of bytes that can always be written
         to the stream atomically (without interleaving).
 
-    Lock - Stores a pointer to a lock ensuring only one party is accessing the
-        buffer at once.
+    ReadLock - Stores a pointer to a lock serializing readers.
+
+    WriteLock - Stores a pointer to a lock serializing writers.
 
     IoState - Stores a pointer to the I/O object state.
 
+    Gift - Stores an optional pointer to data handed over by a blocked writer.
+        It is read after anything in the buffer, and nothing else is written
+        until it is consumed. It is set with the write lock held and cleared
+        with the read lock held.
+
 --*/
 
 struct _STREAM_BUFFER {
     ULONG Flags;
     ULONG Size;
+    ULONG MaxSize;
     PVOID Buffer;
-    ULONG NextReadOffset;
-    ULONG NextWriteOffset;
+    volatile ULONG NextReadOffset;
+    volatile ULONG NextWriteOffset;
     ULONG AtomicWriteSize;
-    PQUEUED_LOCK Lock;
+    PQUEUED_LOCK ReadLock;
+    PQUEUED_LOCK WriteLock;
     PIO_OBJECT_STATE IoState;
+    PSTREAM_BUFFER_GIFT volatile Gift;
 };
 
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+ULONG
+IopGetStreamBufferSpace (
+    PSTREAM_BUFFER StreamBuffer,
+    ULONG NextReadOffset,
+    ULONG NextWriteOffset,
+    PULONG ContiguousSpace
+    );
+
+BOOL
+IopIsStreamBufferReadable (
+    PSTREAM_BUFFER StreamBuffer
+    );
+
+BOOL
+IopIsStreamBufferWritable (
+    PSTREAM_BUFFER StreamBuffer
+    );
+
+VOID
+IopUpdateStreamBufferInEvent (
+    PSTREAM_BUFFER StreamBuffer
+    );
+
+VOID
+IopUpdateStreamBufferOutEvent (
+    PSTREAM_BUFFER StreamBuffer
+    );
+
+KSTATUS
+IopGrowStreamBuffer (
+    PSTREAM_BUFFER StreamBuffer
+    );
+
+UINTN
+IopGetStreamBufferGiftSize (
+    PSTREAM_BUFFER StreamBuffer,
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    UINTN ByteCount
+    );
+
+KSTATUS
+IopGiftStreamBufferData (
+    PSTREAM_BUFFER StreamBuffer,
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    UINTN Size,
+    ULONG TimeoutInMilliseconds,
+    PUINTN BytesGifted
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -171,9 +279,22 @@ Return Value:
 
     RtlZeroMemory(StreamBuffer, sizeof(STREAM_BUFFER));
     StreamBuffer->Size = BufferSize;
+    StreamBuffer->MaxSize = BufferSize;
+    if (((Flags & STREAM_BUFFER_FLAG_GROWABLE) != 0) &&
+        (BufferSize < STREAM_BUFFER_MAX_GROWN_SIZE)) {
+
+        StreamBuffer->MaxSize = STREAM_BUFFER_MAX_GROWN_SIZE;
+    }
+
     StreamBuffer->AtomicWriteSize = AtomicWriteSize;
-    StreamBuffer->Lock = KeCreateQueuedLock();
-    if (StreamBuffer->Lock == NULL) {
+    StreamBuffer->ReadLock = KeCreateQueuedLock();
+    if (StreamBuffer->ReadLock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateStreamBufferEnd;
+    }
+
+    StreamBuffer->WriteLock = KeCreateQueuedLock();
+    if (StreamBuffer->WriteLock == NULL) {
         Status = STATUS_INSUFFICIENT_RESOURCES;
         goto CreateStreamBufferEnd;
     }
@@ -204,8 +325,12 @@ Return Value:
 CreateStreamBufferEnd:
     if (!KSUCCESS(Status)) {
         if (StreamBuffer != NULL) {
-            if (StreamBuffer->Lock != NULL) {
-                KeDestroyQueuedLock(StreamBuffer->Lock);
+            if (StreamBuffer->ReadLock != NULL) {
+                KeDestroyQueuedLock(StreamBuffer->ReadLock);
+            }
+
+            if (StreamBuffer->WriteLock != NULL) {
+                KeDestroyQueuedLock(StreamBuffer->WriteLock);
             }
 
             if (StreamBuffer->Buffer != NULL) {
@@ -244,8 +369,14 @@ Return Value:
 
 {
 
-    if (StreamBuffer->Lock != NULL) {
-        KeDestroyQueuedLock(StreamBuffer->Lock);
+    ASSERT(StreamBuffer->Gift == NULL);
+
+    if (StreamBuffer->ReadLock != NULL) {
+        KeDestroyQueuedLock(StreamBuffer->ReadLock);
+    }
+
+    if (StreamBuffer->WriteLock != NULL) {
+        KeDestroyQueuedLock(StreamBuffer->WriteLock);
     }
 
     StreamBuffer->IoState = NULL;
@@ -304,9 +435,12 @@ Return Value:
 {
 
     ULONG BytesAvailable;
-    ULONG BytesReadHere;
+    UINTN BytesReadHere;
     ULONG BytesToRead;
     ULONG EventsMask;
+    PSTREAM_BUFFER_GIFT Gift;
+    UINTN GiftBytes;
+    ULONG NextReadOffset;
     ULONG NextWriteOffset;
     ULONG ReturnedEvents;
     KSTATUS Status;
@@ -345,27 +479,88 @@ Return Value:
         }
 
         //
-        // Multiple threads might have come out of waiting. Acquire the lock.
+        // Multiple threads might have come out of waiting. Acquire the read
+        // lock, which writers never take.
         //
 
-        KeAcquireQueuedLock(StreamBuffer->Lock);
+        KeAcquireQueuedLock(StreamBuffer->ReadLock);
+        NextReadOffset = StreamBuffer->NextReadOffset;
+        NextWriteOffset = StreamBuffer->NextWriteOffset;
 
         //
-        // Start over if there's nothing to read.
+        // Don't look at the data before the write offset that covers it.
         //
 
-        if (StreamBuffer->NextReadOffset == StreamBuffer->NextWriteOffset) {
+        RtlMemoryBarrier();
+
+        //
+        // With the buffer drained, take data from a writer's gift if there is
+        // one.
+        //
+
+        if (NextReadOffset == NextWriteOffset) {
+            Gift = StreamBuffer->Gift;
+            if (Gift != NULL) {
+                GiftBytes = Gift->Size;
+                if (ByteCount < GiftBytes) {
+                    GiftBytes = ByteCount;
+                }
+
+                Status = MmCopyIoBuffer(IoBuffer,
+                                        *BytesRead,
+                                        Gift->IoBuffer,
+                                        Gift->Offset,
+                                        GiftBytes);
+
+                if (KSUCCESS(Status)) {
+                    Gift->Offset += GiftBytes;
+                    Gift->Size -= GiftBytes;
+                    *BytesRead += GiftBytes;
+                    BytesReadHere += GiftBytes;
+                    ByteCount -= GiftBytes;
+
+                    //
+                    // Hand the stream back to the writers once the gift is
+                    // used up, which also wakes the giving writer.
+                    //
+
+                    if (Gift->Size == 0) {
+                        StreamBuffer->Gift = NULL;
+                        RtlMemoryBarrier();
+                        if (((ReturnedEvents & POLL_ERROR_EVENTS) == 0) &&
+                            (IopIsStreamBufferWritable(StreamBuffer) !=
+                             FALSE)) {
+
+                            IoSetIoObjectState(StreamBuffer->IoState,
+                                               POLL_EVENT_OUT,
+                                               TRUE);
+                        }
+                    }
+                }
+
+                if ((ReturnedEvents & POLL_ERROR_EVENTS) == 0) {
+                    IopUpdateStreamBufferInEvent(StreamBuffer);
+                }
+
+                KeReleaseQueuedLock(StreamBuffer->ReadLock);
+                if (!KSUCCESS(Status)) {
+                    return Status;
+                }
+
+                continue;
+            }
 
             //
-            // If the IN flag is set, then that would mean this routine is
-            // busy spinning. Poor form.
+            // Clear the read event, as otherwise this routine would be busy
+            // spinning. A writer may have just set it after an earlier read
+            // took its data.
             //
 
-            ASSERT((NonBlocking != FALSE) ||
-                   ((StreamBuffer->IoState->Events & POLL_ERROR_EVENTS) != 0) ||
-                   ((StreamBuffer->IoState->Events & POLL_EVENT_IN) == 0));
+            if ((ReturnedEvents & POLL_ERROR_EVENTS) == 0) {
+                IopUpdateStreamBufferInEvent(StreamBuffer);
+            }
 
-            KeReleaseQueuedLock(StreamBuffer->Lock);
+            KeReleaseQueuedLock(StreamBuffer->ReadLock);
 
             //
             // If the error event is set, error out.
@@ -398,15 +593,13 @@ Return Value:
         // Wraparounds will be handled later on.
         //
 
-        NextWriteOffset = StreamBuffer->NextWriteOffset;
-
         ASSERT(NextWriteOffset < StreamBuffer->Size);
 
-        if (NextWriteOffset > StreamBuffer->NextReadOffset) {
-            BytesAvailable = NextWriteOffset - StreamBuffer->NextReadOffset;
+        if (NextWriteOffset > NextReadOffset) {
+            BytesAvailable = NextWriteOffset - NextReadOffset;
 
         } else {
-            BytesAvailable = StreamBuffer->Size - StreamBuffer->NextReadOffset;
+            BytesAvailable = StreamBuffer->Size - NextReadOffset;
         }
 
         BytesToRead = BytesAvailable;
@@ -414,30 +607,25 @@ Return Value:
             BytesToRead = ByteCount;
         }
 
-        Status = MmCopyIoBufferData(
-                           IoBuffer,
-                           StreamBuffer->Buffer + StreamBuffer->NextReadOffset,
-                           *BytesRead,
-                           BytesToRead,
-                           TRUE);
+        Status = MmCopyIoBufferData(IoBuffer,
+                                    StreamBuffer->Buffer + NextReadOffset,
+                                    *BytesRead,
+                                    BytesToRead,
+                                    TRUE);
 
         if (!KSUCCESS(Status)) {
-            KeReleaseQueuedLock(StreamBuffer->Lock);
+            KeReleaseQueuedLock(StreamBuffer->ReadLock);
             return Status;
         }
 
-        //
-        // Update the read offset so that it always contains a valid value.
-        //
-
-        if (StreamBuffer->NextReadOffset + BytesToRead == StreamBuffer->Size) {
-            StreamBuffer->NextReadOffset = 0;
+        if (NextReadOffset + BytesToRead == StreamBuffer->Size) {
+            NextReadOffset = 0;
 
         } else {
-            StreamBuffer->NextReadOffset += BytesToRead;
+            NextReadOffset += BytesToRead;
         }
 
-        ASSERT(StreamBuffer->NextReadOffset < StreamBuffer->Size);
+        ASSERT(NextReadOffset < StreamBuffer->Size);
 
         *BytesRead += BytesToRead;
         BytesReadHere += BytesToRead;
@@ -448,13 +636,12 @@ Return Value:
         // content wraps around. Grab the rest of that data if so.
         //
 
-        if ((ByteCount != 0) &&
-            (StreamBuffer->NextReadOffset != NextWriteOffset)) {
+        if ((ByteCount != 0) && (NextReadOffset != NextWriteOffset)) {
 
-            ASSERT(StreamBuffer->NextReadOffset == 0);
-            ASSERT(NextWriteOffset > StreamBuffer->NextReadOffset);
+            ASSERT(NextReadOffset == 0);
+            ASSERT(NextWriteOffset > NextReadOffset);
 
-            BytesAvailable = NextWriteOffset - StreamBuffer->NextReadOffset;
+            BytesAvailable = NextWriteOffset - NextReadOffset;
             BytesToRead = BytesAvailable;
             if (ByteCount < BytesToRead) {
                 BytesToRead = ByteCount;
@@ -466,17 +653,16 @@ Return Value:
             // copy that happened.
             //
 
-            Status = MmCopyIoBufferData(
-                           IoBuffer,
-                           StreamBuffer->Buffer + StreamBuffer->NextReadOffset,
-                           *BytesRead,
-                           BytesToRead,
-                           TRUE);
+            Status = MmCopyIoBufferData(IoBuffer,
+                                        StreamBuffer->Buffer + NextReadOffset,
+                                        *BytesRead,
+                                        BytesToRead,
+                                        TRUE);
 
             if (KSUCCESS(Status)) {
-                StreamBuffer->NextReadOffset += BytesToRead;
+                NextReadOffset += BytesToRead;
 
-                ASSERT(StreamBuffer->NextReadOffset < StreamBuffer->Size);
+                ASSERT(NextReadOffset < StreamBuffer->Size);
 
                 *BytesRead += BytesToRead;
                 BytesReadHere += BytesToRead;
@@ -485,23 +671,30 @@ Return Value:
         }
 
         //
-        // Signal the write event (since more space was just made), and signal
+        // Publish the new read offset only after the data has been copied out,
+        // so that writers don't overwrite it early.
+        //
+
+        RtlMemoryBarrier();
+        StreamBuffer->NextReadOffset = NextReadOffset;
+        RtlMemoryBarrier();
+
+        //
+        // Signal the write event if enough space was just made, and signal
         // the read event if there is still data left to be read. Don't do
         // this if the error events are set, as this is probably a disconnected
         // pipe with some data left in it.
         //
 
         if ((ReturnedEvents & POLL_ERROR_EVENTS) == 0) {
-            IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, TRUE);
-            if (StreamBuffer->NextReadOffset != StreamBuffer->NextWriteOffset) {
-                IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, TRUE);
-
-            } else {
-                IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, FALSE);
+            if (IopIsStreamBufferWritable(StreamBuffer) != FALSE) {
+                IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, TRUE);
             }
+
+            IopUpdateStreamBufferInEvent(StreamBuffer);
         }
 
-        KeReleaseQueuedLock(StreamBuffer->Lock);
+        KeReleaseQueuedLock(StreamBuffer->ReadLock);
 
         //
         // If that second copy failed, now's the time to break out.
@@ -561,18 +754,55 @@ Return Value:
 {
 
     ULONG BytesAvailable;
+    UINTN BytesGifted;
     ULONG BytesToWrite;
     ULONG EventsMask;
+    PIO_BUFFER GiftBuffer;
+    UINTN GiftSize;
+    BOOL LockedCopy;
     ULONG NextReadOffset;
+    ULONG NextWriteOffset;
     ULONG ReturnedEvents;
     KSTATUS Status;
     ULONG TotalBytesAvailable;
 
     *BytesWritten = 0;
     EventsMask = POLL_EVENT_OUT | POLL_ERROR_EVENTS;
+    GiftBuffer = NULL;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
+    //
+    // A blocking write too large to ever fit in the buffer can hand most of
+    // its pages to the reader directly, saving a copy. Lock the pages down so
+    // the reader can get at them from any process.
+    //
+
+    if (((StreamBuffer->Flags & STREAM_BUFFER_FLAG_GIFT_PAGES) != 0) &&
+        (NonBlocking == FALSE) &&
+        (IopGetStreamBufferGiftSize(StreamBuffer, IoBuffer, 0, ByteCount) !=
+         0)) {
+
+        GiftBuffer = IoBuffer;
+        Status = MmValidateIoBuffer(0,
+                                    MAX_ULONGLONG,
+                                    0,
+                                    ByteCount,
+                                    FALSE,
+                                    &GiftBuffer,
+                                    &LockedCopy);
+
+        if ((!KSUCCESS(Status)) ||
+            ((GiftBuffer != IoBuffer) && (LockedCopy == FALSE))) {
+
+            if (GiftBuffer != IoBuffer) {
+                MmFreeIoBuffer(GiftBuffer);
+            }
+
+            GiftBuffer = NULL;
+        }
+    }
+
     Status = STATUS_SUCCESS;
     while (ByteCount != 0) {
         if (NonBlocking == FALSE) {
@@ -593,51 +823,78 @@ Return Value:
         }
 
         //
-        // Multiple threads might have come out of waiting since read and
-        // write aren't synchronized.
+        // Multiple threads might have come out of waiting. Acquire the write
+        // lock, which readers never take.
         //
 
-        KeAcquireQueuedLock(StreamBuffer->Lock);
+        KeAcquireQueuedLock(StreamBuffer->WriteLock);
 
         //
-        // Figure out how much room there is.
+        // Nothing else can be written while a gift is outstanding, as its data
+        // has to be read first.
         //
 
-        NextReadOffset = StreamBuffer->NextReadOffset;
-
-        ASSERT(NextReadOffset < StreamBuffer->Size);
-
-        if (NextReadOffset <= StreamBuffer->NextWriteOffset) {
+        NextWriteOffset = StreamBuffer->NextWriteOffset;
+        NextReadOffset = NextWriteOffset;
+        BytesAvailable = 0;
+        TotalBytesAvailable = 0;
+        if (StreamBuffer->Gift == NULL) {
 
             //
-            // The total available is the entire buffer (minus one) minus the
-            // distance between the read and write pointers.
+            // Don't overwrite anything before the read offset that frees it.
             //
 
-            TotalBytesAvailable = (StreamBuffer->Size - 1) -
-                                  (StreamBuffer->NextWriteOffset -
-                                   NextReadOffset);
+            NextReadOffset = StreamBuffer->NextReadOffset;
+            RtlMemoryBarrier();
+            TotalBytesAvailable = IopGetStreamBufferSpace(StreamBuffer,
+                                                          NextReadOffset,
+                                                          NextWriteOffset,
+                                                          &BytesAvailable);
 
             //
-            // The first copy goes from the next write offset to the end, but
-            // if the read offset is right at zero then the padding byte is at
-            // the end there.
+            // Grow the buffer if the write won't fit in it.
             //
 
-            BytesAvailable = StreamBuffer->Size - StreamBuffer->NextWriteOffset;
-            if (NextReadOffset == 0) {
-                BytesAvailable -= 1;
-            }
+            if ((TotalBytesAvailable < ByteCount) &&
+                (StreamBuffer->Size < StreamBuffer->MaxSize) &&
+                (KSUCCESS(IopGrowStreamBuffer(StreamBuffer)))) {
 
-        } else {
+                NextReadOffset = StreamBuffer->NextReadOffset;
+                NextWriteOffset = StreamBuffer->NextWriteOffset;
+                TotalBytesAvailable = IopGetStreamBufferSpace(StreamBuffer,
+                                                              NextReadOffset,
+                                                              NextWriteOffset,
+                                                              &BytesAvailable);
+            }
 
             //
-            // The total available space is the distance between the write
-            // catching up to the read, minus the one buffer byte.
+            // If it still won't fit, hand the leading pages to the reader. The
+            // gift routine releases the write lock.
             //
 
-            BytesAvailable = NextReadOffset - StreamBuffer->NextWriteOffset - 1;
-            TotalBytesAvailable = BytesAvailable;
+            if ((TotalBytesAvailable < ByteCount) && (GiftBuffer != NULL)) {
+                GiftSize = IopGetStreamBufferGiftSize(StreamBuffer,
+                                                      IoBuffer,
+                                                      *BytesWritten,
+                                                      ByteCount);
+
+                if (GiftSize != 0) {
+                    Status = IopGiftStreamBufferData(StreamBuffer,
+                                                     GiftBuffer,
+                                                     *BytesWritten,
+                                                     GiftSize,
+                                                     TimeoutInMilliseconds,
+                                                     &BytesGifted);
+
+                    *BytesWritten += BytesGifted;
+                    ByteCount -= BytesGifted;
+                    if (!KSUCCESS(Status)) {
+                        break;
+                    }
+
+                    continue;
+                }
+            }
         }
 
         //
@@ -649,8 +906,8 @@ Return Value:
         if ((TotalBytesAvailable < ByteCount) &&
             (TotalBytesAvailable < StreamBuffer->AtomicWriteSize)) {
 
-            IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, FALSE);
-            KeReleaseQueuedLock(StreamBuffer->Lock);
+            IopUpdateStreamBufferOutEvent(StreamBuffer);
+            KeReleaseQueuedLock(StreamBuffer->WriteLock);
             if (NonBlocking == FALSE) {
                 continue;
 
@@ -675,30 +932,22 @@ Return Value:
             BytesToWrite = ByteCount;
         }
 
-        Status = MmCopyIoBufferData(
-                          IoBuffer,
-                          StreamBuffer->Buffer + StreamBuffer->NextWriteOffset,
-                          *BytesWritten,
-                          BytesToWrite,
-                          FALSE);
+        Status = MmCopyIoBufferData(IoBuffer,
+                                    StreamBuffer->Buffer + NextWriteOffset,
+                                    *BytesWritten,
+                                    BytesToWrite,
+                                    FALSE);
 
         if (!KSUCCESS(Status)) {
-            KeReleaseQueuedLock(StreamBuffer->Lock);
-            return Status;
+            KeReleaseQueuedLock(StreamBuffer->WriteLock);
+            break;
         }
 
-        //
-        // Update the next write pointer in a manner that ensures its value is
-        // always valid.
-        //
-
-        if (StreamBuffer->NextWriteOffset + BytesToWrite ==
-            StreamBuffer->Size) {
-
-            StreamBuffer->NextWriteOffset = 0;
+        if (NextWriteOffset + BytesToWrite == StreamBuffer->Size) {
+            NextWriteOffset = 0;
 
         } else {
-            StreamBuffer->NextWriteOffset += BytesToWrite;
+            NextWriteOffset += BytesToWrite;
         }
 
         *BytesWritten += BytesToWrite;
@@ -711,13 +960,12 @@ Return Value:
         //
 
         if ((ByteCount != 0) &&
-            (((StreamBuffer->NextWriteOffset + 1) % StreamBuffer->Size) !=
-                                                             NextReadOffset)) {
+            (((NextWriteOffset + 1) % StreamBuffer->Size) != NextReadOffset)) {
 
-            ASSERT(StreamBuffer->NextWriteOffset == 0);
-            ASSERT(NextReadOffset > StreamBuffer->NextWriteOffset + 1);
+            ASSERT(NextWriteOffset == 0);
+            ASSERT(NextReadOffset > NextWriteOffset + 1);
 
-            BytesAvailable = NextReadOffset - StreamBuffer->NextWriteOffset - 1;
+            BytesAvailable = NextReadOffset - NextWriteOffset - 1;
             BytesToWrite = BytesAvailable;
             if (ByteCount < BytesToWrite) {
                 BytesToWrite = ByteCount;
@@ -729,17 +977,16 @@ Return Value:
             // copy that happened.
             //
 
-            Status = MmCopyIoBufferData(
-                          IoBuffer,
-                          StreamBuffer->Buffer + StreamBuffer->NextWriteOffset,
-                          *BytesWritten,
-                          BytesToWrite,
-                          FALSE);
+            Status = MmCopyIoBufferData(IoBuffer,
+                                        StreamBuffer->Buffer + NextWriteOffset,
+                                        *BytesWritten,
+                                        BytesToWrite,
+                                        FALSE);
 
             if (KSUCCESS(Status)) {
-                StreamBuffer->NextWriteOffset += BytesToWrite;
+                NextWriteOffset += BytesToWrite;
 
-                ASSERT(StreamBuffer->NextWriteOffset < StreamBuffer->Size);
+                ASSERT(NextWriteOffset < StreamBuffer->Size);
 
                 *BytesWritten += BytesToWrite;
                 ByteCount -= BytesToWrite;
@@ -747,33 +994,34 @@ Return Value:
             }
         }
 
+        ASSERT(TotalBytesAvailable < StreamBuffer->Size);
+
         //
-        // Signal the read event (since there's now stuff to read), and signal
+        // Publish the new write offset only after the data is in place, then
+        // signal the read event (since there's now stuff to read), and signal
         // the write event if there is still space left.
         //
 
+        RtlMemoryBarrier();
+        StreamBuffer->NextWriteOffset = NextWriteOffset;
+        RtlMemoryBarrier();
         IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, TRUE);
-
-        ASSERT(TotalBytesAvailable < StreamBuffer->Size);
-
-        if (TotalBytesAvailable >= StreamBuffer->AtomicWriteSize) {
-            IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, TRUE);
-
-        } else {
-            IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, FALSE);
-        }
-
-        KeReleaseQueuedLock(StreamBuffer->Lock);
+        IopUpdateStreamBufferOutEvent(StreamBuffer);
+        KeReleaseQueuedLock(StreamBuffer->WriteLock);
 
         //
         // If that second copy failed, now is the time to exit.
         //
 
         if (!KSUCCESS(Status)) {
-            return Status;
+            break;
         }
     }
 
+    if ((GiftBuffer != NULL) && (GiftBuffer != IoBuffer)) {
+        MmFreeIoBuffer(GiftBuffer);
+    }
+
     return Status;
 }
 
@@ -801,15 +1049,107 @@ Return Value:
 
 {
 
-    ULONG TotalBytesAvailable;
+    KeAcquireQueuedLock(StreamBuffer->WriteLock);
+    KeAcquireQueuedLock(StreamBuffer->ReadLock);
+
+    //
+    // Signal the write event if there's space to be written.
+    //
 
-    KeAcquireQueuedLock(StreamBuffer->Lock);
+    if (IopIsStreamBufferWritable(StreamBuffer) != FALSE) {
+        IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, TRUE);
+
+    } else {
+        IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, FALSE);
+    }
 
     //
-    // Figure out how much space there is.
+    // Signal the read event if there's data in there.
     //
 
-    if (StreamBuffer->NextReadOffset <= StreamBuffer->NextWriteOffset) {
+    if (IopIsStreamBufferReadable(StreamBuffer) != FALSE) {
+        IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, TRUE);
+
+    } else {
+        IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, FALSE);
+    }
+
+    KeReleaseQueuedLock(StreamBuffer->ReadLock);
+    KeReleaseQueuedLock(StreamBuffer->WriteLock);
+    return STATUS_SUCCESS;
+}
+
+PIO_OBJECT_STATE
+IoStreamBufferGetIoObjectState (
+    PSTREAM_BUFFER StreamBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the I/O state for a stream buffer.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer.
+
+Return Value:
+
+    Returns a pointer to the stream buffer's I/O object state.
+
+--*/
+
+{
+
+    return StreamBuffer->IoState;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+ULONG
+IopGetStreamBufferSpace (
+    PSTREAM_BUFFER StreamBuffer,
+    ULONG NextReadOffset,
+    ULONG NextWriteOffset,
+    PULONG ContiguousSpace
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines how much room there is in a stream buffer. The
+    caller must hold either lock so that the buffer size is stable.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer.
+
+    NextReadOffset - Supplies the read offset to use.
+
+    NextWriteOffset - Supplies the write offset to use.
+
+    ContiguousSpace - Supplies an optional pointer where the number of bytes
+        that can be written at the write offset without wrapping around will be
+        returned.
+
+Return Value:
+
+    Returns the total number of bytes that can be written.
+
+--*/
+
+{
+
+    ULONG BytesAvailable;
+    ULONG TotalBytesAvailable;
+
+    ASSERT(NextReadOffset < StreamBuffer->Size);
+
+    if (NextReadOffset <= NextWriteOffset) {
 
         //
         // The total available is the entire buffer (minus one) minus the
@@ -817,8 +1157,18 @@ Return Value:
         //
 
         TotalBytesAvailable = (StreamBuffer->Size - 1) -
-                              (StreamBuffer->NextWriteOffset -
-                               StreamBuffer->NextReadOffset);
+                              (NextWriteOffset - NextReadOffset);
+
+        //
+        // The first copy goes from the next write offset to the end, but
+        // if the read offset is right at zero then the padding byte is at
+        // the end there.
+        //
+
+        BytesAvailable = StreamBuffer->Size - NextWriteOffset;
+        if (NextReadOffset == 0) {
+            BytesAvailable -= 1;
+        }
 
     } else {
 
@@ -827,63 +1177,434 @@ Return Value:
         // catching up to the read, minus the one buffer byte.
         //
 
-        TotalBytesAvailable = StreamBuffer->NextReadOffset -
-                              StreamBuffer->NextWriteOffset - 1;
+        BytesAvailable = NextReadOffset - NextWriteOffset - 1;
+        TotalBytesAvailable = BytesAvailable;
+    }
+
+    if (ContiguousSpace != NULL) {
+        *ContiguousSpace = BytesAvailable;
+    }
+
+    return TotalBytesAvailable;
+}
+
+BOOL
+IopIsStreamBufferReadable (
+    PSTREAM_BUFFER StreamBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a stream buffer has data to read.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer.
+
+Return Value:
+
+    TRUE if there is data in the buffer or a gift pending.
+
+    FALSE if the stream is empty.
+
+--*/
+
+{
+
+    if ((StreamBuffer->NextReadOffset != StreamBuffer->NextWriteOffset) ||
+        (StreamBuffer->Gift != NULL)) {
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+BOOL
+IopIsStreamBufferWritable (
+    PSTREAM_BUFFER StreamBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a stream buffer can take an atomic write.
+    The caller must hold either lock.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer.
+
+Return Value:
+
+    TRUE if at least the atomic write size can be written.
+
+    FALSE if the buffer is too full or a gift is pending.
+
+--*/
+
+{
+
+    ULONG TotalBytesAvailable;
+
+    if (StreamBuffer->Gift != NULL) {
+        return FALSE;
+    }
+
+    TotalBytesAvailable = IopGetStreamBufferSpace(
+                                               StreamBuffer,
+                                               StreamBuffer->NextReadOffset,
+                                               StreamBuffer->NextWriteOffset,
+                                               NULL);
+
+    if (TotalBytesAvailable >= StreamBuffer->AtomicWriteSize) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+VOID
+IopUpdateStreamBufferInEvent (
+    PSTREAM_BUFFER StreamBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets or clears the read event of a stream buffer based on
+    whether there is anything to read. The caller must hold the read lock.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (IopIsStreamBufferReadable(StreamBuffer) != FALSE) {
+        IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, TRUE);
+        return;
     }
 
     //
-    // Signal the write event if there's space to be written.
+    // A writer may add data and set the event right before it is cleared
+    // here. Look again afterwards so that the wakeup is not lost.
     //
 
-    if (TotalBytesAvailable >= StreamBuffer->AtomicWriteSize) {
+    IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, FALSE);
+    RtlMemoryBarrier();
+    if (IopIsStreamBufferReadable(StreamBuffer) != FALSE) {
+        IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, TRUE);
+    }
+
+    return;
+}
+
+VOID
+IopUpdateStreamBufferOutEvent (
+    PSTREAM_BUFFER StreamBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets or clears the write event of a stream buffer based on
+    whether there is room to write. The caller must hold the write lock.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (IopIsStreamBufferWritable(StreamBuffer) != FALSE) {
         IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, TRUE);
+        return;
+    }
 
-    } else {
-        IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, FALSE);
+    //
+    // A reader may free space and set the event right before it is cleared
+    // here. Look again afterwards so that the wakeup is not lost.
+    //
+
+    IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, FALSE);
+    RtlMemoryBarrier();
+    if (IopIsStreamBufferWritable(StreamBuffer) != FALSE) {
+        IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, TRUE);
+    }
+
+    return;
+}
+
+KSTATUS
+IopGrowStreamBuffer (
+    PSTREAM_BUFFER StreamBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine doubles the size of a stream buffer, up to its maximum size.
+    The caller must hold the write lock and there must be no gift pending.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG FirstSize;
+    PVOID NewBuffer;
+    ULONG NewSize;
+    ULONG NextReadOffset;
+    ULONG NextWriteOffset;
+    PVOID OldBuffer;
+    ULONG UsedSize;
+
+    ASSERT(StreamBuffer->Size < StreamBuffer->MaxSize);
+    ASSERT(StreamBuffer->Gift == NULL);
+
+    NewSize = ((StreamBuffer->Size - 1) * 2) + 1;
+    if (NewSize > StreamBuffer->MaxSize) {
+        NewSize = StreamBuffer->MaxSize;
+    }
+
+    NewBuffer = MmAllocatePagedPool(NewSize, FI_ALLOCATION_TAG);
+    if (NewBuffer == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
     }
 
     //
-    // Signal the read event if there's data in there.
+    // Keep readers out while the contents move to the start of the new
+    // buffer.
     //
 
-    if (TotalBytesAvailable != StreamBuffer->Size - 1) {
-        IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, TRUE);
+    KeAcquireQueuedLock(StreamBuffer->ReadLock);
+    OldBuffer = StreamBuffer->Buffer;
+    NextReadOffset = StreamBuffer->NextReadOffset;
+    NextWriteOffset = StreamBuffer->NextWriteOffset;
+    if (NextReadOffset <= NextWriteOffset) {
+        UsedSize = NextWriteOffset - NextReadOffset;
+        RtlCopyMemory(NewBuffer, OldBuffer + NextReadOffset, UsedSize);
 
     } else {
-        IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, FALSE);
+        FirstSize = StreamBuffer->Size - NextReadOffset;
+        RtlCopyMemory(NewBuffer, OldBuffer + NextReadOffset, FirstSize);
+        RtlCopyMemory(NewBuffer + FirstSize, OldBuffer, NextWriteOffset);
+        UsedSize = FirstSize + NextWriteOffset;
     }
 
-    KeReleaseQueuedLock(StreamBuffer->Lock);
+    StreamBuffer->Buffer = NewBuffer;
+    StreamBuffer->Size = NewSize;
+    StreamBuffer->NextReadOffset = 0;
+    StreamBuffer->NextWriteOffset = UsedSize;
+    KeReleaseQueuedLock(StreamBuffer->ReadLock);
+    MmFreePagedPool(OldBuffer);
     return STATUS_SUCCESS;
 }
 
-PIO_OBJECT_STATE
-IoStreamBufferGetIoObjectState (
-    PSTREAM_BUFFER StreamBuffer
+UINTN
+IopGetStreamBufferGiftSize (
+    PSTREAM_BUFFER StreamBuffer,
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    UINTN ByteCount
     )
 
 /*++
 
 Routine Description:
 
-    This routine returns the I/O state for a stream buffer.
+    This routine determines how much of a write can be handed to readers
+    directly. Only whole, page aligned pages are handed over, and enough is
+    held back to fill the buffer at its largest size, so the writer never
+    waits on readers for longer than it would have if everything had been
+    copied through the buffer.
 
 Arguments:
 
     StreamBuffer - Supplies a pointer to the stream buffer.
 
+    IoBuffer - Supplies a pointer to the I/O buffer being written.
+
+    Offset - Supplies the offset into the I/O buffer of the remaining data.
+
+    ByteCount - Supplies the number of bytes remaining to be written.
+
 Return Value:
 
-    Returns a pointer to the stream buffer's I/O object state.
+    Returns the number of bytes to hand over, or 0 if the write does not
+    qualify.
 
 --*/
 
 {
 
-    return StreamBuffer->IoState;
+    PVOID Address;
+    UINTN GiftSize;
+    ULONG PageSize;
+
+    if (ByteCount <= StreamBuffer->MaxSize - 1) {
+        return 0;
+    }
+
+    PageSize = MmPageSize();
+    GiftSize = ALIGN_RANGE_DOWN(ByteCount - (StreamBuffer->MaxSize - 1),
+                                PageSize);
+
+    if ((GiftSize < STREAM_BUFFER_MINIMUM_GIFT_SIZE) ||
+        (IoBuffer->FragmentCount != 1)) {
+
+        return 0;
+    }
+
+    Address = IoBuffer->Fragment[0].VirtualAddress +
+              MmGetIoBufferCurrentOffset(IoBuffer) +
+              Offset;
+
+    if (IS_POINTER_ALIGNED(Address, PageSize) == FALSE) {
+        return 0;
+    }
+
+    return GiftSize;
 }
 
-//
-// --------------------------------------------------------- Internal Functions
-//
+KSTATUS
+IopGiftStreamBufferData (
+    PSTREAM_BUFFER StreamBuffer,
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    UINTN Size,
+    ULONG TimeoutInMilliseconds,
+    PUINTN BytesGifted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands part of a write directly to readers, who copy it
+    straight out of the writer's pages, and waits for them to consume it. The
+    caller must hold the write lock, which this routine releases.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer.
+
+    IoBuffer - Supplies a pointer to the writer's I/O buffer, which must be
+        locked in memory.
+
+    Offset - Supplies the offset into the I/O buffer where the data begins.
+
+    Size - Supplies the number of bytes to hand over.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds to wait for
+        readers to consume the data.
+
+    BytesGifted - Supplies a pointer where the number of bytes consumed by
+        readers will be returned. This may be less than the size on failure.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    STREAM_BUFFER_GIFT Gift;
+    ULONG ReturnedEvents;
+    KSTATUS Status;
+
+    ASSERT(StreamBuffer->Gift == NULL);
+
+    Gift.IoBuffer = IoBuffer;
+    Gift.Offset = Offset;
+    Gift.Size = Size;
+
+    //
+    // Clear the write event before publishing the gift so that the signal
+    // from the reader that finishes it cannot be lost.
+    //
+
+    IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, FALSE);
+    RtlMemoryBarrier();
+    StreamBuffer->Gift = &Gift;
+    RtlMemoryBarrier();
+    IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, TRUE);
+    KeReleaseQueuedLock(StreamBuffer->WriteLock);
+    while (TRUE) {
+        Status = IoWaitForIoObjectState(StreamBuffer->IoState,
+                                        POLL_EVENT_OUT | POLL_ERROR_EVENTS,
+                                        TRUE,
+                                        TimeoutInMilliseconds,
+                                        &ReturnedEvents);
+
+        //
+        // Readers only touch the gift with the read lock held.
+        //
+
+        KeAcquireQueuedLock(StreamBuffer->ReadLock);
+        if (Gift.Size == 0) {
+
+            ASSERT(StreamBuffer->Gift != &Gift);
+
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        if ((KSUCCESS(Status)) &&
+            ((ReturnedEvents & POLL_ERROR_EVENTS) != 0)) {
+
+            Status = STATUS_BROKEN_PIPE;
+        }
+
+        if (!KSUCCESS(Status)) {
+            StreamBuffer->Gift = NULL;
+            break;
+        }
+
+        IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, FALSE);
+        KeReleaseQueuedLock(StreamBuffer->ReadLock);
+    }
+
+    KeReleaseQueuedLock(StreamBuffer->ReadLock);
+    *BytesGifted = Size - Gift.Size;
+
+    //
+    // If the wait was cut short, let other writers back in.
+    //
+
+    if ((!KSUCCESS(Status)) && (Status != STATUS_BROKEN_PIPE)) {
+        KeAcquireQueuedLock(StreamBuffer->WriteLock);
+        IopUpdateStreamBufferOutEvent(StreamBuffer);
+        KeReleaseQueuedLock(StreamBuffer->WriteLock);
+    }
+
+    return Status;
+}
 
@@ -0,0 +1,59 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    Page Cache Index Test
+
+Abstract:
+
+    This program compiles the kernel page cache index into a user mode
+    application for the purposes of testing it.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Test
+
+--*/
+
+from menv import application;
+
+function build() {
+    var buildApp;
+    var buildLibs;
+    var entries;
+    var sources;
+
+    sources = [
+        "stubs.c",
+        "testpc.c"
+    ];
+
+    buildLibs = [
+        "kernel/io:build_pcindex",
+        "lib/rtl/urtl:build_rtlc",
+        "lib/rtl/base:build_basertl"
+    ];
+
+    buildApp = {
+        "label": "build_testpc",
+        "output": "testpc",
+        "inputs": sources + buildLibs,
+        "build": true,
+        "prefix": "build"
+    };
+
+    entries = application(buildApp);
+    return entries;
+}
+
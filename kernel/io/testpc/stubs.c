@@ -0,0 +1,258 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    stubs.c
+
+Abstract:
+
+    This module implements stub routines so the page cache index can be
+    compiled in user mode.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Test
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "testpc.h"
+
+#include <stdlib.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines the stand-in for a block allocator.
+
+Members:
+
+    BlockSize - Stores the size of each block.
+
+    Outstanding - Stores the number of blocks allocated and not yet freed.
+
+--*/
+
+struct _BLOCK_ALLOCATOR {
+    ULONG BlockSize;
+    ULONG Outstanding;
+};
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+PBLOCK_ALLOCATOR
+MmCreateBlockAllocator (
+    ULONG BlockSize,
+    ULONG Alignment,
+    ULONG ExpansionCount,
+    ULONG Flags,
+    ULONG Tag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a memory block allocator.
+
+Arguments:
+
+    BlockSize - Supplies the size of allocations that this block allocator
+        doles out.
+
+    Alignment - Supplies the required address alignment, in bytes, for each
+        allocation.
+
+    ExpansionCount - Supplies the number of blocks to expand the pool by when
+        out of free blocks.
+
+    Flags - Supplies a bitfield of flags governing the creation and behavior of
+        the block allocator.
+
+    Tag - Supplies an identifier to associate with the block allocations.
+
+Return Value:
+
+    Returns a pointer to the block allocator on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    PBLOCK_ALLOCATOR Allocator;
+
+    Allocator = calloc(1, sizeof(BLOCK_ALLOCATOR));
+    if (Allocator == NULL) {
+        return NULL;
+    }
+
+    Allocator->BlockSize = BlockSize;
+    return Allocator;
+}
+
+VOID
+MmDestroyBlockAllocator (
+    PBLOCK_ALLOCATOR Allocator
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a block allocator.
+
+Arguments:
+
+    Allocator - Supplies a pointer to the allocator to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    free(Allocator);
+    return;
+}
+
+PVOID
+MmAllocateBlock (
+    PBLOCK_ALLOCATOR Allocator,
+    PPHYSICAL_ADDRESS AllocationPhysicalAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to allocate a block from the given block allocator.
+
+Arguments:
+
+    Allocator - Supplies a pointer to the allocator to allocate the block of
+        memory from.
+
+    AllocationPhysicalAddress - Supplies an optional pointer where the physical
+        address of the allocation is returned. This is not supported here.
+
+Return Value:
+
+    Returns an allocation of fixed size (defined when the block allocator was
+    created) on success.
+
+    NULL on failure.
+
+--*/
+
+{
+
+    PVOID Block;
+
+    Block = malloc(Allocator->BlockSize);
+    if (Block != NULL) {
+        Allocator->Outstanding += 1;
+    }
+
+    return Block;
+}
+
+VOID
+MmFreeBlock (
+    PBLOCK_ALLOCATOR Allocator,
+    PVOID Allocation
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees an allocated block back into the block allocator.
+
+Arguments:
+
+    Allocator - Supplies a pointer to the allocator that originally doled out
+        the allocation.
+
+    Allocation - Supplies a pointer to the allocation to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Allocator->Outstanding -= 1;
+    free(Allocation);
+    return;
+}
+
+ULONG
+TestGetOutstandingBlocks (
+    PBLOCK_ALLOCATOR Allocator
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the number of blocks allocated and not yet freed.
+
+Arguments:
+
+    Allocator - Supplies a pointer to the allocator.
+
+Return Value:
+
+    Returns the number of outstanding blocks.
+
+--*/
+
+{
+
+    return Allocator->Outstanding;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
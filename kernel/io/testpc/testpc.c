@@ -0,0 +1,833 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    testpc.c
+
+Abstract:
+
+    This module implements the test cases for the page cache index, checking
+    lookups, tags and range gathers against a simple sorted array.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Test
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "../iop.h"
+#include "../pagecach.h"
+#include "testpc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define TEST_DENSE_KEY_COUNT 300
+#define TEST_SPARSE_KEY_COUNT 400
+#define TEST_RANDOM_GATHER_COUNT 20000
+#define TEST_GATHER_MAX 512
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines an entry in the test's model of the index.
+
+Members:
+
+    Key - Stores the key of the entry.
+
+    Present - Stores a boolean indicating if the entry is in the index.
+
+    Dirty - Stores a boolean indicating if the entry has the dirty tag.
+
+--*/
+
+typedef struct _TEST_ENTRY {
+    ULONGLONG Key;
+    BOOL Present;
+    BOOL Dirty;
+} TEST_ENTRY, *PTEST_ENTRY;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+ULONG
+TestDenseIndex (
+    VOID
+    );
+
+ULONG
+TestSparseIndex (
+    VOID
+    );
+
+ULONG
+TestInsertEntries (
+    PPAGE_CACHE_INDEX Index,
+    PTEST_ENTRY Entries,
+    ULONG EntryCount
+    );
+
+ULONG
+TestRemoveEntries (
+    PPAGE_CACHE_INDEX Index,
+    PTEST_ENTRY Entries,
+    ULONG EntryCount,
+    BOOL RemoveAll
+    );
+
+ULONG
+TestCheckGather (
+    PPAGE_CACHE_INDEX Index,
+    PTEST_ENTRY Entries,
+    ULONG EntryCount,
+    ULONGLONG FirstKey,
+    ULONGLONG LastKey,
+    ULONG Tag,
+    ULONG Count
+    );
+
+ULONGLONG
+TestRandomKey (
+    VOID
+    );
+
+INT
+TestCompareEntries (
+    const VOID *Left,
+    const VOID *Right
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+extern PBLOCK_ALLOCATOR IoPageCacheIndexNodeAllocator;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INT
+main (
+    INT ArgumentCount,
+    CHAR **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for the page cache index test program. It
+    executes the tests.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of arguments specified on the command
+        line.
+
+    Arguments - Supplies an array of strings representing the command line
+        arguments.
+
+Return Value:
+
+    returns 0 on success, or nonzero on failure.
+
+--*/
+
+{
+
+    ULONG Failures;
+    time_t Seed;
+    KSTATUS Status;
+    ULONG TotalTestsFailed;
+
+    Seed = time(NULL);
+    srand(Seed);
+    TotalTestsFailed = 0;
+    Status = IopInitializePageCacheIndexAllocator();
+    if (!KSUCCESS(Status)) {
+        printf("Failed to initialize index allocator: %d\n", Status);
+        return 1;
+    }
+
+    Failures = TestDenseIndex();
+    if (Failures != 0) {
+        printf("\nDense index test had %d failures.\n", Failures);
+    }
+
+    TotalTestsFailed += Failures;
+    Failures = TestSparseIndex();
+    if (Failures != 0) {
+        printf("\nSparse index test had %d failures.\n", Failures);
+    }
+
+    TotalTestsFailed += Failures;
+    IopDestroyPageCacheIndexAllocator();
+
+    //
+    // Tests are over, print results.
+    //
+
+    if (TotalTestsFailed != 0) {
+        printf("Seed was %lu\n", (long unsigned int)Seed);
+        printf("*** %d Failure(s) in page cache index test. ***\n",
+               TotalTestsFailed);
+
+        return 1;
+    }
+
+    printf("All page cache index tests passed.\n");
+    return 0;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+ULONG
+TestDenseIndex (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests an index holding a run of consecutive keys, gathering
+    from every starting key so that ranges begin in the middle of leaves.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Count;
+    PTEST_ENTRY Entries;
+    ULONG Failures;
+    ULONGLONG FirstKey;
+    PAGE_CACHE_INDEX Index;
+    ULONG KeyIndex;
+    ULONG Span;
+
+    Failures = 0;
+    INITIALIZE_PAGE_CACHE_INDEX(&Index);
+    Entries = calloc(TEST_DENSE_KEY_COUNT, sizeof(TEST_ENTRY));
+    if (Entries == NULL) {
+        return 1;
+    }
+
+    for (KeyIndex = 0; KeyIndex < TEST_DENSE_KEY_COUNT; KeyIndex += 1) {
+        Entries[KeyIndex].Key = KeyIndex;
+        if (((KeyIndex % 10) == 0) || ((KeyIndex % 7) == 3)) {
+            Entries[KeyIndex].Dirty = TRUE;
+        }
+    }
+
+    Failures += TestInsertEntries(&Index, Entries, TEST_DENSE_KEY_COUNT);
+    for (FirstKey = 0; FirstKey < TEST_DENSE_KEY_COUNT + 10; FirstKey += 1) {
+        for (Span = 0; Span < 130; Span += 7) {
+            for (Count = 1; Count <= TEST_GATHER_MAX; Count *= 4) {
+                Failures += TestCheckGather(&Index,
+                                            Entries,
+                                            TEST_DENSE_KEY_COUNT,
+                                            FirstKey,
+                                            FirstKey + Span,
+                                            PAGE_CACHE_INDEX_NO_TAG,
+                                            Count);
+
+                Failures += TestCheckGather(&Index,
+                                            Entries,
+                                            TEST_DENSE_KEY_COUNT,
+                                            FirstKey,
+                                            FirstKey + Span,
+                                            PageCacheIndexTagDirty,
+                                            Count);
+            }
+        }
+    }
+
+    //
+    // Punch holes in the run and check again.
+    //
+
+    Failures += TestRemoveEntries(&Index,
+                                  Entries,
+                                  TEST_DENSE_KEY_COUNT,
+                                  FALSE);
+
+    for (FirstKey = 0; FirstKey < TEST_DENSE_KEY_COUNT + 10; FirstKey += 1) {
+        Failures += TestCheckGather(&Index,
+                                    Entries,
+                                    TEST_DENSE_KEY_COUNT,
+                                    FirstKey,
+                                    MAX_ULONGLONG,
+                                    PAGE_CACHE_INDEX_NO_TAG,
+                                    TEST_GATHER_MAX);
+
+        Failures += TestCheckGather(&Index,
+                                    Entries,
+                                    TEST_DENSE_KEY_COUNT,
+                                    FirstKey,
+                                    MAX_ULONGLONG,
+                                    PageCacheIndexTagDirty,
+                                    16);
+    }
+
+    Failures += TestRemoveEntries(&Index,
+                                  Entries,
+                                  TEST_DENSE_KEY_COUNT,
+                                  TRUE);
+
+    if (Index.Root != NULL) {
+        printf("Index root not NULL after removing all entries.\n");
+        Failures += 1;
+    }
+
+    if (TestGetOutstandingBlocks(IoPageCacheIndexNodeAllocator) != 0) {
+        printf("%d index nodes leaked.\n",
+               TestGetOutstandingBlocks(IoPageCacheIndexNodeAllocator));
+
+        Failures += 1;
+    }
+
+    free(Entries);
+    return Failures;
+}
+
+ULONG
+TestSparseIndex (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests an index holding keys scattered across the whole key
+    space, including clusters of nearby keys, against random range gathers.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Count;
+    PTEST_ENTRY Entries;
+    ULONG Failures;
+    ULONGLONG FirstKey;
+    ULONG GatherIndex;
+    PAGE_CACHE_INDEX Index;
+    ULONG KeyIndex;
+    ULONGLONG LastKey;
+    ULONG Tag;
+
+    Failures = 0;
+    INITIALIZE_PAGE_CACHE_INDEX(&Index);
+    Entries = calloc(TEST_SPARSE_KEY_COUNT, sizeof(TEST_ENTRY));
+    if (Entries == NULL) {
+        return 1;
+    }
+
+    //
+    // Make half the keys random and the other half close to an earlier key,
+    // then drop any duplicates.
+    //
+
+    for (KeyIndex = 0; KeyIndex < TEST_SPARSE_KEY_COUNT; KeyIndex += 1) {
+        if ((KeyIndex < 2) || ((rand() & 1) == 0)) {
+            Entries[KeyIndex].Key = TestRandomKey();
+
+        } else {
+            Entries[KeyIndex].Key = Entries[rand() % KeyIndex].Key +
+                                    (rand() % 200);
+        }
+
+        Entries[KeyIndex].Dirty = ((rand() % 3) == 0);
+    }
+
+    qsort(Entries,
+          TEST_SPARSE_KEY_COUNT,
+          sizeof(TEST_ENTRY),
+          TestCompareEntries);
+
+    for (KeyIndex = 1; KeyIndex < TEST_SPARSE_KEY_COUNT; KeyIndex += 1) {
+        if (Entries[KeyIndex].Key <= Entries[KeyIndex - 1].Key) {
+            Entries[KeyIndex].Key = Entries[KeyIndex - 1].Key + 1;
+        }
+    }
+
+    Failures += TestInsertEntries(&Index, Entries, TEST_SPARSE_KEY_COUNT);
+    for (GatherIndex = 0;
+         GatherIndex < TEST_RANDOM_GATHER_COUNT;
+         GatherIndex += 1) {
+
+        if ((GatherIndex == TEST_RANDOM_GATHER_COUNT / 2) &&
+            (Failures == 0)) {
+
+            Failures += TestRemoveEntries(&Index,
+                                          Entries,
+                                          TEST_SPARSE_KEY_COUNT,
+                                          FALSE);
+        }
+
+        //
+        // Start near an existing key most of the time, since that is where
+        // off-by-a-few mistakes show up.
+        //
+
+        KeyIndex = rand() % TEST_SPARSE_KEY_COUNT;
+        if ((rand() % 4) == 0) {
+            FirstKey = TestRandomKey();
+
+        } else {
+            FirstKey = Entries[KeyIndex].Key - (rand() % 3) + (rand() % 70);
+        }
+
+        LastKey = FirstKey + TestRandomKey();
+        if (LastKey < FirstKey) {
+            LastKey = MAX_ULONGLONG;
+        }
+
+        Count = (rand() % TEST_GATHER_MAX) + 1;
+        Tag = PAGE_CACHE_INDEX_NO_TAG;
+        if ((rand() & 1) != 0) {
+            Tag = PageCacheIndexTagDirty;
+        }
+
+        Failures += TestCheckGather(&Index,
+                                    Entries,
+                                    TEST_SPARSE_KEY_COUNT,
+                                    FirstKey,
+                                    LastKey,
+                                    Tag,
+                                    Count);
+
+        if (Failures > 10) {
+            break;
+        }
+    }
+
+    Failures += TestRemoveEntries(&Index,
+                                  Entries,
+                                  TEST_SPARSE_KEY_COUNT,
+                                  TRUE);
+
+    if ((Index.Root != NULL) ||
+        (TestGetOutstandingBlocks(IoPageCacheIndexNodeAllocator) != 0)) {
+
+        printf("Index nodes leaked after removing all entries.\n");
+        Failures += 1;
+    }
+
+    free(Entries);
+    return Failures;
+}
+
+ULONG
+TestInsertEntries (
+    PPAGE_CACHE_INDEX Index,
+    PTEST_ENTRY Entries,
+    ULONG EntryCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine inserts the given entries into the index in a random order,
+    tags the dirty ones, and checks that each can be looked up.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Entries - Supplies the model entries.
+
+    EntryCount - Supplies the number of model entries.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Failures;
+    ULONG KeyIndex;
+    ULONG *Order;
+    PAGE_CACHE_INDEX_RESERVE Reserve;
+    KSTATUS Status;
+    ULONG Swap;
+    ULONG SwapIndex;
+
+    Failures = 0;
+    Order = malloc(EntryCount * sizeof(ULONG));
+    if (Order == NULL) {
+        return 1;
+    }
+
+    for (KeyIndex = 0; KeyIndex < EntryCount; KeyIndex += 1) {
+        Order[KeyIndex] = KeyIndex;
+    }
+
+    for (KeyIndex = EntryCount - 1; KeyIndex > 0; KeyIndex -= 1) {
+        SwapIndex = rand() % (KeyIndex + 1);
+        Swap = Order[KeyIndex];
+        Order[KeyIndex] = Order[SwapIndex];
+        Order[SwapIndex] = Swap;
+    }
+
+    for (KeyIndex = 0; KeyIndex < EntryCount; KeyIndex += 1) {
+        Status = IopReservePageCacheIndexNodes(Index,
+                                               Entries[Order[KeyIndex]].Key,
+                                               &Reserve);
+
+        if (!KSUCCESS(Status)) {
+            printf("Failed to reserve index nodes: %d\n", Status);
+            Failures += 1;
+            break;
+        }
+
+        IopInsertPageCacheIndexEntry(Index,
+                                     Entries[Order[KeyIndex]].Key,
+                                     &(Entries[Order[KeyIndex]]),
+                                     &Reserve);
+
+        IopReleasePageCacheIndexNodes(&Reserve);
+        Entries[Order[KeyIndex]].Present = TRUE;
+        if (Entries[Order[KeyIndex]].Dirty != FALSE) {
+            IopSetPageCacheIndexTag(Index,
+                                    Entries[Order[KeyIndex]].Key,
+                                    PageCacheIndexTagDirty);
+        }
+    }
+
+    for (KeyIndex = 0; KeyIndex < EntryCount; KeyIndex += 1) {
+        if (Entries[KeyIndex].Present == FALSE) {
+            continue;
+        }
+
+        if (IopLookupPageCacheIndexEntry(Index, Entries[KeyIndex].Key) !=
+            &(Entries[KeyIndex])) {
+
+            printf("Lookup of key %llx failed.\n", Entries[KeyIndex].Key);
+            Failures += 1;
+        }
+    }
+
+    free(Order);
+    return Failures;
+}
+
+ULONG
+TestRemoveEntries (
+    PPAGE_CACHE_INDEX Index,
+    PTEST_ENTRY Entries,
+    ULONG EntryCount,
+    BOOL RemoveAll
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes entries from the index, and clears the dirty tag from
+    some of the entries that remain.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Entries - Supplies the model entries.
+
+    EntryCount - Supplies the number of model entries.
+
+    RemoveAll - Supplies a boolean indicating whether to remove every entry
+        (TRUE) or about half of them (FALSE).
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    PVOID Entry;
+    ULONG Failures;
+    ULONG KeyIndex;
+
+    Failures = 0;
+    for (KeyIndex = 0; KeyIndex < EntryCount; KeyIndex += 1) {
+        if (Entries[KeyIndex].Present == FALSE) {
+            continue;
+        }
+
+        if ((RemoveAll == FALSE) && ((rand() & 1) == 0)) {
+            if ((Entries[KeyIndex].Dirty != FALSE) && ((rand() % 3) == 0)) {
+                IopClearPageCacheIndexTag(Index,
+                                          Entries[KeyIndex].Key,
+                                          PageCacheIndexTagDirty);
+
+                Entries[KeyIndex].Dirty = FALSE;
+            }
+
+            continue;
+        }
+
+        Entry = IopRemovePageCacheIndexEntry(Index, Entries[KeyIndex].Key);
+        if (Entry != &(Entries[KeyIndex])) {
+            printf("Remove of key %llx returned %p instead of %p.\n",
+                   Entries[KeyIndex].Key,
+                   Entry,
+                   &(Entries[KeyIndex]));
+
+            Failures += 1;
+        }
+
+        Entries[KeyIndex].Present = FALSE;
+        if (IopLookupPageCacheIndexEntry(Index, Entries[KeyIndex].Key) !=
+            NULL) {
+
+            printf("Key %llx still present after removal.\n",
+                   Entries[KeyIndex].Key);
+
+            Failures += 1;
+        }
+    }
+
+    return Failures;
+}
+
+ULONG
+TestCheckGather (
+    PPAGE_CACHE_INDEX Index,
+    PTEST_ENTRY Entries,
+    ULONG EntryCount,
+    ULONGLONG FirstKey,
+    ULONGLONG LastKey,
+    ULONG Tag,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gathers a range of entries from the index and compares the
+    result with the model.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Entries - Supplies the model entries, sorted by key.
+
+    EntryCount - Supplies the number of model entries.
+
+    FirstKey - Supplies the first key of the range.
+
+    LastKey - Supplies the last key of the range, inclusive.
+
+    Tag - Supplies the tag to gather, or PAGE_CACHE_INDEX_NO_TAG.
+
+    Count - Supplies the maximum number of entries to gather.
+
+Return Value:
+
+    Returns 1 if the gather returned the wrong entries, or 0 if it was correct.
+
+--*/
+
+{
+
+    ULONG Expected;
+    PVOID Found[TEST_GATHER_MAX];
+    ULONG FoundCount;
+    ULONG KeyIndex;
+    PTEST_ENTRY Result;
+
+    ASSERT(Count <= TEST_GATHER_MAX);
+
+    FoundCount = IopGatherPageCacheIndexEntries(Index,
+                                                FirstKey,
+                                                LastKey,
+                                                Tag,
+                                                Found,
+                                                Count);
+
+    Expected = 0;
+    for (KeyIndex = 0; KeyIndex < EntryCount; KeyIndex += 1) {
+        if (Expected == Count) {
+            break;
+        }
+
+        if ((Entries[KeyIndex].Present == FALSE) ||
+            (Entries[KeyIndex].Key < FirstKey) ||
+            (Entries[KeyIndex].Key > LastKey)) {
+
+            continue;
+        }
+
+        if ((Tag != PAGE_CACHE_INDEX_NO_TAG) &&
+            (Entries[KeyIndex].Dirty == FALSE)) {
+
+            continue;
+        }
+
+        if ((Expected >= FoundCount) ||
+            (Found[Expected] != &(Entries[KeyIndex]))) {
+
+            Result = NULL;
+            if (Expected < FoundCount) {
+                Result = Found[Expected];
+            }
+
+            printf("Gather %llx-%llx tag %d count %d: entry %d was key %llx, "
+                   "expected %llx.\n",
+                   FirstKey,
+                   LastKey,
+                   Tag,
+                   Count,
+                   Expected,
+                   (Result != NULL) ? Result->Key : -1ULL,
+                   Entries[KeyIndex].Key);
+
+            return 1;
+        }
+
+        Expected += 1;
+    }
+
+    if (Expected != FoundCount) {
+        printf("Gather %llx-%llx tag %d count %d: found %d entries, expected "
+               "%d.\n",
+               FirstKey,
+               LastKey,
+               Tag,
+               Count,
+               FoundCount,
+               Expected);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+ULONGLONG
+TestRandomKey (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns a random key, with its magnitude spread evenly over
+    the key space.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a random key.
+
+--*/
+
+{
+
+    ULONGLONG Key;
+
+    Key = ((ULONGLONG)rand() << 32) ^ ((ULONGLONG)rand() << 16) ^ rand();
+    return Key >> (rand() % 64);
+}
+
+INT
+TestCompareEntries (
+    const VOID *Left,
+    const VOID *Right
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two model entries by key.
+
+Arguments:
+
+    Left - Supplies a pointer to the left entry.
+
+    Right - Supplies a pointer to the right entry.
+
+Return Value:
+
+    Less than zero if the left key is smaller, greater than zero if it is
+    larger, and zero if they are equal.
+
+--*/
+
+{
+
+    const TEST_ENTRY *LeftEntry;
+    const TEST_ENTRY *RightEntry;
+
+    LeftEntry = Left;
+    RightEntry = Right;
+    if (LeftEntry->Key < RightEntry->Key) {
+        return -1;
+
+    } else if (LeftEntry->Key > RightEntry->Key) {
+        return 1;
+    }
+
+    return 0;
+}
+
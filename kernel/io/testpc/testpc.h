@@ -0,0 +1,64 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    testpc.h
+
+Abstract:
+
+    This header contains definitions for the page cache index test.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+ULONG
+TestGetOutstandingBlocks (
+    PBLOCK_ALLOCATOR Allocator
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the number of blocks allocated and not yet freed.
+
+Arguments:
+
+    Allocator - Supplies a pointer to the allocator.
+
+Return Value:
+
+    Returns the number of outstanding blocks.
+
+--*/
+
@@ -58,6 +58,14 @@ Module Name:
 
 #define UNIX_SOCKET_MAX_CONTROL_DATA 32768
 
+//
+// Define the minimum amount of data a blocked stream sender lends to the
+// receiver directly rather than waiting to copy it into packets. Below this,
+// locking the sender's pages costs more than the copy it saves.
+//
+
+#define UNIX_SOCKET_MINIMUM_LEND_SIZE 0x4000
+
 //
 // Define local socket flags.
 //
@@ -122,8 +130,18 @@ Structure Description:
 Members:
 
     ListEntry - Stores pointers to the next and previous packets to be received.
+        For lent packets, the receiver sets the next pointer to NULL when it
+        takes the packet off of the list.
+
+    Data - Stores a pointer to the data, or NULL for lent packets.
 
-    Data - Stores a pointer to the data.
+    IoBuffer - Stores an optional pointer to the locked I/O buffer of a sender
+        that lent its data directly. The receiver copies straight out of the
+        sender's pages, and the packet belongs to the sender rather than the
+        receiver.
+
+    IoBufferOffset - Stores the offset into the lent I/O buffer where the data
+        begins.
 
     Length - Stores the length of the data, in bytes.
 
@@ -145,6 +163,8 @@ Structure Description:
 typedef struct _UNIX_SOCKET_PACKET {
     LIST_ENTRY ListEntry;
     PVOID Data;
+    PIO_BUFFER IoBuffer;
+    UINTN IoBufferOffset;
     UINTN Length;
     UINTN Offset;
     PUNIX_SOCKET Sender;
@@ -251,6 +271,22 @@ IopUnixSocketDestroyPacket (
     PUNIX_SOCKET_PACKET Packet
     );
 
+KSTATUS
+IopUnixSocketLendData (
+    PUNIX_SOCKET Sender,
+    PUNIX_SOCKET Remote,
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    UINTN Size,
+    ULONG TimeoutInMilliseconds,
+    PUINTN BytesLent
+    );
+
+VOID
+IopUnixSocketReleasePacket (
+    PUNIX_SOCKET_PACKET Packet
+    );
+
 KSTATUS
 IopUnixSocketSendControlData (
     BOOL FromKernelMode,
@@ -1347,9 +1383,12 @@ Return Value:
 {
 
     UINTN BytesCompleted;
+    UINTN BytesLent;
     PNETWORK_ADDRESS Destination;
     NETWORK_ADDRESS DestinationLocal;
     PFILE_OBJECT FileObject;
+    PIO_BUFFER LendBuffer;
+    BOOL LockedCopy;
     ULONG OpenFlags;
     PUNIX_SOCKET_PACKET Packet;
     UINTN PacketSize;
@@ -1369,6 +1408,7 @@ Return Value:
     ULONG WalkedPathSize;
 
     BytesCompleted = 0;
+    LendBuffer = NULL;
     Packet = NULL;
     IO_INITIALIZE_PATH_POINT(&PathPoint);
     RemoteCopy = NULL;
@@ -1484,6 +1524,39 @@ Return Value:
 
     OpenFlags = IoGetIoHandleOpenFlags(Socket->IoHandle);
 
+    //
+    // A blocking stream send too large to fit in the send list is going to
+    // wait on the receiver anyway. Lock its pages down so that once it
+    // blocks, the rest can be lent to the receiver, who copies it straight
+    // out of the sender's buffer rather than through packets.
+    //
+
+    if ((Socket->Type == NetSocketStream) &&
+        ((OpenFlags & OPEN_FLAG_NON_BLOCKING) == 0) &&
+        ((Parameters->ControlData == NULL) ||
+         (Parameters->ControlDataSize == 0)) &&
+        (Parameters->Size > UnixSocket->SendListMax)) {
+
+        LendBuffer = IoBuffer;
+        Status = MmValidateIoBuffer(0,
+                                    MAX_ULONGLONG,
+                                    0,
+                                    Parameters->Size,
+                                    FALSE,
+                                    &LendBuffer,
+                                    &LockedCopy);
+
+        if ((!KSUCCESS(Status)) ||
+            ((LendBuffer != IoBuffer) && (LockedCopy == FALSE))) {
+
+            if ((LendBuffer != NULL) && (LendBuffer != IoBuffer)) {
+                MmFreeIoBuffer(LendBuffer);
+            }
+
+            LendBuffer = NULL;
+        }
+    }
+
     //
     // Loop while there's data to send.
     //
@@ -1632,6 +1705,34 @@ Return Value:
                 goto UnixSocketSendDataEnd;
             }
 
+            //
+            // Rather than wait for space, lend the rest of a large send to
+            // the receiver if no credentials need to go along with it.
+            //
+
+            if ((LendBuffer != NULL) &&
+                (Size >= UNIX_SOCKET_MINIMUM_LEND_SIZE) &&
+                (((UnixSocket->Flags | RemoteUnixSocket->Flags) &
+                  UNIX_SOCKET_FLAG_SEND_CREDENTIALS) == 0)) {
+
+                Status = IopUnixSocketLendData(
+                                           UnixSocket,
+                                           RemoteUnixSocket,
+                                           LendBuffer,
+                                           BytesCompleted,
+                                           Size,
+                                           Parameters->TimeoutInMilliseconds,
+                                           &BytesLent);
+
+                BytesCompleted += BytesLent;
+                Size -= BytesLent;
+                if (!KSUCCESS(Status)) {
+                    goto UnixSocketSendDataEnd;
+                }
+
+                continue;
+            }
+
             Status = IoWaitForIoObjectState(Socket->IoState,
                                             POLL_EVENT_OUT,
                                             TRUE,
@@ -1697,6 +1798,10 @@ Return Value:
         MmFreePagedPool(RemoteCopy);
     }
 
+    if ((LendBuffer != NULL) && (LendBuffer != IoBuffer)) {
+        MmFreeIoBuffer(LendBuffer);
+    }
+
     if (!KSUCCESS(Status)) {
 
         //
@@ -1888,11 +1993,20 @@ Return Value:
                 ByteCount = Size;
             }
 
-            Status = MmCopyIoBufferData(IoBuffer,
-                                        Packet->Data + Packet->Offset,
+            if (Packet->IoBuffer != NULL) {
+                Status = MmCopyIoBuffer(IoBuffer,
                                         BytesReceived,
-                                        ByteCount,
-                                        TRUE);
+                                        Packet->IoBuffer,
+                                        Packet->IoBufferOffset + Packet->Offset,
+                                        ByteCount);
+
+            } else {
+                Status = MmCopyIoBufferData(IoBuffer,
+                                            Packet->Data + Packet->Offset,
+                                            BytesReceived,
+                                            ByteCount,
+                                            TRUE);
+            }
 
             if (!KSUCCESS(Status)) {
                 goto UnixSocketReceiveDataEnd;
@@ -1981,29 +2095,39 @@ Return Value:
                 }
 
                 //
-                // Release the sender if needed. Release the lock first so that
-                // both locks are not held at once, which could cause lock
-                // ordering problems.
+                // A lent packet goes back to the sender, who is waiting with
+                // this socket's lock to find out it was consumed.
                 //
 
-                KeReleaseQueuedLock(UnixSocket->Lock);
-                UnixSocketLockHeld = FALSE;
-                KeAcquireQueuedLock(Packet->Sender->Lock);
+                if (Packet->IoBuffer != NULL) {
+                    IopUnixSocketReleasePacket(Packet);
 
-                ASSERT(Packet->Sender->SendListSize >= Packet->Length);
+                //
+                // Release the sender if needed. Release the lock first so
+                // that both locks are not held at once, which could cause
+                // lock ordering problems.
+                //
 
-                IoSetIoObjectState(Packet->Sender->KernelSocket.IoState,
-                                   POLL_EVENT_OUT,
-                                   TRUE);
+                } else {
+                    KeReleaseQueuedLock(UnixSocket->Lock);
+                    UnixSocketLockHeld = FALSE;
+                    KeAcquireQueuedLock(Packet->Sender->Lock);
 
-                Packet->Sender->SendListSize -= Packet->Length;
-                KeReleaseQueuedLock(Packet->Sender->Lock);
+                    ASSERT(Packet->Sender->SendListSize >= Packet->Length);
 
-                //
-                // Destroy the sender's packet.
-                //
+                    IoSetIoObjectState(Packet->Sender->KernelSocket.IoState,
+                                       POLL_EVENT_OUT,
+                                       TRUE);
 
-                IopUnixSocketDestroyPacket(Packet);
+                    Packet->Sender->SendListSize -= Packet->Length;
+                    KeReleaseQueuedLock(Packet->Sender->Lock);
+
+                    //
+                    // Destroy the sender's packet.
+                    //
+
+                    IopUnixSocketDestroyPacket(Packet);
+                }
             }
 
             //
@@ -2650,6 +2774,11 @@ Return Value:
                             ListEntry);
 
         LIST_REMOVE(&(Packet->ListEntry));
+        if (Packet->IoBuffer != NULL) {
+            IopUnixSocketReleasePacket(Packet);
+            continue;
+        }
+
         KeAcquireQueuedLock(Packet->Sender->Lock);
 
         ASSERT(Packet->Sender->SendListSize >= Packet->Length);
@@ -2716,6 +2845,8 @@ Return Value:
 
     Packet->Sender = Sender;
     Packet->Data = (PVOID)(Packet + 1);
+    Packet->IoBuffer = NULL;
+    Packet->IoBufferOffset = 0;
     Packet->Length = DataSize;
     Packet->Offset = 0;
     Packet->Credentials.ProcessId = -1;
@@ -2785,6 +2916,188 @@ Return Value:
     return;
 }
 
+KSTATUS
+IopUnixSocketLendData (
+    PUNIX_SOCKET Sender,
+    PUNIX_SOCKET Remote,
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    UINTN Size,
+    ULONG TimeoutInMilliseconds,
+    PUINTN BytesLent
+    )
+
+/*++
+
+Routine Description:
+
+    This routine lends data from a blocked stream sender directly to the
+    receiving socket. The data goes on the receive list in a packet that
+    points at the sender's locked pages, so the receiver copies it once,
+    straight into its own buffer. The sender waits until the packet has been
+    consumed. Neither socket lock should be held by the caller.
+
+Arguments:
+
+    Sender - Supplies a pointer to the sending socket.
+
+    Remote - Supplies a pointer to the receiving socket.
+
+    IoBuffer - Supplies a pointer to the sender's I/O buffer, which must be
+        locked in memory.
+
+    Offset - Supplies the offset into the I/O buffer where the data begins.
+
+    Size - Supplies the number of bytes to lend.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds to wait for
+        the receiver to consume the data.
+
+    BytesLent - Supplies a pointer where the number of bytes the receiver
+        consumed will be returned. This may be less than the size on failure.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UNIX_SOCKET_PACKET Packet;
+    ULONG ReturnedEvents;
+    KSTATUS Status;
+
+    RtlZeroMemory(&Packet, sizeof(UNIX_SOCKET_PACKET));
+    Packet.IoBuffer = IoBuffer;
+    Packet.IoBufferOffset = Offset;
+    Packet.Length = Size;
+    Packet.Sender = Sender;
+    Packet.Credentials.ProcessId = -1;
+    Packet.Credentials.UserId = -1;
+    Packet.Credentials.GroupId = -1;
+    KeAcquireQueuedLock(Remote->Lock);
+    if (Remote->KernelSocket.Type != Sender->KernelSocket.Type) {
+        KeReleaseQueuedLock(Remote->Lock);
+        *BytesLent = 0;
+        return STATUS_DOMAIN_NOT_SUPPORTED;
+    }
+
+    Status = IopUnixSocketEnsureConnected(Remote, FALSE);
+    if (!KSUCCESS(Status)) {
+        KeReleaseQueuedLock(Remote->Lock);
+        *BytesLent = 0;
+        return STATUS_BROKEN_PIPE;
+    }
+
+    //
+    // Clear the write event before publishing the packet so that the signal
+    // from the receiver that finishes it cannot be lost.
+    //
+
+    IoSetIoObjectState(Sender->KernelSocket.IoState, POLL_EVENT_OUT, FALSE);
+    INSERT_BEFORE(&(Packet.ListEntry), &(Remote->ReceiveList));
+    if (Packet.ListEntry.Previous == &(Remote->ReceiveList)) {
+        IoSetIoObjectState(Remote->KernelSocket.IoState, POLL_EVENT_IN, TRUE);
+    }
+
+    KeReleaseQueuedLock(Remote->Lock);
+    while (TRUE) {
+        Status = IoWaitForIoObjectState(Sender->KernelSocket.IoState,
+                                        POLL_EVENT_OUT,
+                                        TRUE,
+                                        TimeoutInMilliseconds,
+                                        &ReturnedEvents);
+
+        //
+        // The receiver only touches the packet with its lock held, and takes
+        // the packet off the list when it is done with it.
+        //
+
+        KeAcquireQueuedLock(Remote->Lock);
+        if (Packet.ListEntry.Next == NULL) {
+            break;
+        }
+
+        //
+        // Pull the packet back if the wait was cut short. The receiver may
+        // have taken some of it already.
+        //
+
+        if (!KSUCCESS(Status)) {
+            LIST_REMOVE(&(Packet.ListEntry));
+            if (LIST_EMPTY(&(Remote->ReceiveList)) != FALSE) {
+                IoSetIoObjectState(Remote->KernelSocket.IoState,
+                                   POLL_EVENT_IN,
+                                   FALSE);
+            }
+
+            break;
+        }
+
+        IoSetIoObjectState(Sender->KernelSocket.IoState, POLL_EVENT_OUT, FALSE);
+        KeReleaseQueuedLock(Remote->Lock);
+    }
+
+    KeReleaseQueuedLock(Remote->Lock);
+    *BytesLent = Packet.Offset;
+
+    //
+    // The receiver flushes packets it will never read.
+    //
+
+    if ((KSUCCESS(Status)) && (Packet.Offset < Packet.Length)) {
+        Status = STATUS_BROKEN_PIPE;
+    }
+
+    //
+    // Let other senders back in if there is room.
+    //
+
+    KeAcquireQueuedLock(Sender->Lock);
+    if (Sender->SendListSize < Sender->SendListMax) {
+        IoSetIoObjectState(Sender->KernelSocket.IoState, POLL_EVENT_OUT, TRUE);
+    }
+
+    KeReleaseQueuedLock(Sender->Lock);
+    return Status;
+}
+
+VOID
+IopUnixSocketReleasePacket (
+    PUNIX_SOCKET_PACKET Packet
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands a lent packet that has been taken off the receive list
+    back to its sender. This routine assumes the receiving socket's lock is
+    held, which keeps the sender waiting on the packet until it is released.
+
+Arguments:
+
+    Packet - Supplies a pointer to the lent packet.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Packet->IoBuffer != NULL);
+
+    Packet->ListEntry.Next = NULL;
+    IoSetIoObjectState(Packet->Sender->KernelSocket.IoState,
+                       POLL_EVENT_OUT,
+                       TRUE);
+
+    return;
+}
+
 KSTATUS
 IopUnixSocketSendControlData (
     BOOL FromKernelMode,
@@ -0,0 +1,833 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    writebk.c
+
+Abstract:
+
+    This module implements per-device writeback. Each device with cacheable
+    file objects gets a writeback context with its own worker thread, dirty
+    page counters, and an estimate of how fast the device writes. The page
+    cache thread wakes the workers, and writers that dirty pages faster than
+    their device can clean them are throttled against the device's share of
+    the dirty page limit.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+#include "pagecach.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define WRITEBACK_ALLOCATION_TAG 0x6B427257 // 'kBrW'
+
+//
+// Define the amount of busy time, in milliseconds, a bandwidth sample must
+// cover before it is folded into the estimate.
+//
+
+#define WRITEBACK_SAMPLE_MILLISECONDS 200
+
+//
+// Define the fraction of the dirty limit every device gets regardless of its
+// bandwidth, as a shift. This keeps a device with no estimate yet, or one that
+// has been idle, from being throttled to a standstill.
+//
+
+#define WRITEBACK_MINIMUM_SHARE_SHIFT 4
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+PWRITEBACK_CONTEXT
+IopCreateWritebackContext (
+    DEVICE_ID DeviceId
+    );
+
+VOID
+IopDestroyWritebackContext (
+    PWRITEBACK_CONTEXT Context
+    );
+
+VOID
+IopWritebackWorker (
+    PVOID Parameter
+    );
+
+VOID
+IopSampleWritebackBandwidth (
+    PWRITEBACK_CONTEXT Context
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store the list of writeback contexts and the lock that protects it and the
+// context reference counts.
+//
+
+LIST_ENTRY IoWritebackContextList;
+PQUEUED_LOCK IoWritebackContextListLock;
+
+//
+// Store the context shared by all file objects that are not cacheable.
+//
+
+PWRITEBACK_CONTEXT IoSharedWritebackContext;
+
+//
+// Store the sum of the bandwidth estimates of all contexts, in bytes per
+// second.
+//
+
+volatile ULONGLONG IoWritebackTotalBandwidth;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+IopInitializeWriteback (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes writeback support.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    INITIALIZE_LIST_HEAD(&IoWritebackContextList);
+    IoWritebackContextListLock = KeCreateQueuedLock();
+    if (IoWritebackContextListLock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    //
+    // The shared context holds a permanent reference so that it is never
+    // reaped.
+    //
+
+    IoSharedWritebackContext = IopCreateWritebackContext(0);
+    if (IoSharedWritebackContext == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    IoSharedWritebackContext->ReferenceCount = 1;
+    INSERT_BEFORE(&(IoSharedWritebackContext->ListEntry),
+                  &IoWritebackContextList);
+
+    return STATUS_SUCCESS;
+}
+
+PWRITEBACK_CONTEXT
+IopGetWritebackContext (
+    DEVICE_ID DeviceId,
+    IO_OBJECT_TYPE Type
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds or creates the writeback context for a new file object
+    and adds a reference to it. Cacheable file objects get the context of
+    their device. All others share one context.
+
+Arguments:
+
+    DeviceId - Supplies the ID of the device that owns the file object.
+
+    Type - Supplies the type of the file object.
+
+Return Value:
+
+    Returns a pointer to the writeback context on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    PWRITEBACK_CONTEXT Context;
+    PLIST_ENTRY CurrentEntry;
+    PWRITEBACK_CONTEXT NewContext;
+
+    if ((DeviceId == 0) || (IO_IS_CACHEABLE_TYPE(Type) == FALSE)) {
+        DeviceId = 0;
+    }
+
+    NewContext = NULL;
+    while (TRUE) {
+        KeAcquireQueuedLock(IoWritebackContextListLock);
+        CurrentEntry = IoWritebackContextList.Next;
+        while (CurrentEntry != &IoWritebackContextList) {
+            Context = LIST_VALUE(CurrentEntry, WRITEBACK_CONTEXT, ListEntry);
+            if (Context->DeviceId == DeviceId) {
+                Context->ReferenceCount += 1;
+                KeReleaseQueuedLock(IoWritebackContextListLock);
+                if (NewContext != NULL) {
+                    IopDestroyWritebackContext(NewContext);
+                }
+
+                return Context;
+            }
+
+            CurrentEntry = CurrentEntry->Next;
+        }
+
+        if (NewContext != NULL) {
+            NewContext->ReferenceCount = 1;
+            INSERT_BEFORE(&(NewContext->ListEntry), &IoWritebackContextList);
+            KeReleaseQueuedLock(IoWritebackContextListLock);
+            return NewContext;
+        }
+
+        //
+        // Create the context outside the lock, since it creates a thread, and
+        // then go around again in case someone else raced to create it too.
+        //
+
+        KeReleaseQueuedLock(IoWritebackContextListLock);
+        NewContext = IopCreateWritebackContext(DeviceId);
+        if (NewContext == NULL) {
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+VOID
+IopReleaseWritebackContext (
+    PWRITEBACK_CONTEXT Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a file object's reference on a writeback context.
+    Unreferenced contexts are destroyed later by the page cache thread.
+
+Arguments:
+
+    Context - Supplies a pointer to the writeback context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    KeAcquireQueuedLock(IoWritebackContextListLock);
+
+    ASSERT((Context->ReferenceCount != 0) &&
+           (Context->ReferenceCount < 0x10000000));
+
+    Context->ReferenceCount -= 1;
+    KeReleaseQueuedLock(IoWritebackContextListLock);
+    return;
+}
+
+VOID
+IopWakeWritebackWorker (
+    PWRITEBACK_CONTEXT Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues the writeback worker for the given context if it is
+    not already queued.
+
+Arguments:
+
+    Context - Supplies a pointer to the writeback context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    //
+    // A failure here means the worker is already queued, which is just as
+    // good.
+    //
+
+    KeQueueWorkItem(Context->WorkItem);
+    return;
+}
+
+VOID
+IopWakeWritebackWorkers (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues the writeback worker of every context that has dirty
+    file objects, and destroys any contexts no longer in use. This routine
+    must only be called from the page cache thread.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PWRITEBACK_CONTEXT Context;
+    PLIST_ENTRY CurrentEntry;
+    LIST_ENTRY DestroyList;
+
+    INITIALIZE_LIST_HEAD(&DestroyList);
+    KeAcquireQueuedLock(IoWritebackContextListLock);
+    CurrentEntry = IoWritebackContextList.Next;
+    while (CurrentEntry != &IoWritebackContextList) {
+        Context = LIST_VALUE(CurrentEntry, WRITEBACK_CONTEXT, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (Context->ReferenceCount == 0) {
+
+            ASSERT(Context != IoSharedWritebackContext);
+
+            LIST_REMOVE(&(Context->ListEntry));
+            INSERT_BEFORE(&(Context->ListEntry), &DestroyList);
+            continue;
+        }
+
+        if (Context->DirtyFileObjectCount != 0) {
+            IopWakeWritebackWorker(Context);
+        }
+    }
+
+    KeReleaseQueuedLock(IoWritebackContextListLock);
+
+    //
+    // With no file objects left there is nothing for the worker to flush,
+    // but it may still be running a pass that started before the last file
+    // object went away.
+    //
+
+    while (LIST_EMPTY(&DestroyList) == FALSE) {
+        Context = LIST_VALUE(DestroyList.Next, WRITEBACK_CONTEXT, ListEntry);
+        LIST_REMOVE(&(Context->ListEntry));
+        KeFlushWorkItem(Context->WorkItem);
+        RtlAtomicAdd64(&IoWritebackTotalBandwidth, -Context->Bandwidth);
+        IopDestroyWritebackContext(Context);
+    }
+
+    return;
+}
+
+ULONGLONG
+IopBeginWritebackIo (
+    PWRITEBACK_CONTEXT Context,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine notes that a write of dirty pages to the device is starting.
+
+Arguments:
+
+    Context - Supplies a pointer to the writeback context.
+
+    Size - Supplies the number of bytes about to be written.
+
+Return Value:
+
+    Returns the time counter value when the write started, to be passed to
+    the end routine.
+
+--*/
+
+{
+
+    RtlAtomicAdd(&(Context->WritebackPageCount),
+                 Size >> MmPageShift());
+
+    return HlQueryTimeCounter();
+}
+
+VOID
+IopEndWritebackIo (
+    PWRITEBACK_CONTEXT Context,
+    UINTN Size,
+    UINTN BytesCompleted,
+    ULONGLONG StartTime
+    )
+
+/*++
+
+Routine Description:
+
+    This routine notes that a write of dirty pages to the device is complete,
+    and updates the bandwidth estimate of the device.
+
+Arguments:
+
+    Context - Supplies a pointer to the writeback context.
+
+    Size - Supplies the number of bytes supplied to the begin routine.
+
+    BytesCompleted - Supplies the number of bytes actually written.
+
+    StartTime - Supplies the time counter value returned by the begin
+        routine.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG Elapsed;
+    ULONGLONG SampleLength;
+    ULONGLONG SampleTime;
+
+    Elapsed = HlQueryTimeCounter() - StartTime;
+    RtlAtomicAdd(&(Context->WritebackPageCount),
+                 -(Size >> MmPageShift()));
+
+    if (BytesCompleted == 0) {
+        return;
+    }
+
+    RtlAtomicAdd64(&(Context->BytesWritten), BytesCompleted);
+    RtlAtomicAdd64(&(Context->SampleBytes), BytesCompleted);
+    SampleTime = RtlAtomicAdd64(&(Context->SampleTime), Elapsed) + Elapsed;
+    SampleLength = HlQueryTimeCounterFrequency() *
+                   WRITEBACK_SAMPLE_MILLISECONDS / MILLISECONDS_PER_SECOND;
+
+    if (SampleTime >= SampleLength) {
+        IopSampleWritebackBandwidth(Context);
+    }
+
+    return;
+}
+
+BOOL
+IopIsWritebackOverLimit (
+    PWRITEBACK_CONTEXT Context,
+    UINTN DirtyLimit
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a device has more than its share of the
+    page cache's dirty pages. The share of each device is proportional to how
+    fast it has been writing back, so that a slow device cannot fill the cache
+    with dirty pages at the expense of faster ones.
+
+Arguments:
+
+    Context - Supplies a pointer to the writeback context of the device.
+
+    DirtyLimit - Supplies the number of dirty pages allowed in the page cache
+        as a whole.
+
+Return Value:
+
+    TRUE if the device has used up its share of dirty pages.
+
+    FALSE if the device is under its share.
+
+--*/
+
+{
+
+    ULONGLONG Bandwidth;
+    UINTN MinimumShare;
+    UINTN Share;
+    ULONGLONG TotalBandwidth;
+
+    Bandwidth = Context->Bandwidth;
+    TotalBandwidth = IoWritebackTotalBandwidth;
+    MinimumShare = DirtyLimit >> WRITEBACK_MINIMUM_SHARE_SHIFT;
+    Share = DirtyLimit;
+    if ((TotalBandwidth != 0) && (Bandwidth < TotalBandwidth)) {
+        Share = (UINTN)(DirtyLimit * Bandwidth / TotalBandwidth);
+    }
+
+    if (Share < MinimumShare) {
+        Share = MinimumShare;
+    }
+
+    if ((Context->DirtyPageCount + Context->WritebackPageCount) >= Share) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+KSTATUS
+IopGetWritebackStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the writeback statistics of each device.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PWRITEBACK_CONTEXT Context;
+    UINTN Count;
+    PLIST_ENTRY CurrentEntry;
+    UINTN RequiredSize;
+    PIO_WRITEBACK_STATISTICS Statistics;
+    KSTATUS Status;
+
+    if (Set != FALSE) {
+        *DataSize = 0;
+        return STATUS_ACCESS_DENIED;
+    }
+
+    Count = 0;
+    Statistics = Data;
+    Status = STATUS_SUCCESS;
+    KeAcquireQueuedLock(IoWritebackContextListLock);
+    CurrentEntry = IoWritebackContextList.Next;
+    while (CurrentEntry != &IoWritebackContextList) {
+        Count += 1;
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    RequiredSize = Count * sizeof(IO_WRITEBACK_STATISTICS);
+    if (*DataSize < RequiredSize) {
+        Status = STATUS_BUFFER_TOO_SMALL;
+        goto GetWritebackStatisticsEnd;
+    }
+
+    CurrentEntry = IoWritebackContextList.Next;
+    while (CurrentEntry != &IoWritebackContextList) {
+        Context = LIST_VALUE(CurrentEntry, WRITEBACK_CONTEXT, ListEntry);
+        Statistics->DeviceId = Context->DeviceId;
+        Statistics->DirtyPageCount = Context->DirtyPageCount;
+        Statistics->WritebackPageCount = Context->WritebackPageCount;
+        Statistics->BytesWritten = Context->BytesWritten;
+        Statistics->Bandwidth = Context->Bandwidth;
+        Statistics += 1;
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+GetWritebackStatisticsEnd:
+    KeReleaseQueuedLock(IoWritebackContextListLock);
+    *DataSize = RequiredSize;
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+PWRITEBACK_CONTEXT
+IopCreateWritebackContext (
+    DEVICE_ID DeviceId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a writeback context and its worker.
+
+Arguments:
+
+    DeviceId - Supplies the ID of the device the context covers.
+
+Return Value:
+
+    Returns a pointer to the new context with no references on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    PWRITEBACK_CONTEXT Context;
+    KSTATUS Status;
+
+    Status = STATUS_INSUFFICIENT_RESOURCES;
+
+    //
+    // The context is touched on the paging path, so keep it out of paged
+    // pool.
+    //
+
+    Context = MmAllocateNonPagedPool(sizeof(WRITEBACK_CONTEXT),
+                                     WRITEBACK_ALLOCATION_TAG);
+
+    if (Context == NULL) {
+        goto CreateWritebackContextEnd;
+    }
+
+    RtlZeroMemory(Context, sizeof(WRITEBACK_CONTEXT));
+    Context->DeviceId = DeviceId;
+    Context->SampleLock = KeCreateQueuedLock();
+    if (Context->SampleLock == NULL) {
+        goto CreateWritebackContextEnd;
+    }
+
+    Context->WorkQueue = KeCreateWorkQueue(0, "IoWriteback");
+    if (Context->WorkQueue == NULL) {
+        goto CreateWritebackContextEnd;
+    }
+
+    Context->WorkItem = KeCreateWorkItem(Context->WorkQueue,
+                                         WorkPriorityNormal,
+                                         IopWritebackWorker,
+                                         Context,
+                                         WRITEBACK_ALLOCATION_TAG);
+
+    if (Context->WorkItem == NULL) {
+        goto CreateWritebackContextEnd;
+    }
+
+    Status = STATUS_SUCCESS;
+
+CreateWritebackContextEnd:
+    if (!KSUCCESS(Status)) {
+        if (Context != NULL) {
+            IopDestroyWritebackContext(Context);
+            Context = NULL;
+        }
+    }
+
+    return Context;
+}
+
+VOID
+IopDestroyWritebackContext (
+    PWRITEBACK_CONTEXT Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a writeback context. The context must not be on the
+    list and its worker must not be queued.
+
+Arguments:
+
+    Context - Supplies a pointer to the context to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Context->ReferenceCount == 0);
+    ASSERT(Context->DirtyFileObjectCount == 0);
+
+    if (Context->WorkItem != NULL) {
+        KeDestroyWorkItem(Context->WorkItem);
+    }
+
+    if (Context->WorkQueue != NULL) {
+        KeDestroyWorkQueue(Context->WorkQueue);
+    }
+
+    if (Context->SampleLock != NULL) {
+        KeDestroyQueuedLock(Context->SampleLock);
+    }
+
+    MmFreeNonPagedPool(Context);
+    return;
+}
+
+VOID
+IopWritebackWorker (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine flushes the dirty file objects of one writeback context.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the writeback context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PWRITEBACK_CONTEXT Context;
+
+    Context = Parameter;
+    IopFlushWritebackContext(Context, IO_FLAG_HARD_FLUSH_ALLOWED, NULL);
+
+    //
+    // If file objects were dirtied again while the flush ran, or the flush
+    // failed partway through, get the page cache thread to come back around
+    // and requeue this worker once the dirty timeout has passed.
+    //
+
+    if (Context->DirtyFileObjectCount != 0) {
+        IopSchedulePageCacheThread();
+    }
+
+    return;
+}
+
+VOID
+IopSampleWritebackBandwidth (
+    PWRITEBACK_CONTEXT Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine folds the current bandwidth sample of a writeback context
+    into its bandwidth estimate. The sample measures bytes written against
+    the time spent writing them, so gaps between writes do not make the
+    device look slow.
+
+Arguments:
+
+    Context - Supplies a pointer to the writeback context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG Bandwidth;
+    ULONGLONG Bytes;
+    ULONGLONG Milliseconds;
+    ULONGLONG NewBandwidth;
+    ULONGLONG Ticks;
+
+    if (KeTryToAcquireQueuedLock(Context->SampleLock) == FALSE) {
+        return;
+    }
+
+    Ticks = RtlAtomicExchange64(&(Context->SampleTime), 0);
+    Bytes = RtlAtomicExchange64(&(Context->SampleBytes), 0);
+    Milliseconds = Ticks * MILLISECONDS_PER_SECOND /
+                   HlQueryTimeCounterFrequency();
+
+    if (Milliseconds == 0) {
+        goto SampleWritebackBandwidthEnd;
+    }
+
+    //
+    // Smooth the estimate so a single slow or fast burst doesn't swing the
+    // device's share of dirty pages.
+    //
+
+    NewBandwidth = Bytes * MILLISECONDS_PER_SECOND / Milliseconds;
+    Bandwidth = Context->Bandwidth;
+    if (Bandwidth != 0) {
+        NewBandwidth = ((Bandwidth * 3) + NewBandwidth) / 4;
+    }
+
+    Context->Bandwidth = NewBandwidth;
+    RtlAtomicAdd64(&IoWritebackTotalBandwidth, NewBandwidth - Bandwidth);
+
+SampleWritebackBandwidthEnd:
+    KeReleaseQueuedLock(Context->SampleLock);
+    return;
+}
+
@@ -512,6 +512,7 @@ Return Value:
 {
 
     CALENDAR_TIME CalendarTime;
+    ULONGLONG ProcessorCounterOffset;
     KSTATUS Status;
     SYSTEM_TIME SystemTime;
     PUSER_SHARED_DATA UserSharedData;
@@ -524,6 +525,19 @@ Return Value:
     UserSharedData->ProcessorCounterFrequency =
                                             HlQueryProcessorCounterFrequency();
 
+    //
+    // If the time counter is just an offset from an invariant processor
+    // counter, let user mode compute it without a system call. Publish the
+    // offset before the flag so that nobody sees the flag with a stale offset.
+    //
+
+    if (HlQueryProcessorCounterTimeOffset(&ProcessorCounterOffset) != FALSE) {
+        UserSharedData->ProcessorCounterTimeOffset = ProcessorCounterOffset;
+        RtlMemoryBarrier();
+        UserSharedData->TimeCounterFlags |=
+                                      USER_TIME_COUNTER_FLAG_PROCESSOR_COUNTER;
+    }
+
     //
     // If no calendar services are around, set this to the boot time and go
     // from there.
@@ -796,13 +796,16 @@ Return Value:
 {
 
     ULONG ActiveCount;
+    ULONG CurrentNode;
     ULONG CurrentNumber;
     PSCHEDULER_GROUP_ENTRY DestinationGroupEntry;
     BOOL FirstThread;
     PSCHEDULER_GROUP Group;
+    BOOL LocalPass;
     ULONG Number;
     RUNLEVEL OldRunLevel;
     PPROCESSOR_BLOCK ProcessorBlock;
+    BOOL SameNode;
     PSCHEDULER_GROUP_ENTRY SourceGroupEntry;
     PSCHEDULER_DATA VictimScheduler;
     PKTHREAD VictimThread;
@@ -817,12 +820,17 @@ Return Value:
     ASSERT(OldRunLevel == RunLevelLow);
 
     CurrentNumber = KeGetCurrentProcessorNumber();
+    CurrentNode = KeProcessorBlocks[CurrentNumber]->NumaNode;
     VictimThread = NULL;
 
     //
     // Try to steal from another processor, starting with the next neighbor.
+    // The first trip around only considers processors in the same NUMA node,
+    // so that stolen threads stay near the memory they have been using. The
+    // second trip considers the processors in other nodes.
     //
 
+    LocalPass = TRUE;
     Number = CurrentNumber + 1;
     while (TRUE) {
         if (Number == ActiveCount) {
@@ -830,13 +838,25 @@ Return Value:
         }
 
         if (Number == CurrentNumber) {
-            break;
+            if (LocalPass == FALSE) {
+                break;
+            }
+
+            LocalPass = FALSE;
+            Number += 1;
+            continue;
         }
 
         ProcessorBlock = KeProcessorBlocks[Number];
         VictimScheduler = &(ProcessorBlock->Scheduler);
-        if (VictimScheduler->Group.ReadyThreadCount >=
-            SCHEDULER_REBALANCE_MINIMUM_THREADS) {
+        SameNode = FALSE;
+        if (ProcessorBlock->NumaNode == CurrentNode) {
+            SameNode = TRUE;
+        }
+
+        if ((SameNode == LocalPass) &&
+            (VictimScheduler->Group.ReadyThreadCount >=
+             SCHEDULER_REBALANCE_MINIMUM_THREADS)) {
 
             KeAcquireSpinLock(&(VictimScheduler->Lock));
             VictimThread = KepGetNextThread(VictimScheduler, TRUE);
@@ -221,6 +221,10 @@ SYSTEM_CALL_TABLE_ENTRY KeSystemCallTable[SystemCallCount] = {
     {MmSysSetBreak,
         sizeof(SYSTEM_CALL_SET_BREAK),
         sizeof(SYSTEM_CALL_SET_BREAK)},
+    {IoSysCreateIoRing,
+        sizeof(SYSTEM_CALL_CREATE_IO_RING),
+        sizeof(SYSTEM_CALL_CREATE_IO_RING)},
+    {IoSysSubmitIoRing, sizeof(SYSTEM_CALL_SUBMIT_IO_RING), 0},
 };
 
 //
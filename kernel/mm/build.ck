@@ -51,6 +51,7 @@ function build() {
         "iobuf.c",
         "load.c",
         "mdl.c",
+        "merge.c",
         "paging.c",
         "physical.c",
         "kpools.c",
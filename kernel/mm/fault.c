@@ -226,6 +226,18 @@ Return Value:
                 continue;
             }
 
+            //
+            // Map in the neighboring pages of page cache backed sections, and
+            // read back the rest of the run if this page came from the page
+            // file, to save the faults that sequential access would otherwise
+            // take.
+            //
+
+            if (KSUCCESS(Status)) {
+                MmpFaultAroundBackedSection(ImageSection, PageOffset);
+                MmpReadAheadPageFile(ImageSection, PageOffset);
+            }
+
             if (!KSUCCESS(Status) && (Status != STATUS_TOO_LATE)) {
 
                 //
@@ -31,6 +31,7 @@ Module Name:
 //
 
 #include <minoca/kernel/kernel.h>
+#include "mmp.h"
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -51,6 +52,21 @@ MmpGetSetSystemMemoryInformation (
     BOOL Set
     );
 
+KSTATUS
+MmpGetSetNumaNodeInformation (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+KSTATUS
+MmpGetSetPageMergeInformation (
+    BOOL FromKernelMode,
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -106,6 +122,18 @@ Return Value:
         Status = MmpGetSetSystemMemoryInformation(Data, DataSize, Set);
         break;
 
+    case MmInformationNumaNodes:
+        Status = MmpGetSetNumaNodeInformation(Data, DataSize, Set);
+        break;
+
+    case MmInformationPageMerge:
+        Status = MmpGetSetPageMergeInformation(FromKernelMode,
+                                               Data,
+                                               DataSize,
+                                               Set);
+
+        break;
+
     default:
         Status = STATUS_INVALID_PARAMETER;
         *DataSize = 0;
@@ -167,3 +195,117 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+MmpGetSetNumaNodeInformation (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets per NUMA node memory information.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN RequiredSize;
+
+    RequiredSize = MmNumaNodeCount * sizeof(MM_NUMA_NODE_STATISTICS);
+    if (*DataSize != RequiredSize) {
+        *DataSize = RequiredSize;
+        return STATUS_DATA_LENGTH_MISMATCH;
+    }
+
+    if (Set != FALSE) {
+        *DataSize = 0;
+        return STATUS_ACCESS_DENIED;
+    }
+
+    MmpGetNumaNodeStatistics(Data);
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+MmpGetSetPageMergeInformation (
+    BOOL FromKernelMode,
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the state of the page merge scanner.
+
+Arguments:
+
+    FromKernelMode - Supplies a boolean indicating whether or not this request
+        (and the buffer associated with it) originates from user mode (FALSE)
+        or kernel mode (TRUE).
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PMM_PAGE_MERGE_INFORMATION Information;
+    KSTATUS Status;
+
+    if (*DataSize != sizeof(MM_PAGE_MERGE_INFORMATION)) {
+        *DataSize = sizeof(MM_PAGE_MERGE_INFORMATION);
+        return STATUS_DATA_LENGTH_MISMATCH;
+    }
+
+    Information = Data;
+    if (Set != FALSE) {
+        if (FromKernelMode == FALSE) {
+            Status = PsCheckPermission(PERMISSION_SYSTEM_ADMINISTRATOR);
+            if (!KSUCCESS(Status)) {
+                *DataSize = 0;
+                return Status;
+            }
+        }
+
+        Status = MmpEnablePageMerge(Information->Enabled);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
+    MmpGetPageMergeInformation(Information);
+    return STATUS_SUCCESS;
+}
+
@@ -357,6 +357,16 @@ Return Value:
         if (MmPhysicalPageZeroAvailable != FALSE) {
             MmpAddPageZeroDescriptorsToMdl(&MmKernelVirtualSpace);
         }
+
+        //
+        // Start re-sharing forked pages and reclaiming zero pages if
+        // requested.
+        //
+
+        Status = MmpInitializePageMerge();
+        if (!KSUCCESS(Status)) {
+            goto InitializeEnd;
+        }
     }
 
 InitializeEnd:
@@ -0,0 +1,814 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    merge.c
+
+Abstract:
+
+    This module implements the background page merge scanner, which does
+    fork page re-sharing and zero page reclaim. The scanner walks resident
+    pages of private anonymous sections looking for pages that no longer need
+    their own physical page: pages that are entirely zero, and pages of forked
+    sections that are identical to the page they were copied from. Zero pages
+    are released to be zero-filled on the next touch, and identical pages are
+    folded back into the parent's page using the image section inheritance
+    that fork set up in the first place. A later write breaks the sharing
+    again through the normal copy-on-write path.
+
+    This is not general same-page merging. There is no index of page
+    contents, so identical pages in unrelated sections, or at different
+    offsets, are never shared. The only page a private page is compared
+    against is the one its fork parent owns at the same offset.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "mmp.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the number of physical pages the scanner looks at each time it
+// wakes up, and how long it sleeps in between, in milliseconds.
+//
+
+#define PAGE_MERGE_SCAN_PAGE_COUNT 1024
+#define PAGE_MERGE_SCAN_INTERVAL 1000
+
+//
+// Define the number of pages of VA the scanner uses to look at the contents
+// of a page and the page it might be merged with.
+//
+
+#define PAGE_MERGE_REGION_PAGE_COUNT 2
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+MmpPageMergeThread (
+    PVOID Parameter
+    );
+
+VOID
+MmpScanForMergeablePages (
+    PVOID SwapAddress,
+    UINTN PageBudget
+    );
+
+VOID
+MmpMergePage (
+    PIMAGE_SECTION Section,
+    UINTN PageOffset,
+    PHYSICAL_ADDRESS PhysicalAddress,
+    PVOID SwapAddress
+    );
+
+PHYSICAL_ADDRESS
+MmpGetSectionPhysicalAddress (
+    PIMAGE_SECTION Section,
+    PVOID VirtualAddress
+    );
+
+BOOL
+MmpIsPageMergeable (
+    PIMAGE_SECTION Section
+    );
+
+BOOL
+MmpIsPageZero (
+    PVOID Page
+    );
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store whether or not the scanner should be running, whether or not its
+// thread has been created, and the event used to wake it.
+//
+
+volatile BOOL MmPageMergeEnabled = FALSE;
+volatile ULONG MmPageMergeThreadCreated = FALSE;
+PKEVENT MmPageMergeEvent;
+
+//
+// Store the cumulative scanner counters. These are only updated by the
+// scanner thread.
+//
+
+volatile UINTN MmPageMergePagesScanned;
+volatile UINTN MmPageMergeForkPagesReshared;
+volatile UINTN MmPageMergeZeroPagesFreed;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+MmpInitializePageMerge (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts the background page merge scanner if it was requested
+    on the kernel command line.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PKERNEL_ARGUMENT MergeArgument;
+    PCSTR MergeString;
+    ULONG MergeStringSize;
+    LONGLONG MergeValue;
+    KSTATUS Status;
+
+    MmPageMergeEvent = KeCreateEvent(NULL);
+    if (MmPageMergeEvent == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    MergeArgument = KeGetKernelArgument(NULL,
+                                        MM_KERNEL_ARGUMENT_COMPONENT,
+                                        MM_KERNEL_ARGUMENT_PAGE_MERGE);
+
+    if ((MergeArgument == NULL) || (MergeArgument->ValueCount == 0)) {
+        return STATUS_SUCCESS;
+    }
+
+    MergeString = MergeArgument->Values[0];
+    MergeStringSize = RtlStringLength(MergeString) + 1;
+    Status = RtlStringScanInteger(&MergeString,
+                                  &MergeStringSize,
+                                  0,
+                                  FALSE,
+                                  &MergeValue);
+
+    if ((!KSUCCESS(Status)) || (MergeValue == 0)) {
+        return STATUS_SUCCESS;
+    }
+
+    return MmpEnablePageMerge(TRUE);
+}
+
+KSTATUS
+MmpEnablePageMerge (
+    BOOL Enable
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts or stops the background page merge scanner. The
+    scanner thread is created the first time it is enabled.
+
+Arguments:
+
+    Enable - Supplies a boolean indicating whether to start (TRUE) or stop
+        (FALSE) scanning.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Created;
+    KSTATUS Status;
+
+    if (MmPageMergeEvent == NULL) {
+        return STATUS_NOT_READY;
+    }
+
+    MmPageMergeEnabled = Enable;
+    if (Enable != FALSE) {
+        Created = RtlAtomicCompareExchange32(&MmPageMergeThreadCreated,
+                                             TRUE,
+                                             FALSE);
+
+        if (Created == FALSE) {
+            Status = PsCreateKernelThread(MmpPageMergeThread,
+                                          NULL,
+                                          "MmpPageMergeThread");
+
+            if (!KSUCCESS(Status)) {
+                MmPageMergeEnabled = FALSE;
+                RtlAtomicExchange32(&MmPageMergeThreadCreated, FALSE);
+                return Status;
+            }
+        }
+    }
+
+    KeSignalEvent(MmPageMergeEvent, SignalOptionSignalAll);
+    return STATUS_SUCCESS;
+}
+
+VOID
+MmpGetPageMergeInformation (
+    PMM_PAGE_MERGE_INFORMATION Information
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the state and counters of the page merge scanner.
+
+Arguments:
+
+    Information - Supplies a pointer where the information will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Information->Enabled = MmPageMergeEnabled;
+    Information->PagesScanned = MmPageMergePagesScanned;
+    Information->ForkPagesReshared = MmPageMergeForkPagesReshared;
+    Information->ZeroPagesFreed = MmPageMergeZeroPagesFreed;
+    Information->PagesSaved = Information->ForkPagesReshared +
+                              Information->ZeroPagesFreed;
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+MmpPageMergeThread (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the background page merge scanner. It wakes up
+    periodically while enabled and looks at a portion of physical memory.
+
+Arguments:
+
+    Parameter - Supplies a pointer supplied by the creator of the thread. This
+        parameter is not used.
+
+Return Value:
+
+    None. This thread only exits if its resources cannot be allocated.
+
+--*/
+
+{
+
+    UINTN RegionSize;
+    PMEMORY_RESERVATION SwapRegion;
+
+    RegionSize = PAGE_MERGE_REGION_PAGE_COUNT << MmPageShift();
+    SwapRegion = MmCreateMemoryReservation(NULL,
+                                           RegionSize,
+                                           0,
+                                           MAX_ADDRESS,
+                                           AllocationStrategyAnyAddress,
+                                           TRUE);
+
+    if (SwapRegion == NULL) {
+        MmPageMergeEnabled = FALSE;
+        RtlAtomicExchange32(&MmPageMergeThreadCreated, FALSE);
+        return;
+    }
+
+    //
+    // Create the page tables up front so that mapping pages to compare them
+    // never needs to allocate while a section lock is held.
+    //
+
+    MmpCreatePageTables(SwapRegion->VirtualBase, SwapRegion->Size);
+    while (TRUE) {
+        if (MmPageMergeEnabled == FALSE) {
+            KeWaitForEvent(MmPageMergeEvent, FALSE, WAIT_TIME_INDEFINITE);
+            KeSignalEvent(MmPageMergeEvent, SignalOptionUnsignal);
+            continue;
+        }
+
+        MmpScanForMergeablePages(SwapRegion->VirtualBase,
+                                 PAGE_MERGE_SCAN_PAGE_COUNT);
+
+        KeWaitForEvent(MmPageMergeEvent, FALSE, PAGE_MERGE_SCAN_INTERVAL);
+        KeSignalEvent(MmPageMergeEvent, SignalOptionUnsignal);
+    }
+
+    return;
+}
+
+VOID
+MmpScanForMergeablePages (
+    PVOID SwapAddress,
+    UINTN PageBudget
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks at the next portion of physical memory, trying to
+    merge each candidate page it finds.
+
+Arguments:
+
+    SwapAddress - Supplies the base of the VA region the scanner uses to look
+        at page contents.
+
+    PageBudget - Supplies the number of physical pages to look at.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN PageOffset;
+    UINTN PagesScanned;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PIMAGE_SECTION Section;
+
+    while (PageBudget != 0) {
+        Section = MmpFindPageMergeCandidate(PageBudget,
+                                            &PagesScanned,
+                                            &PageOffset,
+                                            &PhysicalAddress);
+
+        ASSERT(PagesScanned <= PageBudget);
+
+        PageBudget -= PagesScanned;
+        MmPageMergePagesScanned += PagesScanned;
+        if (Section == NULL) {
+            break;
+        }
+
+        MmpMergePage(Section, PageOffset, PhysicalAddress, SwapAddress);
+        MmpImageSectionReleaseReference(Section);
+    }
+
+    return;
+}
+
+VOID
+MmpMergePage (
+    PIMAGE_SECTION Section,
+    UINTN PageOffset,
+    PHYSICAL_ADDRESS PhysicalAddress,
+    PVOID SwapAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to release the given private page of an anonymous
+    section. If the page is all zeros, it is freed and will be zero-filled on
+    the next touch. If the section was forked and the page is identical to the
+    one it was copied from, the section goes back to inheriting that page.
+
+Arguments:
+
+    Section - Supplies a pointer to the image section the page belongs to.
+
+    PageOffset - Supplies the offset, in pages, of the page within the section.
+
+    PhysicalAddress - Supplies the physical address of the page, as found by
+        the scan. This is revalidated with the section lock held.
+
+    SwapAddress - Supplies the base of the VA region the scanner uses to look
+        at page contents.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BitmapIndex;
+    ULONG BitmapMask;
+    PIMAGE_SECTION Child;
+    BOOL Claimed;
+    PLIST_ENTRY CurrentEntry;
+    BOOL Dirty;
+    BOOL Equal;
+    UINTN MappedPages;
+    PIMAGE_SECTION OwningSection;
+    ULONG PageShift;
+    ULONG PageSize;
+    PVOID SharedAddress;
+    PHYSICAL_ADDRESS SharedPhysicalAddress;
+    PVOID VirtualAddress;
+
+    Claimed = FALSE;
+    MappedPages = 0;
+    OwningSection = NULL;
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    SharedAddress = SwapAddress + PageSize;
+    BitmapIndex = IMAGE_SECTION_BITMAP_INDEX(PageOffset);
+    BitmapMask = IMAGE_SECTION_BITMAP_MASK(PageOffset);
+    KeAcquireQueuedLock(Section->Lock);
+    if ((MmpIsPageMergeable(Section) == FALSE) ||
+        (PageOffset >= (Section->Size >> PageShift))) {
+
+        goto MergePageEnd;
+    }
+
+    //
+    // The page must still be this section's private page, mapped where the
+    // scan found it.
+    //
+
+    if ((Section->Parent != NULL) &&
+        ((Section->InheritPageBitmap[BitmapIndex] & BitmapMask) != 0)) {
+
+        goto MergePageEnd;
+    }
+
+    VirtualAddress = Section->VirtualAddress + (PageOffset << PageShift);
+    if (MmpGetSectionPhysicalAddress(Section, VirtualAddress) !=
+        PhysicalAddress) {
+
+        goto MergePageEnd;
+    }
+
+    //
+    // Leave pages that children are still sharing alone. They are already
+    // doing their part.
+    //
+
+    CurrentEntry = Section->ChildList.Next;
+    while (CurrentEntry != &(Section->ChildList)) {
+        Child = LIST_VALUE(CurrentEntry, IMAGE_SECTION, CopyListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if ((Child->InheritPageBitmap[BitmapIndex] & BitmapMask) != 0) {
+            goto MergePageEnd;
+        }
+    }
+
+    MmpMapPage(PhysicalAddress,
+               SwapAddress,
+               MAP_FLAG_PRESENT | MAP_FLAG_READ_ONLY);
+
+    MappedPages = 1;
+
+    //
+    // A zero page can simply be freed. With the dirty bit clear, the next
+    // fault zero-fills a fresh page. Check again once the page is unmapped,
+    // as it may have been written in the meantime.
+    //
+
+    if (MmpIsPageZero(SwapAddress) != FALSE) {
+        Claimed = MmpClaimPagesForMerge(Section->Lock,
+                                        PhysicalAddress,
+                                        INVALID_PHYSICAL_ADDRESS);
+
+        if (Claimed == FALSE) {
+            goto MergePageEnd;
+        }
+
+        MmpModifySectionMapping(Section,
+                                PageOffset,
+                                INVALID_PHYSICAL_ADDRESS,
+                                FALSE,
+                                &Dirty,
+                                TRUE);
+
+        if (MmpIsPageZero(SwapAddress) != FALSE) {
+            Section->DirtyPageBitmap[BitmapIndex] &= ~BitmapMask;
+            MmpUnmapPages(SwapAddress,
+                          MappedPages,
+                          UNMAP_FLAG_SEND_INVALIDATE_IPI,
+                          NULL);
+
+            MappedPages = 0;
+            MmFreePhysicalPage(PhysicalAddress);
+            MmPageMergeZeroPagesFreed += 1;
+
+        } else {
+            MmpModifySectionMapping(Section,
+                                    PageOffset,
+                                    PhysicalAddress,
+                                    TRUE,
+                                    NULL,
+                                    FALSE);
+
+            if ((Dirty != FALSE) &&
+                ((Section->Flags & IMAGE_SECTION_WAS_WRITABLE) != 0)) {
+
+                Section->DirtyPageBitmap[BitmapIndex] |= BitmapMask;
+            }
+        }
+
+        goto MergePageEnd;
+    }
+
+    //
+    // Otherwise the only page this one can be merged with is the page it was
+    // copied from, which is the page the parent tree currently owns at the
+    // same offset.
+    //
+
+    if (Section->Parent == NULL) {
+        goto MergePageEnd;
+    }
+
+    OwningSection = MmpGetOwningSection(Section->Parent, PageOffset);
+    if ((MmpIsPageMergeable(OwningSection) == FALSE) ||
+        (OwningSection->VirtualAddress != Section->VirtualAddress)) {
+
+        goto MergePageEnd;
+    }
+
+    SharedPhysicalAddress = MmpGetSectionPhysicalAddress(OwningSection,
+                                                         VirtualAddress);
+
+    if (SharedPhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+        goto MergePageEnd;
+    }
+
+    MmpMapPage(SharedPhysicalAddress,
+               SharedAddress,
+               MAP_FLAG_PRESENT | MAP_FLAG_READ_ONLY);
+
+    MappedPages = 2;
+    if (RtlCompareMemory(SwapAddress, SharedAddress, PageSize) == FALSE) {
+        goto MergePageEnd;
+    }
+
+    Claimed = MmpClaimPagesForMerge(Section->Lock,
+                                    PhysicalAddress,
+                                    SharedPhysicalAddress);
+
+    if (Claimed == FALSE) {
+        goto MergePageEnd;
+    }
+
+    //
+    // Start inheriting the page again, and unmap the owner's page everywhere
+    // it is mapped. This includes this section's private page, since it now
+    // shows up as an inheriting child. With nobody able to write to either
+    // page, compare them again.
+    //
+
+    Section->InheritPageBitmap[BitmapIndex] |= BitmapMask;
+    MmpModifySectionMapping(OwningSection,
+                            PageOffset,
+                            INVALID_PHYSICAL_ADDRESS,
+                            FALSE,
+                            &Dirty,
+                            TRUE);
+
+    Equal = RtlCompareMemory(SwapAddress, SharedAddress, PageSize);
+    if ((Dirty != FALSE) &&
+        ((OwningSection->Flags & IMAGE_SECTION_WAS_WRITABLE) != 0)) {
+
+        OwningSection->DirtyPageBitmap[BitmapIndex] |= BitmapMask;
+    }
+
+    if (Equal == FALSE) {
+        Section->InheritPageBitmap[BitmapIndex] &= ~BitmapMask;
+        if ((Dirty != FALSE) &&
+            ((Section->Flags & IMAGE_SECTION_WAS_WRITABLE) != 0)) {
+
+            Section->DirtyPageBitmap[BitmapIndex] |= BitmapMask;
+        }
+
+        MmpModifySectionMapping(Section,
+                                PageOffset,
+                                PhysicalAddress,
+                                TRUE,
+                                NULL,
+                                FALSE);
+    }
+
+    //
+    // Map the owner's page back. The mapping is read-only in every section
+    // now that this section inherits it again, so a write by anyone copies
+    // the page.
+    //
+
+    MmpModifySectionMapping(OwningSection,
+                            PageOffset,
+                            SharedPhysicalAddress,
+                            TRUE,
+                            NULL,
+                            FALSE);
+
+    if (Equal != FALSE) {
+
+        //
+        // Like a freshly forked child, the section is dirty exactly when the
+        // section it inherits from is.
+        //
+
+        if ((OwningSection->DirtyPageBitmap[BitmapIndex] & BitmapMask) != 0) {
+            Section->DirtyPageBitmap[BitmapIndex] |= BitmapMask;
+
+        } else {
+            Section->DirtyPageBitmap[BitmapIndex] &= ~BitmapMask;
+        }
+
+        MmpUnmapPages(SwapAddress,
+                      MappedPages,
+                      UNMAP_FLAG_SEND_INVALIDATE_IPI,
+                      NULL);
+
+        MappedPages = 0;
+        MmFreePhysicalPage(PhysicalAddress);
+        MmPageMergeForkPagesReshared += 1;
+    }
+
+MergePageEnd:
+    if (MappedPages != 0) {
+        MmpUnmapPages(SwapAddress,
+                      MappedPages,
+                      UNMAP_FLAG_SEND_INVALIDATE_IPI,
+                      NULL);
+    }
+
+    if (Claimed != FALSE) {
+        MmpReleasePagesForMerge();
+    }
+
+    KeReleaseQueuedLock(Section->Lock);
+    if (OwningSection != NULL) {
+        MmpImageSectionReleaseReference(OwningSection);
+    }
+
+    return;
+}
+
+PHYSICAL_ADDRESS
+MmpGetSectionPhysicalAddress (
+    PIMAGE_SECTION Section,
+    PVOID VirtualAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the physical page currently mapped at the given
+    address of the given section, which may belong to another process.
+
+Arguments:
+
+    Section - Supplies a pointer to the image section.
+
+    VirtualAddress - Supplies the virtual address to look up.
+
+Return Value:
+
+    Returns the physical address mapped at the given virtual address, or
+    INVALID_PHYSICAL_ADDRESS if the page is not mapped.
+
+--*/
+
+{
+
+    if (Section->AddressSpace == MmKernelAddressSpace) {
+        return MmpVirtualToPhysical(VirtualAddress, NULL);
+    }
+
+    return MmpVirtualToPhysicalInOtherProcess(Section->AddressSpace,
+                                              VirtualAddress);
+}
+
+BOOL
+MmpIsPageMergeable (
+    PIMAGE_SECTION Section
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether pages of the given section can be merged.
+    Only live, private, pagable, anonymous user mode sections qualify.
+
+Arguments:
+
+    Section - Supplies a pointer to the image section. The section lock must
+        be held.
+
+Return Value:
+
+    TRUE if the section's pages may be merged.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    ASSERT(KeIsQueuedLockHeld(Section->Lock) != FALSE);
+
+    if ((Section->VirtualAddress >= USER_VA_END) ||
+        (Section->DirtyPageBitmap == NULL) ||
+        ((Section->Flags &
+          (IMAGE_SECTION_BACKED | IMAGE_SECTION_SHARED |
+           IMAGE_SECTION_NON_PAGED | IMAGE_SECTION_DESTROYING |
+           IMAGE_SECTION_DESTROYED)) != 0)) {
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL
+MmpIsPageZero (
+    PVOID Page
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given page contains only zeros.
+
+Arguments:
+
+    Page - Supplies a pointer to the mapped page.
+
+Return Value:
+
+    TRUE if every byte of the page is zero.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    UINTN Count;
+    UINTN Index;
+    volatile UINTN *Words;
+
+    Words = Page;
+    Count = MmPageSize() / sizeof(UINTN);
+    for (Index = 0; Index < Count; Index += 1) {
+        if (Words[Index] != 0) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
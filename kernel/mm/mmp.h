@@ -38,6 +38,14 @@ Module Name:
 
 #define MM_PAGE_DIRECTORY_BLOCK_ALLOCATOR_EXPANSION_COUNT 4
 
+//
+// Define kernel command line information for the memory manager.
+//
+
+#define MM_KERNEL_ARGUMENT_COMPONENT "mm"
+#define MM_KERNEL_ARGUMENT_FAULT_AROUND "faultaround"
+#define MM_KERNEL_ARGUMENT_PAGE_MERGE "merge"
+
 //
 // Define paging entry flags.
 //
@@ -342,6 +350,12 @@ extern BOOL MmPhysicalPageZeroAvailable;
 
 extern PKEVENT MmPhysicalMemoryWarningEvent;
 
+//
+// Stores the number of NUMA nodes in the system.
+//
+
+extern ULONG MmNumaNodeCount;
+
 //
 // Stores the event used to signal a virtual memory notification when there is
 // a significant change in the amount of allocated virtual memory.
@@ -384,6 +398,13 @@ extern PKTHREAD MmPagingThread;
 extern PKEVENT MmPagingEvent;
 extern PKEVENT MmPagingFreePagesEvent;
 
+//
+// Store the size of the window, in pages, mapped around page cache backed
+// faults.
+//
+
+extern UINTN MmFaultAroundPageCount;
+
 //
 // This lock serializes TLB invaldation IPIs.
 //
@@ -462,6 +483,126 @@ Return Value:
 
 --*/
 
+VOID
+MmpGetNumaNodeStatistics (
+    PMM_NUMA_NODE_STATISTICS Statistics
+    );
+
+/*++
+
+Routine Description:
+
+    This routine fills out the physical memory statistics for each NUMA node.
+
+Arguments:
+
+    Statistics - Supplies a pointer to an array of MmNumaNodeCount statistics
+        structures to fill in.
+
+Return Value:
+
+    None.
+
+--*/
+
+PIMAGE_SECTION
+MmpFindPageMergeCandidate (
+    UINTN PageBudget,
+    PUINTN PagesScanned,
+    PUINTN PageOffset,
+    PPHYSICAL_ADDRESS PhysicalAddress
+    );
+
+/*++
+
+Routine Description:
+
+    This routine continues the page merge scanner's sweep across the physical
+    page database, looking for a resident page of a private anonymous user
+    mode section.
+
+Arguments:
+
+    PageBudget - Supplies the maximum number of physical pages to look at.
+
+    PagesScanned - Supplies a pointer where the number of physical pages
+        looked at will be returned.
+
+    PageOffset - Supplies a pointer where the offset, in pages, of the
+        candidate page within its image section will be returned.
+
+    PhysicalAddress - Supplies a pointer where the physical address of the
+        candidate page will be returned.
+
+Return Value:
+
+    Returns a pointer to the image section that the candidate page belongs to.
+    The caller is responsible for releasing the reference taken on it.
+
+    NULL if no candidate was found within the budget.
+
+--*/
+
+BOOL
+MmpClaimPagesForMerge (
+    PQUEUED_LOCK SectionLock,
+    PHYSICAL_ADDRESS PhysicalAddress,
+    PHYSICAL_ADDRESS SharedPhysicalAddress
+    );
+
+/*++
+
+Routine Description:
+
+    This routine prevents the given pages from being selected for page out
+    while the page merge scanner unmaps, compares, and potentially frees them.
+    The caller must hold the given section lock, which keeps the pages from
+    being locked in the meantime.
+
+Arguments:
+
+    SectionLock - Supplies a pointer to the lock shared by the image section
+        tree that both pages belong to.
+
+    PhysicalAddress - Supplies the physical address of the page that may be
+        freed.
+
+    SharedPhysicalAddress - Supplies an optional physical address of the page
+        that will be kept and shared in its place. Supply
+        INVALID_PHYSICAL_ADDRESS if there is no such page.
+
+Return Value:
+
+    TRUE if the pages were claimed. The caller must call
+    MmpReleasePagesForMerge when it is done with them.
+
+    FALSE if the pages are already being paged out, are locked, or no longer
+    belong to the section tree.
+
+--*/
+
+VOID
+MmpReleasePagesForMerge (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine allows the pages claimed by the page merge scanner to be
+    selected for page out again.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
 PHYSICAL_ADDRESS
 MmpAllocatePhysicalPage (
     VOID
@@ -765,28 +906,22 @@ Return Value:
 
 UINTN
 MmpPageOutPhysicalPages (
-    UINTN FreePagesTarget,
-    PIO_BUFFER IoBuffer,
-    PMEMORY_RESERVATION SwapRegion
+    UINTN FreePagesTarget
     );
 
 /*++
 
 Routine Description:
 
-    This routine pages out physical pages to the backing store.
+    This routine pages out physical pages to the backing store. Page outs are
+    spread across the page out writers, so several page file writes can be in
+    flight at once. This routine waits for all of them before returning.
 
 Arguments:
 
     FreePagesTarget - Supplies the target number of free pages the system
         should have.
 
-    IoBuffer - Supplies a pointer to an allocated but uninitialized I/O buffer
-        to use during page out I/O.
-
-    SwapRegion - Supplies a pointer to a region of VA space to use during page
-        out I/O.
-
 Return Value:
 
     Returns the number of physical pages that were able to be paged out.
@@ -2225,6 +2360,37 @@ Return Value:
 
 --*/
 
+VOID
+MmpFaultAroundBackedSection (
+    PIMAGE_SECTION ImageSection,
+    UINTN PageOffset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine maps the pages surrounding a just-resolved fault in a page
+    cache backed section. It reads the aligned window containing the faulting
+    page through the page cache, which finds the pages that are already cached
+    and reads any misses from the device together, and then maps every page in
+    the window that is not already mapped or dirty. This is purely an
+    optimization, so failures are ignored. This routine must be called at low
+    level from the faulting process.
+
+Arguments:
+
+    ImageSection - Supplies a pointer to the image section that took the
+        fault.
+
+    PageOffset - Supplies the offset, in pages, of the page that faulted.
+
+Return Value:
+
+    None.
+
+--*/
+
 KSTATUS
 MmpPageInAndLock (
     PIMAGE_SECTION Section,
@@ -2253,6 +2419,37 @@ Return Value:
 
 --*/
 
+VOID
+MmpReadAheadPageFile (
+    PIMAGE_SECTION ImageSection,
+    UINTN PageOffset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads in the swapped out pages next to a page that was just
+    paged in, so that the run of pages written out together comes back in
+    together instead of one fault at a time. Only the pages in the aligned
+    window around the faulting page that live in the same page file run are
+    read, with a single I/O. This is purely an optimization, so failures are
+    ignored. This routine must be called at low level from the faulting
+    process.
+
+Arguments:
+
+    ImageSection - Supplies a pointer to the image section that took the
+        fault.
+
+    PageOffset - Supplies the offset, in pages, of the page that faulted.
+
+Return Value:
+
+    None.
+
+--*/
+
 KSTATUS
 MmpPageOut (
     PPAGING_ENTRY PagingEntry,
@@ -2261,6 +2458,7 @@ MmpPageOut (
     PHYSICAL_ADDRESS PhysicalAddress,
     PIO_BUFFER IoBuffer,
     PMEMORY_RESERVATION SwapRegion,
+    ULONG WriterIndex,
     PUINTN PagesPaged
     );
 
@@ -2291,6 +2489,9 @@ Routine Description:
     SwapRegion - Supplies a pointer to a region of VA space to use during
         paging.
 
+    WriterIndex - Supplies the index of the page out writer doing the page
+        out, which selects the page file IRP used for the write.
+
     PagesPaged - Supplies a pointer where the count of pages removed will
         be returned.
 
@@ -2300,6 +2501,179 @@ Return Value:
 
 --*/
 
+VOID
+MmpQueuePageOut (
+    PPAGING_ENTRY PagingEntry,
+    PIMAGE_SECTION Section,
+    UINTN PageOffset,
+    PHYSICAL_ADDRESS PhysicalAddress,
+    PUINTN PagesPaged,
+    PULONG FailureCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine hands a page flagged for paging out to a page out writer.
+    If a writer thread is idle, the page out proceeds in the background.
+    Otherwise it is performed synchronously on the paging thread, which keeps
+    the number of writes in flight bounded. Only the paging thread may call
+    this routine.
+
+Arguments:
+
+    PagingEntry - Supplies a pointer to the physical page's paging entry.
+
+    Section - Supplies a pointer to the image section, snapped from the paging
+        entry while the physical page lock was still held.
+
+    PageOffset - Supplies the offset into the section in pages where this page
+        resides, snapped from the paging entry while the physical page lock
+        was still held.
+
+    PhysicalAddress - Supplies the address of the physical page to swap out.
+
+    PagesPaged - Supplies a pointer that is incremented by the number of pages
+        paged out by this page out or any background page outs collected
+        along the way.
+
+    FailureCount - Supplies a pointer that is incremented for every failed
+        page out.
+
+Return Value:
+
+    None.
+
+--*/
+
+ULONG
+MmpCollectPageOuts (
+    BOOL Wait,
+    PUINTN PagesPaged,
+    PULONG FailureCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine collects the results of background page outs. Only the
+    paging thread may call this routine.
+
+Arguments:
+
+    Wait - Supplies a boolean indicating whether or not to wait for at least
+        one busy writer to complete.
+
+    PagesPaged - Supplies a pointer that is incremented by the number of pages
+        paged out by the completed writers.
+
+    FailureCount - Supplies a pointer that is incremented for every failed
+        page out.
+
+Return Value:
+
+    Returns the number of writers that were busy or complete when this
+    routine was called. Zero means there were no background page outs left to
+    collect.
+
+--*/
+
+BOOL
+MmpIsSectionPagingOut (
+    PIMAGE_SECTION Section
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a background page out writer has been
+    handed a page of the given section and not yet been collected. The pages
+    of such a section cannot be chosen for page out, as the writer may already
+    have gathered them into its run. This routine can only be called by the
+    paging thread.
+
+Arguments:
+
+    Section - Supplies a pointer to the image section to check. It is only
+        compared, not dereferenced.
+
+Return Value:
+
+    TRUE if a writer is paging out the section.
+
+    FALSE otherwise.
+
+--*/
+
+KSTATUS
+MmpInitializePageMerge (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine starts the background page merge scanner if it was requested
+    on the kernel command line.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+MmpEnablePageMerge (
+    BOOL Enable
+    );
+
+/*++
+
+Routine Description:
+
+    This routine starts or stops the background page merge scanner. The
+    scanner thread is created the first time it is enabled.
+
+Arguments:
+
+    Enable - Supplies a boolean indicating whether to start (TRUE) or stop
+        (FALSE) scanning.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VOID
+MmpGetPageMergeInformation (
+    PMM_PAGE_MERGE_INFORMATION Information
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the state and counters of the page merge scanner.
+
+Arguments:
+
+    Information - Supplies a pointer where the information will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
 VOID
 MmpModifySectionMapping (
     PIMAGE_SECTION OwningSection,
@@ -59,6 +59,34 @@ Module Name:
 
 #define PAGE_OUT_MAX_CLEAN_STREAK 4
 
+//
+// Define the number of page out writers, which bounds the number of page file
+// writes the paging thread can have in flight at once. Writer zero is always
+// run directly on the paging thread, the rest get their own threads.
+//
+
+#define PAGE_OUT_WRITER_COUNT 4
+
+//
+// Define the maximum number of pages read from the page file in addition to
+// the faulting page. This must be a power of two.
+//
+
+#define PAGE_FILE_READ_AHEAD_PAGE_COUNT 16
+
+//
+// Define the default number of pages in the aligned window that is mapped
+// around a fault in a page cache backed section. This must be a power of two.
+//
+
+#define FAULT_AROUND_DEFAULT_PAGE_COUNT 16
+
+//
+// Define the maximum fault around window size, in pages.
+//
+
+#define FAULT_AROUND_MAX_PAGE_COUNT 256
+
 //
 // Define the alignment and initial capacity for the paging entry block
 // allocator.
@@ -76,6 +104,18 @@ Module Name:
 #define PAGE_IN_CONTEXT_FLAG_ALLOCATE_SWAP_SPACE 0x00000004
 #define PAGE_IN_CONTEXT_FLAG_ALLOCATE_MASK       0x00000007
 
+//
+// Define page file flags.
+//
+
+//
+// This flag is set if the file system backing the page file may need to
+// read-modify-write blocks to satisfy a page sized write, in which case all
+// writes to the page file must be serialized.
+//
+
+#define PAGE_FILE_FLAG_SERIALIZE_WRITES 0x00000001
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -132,8 +172,9 @@ Structure Description:
     IoBuffer - Stores a pointer to an I/O buffer that either contains the data
         to write or will contain the read data.
 
-    Irp - Stores the optional IRP to use for reads. Each page file has its own
-        write IRP.
+    Irp - Stores the optional IRP to use. Reads create an IRP if none is
+        supplied. Writes without an IRP use the page file's paging out IRP,
+        which is serialized by the page file lock.
 
     SizeInBytes - Stores the number of bytes to read or write.
 
@@ -183,6 +224,12 @@ Structure Description:
     PagingOutIrp - Stores a pointer to an IRP used for paging out to this page
         file.
 
+    WriterIrp - Stores an array of IRPs used by each of the page out writers,
+        allowing several writes to this page file to be in flight at once.
+
+    Flags - Stores a bitmask of page file flags. See PAGE_FILE_FLAG_* for
+        definitions.
+
     PageCount - Stores the number of pages this backing store can hold.
 
     FreePages - Stores the number of free pages in this backing store.
@@ -201,12 +248,72 @@ typedef struct _PAGE_FILE {
     PQUEUED_LOCK Lock;
     PULONG Bitmap;
     PIRP PagingOutIrp;
+    PIRP WriterIrp[PAGE_OUT_WRITER_COUNT];
+    ULONG Flags;
     UINTN PageCount;
     UINTN FreePages;
     UINTN LastAllocatedPage;
     UINTN FailedAllocations;
 } PAGE_FILE, *PPAGE_FILE;
 
+typedef enum _PAGE_OUT_WRITER_STATE {
+    PageOutWriterIdle,
+    PageOutWriterBusy,
+    PageOutWriterComplete
+} PAGE_OUT_WRITER_STATE, *PPAGE_OUT_WRITER_STATE;
+
+/*++
+
+Structure Description:
+
+    This structure defines a page out writer, which gathers and writes one
+    run of pages to the page file at a time.
+
+Members:
+
+    WorkEvent - Stores a pointer to the event the writer thread waits on for
+        new work. This is NULL for the writer run on the paging thread.
+
+    IoBuffer - Stores a pointer to the I/O buffer used for the write.
+
+    SwapRegion - Stores a pointer to the region of VA space the pages are
+        mapped to during the write.
+
+    Index - Stores the index of the writer, which selects the page file IRP
+        it uses.
+
+    State - Stores the state of the writer. Only the paging thread moves a
+        writer out of the idle or complete states.
+
+    PagingEntry - Stores a pointer to the paging entry of the victim page.
+
+    Section - Stores a pointer to the image section that owns the victim page.
+
+    PageOffset - Stores the offset, in pages, of the victim page within the
+        section.
+
+    PhysicalAddress - Stores the physical address of the victim page.
+
+    PagesPaged - Stores the number of pages freed by the last page out.
+
+    Status - Stores the status of the last page out.
+
+--*/
+
+typedef struct _PAGE_OUT_WRITER {
+    PKEVENT WorkEvent;
+    PIO_BUFFER IoBuffer;
+    PMEMORY_RESERVATION SwapRegion;
+    ULONG Index;
+    volatile ULONG State;
+    PPAGING_ENTRY PagingEntry;
+    PIMAGE_SECTION Section;
+    UINTN PageOffset;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN PagesPaged;
+    KSTATUS Status;
+} PAGE_OUT_WRITER, *PPAGE_OUT_WRITER;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -241,6 +348,24 @@ MmpPagingThread (
     PVOID Parameter
     );
 
+KSTATUS
+MmpInitializePageOutWriter (
+    PPAGE_OUT_WRITER Writer,
+    ULONG Index
+    );
+
+VOID
+MmpPageOutWriterThread (
+    PVOID Parameter
+    );
+
+VOID
+MmpCollectPageOutWriter (
+    PPAGE_OUT_WRITER Writer,
+    PUINTN PagesPaged,
+    PULONG FailureCount
+    );
+
 KSTATUS
 MmpPageInAnonymousSection (
     PIMAGE_SECTION ImageSection,
@@ -303,6 +428,7 @@ KSTATUS
 MmpReadBackingImage (
     PIMAGE_SECTION Section,
     UINTN PageOffset,
+    UINTN PageCount,
     PIO_BUFFER IoBuffer
     );
 
@@ -333,6 +459,21 @@ MmpCanWriteToSection (
     UINTN PageOffset
     );
 
+UINTN
+MmpFindPageFileRun (
+    PIMAGE_SECTION ImageSection,
+    PIMAGE_SECTION OwningSection,
+    UINTN PageOffset,
+    PUINTN RunStart
+    );
+
+BOOL
+MmpIsPageInPageFile (
+    PIMAGE_SECTION ImageSection,
+    PIMAGE_SECTION OwningSection,
+    UINTN PageOffset
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -357,6 +498,15 @@ BOOL MmPagingForceDisable = FALSE;
 
 BOOL MmPagingAllVolumes = FALSE;
 
+//
+// Store the number of pages in the aligned window around a fault in a page
+// cache backed section that get mapped if they are already cached, or read in
+// together if they are not. Set this to 1 to disable fault around. This can
+// be set with the mm.faultaround kernel argument, and must be a power of two.
+//
+
+UINTN MmFaultAroundPageCount = FAULT_AROUND_DEFAULT_PAGE_COUNT;
+
 //
 // Store a list of the available paging devices.
 //
@@ -374,6 +524,15 @@ PKEVENT MmPagingEvent;
 PKEVENT MmPagingFreePagesEvent;
 volatile UINTN MmPagingFreeTarget;
 
+//
+// Store the page out writers and the event signaled whenever one of the
+// writer threads completes a page out.
+//
+
+PAGE_OUT_WRITER MmPageOutWriters[PAGE_OUT_WRITER_COUNT];
+ULONG MmPageOutWriterCount;
+PKEVENT MmPageOutWriterEvent;
+
 //
 // Store the block allocator used for allocating paging entries.
 //
@@ -727,8 +886,41 @@ Return Value:
 {
 
     PBLOCK_ALLOCATOR BlockAllocator;
+    PKERNEL_ARGUMENT FaultAroundArgument;
+    LONGLONG FaultAroundPageCount;
+    PCSTR FaultAroundString;
+    ULONG FaultAroundStringSize;
     KSTATUS Status;
 
+    //
+    // Pick up the fault around window size from the command line if it was
+    // specified. Ignore values that aren't a sensible power of two.
+    //
+
+    FaultAroundArgument = KeGetKernelArgument(NULL,
+                                              MM_KERNEL_ARGUMENT_COMPONENT,
+                                              MM_KERNEL_ARGUMENT_FAULT_AROUND);
+
+    if ((FaultAroundArgument != NULL) &&
+        (FaultAroundArgument->ValueCount != 0)) {
+
+        FaultAroundString = FaultAroundArgument->Values[0];
+        FaultAroundStringSize = RtlStringLength(FaultAroundString) + 1;
+        Status = RtlStringScanInteger(&FaultAroundString,
+                                      &FaultAroundStringSize,
+                                      0,
+                                      FALSE,
+                                      &FaultAroundPageCount);
+
+        if ((KSUCCESS(Status)) &&
+            (FaultAroundPageCount > 0) &&
+            (FaultAroundPageCount <= FAULT_AROUND_MAX_PAGE_COUNT) &&
+            (POWER_OF_2(FaultAroundPageCount) != FALSE)) {
+
+            MmFaultAroundPageCount = (UINTN)FaultAroundPageCount;
+        }
+    }
+
     //
     // Initialize the structure necessary to maintain a list of page files.
     //
@@ -757,6 +949,12 @@ Return Value:
         goto InitializePagingEnd;
     }
 
+    MmPageOutWriterEvent = KeCreateEvent(NULL);
+    if (MmPageOutWriterEvent == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializePagingEnd;
+    }
+
     //
     // Initialize the block allocator from which paging entries will be
     // allocated.
@@ -800,6 +998,7 @@ Return Value:
     return Status;
 }
 
+KERNEL_API
 KSTATUS
 MmAllocatePageFileSpace (
     PIMAGE_BACKING ImageBacking,
@@ -916,6 +1115,7 @@ Return Value:
     return Status;
 }
 
+KERNEL_API
 VOID
 MmFreePageFileSpace (
     PIMAGE_BACKING ImageBacking,
@@ -1016,6 +1216,7 @@ Return Value:
     return;
 }
 
+KERNEL_API
 KSTATUS
 MmPageFilePerformIo (
     PIMAGE_BACKING ImageBacking,
@@ -1223,31 +1424,473 @@ Return Value:
             goto PageInAndLockEnd;
         }
 
-        //
-        // If the page is already mapped, great. Exit with the lock held.
-        //
+        //
+        // If the page is already mapped, great. Exit with the lock held.
+        //
+
+        PhysicalAddress = MmpVirtualToPhysical(VirtualAddress, NULL);
+        if (PhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
+            Status = STATUS_SUCCESS;
+            goto PageInAndLockEnd;
+        }
+
+        KeReleaseQueuedLock(Section->Lock);
+
+        //
+        // The page is not present. Try to page it in. If this succeeds, then
+        // loop back and try to trap the mapping.
+        //
+
+        Status = MmpPageIn(Section, PageOffset, NULL);
+        if (!KSUCCESS(Status)) {
+            goto PageInAndLockEnd;
+        }
+    }
+
+PageInAndLockEnd:
+    return Status;
+}
+
+VOID
+MmpFaultAroundBackedSection (
+    PIMAGE_SECTION ImageSection,
+    UINTN PageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps the pages surrounding a just-resolved fault in a page
+    cache backed section. It reads the aligned window containing the faulting
+    page through the page cache, which finds the pages that are already cached
+    and reads any misses from the device together, and then maps every page in
+    the window that is not already mapped or dirty. This is purely an
+    optimization, so failures are ignored. This routine must be called at low
+    level from the faulting process.
+
+Arguments:
+
+    ImageSection - Supplies a pointer to the image section that took the
+        fault.
+
+    PageOffset - Supplies the offset, in pages, of the page that faulted.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BitmapIndex;
+    ULONG BitmapMask;
+    UINTN CurrentOffset;
+    PIO_BUFFER IoBuffer;
+    IO_BUFFER IoBufferData;
+    PIMAGE_SECTION OwningSection;
+    PPAGE_CACHE_ENTRY PageCacheEntry;
+    UINTN PageCount;
+    UINTN PageIndex;
+    ULONG PageShift;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN SectionPageCount;
+    KSTATUS Status;
+    ULONG TruncateCount;
+    PVOID VirtualAddress;
+    UINTN WindowEnd;
+    UINTN WindowSize;
+    UINTN WindowStart;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    if (((ImageSection->Flags & IMAGE_SECTION_BACKED) == 0) ||
+        ((ImageSection->Flags &
+          (IMAGE_SECTION_NO_IMAGE_BACKING | IMAGE_SECTION_SHARED)) != 0)) {
+
+        return;
+    }
+
+    WindowSize = MmFaultAroundPageCount;
+    if (WindowSize <= 1) {
+        return;
+    }
+
+    ASSERT(POWER_OF_2(WindowSize) != FALSE);
+
+    IoBuffer = NULL;
+    PageShift = MmPageShift();
+    WindowStart = ALIGN_RANGE_DOWN(PageOffset, WindowSize);
+    WindowEnd = WindowStart + WindowSize;
+
+    //
+    // Clip the window to the section and take a reference on the image
+    // backing while the lock is held.
+    //
+
+    KeAcquireQueuedLock(ImageSection->Lock);
+    if ((ImageSection->Flags & IMAGE_SECTION_DESTROYED) != 0) {
+        KeReleaseQueuedLock(ImageSection->Lock);
+        return;
+    }
+
+    SectionPageCount = ImageSection->Size >> PageShift;
+    if (WindowEnd > SectionPageCount) {
+        WindowEnd = SectionPageCount;
+    }
+
+    if ((WindowStart >= WindowEnd) || ((WindowEnd - WindowStart) <= 1)) {
+        KeReleaseQueuedLock(ImageSection->Lock);
+        return;
+    }
+
+    MmpImageSectionAddImageBackingReference(ImageSection);
+    TruncateCount = ImageSection->TruncateCount;
+    KeReleaseQueuedLock(ImageSection->Lock);
+
+    //
+    // Read the whole window in one go. Pages already in the page cache are
+    // just looked up, and runs of misses are sent to the device as a single
+    // read.
+    //
+
+    IoBuffer = &IoBufferData;
+    Status = MmInitializeIoBuffer(IoBuffer,
+                                  NULL,
+                                  INVALID_PHYSICAL_ADDRESS,
+                                  0,
+                                  IO_BUFFER_FLAG_KERNEL_MODE_DATA);
+
+    if (!KSUCCESS(Status)) {
+        MmpImageSectionReleaseImageBackingReference(ImageSection);
+        IoBuffer = NULL;
+        goto FaultAroundBackedSectionEnd;
+    }
+
+    Status = MmpReadBackingImage(ImageSection,
+                                 WindowStart,
+                                 WindowEnd - WindowStart,
+                                 IoBuffer);
+
+    MmpImageSectionReleaseImageBackingReference(ImageSection);
+    if (!KSUCCESS(Status)) {
+        goto FaultAroundBackedSectionEnd;
+    }
+
+    PageCount = MmGetIoBufferSize(IoBuffer) >> PageShift;
+
+    //
+    // Reacquire the lock and map each page that is still unmapped and clean.
+    // If the section got truncated in the meantime, the pages read may have
+    // been evicted, so just give up.
+    //
+
+    KeAcquireQueuedLock(ImageSection->Lock);
+    if (((ImageSection->Flags & IMAGE_SECTION_DESTROYED) != 0) ||
+        (ImageSection->TruncateCount != TruncateCount)) {
+
+        KeReleaseQueuedLock(ImageSection->Lock);
+        goto FaultAroundBackedSectionEnd;
+    }
+
+    SectionPageCount = ImageSection->Size >> PageShift;
+    for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+        CurrentOffset = WindowStart + PageIndex;
+        if (CurrentOffset >= SectionPageCount) {
+            break;
+        }
+
+        if (CurrentOffset == PageOffset) {
+            continue;
+        }
+
+        PageCacheEntry = MmGetIoBufferPageCacheEntry(IoBuffer,
+                                                     PageIndex << PageShift);
+
+        if (PageCacheEntry == NULL) {
+            continue;
+        }
+
+        VirtualAddress = ImageSection->VirtualAddress +
+                         (CurrentOffset << PageShift);
+
+        if (MmpVirtualToPhysical(VirtualAddress, NULL) !=
+            INVALID_PHYSICAL_ADDRESS) {
+
+            continue;
+        }
+
+        //
+        // Only map pages that still come from the backing image. Dirty pages
+        // need to come in from the page file, which is left to a real fault.
+        //
+
+        OwningSection = MmpGetOwningSection(ImageSection, CurrentOffset);
+
+        ASSERT(OwningSection->DirtyPageBitmap != NULL);
+
+        BitmapIndex = IMAGE_SECTION_BITMAP_INDEX(CurrentOffset);
+        BitmapMask = IMAGE_SECTION_BITMAP_MASK(CurrentOffset);
+        if (((OwningSection->Flags & IMAGE_SECTION_DESTROYED) == 0) &&
+            ((OwningSection->DirtyPageBitmap[BitmapIndex] & BitmapMask) ==
+             0)) {
+
+            PhysicalAddress = IoGetPageCacheEntryPhysicalAddress(PageCacheEntry,
+                                                                 NULL);
+
+            MmpMapPageInSection(OwningSection,
+                                CurrentOffset,
+                                PhysicalAddress,
+                                NULL,
+                                FALSE);
+        }
+
+        MmpImageSectionReleaseReference(OwningSection);
+    }
+
+    KeReleaseQueuedLock(ImageSection->Lock);
+
+FaultAroundBackedSectionEnd:
+    if (IoBuffer != NULL) {
+        MmFreeIoBuffer(IoBuffer);
+    }
+
+    return;
+}
+
+VOID
+MmpReadAheadPageFile (
+    PIMAGE_SECTION ImageSection,
+    UINTN PageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads in the swapped out pages next to a page that was just
+    paged in, so that the run of pages written out together comes back in
+    together instead of one fault at a time. Only the pages in the aligned
+    window around the faulting page that live in the same page file run are
+    read, with a single I/O. This is purely an optimization, so failures are
+    ignored. This routine must be called at low level from the faulting
+    process.
+
+Arguments:
+
+    ImageSection - Supplies a pointer to the image section that took the
+        fault.
+
+    PageOffset - Supplies the offset, in pages, of the page that faulted.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BitmapIndex;
+    ULONG BitmapMask;
+    PDEVICE Device;
+    HANDLE DeviceHandle;
+    UINTN Index;
+    PIO_BUFFER IoBuffer;
+    PAGE_FILE_IO_CONTEXT IoContext;
+    PIRP Irp;
+    PIMAGE_SECTION OwningSection;
+    PPAGE_FILE PageFile;
+    UINTN PageCount;
+    ULONG PageShift;
+    ULONG PageSize;
+    PPAGING_ENTRY PagingEntries[PAGE_FILE_READ_AHEAD_PAGE_COUNT];
+    PHYSICAL_ADDRESS PhysicalAddresses[PAGE_FILE_READ_AHEAD_PAGE_COUNT];
+    UINTN RunStart;
+    KSTATUS Status;
+    PVOID VirtualAddress;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    if ((ImageSection->Flags &
+         (IMAGE_SECTION_NON_PAGED | IMAGE_SECTION_SHARED)) != 0) {
+
+        return;
+    }
+
+    //
+    // Don't add to the memory pressure that likely caused the page out in the
+    // first place.
+    //
+
+    if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevelNone) {
+        return;
+    }
+
+    IoBuffer = NULL;
+    Irp = NULL;
+    PageCount = 0;
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    RunStart = 0;
+
+    //
+    // Find the run of pages next to the faulting page that are still out in
+    // the same page file. The faulting page only came from the page file if
+    // it is dirty.
+    //
+
+    KeAcquireQueuedLock(ImageSection->Lock);
+    OwningSection = MmpGetOwningSection(ImageSection, PageOffset);
+    DeviceHandle = OwningSection->PageFileBacking.DeviceHandle;
+    BitmapIndex = IMAGE_SECTION_BITMAP_INDEX(PageOffset);
+    BitmapMask = IMAGE_SECTION_BITMAP_MASK(PageOffset);
+    if (((ImageSection->Flags & IMAGE_SECTION_DESTROYED) == 0) &&
+        ((OwningSection->Flags & IMAGE_SECTION_DESTROYED) == 0) &&
+        (DeviceHandle != INVALID_HANDLE) &&
+        (OwningSection->DirtyPageBitmap != NULL) &&
+        ((OwningSection->DirtyPageBitmap[BitmapIndex] & BitmapMask) != 0)) {
+
+        PageCount = MmpFindPageFileRun(ImageSection,
+                                       OwningSection,
+                                       PageOffset,
+                                       &RunStart);
+    }
+
+    KeReleaseQueuedLock(ImageSection->Lock);
+    if (PageCount == 0) {
+        goto ReadAheadPageFileEnd;
+    }
+
+    //
+    // Allocate everything up front, as memory cannot be allocated while the
+    // section lock is held without risking a deadlock with the paging thread.
+    //
+
+    for (Index = 0; Index < PAGE_FILE_READ_AHEAD_PAGE_COUNT; Index += 1) {
+        PhysicalAddresses[Index] = INVALID_PHYSICAL_ADDRESS;
+        PagingEntries[Index] = NULL;
+    }
+
+    for (Index = 0; Index < PageCount; Index += 1) {
+        PhysicalAddresses[Index] = MmpAllocatePhysicalPage();
+        if (PhysicalAddresses[Index] == INVALID_PHYSICAL_ADDRESS) {
+            goto ReadAheadPageFileEnd;
+        }
+
+        PagingEntries[Index] = MmpCreatePagingEntry(NULL, 0);
+        if (PagingEntries[Index] == NULL) {
+            goto ReadAheadPageFileEnd;
+        }
+    }
+
+    IoBuffer = MmAllocateUninitializedIoBuffer(PageCount << PageShift, 0);
+    if (IoBuffer == NULL) {
+        goto ReadAheadPageFileEnd;
+    }
+
+    for (Index = 0; Index < PageCount; Index += 1) {
+        MmIoBufferAppendPage(IoBuffer, NULL, NULL, PhysicalAddresses[Index]);
+    }
+
+    Status = MmMapIoBuffer(IoBuffer, FALSE, FALSE, TRUE);
+    if (!KSUCCESS(Status)) {
+        goto ReadAheadPageFileEnd;
+    }
+
+    PageFile = (PPAGE_FILE)DeviceHandle;
+    Status = IoGetDevice(PageFile->Handle, &Device);
+    if (!KSUCCESS(Status)) {
+        goto ReadAheadPageFileEnd;
+    }
+
+    Irp = IoCreateIrp(Device, IrpMajorIo, IRP_CREATE_FLAG_NO_ALLOCATE);
+    if (Irp == NULL) {
+        goto ReadAheadPageFileEnd;
+    }
+
+    //
+    // Reacquire the lock and make sure the run is still out in the page file.
+    // The lock must be held for the read so that none of these pages can be
+    // paged in, changed, and written back out underneath it.
+    //
+
+    KeAcquireQueuedLock(ImageSection->Lock);
+    if (((ImageSection->Flags & IMAGE_SECTION_DESTROYED) != 0) ||
+        ((OwningSection->Flags & IMAGE_SECTION_DESTROYED) != 0) ||
+        (OwningSection->PageFileBacking.DeviceHandle != DeviceHandle)) {
+
+        KeReleaseQueuedLock(ImageSection->Lock);
+        goto ReadAheadPageFileEnd;
+    }
+
+    for (Index = 0; Index < PageCount; Index += 1) {
+        if (MmpIsPageInPageFile(ImageSection,
+                                OwningSection,
+                                RunStart + Index) == FALSE) {
+
+            KeReleaseQueuedLock(ImageSection->Lock);
+            goto ReadAheadPageFileEnd;
+        }
+    }
+
+    IoContext.Offset = RunStart << PageShift;
+    IoContext.IoBuffer = IoBuffer;
+    IoContext.Irp = Irp;
+    IoContext.SizeInBytes = PageCount << PageShift;
+    IoContext.BytesCompleted = 0;
+    IoContext.Flags = IO_FLAG_SERVICING_FAULT;
+    IoContext.TimeoutInMilliseconds = WAIT_TIME_INDEFINITE;
+    IoContext.Write = FALSE;
+    Status = MmpPageFilePerformIo(&(OwningSection->PageFileBacking),
+                                  &IoContext);
+
+    if ((KSUCCESS(Status)) &&
+        (IoContext.BytesCompleted == IoContext.SizeInBytes)) {
+
+        for (Index = 0; Index < PageCount; Index += 1) {
+            if ((OwningSection->Flags & IMAGE_SECTION_EXECUTABLE) != 0) {
+                VirtualAddress = IoBuffer->Fragment[0].VirtualAddress +
+                                 (Index << PageShift);
+
+                MmpSyncSwapPage(VirtualAddress, PageSize);
+            }
+
+            MmpMapPageInSection(OwningSection,
+                                RunStart + Index,
+                                PhysicalAddresses[Index],
+                                PagingEntries[Index],
+                                FALSE);
 
-        PhysicalAddress = MmpVirtualToPhysical(VirtualAddress, NULL);
-        if (PhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
-            Status = STATUS_SUCCESS;
-            goto PageInAndLockEnd;
+            PhysicalAddresses[Index] = INVALID_PHYSICAL_ADDRESS;
+            PagingEntries[Index] = NULL;
         }
+    }
 
-        KeReleaseQueuedLock(Section->Lock);
+    KeReleaseQueuedLock(ImageSection->Lock);
 
-        //
-        // The page is not present. Try to page it in. If this succeeds, then
-        // loop back and try to trap the mapping.
-        //
+ReadAheadPageFileEnd:
+    if (IoBuffer != NULL) {
+        MmFreeIoBuffer(IoBuffer);
+    }
 
-        Status = MmpPageIn(Section, PageOffset, NULL);
-        if (!KSUCCESS(Status)) {
-            goto PageInAndLockEnd;
+    if (Irp != NULL) {
+        IoDestroyIrp(Irp);
+    }
+
+    for (Index = 0; Index < PageCount; Index += 1) {
+        if (PhysicalAddresses[Index] != INVALID_PHYSICAL_ADDRESS) {
+            MmFreePhysicalPage(PhysicalAddresses[Index]);
+        }
+
+        if (PagingEntries[Index] != NULL) {
+            MmpDestroyPagingEntry(PagingEntries[Index]);
         }
     }
 
-PageInAndLockEnd:
-    return Status;
+    MmpImageSectionReleaseReference(OwningSection);
+    return;
 }
 
 KSTATUS
@@ -1258,6 +1901,7 @@ MmpPageOut (
     PHYSICAL_ADDRESS PhysicalAddress,
     PIO_BUFFER IoBuffer,
     PMEMORY_RESERVATION SwapRegion,
+    ULONG WriterIndex,
     PUINTN PagesPaged
     )
 
@@ -1288,6 +1932,9 @@ Routine Description:
     SwapRegion - Supplies a pointer to a region of VA space to use during
         paging.
 
+    WriterIndex - Supplies the index of the page out writer doing the page
+        out, which selects the page file IRP used for the write.
+
     PagesPaged - Supplies a pointer where the count of pages removed will
         be returned.
 
@@ -1305,6 +1952,7 @@ Return Value:
     UINTN CleanStreak;
     BOOL Dirty;
     UINTN IoBufferSize;
+    PAGE_FILE_IO_CONTEXT IoContext;
     PPAGING_ENTRY OriginalPagingEntry;
     PIMAGE_SECTION OwningSection;
     UINTN PageCount;
@@ -1567,21 +2215,28 @@ Return Value:
     }
 
     //
-    // Acquire the page file's lock in order to use its paging out IRP, and
-    // perform the write.
+    // Perform the write using this writer's IRP. Other writers may have
+    // writes to the same page file in flight.
     //
 
     IoBufferSize = SwapOffset;
     PageCount = IoBufferSize >> PageShift;
     if (PageCount != 0) {
-        Status = MmPageFilePerformIo(&(Section->PageFileBacking),
-                                     IoBuffer,
-                                     SectionOffset,
-                                     IoBufferSize,
-                                     0,
-                                     WAIT_TIME_INDEFINITE,
-                                     TRUE,
-                                     &BytesCompleted);
+
+        ASSERT(WriterIndex < PAGE_OUT_WRITER_COUNT);
+
+        IoContext.Offset = SectionOffset;
+        IoContext.IoBuffer = IoBuffer;
+        IoContext.Irp = PageFile->WriterIrp[WriterIndex];
+        IoContext.SizeInBytes = IoBufferSize;
+        IoContext.BytesCompleted = 0;
+        IoContext.Flags = 0;
+        IoContext.TimeoutInMilliseconds = WAIT_TIME_INDEFINITE;
+        IoContext.Write = TRUE;
+        Status = MmpPageFilePerformIo(&(Section->PageFileBacking),
+                                      &IoContext);
+
+        BytesCompleted = IoContext.BytesCompleted;
 
         if (PagingEntry != NULL) {
             PagingEntry->U.Flags &= ~PAGING_ENTRY_FLAG_PAGING_OUT;
@@ -1624,6 +2279,219 @@ Return Value:
     return Status;
 }
 
+VOID
+MmpQueuePageOut (
+    PPAGING_ENTRY PagingEntry,
+    PIMAGE_SECTION Section,
+    UINTN PageOffset,
+    PHYSICAL_ADDRESS PhysicalAddress,
+    PUINTN PagesPaged,
+    PULONG FailureCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands a page flagged for paging out to a page out writer.
+    If a writer thread is idle, the page out proceeds in the background.
+    Otherwise it is performed synchronously on the paging thread, which keeps
+    the number of writes in flight bounded. Only the paging thread may call
+    this routine.
+
+Arguments:
+
+    PagingEntry - Supplies a pointer to the physical page's paging entry.
+
+    Section - Supplies a pointer to the image section, snapped from the paging
+        entry while the physical page lock was still held.
+
+    PageOffset - Supplies the offset into the section in pages where this page
+        resides, snapped from the paging entry while the physical page lock
+        was still held.
+
+    PhysicalAddress - Supplies the address of the physical page to swap out.
+
+    PagesPaged - Supplies a pointer that is incremented by the number of pages
+        paged out by this page out or any background page outs collected
+        along the way.
+
+    FailureCount - Supplies a pointer that is incremented for every failed
+        page out.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+    KSTATUS Status;
+    PPAGE_OUT_WRITER Writer;
+
+    ASSERT(KeGetCurrentThread() == MmPagingThread);
+
+    for (Index = 1; Index < MmPageOutWriterCount; Index += 1) {
+        Writer = &(MmPageOutWriters[Index]);
+        if (Writer->State == PageOutWriterComplete) {
+            MmpCollectPageOutWriter(Writer, PagesPaged, FailureCount);
+        }
+
+        if (Writer->State == PageOutWriterIdle) {
+            Writer->PagingEntry = PagingEntry;
+            Writer->Section = Section;
+            Writer->PageOffset = PageOffset;
+            Writer->PhysicalAddress = PhysicalAddress;
+            RtlAtomicExchange32(&(Writer->State), PageOutWriterBusy);
+            KeSignalEvent(Writer->WorkEvent, SignalOptionSignalAll);
+            return;
+        }
+    }
+
+    //
+    // All the writer threads are busy. Do this one directly.
+    //
+
+    Writer = &(MmPageOutWriters[0]);
+    Writer->PagesPaged = 0;
+    Status = MmpPageOut(PagingEntry,
+                        Section,
+                        PageOffset,
+                        PhysicalAddress,
+                        Writer->IoBuffer,
+                        Writer->SwapRegion,
+                        0,
+                        &(Writer->PagesPaged));
+
+    *PagesPaged += Writer->PagesPaged;
+    if ((!KSUCCESS(Status)) && (Status != STATUS_RESOURCE_IN_USE)) {
+        *FailureCount += 1;
+    }
+
+    return;
+}
+
+ULONG
+MmpCollectPageOuts (
+    BOOL Wait,
+    PUINTN PagesPaged,
+    PULONG FailureCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine collects the results of background page outs. Only the
+    paging thread may call this routine.
+
+Arguments:
+
+    Wait - Supplies a boolean indicating whether or not to wait for at least
+        one busy writer to complete.
+
+    PagesPaged - Supplies a pointer that is incremented by the number of pages
+        paged out by the completed writers.
+
+    FailureCount - Supplies a pointer that is incremented for every failed
+        page out.
+
+Return Value:
+
+    Returns the number of writers that were busy or complete when this
+    routine was called. Zero means there were no background page outs left to
+    collect.
+
+--*/
+
+{
+
+    ULONG BusyCount;
+    ULONG CompleteCount;
+    ULONG Index;
+    PPAGE_OUT_WRITER Writer;
+
+    ASSERT(KeGetCurrentThread() == MmPagingThread);
+
+    BusyCount = 0;
+    while (TRUE) {
+        KeSignalEvent(MmPageOutWriterEvent, SignalOptionUnsignal);
+        CompleteCount = 0;
+        for (Index = 1; Index < MmPageOutWriterCount; Index += 1) {
+            Writer = &(MmPageOutWriters[Index]);
+            if (Writer->State == PageOutWriterComplete) {
+                MmpCollectPageOutWriter(Writer, PagesPaged, FailureCount);
+                CompleteCount += 1;
+
+            } else if (Writer->State == PageOutWriterBusy) {
+                BusyCount += 1;
+            }
+        }
+
+        if ((Wait == FALSE) || (CompleteCount != 0) || (BusyCount == 0)) {
+            break;
+        }
+
+        //
+        // Wait for a busy writer to finish. Count the writers again on the
+        // next pass, as they were all counted busy on this one.
+        //
+
+        KeWaitForEvent(MmPageOutWriterEvent, FALSE, WAIT_TIME_INDEFINITE);
+        Wait = FALSE;
+        BusyCount = 0;
+    }
+
+    return BusyCount + CompleteCount;
+}
+
+BOOL
+MmpIsSectionPagingOut (
+    PIMAGE_SECTION Section
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a background page out writer has been
+    handed a page of the given section and not yet been collected. The pages
+    of such a section cannot be chosen for page out, as the writer may already
+    have gathered them into its run. This routine can only be called by the
+    paging thread.
+
+Arguments:
+
+    Section - Supplies a pointer to the image section to check. It is only
+        compared, not dereferenced.
+
+Return Value:
+
+    TRUE if a writer is paging out the section.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    ULONG Index;
+    PPAGE_OUT_WRITER Writer;
+
+    for (Index = 1; Index < MmPageOutWriterCount; Index += 1) {
+        Writer = &(MmPageOutWriters[Index]);
+        if ((Writer->State != PageOutWriterIdle) &&
+            (Writer->Section == Section)) {
+
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
 VOID
 MmpModifySectionMapping (
     PIMAGE_SECTION OwningSection,
@@ -2104,6 +2972,8 @@ Return Value:
 
     ULONG AllocationSize;
     PDEVICE Device;
+    FILE_PROPERTIES FileProperties;
+    ULONG Index;
     BOOL LockHeld;
     ULONGLONG PageCount;
     PPAGE_FILE PageFile;
@@ -2175,6 +3045,33 @@ Return Value:
         goto CreatePagingDeviceEnd;
     }
 
+    for (Index = 0; Index < PAGE_OUT_WRITER_COUNT; Index += 1) {
+        PageFile->WriterIrp[Index] = IoCreateIrp(Device,
+                                                 IrpMajorIo,
+                                                 IRP_CREATE_FLAG_NO_ALLOCATE);
+
+        if (PageFile->WriterIrp[Index] == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto CreatePagingDeviceEnd;
+        }
+    }
+
+    //
+    // Writes to the page file only need to be serialized if the file system
+    // might have to read-modify-write a block to complete a page sized write.
+    // Assume the worst if the block size cannot be determined.
+    //
+
+    PageFile->Flags |= PAGE_FILE_FLAG_SERIALIZE_WRITES;
+    Status = IoGetFileInformation(Handle, &FileProperties);
+    if ((KSUCCESS(Status)) &&
+        (FileProperties.BlockSize != 0) &&
+        (FileProperties.BlockSize <= PageSize) &&
+        ((PageSize % FileProperties.BlockSize) == 0)) {
+
+        PageFile->Flags &= ~PAGE_FILE_FLAG_SERIALIZE_WRITES;
+    }
+
     //
     // Notify the kernel executive about the page file so it could possibly be
     // used to collect crash information. Ignore failures here, as it's still
@@ -2265,6 +3162,8 @@ Return Value:
 
 {
 
+    ULONG Index;
+
     ASSERT(PageFile->FreePages == PageFile->PageCount);
 
     //
@@ -2280,6 +3179,12 @@ Return Value:
         IoDestroyIrp(PageFile->PagingOutIrp);
     }
 
+    for (Index = 0; Index < PAGE_OUT_WRITER_COUNT; Index += 1) {
+        if (PageFile->WriterIrp[Index] != NULL) {
+            IoDestroyIrp(PageFile->WriterIrp[Index]);
+        }
+    }
+
     if (PageFile->Handle != INVALID_HANDLE) {
         IoClose(PageFile->Handle);
     }
@@ -2509,72 +3414,185 @@ Return Value:
 
 --*/
 
-{
+{
+
+    ULONG CurrentChunkIndex;
+    ULONG CurrentIndex;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    KeAcquireQueuedLock(PageFile->Lock);
+    for (CurrentIndex = Allocation;
+         CurrentIndex < Allocation + PageCount;
+         CurrentIndex += 1) {
+
+        CurrentChunkIndex = CurrentIndex / 32;
+
+        //
+        // Assert that the page was actually marked as claimed, and unmark it.
+        //
+
+        ASSERT((PageFile->Bitmap[CurrentChunkIndex] &
+                (1 << (CurrentIndex - (CurrentChunkIndex * 32)))) != 0);
+
+        PageFile->Bitmap[CurrentChunkIndex] &=
+                             ~(1 << (CurrentIndex - (CurrentChunkIndex * 32)));
+    }
+
+    PageFile->FreePages += PageCount;
+    KeReleaseQueuedLock(PageFile->Lock);
+    return;
+}
+
+VOID
+MmpPagingThread (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to release physical page pressure by paging out
+    pages or removing them from the page cache if memory is tight. This runs
+    on its own thread, which cannot allocate memory or touch paged pool.
+
+Arguments:
+
+    Parameter - Supplies a pointer supplied by the creator of the thread. This
+        parameter is not used.
+
+Return Value:
+
+    None. This thread never exits.
+
+--*/
+
+{
+
+    UINTN FreePagesTarget;
+    ULONG Index;
+    PKEVENT PhysicalMemoryWarningEvent;
+    PVOID SignalingObject;
+    KSTATUS Status;
+    PVOID WaitObjectArray[2];
+
+    //
+    // Set up the page out writers. The first one runs directly on this
+    // thread and must succeed. The others are a bonus that allow several page
+    // file writes to be in flight at once.
+    //
+
+    Status = MmpInitializePageOutWriter(&(MmPageOutWriters[0]), 0);
+    if (!KSUCCESS(Status)) {
+        return;
+    }
+
+    MmPageOutWriterCount = 1;
+    for (Index = 1; Index < PAGE_OUT_WRITER_COUNT; Index += 1) {
+        Status = MmpInitializePageOutWriter(&(MmPageOutWriters[Index]), Index);
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        MmPageOutWriterCount += 1;
+    }
+
+    MmPagingThread = KeGetCurrentThread();
+
+    ASSERT(2 < BUILTIN_WAIT_BLOCK_ENTRY_COUNT);
+
+    PhysicalMemoryWarningEvent = MmGetPhysicalMemoryWarningEvent();
+    WaitObjectArray[0] = MmPagingEvent;
+    WaitObjectArray[1] = PhysicalMemoryWarningEvent;
+    while (TRUE) {
+        Status = ObWaitOnObjects(WaitObjectArray,
+                                 2,
+                                 0,
+                                 WAIT_TIME_INDEFINITE,
+                                 NULL,
+                                 &SignalingObject);
+
+        ASSERT(KSUCCESS(Status));
+
+        //
+        // If the memory warning event signaled for something other than
+        // warning level 1, ignore it.
+        //
+
+        if (SignalingObject == PhysicalMemoryWarningEvent) {
+            if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevel1) {
+                continue;
+            }
+        }
 
-    ULONG CurrentChunkIndex;
-    ULONG CurrentIndex;
+        //
+        // Always unsignal the paging event because paging is about to run.
+        //
 
-    ASSERT(KeGetRunLevel() == RunLevelLow);
+        KeSignalEvent(MmPagingEvent, SignalOptionUnsignal);
 
-    KeAcquireQueuedLock(PageFile->Lock);
-    for (CurrentIndex = Allocation;
-         CurrentIndex < Allocation + PageCount;
-         CurrentIndex += 1) {
+        //
+        // If paging is not enabled, act like something was released and go
+        // back to sleep.
+        //
 
-        CurrentChunkIndex = CurrentIndex / 32;
+        if (MmPagingEnabled == FALSE) {
+            KeSignalEvent(MmPagingFreePagesEvent, SignalOptionSignalAll);
+            continue;
+        }
 
         //
-        // Assert that the page was actually marked as claimed, and unmark it.
+        // Snap and reset the target free page count, then go for it.
         //
 
-        ASSERT((PageFile->Bitmap[CurrentChunkIndex] &
-                (1 << (CurrentIndex - (CurrentChunkIndex * 32)))) != 0);
-
-        PageFile->Bitmap[CurrentChunkIndex] &=
-                             ~(1 << (CurrentIndex - (CurrentChunkIndex * 32)));
+        FreePagesTarget = RtlAtomicExchange(&MmPagingFreeTarget, 0);
+        MmpPageOutPhysicalPages(FreePagesTarget);
     }
 
-    PageFile->FreePages += PageCount;
-    KeReleaseQueuedLock(PageFile->Lock);
     return;
 }
 
-VOID
-MmpPagingThread (
-    PVOID Parameter
+KSTATUS
+MmpInitializePageOutWriter (
+    PPAGE_OUT_WRITER Writer,
+    ULONG Index
     )
 
 /*++
 
 Routine Description:
 
-    This routine attempts to release physical page pressure by paging out
-    pages or removing them from the page cache if memory is tight. This runs
-    on its own thread, which cannot allocate memory or touch paged pool.
+    This routine allocates the resources for a page out writer. Every writer
+    but the first also gets its own thread.
 
 Arguments:
 
-    Parameter - Supplies a pointer supplied by the creator of the thread. This
-        parameter is not used.
+    Writer - Supplies a pointer to the zeroed writer to initialize.
+
+    Index - Supplies the index of the writer.
 
 Return Value:
 
-    None. This thread never exits.
+    Status code.
 
 --*/
 
 {
 
     ULONG AllocationSize;
-    UINTN FreePagesTarget;
     PIO_BUFFER IoBuffer;
     UINTN PageCount;
-    PKEVENT PhysicalMemoryWarningEvent;
-    PVOID SignalingObject;
     UINTN Size;
     KSTATUS Status;
     PMEMORY_RESERVATION SwapRegion;
-    PVOID WaitObjectArray[2];
+
+    ASSERT(Writer->IoBuffer == NULL);
+
+    IoBuffer = NULL;
+    SwapRegion = NULL;
+    Writer->Index = Index;
+    Writer->State = PageOutWriterIdle;
 
     //
     // Create the I/O buffer used to page out in chunks, and allocate a VA
@@ -2589,7 +3607,8 @@ Return Value:
     AllocationSize += (PageCount * sizeof(IO_BUFFER_FRAGMENT));
     IoBuffer = MmAllocateNonPagedPool(AllocationSize, MM_IO_ALLOCATION_TAG);
     if (IoBuffer == NULL) {
-        return;
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializePageOutWriterEnd;
     }
 
     RtlZeroMemory(IoBuffer, AllocationSize);
@@ -2607,8 +3626,8 @@ Return Value:
                                            TRUE);
 
     if (SwapRegion == NULL) {
-        MmFreeIoBuffer(IoBuffer);
-        return;
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializePageOutWriterEnd;
     }
 
     //
@@ -2618,60 +3637,145 @@ Return Value:
     //
 
     MmpCreatePageTables(SwapRegion->VirtualBase, SwapRegion->Size);
-    MmPagingThread = KeGetCurrentThread();
+    Writer->IoBuffer = IoBuffer;
+    Writer->SwapRegion = SwapRegion;
+    if (Index != 0) {
+        Writer->WorkEvent = KeCreateEvent(NULL);
+        if (Writer->WorkEvent == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto InitializePageOutWriterEnd;
+        }
 
-    ASSERT(2 < BUILTIN_WAIT_BLOCK_ENTRY_COUNT);
+        Status = PsCreateKernelThread(MmpPageOutWriterThread,
+                                      Writer,
+                                      "MmpPageOutWriterThread");
 
-    PhysicalMemoryWarningEvent = MmGetPhysicalMemoryWarningEvent();
-    WaitObjectArray[0] = MmPagingEvent;
-    WaitObjectArray[1] = PhysicalMemoryWarningEvent;
-    while (TRUE) {
-        Status = ObWaitOnObjects(WaitObjectArray,
-                                 2,
-                                 0,
-                                 WAIT_TIME_INDEFINITE,
-                                 NULL,
-                                 &SignalingObject);
+        if (!KSUCCESS(Status)) {
+            goto InitializePageOutWriterEnd;
+        }
+    }
 
-        ASSERT(KSUCCESS(Status));
+    Status = STATUS_SUCCESS;
 
-        //
-        // If the memory warning event signaled for something other than
-        // warning level 1, ignore it.
-        //
+InitializePageOutWriterEnd:
+    if (!KSUCCESS(Status)) {
+        if (Writer->WorkEvent != NULL) {
+            KeDestroyEvent(Writer->WorkEvent);
+            Writer->WorkEvent = NULL;
+        }
 
-        if (SignalingObject == PhysicalMemoryWarningEvent) {
-            if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevel1) {
-                continue;
-            }
+        if (IoBuffer != NULL) {
+            MmFreeIoBuffer(IoBuffer);
         }
 
-        //
-        // Always unsignal the paging event because paging is about to run.
-        //
+        if (SwapRegion != NULL) {
+            MmFreeMemoryReservation(SwapRegion);
+        }
 
-        KeSignalEvent(MmPagingEvent, SignalOptionUnsignal);
+        Writer->IoBuffer = NULL;
+        Writer->SwapRegion = NULL;
+    }
 
-        //
-        // If paging is not enabled, act like something was released and go
-        // back to sleep.
-        //
+    return Status;
+}
 
-        if (MmPagingEnabled == FALSE) {
-            KeSignalEvent(MmPagingFreePagesEvent, SignalOptionSignalAll);
+VOID
+MmpPageOutWriterThread (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements a page out writer thread. It waits for the paging
+    thread to hand it a victim page, pages out the run of pages around it, and
+    reports back. Like the paging thread, it cannot allocate memory or touch
+    paged pool.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the page out writer.
+
+Return Value:
+
+    None. This thread never exits.
+
+--*/
+
+{
+
+    PPAGE_OUT_WRITER Writer;
+
+    Writer = Parameter;
+    while (TRUE) {
+        KeWaitForEvent(Writer->WorkEvent, FALSE, WAIT_TIME_INDEFINITE);
+        KeSignalEvent(Writer->WorkEvent, SignalOptionUnsignal);
+        if (Writer->State != PageOutWriterBusy) {
             continue;
         }
 
-        //
-        // Snap and reset the target free page count, then go for it.
-        //
+        Writer->PagesPaged = 0;
+        Writer->Status = MmpPageOut(Writer->PagingEntry,
+                                    Writer->Section,
+                                    Writer->PageOffset,
+                                    Writer->PhysicalAddress,
+                                    Writer->IoBuffer,
+                                    Writer->SwapRegion,
+                                    Writer->Index,
+                                    &(Writer->PagesPaged));
+
+        RtlAtomicExchange32(&(Writer->State), PageOutWriterComplete);
+        KeSignalEvent(MmPageOutWriterEvent, SignalOptionSignalAll);
+    }
 
-        FreePagesTarget = RtlAtomicExchange(&MmPagingFreeTarget, 0);
-        MmpPageOutPhysicalPages(FreePagesTarget, IoBuffer, SwapRegion);
+    return;
+}
+
+VOID
+MmpCollectPageOutWriter (
+    PPAGE_OUT_WRITER Writer,
+    PUINTN PagesPaged,
+    PULONG FailureCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine collects the results of a completed page out writer and
+    makes it idle again.
+
+Arguments:
+
+    Writer - Supplies a pointer to the completed writer.
+
+    PagesPaged - Supplies a pointer that is incremented by the number of pages
+        the writer paged out.
+
+    FailureCount - Supplies a pointer that is incremented if the writer
+        failed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Writer->State == PageOutWriterComplete);
+
+    *PagesPaged += Writer->PagesPaged;
+    if ((!KSUCCESS(Writer->Status)) &&
+        (Writer->Status != STATUS_RESOURCE_IN_USE)) {
+
+        *FailureCount += 1;
     }
 
-    MmFreeIoBuffer(IoBuffer);
-    MmFreeMemoryReservation(SwapRegion);
+    Writer->Section = NULL;
+    Writer->PagingEntry = NULL;
+    Writer->State = PageOutWriterIdle;
     return;
 }
 
@@ -3190,7 +4294,7 @@ Return Value:
         // Read from the backing image at the faulting page's offset.
         //
 
-        Status = MmpReadBackingImage(ImageSection, PageOffset, IoBuffer);
+        Status = MmpReadBackingImage(ImageSection, PageOffset, 1, IoBuffer);
         if (!KSUCCESS(Status)) {
 
             ASSERT(MmGetIoBufferPageCacheEntry(IoBuffer, 0) == NULL);
@@ -3543,7 +4647,7 @@ Return Value:
                 }
             }
 
-            Status = MmpReadBackingImage(ImageSection, PageOffset, IoBuffer);
+            Status = MmpReadBackingImage(ImageSection, PageOffset, 1, IoBuffer);
             MmpImageSectionReleaseImageBackingReference(ImageSection);
             if (!KSUCCESS(Status)) {
 
@@ -3755,7 +4859,7 @@ Return Value:
         // Read from the backing image at the faulting page's offset.
         //
 
-        Status = MmpReadBackingImage(ImageSection, PageOffset, IoBuffer);
+        Status = MmpReadBackingImage(ImageSection, PageOffset, 1, IoBuffer);
         MmpImageSectionReleaseImageBackingReference(ImageSection);
         if (!KSUCCESS(Status)) {
 
@@ -4461,7 +5565,7 @@ Return Value:
         // order to make a cache-aligned read.
         //
 
-        Status = MmpReadBackingImage(OriginalOwner, PageOffset, IoBuffer);
+        Status = MmpReadBackingImage(OriginalOwner, PageOffset, 1, IoBuffer);
         MmpImageSectionReleaseImageBackingReference(OriginalOwner);
         if (!KSUCCESS(Status)) {
             goto PageInDefaultSectionEnd;
@@ -5021,6 +6125,7 @@ Return Value:
     PDEVICE Device;
     PIRP Irp;
     PPAGE_FILE PageFile;
+    BOOL Serialize;
     KSTATUS Status;
 
     PageFile = (PPAGE_FILE)ImageBacking->DeviceHandle;
@@ -5030,14 +6135,26 @@ Return Value:
     ASSERT(IS_ALIGNED(IoContext->Offset, MmPageSize()) != FALSE);
 
     //
-    // All page file writes must be serialized. If the file system's block size
-    // is greater than a page, it may perform a read-modify-write operation. If
+    // Page file writes must be serialized if the file system's block size is
+    // greater than a page, as it may perform a read-modify-write operation. If
     // multiple read-modify-write operations were not synchronized, the page
-    // file could be corrupted.
+    // file could be corrupted. The shared paging out IRP also needs the lock.
     //
 
     if (IoContext->Write != FALSE) {
-        KeAcquireQueuedLock(PageFile->Lock);
+        Irp = IoContext->Irp;
+        Serialize = FALSE;
+        if ((Irp == NULL) ||
+            ((PageFile->Flags & PAGE_FILE_FLAG_SERIALIZE_WRITES) != 0)) {
+
+            Serialize = TRUE;
+            KeAcquireQueuedLock(PageFile->Lock);
+        }
+
+        if (Irp == NULL) {
+            Irp = PageFile->PagingOutIrp;
+        }
+
         Status = IoWriteAtOffset(PageFile->Handle,
                                  IoContext->IoBuffer,
                                  IoContext->Offset,
@@ -5045,9 +6162,11 @@ Return Value:
                                  IoContext->Flags | IO_FLAG_NO_ALLOCATE,
                                  IoContext->TimeoutInMilliseconds,
                                  &(IoContext->BytesCompleted),
-                                 PageFile->PagingOutIrp);
+                                 Irp);
 
-        KeReleaseQueuedLock(PageFile->Lock);
+        if (Serialize != FALSE) {
+            KeReleaseQueuedLock(PageFile->Lock);
+        }
 
     } else {
         Irp = IoContext->Irp;
@@ -5086,6 +6205,7 @@ KSTATUS
 MmpReadBackingImage (
     PIMAGE_SECTION Section,
     UINTN PageOffset,
+    UINTN PageCount,
     PIO_BUFFER IoBuffer
     )
 
@@ -5102,7 +6222,12 @@ Routine Description:
 
     Section - Supplies a pointer to an image section.
 
-    PageOffset - Supplies the offset, in pages, of the page that is to be read.
+    PageOffset - Supplies the offset, in pages, of the first page that is to be
+        read.
+
+    PageCount - Supplies the number of pages to read. This must be 1 unless
+        the section is directly backed by the page cache, in which case page
+        cache misses within the range are read from the device together.
 
     IoBuffer - Supplies a pointer to an I/O buffer that will receive the data
         read from the backing image.
@@ -5134,6 +6259,7 @@ Return Value:
     //
 
     ASSERT(IoGetCacheEntryDataSize() == PageSize);
+    ASSERT((PageCount == 1) || ((Section->Flags & IMAGE_SECTION_BACKED) != 0));
 
     if (((Section->Flags & IMAGE_SECTION_BACKED) == 0) &&
         (IS_ALIGNED(ReadOffset, PageSize) == FALSE)) {
@@ -5142,7 +6268,7 @@ Return Value:
         ReadOffset = ALIGN_RANGE_DOWN(ReadOffset, PageSize);
 
     } else {
-        ReadSize = PageSize;
+        ReadSize = PageCount << PageShift;
     }
 
     //
@@ -5520,3 +6646,150 @@ Return Value:
     return CanWrite;
 }
 
+UINTN
+MmpFindPageFileRun (
+    PIMAGE_SECTION ImageSection,
+    PIMAGE_SECTION OwningSection,
+    UINTN PageOffset,
+    PUINTN RunStart
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the run of pages next to the given page that are out
+    in the owning section's page file. It looks forward from the page first,
+    and then backward if the page after it is not in the page file. The run
+    is confined to the aligned read ahead window containing the page. The
+    section lock must be held.
+
+Arguments:
+
+    ImageSection - Supplies a pointer to the image section that took the
+        fault.
+
+    OwningSection - Supplies a pointer to the section that owns the faulting
+        page.
+
+    PageOffset - Supplies the offset, in pages, of the page that faulted.
+
+    RunStart - Supplies a pointer where the first page offset of the run will
+        be returned.
+
+Return Value:
+
+    Returns the number of pages in the run, which may be zero.
+
+--*/
+
+{
+
+    UINTN CurrentOffset;
+    UINTN SectionPageCount;
+    UINTN WindowEnd;
+    UINTN WindowStart;
+
+    ASSERT(KeIsQueuedLockHeld(ImageSection->Lock) != FALSE);
+    ASSERT(POWER_OF_2(PAGE_FILE_READ_AHEAD_PAGE_COUNT) != FALSE);
+
+    WindowStart = ALIGN_RANGE_DOWN(PageOffset,
+                                   PAGE_FILE_READ_AHEAD_PAGE_COUNT);
+
+    WindowEnd = WindowStart + PAGE_FILE_READ_AHEAD_PAGE_COUNT;
+    SectionPageCount = ImageSection->Size >> MmPageShift();
+    if (WindowEnd > SectionPageCount) {
+        WindowEnd = SectionPageCount;
+    }
+
+    CurrentOffset = PageOffset + 1;
+    while ((CurrentOffset < WindowEnd) &&
+           (MmpIsPageInPageFile(ImageSection, OwningSection, CurrentOffset) !=
+            FALSE)) {
+
+        CurrentOffset += 1;
+    }
+
+    if (CurrentOffset != PageOffset + 1) {
+        *RunStart = PageOffset + 1;
+        return CurrentOffset - (PageOffset + 1);
+    }
+
+    CurrentOffset = PageOffset;
+    while ((CurrentOffset > WindowStart) &&
+           (MmpIsPageInPageFile(ImageSection,
+                                OwningSection,
+                                CurrentOffset - 1) != FALSE)) {
+
+        CurrentOffset -= 1;
+    }
+
+    *RunStart = CurrentOffset;
+    return PageOffset - CurrentOffset;
+}
+
+BOOL
+MmpIsPageInPageFile (
+    PIMAGE_SECTION ImageSection,
+    PIMAGE_SECTION OwningSection,
+    UINTN PageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a page of the given section is currently
+    out in the owning section's page file: it is owned by that section, is
+    dirty, and is not mapped. The section lock must be held.
+
+Arguments:
+
+    ImageSection - Supplies a pointer to the image section being checked.
+
+    OwningSection - Supplies a pointer to the section whose page file is of
+        interest.
+
+    PageOffset - Supplies the offset, in pages, of the page to check.
+
+Return Value:
+
+    TRUE if the page must be read from the owning section's page file.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    UINTN BitmapIndex;
+    ULONG BitmapMask;
+    PIMAGE_SECTION PageOwner;
+    PVOID VirtualAddress;
+
+    ASSERT(KeIsQueuedLockHeld(ImageSection->Lock) != FALSE);
+
+    PageOwner = MmpGetOwningSection(ImageSection, PageOffset);
+    MmpImageSectionReleaseReference(PageOwner);
+    if (PageOwner != OwningSection) {
+        return FALSE;
+    }
+
+    BitmapIndex = IMAGE_SECTION_BITMAP_INDEX(PageOffset);
+    BitmapMask = IMAGE_SECTION_BITMAP_MASK(PageOffset);
+    if ((OwningSection->DirtyPageBitmap[BitmapIndex] & BitmapMask) == 0) {
+        return FALSE;
+    }
+
+    VirtualAddress = ImageSection->VirtualAddress +
+                     (PageOffset << MmPageShift());
+
+    if (MmpVirtualToPhysical(VirtualAddress, NULL) !=
+        INVALID_PHYSICAL_ADDRESS) {
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
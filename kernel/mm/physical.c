@@ -177,6 +177,9 @@ Structure Description:
 
     FreePages - Stores the number of unallocated pages in the segment.
 
+    Node - Stores the NUMA node the segment's memory belongs to. Segments
+        never span more than one node.
+
 --*/
 
 typedef struct _PHYSICAL_MEMORY_SEGMENT {
@@ -184,6 +187,7 @@ typedef struct _PHYSICAL_MEMORY_SEGMENT {
     PHYSICAL_ADDRESS StartAddress;
     PHYSICAL_ADDRESS EndAddress;
     volatile UINTN FreePages;
+    ULONG Node;
 } PHYSICAL_MEMORY_SEGMENT, *PPHYSICAL_MEMORY_SEGMENT;
 
 /*++
@@ -211,6 +215,9 @@ Structure Description:
 
     TotalMemoryPages - Stores the maximum number of pages to initialize.
 
+    NodeEnd - Stores the physical address where the current segment's NUMA
+        node ends.
+
 --*/
 
 typedef struct _INIT_PHYSICAL_MEMORY_ITERATOR {
@@ -221,8 +228,43 @@ typedef struct _INIT_PHYSICAL_MEMORY_ITERATOR {
     PPHYSICAL_MEMORY_SEGMENT CurrentSegment;
     UINTN PagesInitialized;
     UINTN TotalMemoryPages;
+    PHYSICAL_ADDRESS NodeEnd;
 } INIT_PHYSICAL_MEMORY_ITERATOR, *PINIT_PHYSICAL_MEMORY_ITERATOR;
 
+/*++
+
+Structure Description:
+
+    This structure stores the physical allocator state for a NUMA node.
+
+Members:
+
+    LastAllocatedSegment - Stores the segment in this node that the last
+        node-local allocation came from.
+
+    LastAllocatedSegmentOffset - Stores the page offset just after the last
+        node-local allocation.
+
+    LocalAllocations - Stores the number of pages allocated on behalf of a
+        processor in this node that came from the node's own memory.
+
+    RemoteAllocations - Stores the number of pages allocated on behalf of a
+        processor in this node that had to come from another node.
+
+    FallbackOrder - Stores the nodes that single page allocations on behalf of
+        a processor in this node try, nearest first according to the
+        firmware's distance table. The node itself is always first.
+
+--*/
+
+typedef struct _PHYSICAL_MEMORY_NODE {
+    PPHYSICAL_MEMORY_SEGMENT LastAllocatedSegment;
+    UINTN LastAllocatedSegmentOffset;
+    volatile UINTN LocalAllocations;
+    volatile UINTN RemoteAllocations;
+    UCHAR FallbackOrder[ACPI_MAX_NUMA_NODES];
+} PHYSICAL_MEMORY_NODE, *PPHYSICAL_MEMORY_NODE;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -243,6 +285,17 @@ MmpInitializePhysicalAllocatorIterationRoutine (
     PVOID Context
     );
 
+PHYSICAL_ADDRESS
+MmpAllocateNodePhysicalPage (
+    ULONG Node,
+    PBOOL SignalEvent
+    );
+
+VOID
+MmpInitializeNumaFallbackOrder (
+    VOID
+    );
+
 BOOL
 MmpUpdatePhysicalMemoryStatistics (
     UINTN PageCount,
@@ -255,6 +308,11 @@ MmpWaitForFreePhysicalPages (
     PULONGLONG Timeout
     );
 
+PPHYSICAL_PAGE
+MmpGetPhysicalPage (
+    PHYSICAL_ADDRESS PhysicalAddress
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -315,6 +373,24 @@ UINTN MmLastAllocatedSegmentOffset;
 PPHYSICAL_MEMORY_SEGMENT MmLastPagedSegment;
 UINTN MmLastPagedSegmentOffset;
 
+//
+// Store the page merge scanner's position in the physical page database, and
+// the lock of the image section tree whose pages it is currently merging.
+// Pages of that tree are not selected for page out while it is set.
+//
+
+PPHYSICAL_MEMORY_SEGMENT MmLastMergedSegment;
+UINTN MmLastMergedSegmentOffset;
+PQUEUED_LOCK MmPageMergeSectionLock;
+
+//
+// Store the number of NUMA nodes in the system, and the per-node allocation
+// state. Single page allocations try the current processor's node first.
+//
+
+ULONG MmNumaNodeCount = 1;
+PHYSICAL_MEMORY_NODE MmNumaNodes[ACPI_MAX_NUMA_NODES];
+
 //
 // Stores the lock protecting access to physical page data structures.
 //
@@ -437,6 +513,7 @@ Return Value:
     return MmPhysicalMemoryWarningLevel;
 }
 
+KERNEL_API
 UINTN
 MmGetTotalPhysicalPages (
     VOID
@@ -489,6 +566,39 @@ Return Value:
     return MmTotalPhysicalPages - MmTotalAllocatedPhysicalPages;
 }
 
+KERNEL_API
+PHYSICAL_ADDRESS
+MmAllocatePhysicalPage (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a single non-paged physical page of memory for a
+    driver's own use. The page is not mapped. It must be freed with
+    MmFreePhysicalPage. This routine must be called at low level.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the physical address of the allocated page on success, or
+    INVALID_PHYSICAL_ADDRESS on failure.
+
+--*/
+
+{
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    return MmpAllocatePhysicalPage();
+}
+
+KERNEL_API
 VOID
 MmFreePhysicalPages (
     PHYSICAL_ADDRESS PhysicalAddress,
@@ -790,15 +900,18 @@ Return Value:
     UINTN AllocationSize;
     INIT_PHYSICAL_MEMORY_ITERATOR Context;
     UINTN Count;
+    PLIST_ENTRY CurrentEntry;
     ULONG LastBitIndex;
     ULONG LeadingZeros;
     ULONG PageShift;
     PUCHAR RawBuffer;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
     KSTATUS Status;
 
     PageShift = MmPageShift();
     Status = STATUS_SUCCESS;
     INITIALIZE_LIST_HEAD(&MmPhysicalSegmentListHead);
+    MmNumaNodeCount = AcpiGetNumaNodeCount();
 
     //
     // Loop through the descriptors once to determine the number of segments
@@ -844,6 +957,7 @@ Return Value:
     Context.TotalSegments = 0;
     Context.TotalMemoryBytes = 0;
     Context.LastEnd = 0;
+    Context.NodeEnd = 0;
     MmMdIterate(MemoryMap,
                 MmpInitializePhysicalAllocatorIterationRoutine,
                 &Context);
@@ -865,6 +979,26 @@ Return Value:
     MmLastAllocatedSegmentOffset = 0;
     MmLastPagedSegment = MmLastAllocatedSegment;
     MmLastPagedSegmentOffset = 0;
+    MmLastMergedSegment = MmLastAllocatedSegment;
+    MmLastMergedSegmentOffset = 0;
+
+    //
+    // Point each NUMA node's allocation cursor at the first segment in that
+    // node. Nodes without any memory keep a NULL cursor.
+    //
+
+    CurrentEntry = MmPhysicalSegmentListHead.Next;
+    while (CurrentEntry != &MmPhysicalSegmentListHead) {
+        Segment = LIST_VALUE(CurrentEntry, PHYSICAL_MEMORY_SEGMENT, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (MmNumaNodes[Segment->Node].LastAllocatedSegment == NULL) {
+            MmNumaNodes[Segment->Node].LastAllocatedSegment = Segment;
+            MmNumaNodes[Segment->Node].LastAllocatedSegmentOffset = 0;
+        }
+    }
+
+    MmpInitializeNumaFallbackOrder();
+
     MmTotalPhysicalPages = Context.TotalMemoryPages;
     MmMinimumFreePhysicalPages =
                 (MmTotalPhysicalPages * MIN_FREE_PHYSICAL_PAGES_PERCENT) / 100;
@@ -937,6 +1071,65 @@ Return Value:
     return;
 }
 
+VOID
+MmpGetNumaNodeStatistics (
+    PMM_NUMA_NODE_STATISTICS Statistics
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills out the physical memory statistics for each NUMA node.
+
+Arguments:
+
+    Statistics - Supplies a pointer to an array of MmNumaNodeCount statistics
+        structures to fill in.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    ULONG Node;
+    UINTN PageShift;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+
+    PageShift = MmPageShift();
+    RtlZeroMemory(Statistics,
+                  MmNumaNodeCount * sizeof(MM_NUMA_NODE_STATISTICS));
+
+    for (Node = 0; Node < MmNumaNodeCount; Node += 1) {
+        Statistics[Node].Node = Node;
+        Statistics[Node].LocalAllocations = MmNumaNodes[Node].LocalAllocations;
+        Statistics[Node].RemoteAllocations =
+                                          MmNumaNodes[Node].RemoteAllocations;
+    }
+
+    KeAcquireSharedExclusiveLockShared(MmPhysicalPageLock);
+    CurrentEntry = MmPhysicalSegmentListHead.Next;
+    while (CurrentEntry != &MmPhysicalSegmentListHead) {
+        Segment = LIST_VALUE(CurrentEntry, PHYSICAL_MEMORY_SEGMENT, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+
+        ASSERT(Segment->Node < MmNumaNodeCount);
+
+        Node = Segment->Node;
+        Statistics[Node].PhysicalPages +=
+                    (Segment->EndAddress - Segment->StartAddress) >> PageShift;
+
+        Statistics[Node].FreePhysicalPages += Segment->FreePages;
+    }
+
+    KeReleaseSharedExclusiveLockShared(MmPhysicalPageLock);
+    return;
+}
+
 PHYSICAL_ADDRESS
 MmpAllocatePhysicalPage (
     VOID
@@ -963,9 +1156,12 @@ Return Value:
 {
 
     PHYSICAL_ADDRESS Allocation;
+    ULONG Candidate;
     BOOL FirstIteration;
+    ULONG Index;
     PPHYSICAL_MEMORY_SEGMENT LastSegment;
     UINTN LastSegmentOffset;
+    ULONG Node;
     UINTN Offset;
     UINTN PageShift;
     PPHYSICAL_PAGE PhysicalPage;
@@ -980,6 +1176,16 @@ Return Value:
     PageShift = MmPageShift();
     SignalEvent = FALSE;
 
+    //
+    // The thread may migrate after this, which just makes the allocation a
+    // little less local than it could have been.
+    //
+
+    Node = 0;
+    if (MmNumaNodeCount > 1) {
+        Node = KeGetCurrentProcessorBlock()->NumaNode;
+    }
+
     //
     // Loop continuously looking for free pages.
     //
@@ -990,6 +1196,32 @@ Return Value:
             KeAcquireSharedExclusiveLockShared(MmPhysicalPageLock);
         }
 
+        //
+        // On NUMA systems, prefer memory from the current processor's node,
+        // and after that from the nodes closest to it.
+        //
+
+        if (MmNumaNodeCount > 1) {
+            for (Index = 0; Index < MmNumaNodeCount; Index += 1) {
+                Candidate = MmNumaNodes[Node].FallbackOrder[Index];
+                Allocation = MmpAllocateNodePhysicalPage(Candidate,
+                                                         &SignalEvent);
+
+                if (Allocation == INVALID_PHYSICAL_ADDRESS) {
+                    continue;
+                }
+
+                if (Candidate == Node) {
+                    RtlAtomicAdd(&(MmNumaNodes[Node].LocalAllocations), 1);
+
+                } else {
+                    RtlAtomicAdd(&(MmNumaNodes[Node].RemoteAllocations), 1);
+                }
+
+                goto AllocatePhysicalPageEnd;
+            }
+        }
+
         //
         // Look directly for a single free physical page.
         //
@@ -1065,6 +1297,19 @@ Return Value:
                         SignalEvent = MmpUpdatePhysicalMemoryStatistics(1,
                                                                         TRUE);
 
+                        if (MmNumaNodeCount > 1) {
+                            if (Segment->Node == Node) {
+                                RtlAtomicAdd(
+                                       &(MmNumaNodes[Node].LocalAllocations),
+                                       1);
+
+                            } else {
+                                RtlAtomicAdd(
+                                       &(MmNumaNodes[Node].RemoteAllocations),
+                                       1);
+                            }
+                        }
+
                         Allocation = Segment->StartAddress +
                                      (Offset << PageShift);
 
@@ -2083,6 +2328,243 @@ Return Value:
     return PageCacheEntry;
 }
 
+PIMAGE_SECTION
+MmpFindPageMergeCandidate (
+    UINTN PageBudget,
+    PUINTN PagesScanned,
+    PUINTN PageOffset,
+    PPHYSICAL_ADDRESS PhysicalAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine continues the page merge scanner's sweep across the physical
+    page database, looking for a resident page of a private anonymous user
+    mode section.
+
+Arguments:
+
+    PageBudget - Supplies the maximum number of physical pages to look at.
+
+    PagesScanned - Supplies a pointer where the number of physical pages
+        looked at will be returned.
+
+    PageOffset - Supplies a pointer where the offset, in pages, of the
+        candidate page within its image section will be returned.
+
+    PhysicalAddress - Supplies a pointer where the physical address of the
+        candidate page will be returned.
+
+Return Value:
+
+    Returns a pointer to the image section that the candidate page belongs to.
+    The caller is responsible for releasing the reference taken on it.
+
+    NULL if no candidate was found within the budget.
+
+--*/
+
+{
+
+    UINTN Offset;
+    ULONG PageShift;
+    PPAGING_ENTRY PagingEntry;
+    PPHYSICAL_PAGE PhysicalPage;
+    UINTN Scanned;
+    PIMAGE_SECTION Section;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    UINTN SegmentPageCount;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    PageShift = MmPageShift();
+    Scanned = 0;
+    Section = NULL;
+    KeAcquireSharedExclusiveLockExclusive(MmPhysicalPageLock);
+    Segment = MmLastMergedSegment;
+    Offset = MmLastMergedSegmentOffset;
+    while (Scanned < PageBudget) {
+        SegmentPageCount = (Segment->EndAddress - Segment->StartAddress) >>
+                           PageShift;
+
+        if (Offset >= SegmentPageCount) {
+            if (Segment->ListEntry.Next == &MmPhysicalSegmentListHead) {
+                Segment = LIST_VALUE(MmPhysicalSegmentListHead.Next,
+                                     PHYSICAL_MEMORY_SEGMENT,
+                                     ListEntry);
+
+            } else {
+                Segment = LIST_VALUE(Segment->ListEntry.Next,
+                                     PHYSICAL_MEMORY_SEGMENT,
+                                     ListEntry);
+            }
+
+            Offset = 0;
+            continue;
+        }
+
+        PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+        PhysicalPage += Offset;
+        Offset += 1;
+        Scanned += 1;
+        if ((PhysicalPage->U.Free == PHYSICAL_PAGE_FREE) ||
+            ((PhysicalPage->U.Flags & PHYSICAL_PAGE_FLAG_NON_PAGED) != 0)) {
+
+            continue;
+        }
+
+        //
+        // Skip pages that are on their way out or locked in memory, and pages
+        // that do not belong to private anonymous user mode sections.
+        //
+
+        PagingEntry = PhysicalPage->U.PagingEntry;
+        if (((PagingEntry->U.Flags & PAGING_ENTRY_FLAG_PAGING_OUT) != 0) ||
+            (PagingEntry->U.LockCount != 0)) {
+
+            continue;
+        }
+
+        if ((PagingEntry->Section->VirtualAddress >= USER_VA_END) ||
+            ((PagingEntry->Section->Flags &
+              (IMAGE_SECTION_BACKED | IMAGE_SECTION_SHARED |
+               IMAGE_SECTION_NON_PAGED | IMAGE_SECTION_DESTROYING |
+               IMAGE_SECTION_DESTROYED)) != 0)) {
+
+            continue;
+        }
+
+        Section = PagingEntry->Section;
+        MmpImageSectionAddReference(Section);
+        *PageOffset = PagingEntry->U.SectionOffset;
+        *PhysicalAddress = Segment->StartAddress +
+                           ((PHYSICAL_ADDRESS)(Offset - 1) << PageShift);
+
+        break;
+    }
+
+    MmLastMergedSegment = Segment;
+    MmLastMergedSegmentOffset = Offset;
+    KeReleaseSharedExclusiveLockExclusive(MmPhysicalPageLock);
+    *PagesScanned = Scanned;
+    return Section;
+}
+
+BOOL
+MmpClaimPagesForMerge (
+    PQUEUED_LOCK SectionLock,
+    PHYSICAL_ADDRESS PhysicalAddress,
+    PHYSICAL_ADDRESS SharedPhysicalAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prevents the given pages from being selected for page out
+    while the page merge scanner unmaps, compares, and potentially frees them.
+    The caller must hold the given section lock, which keeps the pages from
+    being locked in the meantime.
+
+Arguments:
+
+    SectionLock - Supplies a pointer to the lock shared by the image section
+        tree that both pages belong to.
+
+    PhysicalAddress - Supplies the physical address of the page that may be
+        freed.
+
+    SharedPhysicalAddress - Supplies an optional physical address of the page
+        that will be kept and shared in its place. Supply
+        INVALID_PHYSICAL_ADDRESS if there is no such page.
+
+Return Value:
+
+    TRUE if the pages were claimed. The caller must call
+    MmpReleasePagesForMerge when it is done with them.
+
+    FALSE if the pages are already being paged out, are locked, or no longer
+    belong to the section tree.
+
+--*/
+
+{
+
+    PHYSICAL_ADDRESS Addresses[2];
+    BOOL Claimed;
+    ULONG Index;
+    PPAGING_ENTRY PagingEntry;
+    PPHYSICAL_PAGE PhysicalPage;
+
+    ASSERT(KeIsQueuedLockHeld(SectionLock) != FALSE);
+    ASSERT(MmPageMergeSectionLock == NULL);
+
+    Addresses[0] = PhysicalAddress;
+    Addresses[1] = SharedPhysicalAddress;
+    Claimed = FALSE;
+    KeAcquireSharedExclusiveLockExclusive(MmPhysicalPageLock);
+    for (Index = 0; Index < 2; Index += 1) {
+        if (Addresses[Index] == INVALID_PHYSICAL_ADDRESS) {
+            continue;
+        }
+
+        PhysicalPage = MmpGetPhysicalPage(Addresses[Index]);
+        if ((PhysicalPage == NULL) ||
+            (PhysicalPage->U.Free == PHYSICAL_PAGE_FREE) ||
+            ((PhysicalPage->U.Flags & PHYSICAL_PAGE_FLAG_NON_PAGED) != 0)) {
+
+            goto ClaimPagesForMergeEnd;
+        }
+
+        PagingEntry = PhysicalPage->U.PagingEntry;
+        if ((PagingEntry->Section->Lock != SectionLock) ||
+            ((PagingEntry->U.Flags & PAGING_ENTRY_FLAG_PAGING_OUT) != 0) ||
+            (PagingEntry->U.LockCount != 0)) {
+
+            goto ClaimPagesForMergeEnd;
+        }
+    }
+
+    MmPageMergeSectionLock = SectionLock;
+    Claimed = TRUE;
+
+ClaimPagesForMergeEnd:
+    KeReleaseSharedExclusiveLockExclusive(MmPhysicalPageLock);
+    return Claimed;
+}
+
+VOID
+MmpReleasePagesForMerge (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allows the pages claimed by the page merge scanner to be
+    selected for page out again.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(MmPageMergeSectionLock != NULL);
+
+    MmPageMergeSectionLock = NULL;
+    return;
+}
+
 VOID
 MmpMigratePagingEntries (
     PIMAGE_SECTION OldSection,
@@ -2222,28 +2704,22 @@ Return Value:
 
 UINTN
 MmpPageOutPhysicalPages (
-    UINTN FreePagesTarget,
-    PIO_BUFFER IoBuffer,
-    PMEMORY_RESERVATION SwapRegion
+    UINTN FreePagesTarget
     )
 
 /*++
 
 Routine Description:
 
-    This routine pages out physical pages to the backing store.
+    This routine pages out physical pages to the backing store. Page outs are
+    spread across the page out writers, so several page file writes can be in
+    flight at once. This routine waits for all of them before returning.
 
 Arguments:
 
     FreePagesTarget - Supplies the target number of free pages the system
         should have.
 
-    IoBuffer - Supplies a pointer to an allocated but uninitialized I/O buffer
-        to use during page out I/O.
-
-    SwapRegion - Supplies a pointer to a region of VA space to use during page
-        out I/O.
-
 Return Value:
 
     Returns the number of physical pages that were able to be paged out.
@@ -2252,7 +2728,6 @@ Return Value:
 
 {
 
-    BOOL Failure;
     ULONG FailureCount;
     UINTN FreePages;
     BOOL LockHeld;
@@ -2267,7 +2742,6 @@ Return Value:
     UINTN SectionOffset;
     PPHYSICAL_MEMORY_SEGMENT Segment;
     UINTN SegmentOffset;
-    KSTATUS Status;
     UINTN TotalPagesPaged;
 
     LockHeld = FALSE;
@@ -2322,75 +2796,80 @@ Return Value:
                                        &SegmentOffset,
                                        &PagesFound);
 
+        PagesPaged = 0;
         if (Segment == NULL) {
-            break;
-        }
-
-        ASSERT(PagesFound == 1);
+            if (LockHeld != FALSE) {
+                KeReleaseSharedExclusiveLockExclusive(MmPhysicalPageLock);
+                LockHeld = FALSE;
+            }
 
-        Failure = FALSE;
-        PagesPaged = 0;
-        PhysicalAddress = Segment->StartAddress + (SegmentOffset << PageShift);
-        PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
-        PhysicalPage += SegmentOffset;
-        PagingEntry = PhysicalPage->U.PagingEntry;
+            //
+            // The search skips pages of sections that writers are still
+            // working on. If there are any, wait for one and try again.
+            //
 
-        ASSERT(PagingEntry != NULL);
-        ASSERT(((UINTN)PagingEntry & PHYSICAL_PAGE_FLAG_NON_PAGED) == 0);
+            if (MmpCollectPageOuts(TRUE, &PagesPaged, &FailureCount) == 0) {
+                break;
+            }
 
-        //
-        // Snap the image section and offset while the lock is still held to
-        // avoid racing with the migrate paging entries function.
-        //
+        } else {
 
-        Section = PagingEntry->Section;
-        SectionOffset = PagingEntry->U.SectionOffset;
-        if (LockHeld != FALSE) {
-            KeReleaseSharedExclusiveLockExclusive(MmPhysicalPageLock);
-            LockHeld = FALSE;
-        }
+            ASSERT(PagesFound == 1);
 
-        //
-        // Try to page this memory out.
-        //
+            PhysicalAddress = Segment->StartAddress +
+                              (SegmentOffset << PageShift);
 
-        Status = MmpPageOut(PagingEntry,
-                            Section,
-                            SectionOffset,
-                            PhysicalAddress,
-                            IoBuffer,
-                            SwapRegion,
-                            &PagesPaged);
+            PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+            PhysicalPage += SegmentOffset;
+            PagingEntry = PhysicalPage->U.PagingEntry;
 
-        if (KSUCCESS(Status)) {
-            PageCountSinceEvent += PagesPaged;
+            ASSERT(PagingEntry != NULL);
+            ASSERT(((UINTN)PagingEntry & PHYSICAL_PAGE_FLAG_NON_PAGED) == 0);
 
             //
-            // If a reasonable number of pages have been freed up, let
-            // everyone try their allocations again.
+            // Snap the image section and offset while the lock is still held
+            // to avoid racing with the migrate paging entries function.
             //
 
-            if (PageCountSinceEvent >= PAGING_EVENT_SIGNAL_PAGE_COUNT) {
-                PageCountSinceEvent = 0;
-                KeSignalEvent(MmPagingFreePagesEvent, SignalOptionSignalAll);
+            Section = PagingEntry->Section;
+            SectionOffset = PagingEntry->U.SectionOffset;
+            if (LockHeld != FALSE) {
+                KeReleaseSharedExclusiveLockExclusive(MmPhysicalPageLock);
+                LockHeld = FALSE;
             }
 
-        } else if (Status != STATUS_RESOURCE_IN_USE) {
-            Failure = TRUE;
+            //
+            // Try to page this memory out. This also collects any page outs
+            // that completed in the background.
+            //
+
+            MmpQueuePageOut(PagingEntry,
+                            Section,
+                            SectionOffset,
+                            PhysicalAddress,
+                            &PagesPaged,
+                            &FailureCount);
+        }
+
+        //
+        // If a reasonable number of pages have been freed up, let everyone
+        // try their allocations again.
+        //
+
+        PageCountSinceEvent += PagesPaged;
+        if (PageCountSinceEvent >= PAGING_EVENT_SIGNAL_PAGE_COUNT) {
+            PageCountSinceEvent = 0;
+            KeSignalEvent(MmPagingFreePagesEvent, SignalOptionSignalAll);
         }
 
         TotalPagesPaged += PagesPaged;
 
         //
-        // If the physical page run failed to be completely paged out, then
-        // increment the failure count and stop if too many runs have failed.
+        // Stop if too many page outs have failed.
         //
 
-        if (Failure != FALSE) {
-            FailureCount += 1;
-            if (FailureCount >= PHYSICAL_MEMORY_MAX_PAGE_OUT_FAILURE_COUNT) {
-                break;
-            }
+        if (FailureCount >= PHYSICAL_MEMORY_MAX_PAGE_OUT_FAILURE_COUNT) {
+            break;
         }
     }
 
@@ -2398,6 +2877,20 @@ Return Value:
         KeReleaseSharedExclusiveLockExclusive(MmPhysicalPageLock);
     }
 
+    //
+    // Wait for the page outs still in flight.
+    //
+
+    while (TRUE) {
+        PagesPaged = 0;
+        if (MmpCollectPageOuts(TRUE, &PagesPaged, &FailureCount) == 0) {
+            break;
+        }
+
+        PageCountSinceEvent += PagesPaged;
+        TotalPagesPaged += PagesPaged;
+    }
+
     //
     // Signal the event if there are any remainders that were paged out.
     //
@@ -2645,6 +3138,28 @@ Return Value:
                     if (PagingEntry->U.LockCount != 0) {
                         ExitCheck = TRUE;
 
+                    //
+                    // Skip pages of the section tree the page merge scanner
+                    // is working on, as it may be about to free this page.
+                    //
+
+                    } else if ((MmPageMergeSectionLock != NULL) &&
+                               (PagingEntry->Section->Lock ==
+                                MmPageMergeSectionLock)) {
+
+                        ExitCheck = TRUE;
+
+                    //
+                    // Skip pages of sections that a page out writer is still
+                    // working on, as the writer may have gathered this page
+                    // into its run already.
+                    //
+
+                    } else if (MmpIsSectionPagingOut(PagingEntry->Section) !=
+                               FALSE) {
+
+                        ExitCheck = TRUE;
+
                     //
                     // Otherwise mark that the page is being paged out so that
                     // it does not get released in the middle of use.
@@ -2793,9 +3308,11 @@ Return Value:
 
     ULONGLONG BaseAddress;
     PPHYSICAL_MEMORY_SEGMENT CurrentSegment;
+    ULONGLONG DescriptorEnd;
     BOOL FreePage;
     PHYSICAL_ADDRESS LowestPhysicalAddress;
     PINIT_PHYSICAL_MEMORY_ITERATOR MemoryContext;
+    PHYSICAL_ADDRESS NodeEnd;
     UINTN OutOfBoundsAllocatedPageCount;
     UINTN PageCount;
     UINTN PageShift;
@@ -2978,11 +3495,30 @@ Return Value:
             CurrentSegment->StartAddress = BaseAddress;
             CurrentSegment->EndAddress = CurrentSegment->StartAddress;
             CurrentSegment->FreePages = 0;
+            CurrentSegment->Node = AcpiGetMemoryNode(BaseAddress,
+                                                     &(MemoryContext->NodeEnd));
+
             MemoryContext->CurrentSegment = CurrentSegment;
             MemoryContext->CurrentPage = (PPHYSICAL_PAGE)(CurrentSegment + 1);
         }
     }
 
+    //
+    // On the counting pass, reserve a segment for every NUMA node boundary
+    // the descriptor may cross, plus one in case it merges with the previous
+    // segment right at a node boundary. Overestimating only costs a few bytes.
+    //
+
+    if (MemoryContext->CurrentPage == NULL) {
+        DescriptorEnd = Descriptor->BaseAddress + Descriptor->Size;
+        AcpiGetMemoryNode(BaseAddress, &NodeEnd);
+        MemoryContext->TotalSegments += 1;
+        while (NodeEnd < DescriptorEnd) {
+            MemoryContext->TotalSegments += 1;
+            AcpiGetMemoryNode(NodeEnd, &NodeEnd);
+        }
+    }
+
     //
     // If the current page is set up, add the descriptor to the physical memory
     // segment. Use the real (non trimmed) descriptor size here. The recorded
@@ -3032,6 +3568,31 @@ Return Value:
                (MemoryContext->PagesInitialized <
                 MemoryContext->TotalMemoryPages)) {
 
+            //
+            // Start a new segment if this page is in a different NUMA node
+            // than the current segment, so each segment lies in one node.
+            //
+
+            if (CurrentSegment->EndAddress >= MemoryContext->NodeEnd) {
+                NodeEnd = CurrentSegment->EndAddress;
+                MemoryContext->TotalSegments += 1;
+                CurrentSegment =
+                        (PPHYSICAL_MEMORY_SEGMENT)(MemoryContext->CurrentPage);
+
+                INSERT_BEFORE(&(CurrentSegment->ListEntry),
+                              &(MmPhysicalSegmentListHead));
+
+                CurrentSegment->StartAddress = NodeEnd;
+                CurrentSegment->EndAddress = NodeEnd;
+                CurrentSegment->FreePages = 0;
+                CurrentSegment->Node =
+                         AcpiGetMemoryNode(NodeEnd, &(MemoryContext->NodeEnd));
+
+                MemoryContext->CurrentSegment = CurrentSegment;
+                MemoryContext->CurrentPage =
+                                         (PPHYSICAL_PAGE)(CurrentSegment + 1);
+            }
+
             //
             // If the page is not free, mark it as non-paged.
             //
@@ -3291,3 +3852,239 @@ Return Value:
     return;
 }
 
+PHYSICAL_ADDRESS
+MmpAllocateNodePhysicalPage (
+    ULONG Node,
+    PBOOL SignalEvent
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to allocate a single physical page from the given
+    NUMA node. The caller is responsible for counting the allocation against
+    the node it was made on behalf of. This routine assumes the physical page
+    lock is held shared.
+
+Arguments:
+
+    Node - Supplies the NUMA node to allocate from.
+
+    SignalEvent - Supplies a pointer where a boolean will be returned
+        indicating whether or not the physical memory warning event needs to
+        be signaled.
+
+Return Value:
+
+    Returns the physical address of the allocated page on success, or
+    INVALID_PHYSICAL_ADDRESS if the node has no free pages.
+
+--*/
+
+{
+
+    PPHYSICAL_MEMORY_SEGMENT FirstSegment;
+    UINTN FirstSegmentOffset;
+    UINTN Limit;
+    PPHYSICAL_MEMORY_NODE NodeState;
+    UINTN Offset;
+    UINTN PageShift;
+    PPHYSICAL_PAGE PhysicalPage;
+    UINTN Previous;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    BOOL Wrapped;
+
+    NodeState = &(MmNumaNodes[Node]);
+    FirstSegment = NodeState->LastAllocatedSegment;
+    if (FirstSegment == NULL) {
+        return INVALID_PHYSICAL_ADDRESS;
+    }
+
+    PageShift = MmPageShift();
+    FirstSegmentOffset = NodeState->LastAllocatedSegmentOffset;
+    Offset = FirstSegmentOffset;
+    Segment = FirstSegment;
+    Wrapped = FALSE;
+
+    //
+    // Sweep once around the segment list starting at the node's cursor,
+    // skipping segments that belong to other nodes. The first segment is
+    // visited again at the end to cover the pages before the cursor.
+    //
+
+    while (TRUE) {
+        if ((Segment->Node == Node) && (Segment->FreePages != 0)) {
+            Limit = (Segment->EndAddress - Segment->StartAddress) >> PageShift;
+            if ((Wrapped != FALSE) && (Segment == FirstSegment) &&
+                (FirstSegmentOffset < Limit)) {
+
+                Limit = FirstSegmentOffset;
+            }
+
+            PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+            PhysicalPage += Offset;
+            while (Offset < Limit) {
+                if (PhysicalPage->U.Free == PHYSICAL_PAGE_FREE) {
+                    Previous = RtlAtomicCompareExchange(
+                                                  &(PhysicalPage->U.Flags),
+                                                  PHYSICAL_PAGE_FLAG_NON_PAGED,
+                                                  PHYSICAL_PAGE_FREE);
+
+                    if (Previous == PHYSICAL_PAGE_FREE) {
+                        NodeState->LastAllocatedSegment = Segment;
+                        NodeState->LastAllocatedSegmentOffset = Offset + 1;
+                        RtlAtomicAdd(&(Segment->FreePages), -1);
+                        *SignalEvent = MmpUpdatePhysicalMemoryStatistics(1,
+                                                                         TRUE);
+
+                        return Segment->StartAddress + (Offset << PageShift);
+                    }
+                }
+
+                Offset += 1;
+                PhysicalPage += 1;
+            }
+        }
+
+        if ((Wrapped != FALSE) && (Segment == FirstSegment)) {
+            break;
+        }
+
+        if (Segment->ListEntry.Next == &MmPhysicalSegmentListHead) {
+            Segment = LIST_VALUE(MmPhysicalSegmentListHead.Next,
+                                 PHYSICAL_MEMORY_SEGMENT,
+                                 ListEntry);
+
+        } else {
+            Segment = LIST_VALUE(Segment->ListEntry.Next,
+                                 PHYSICAL_MEMORY_SEGMENT,
+                                 ListEntry);
+        }
+
+        Offset = 0;
+        if (Segment == FirstSegment) {
+            Wrapped = TRUE;
+        }
+    }
+
+    return INVALID_PHYSICAL_ADDRESS;
+}
+
+VOID
+MmpInitializeNumaFallbackOrder (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sorts the other NUMA nodes for each node by their distance
+    from it, as described by the firmware, so that single page allocations
+    that cannot be satisfied locally fall back to the nearest memory first.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Candidate;
+    ULONG Distance;
+    ULONG Index;
+    ULONG Node;
+    PPHYSICAL_MEMORY_NODE NodeState;
+    ULONG Other;
+    ULONG Position;
+
+    for (Node = 0; Node < MmNumaNodeCount; Node += 1) {
+        NodeState = &(MmNumaNodes[Node]);
+        NodeState->FallbackOrder[0] = Node;
+        Index = 1;
+
+        //
+        // Insertion sort the other nodes by distance. Nodes at the same
+        // distance stay in node order.
+        //
+
+        for (Other = 0; Other < MmNumaNodeCount; Other += 1) {
+            if (Other == Node) {
+                continue;
+            }
+
+            Distance = AcpiGetNumaDistance(Node, Other);
+            Position = Index;
+            while (Position > 1) {
+                Candidate = NodeState->FallbackOrder[Position - 1];
+                if (AcpiGetNumaDistance(Node, Candidate) <= Distance) {
+                    break;
+                }
+
+                NodeState->FallbackOrder[Position] = Candidate;
+                Position -= 1;
+            }
+
+            NodeState->FallbackOrder[Position] = Other;
+            Index += 1;
+        }
+    }
+
+    return;
+}
+
+PPHYSICAL_PAGE
+MmpGetPhysicalPage (
+    PHYSICAL_ADDRESS PhysicalAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the physical page database entry for the given physical
+    address. The caller must hold the physical page lock.
+
+Arguments:
+
+    PhysicalAddress - Supplies the physical address to look up.
+
+Return Value:
+
+    Returns a pointer to the physical page entry on success.
+
+    NULL if the address is not described by any physical memory segment.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    UINTN Offset;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+
+    CurrentEntry = MmPhysicalSegmentListHead.Next;
+    while (CurrentEntry != &MmPhysicalSegmentListHead) {
+        Segment = LIST_VALUE(CurrentEntry, PHYSICAL_MEMORY_SEGMENT, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if ((PhysicalAddress >= Segment->StartAddress) &&
+            (PhysicalAddress < Segment->EndAddress)) {
+
+            Offset = (PhysicalAddress - Segment->StartAddress) >>
+                     MmPageShift();
+
+            PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+            return PhysicalPage + Offset;
+        }
+    }
+
+    return NULL;
+}
+
@@ -1919,6 +1919,42 @@ Return Value:
     return 1;
 }
 
+KERNEL_API
+PKERNEL_ARGUMENT
+KeGetKernelArgument (
+    PKERNEL_ARGUMENT Start,
+    PCSTR Component,
+    PCSTR Name
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up a kernel command line argument.
+
+Arguments:
+
+    Start - Supplies an optional pointer to the previous command line argument
+        to start from. Supply NULL here initially.
+
+    Component - Supplies a pointer to the component string to look up.
+
+    Name - Supplies a pointer to the argument name to look up.
+
+Return Value:
+
+    Returns a pointer to a matching kernel argument on success.
+
+    NULL if no argument could be found.
+
+--*/
+
+{
+
+    return NULL;
+}
+
 KERNEL_API
 PKEVENT
 KeCreateEvent (
@@ -3365,3 +3401,61 @@ Return Value:
     return NULL;
 }
 
+ULONG
+AcpiGetNumaNodeCount (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the number of NUMA nodes described by the firmware.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of NUMA nodes in the system.
+
+--*/
+
+{
+
+    return 1;
+}
+
+ULONG
+AcpiGetMemoryNode (
+    ULONGLONG Address,
+    PULONGLONG RangeEnd
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines which NUMA node the given physical address belongs
+    to.
+
+Arguments:
+
+    Address - Supplies the physical address to look up.
+
+    RangeEnd - Supplies a pointer where the first physical address after the
+        given address at which the node may change will be returned.
+
+Return Value:
+
+    Returns the NUMA node the address belongs to.
+
+--*/
+
+{
+
+    *RangeEnd = MAX_ULONGLONG;
+    return 0;
+}
+
@@ -87,17 +87,54 @@ Structure Description:
         these flags are available for the user. A couple of the high ones are
         reserved.
 
+    LookupCount - Stores the number of lookups currently reading this entry
+        without the table lock. Removing or replacing a value waits for this
+        to drain so that the lookup callback never runs on a stale value.
+
+    Sequence - Stores a counter that is odd while a replace is changing the
+        value and flags of an allocated entry. Lookups retry if it is odd or
+        changes underneath them, so they never pair a value with the wrong
+        flags.
+
     HandleValue - Stores the actual value of the handle.
 
 --*/
 
 typedef struct _HANDLE_TABLE_ENTRY {
-    ULONG Flags;
-    PVOID HandleValue;
+    volatile ULONG Flags;
+    volatile ULONG LookupCount;
+    volatile ULONG Sequence;
+    PVOID volatile HandleValue;
 } HANDLE_TABLE_ENTRY, *PHANDLE_TABLE_ENTRY;
 
 /*++
 
+Structure Description:
+
+    This structure records an entry array that was replaced when the handle
+    table grew. Lookups do not take the table lock, so they may still be
+    touching an old array after it is replaced. Old arrays are therefore kept
+    until the table is destroyed. Since the table doubles each time, they
+    never add up to more than the current array.
+
+Members:
+
+    Next - Stores a pointer to the next retired array.
+
+    Entries - Stores the retired entry array.
+
+--*/
+
+typedef struct _HANDLE_TABLE_RETIRED_ARRAY HANDLE_TABLE_RETIRED_ARRAY;
+typedef HANDLE_TABLE_RETIRED_ARRAY *PHANDLE_TABLE_RETIRED_ARRAY;
+
+struct _HANDLE_TABLE_RETIRED_ARRAY {
+    PHANDLE_TABLE_RETIRED_ARRAY Next;
+    PHANDLE_TABLE_ENTRY Entries;
+};
+
+/*++
+
 Structure Description:
 
     This structure defines a handle table.
@@ -110,11 +147,15 @@ Structure Description:
 
     MaxDescriptor - Stores the maximum valid descriptor number.
 
-    Entries - Stores the actual array of handles.
+    Entries - Stores the actual array of handles. This is published before
+        the array size grows, so lookups read the size first.
 
     ArraySize - Stores the number of elements in the array.
 
-    Lock - Stores a pointer to a lock protecting access to the handle table.
+    RetiredArrays - Stores the list of arrays replaced by expansion.
+
+    Lock - Stores a pointer to a lock serializing changes to the handle table.
+        Lookups do not acquire it.
 
     LookupCallback - Stores an optional pointer to a routine that is called
         whenever a handle is looked up.
@@ -125,8 +166,9 @@ struct _HANDLE_TABLE {
     PKPROCESS Process;
     ULONG NextDescriptor;
     ULONG MaxDescriptor;
-    PHANDLE_TABLE_ENTRY Entries;
-    ULONG ArraySize;
+    PHANDLE_TABLE_ENTRY volatile Entries;
+    volatile ULONG ArraySize;
+    PHANDLE_TABLE_RETIRED_ARRAY RetiredArrays;
     PQUEUED_LOCK Lock;
     PHANDLE_TABLE_LOOKUP_CALLBACK LookupCallback;
 };
@@ -141,6 +183,11 @@ ObpExpandHandleTable (
     ULONG Descriptor
     );
 
+VOID
+ObpWaitForHandleLookups (
+    PHANDLE_TABLE_ENTRY Entry
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -203,6 +250,7 @@ Return Value:
     HandleTable->Lock = NULL;
     HandleTable->NextDescriptor = 0;
     HandleTable->MaxDescriptor = 0;
+    HandleTable->RetiredArrays = NULL;
     HandleTable->LookupCallback = LookupCallbackRoutine;
     AllocationSize = HANDLE_TABLE_INITIAL_SIZE * sizeof(HANDLE_TABLE_ENTRY);
     HandleTable->Entries = MmAllocatePagedPool(AllocationSize,
@@ -256,6 +304,8 @@ Return Value:
 
 {
 
+    PHANDLE_TABLE_RETIRED_ARRAY Retired;
+
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
     if (HandleTable->Lock != NULL) {
@@ -266,6 +316,13 @@ Return Value:
         MmFreePagedPool(HandleTable->Entries);
     }
 
+    while (HandleTable->RetiredArrays != NULL) {
+        Retired = HandleTable->RetiredArrays;
+        HandleTable->RetiredArrays = Retired->Next;
+        MmFreePagedPool(Retired->Entries);
+        MmFreePagedPool(Retired);
+    }
+
     if (HandleTable->Process != NULL) {
         ObReleaseReference(HandleTable->Process);
     }
@@ -399,10 +456,15 @@ Return Value:
 
     ASSERT(HandleValue != NULL);
 
-    Table->Entries[Descriptor].Flags = HANDLE_FLAG_ALLOCATED |
-                                       (Flags & HANDLE_FLAG_MASK);
+    //
+    // Set the value before the allocated flag so that a concurrent lookup
+    // never sees an allocated entry without its value.
+    //
 
     Table->Entries[Descriptor].HandleValue = HandleValue;
+    RtlAtomicExchange32((PULONG)&(Table->Entries[Descriptor].Flags),
+                        HANDLE_FLAG_ALLOCATED | (Flags & HANDLE_FLAG_MASK));
+
     *NewHandle = (HANDLE)(UINTN)Descriptor;
     if (Descriptor > Table->MaxDescriptor) {
         Table->MaxDescriptor = Descriptor;
@@ -457,8 +519,15 @@ Return Value:
         goto DestroyHandleEnd;
     }
 
+    //
+    // Clear the allocated flag first, then wait out any lookup that saw it
+    // set. After that no lookup can hand out the old value, and the caller
+    // is free to release it.
+    //
+
+    RtlAtomicExchange32((PULONG)&(Table->Entries[Descriptor].Flags), 0);
+    ObpWaitForHandleLookups(&(Table->Entries[Descriptor]));
     Table->Entries[Descriptor].HandleValue = NULL;
-    Table->Entries[Descriptor].Flags = 0;
     if (Table->NextDescriptor > Descriptor) {
         Table->NextDescriptor = Descriptor;
     }
@@ -515,6 +584,7 @@ Return Value:
 {
 
     ULONG Descriptor;
+    PHANDLE_TABLE_ENTRY Entry;
     KSTATUS Status;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
@@ -544,10 +614,20 @@ Return Value:
         *OldHandleValue = Table->Entries[Descriptor].HandleValue;
     }
 
-    Table->Entries[Descriptor].Flags = HANDLE_FLAG_ALLOCATED |
-                                       (NewFlags & HANDLE_FLAG_MASK);
+    //
+    // Swap in the new value and flags inside an odd sequence count so that
+    // lock-free lookups see either the old pair or the new one. Then wait for
+    // lookups that may have picked up the old value, as the caller is likely
+    // to release it.
+    //
 
-    Table->Entries[Descriptor].HandleValue = NewHandleValue;
+    Entry = &(Table->Entries[Descriptor]);
+    RtlAtomicAdd32((PULONG)&(Entry->Sequence), 1);
+    Entry->HandleValue = NewHandleValue;
+    RtlMemoryBarrier();
+    Entry->Flags = HANDLE_FLAG_ALLOCATED | (NewFlags & HANDLE_FLAG_MASK);
+    RtlAtomicAdd32((PULONG)&(Entry->Sequence), 1);
+    ObpWaitForHandleLookups(Entry);
     if (Descriptor > Table->MaxDescriptor) {
         Table->MaxDescriptor = Descriptor;
     }
@@ -571,7 +651,9 @@ ObGetHandleValue (
 Routine Description:
 
     This routine looks up the given handle and returns the value associated
-    with that handle.
+    with that handle. This routine does not acquire the handle table lock. The
+    entry is pinned while the lookup callback runs, so a concurrent close or
+    replace of the handle waits for the callback to finish.
 
 Arguments:
 
@@ -592,8 +674,12 @@ Return Value:
 
 {
 
+    ULONG ArraySize;
     ULONG Descriptor;
+    PHANDLE_TABLE_ENTRY Entries;
+    PHANDLE_TABLE_ENTRY Entry;
     ULONG LocalFlags;
+    ULONG Sequence;
     PVOID Value;
 
     ASSERT((Table->Process == NULL) ||
@@ -603,23 +689,66 @@ Return Value:
     Descriptor = (UINTN)Handle;
     LocalFlags = 0;
     Value = NULL;
-    OB_ACQUIRE_HANDLE_TABLE_LOCK(Table);
-    if (Descriptor >= Table->ArraySize) {
-        goto GetHandleValueEnd;
-    }
+    while (TRUE) {
 
-    LocalFlags = Table->Entries[Descriptor].Flags;
-    if ((LocalFlags & HANDLE_FLAG_ALLOCATED) == 0) {
-        goto GetHandleValueEnd;
-    }
+        //
+        // Expansion publishes the new array before the new size, so reading
+        // in the opposite order guarantees the index is in bounds.
+        //
+
+        ArraySize = Table->ArraySize;
+        RtlMemoryBarrier();
+        Entries = Table->Entries;
+        if (Descriptor >= ArraySize) {
+            break;
+        }
+
+        //
+        // Pin the entry, then make sure the array was not replaced in the
+        // meantime. If it was, the entry may be stale, so try again with the
+        // new array. Expansion waits for pins on the old array to drain, and
+        // removal waits for pins on the entry, so the value cannot be
+        // released while it is pinned here.
+        //
+
+        Entry = &(Entries[Descriptor]);
+        RtlAtomicAdd32((PULONG)&(Entry->LookupCount), 1);
+        if (Table->Entries != Entries) {
+            RtlAtomicAdd32((PULONG)&(Entry->LookupCount), -1);
+            continue;
+        }
 
-    Value = Table->Entries[Descriptor].HandleValue;
-    if (Table->LookupCallback != NULL) {
-        Table->LookupCallback(Table, (HANDLE)(UINTN)Descriptor, Value);
+        //
+        // Read the flags and value between two reads of the sequence. If a
+        // replace was in progress or finished in between, the pair may be
+        // mismatched, so try again.
+        //
+
+        Sequence = Entry->Sequence;
+        RtlMemoryBarrier();
+        LocalFlags = Entry->Flags;
+        Value = NULL;
+        if ((LocalFlags & HANDLE_FLAG_ALLOCATED) != 0) {
+            RtlMemoryBarrier();
+            Value = Entry->HandleValue;
+        }
+
+        RtlMemoryBarrier();
+        if (((Sequence & 0x1) != 0) || (Entry->Sequence != Sequence)) {
+            RtlAtomicAdd32((PULONG)&(Entry->LookupCount), -1);
+            continue;
+        }
+
+        if (Value != NULL) {
+            if (Table->LookupCallback != NULL) {
+                Table->LookupCallback(Table, (HANDLE)(UINTN)Descriptor, Value);
+            }
+        }
+
+        RtlAtomicAdd32((PULONG)&(Entry->LookupCount), -1);
+        break;
     }
 
-GetHandleValueEnd:
-    OB_RELEASE_HANDLE_TABLE_LOCK(Table);
     if ((Flags != NULL) && (Value != NULL)) {
         *Flags = LocalFlags & HANDLE_FLAG_MASK;
     }
@@ -847,8 +976,12 @@ Return Value:
 {
 
     UINTN AllocationSize;
+    ULONG Index;
     PVOID NewBuffer;
     UINTN NewCapacity;
+    PHANDLE_TABLE_ENTRY OldEntries;
+    ULONG OldSize;
+    PHANDLE_TABLE_RETIRED_ARRAY Retired;
     KSTATUS Status;
 
     if (Descriptor >= OB_MAX_HANDLES) {
@@ -880,25 +1013,58 @@ Return Value:
         ASSERT((NewCapacity > Table->ArraySize) &&
                (NewCapacity > Table->NextDescriptor));
 
+        Retired = MmAllocatePagedPool(sizeof(HANDLE_TABLE_RETIRED_ARRAY),
+                                      HANDLE_TABLE_ALLOCATION_TAG);
+
+        if (Retired == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto ExpandHandleTableEnd;
+        }
+
         NewBuffer = MmAllocatePagedPool(AllocationSize,
                                         HANDLE_TABLE_ALLOCATION_TAG);
 
         if (NewBuffer == NULL) {
+            MmFreePagedPool(Retired);
             Status = STATUS_INSUFFICIENT_RESOURCES;
             goto ExpandHandleTableEnd;
         }
 
+        //
+        // The copy carries over lookup counts from the old array. Zero them,
+        // as pins taken on the old array are released there.
+        //
+
+        OldEntries = Table->Entries;
+        OldSize = Table->ArraySize;
         RtlCopyMemory(NewBuffer,
-                      Table->Entries,
-                      Table->ArraySize * sizeof(HANDLE_TABLE_ENTRY));
+                      OldEntries,
+                      OldSize * sizeof(HANDLE_TABLE_ENTRY));
+
+        RtlZeroMemory(NewBuffer + (OldSize * sizeof(HANDLE_TABLE_ENTRY)),
+                      (NewCapacity - OldSize) * sizeof(HANDLE_TABLE_ENTRY));
+
+        for (Index = 0; Index < OldSize; Index += 1) {
+            ((PHANDLE_TABLE_ENTRY)NewBuffer)[Index].LookupCount = 0;
+        }
 
-        RtlZeroMemory(
-                NewBuffer + (Table->ArraySize * sizeof(HANDLE_TABLE_ENTRY)),
-                (NewCapacity - Table->ArraySize) * sizeof(HANDLE_TABLE_ENTRY));
+        //
+        // Publish the new array before the new size, then wait for lookups
+        // that pinned an entry in the old array before the switch. Any later
+        // lookup on the old array notices the switch and retries.
+        //
 
-        MmFreePagedPool(Table->Entries);
+        RtlMemoryBarrier();
         Table->Entries = NewBuffer;
+        RtlMemoryBarrier();
         Table->ArraySize = NewCapacity;
+        for (Index = 0; Index < OldSize; Index += 1) {
+            ObpWaitForHandleLookups(&(OldEntries[Index]));
+        }
+
+        Retired->Entries = OldEntries;
+        Retired->Next = Table->RetiredArrays;
+        Table->RetiredArrays = Retired;
     }
 
     Status = STATUS_SUCCESS;
@@ -907,3 +1073,39 @@ Return Value:
     return Status;
 }
 
+VOID
+ObpWaitForHandleLookups (
+    PHANDLE_TABLE_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits until no lookups have the given entry pinned. The
+    handle table lock must be held, which keeps new pins from finding a stale
+    value.
+
+Arguments:
+
+    Entry - Supplies a pointer to the entry to wait on.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    //
+    // Pins are only held across a lookup callback, so this rarely waits long.
+    //
+
+    while (Entry->LookupCount != 0) {
+        KeYield();
+    }
+
+    return;
+}
+
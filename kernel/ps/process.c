@@ -3764,8 +3764,9 @@ PspHandleTableLookupCallback (
 
 Routine Description:
 
-    This routine is called whenever a handle is looked up. It is called with
-    the handle table lock still held.
+    This routine is called whenever a handle is looked up. It is called
+    without the handle table lock held, but the handle cannot be closed or
+    replaced until it returns.
 
 Arguments:
 
@@ -37,7 +37,10 @@ function build() {
         "lib/fatlib/fattest:",
         "lib/rtl/testrtl:",
         "lib/yy/yytest:",
+        "kernel/io/testpc:",
         "kernel/mm/testmm:",
+        "drivers/sd/core/testsd:",
+        "drivers/usb/usbmass/testmass:",
     ];
 
     entries = group("test_apps", testApps);
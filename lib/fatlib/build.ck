@@ -36,6 +36,8 @@ function build() {
     var sources;
 
     sources = [
+        "dirindex.c",
+        "extent.c",
         "fat.c",
         "fatcache.c",
         "fatsup.c",
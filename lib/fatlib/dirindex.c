@@ -0,0 +1,1636 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    dirindex.c
+
+Abstract:
+
+    This module implements the in-memory name index kept for large FAT
+    directories. The index hashes every name in the directory to the offset
+    of its entries, and tracks which entries are erased so that new entries
+    can be placed without scanning the directory.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Kernel, Boot, Build
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/fat/fatlib.h>
+#include <minoca/lib/fat/fat.h>
+#include "fatlibp.h"
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// These macros test and modify the bit for a directory entry offset in the
+// erased entry bitmap.
+//
+
+#define FAT_INDEX_BIT(_Offset) ((_Offset) - DIRECTORY_CONTENTS_OFFSET)
+
+#define FAT_INDEX_IS_ERASED(_Bitmap, _Offset)                        \
+    (((_Bitmap)[FAT_INDEX_BIT(_Offset) / BITS_PER_ULONG] &           \
+      (1UL << (FAT_INDEX_BIT(_Offset) % BITS_PER_ULONG))) != 0)
+
+#define FAT_INDEX_MARK_ERASED(_Bitmap, _Offset)                      \
+    ((_Bitmap)[FAT_INDEX_BIT(_Offset) / BITS_PER_ULONG] |=           \
+     (1UL << (FAT_INDEX_BIT(_Offset) % BITS_PER_ULONG)))
+
+#define FAT_INDEX_MARK_USED(_Bitmap, _Offset)                        \
+    ((_Bitmap)[FAT_INDEX_BIT(_Offset) / BITS_PER_ULONG] &=           \
+     ~(1UL << (FAT_INDEX_BIT(_Offset) % BITS_PER_ULONG)))
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define BITS_PER_ULONG (sizeof(ULONG) * BITS_PER_BYTE)
+
+//
+// Define the initial number of hash buckets in a directory index. This must
+// be a power of two.
+//
+
+#define FAT_DIRECTORY_INDEX_INITIAL_BUCKETS 256
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef struct _FAT_DIRECTORY_NAME FAT_DIRECTORY_NAME, *PFAT_DIRECTORY_NAME;
+
+/*++
+
+Structure Description:
+
+    This structure stores the location of one name in an indexed directory.
+    The name itself is not stored; hits are confirmed by reading the entries
+    back.
+
+Members:
+
+    NameNext - Stores a pointer to the next name in the same name hash bucket.
+
+    OffsetNext - Stores a pointer to the next name in the same offset hash
+        bucket.
+
+    Hash - Stores the hash of the name.
+
+    StartOffset - Stores the directory offset to begin reading at to get this
+        name back. Erased entries and other names may come first.
+
+    EntryOffset - Stores the directory offset of the short entry for the name.
+
+--*/
+
+struct _FAT_DIRECTORY_NAME {
+    PFAT_DIRECTORY_NAME NameNext;
+    PFAT_DIRECTORY_NAME OffsetNext;
+    ULONG Hash;
+    ULONG StartOffset;
+    ULONG EntryOffset;
+};
+
+/*++
+
+Structure Description:
+
+    This structure stores the name index for one directory.
+
+Members:
+
+    TreeNode - Stores the node in the volume's tree of directory indices.
+
+    ListEntry - Stores pointers to the next and previous indices in the
+        volume's list, ordered from most to least recently used. The next
+        pointer is NULL once the index has been removed from the volume.
+
+    ReferenceCount - Stores the number of references on the index. The
+        volume's tree holds one. This is protected by the volume lock.
+
+    Cluster - Stores the first cluster of the directory.
+
+    NameBuckets - Stores the array of name lists, hashed by name.
+
+    OffsetBuckets - Stores the array of name lists, hashed by entry offset.
+
+    BucketCount - Stores the number of elements in each bucket array.
+
+    NameCount - Stores the number of names in the index.
+
+    ErasedBitmap - Stores a bitmap with a bit set for each erased entry before
+        the end of the directory.
+
+    BitmapSize - Stores the number of bits the bitmap can hold.
+
+    EndOffset - Stores the offset of the directory's end entry, or the end of
+        the directory file if it has none.
+
+--*/
+
+typedef struct _FAT_DIRECTORY_INDEX {
+    RED_BLACK_TREE_NODE TreeNode;
+    LIST_ENTRY ListEntry;
+    ULONG ReferenceCount;
+    ULONG Cluster;
+    PFAT_DIRECTORY_NAME *NameBuckets;
+    PFAT_DIRECTORY_NAME *OffsetBuckets;
+    ULONG BucketCount;
+    ULONG NameCount;
+    PULONG ErasedBitmap;
+    ULONG BitmapSize;
+    ULONG EndOffset;
+} FAT_DIRECTORY_INDEX, *PFAT_DIRECTORY_INDEX;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+PFAT_DIRECTORY_INDEX
+FatpGetDirectoryIndex (
+    PFAT_DIRECTORY_CONTEXT Directory
+    );
+
+VOID
+FatpReleaseDirectoryIndex (
+    PFAT_VOLUME Volume,
+    PFAT_DIRECTORY_INDEX Index
+    );
+
+VOID
+FatpDestroyDirectoryIndex (
+    PFAT_VOLUME Volume,
+    PFAT_DIRECTORY_INDEX Index
+    );
+
+KSTATUS
+FatpDirectoryIndexInsert (
+    PFAT_VOLUME Volume,
+    PFAT_DIRECTORY_INDEX Index,
+    ULONG Hash,
+    ULONG StartOffset,
+    ULONG EntryOffset
+    );
+
+VOID
+FatpDirectoryIndexRehash (
+    PFAT_VOLUME Volume,
+    PFAT_DIRECTORY_INDEX Index
+    );
+
+KSTATUS
+FatpDirectoryIndexGrowBitmap (
+    PFAT_VOLUME Volume,
+    PFAT_DIRECTORY_INDEX Index,
+    ULONG EndOffset
+    );
+
+KSTATUS
+FatpDirectoryIndexReadName (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    PFAT_DIRECTORY_NAME Name,
+    PSTR NameBuffer,
+    PULONG NameBufferSize,
+    PFAT_DIRECTORY_ENTRY Entry
+    );
+
+KSTATUS
+FatpDirectoryIndexCheckEntries (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    ULONG EntryOffset,
+    ULONG EntryCount,
+    UCHAR Expected
+    );
+
+ULONG
+FatpHashDirectoryName (
+    PCSTR Name,
+    ULONG NameLength
+    );
+
+COMPARISON_RESULT
+FatpCompareDirectoryIndexNodes (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+VOID
+FatpInitializeDirectoryIndexTree (
+    PFAT_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes the tree of directory indices for a volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RtlRedBlackTreeInitialize(&(Volume->DirectoryIndexTree),
+                              0,
+                              FatpCompareDirectoryIndexNodes);
+
+    INITIALIZE_LIST_HEAD(&(Volume->DirectoryIndexList));
+    Volume->DirectoryIndexCount = 0;
+    return;
+}
+
+VOID
+FatpDestroyDirectoryIndexTree (
+    PFAT_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys all the directory indices for a volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFAT_DIRECTORY_INDEX Index;
+
+    while (LIST_EMPTY(&(Volume->DirectoryIndexList)) == FALSE) {
+        Index = LIST_VALUE(Volume->DirectoryIndexList.Next,
+                           FAT_DIRECTORY_INDEX,
+                           ListEntry);
+
+        ASSERT(Index->ReferenceCount == 1);
+
+        RtlRedBlackTreeRemove(&(Volume->DirectoryIndexTree),
+                              &(Index->TreeNode));
+
+        LIST_REMOVE(&(Index->ListEntry));
+        FatpDestroyDirectoryIndex(Volume, Index);
+    }
+
+    Volume->DirectoryIndexCount = 0;
+    return;
+}
+
+VOID
+FatpBuildDirectoryIndex (
+    PFAT_DIRECTORY_CONTEXT Directory
+    )
+
+/*++
+
+Routine Description:
+
+    This routine scans a directory and builds a name index for it. Failures
+    are not reported, the directory just goes without an index.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    FAT_DIRECTORY_ENTRY Entry;
+    ULONG EntriesRead;
+    PRED_BLACK_TREE_NODE ExistingNode;
+    PFAT_DIRECTORY_INDEX Index;
+    ULONG IndexSize;
+    PSTR NameBuffer;
+    ULONG NameBufferSize;
+    ULONG NameSize;
+    ULONG Offset;
+    ULONG StartOffset;
+    KSTATUS Status;
+    PFAT_DIRECTORY_INDEX Victim;
+    PFAT_VOLUME Volume;
+
+    Volume = Directory->File->Volume;
+    NameBuffer = NULL;
+    Victim = NULL;
+    if (Directory->File->IsRootDirectory != FALSE) {
+        return;
+    }
+
+    Index = FatpGetDirectoryIndex(Directory);
+    if (Index != NULL) {
+        FatpReleaseDirectoryIndex(Volume, Index);
+        return;
+    }
+
+    IndexSize = sizeof(FAT_DIRECTORY_INDEX) +
+                (FAT_DIRECTORY_INDEX_INITIAL_BUCKETS *
+                 sizeof(PFAT_DIRECTORY_NAME) * 2);
+
+    Index = FatAllocatePagedMemory(Volume->Device.DeviceToken, IndexSize);
+    if (Index == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto BuildDirectoryIndexEnd;
+    }
+
+    RtlZeroMemory(Index, IndexSize);
+    Index->ReferenceCount = 1;
+    Index->Cluster = Directory->File->SeekTable[0];
+    Index->NameBuckets = (PFAT_DIRECTORY_NAME *)(Index + 1);
+    Index->OffsetBuckets = Index->NameBuckets +
+                           FAT_DIRECTORY_INDEX_INITIAL_BUCKETS;
+
+    Index->BucketCount = FAT_DIRECTORY_INDEX_INITIAL_BUCKETS;
+
+    //
+    // First find every erased entry and the end of the directory.
+    //
+
+    Offset = DIRECTORY_CONTENTS_OFFSET;
+    Status = FatpDirectorySeek(Directory, Offset);
+    if (!KSUCCESS(Status)) {
+        goto BuildDirectoryIndexEnd;
+    }
+
+    while (TRUE) {
+        Status = FatpReadDirectory(Directory, &Entry, 1, &EntriesRead);
+        if (Status == STATUS_END_OF_FILE) {
+            break;
+
+        } else if (!KSUCCESS(Status)) {
+            goto BuildDirectoryIndexEnd;
+        }
+
+        if ((EntriesRead == 0) ||
+            (Entry.DosName[0] == FAT_DIRECTORY_ENTRY_END)) {
+
+            break;
+        }
+
+        if (Entry.DosName[0] == FAT_DIRECTORY_ENTRY_ERASED) {
+            Status = FatpDirectoryIndexGrowBitmap(Volume, Index, Offset + 1);
+            if (!KSUCCESS(Status)) {
+                goto BuildDirectoryIndexEnd;
+            }
+
+            FAT_INDEX_MARK_ERASED(Index->ErasedBitmap, Offset);
+        }
+
+        Offset += 1;
+    }
+
+    Index->EndOffset = Offset;
+    Status = FatpDirectoryIndexGrowBitmap(Volume, Index, Offset);
+    if (!KSUCCESS(Status)) {
+        goto BuildDirectoryIndexEnd;
+    }
+
+    //
+    // Now read every name and where it lives.
+    //
+
+    NameBufferSize = FAT_MAX_LONG_FILE_LENGTH + 1;
+    NameBuffer = FatAllocatePagedMemory(Volume->Device.DeviceToken,
+                                        NameBufferSize);
+
+    if (NameBuffer == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto BuildDirectoryIndexEnd;
+    }
+
+    Offset = DIRECTORY_CONTENTS_OFFSET;
+    Status = FatpDirectorySeek(Directory, Offset);
+    if (!KSUCCESS(Status)) {
+        goto BuildDirectoryIndexEnd;
+    }
+
+    while (TRUE) {
+        StartOffset = Offset;
+        NameSize = NameBufferSize;
+        Status = FatpReadNextDirectoryEntry(Directory,
+                                            NULL,
+                                            NameBuffer,
+                                            &NameSize,
+                                            &Entry,
+                                            &EntriesRead);
+
+        if (Status == STATUS_END_OF_FILE) {
+            break;
+
+        } else if (!KSUCCESS(Status)) {
+            goto BuildDirectoryIndexEnd;
+        }
+
+        Offset += EntriesRead;
+        Status = FatpDirectoryIndexInsert(
+                                   Volume,
+                                   Index,
+                                   FatpHashDirectoryName(NameBuffer, NameSize),
+                                   StartOffset,
+                                   Offset - 1);
+
+        if (!KSUCCESS(Status)) {
+            goto BuildDirectoryIndexEnd;
+        }
+    }
+
+    //
+    // Publish the index, evicting the least recently used one if there are
+    // too many.
+    //
+
+    FatAcquireLock(Volume->Lock);
+    ExistingNode = RtlRedBlackTreeSearch(&(Volume->DirectoryIndexTree),
+                                         &(Index->TreeNode));
+
+    if (ExistingNode == NULL) {
+        RtlRedBlackTreeInsert(&(Volume->DirectoryIndexTree),
+                              &(Index->TreeNode));
+
+        INSERT_AFTER(&(Index->ListEntry), &(Volume->DirectoryIndexList));
+        Volume->DirectoryIndexCount += 1;
+        if (Volume->DirectoryIndexCount > FAT_DIRECTORY_INDEX_MAX_COUNT) {
+            Victim = LIST_VALUE(Volume->DirectoryIndexList.Previous,
+                                FAT_DIRECTORY_INDEX,
+                                ListEntry);
+
+            RtlRedBlackTreeRemove(&(Volume->DirectoryIndexTree),
+                                  &(Victim->TreeNode));
+
+            LIST_REMOVE(&(Victim->ListEntry));
+            Victim->ListEntry.Next = NULL;
+            Volume->DirectoryIndexCount -= 1;
+            Victim->ReferenceCount -= 1;
+            if (Victim->ReferenceCount != 0) {
+                Victim = NULL;
+            }
+        }
+
+        Index = NULL;
+    }
+
+    FatReleaseLock(Volume->Lock);
+    Status = STATUS_SUCCESS;
+
+BuildDirectoryIndexEnd:
+    if (Index != NULL) {
+        FatpDestroyDirectoryIndex(Volume, Index);
+    }
+
+    if (Victim != NULL) {
+        FatpDestroyDirectoryIndex(Volume, Victim);
+    }
+
+    if (NameBuffer != NULL) {
+        FatFreePagedMemory(Volume->Device.DeviceToken, NameBuffer);
+    }
+
+    return;
+}
+
+VOID
+FatpDiscardDirectoryIndex (
+    PFAT_VOLUME Volume,
+    ULONG Cluster
+    )
+
+/*++
+
+Routine Description:
+
+    This routine throws away the name index for a directory, if it has one.
+    This is used when the directory is deleted or the index may no longer
+    match the directory contents.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Cluster - Supplies the first cluster of the directory.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PRED_BLACK_TREE_NODE FoundNode;
+    PFAT_DIRECTORY_INDEX Index;
+    FAT_DIRECTORY_INDEX SearchIndex;
+
+    Index = NULL;
+    SearchIndex.Cluster = Cluster;
+    FatAcquireLock(Volume->Lock);
+    FoundNode = RtlRedBlackTreeSearch(&(Volume->DirectoryIndexTree),
+                                      &(SearchIndex.TreeNode));
+
+    if (FoundNode != NULL) {
+        Index = RED_BLACK_TREE_VALUE(FoundNode, FAT_DIRECTORY_INDEX, TreeNode);
+        RtlRedBlackTreeRemove(&(Volume->DirectoryIndexTree), FoundNode);
+        LIST_REMOVE(&(Index->ListEntry));
+        Index->ListEntry.Next = NULL;
+        Volume->DirectoryIndexCount -= 1;
+        Index->ReferenceCount -= 1;
+        if (Index->ReferenceCount != 0) {
+            Index = NULL;
+        }
+    }
+
+    FatReleaseLock(Volume->Lock);
+    if (Index != NULL) {
+        FatpDestroyDirectoryIndex(Volume, Index);
+    }
+
+    return;
+}
+
+KSTATUS
+FatpDirectoryIndexLookup (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    PCSTR Name,
+    ULONG NameLength,
+    PFAT_DIRECTORY_ENTRY Entry,
+    PULONGLONG EntryOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up a name in a directory's name index.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+    Name - Supplies the name to look up.
+
+    NameLength - Supplies the size of the name buffer in bytes, including the
+        null terminator.
+
+    Entry - Supplies a pointer where the directory entry will be returned.
+
+    EntryOffset - Supplies a pointer where the offset of the short directory
+        entry will be returned.
+
+Return Value:
+
+    STATUS_SUCCESS if the name was found.
+
+    STATUS_PATH_NOT_FOUND if the directory does not contain the name.
+
+    STATUS_NOT_FOUND if the directory has no usable index. The caller must
+    scan the directory.
+
+--*/
+
+{
+
+    ULONG Hash;
+    PFAT_DIRECTORY_INDEX Index;
+    PFAT_DIRECTORY_NAME IndexName;
+    PSTR NameBuffer;
+    ULONG NameBufferSize;
+    ULONG NameSize;
+    KSTATUS Status;
+    PFAT_VOLUME Volume;
+
+    Volume = Directory->File->Volume;
+    NameBuffer = NULL;
+    Index = FatpGetDirectoryIndex(Directory);
+    if (Index == NULL) {
+        Status = STATUS_NOT_FOUND;
+        goto DirectoryIndexLookupEnd;
+    }
+
+    NameBufferSize = FAT_MAX_LONG_FILE_LENGTH + 1;
+    NameBuffer = FatAllocatePagedMemory(Volume->Device.DeviceToken,
+                                        NameBufferSize);
+
+    if (NameBuffer == NULL) {
+        Status = STATUS_NOT_FOUND;
+        goto DirectoryIndexLookupEnd;
+    }
+
+    //
+    // Read back each name with a matching hash to confirm it. If what is on
+    // disk no longer matches the index, throw the index away.
+    //
+
+    Status = STATUS_PATH_NOT_FOUND;
+    Hash = FatpHashDirectoryName(Name, NameLength);
+    IndexName = Index->NameBuckets[Hash & (Index->BucketCount - 1)];
+    while (IndexName != NULL) {
+        if (IndexName->Hash == Hash) {
+            NameSize = NameBufferSize;
+            Status = FatpDirectoryIndexReadName(Directory,
+                                                IndexName,
+                                                NameBuffer,
+                                                &NameSize,
+                                                Entry);
+
+            if ((!KSUCCESS(Status)) ||
+                (FatpHashDirectoryName(NameBuffer, NameSize) != Hash)) {
+
+                FatpDiscardDirectoryIndex(Volume, Index->Cluster);
+                Status = STATUS_NOT_FOUND;
+                break;
+            }
+
+            if ((NameSize <= NameLength) &&
+                (RtlAreStringsEqual(Name, NameBuffer, NameLength - 1) !=
+                 FALSE)) {
+
+                *EntryOffset = IndexName->EntryOffset;
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            Status = STATUS_PATH_NOT_FOUND;
+        }
+
+        IndexName = IndexName->NameNext;
+    }
+
+DirectoryIndexLookupEnd:
+    if (NameBuffer != NULL) {
+        FatFreePagedMemory(Volume->Device.DeviceToken, NameBuffer);
+    }
+
+    if (Index != NULL) {
+        FatpReleaseDirectoryIndex(Volume, Index);
+    }
+
+    return Status;
+}
+
+KSTATUS
+FatpDirectoryIndexFindFreeEntries (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    ULONG EntryCount,
+    PULONGLONG EntryOffset,
+    PBOOL AtEnd
+    )
+
+/*++
+
+Routine Description:
+
+    This routine uses a directory's index to find the first run of erased
+    entries long enough for a new name, or failing that the end of the
+    directory. On success the directory is positioned at the returned offset.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+    EntryCount - Supplies the number of entries needed.
+
+    EntryOffset - Supplies a pointer where the offset of the first entry to
+        write will be returned.
+
+    AtEnd - Supplies a pointer where a boolean will be returned indicating
+        whether the entries go at the end of the directory, in which case a
+        new end entry needs to be written after them.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_FOUND if the directory has no usable index. The caller must
+    scan the directory.
+
+--*/
+
+{
+
+    ULONG Bit;
+    ULONG BitCount;
+    PULONG Bitmap;
+    UCHAR Expected;
+    PFAT_DIRECTORY_INDEX Index;
+    ULONG Offset;
+    ULONG RunLength;
+    ULONG RunStart;
+    KSTATUS Status;
+    PFAT_VOLUME Volume;
+
+    Volume = Directory->File->Volume;
+    Index = FatpGetDirectoryIndex(Directory);
+    if (Index == NULL) {
+        return STATUS_NOT_FOUND;
+    }
+
+    //
+    // Search for the first run of erased entries long enough, skipping over
+    // whole words of live entries at a time.
+    //
+
+    Bitmap = Index->ErasedBitmap;
+    BitCount = FAT_INDEX_BIT(Index->EndOffset);
+    Bit = 0;
+    RunLength = 0;
+    RunStart = 0;
+    while (Bit < BitCount) {
+        if (((Bit % BITS_PER_ULONG) == 0) &&
+            (Bitmap[Bit / BITS_PER_ULONG] == 0)) {
+
+            RunLength = 0;
+            Bit += BITS_PER_ULONG;
+            continue;
+        }
+
+        if ((Bitmap[Bit / BITS_PER_ULONG] &
+             (1UL << (Bit % BITS_PER_ULONG))) != 0) {
+
+            if (RunLength == 0) {
+                RunStart = Bit;
+            }
+
+            RunLength += 1;
+            if (RunLength >= EntryCount) {
+                break;
+            }
+
+        } else {
+            RunLength = 0;
+        }
+
+        Bit += 1;
+    }
+
+    //
+    // Make sure the chosen entries really are erased, or really are the end
+    // of the directory.
+    //
+
+    if ((RunLength >= EntryCount) && (Bit < BitCount)) {
+        Offset = RunStart + DIRECTORY_CONTENTS_OFFSET;
+        *AtEnd = FALSE;
+        Expected = FAT_DIRECTORY_ENTRY_ERASED;
+
+    } else {
+        Offset = Index->EndOffset;
+        EntryCount = 1;
+        *AtEnd = TRUE;
+        Expected = FAT_DIRECTORY_ENTRY_END;
+    }
+
+    Status = FatpDirectoryIndexCheckEntries(Directory,
+                                            Offset,
+                                            EntryCount,
+                                            Expected);
+
+    //
+    // A directory that fills its last cluster exactly has no end entry. Let
+    // the caller's scan handle growing it; the index stays valid.
+    //
+
+    if (!KSUCCESS(Status)) {
+        if ((Status != STATUS_END_OF_FILE) || (*AtEnd == FALSE)) {
+            FatpDiscardDirectoryIndex(Volume, Index->Cluster);
+        }
+
+        Status = STATUS_NOT_FOUND;
+        goto DirectoryIndexFindFreeEntriesEnd;
+    }
+
+    Status = FatpDirectorySeek(Directory, Offset);
+    if (!KSUCCESS(Status)) {
+        Status = STATUS_NOT_FOUND;
+        goto DirectoryIndexFindFreeEntriesEnd;
+    }
+
+    *EntryOffset = Offset;
+
+DirectoryIndexFindFreeEntriesEnd:
+    FatpReleaseDirectoryIndex(Volume, Index);
+    return Status;
+}
+
+VOID
+FatpDirectoryIndexAddName (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    PCSTR Name,
+    ULONG NameLength,
+    ULONGLONG EntryOffset,
+    ULONG EntryCount,
+    BOOL AtEnd
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records a newly written name in the directory's index, if it
+    has one.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+    Name - Supplies the name that was added.
+
+    NameLength - Supplies the size of the name buffer in bytes, including the
+        null terminator.
+
+    EntryOffset - Supplies the offset of the first entry written for the name.
+
+    EntryCount - Supplies the number of entries written for the name.
+
+    AtEnd - Supplies a boolean indicating if the entries were written at the
+        end of the directory, moving the end entry.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFAT_DIRECTORY_INDEX Index;
+    ULONG Offset;
+    KSTATUS Status;
+    PFAT_VOLUME Volume;
+
+    Volume = Directory->File->Volume;
+    Index = FatpGetDirectoryIndex(Directory);
+    if (Index == NULL) {
+        return;
+    }
+
+    if (AtEnd != FALSE) {
+        Status = FatpDirectoryIndexGrowBitmap(Volume,
+                                              Index,
+                                              EntryOffset + EntryCount);
+
+        if (!KSUCCESS(Status)) {
+            goto DirectoryIndexAddNameEnd;
+        }
+
+        Index->EndOffset = EntryOffset + EntryCount;
+    }
+
+    for (Offset = EntryOffset; Offset < EntryOffset + EntryCount; Offset += 1) {
+        FAT_INDEX_MARK_USED(Index->ErasedBitmap, Offset);
+    }
+
+    Status = FatpDirectoryIndexInsert(Volume,
+                                      Index,
+                                      FatpHashDirectoryName(Name, NameLength),
+                                      EntryOffset,
+                                      EntryOffset + EntryCount - 1);
+
+DirectoryIndexAddNameEnd:
+    if (!KSUCCESS(Status)) {
+        FatpDiscardDirectoryIndex(Volume, Index->Cluster);
+    }
+
+    FatpReleaseDirectoryIndex(Volume, Index);
+    return;
+}
+
+VOID
+FatpDirectoryIndexRemoveName (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    ULONGLONG EntryOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes an erased name from the directory's index, if it has
+    one, and records which of its entries are now free.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+    EntryOffset - Supplies the offset of the short entry that was erased.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    FAT_DIRECTORY_ENTRY Entry;
+    ULONG EntriesRead;
+    PFAT_DIRECTORY_INDEX Index;
+    PFAT_DIRECTORY_NAME IndexName;
+    PFAT_DIRECTORY_NAME *Link;
+    ULONG Offset;
+    ULONG StartOffset;
+    KSTATUS Status;
+    PFAT_VOLUME Volume;
+
+    Volume = Directory->File->Volume;
+    Index = FatpGetDirectoryIndex(Directory);
+    if (Index == NULL) {
+        return;
+    }
+
+    //
+    // Unlink the name from the offset bucket, then from the name bucket.
+    //
+
+    Link = &(Index->OffsetBuckets[EntryOffset & (Index->BucketCount - 1)]);
+    while ((*Link != NULL) && ((*Link)->EntryOffset != EntryOffset)) {
+        Link = &((*Link)->OffsetNext);
+    }
+
+    IndexName = *Link;
+    if (IndexName == NULL) {
+        Status = STATUS_NOT_FOUND;
+        goto DirectoryIndexRemoveNameEnd;
+    }
+
+    *Link = IndexName->OffsetNext;
+    Link = &(Index->NameBuckets[IndexName->Hash & (Index->BucketCount - 1)]);
+    while (*Link != IndexName) {
+        Link = &((*Link)->NameNext);
+    }
+
+    *Link = IndexName->NameNext;
+    Index->NameCount -= 1;
+    StartOffset = IndexName->StartOffset;
+    FatFreePagedMemory(Volume->Device.DeviceToken, IndexName);
+
+    //
+    // Read back the range the name covered and mark whatever is now erased.
+    //
+
+    Status = FatpDirectorySeek(Directory, StartOffset);
+    if (!KSUCCESS(Status)) {
+        goto DirectoryIndexRemoveNameEnd;
+    }
+
+    for (Offset = StartOffset; Offset <= EntryOffset; Offset += 1) {
+        Status = FatpReadDirectory(Directory, &Entry, 1, &EntriesRead);
+        if (!KSUCCESS(Status)) {
+            goto DirectoryIndexRemoveNameEnd;
+        }
+
+        if (EntriesRead != 1) {
+            Status = STATUS_FILE_CORRUPT;
+            goto DirectoryIndexRemoveNameEnd;
+        }
+
+        if (Entry.DosName[0] == FAT_DIRECTORY_ENTRY_ERASED) {
+            FAT_INDEX_MARK_ERASED(Index->ErasedBitmap, Offset);
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+DirectoryIndexRemoveNameEnd:
+    if (!KSUCCESS(Status)) {
+        FatpDiscardDirectoryIndex(Volume, Index->Cluster);
+    }
+
+    FatpReleaseDirectoryIndex(Volume, Index);
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+PFAT_DIRECTORY_INDEX
+FatpGetDirectoryIndex (
+    PFAT_DIRECTORY_CONTEXT Directory
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the index for a directory and takes a reference on it.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+Return Value:
+
+    Returns a pointer to the index with a reference held, or NULL if the
+    directory has no index.
+
+--*/
+
+{
+
+    PRED_BLACK_TREE_NODE FoundNode;
+    PFAT_DIRECTORY_INDEX Index;
+    FAT_DIRECTORY_INDEX SearchIndex;
+    PFAT_VOLUME Volume;
+
+    if (Directory->File->IsRootDirectory != FALSE) {
+        return NULL;
+    }
+
+    Index = NULL;
+    Volume = Directory->File->Volume;
+    SearchIndex.Cluster = Directory->File->SeekTable[0];
+    FatAcquireLock(Volume->Lock);
+    FoundNode = RtlRedBlackTreeSearch(&(Volume->DirectoryIndexTree),
+                                      &(SearchIndex.TreeNode));
+
+    if (FoundNode != NULL) {
+        Index = RED_BLACK_TREE_VALUE(FoundNode, FAT_DIRECTORY_INDEX, TreeNode);
+        Index->ReferenceCount += 1;
+        LIST_REMOVE(&(Index->ListEntry));
+        INSERT_AFTER(&(Index->ListEntry), &(Volume->DirectoryIndexList));
+    }
+
+    FatReleaseLock(Volume->Lock);
+    return Index;
+}
+
+VOID
+FatpReleaseDirectoryIndex (
+    PFAT_VOLUME Volume,
+    PFAT_DIRECTORY_INDEX Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a reference on a directory index, destroying it if
+    it was the last one.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Index - Supplies a pointer to the index.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL Destroy;
+
+    FatAcquireLock(Volume->Lock);
+
+    ASSERT(Index->ReferenceCount != 0);
+
+    Index->ReferenceCount -= 1;
+    Destroy = FALSE;
+    if (Index->ReferenceCount == 0) {
+
+        ASSERT(Index->ListEntry.Next == NULL);
+
+        Destroy = TRUE;
+    }
+
+    FatReleaseLock(Volume->Lock);
+    if (Destroy != FALSE) {
+        FatpDestroyDirectoryIndex(Volume, Index);
+    }
+
+    return;
+}
+
+VOID
+FatpDestroyDirectoryIndex (
+    PFAT_VOLUME Volume,
+    PFAT_DIRECTORY_INDEX Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a directory index and all its names.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Index - Supplies a pointer to the index.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    PVOID DeviceToken;
+    PFAT_DIRECTORY_NAME IndexName;
+    PFAT_DIRECTORY_NAME NextName;
+
+    DeviceToken = Volume->Device.DeviceToken;
+    for (Bucket = 0; Bucket < Index->BucketCount; Bucket += 1) {
+        IndexName = Index->NameBuckets[Bucket];
+        while (IndexName != NULL) {
+            NextName = IndexName->NameNext;
+            FatFreePagedMemory(DeviceToken, IndexName);
+            IndexName = NextName;
+        }
+    }
+
+    //
+    // The initial bucket arrays are allocated with the index itself.
+    //
+
+    if (Index->NameBuckets != (PFAT_DIRECTORY_NAME *)(Index + 1)) {
+        FatFreePagedMemory(DeviceToken, Index->NameBuckets);
+    }
+
+    if (Index->ErasedBitmap != NULL) {
+        FatFreePagedMemory(DeviceToken, Index->ErasedBitmap);
+    }
+
+    FatFreePagedMemory(DeviceToken, Index);
+    return;
+}
+
+KSTATUS
+FatpDirectoryIndexInsert (
+    PFAT_VOLUME Volume,
+    PFAT_DIRECTORY_INDEX Index,
+    ULONG Hash,
+    ULONG StartOffset,
+    ULONG EntryOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a name to a directory index.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Index - Supplies a pointer to the index.
+
+    Hash - Supplies the hash of the name.
+
+    StartOffset - Supplies the offset to start reading at to get the name.
+
+    EntryOffset - Supplies the offset of the name's short entry.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    PFAT_DIRECTORY_NAME IndexName;
+
+    IndexName = FatAllocatePagedMemory(Volume->Device.DeviceToken,
+                                       sizeof(FAT_DIRECTORY_NAME));
+
+    if (IndexName == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    IndexName->Hash = Hash;
+    IndexName->StartOffset = StartOffset;
+    IndexName->EntryOffset = EntryOffset;
+    Bucket = Hash & (Index->BucketCount - 1);
+    IndexName->NameNext = Index->NameBuckets[Bucket];
+    Index->NameBuckets[Bucket] = IndexName;
+    Bucket = EntryOffset & (Index->BucketCount - 1);
+    IndexName->OffsetNext = Index->OffsetBuckets[Bucket];
+    Index->OffsetBuckets[Bucket] = IndexName;
+    Index->NameCount += 1;
+    if (Index->NameCount > (Index->BucketCount * 2)) {
+        FatpDirectoryIndexRehash(Volume, Index);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FatpDirectoryIndexRehash (
+    PFAT_VOLUME Volume,
+    PFAT_DIRECTORY_INDEX Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine doubles the number of buckets in a directory index. If the
+    new buckets cannot be allocated, the index stays as it is.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Index - Supplies a pointer to the index.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    ULONG BucketCount;
+    PFAT_DIRECTORY_NAME IndexName;
+    PFAT_DIRECTORY_NAME *NameBuckets;
+    PFAT_DIRECTORY_NAME NextName;
+    PFAT_DIRECTORY_NAME *OffsetBuckets;
+    ULONG Size;
+
+    BucketCount = Index->BucketCount * 2;
+    Size = BucketCount * sizeof(PFAT_DIRECTORY_NAME) * 2;
+    NameBuckets = FatAllocatePagedMemory(Volume->Device.DeviceToken, Size);
+    if (NameBuckets == NULL) {
+        return;
+    }
+
+    RtlZeroMemory(NameBuckets, Size);
+    OffsetBuckets = NameBuckets + BucketCount;
+    for (Bucket = 0; Bucket < Index->BucketCount; Bucket += 1) {
+        IndexName = Index->NameBuckets[Bucket];
+        while (IndexName != NULL) {
+            NextName = IndexName->NameNext;
+            IndexName->NameNext = NameBuckets[IndexName->Hash &
+                                              (BucketCount - 1)];
+
+            NameBuckets[IndexName->Hash & (BucketCount - 1)] = IndexName;
+            IndexName->OffsetNext = OffsetBuckets[IndexName->EntryOffset &
+                                                  (BucketCount - 1)];
+
+            OffsetBuckets[IndexName->EntryOffset & (BucketCount - 1)] =
+                                                                    IndexName;
+
+            IndexName = NextName;
+        }
+    }
+
+    if (Index->NameBuckets != (PFAT_DIRECTORY_NAME *)(Index + 1)) {
+        FatFreePagedMemory(Volume->Device.DeviceToken, Index->NameBuckets);
+    }
+
+    Index->NameBuckets = NameBuckets;
+    Index->OffsetBuckets = OffsetBuckets;
+    Index->BucketCount = BucketCount;
+    return;
+}
+
+KSTATUS
+FatpDirectoryIndexGrowBitmap (
+    PFAT_VOLUME Volume,
+    PFAT_DIRECTORY_INDEX Index,
+    ULONG EndOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes sure the erased entry bitmap covers every entry before
+    the given offset. New bits are clear.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Index - Supplies a pointer to the index.
+
+    EndOffset - Supplies the directory offset the bitmap must reach.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PULONG Bitmap;
+    ULONG BitmapSize;
+    ULONG Needed;
+
+    Needed = FAT_INDEX_BIT(EndOffset);
+    if (Needed <= Index->BitmapSize) {
+        return STATUS_SUCCESS;
+    }
+
+    BitmapSize = Index->BitmapSize * 2;
+    if (BitmapSize < Needed) {
+        BitmapSize = ALIGN_RANGE_UP(Needed, BITS_PER_ULONG * 32);
+    }
+
+    Bitmap = FatAllocatePagedMemory(Volume->Device.DeviceToken,
+                                    BitmapSize / BITS_PER_BYTE);
+
+    if (Bitmap == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Bitmap, BitmapSize / BITS_PER_BYTE);
+    if (Index->ErasedBitmap != NULL) {
+        RtlCopyMemory(Bitmap,
+                      Index->ErasedBitmap,
+                      Index->BitmapSize / BITS_PER_BYTE);
+
+        FatFreePagedMemory(Volume->Device.DeviceToken, Index->ErasedBitmap);
+    }
+
+    Index->ErasedBitmap = Bitmap;
+    Index->BitmapSize = BitmapSize;
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+FatpDirectoryIndexReadName (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    PFAT_DIRECTORY_NAME Name,
+    PSTR NameBuffer,
+    PULONG NameBufferSize,
+    PFAT_DIRECTORY_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads back the name an index entry refers to.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+    Name - Supplies a pointer to the index entry.
+
+    NameBuffer - Supplies a pointer to a buffer where the name will be
+        returned.
+
+    NameBufferSize - Supplies a pointer that on input contains the size of the
+        name buffer. On output, returns the size of the name including the
+        null terminator.
+
+    Entry - Supplies a pointer where the short directory entry for the name
+        will be returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_FOUND if no name ends at the index entry's offset.
+
+    Other error codes on device I/O errors.
+
+--*/
+
+{
+
+    ULONG BufferSize;
+    ULONG EntriesRead;
+    ULONG Offset;
+    KSTATUS Status;
+
+    BufferSize = *NameBufferSize;
+    Offset = Name->StartOffset;
+    Status = FatpDirectorySeek(Directory, Offset);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    //
+    // Other names may have been created in erased entries before this one.
+    // Read forward until reaching this one.
+    //
+
+    while (Offset <= Name->EntryOffset) {
+        *NameBufferSize = BufferSize;
+        Status = FatpReadNextDirectoryEntry(Directory,
+                                            NULL,
+                                            NameBuffer,
+                                            NameBufferSize,
+                                            Entry,
+                                            &EntriesRead);
+
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        Offset += EntriesRead;
+        if (Offset - 1 == Name->EntryOffset) {
+            return STATUS_SUCCESS;
+        }
+    }
+
+    return STATUS_NOT_FOUND;
+}
+
+KSTATUS
+FatpDirectoryIndexCheckEntries (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    ULONG EntryOffset,
+    ULONG EntryCount,
+    UCHAR Expected
+    )
+
+/*++
+
+Routine Description:
+
+    This routine confirms that a run of raw directory entries all begin with
+    the given marker byte.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+    EntryOffset - Supplies the offset of the first entry to check.
+
+    EntryCount - Supplies the number of entries to check.
+
+    Expected - Supplies the expected first byte of each entry.
+
+Return Value:
+
+    STATUS_SUCCESS if all the entries match.
+
+    STATUS_NOT_FOUND if an entry does not match.
+
+    STATUS_END_OF_FILE if the directory ends first.
+
+    Other error codes on device I/O errors.
+
+--*/
+
+{
+
+    FAT_DIRECTORY_ENTRY Entry;
+    ULONG EntriesRead;
+    ULONG Index;
+    KSTATUS Status;
+
+    Status = FatpDirectorySeek(Directory, EntryOffset);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    for (Index = 0; Index < EntryCount; Index += 1) {
+        Status = FatpReadDirectory(Directory, &Entry, 1, &EntriesRead);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        if ((EntriesRead != 1) || (Entry.DosName[0] != Expected)) {
+            return STATUS_NOT_FOUND;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+ULONG
+FatpHashDirectoryName (
+    PCSTR Name,
+    ULONG NameLength
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hashes a file name, up to its null terminator.
+
+Arguments:
+
+    Name - Supplies the name to hash.
+
+    NameLength - Supplies the size of the name buffer in bytes, including the
+        null terminator.
+
+Return Value:
+
+    Returns the hash of the name.
+
+--*/
+
+{
+
+    ULONG Length;
+
+    Length = 0;
+    while ((Length + 1 < NameLength) && (Name[Length] != '\0')) {
+        Length += 1;
+    }
+
+    return RtlComputeCrc32(0, Name, Length);
+}
+
+COMPARISON_RESULT
+FatpCompareDirectoryIndexNodes (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two directory index nodes by directory cluster.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PFAT_DIRECTORY_INDEX First;
+    PFAT_DIRECTORY_INDEX Second;
+
+    First = RED_BLACK_TREE_VALUE(FirstNode, FAT_DIRECTORY_INDEX, TreeNode);
+    Second = RED_BLACK_TREE_VALUE(SecondNode, FAT_DIRECTORY_INDEX, TreeNode);
+    if (First->Cluster < Second->Cluster) {
+        return ComparisonResultAscending;
+
+    } else if (First->Cluster > Second->Cluster) {
+        return ComparisonResultDescending;
+    }
+
+    return ComparisonResultSame;
+}
+
@@ -0,0 +1,393 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    extent.c
+
+Abstract:
+
+    This module implements the per-file extent map, which caches the runs of
+    contiguous clusters in a file so that seeks do not have to follow the
+    cluster chain from the beginning.
+
+Author:
+
+    Minoca Corp. 18-Oct-2026
+
+Environment:
+
+    Kernel, Boot, Build
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/fat/fatlib.h>
+#include <minoca/lib/fat/fat.h>
+#include "fatlibp.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+FatpAppendFileExtent (
+    PFAT_FILE File,
+    ULONG Cluster
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+FatpInitializeExtentMap (
+    PFAT_FILE File
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes the extent map of a newly opened file.
+
+Arguments:
+
+    File - Supplies a pointer to the file.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PFAT_EXTENT_MAP Map;
+    KSTATUS Status;
+
+    Map = &(File->ExtentMap);
+    RtlZeroMemory(Map, sizeof(FAT_EXTENT_MAP));
+
+    //
+    // The page file must not allocate on the paging path, and the FAT12/16
+    // root directory is not made of clusters.
+    //
+
+    if (((File->OpenFlags & OPEN_FLAG_PAGE_FILE) != 0) ||
+        (File->IsRootDirectory != FALSE)) {
+
+        return STATUS_SUCCESS;
+    }
+
+    Status = FatCreateLock(&(Map->Lock));
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Map->Generation = File->Volume->ChainGeneration;
+    return STATUS_SUCCESS;
+}
+
+VOID
+FatpDestroyExtentMap (
+    PFAT_FILE File
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tears down a file's extent map.
+
+Arguments:
+
+    File - Supplies a pointer to the file.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFAT_EXTENT_MAP Map;
+
+    Map = &(File->ExtentMap);
+    if (Map->Extents != NULL) {
+        FatFreePagedMemory(File->Volume->Device.DeviceToken, Map->Extents);
+        Map->Extents = NULL;
+    }
+
+    if (Map->Lock != NULL) {
+        FatDestroyLock(Map->Lock);
+        Map->Lock = NULL;
+    }
+
+    Map->Count = 0;
+    Map->Capacity = 0;
+    return;
+}
+
+KSTATUS
+FatpLookupFileExtent (
+    PFAT_FILE File,
+    ULONG FileCluster,
+    PFAT_EXTENT Extent
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the run of contiguous clusters containing the given
+    cluster of a file, following and recording the cluster chain as far as
+    needed.
+
+Arguments:
+
+    File - Supplies a pointer to the file.
+
+    FileCluster - Supplies the index of the cluster within the file.
+
+    Extent - Supplies a pointer where the extent containing the given file
+        cluster will be returned. If the file ends before the given cluster,
+        the file's last extent is returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_END_OF_FILE if the file ends before the given cluster.
+
+    STATUS_NOT_SUPPORTED if the file does not use an extent map.
+
+    STATUS_INSUFFICIENT_RESOURCES if the map could not grow to cover the
+        given cluster. The caller should follow the cluster chain itself.
+
+    STATUS_FILE_CORRUPT if the cluster chain is longer than the volume.
+
+    Other error codes on device I/O errors.
+
+--*/
+
+{
+
+    ULONG Cluster;
+    PFAT_EXTENT Extents;
+    PFAT_EXTENT Last;
+    LONG Maximum;
+    PFAT_EXTENT_MAP Map;
+    LONG Middle;
+    LONG Minimum;
+    ULONG NextCluster;
+    KSTATUS Status;
+    PFAT_VOLUME Volume;
+
+    Map = &(File->ExtentMap);
+    Volume = File->Volume;
+    if (((File->OpenFlags & OPEN_FLAG_PAGE_FILE) != 0) ||
+        (File->IsRootDirectory != FALSE)) {
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    FatAcquireLock(Map->Lock);
+
+    //
+    // Throw the map away if a cluster chain on the volume was cut since it
+    // was built.
+    //
+
+    if (Map->Generation != Volume->ChainGeneration) {
+        Map->Generation = Volume->ChainGeneration;
+        Map->Count = 0;
+    }
+
+    if (Map->Count == 0) {
+        Cluster = File->SeekTable[0];
+        if ((Cluster < FAT_CLUSTER_BEGIN) || (Cluster >= Volume->ClusterBad)) {
+            Status = STATUS_FILE_CORRUPT;
+            goto LookupFileExtentEnd;
+        }
+
+        Status = FatpAppendFileExtent(File, Cluster);
+        if (!KSUCCESS(Status)) {
+            goto LookupFileExtentEnd;
+        }
+    }
+
+    //
+    // Follow the chain from the end of the map until it covers the requested
+    // cluster. Contiguous clusters just lengthen the last extent.
+    //
+
+    Last = &(Map->Extents[Map->Count - 1]);
+    while (Last->FileCluster + Last->Count <= FileCluster) {
+        if (Last->FileCluster + Last->Count >= Volume->ClusterCount) {
+            Status = STATUS_FILE_CORRUPT;
+            goto LookupFileExtentEnd;
+        }
+
+        Cluster = Last->Cluster + Last->Count - 1;
+        Status = FatpGetNextCluster(Volume, 0, Cluster, &NextCluster);
+        if (!KSUCCESS(Status)) {
+            goto LookupFileExtentEnd;
+        }
+
+        if ((NextCluster < FAT_CLUSTER_BEGIN) ||
+            (NextCluster >= Volume->ClusterBad)) {
+
+            *Extent = *Last;
+            Status = STATUS_END_OF_FILE;
+            goto LookupFileExtentEnd;
+        }
+
+        if (NextCluster == Cluster + 1) {
+            Last->Count += 1;
+            continue;
+        }
+
+        Status = FatpAppendFileExtent(File, NextCluster);
+        if (!KSUCCESS(Status)) {
+            goto LookupFileExtentEnd;
+        }
+
+        Last = &(Map->Extents[Map->Count - 1]);
+    }
+
+    //
+    // Binary search for the extent containing the cluster.
+    //
+
+    Extents = Map->Extents;
+    Minimum = 0;
+    Maximum = Map->Count - 1;
+    while (Minimum < Maximum) {
+        Middle = Minimum + ((Maximum - Minimum + 1) / 2);
+        if (Extents[Middle].FileCluster <= FileCluster) {
+            Minimum = Middle;
+
+        } else {
+            Maximum = Middle - 1;
+        }
+    }
+
+    ASSERT((FileCluster >= Extents[Minimum].FileCluster) &&
+           (FileCluster <
+            Extents[Minimum].FileCluster + Extents[Minimum].Count));
+
+    *Extent = Extents[Minimum];
+    Status = STATUS_SUCCESS;
+
+LookupFileExtentEnd:
+    FatReleaseLock(Map->Lock);
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+FatpAppendFileExtent (
+    PFAT_FILE File,
+    ULONG Cluster
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a one cluster extent to the end of a file's extent map,
+    growing the array if needed. This routine assumes the map lock is held.
+
+Arguments:
+
+    File - Supplies a pointer to the file.
+
+    Cluster - Supplies the volume cluster that begins the new extent.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if the map is full or could not be grown.
+
+--*/
+
+{
+
+    ULONG Capacity;
+    PVOID DeviceToken;
+    PFAT_EXTENT Extents;
+    PFAT_EXTENT Last;
+    PFAT_EXTENT_MAP Map;
+    PFAT_EXTENT NewExtent;
+
+    Map = &(File->ExtentMap);
+    if (Map->Count == Map->Capacity) {
+        if (Map->Capacity >= FAT_EXTENT_MAP_MAX_EXTENTS) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        Capacity = Map->Capacity * 2;
+        if (Capacity == 0) {
+            Capacity = FAT_EXTENT_MAP_INITIAL_CAPACITY;
+        }
+
+        DeviceToken = File->Volume->Device.DeviceToken;
+        Extents = FatAllocatePagedMemory(DeviceToken,
+                                         Capacity * sizeof(FAT_EXTENT));
+
+        if (Extents == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        if (Map->Extents != NULL) {
+            RtlCopyMemory(Extents,
+                          Map->Extents,
+                          Map->Count * sizeof(FAT_EXTENT));
+
+            FatFreePagedMemory(DeviceToken, Map->Extents);
+        }
+
+        Map->Extents = Extents;
+        Map->Capacity = Capacity;
+    }
+
+    NewExtent = &(Map->Extents[Map->Count]);
+    NewExtent->FileCluster = 0;
+    if (Map->Count != 0) {
+        Last = &(Map->Extents[Map->Count - 1]);
+        NewExtent->FileCluster = Last->FileCluster + Last->Count;
+    }
+
+    NewExtent->Cluster = Cluster;
+    NewExtent->Count = 1;
+    Map->Count += 1;
+    return STATUS_SUCCESS;
+}
+
@@ -939,6 +939,7 @@ Return Value:
                   sizeof(BLOCK_DEVICE_PARAMETERS));
 
     FatpInitializeFileMappingTree(FatVolume);
+    FatpInitializeDirectoryIndexTree(FatVolume);
     FatVolume->BlockShift =
                           RtlCountTrailingZeros32(FatVolume->Device.BlockSize);
 
@@ -1183,6 +1184,7 @@ Return Value:
     FatVolume = (PFAT_VOLUME)Volume;
     FatpDestroyFatCache(FatVolume);
     FatpDestroyFileMappingTree(FatVolume);
+    FatpDestroyDirectoryIndexTree(FatVolume);
     FatDestroyLock(FatVolume->Lock);
     FatFreeNonPagedMemory(FatVolume->Device.DeviceToken, FatVolume);
     return STATUS_SUCCESS;
@@ -1365,6 +1367,11 @@ Return Value:
         FatFile->IsRootDirectory = TRUE;
     }
 
+    Status = FatpInitializeExtentMap(FatFile);
+    if (!KSUCCESS(Status)) {
+        goto OpenFileIdEnd;
+    }
+
     *FileToken = FatFile;
     Status = STATUS_SUCCESS;
 
@@ -1420,6 +1427,7 @@ Return Value:
 
     ASSERT(FatFile != NULL);
 
+    FatpDestroyExtentMap(FatFile);
     if (FatFile->ScratchIoBuffer != NULL) {
         FatFreeIoBuffer(FatFile->ScratchIoBuffer);
     }
@@ -2761,8 +2769,10 @@ Return Value:
     ULONG CurrentWindowIndex;
     ULONGLONG DestinationOffset;
     ULONGLONG DiskByteOffset;
+    FAT_EXTENT Extent;
     PFAT_FILE File;
     ULONGLONG FileByteOffset;
+    ULONG FileCluster;
     ULONG PreviousCluster;
     ULONG PreviousTableIndex;
     KSTATUS Status;
@@ -2911,12 +2921,59 @@ Return Value:
     }
 
     //
-    // Get the nearest seek table index, and march down until a seek table
-    // entry is filled in. The first one is guaranteed to be filled in.
+    // Look up the destination in the file's extent map. This only follows
+    // the parts of the cluster chain that have not been seen before.
+    //
+
+    ClusterAlignedDestination = ALIGN_RANGE_DOWN(DestinationOffset,
+                                                 ClusterSize);
+
+    FileCluster = ClusterAlignedDestination >> Volume->ClusterShift;
+    Status = FatpLookupFileExtent(File, FileCluster, &Extent);
+    if (KSUCCESS(Status)) {
+        CurrentCluster = Extent.Cluster + (FileCluster - Extent.FileCluster);
+        DiskByteOffset = FAT_CLUSTER_TO_BYTE(Volume, CurrentCluster);
+        FatSeekInformation->ClusterByteOffset = DestinationOffset -
+                                                ClusterAlignedDestination;
+
+        DiskByteOffset += FatSeekInformation->ClusterByteOffset;
+        FatSeekInformation->CurrentBlock = DiskByteOffset >> BlockShift;
+        FatSeekInformation->CurrentCluster = CurrentCluster;
+        FatSeekInformation->FileByteOffset = DestinationOffset;
+        goto FatFileSeekEnd;
+    }
+
+    //
+    // If the file ends first, tip the seek information just over the line
+    // at the end of the last cluster, as below.
+    //
+
+    if (Status == STATUS_END_OF_FILE) {
+        CurrentOffset = (ULONGLONG)(Extent.FileCluster + Extent.Count) <<
+                        Volume->ClusterShift;
+
+        if (CurrentOffset == ClusterAlignedDestination) {
+            Status = STATUS_SUCCESS;
+        }
+
+        PreviousCluster = Extent.Cluster + Extent.Count - 1;
+        DiskByteOffset = FAT_CLUSTER_TO_BYTE(Volume, PreviousCluster);
+        FatSeekInformation->CurrentBlock = DiskByteOffset >> BlockShift;
+        FatSeekInformation->ClusterByteOffset = ClusterSize;
+        FatSeekInformation->CurrentCluster = PreviousCluster;
+        FatSeekInformation->FileByteOffset = CurrentOffset;
+        goto FatFileSeekEnd;
+    }
+
+    //
+    // If the extent map could not be used, get the nearest seek table index,
+    // and march down until a seek table entry is filled in. The first one is
+    // guaranteed to be filled in.
     //
 
     ASSERT(File->SeekTable[0] != 0);
 
+    Status = STATUS_SUCCESS;
     TableIndex = FAT_SEEK_TABLE_INDEX(DestinationOffset);
     while (File->SeekTable[TableIndex] == 0) {
         TableIndex -= 1;
@@ -2951,9 +3008,6 @@ Return Value:
     // Cruise the singly linked list of clusters.
     //
 
-    ClusterAlignedDestination = ALIGN_RANGE_DOWN(DestinationOffset,
-                                                 ClusterSize);
-
     PreviousCluster = CurrentCluster;
     PreviousTableIndex = TableIndex;
     CurrentWindowIndex = MAX_ULONG;
@@ -3418,6 +3472,14 @@ Return Value:
            (StartingCluster >= FAT_CLUSTER_BEGIN) &&
            (StartingCluster < FatVolume->ClusterCount));
 
+    //
+    // A directory being deleted takes its name index with it.
+    //
+
+    if (Truncate == FALSE) {
+        FatpDiscardDirectoryIndex(FatVolume, StartingCluster);
+    }
+
     if (Truncate != FALSE) {
 
         //
@@ -3752,9 +3814,11 @@ Return Value:
 
 {
 
+    ULONG AllocatedCount;
     ULONG Cluster;
     ULONG ClusterCount;
     ULONGLONG CurrentSize;
+    ULONG DesiredCount;
     BOOL Dirty;
     PFAT_VOLUME FatVolume;
     ULONG NextCluster;
@@ -3775,13 +3839,31 @@ Return Value:
             return Status;
         }
 
+        //
+        // Once off the end of the chain, allocate everything still needed in
+        // as few contiguous extents as possible.
+        //
+
         if (NextCluster >= ClusterCount) {
-            Status = FatpAllocateCluster(Volume, Cluster, &NextCluster, FALSE);
+            DesiredCount = ALIGN_RANGE_UP(FileSize - CurrentSize,
+                                          FatVolume->ClusterSize) >>
+                           FatVolume->ClusterShift;
+
+            Status = FatpAllocateClusters(Volume,
+                                          Cluster,
+                                          DesiredCount,
+                                          &NextCluster,
+                                          &AllocatedCount,
+                                          FALSE);
+
             if (!KSUCCESS(Status)) {
                 return Status;
             }
 
             Dirty = TRUE;
+            Cluster = NextCluster + AllocatedCount - 1;
+            CurrentSize += (ULONGLONG)AllocatedCount << FatVolume->ClusterShift;
+            continue;
         }
 
         Cluster = NextCluster;
@@ -3860,6 +3942,7 @@ Return Value:
 
 {
 
+    ULONG AllocatedCount;
     ULONG BlockByteOffset;
     UINTN BlockCount;
     ULONG BlockShift;
@@ -3871,8 +3954,11 @@ Return Value:
     ULONG ClusterShift;
     ULONG ClusterSize;
     ULONG CurrentCluster;
+    ULONG DesiredCount;
+    FAT_EXTENT Extent;
     PFAT_FILE File;
     ULONGLONG FileByteOffset;
+    ULONG FileCluster;
     KSTATUS FlushStatus;
     UINTN MaxContiguousBytes;
     ULONG NewCluster;
@@ -3880,6 +3966,7 @@ Return Value:
     ULONG NextCluster;
     PFAT_IO_BUFFER ScratchIoBuffer;
     BOOL ScratchLockHeld;
+    ULONG SkipCount;
     KSTATUS Status;
     ULONG TableIndex;
     UINTN TotalBytesProcessed;
@@ -4004,10 +4091,20 @@ Return Value:
             ASSERT((IoFlags & IO_FLAG_NO_ALLOCATE) == 0);
             ASSERT((File->OpenFlags & OPEN_FLAG_PAGE_FILE) == 0);
 
-            Status = FatpAllocateCluster(Volume,
-                                         FatSeekInformation->CurrentCluster,
-                                         &NewCluster,
-                                         FALSE);
+            //
+            // Allocate enough for the whole write at once so that it lands
+            // in as few extents as possible.
+            //
+
+            DesiredCount = ALIGN_RANGE_UP(SizeInBytes, ClusterSize) >>
+                           ClusterShift;
+
+            Status = FatpAllocateClusters(Volume,
+                                          FatSeekInformation->CurrentCluster,
+                                          DesiredCount,
+                                          &NewCluster,
+                                          &AllocatedCount,
+                                          FALSE);
 
             if (!KSUCCESS(Status)) {
                 goto PerformFileIoEnd;
@@ -4074,6 +4171,38 @@ Return Value:
 
             CurrentCluster = FatSeekInformation->CurrentCluster;
             FileByteOffset = FatSeekInformation->FileByteOffset;
+
+            //
+            // Use the extent map to skip to the end of the current run, so
+            // that the chain is only followed where the run ends.
+            //
+
+            if (MaxContiguousBytes < SizeInBytes) {
+                FileCluster = FileByteOffset >> ClusterShift;
+                Status = FatpLookupFileExtent(File, FileCluster, &Extent);
+                if ((KSUCCESS(Status)) &&
+                    (Extent.Cluster + (FileCluster - Extent.FileCluster) ==
+                     CurrentCluster)) {
+
+                    SkipCount = Extent.Count -
+                                (FileCluster - Extent.FileCluster) - 1;
+
+                    DesiredCount = ALIGN_RANGE_UP(SizeInBytes -
+                                                  MaxContiguousBytes,
+                                                  ClusterSize) >> ClusterShift;
+
+                    if (SkipCount > DesiredCount) {
+                        SkipCount = DesiredCount;
+                    }
+
+                    MaxContiguousBytes += (UINTN)SkipCount << ClusterShift;
+                    CurrentCluster += SkipCount;
+                    FileByteOffset += (ULONGLONG)SkipCount << ClusterShift;
+                }
+
+                Status = STATUS_SUCCESS;
+            }
+
             while (MaxContiguousBytes < SizeInBytes) {
                 Status = FatpGetNextCluster(Volume,
                                             IoFlags,
@@ -4099,10 +4228,22 @@ Return Value:
                     ASSERT((IoFlags & IO_FLAG_NO_ALLOCATE) == 0);
                     ASSERT((File->OpenFlags & OPEN_FLAG_PAGE_FILE) == 0);
 
-                    Status = FatpAllocateCluster(Volume,
-                                                 CurrentCluster,
-                                                 &NewCluster,
-                                                 FALSE);
+                    //
+                    // Allocate the rest of the write as one extent. The
+                    // clusters are chained, so subsequent passes just follow
+                    // them.
+                    //
+
+                    DesiredCount = SizeInBytes - MaxContiguousBytes;
+                    DesiredCount = ALIGN_RANGE_UP(DesiredCount, ClusterSize) >>
+                                   ClusterShift;
+
+                    Status = FatpAllocateClusters(Volume,
+                                                  CurrentCluster,
+                                                  DesiredCount,
+                                                  &NewCluster,
+                                                  &AllocatedCount,
+                                                  FALSE);
 
                     if (!KSUCCESS(Status)) {
                         goto PerformFileIoEnd;
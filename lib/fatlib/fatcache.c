@@ -37,6 +37,19 @@ Module Name:
 // --------------------------------------------------------------------- Macros
 //
 
+//
+// These macros test, set, and clear a cluster's bit in the free bitmap.
+//
+
+#define FAT_IS_CLUSTER_FREE(_Bitmap, _Cluster) \
+    (((_Bitmap)[(_Cluster) >> 5] & (1 << ((_Cluster) & 0x1F))) != 0)
+
+#define FAT_MARK_CLUSTER_FREE(_Bitmap, _Cluster) \
+    ((_Bitmap)[(_Cluster) >> 5] |= (1 << ((_Cluster) & 0x1F)))
+
+#define FAT_MARK_CLUSTER_ALLOCATED(_Bitmap, _Cluster) \
+    ((_Bitmap)[(_Cluster) >> 5] &= ~(1 << ((_Cluster) & 0x1F)))
+
 //
 // ---------------------------------------------------------------- Definitions
 //
@@ -49,6 +62,13 @@ Module Name:
 
 #define FAT_CACHE_MINIMUM_WINDOW_SIZE _128KB
 
+//
+// Define the value stored in the FS information block when the free cluster
+// count is unknown.
+//
+
+#define FAT32_FREE_CLUSTERS_UNKNOWN 0xFFFFFFFF
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -71,6 +91,19 @@ FatpFatCacheWriteWindow (
     ULONG WindowIndex
     );
 
+KSTATUS
+FatpFatCacheWriteInformation (
+    PFAT_VOLUME Volume,
+    ULONG IoFlags
+    );
+
+ULONG
+FatpFatCacheMeasureFreeRun (
+    PFAT_VOLUME Volume,
+    ULONG Cluster,
+    ULONG Limit
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -225,6 +258,13 @@ Return Value:
     FatFreeNonPagedMemory(Volume->Device.DeviceToken,
                           Volume->FatCache.WindowBuffers);
 
+    if (Volume->FreeClusterBitmap != NULL) {
+        FatFreeNonPagedMemory(Volume->Device.DeviceToken,
+                              Volume->FreeClusterBitmap);
+
+        Volume->FreeClusterBitmap = NULL;
+    }
+
     return;
 }
 
@@ -584,6 +624,42 @@ Return Value:
         ((PULONG)FatWindow)[WindowOffset] = NewValue;
     }
 
+    //
+    // Keep the free cluster bitmap and count in sync with the FAT.
+    //
+
+    if ((Original == FAT_CLUSTER_FREE) != (NewValue == FAT_CLUSTER_FREE)) {
+        Volume->Flags |= FAT_VOLUME_FLAG_INFORMATION_DIRTY;
+        if (Volume->FreeClusterBitmap != NULL) {
+            if (NewValue == FAT_CLUSTER_FREE) {
+                FAT_MARK_CLUSTER_FREE(Volume->FreeClusterBitmap, Cluster);
+                Volume->FreeClusterCount += 1;
+
+            } else {
+
+                ASSERT(Volume->FreeClusterCount != 0);
+
+                FAT_MARK_CLUSTER_ALLOCATED(Volume->FreeClusterBitmap,
+                                           Cluster);
+
+                Volume->FreeClusterCount -= 1;
+            }
+        }
+    }
+
+    //
+    // Changing or removing an existing link invalidates any extent maps that
+    // may have recorded it. Extending the end of a chain does not.
+    //
+
+    if ((Original != FAT_CLUSTER_FREE) &&
+        ((Original < Volume->ClusterBad) ||
+         (NewValue < FAT_CLUSTER_BEGIN) ||
+         (NewValue >= Volume->ClusterBad))) {
+
+        Volume->ChainGeneration += 1;
+    }
+
     //
     // Mark the region in the window that's dirty.
     //
@@ -683,9 +759,238 @@ Return Value:
         FatCache->DirtyEnd = 0;
     }
 
+    //
+    // Write the free count out once for the whole batch of changes, rather
+    // than once per cluster.
+    //
+
+    if ((Volume->Flags & FAT_VOLUME_FLAG_INFORMATION_DIRTY) != 0) {
+        Status = FatpFatCacheWriteInformation(Volume, IoFlags);
+        if (!KSUCCESS(Status)) {
+            TotalStatus = Status;
+        }
+    }
+
     return TotalStatus;
 }
 
+KSTATUS
+FatpFatCacheCreateFreeBitmap (
+    PFAT_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine builds the free cluster bitmap by reading the entire FAT.
+    This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PULONG Bitmap;
+    ULONG BitmapSize;
+    ULONG Cluster;
+    ULONG ClusterCount;
+    ULONG FreeCount;
+    KSTATUS Status;
+    ULONG Value;
+    PVOID Window;
+    ULONG WindowOffset;
+    ULONG WindowSize;
+
+    ASSERT(Volume->FreeClusterBitmap == NULL);
+
+    ClusterCount = Volume->ClusterCount;
+    BitmapSize = ALIGN_RANGE_UP(ClusterCount, 32) / 8;
+    Bitmap = FatAllocateNonPagedMemory(Volume->Device.DeviceToken, BitmapSize);
+    if (Bitmap == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateFreeBitmapEnd;
+    }
+
+    RtlZeroMemory(Bitmap, BitmapSize);
+
+    //
+    // Walk the FAT a window at a time. FAT12 always fits in a single window.
+    //
+
+    FreeCount = 0;
+    Window = NULL;
+    WindowOffset = 0;
+    WindowSize = FAT_WINDOW_INDEX_TO_CLUSTER(Volume, 1);
+    for (Cluster = FAT_CLUSTER_BEGIN; Cluster < ClusterCount; Cluster += 1) {
+        if ((Window == NULL) || (WindowOffset >= WindowSize)) {
+            Status = FatpFatCacheGetFatWindow(Volume,
+                                              TRUE,
+                                              Cluster,
+                                              &Window,
+                                              &WindowOffset);
+
+            if (!KSUCCESS(Status)) {
+                goto CreateFreeBitmapEnd;
+            }
+        }
+
+        if (Volume->Format == Fat12Format) {
+            Value = FAT12_READ_CLUSTER(Window, Cluster);
+
+        } else if (Volume->Format == Fat16Format) {
+            Value = ((PUSHORT)Window)[WindowOffset];
+
+        } else {
+            Value = ((PULONG)Window)[WindowOffset];
+        }
+
+        if (Value == FAT_CLUSTER_FREE) {
+            FAT_MARK_CLUSTER_FREE(Bitmap, Cluster);
+            FreeCount += 1;
+        }
+
+        WindowOffset += 1;
+    }
+
+    Volume->FreeClusterBitmap = Bitmap;
+    Volume->FreeClusterCount = FreeCount;
+    Bitmap = NULL;
+    Status = STATUS_SUCCESS;
+
+CreateFreeBitmapEnd:
+    if (Bitmap != NULL) {
+        FatFreeNonPagedMemory(Volume->Device.DeviceToken, Bitmap);
+    }
+
+    return Status;
+}
+
+ULONG
+FatpFatCacheFindFreeClusters (
+    PFAT_VOLUME Volume,
+    ULONG Hint,
+    ULONG DesiredCount,
+    PULONG FirstCluster
+    )
+
+/*++
+
+Routine Description:
+
+    This routine searches the free cluster bitmap for a run of free clusters.
+    It returns the first run at or after the hint (wrapping around) that is at
+    least the desired length, or the longest run seen if the search gives up
+    first. This routine assumes the volume lock is held and the bitmap exists.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Hint - Supplies the cluster to start searching from.
+
+    DesiredCount - Supplies the desired length of the run.
+
+    FirstCluster - Supplies a pointer where the first cluster of the run will
+        be returned.
+
+Return Value:
+
+    Returns the length of the run found, capped at the desired count.
+
+    0 if there are no free clusters.
+
+--*/
+
+{
+
+    PULONG Bitmap;
+    ULONG BestCount;
+    ULONG BestStart;
+    ULONG Cluster;
+    ULONG ClusterCount;
+    ULONG RunCount;
+    ULONG Searched;
+    ULONG Word;
+
+    ASSERT(Volume->FreeClusterBitmap != NULL);
+    ASSERT(DesiredCount != 0);
+
+    Bitmap = Volume->FreeClusterBitmap;
+    ClusterCount = Volume->ClusterCount;
+    BestCount = 0;
+    BestStart = 0;
+    if (Volume->FreeClusterCount == 0) {
+        goto FindFreeClustersEnd;
+    }
+
+    if ((Hint < FAT_CLUSTER_BEGIN) || (Hint >= ClusterCount)) {
+        Hint = FAT_CLUSTER_BEGIN;
+    }
+
+    //
+    // Scan the whole bitmap once, starting at the hint and wrapping around.
+    // Skip fully allocated words at a time. Once something free is found,
+    // only look so much further for a better run.
+    //
+
+    Cluster = Hint;
+    Searched = 0;
+    while (Searched < ClusterCount) {
+        if (Cluster >= ClusterCount) {
+            Cluster = FAT_CLUSTER_BEGIN;
+        }
+
+        if (((Cluster & 0x1F) == 0) && ((Cluster + 32) <= ClusterCount)) {
+            Word = Bitmap[Cluster >> 5];
+            if (Word == 0) {
+                Cluster += 32;
+                Searched += 32;
+                continue;
+            }
+        }
+
+        if (FAT_IS_CLUSTER_FREE(Bitmap, Cluster) == FALSE) {
+            Cluster += 1;
+            Searched += 1;
+            continue;
+        }
+
+        RunCount = FatpFatCacheMeasureFreeRun(Volume, Cluster, DesiredCount);
+        if (RunCount > BestCount) {
+            BestCount = RunCount;
+            BestStart = Cluster;
+            if (BestCount >= DesiredCount) {
+                break;
+            }
+
+        //
+        // Give up looking for a long enough run eventually, and take the best
+        // one seen.
+        //
+
+        } else if ((BestCount != 0) &&
+                   (Searched >= FAT_FREE_RUN_SEARCH_LIMIT)) {
+
+            break;
+        }
+
+        Cluster += RunCount;
+        Searched += RunCount;
+    }
+
+FindFreeClustersEnd:
+    *FirstCluster = BestStart;
+    return BestCount;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -892,3 +1197,166 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+FatpFatCacheWriteInformation (
+    PFAT_VOLUME Volume,
+    ULONG IoFlags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine updates the free cluster count and last allocated cluster in
+    the FS information block. This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    IoFlags - Supplies flags regarding the I/O operation. See IO_FLAG_*
+        definitions.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PFAT32_INFORMATION_SECTOR Information;
+    ULONGLONG InformationBlock;
+    PFAT_IO_BUFFER InformationIoBuffer;
+    KSTATUS Status;
+
+    InformationIoBuffer = NULL;
+    if ((FatMaintainFreeClusterCount == FALSE) ||
+        (Volume->InformationByteOffset == 0)) {
+
+        Status = STATUS_SUCCESS;
+        goto FatCacheWriteInformationEnd;
+    }
+
+    InformationIoBuffer = FatAllocateIoBuffer(Volume->Device.DeviceToken,
+                                              Volume->Device.BlockSize);
+
+    if (InformationIoBuffer == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto FatCacheWriteInformationEnd;
+    }
+
+    IoFlags |= IO_FLAG_FS_DATA | IO_FLAG_FS_METADATA;
+    InformationBlock = Volume->InformationByteOffset >> Volume->BlockShift;
+    Status = FatReadDevice(Volume->Device.DeviceToken,
+                           InformationBlock,
+                           1,
+                           IoFlags,
+                           NULL,
+                           InformationIoBuffer);
+
+    if (!KSUCCESS(Status)) {
+        goto FatCacheWriteInformationEnd;
+    }
+
+    Information = FatMapIoBuffer(InformationIoBuffer);
+    if (Information == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto FatCacheWriteInformationEnd;
+    }
+
+    Information->LastClusterAllocated = Volume->ClusterSearchStart;
+    if (Volume->FreeClusterBitmap != NULL) {
+        Information->FreeClusters = Volume->FreeClusterCount;
+
+    } else {
+        Information->FreeClusters = FAT32_FREE_CLUSTERS_UNKNOWN;
+    }
+
+    Status = FatWriteDevice(Volume->Device.DeviceToken,
+                            InformationBlock,
+                            1,
+                            IoFlags,
+                            NULL,
+                            InformationIoBuffer);
+
+    if (!KSUCCESS(Status)) {
+        goto FatCacheWriteInformationEnd;
+    }
+
+FatCacheWriteInformationEnd:
+    if (KSUCCESS(Status)) {
+        Volume->Flags &= ~FAT_VOLUME_FLAG_INFORMATION_DIRTY;
+    }
+
+    if (InformationIoBuffer != NULL) {
+        FatFreeIoBuffer(InformationIoBuffer);
+    }
+
+    return Status;
+}
+
+ULONG
+FatpFatCacheMeasureFreeRun (
+    PFAT_VOLUME Volume,
+    ULONG Cluster,
+    ULONG Limit
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines how many free clusters in a row start at the given
+    cluster.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Cluster - Supplies the first cluster of the run, which must be free.
+
+    Limit - Supplies the length at which to stop counting.
+
+Return Value:
+
+    Returns the length of the run, up to the limit.
+
+--*/
+
+{
+
+    PULONG Bitmap;
+    ULONG ClusterCount;
+    ULONG RunCount;
+
+    Bitmap = Volume->FreeClusterBitmap;
+    ClusterCount = Volume->ClusterCount;
+    RunCount = 0;
+    while ((RunCount < Limit) && (Cluster < ClusterCount)) {
+
+        //
+        // Take a whole word at a time if it is entirely free.
+        //
+
+        if (((Cluster & 0x1F) == 0) &&
+            ((Cluster + 32) <= ClusterCount) &&
+            ((Limit - RunCount) >= 32) &&
+            (Bitmap[Cluster >> 5] == MAX_ULONG)) {
+
+            RunCount += 32;
+            Cluster += 32;
+            continue;
+        }
+
+        if (FAT_IS_CLUSTER_FREE(Bitmap, Cluster) == FALSE) {
+            break;
+        }
+
+        RunCount += 1;
+        Cluster += 1;
+    }
+
+    return RunCount;
+}
+
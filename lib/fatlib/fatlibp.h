@@ -121,6 +121,31 @@ Module Name:
 //
 
 #define FAT_VOLUME_FLAG_COMPATIBILITY_MODE 0x00000001
+#define FAT_VOLUME_FLAG_INFORMATION_DIRTY  0x00000002
+
+//
+// Define how many clusters the allocator will search for a free run long
+// enough to satisfy a request before settling for the longest run it saw.
+//
+
+#define FAT_FREE_RUN_SEARCH_LIMIT 0x10000
+
+//
+// Define the sizing of a file's extent map. Past the maximum, lookups beyond
+// the end of the map fall back to following the cluster chain.
+//
+
+#define FAT_EXTENT_MAP_INITIAL_CAPACITY 8
+#define FAT_EXTENT_MAP_MAX_EXTENTS 4096
+
+//
+// Define the number of entries a lookup must scan through before the
+// directory gets a name index, and the number of directories per volume that
+// keep one.
+//
+
+#define FAT_DIRECTORY_INDEX_THRESHOLD 256
+#define FAT_DIRECTORY_INDEX_MAX_COUNT 32
 
 //
 // ------------------------------------------------------ Data Type Definitions
@@ -265,6 +290,29 @@ Structure Description:
     FatCache - Stores the File Allocation Table cache. This is used for cluster
         allocation and next cluster lookup during seek, read, and write.
 
+    FreeClusterBitmap - Stores an optional pointer to a bitmap with a bit set
+        for every free cluster. It is built from the FAT the first time a
+        cluster is allocated, and kept in sync by every write to the FAT
+        cache. If it could not be allocated, the allocator falls back to
+        scanning the FAT.
+
+    FreeClusterCount - Stores the number of free clusters on the volume. This
+        is only valid if the free cluster bitmap exists.
+
+    ChainGeneration - Stores a counter that is incremented whenever an
+        existing link in a cluster chain is changed or removed. Extending the
+        end of a chain does not count. File extent maps built under an older
+        generation are discarded.
+
+    DirectoryIndexTree - Stores the tree of name indices for large
+        directories, keyed by the directory's first cluster. This is protected
+        by the volume lock.
+
+    DirectoryIndexList - Stores the list of directory indices, from most to
+        least recently used. This is protected by the volume lock.
+
+    DirectoryIndexCount - Stores the number of directory indices on the tree.
+
 --*/
 
 typedef struct _FAT_VOLUME {
@@ -292,10 +340,69 @@ typedef struct _FAT_VOLUME {
     PVOID Lock;
     RED_BLACK_TREE FileMappingTree;
     FAT_CACHE FatCache;
+    PULONG FreeClusterBitmap;
+    ULONG FreeClusterCount;
+    ULONG ChainGeneration;
+    RED_BLACK_TREE DirectoryIndexTree;
+    LIST_ENTRY DirectoryIndexList;
+    ULONG DirectoryIndexCount;
 } FAT_VOLUME, *PFAT_VOLUME;
 
 /*++
 
+Structure Description:
+
+    This structure describes a run of contiguous clusters in a file.
+
+Members:
+
+    FileCluster - Stores the index of the first cluster of the run within the
+        file.
+
+    Cluster - Stores the volume cluster number where the run begins.
+
+    Count - Stores the number of clusters in the run.
+
+--*/
+
+typedef struct _FAT_EXTENT {
+    ULONG FileCluster;
+    ULONG Cluster;
+    ULONG Count;
+} FAT_EXTENT, *PFAT_EXTENT;
+
+/*++
+
+Structure Description:
+
+    This structure stores the cached layout of the beginning of a file's
+    cluster chain. It is built incrementally as the file is accessed.
+
+Members:
+
+    Lock - Stores a pointer to the lock synchronizing access to the map.
+
+    Extents - Stores an array of extents, sorted by file cluster. They cover
+        the file from its first cluster without gaps.
+
+    Count - Stores the number of valid extents in the array.
+
+    Capacity - Stores the number of extents the array can hold.
+
+    Generation - Stores the volume chain generation the map was built under.
+
+--*/
+
+typedef struct _FAT_EXTENT_MAP {
+    PVOID Lock;
+    PFAT_EXTENT Extents;
+    ULONG Count;
+    ULONG Capacity;
+    ULONG Generation;
+} FAT_EXTENT_MAP, *PFAT_EXTENT_MAP;
+
+/*++
+
 Structure Description:
 
     This structure defines file system state associated with an open file.
@@ -325,6 +432,10 @@ Structure Description:
         out the maximum theoretical file size of 4GB. The first value is file
         offset 0, and is always filled in.
 
+    ExtentMap - Stores the map of contiguous cluster runs in the file, used to
+        seek without following the cluster chain. This is not used for page
+        files or the FAT12/16 root directory.
+
 --*/
 
 typedef struct _FAT_FILE {
@@ -334,6 +445,7 @@ typedef struct _FAT_FILE {
     PVOID ScratchIoBufferLock;
     PFAT_IO_BUFFER ScratchIoBuffer;
     ULONG SeekTable[FAT_SEEK_TABLE_SIZE];
+    FAT_EXTENT_MAP ExtentMap;
 } FAT_FILE, *PFAT_FILE;
 
 /*++
@@ -414,6 +526,13 @@ typedef struct _FAT_ENCODED_PROPERTIES {
 
 extern BOOL FatDisableEncodedProperties;
 
+//
+// Set this to TRUE to maintain the count of free clusters in the FAT FS
+// information block.
+//
+
+extern BOOL FatMaintainFreeClusterCount;
+
 //
 // -------------------------------------------------------- Function Prototypes
 //
@@ -665,6 +784,56 @@ Return Value:
 
 --*/
 
+KSTATUS
+FatpAllocateClusters (
+    PFAT_VOLUME Volume,
+    ULONG PreviousCluster,
+    ULONG DesiredCount,
+    PULONG NewCluster,
+    PULONG AllocatedCount,
+    BOOL Flush
+    );
+
+/*++
+
+Routine Description:
+
+    This routine allocates a run of contiguous free clusters, chains them
+    together, and chains the first one so that the specified previous cluster
+    points to it. If no free run is long enough, a shorter run is allocated,
+    and the caller must come back for the rest.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume.
+
+    PreviousCluster - Supplies the cluster that should point to the first newly
+        allocated cluster. Specify FAT32_CLUSTER_END if no previous cluster
+        should be updated.
+
+    DesiredCount - Supplies the number of clusters the caller would like.
+
+    NewCluster - Supplies a pointer that will receive the first new cluster
+        number.
+
+    AllocatedCount - Supplies a pointer that will receive the number of
+        clusters allocated. This is between one and the desired count on
+        success.
+
+    Flush - Supplies a boolean indicating if the FAT cache should be flushed.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if an invalid cluster was supplied.
+
+    STATUS_VOLUME_FULL if no free clusters exist.
+
+    Other error codes on device I/O errors.
+
+--*/
+
 KSTATUS
 FatpFreeClusterChain (
     PFAT_VOLUME Volume,
@@ -1326,6 +1495,94 @@ Return Value:
 
 --*/
 
+//
+// File extent map functions.
+//
+
+KSTATUS
+FatpInitializeExtentMap (
+    PFAT_FILE File
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes the extent map of a newly opened file.
+
+Arguments:
+
+    File - Supplies a pointer to the file.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VOID
+FatpDestroyExtentMap (
+    PFAT_FILE File
+    );
+
+/*++
+
+Routine Description:
+
+    This routine tears down a file's extent map.
+
+Arguments:
+
+    File - Supplies a pointer to the file.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+FatpLookupFileExtent (
+    PFAT_FILE File,
+    ULONG FileCluster,
+    PFAT_EXTENT Extent
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds the run of contiguous clusters containing the given
+    cluster of a file, following and recording the cluster chain as far as
+    needed.
+
+Arguments:
+
+    File - Supplies a pointer to the file.
+
+    FileCluster - Supplies the index of the cluster within the file.
+
+    Extent - Supplies a pointer where the extent containing the given file
+        cluster will be returned. If the file ends before the given cluster,
+        the file's last extent is returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_END_OF_FILE if the file ends before the given cluster.
+
+    STATUS_NOT_SUPPORTED if the file does not use an extent map.
+
+    STATUS_INSUFFICIENT_RESOURCES if the map could not grow to cover the
+        given cluster. The caller should follow the cluster chain itself.
+
+    STATUS_FILE_CORRUPT if the cluster chain is longer than the volume.
+
+    Other error codes on device I/O errors.
+
+--*/
+
 //
 // File Allocation Table cache support functions.
 //
@@ -1510,8 +1767,9 @@ FatpFatCacheFlush (
 
 Routine Description:
 
-    This routine flushes the FATs down to the disk. This routine assumes the
-    volume lock is already held.
+    This routine flushes the FATs down to the disk, along with the FS
+    information block if the free cluster count changed. This routine assumes
+    the volume lock is already held.
 
 Arguments:
 
@@ -1525,3 +1783,298 @@ Return Value:
     Status code.
 
 --*/
+
+KSTATUS
+FatpFatCacheCreateFreeBitmap (
+    PFAT_VOLUME Volume
+    );
+
+/*++
+
+Routine Description:
+
+    This routine builds the free cluster bitmap by reading the entire FAT.
+    This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+ULONG
+FatpFatCacheFindFreeClusters (
+    PFAT_VOLUME Volume,
+    ULONG Hint,
+    ULONG DesiredCount,
+    PULONG FirstCluster
+    );
+
+/*++
+
+Routine Description:
+
+    This routine searches the free cluster bitmap for a run of free clusters.
+    It returns the first run at or after the hint (wrapping around) that is at
+    least the desired length, or the longest run seen if the search gives up
+    first. This routine assumes the volume lock is held and the bitmap exists.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Hint - Supplies the cluster to start searching from.
+
+    DesiredCount - Supplies the desired length of the run.
+
+    FirstCluster - Supplies a pointer where the first cluster of the run will
+        be returned.
+
+Return Value:
+
+    Returns the length of the run found, capped at the desired count.
+
+    0 if there are no free clusters.
+
+--*/
+
+//
+// Directory index support functions.
+//
+
+VOID
+FatpInitializeDirectoryIndexTree (
+    PFAT_VOLUME Volume
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes the tree of directory indices for a volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+FatpDestroyDirectoryIndexTree (
+    PFAT_VOLUME Volume
+    );
+
+/*++
+
+Routine Description:
+
+    This routine destroys all the directory indices for a volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+FatpBuildDirectoryIndex (
+    PFAT_DIRECTORY_CONTEXT Directory
+    );
+
+/*++
+
+Routine Description:
+
+    This routine scans a directory and builds a name index for it. Failures
+    are not reported, the directory just goes without an index.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+FatpDiscardDirectoryIndex (
+    PFAT_VOLUME Volume,
+    ULONG Cluster
+    );
+
+/*++
+
+Routine Description:
+
+    This routine throws away the name index for a directory, if it has one.
+    This is used when the directory is deleted or the index may no longer
+    match the directory contents.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Cluster - Supplies the first cluster of the directory.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+FatpDirectoryIndexLookup (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    PCSTR Name,
+    ULONG NameLength,
+    PFAT_DIRECTORY_ENTRY Entry,
+    PULONGLONG EntryOffset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine looks up a name in a directory's name index.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+    Name - Supplies the name to look up.
+
+    NameLength - Supplies the size of the name buffer in bytes, including the
+        null terminator.
+
+    Entry - Supplies a pointer where the directory entry will be returned.
+
+    EntryOffset - Supplies a pointer where the offset of the short directory
+        entry will be returned.
+
+Return Value:
+
+    STATUS_SUCCESS if the name was found.
+
+    STATUS_PATH_NOT_FOUND if the directory does not contain the name.
+
+    STATUS_NOT_FOUND if the directory has no usable index. The caller must
+    scan the directory.
+
+--*/
+
+KSTATUS
+FatpDirectoryIndexFindFreeEntries (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    ULONG EntryCount,
+    PULONGLONG EntryOffset,
+    PBOOL AtEnd
+    );
+
+/*++
+
+Routine Description:
+
+    This routine uses a directory's index to find the first run of erased
+    entries long enough for a new name, or failing that the end of the
+    directory. On success the directory is positioned at the returned offset.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+    EntryCount - Supplies the number of entries needed.
+
+    EntryOffset - Supplies a pointer where the offset of the first entry to
+        write will be returned.
+
+    AtEnd - Supplies a pointer where a boolean will be returned indicating
+        whether the entries go at the end of the directory, in which case a
+        new end entry needs to be written after them.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_FOUND if the directory has no usable index. The caller must
+    scan the directory.
+
+--*/
+
+VOID
+FatpDirectoryIndexAddName (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    PCSTR Name,
+    ULONG NameLength,
+    ULONGLONG EntryOffset,
+    ULONG EntryCount,
+    BOOL AtEnd
+    );
+
+/*++
+
+Routine Description:
+
+    This routine records a newly written name in the directory's index, if it
+    has one.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+    Name - Supplies the name that was added.
+
+    NameLength - Supplies the size of the name buffer in bytes, including the
+        null terminator.
+
+    EntryOffset - Supplies the offset of the first entry written for the name.
+
+    EntryCount - Supplies the number of entries written for the name.
+
+    AtEnd - Supplies a boolean indicating if the entries were written at the
+        end of the directory, moving the end entry.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+FatpDirectoryIndexRemoveName (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    ULONGLONG EntryOffset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine removes an erased name from the directory's index, if it has
+    one, and records which of its entries are now free.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+    EntryOffset - Supplies the offset of the short entry that was erased.
+
+Return Value:
+
+    None.
+
+--*/
+
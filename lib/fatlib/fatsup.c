@@ -74,6 +74,30 @@ FatpCreateDirectoryEntriesForFile (
     PULONG EntryCount
     );
 
+KSTATUS
+FatpFindFreeCluster (
+    PFAT_VOLUME Volume,
+    PULONG Cluster
+    );
+
+KSTATUS
+FatpScanDirectoryForEntry (
+    PFAT_VOLUME Volume,
+    PFAT_DIRECTORY_CONTEXT Directory,
+    PCSTR Name,
+    ULONG NameLength,
+    PFAT_DIRECTORY_ENTRY Entry,
+    PULONGLONG EntryOffset
+    );
+
+KSTATUS
+FatpFindFreeDirectoryEntries (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    ULONG EntryCount,
+    PULONGLONG EntryOffset,
+    PBOOL WriteEndEntry
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -95,8 +119,9 @@ BOOL FatCompatibilityMode = FALSE;
 
 //
 // Set this to TRUE to maintain the count of free clusters in the FAT FS
-// information block. Most OSes don't trust or maintain this value anymore, and
-// keeping it up to date generates a lot of extra I/O
+// information block. Most OSes don't trust or maintain this value anymore.
+// The count comes from the free cluster bitmap and is written once per FAT
+// flush.
 //
 
 BOOL FatMaintainFreeClusterCount = FALSE;
@@ -147,116 +172,69 @@ Return Value:
 {
 
     ULONG Cluster;
-    ULONG EntriesRead;
     BOOL IsDotEntry;
     ULONGLONG Offset;
-    PSTR PotentialName;
-    ULONG PotentialNameBufferSize;
-    ULONG PotentialNameSize;
     KSTATUS Status;
 
-    Offset = DIRECTORY_CONTENTS_OFFSET;
-    PotentialName = NULL;
+    Offset = 0;
     if (NameLength <= 1) {
         return STATUS_PATH_NOT_FOUND;
     }
 
     //
-    // Seek to the beginning of the directory.
+    // Large directories keep an index of their names. If this one has an
+    // index, use it rather than scanning.
     //
 
-    Status = FatpDirectorySeek(Directory, Offset);
-    if (!KSUCCESS(Status)) {
-        goto LookupDirectoryEntryEnd;
-    }
-
-    //
-    // Allocate a buffer for the name.
-    //
+    Status = FatpDirectoryIndexLookup(Directory,
+                                      Name,
+                                      NameLength,
+                                      Entry,
+                                      &Offset);
 
-    PotentialNameBufferSize = FAT_MAX_LONG_FILE_LENGTH + 1;
-    PotentialName = FatAllocatePagedMemory(Volume->Device.DeviceToken,
-                                           PotentialNameBufferSize);
+    if (Status == STATUS_NOT_FOUND) {
+        Status = FatpScanDirectoryForEntry(Volume,
+                                           Directory,
+                                           Name,
+                                           NameLength,
+                                           Entry,
+                                           &Offset);
+    }
 
-    if (PotentialName == NULL) {
-        Status = STATUS_INSUFFICIENT_RESOURCES;
+    if (!KSUCCESS(Status)) {
         goto LookupDirectoryEntryEnd;
     }
 
     //
-    // Loop reading directory entries until a matching one is found or the end
-    // is reached.
+    // Set the mapping between the file and the directory, except for the . and
+    // .. entries. Also, empty files may have a cluster ID of 0, don't save
+    // those either.
     //
 
-    while (TRUE) {
-        PotentialNameSize = PotentialNameBufferSize;
-        Status = FatpReadNextDirectoryEntry(Directory,
-                                            NULL,
-                                            PotentialName,
-                                            &PotentialNameSize,
-                                            Entry,
-                                            &EntriesRead);
-
-        if (!KSUCCESS(Status)) {
-            if (Status == STATUS_END_OF_FILE) {
-                Status = STATUS_PATH_NOT_FOUND;
-            }
-
-            goto LookupDirectoryEntryEnd;
-        }
-
-        Offset += EntriesRead;
-        if (PotentialNameSize > NameLength) {
-            continue;
-        }
-
-        if (RtlAreStringsEqual(Name, PotentialName, NameLength - 1) != FALSE) {
-
-            ASSERT(Offset != 0);
-
-            Offset -= 1;
-
-            //
-            // Set the mapping between the file and the directory, except for
-            // the . and .. entries. Also, empty files may have a cluster ID of
-            // 0, don't save those either.
-            //
-
-            IsDotEntry = FALSE;
-            if ((Name[0] == '.') &&
-                ((Name[1] == '\0') ||
-                 ((Name[1] == '.') && (Name[2] == '\0')))) {
-
-                IsDotEntry = TRUE;
-            }
+    IsDotEntry = FALSE;
+    if ((Name[0] == '.') &&
+        ((Name[1] == '\0') || ((Name[1] == '.') && (Name[2] == '\0')))) {
 
-            if (IsDotEntry == FALSE) {
-                Cluster = (Entry->ClusterHigh << 16) | Entry->ClusterLow;
-                if ((Cluster >= FAT_CLUSTER_BEGIN) &&
-                    (Cluster < Volume->ClusterBad)) {
+        IsDotEntry = TRUE;
+    }
 
-                    Status = FatpSetFileMapping(Volume,
-                                                Cluster,
-                                                Directory->File->SeekTable[0],
-                                                Offset);
+    if (IsDotEntry == FALSE) {
+        Cluster = (Entry->ClusterHigh << 16) | Entry->ClusterLow;
+        if ((Cluster >= FAT_CLUSTER_BEGIN) && (Cluster < Volume->ClusterBad)) {
+            Status = FatpSetFileMapping(Volume,
+                                        Cluster,
+                                        Directory->File->SeekTable[0],
+                                        Offset);
 
-                    if (!KSUCCESS(Status)) {
-                        goto LookupDirectoryEntryEnd;
-                    }
-                }
+            if (!KSUCCESS(Status)) {
+                goto LookupDirectoryEntryEnd;
             }
-
-            break;
         }
     }
 
     Status = STATUS_SUCCESS;
 
 LookupDirectoryEntryEnd:
-    if (PotentialName != NULL) {
-        FatFreePagedMemory(Volume->Device.DeviceToken, PotentialName);
-    }
-
     if (!KSUCCESS(Status)) {
         Offset = 0;
     }
@@ -531,17 +509,13 @@ Return Value:
     FAT_DIRECTORY_CONTEXT DirectoryContext;
     BOOL DirectoryContextInitialized;
     FAT_DIRECTORY_ENTRY DirectoryEntry;
-    ULONG EntriesRead;
     ULONG EntriesWritten;
     ULONG EntryCount;
     ULONGLONG EntryOffset;
     FAT_DIRECTORY_ENTRY ExistingEntry;
     ULONG FirstCluster;
     PFAT_DIRECTORY_ENTRY NewEntries;
-    ULONGLONG Offset;
-    ULONGLONG PotentialOffset;
     BOOL SetMapping;
-    ULONG SpanCount;
     KSTATUS Status;
     BOOL WriteEndEntry;
 
@@ -612,115 +586,18 @@ Return Value:
     ASSERT(EntryCount != 0);
 
     //
-    // Reset to the beginning of the directory file.
+    // Find a place for the entries and seek to it.
     //
 
-    Offset = DIRECTORY_CONTENTS_OFFSET;
-    Status = FatpDirectorySeek(&DirectoryContext, Offset);
+    Status = FatpFindFreeDirectoryEntries(&DirectoryContext,
+                                          EntryCount,
+                                          &EntryOffset,
+                                          &WriteEndEntry);
+
     if (!KSUCCESS(Status)) {
         goto CreateDirectoryEntryEnd;
     }
 
-    //
-    // Look for either enough deleted entries or the ending entry.
-    //
-
-    EntryOffset = -1;
-    PotentialOffset = -1;
-    SpanCount = 0;
-    WriteEndEntry = FALSE;
-    while (TRUE) {
-        Status = FatpReadDirectory(&DirectoryContext,
-                                   &DirectoryEntry,
-                                   1,
-                                   &EntriesRead);
-
-        if (Status == STATUS_END_OF_FILE) {
-            WriteEndEntry = TRUE;
-            break;
-
-        } else if (!KSUCCESS(Status)) {
-            goto CreateDirectoryEntryEnd;
-        }
-
-        //
-        // If this is the root directory and the end of it was reached, there's
-        // no space in the root directory.
-        //
-
-        if (EntriesRead == 0) {
-            Status = STATUS_VOLUME_FULL;
-            goto CreateDirectoryEntryEnd;
-        }
-
-        ASSERT(EntriesRead == 1);
-
-        //
-        // If the end is found, use it.
-        //
-
-        if (DirectoryEntry.DosName[0] == FAT_DIRECTORY_ENTRY_END) {
-            EntryOffset = Offset;
-            WriteEndEntry = TRUE;
-            break;
-        }
-
-        //
-        // If an erased entry was found, that's also perfect.
-        //
-
-        if (DirectoryEntry.DosName[0] == FAT_DIRECTORY_ENTRY_ERASED) {
-            if (PotentialOffset == -1) {
-                PotentialOffset = Offset;
-                SpanCount = 1;
-
-            } else {
-                SpanCount += 1;
-            }
-
-            if (SpanCount >= EntryCount) {
-                EntryOffset = PotentialOffset;
-                break;
-            }
-
-        //
-        // This is a regular entry, so it breaks the span.
-        //
-
-        } else {
-            PotentialOffset = -1;
-            SpanCount = 0;
-        }
-
-        Offset += 1;
-    }
-
-    //
-    // Seek either to the desired entry or to the end. If no entry was found,
-    // the file pointer must already be at the end, so there's no need to seek.
-    //
-
-    if (EntryOffset != -1) {
-        Status = FatpDirectorySeek(&DirectoryContext, EntryOffset);
-        if (!KSUCCESS(Status)) {
-
-            ASSERT(Status != STATUS_END_OF_FILE);
-
-            goto CreateDirectoryEntryEnd;
-        }
-
-    //
-    // If an entry offset is not set, then this better have reached the end of
-    // the file.
-    //
-
-    } else {
-
-        ASSERT(Status == STATUS_END_OF_FILE);
-
-        EntryOffset = Offset;
-    }
-
     //
     // First create the mapping between the new file and the directory it came
     // from. This is done first because it is easy to roll back.
@@ -787,11 +664,25 @@ Return Value:
     }
 
     *DirectorySize = DirectoryContext.ClusterPosition.FileByteOffset;
+    FatpDirectoryIndexAddName(&DirectoryContext,
+                              FileName,
+                              FileNameLength,
+                              EntryOffset,
+                              EntryCount,
+                              WriteEndEntry);
+
     Status = STATUS_SUCCESS;
 
 CreateDirectoryEntryEnd:
     if (!KSUCCESS(Status) && (SetMapping != FALSE)) {
         FatpUnsetFileMapping(Volume, FirstCluster);
+
+        //
+        // Some of the entries may have made it out, so the directory's index
+        // can no longer be trusted.
+        //
+
+        FatpDiscardDirectoryIndex(Volume, (ULONG)DirectoryFileId);
     }
 
     if (DirectoryContextInitialized != FALSE) {
@@ -1319,33 +1210,84 @@ Return Value:
 
 {
 
-    ULONG AllocatedCluster;
-    ULONG BlockShift;
+    ULONG AllocatedCount;
+
+    return FatpAllocateClusters(Volume,
+                                PreviousCluster,
+                                1,
+                                NewCluster,
+                                &AllocatedCount,
+                                Flush);
+}
+
+KSTATUS
+FatpAllocateClusters (
+    PFAT_VOLUME Volume,
+    ULONG PreviousCluster,
+    ULONG DesiredCount,
+    PULONG NewCluster,
+    PULONG AllocatedCount,
+    BOOL Flush
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a run of contiguous free clusters, chains them
+    together, and chains the first one so that the specified previous cluster
+    points to it. If no free run is long enough, a shorter run is allocated,
+    and the caller must come back for the rest.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume.
+
+    PreviousCluster - Supplies the cluster that should point to the first newly
+        allocated cluster. Specify FAT32_CLUSTER_END if no previous cluster
+        should be updated.
+
+    DesiredCount - Supplies the number of clusters the caller would like.
+
+    NewCluster - Supplies a pointer that will receive the first new cluster
+        number.
+
+    AllocatedCount - Supplies a pointer that will receive the number of
+        clusters allocated. This is between one and the desired count on
+        success.
+
+    Flush - Supplies a boolean indicating if the FAT cache should be flushed.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if an invalid cluster was supplied.
+
+    STATUS_VOLUME_FULL if no free clusters exist.
+
+    Other error codes on device I/O errors.
+
+--*/
+
+{
+
     ULONG ClusterCount;
-    ULONG ClusterEnd;
-    ULONG CurrentCluster;
-    PFAT32_INFORMATION_SECTOR Information;
-    ULONGLONG InformationBlock;
-    PFAT_IO_BUFFER InformationIoBuffer;
-    ULONG IoFlags;
-    ULONG SearchStart;
+    ULONG FirstCluster;
+    ULONG Index;
+    ULONG NextCluster;
+    ULONG RunCount;
     KSTATUS Status;
-    ULONG Value;
-    PVOID Window;
-    PUSHORT Window16;
-    PULONG Window32;
-    ULONG WindowOffset;
-    ULONG WindowSize;
 
-    AllocatedCluster = FAT_CLUSTER_FREE;
-    BlockShift = Volume->BlockShift;
     ClusterCount = Volume->ClusterCount;
-    InformationIoBuffer = NULL;
-    IoFlags = IO_FLAG_FS_DATA | IO_FLAG_FS_METADATA;
+    FirstCluster = FAT_CLUSTER_FREE;
+    RunCount = 0;
 
     ASSERT((PreviousCluster >= Volume->ClusterBad) ||
            (PreviousCluster < ClusterCount));
 
+    ASSERT(DesiredCount != 0);
+
     if ((PreviousCluster < Volume->ClusterBad) &&
         (PreviousCluster >= ClusterCount)) {
 
@@ -1360,163 +1302,79 @@ Return Value:
     }
 
     //
-    // Search for a free block. Start just after the last allocated cluster.
+    // Build the free cluster bitmap the first time around. If there is not
+    // enough memory for it, fall back to searching the FAT one cluster at a
+    // time.
     //
 
-    CurrentCluster = Volume->ClusterSearchStart;
-    ClusterEnd = ClusterCount;
-    SearchStart = CurrentCluster;
-    CurrentCluster += 1;
-    WindowSize = FAT_WINDOW_INDEX_TO_CLUSTER(Volume, 1);
-    WindowOffset = MAX_ULONG;
-    while (CurrentCluster != SearchStart) {
+    if (Volume->FreeClusterBitmap == NULL) {
+        Status = FatpFatCacheCreateFreeBitmap(Volume);
+        if ((!KSUCCESS(Status)) && (Status != STATUS_INSUFFICIENT_RESOURCES)) {
+            goto AllocateClustersEnd;
+        }
+    }
 
-        //
-        // If this is the end of the FAT, wrap around to the beginning.
-        //
-
-        if (CurrentCluster >= ClusterEnd) {
-            CurrentCluster = FAT_CLUSTER_BEGIN;
-            WindowOffset = MAX_ULONG;
-            ClusterEnd = SearchStart;
-        }
-
-        //
-        // Read the next window if needed.
-        //
-
-        if (WindowOffset >= WindowSize) {
-            Status = FatpFatCacheGetFatWindow(Volume,
-                                              TRUE,
-                                              CurrentCluster,
-                                              &Window,
-                                              &WindowOffset);
-
-            if (!KSUCCESS(Status)) {
-                goto AllocateClusterEnd;
-            }
-        }
-
-        //
-        // Scan the whole window.
-        //
-
-        if (Volume->Format == Fat12Format) {
-            while (CurrentCluster < ClusterEnd) {
-                Value = FAT12_READ_CLUSTER(Window, CurrentCluster);
-                if (Value == FAT_CLUSTER_FREE) {
-                    break;
-                }
-
-                CurrentCluster += 1;
-            }
-
-        } else if (Volume->Format == Fat16Format) {
-            Window16 = Window;
-            while ((WindowOffset < WindowSize) &&
-                   (CurrentCluster < ClusterEnd) &&
-                   (Window16[WindowOffset] != FAT_CLUSTER_FREE)) {
-
-                WindowOffset += 1;
-                CurrentCluster += 1;
-            }
-
-        } else {
-            Window32 = Window;
-            while ((WindowOffset < WindowSize) &&
-                   (CurrentCluster < ClusterEnd) &&
-                   (Window32[WindowOffset] != FAT_CLUSTER_FREE)) {
-
-                WindowOffset += 1;
-                CurrentCluster += 1;
-            }
-        }
-
-        if ((WindowOffset >= WindowSize) || (CurrentCluster >= ClusterEnd)) {
-            continue;
-        }
+    //
+    // Search for a free run. Start just after the last allocated cluster so
+    // that a file growing in pieces stays contiguous.
+    //
 
-        Status = FatpFatCacheWriteClusterEntry(Volume,
-                                               CurrentCluster,
-                                               Volume->ClusterEnd,
-                                               NULL);
+    if (Volume->FreeClusterBitmap != NULL) {
+        RunCount = FatpFatCacheFindFreeClusters(Volume,
+                                                Volume->ClusterSearchStart + 1,
+                                                DesiredCount,
+                                                &FirstCluster);
 
+    } else {
+        Status = FatpFindFreeCluster(Volume, &FirstCluster);
         if (!KSUCCESS(Status)) {
-            goto AllocateClusterEnd;
+            goto AllocateClustersEnd;
         }
 
-        //
-        // Mark a cluster as allocated now that it's been written in stone.
-        //
-
-        AllocatedCluster = CurrentCluster;
-        break;
+        if (FirstCluster != FAT_CLUSTER_FREE) {
+            RunCount = 1;
+        }
     }
 
     //
     // If nothing was found, sadly return.
     //
 
-    if (AllocatedCluster == FAT_CLUSTER_FREE) {
+    if (RunCount == 0) {
         Status = STATUS_VOLUME_FULL;
-        goto AllocateClusterEnd;
+        goto AllocateClustersEnd;
     }
 
     //
-    // Update the FS information block saving the new free space and last block
-    // allocated.
+    // Chain the run together. If that fails partway through, free what was
+    // claimed.
     //
 
-    if ((FatMaintainFreeClusterCount != FALSE) &&
-        (Volume->InformationByteOffset != 0)) {
-
-        InformationIoBuffer = FatAllocateIoBuffer(Volume->Device.DeviceToken,
-                                                  Volume->Device.BlockSize);
-
-        if (InformationIoBuffer == NULL) {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto AllocateClusterEnd;
+    for (Index = 0; Index < RunCount; Index += 1) {
+        NextCluster = FirstCluster + Index + 1;
+        if (Index == RunCount - 1) {
+            NextCluster = Volume->ClusterEnd;
         }
 
-        InformationBlock = Volume->InformationByteOffset >> BlockShift;
-        Status = FatReadDevice(Volume->Device.DeviceToken,
-                               InformationBlock,
-                               1,
-                               IoFlags,
-                               NULL,
-                               InformationIoBuffer);
+        Status = FatpFatCacheWriteClusterEntry(Volume,
+                                               FirstCluster + Index,
+                                               NextCluster,
+                                               NULL);
 
         if (!KSUCCESS(Status)) {
-            goto AllocateClusterEnd;
-        }
-
-        Information = FatMapIoBuffer(InformationIoBuffer);
-        if (Information == NULL) {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto AllocateClusterEnd;
-        }
-
-        Information->LastClusterAllocated = AllocatedCluster;
-
-        ASSERT(Information->FreeClusters != 0);
-
-        if (Information->FreeClusters != 0) {
-            Information->FreeClusters -= 1;
-        }
-
-        Status = FatWriteDevice(Volume->Device.DeviceToken,
-                                InformationBlock,
-                                1,
-                                IoFlags,
-                                NULL,
-                                InformationIoBuffer);
+            while (Index != 0) {
+                Index -= 1;
+                FatpFatCacheWriteClusterEntry(Volume,
+                                              FirstCluster + Index,
+                                              FAT_CLUSTER_FREE,
+                                              NULL);
+            }
 
-        if (!KSUCCESS(Status)) {
-            goto AllocateClusterEnd;
+            goto AllocateClustersEnd;
         }
     }
 
-    Volume->ClusterSearchStart = AllocatedCluster;
+    Volume->ClusterSearchStart = FirstCluster + RunCount - 1;
 
     //
     // Lookup the previous block and update it.
@@ -1525,30 +1383,32 @@ Return Value:
     if ((PreviousCluster != 0) && (PreviousCluster < ClusterCount)) {
         Status = FatpFatCacheWriteClusterEntry(Volume,
                                                PreviousCluster,
-                                               AllocatedCluster,
+                                               FirstCluster,
                                                NULL);
 
         if (!KSUCCESS(Status)) {
-            goto AllocateClusterEnd;
+            goto AllocateClustersEnd;
         }
     }
 
     if (Flush != FALSE) {
         Status = FatpFatCacheFlush(Volume, 0);
         if (!KSUCCESS(Status)) {
-            goto AllocateClusterEnd;
+            goto AllocateClustersEnd;
         }
     }
 
     Status = STATUS_SUCCESS;
 
-AllocateClusterEnd:
+AllocateClustersEnd:
     FatReleaseLock(Volume->Lock);
-    if (InformationIoBuffer != NULL) {
-        FatFreeIoBuffer(InformationIoBuffer);
+    if (!KSUCCESS(Status)) {
+        FirstCluster = FAT_CLUSTER_FREE;
+        RunCount = 0;
     }
 
-    *NewCluster = AllocatedCluster;
+    *NewCluster = FirstCluster;
+    *AllocatedCount = RunCount;
     return Status;
 }
 
@@ -1583,17 +1443,10 @@ Return Value:
 {
 
     ULONG Cluster;
-    ULONG ClusterCount;
-    PFAT32_INFORMATION_SECTOR Information;
-    ULONGLONG InformationBlock;
-    PFAT_IO_BUFFER InformationIoBuffer;
-    ULONG IoFlags;
     ULONG NextCluster;
     KSTATUS Status;
     ULONG TotalClusters;
 
-    InformationIoBuffer = NULL;
-    IoFlags = IO_FLAG_FS_DATA | IO_FLAG_FS_METADATA;
     FatAcquireLock(Volume->Lock);
     TotalClusters = Volume->ClusterCount;
     if ((FirstCluster < FAT_CLUSTER_BEGIN) || (FirstCluster >= TotalClusters)) {
@@ -1601,7 +1454,6 @@ Return Value:
         goto FreeClusterChainEnd;
     }
 
-    ClusterCount = 0;
     Cluster = FirstCluster;
     while (TRUE) {
         if ((Cluster < FAT_CLUSTER_BEGIN) || (Cluster >= TotalClusters)) {
@@ -1641,7 +1493,6 @@ Return Value:
             goto FreeClusterChainEnd;
         }
 
-        ClusterCount += 1;
         if (NextCluster >= TotalClusters) {
             break;
         }
@@ -1649,68 +1500,18 @@ Return Value:
         Cluster = NextCluster;
     }
 
-    Status = FatpFatCacheFlush(Volume, 0);
-    if (!KSUCCESS(Status)) {
-        goto FreeClusterChainEnd;
-    }
-
     //
-    // Update the FS information block saving the new free space.
+    // Flushing the FAT also updates the free count in the FS information
+    // block.
     //
 
-    if ((FatMaintainFreeClusterCount != FALSE) &&
-        (Volume->InformationByteOffset != 0)) {
-
-        InformationIoBuffer = FatAllocateIoBuffer(Volume->Device.DeviceToken,
-                                                  Volume->Device.BlockSize);
-
-        if (InformationIoBuffer == NULL) {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto FreeClusterChainEnd;
-        }
-
-        InformationBlock = Volume->InformationByteOffset >> Volume->BlockShift;
-        Status = FatReadDevice(Volume->Device.DeviceToken,
-                               InformationBlock,
-                               1,
-                               IoFlags,
-                               Irp,
-                               InformationIoBuffer);
-
-        if (!KSUCCESS(Status)) {
-            goto FreeClusterChainEnd;
-        }
-
-        Information = FatMapIoBuffer(InformationIoBuffer);
-        if (Information == NULL) {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto FreeClusterChainEnd;
-        }
-
-        Information->LastClusterAllocated = Cluster;
-
-        ASSERT(Information->FreeClusters + ClusterCount >
-               Information->FreeClusters);
-
-        Information->FreeClusters += ClusterCount;
-        Status = FatWriteDevice(Volume->Device.DeviceToken,
-                                InformationBlock,
-                                1,
-                                IoFlags,
-                                Irp,
-                                InformationIoBuffer);
-
-        if (!KSUCCESS(Status)) {
-            goto FreeClusterChainEnd;
-        }
+    Status = FatpFatCacheFlush(Volume, 0);
+    if (!KSUCCESS(Status)) {
+        goto FreeClusterChainEnd;
     }
 
 FreeClusterChainEnd:
     FatReleaseLock(Volume->Lock);
-    if (InformationIoBuffer != NULL) {
-        FatFreeIoBuffer(InformationIoBuffer);
-    }
-
     return Status;
 }
 
@@ -2036,6 +1837,19 @@ Return Value:
         FatpUnsetFileMapping(Directory->File->Volume, Cluster);
     }
 
+    //
+    // Keep the directory's name index in step. A failure part way through
+    // leaves it unclear which entries were erased, so just drop the index.
+    //
+
+    if (KSUCCESS(Status)) {
+        FatpDirectoryIndexRemoveName(Directory, EntryOffset);
+
+    } else {
+        FatpDiscardDirectoryIndex(Directory->File->Volume,
+                                  Directory->File->SeekTable[0]);
+    }
+
     *EntryErased = LocalEntryErased;
     return Status;
 }
@@ -4059,3 +3873,434 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+FatpFindFreeCluster (
+    PFAT_VOLUME Volume,
+    PULONG Cluster
+    )
+
+/*++
+
+Routine Description:
+
+    This routine searches the FAT for a free cluster, starting just after the
+    last allocated cluster. It is used when there is no free cluster bitmap.
+    This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume.
+
+    Cluster - Supplies a pointer where the free cluster will be returned, or
+        FAT_CLUSTER_FREE if there are no free clusters.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG AllocatedCluster;
+    ULONG ClusterCount;
+    ULONG ClusterEnd;
+    ULONG CurrentCluster;
+    ULONG SearchStart;
+    KSTATUS Status;
+    ULONG Value;
+    PVOID Window;
+    PUSHORT Window16;
+    PULONG Window32;
+    ULONG WindowOffset;
+    ULONG WindowSize;
+
+    AllocatedCluster = FAT_CLUSTER_FREE;
+    ClusterCount = Volume->ClusterCount;
+    Status = STATUS_SUCCESS;
+
+    //
+    // Search for a free block. Start just after the last allocated cluster.
+    //
+
+    CurrentCluster = Volume->ClusterSearchStart;
+    ClusterEnd = ClusterCount;
+    SearchStart = CurrentCluster;
+    CurrentCluster += 1;
+    WindowSize = FAT_WINDOW_INDEX_TO_CLUSTER(Volume, 1);
+    WindowOffset = MAX_ULONG;
+    while (CurrentCluster != SearchStart) {
+
+        //
+        // If this is the end of the FAT, wrap around to the beginning.
+        //
+
+        if (CurrentCluster >= ClusterEnd) {
+            CurrentCluster = FAT_CLUSTER_BEGIN;
+            WindowOffset = MAX_ULONG;
+            ClusterEnd = SearchStart;
+        }
+
+        //
+        // Read the next window if needed.
+        //
+
+        if (WindowOffset >= WindowSize) {
+            Status = FatpFatCacheGetFatWindow(Volume,
+                                              TRUE,
+                                              CurrentCluster,
+                                              &Window,
+                                              &WindowOffset);
+
+            if (!KSUCCESS(Status)) {
+                goto FindFreeClusterEnd;
+            }
+        }
+
+        //
+        // Scan the whole window.
+        //
+
+        if (Volume->Format == Fat12Format) {
+            while (CurrentCluster < ClusterEnd) {
+                Value = FAT12_READ_CLUSTER(Window, CurrentCluster);
+                if (Value == FAT_CLUSTER_FREE) {
+                    break;
+                }
+
+                CurrentCluster += 1;
+            }
+
+        } else if (Volume->Format == Fat16Format) {
+            Window16 = Window;
+            while ((WindowOffset < WindowSize) &&
+                   (CurrentCluster < ClusterEnd) &&
+                   (Window16[WindowOffset] != FAT_CLUSTER_FREE)) {
+
+                WindowOffset += 1;
+                CurrentCluster += 1;
+            }
+
+        } else {
+            Window32 = Window;
+            while ((WindowOffset < WindowSize) &&
+                   (CurrentCluster < ClusterEnd) &&
+                   (Window32[WindowOffset] != FAT_CLUSTER_FREE)) {
+
+                WindowOffset += 1;
+                CurrentCluster += 1;
+            }
+        }
+
+        if ((WindowOffset >= WindowSize) || (CurrentCluster >= ClusterEnd)) {
+            continue;
+        }
+
+        AllocatedCluster = CurrentCluster;
+        break;
+    }
+
+FindFreeClusterEnd:
+    *Cluster = AllocatedCluster;
+    return Status;
+}
+
+KSTATUS
+FatpScanDirectoryForEntry (
+    PFAT_VOLUME Volume,
+    PFAT_DIRECTORY_CONTEXT Directory,
+    PCSTR Name,
+    ULONG NameLength,
+    PFAT_DIRECTORY_ENTRY Entry,
+    PULONGLONG EntryOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads through a directory from the beginning looking for the
+    given name. If the scan was long, the directory gets a name index so the
+    next lookup does not have to scan.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume.
+
+    Directory - Supplies a pointer to the directory context for the open file.
+
+    Name - Supplies the name of the file or directory to find.
+
+    NameLength - Supplies the size of the name buffer in bytes, including the
+        null terminator.
+
+    Entry - Supplies a pointer where the directory entry will be returned.
+
+    EntryOffset - Supplies a pointer where the offset of the short directory
+        entry will be returned.
+
+Return Value:
+
+    STATUS_SUCCESS if the name was found.
+
+    STATUS_PATH_NOT_FOUND if the directory does not contain the name.
+
+    Other error codes on failure.
+
+--*/
+
+{
+
+    ULONG EntriesRead;
+    ULONGLONG Offset;
+    PSTR PotentialName;
+    ULONG PotentialNameBufferSize;
+    ULONG PotentialNameSize;
+    KSTATUS Status;
+
+    Offset = DIRECTORY_CONTENTS_OFFSET;
+    PotentialName = NULL;
+
+    //
+    // Seek to the beginning of the directory.
+    //
+
+    Status = FatpDirectorySeek(Directory, Offset);
+    if (!KSUCCESS(Status)) {
+        goto ScanDirectoryForEntryEnd;
+    }
+
+    //
+    // Allocate a buffer for the name.
+    //
+
+    PotentialNameBufferSize = FAT_MAX_LONG_FILE_LENGTH + 1;
+    PotentialName = FatAllocatePagedMemory(Volume->Device.DeviceToken,
+                                           PotentialNameBufferSize);
+
+    if (PotentialName == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto ScanDirectoryForEntryEnd;
+    }
+
+    //
+    // Loop reading directory entries until a matching one is found or the end
+    // is reached.
+    //
+
+    while (TRUE) {
+        PotentialNameSize = PotentialNameBufferSize;
+        Status = FatpReadNextDirectoryEntry(Directory,
+                                            NULL,
+                                            PotentialName,
+                                            &PotentialNameSize,
+                                            Entry,
+                                            &EntriesRead);
+
+        if (!KSUCCESS(Status)) {
+            if (Status == STATUS_END_OF_FILE) {
+                Status = STATUS_PATH_NOT_FOUND;
+            }
+
+            break;
+        }
+
+        Offset += EntriesRead;
+        if (PotentialNameSize > NameLength) {
+            continue;
+        }
+
+        if (RtlAreStringsEqual(Name, PotentialName, NameLength - 1) != FALSE) {
+
+            ASSERT(Offset != 0);
+
+            *EntryOffset = Offset - 1;
+            break;
+        }
+    }
+
+    if ((KSUCCESS(Status)) || (Status == STATUS_PATH_NOT_FOUND)) {
+        if (Offset - DIRECTORY_CONTENTS_OFFSET >=
+            FAT_DIRECTORY_INDEX_THRESHOLD) {
+
+            FatpBuildDirectoryIndex(Directory);
+        }
+    }
+
+ScanDirectoryForEntryEnd:
+    if (PotentialName != NULL) {
+        FatFreePagedMemory(Volume->Device.DeviceToken, PotentialName);
+    }
+
+    return Status;
+}
+
+KSTATUS
+FatpFindFreeDirectoryEntries (
+    PFAT_DIRECTORY_CONTEXT Directory,
+    ULONG EntryCount,
+    PULONGLONG EntryOffset,
+    PBOOL WriteEndEntry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds room in a directory for a run of new entries: either
+    enough consecutive erased entries, or the end of the directory. On success
+    the directory is positioned at the returned offset.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory context.
+
+    EntryCount - Supplies the number of entries needed.
+
+    EntryOffset - Supplies a pointer where the offset of the first entry to
+        write will be returned.
+
+    WriteEndEntry - Supplies a pointer where a boolean will be returned
+        indicating whether the entries go at the end of the directory, in
+        which case a new end entry needs to be written after them.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_VOLUME_FULL if the FAT12/16 root directory has no room.
+
+    Other error codes on device I/O errors.
+
+--*/
+
+{
+
+    FAT_DIRECTORY_ENTRY DirectoryEntry;
+    ULONG EntriesRead;
+    ULONGLONG Offset;
+    ULONGLONG PotentialOffset;
+    ULONG SpanCount;
+    KSTATUS Status;
+
+    //
+    // A directory with an index already knows where its free entries are.
+    //
+
+    Status = FatpDirectoryIndexFindFreeEntries(Directory,
+                                               EntryCount,
+                                               EntryOffset,
+                                               WriteEndEntry);
+
+    if (Status != STATUS_NOT_FOUND) {
+        return Status;
+    }
+
+    //
+    // Reset to the beginning of the directory file.
+    //
+
+    Offset = DIRECTORY_CONTENTS_OFFSET;
+    Status = FatpDirectorySeek(Directory, Offset);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    //
+    // Look for either enough deleted entries or the ending entry.
+    //
+
+    *EntryOffset = -1;
+    PotentialOffset = -1;
+    SpanCount = 0;
+    *WriteEndEntry = FALSE;
+    while (TRUE) {
+        Status = FatpReadDirectory(Directory, &DirectoryEntry, 1, &EntriesRead);
+        if (Status == STATUS_END_OF_FILE) {
+            *WriteEndEntry = TRUE;
+            break;
+
+        } else if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        //
+        // If this is the root directory and the end of it was reached, there's
+        // no space in the root directory.
+        //
+
+        if (EntriesRead == 0) {
+            return STATUS_VOLUME_FULL;
+        }
+
+        ASSERT(EntriesRead == 1);
+
+        //
+        // If the end is found, use it.
+        //
+
+        if (DirectoryEntry.DosName[0] == FAT_DIRECTORY_ENTRY_END) {
+            *EntryOffset = Offset;
+            *WriteEndEntry = TRUE;
+            break;
+        }
+
+        //
+        // If an erased entry was found, that's also perfect.
+        //
+
+        if (DirectoryEntry.DosName[0] == FAT_DIRECTORY_ENTRY_ERASED) {
+            if (PotentialOffset == -1) {
+                PotentialOffset = Offset;
+                SpanCount = 1;
+
+            } else {
+                SpanCount += 1;
+            }
+
+            if (SpanCount >= EntryCount) {
+                *EntryOffset = PotentialOffset;
+                break;
+            }
+
+        //
+        // This is a regular entry, so it breaks the span.
+        //
+
+        } else {
+            PotentialOffset = -1;
+            SpanCount = 0;
+        }
+
+        Offset += 1;
+    }
+
+    //
+    // Seek either to the desired entry or to the end. If no entry was found,
+    // the file pointer must already be at the end, so there's no need to seek.
+    //
+
+    if (*EntryOffset != -1) {
+        Status = FatpDirectorySeek(Directory, *EntryOffset);
+        if (!KSUCCESS(Status)) {
+
+            ASSERT(Status != STATUS_END_OF_FILE);
+
+            return Status;
+        }
+
+    //
+    // If an entry offset is not set, then this better have reached the end of
+    // the file.
+    //
+
+    } else {
+
+        ASSERT(Status == STATUS_END_OF_FILE);
+
+        *EntryOffset = Offset;
+    }
+
+    return STATUS_SUCCESS;
+}
+
@@ -50,6 +50,54 @@ Module Name:
 #define BLOCK_ITERATIONS 10000
 #define BLOCK_SIZE 4096
 
+//
+// Define the parameters of the sequential write benchmark. The volume is
+// first fragmented by writing a set of small files and deleting every other
+// one, then a large file is written sequentially and read back.
+//
+
+#define BENCHMARK_IMAGE "testfatb.test"
+#define BENCHMARK_DISK_SIZE (128 * 1024 * 1024)
+#define BENCHMARK_FRAGMENT_FILE_COUNT 2048
+#define BENCHMARK_FRAGMENT_FILE_SIZE 4096
+#define BENCHMARK_DIRECTORY_NAME "bench"
+#define BENCHMARK_FILE_NAME "sequential.bin"
+#define BENCHMARK_FILE_SIZE (32 * 1024 * 1024)
+#define BENCHMARK_CHUNK_SIZE (64 * 1024)
+#define BENCHMARK_NAME_SIZE 32
+
+//
+// Define the parameters of the random seek test. Two files are written a
+// chunk at a time in alternation so that every chunk of each is its own run.
+//
+
+#define SEEK_IMAGE "testfats.test"
+#define SEEK_DISK_SIZE (64 * 1024 * 1024)
+#define SEEK_FILE_NAME "seeka.bin"
+#define SEEK_FILLER_NAME "seekb.bin"
+#define SEEK_CHUNK_SIZE 4096
+#define SEEK_CHUNK_COUNT 2048
+#define SEEK_ITERATIONS 50000
+
+//
+// Define the parameters of the large directory test. Enough files are created
+// in one directory that it gets a name index, then some are deleted, renamed,
+// and replaced.
+//
+
+#define DIRECTORY_IMAGE "testfatd.test"
+#define DIRECTORY_DISK_SIZE (64 * 1024 * 1024)
+#define DIRECTORY_NAME "large"
+#define DIRECTORY_FILE_COUNT 4096
+#define DIRECTORY_LOOKUP_ITERATIONS 20000
+
+//
+// This macro defines the contents of each word of a random seek test chunk.
+//
+
+#define SEEK_PATTERN(_Version, _Chunk, _Word) \
+    (((_Version) << 28) | ((_Chunk) << 10) | (_Word))
+
 #define USAGE_STRING    \
     "Testfat.exe will test the FAT file system implementation.\n\n" \
     "Usage: Testfat.exe [-v]\n\n" \
@@ -97,6 +145,46 @@ FormatDisk (
     PVOID *VolumeToken
     );
 
+BOOL
+TestSequentialWrite (
+    VOID
+    );
+
+BOOL
+TestRandomSeek (
+    VOID
+    );
+
+KSTATUS
+TransferSeekChunk (
+    PVOID FileToken,
+    BOOL Write,
+    ULONG Version,
+    ULONG Chunk,
+    PFAT_IO_BUFFER IoBuffer
+    );
+
+BOOL
+TestLargeDirectory (
+    VOID
+    );
+
+BOOL
+CheckLargeDirectory (
+    PVOID VolumeToken,
+    FILE_ID DirectoryId,
+    PFILE_ID FileIds
+    );
+
+KSTATUS
+CreateTestFile (
+    PVOID VolumeToken,
+    PFILE_PROPERTIES DirectoryProperties,
+    PSTR FileName,
+    IO_OBJECT_TYPE Type,
+    PFILE_PROPERTIES Properties
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -475,7 +563,30 @@ Return Value:
     }
 
     FatCloseFile(FileToken);
-    Result = TRUE;
+
+    //
+    // Time large sequential writes on a fragmented volume.
+    //
+
+    Result = TestSequentialWrite();
+    if (Result == FALSE) {
+        goto MainEnd;
+    }
+
+    //
+    // Time random seeks in a badly fragmented file.
+    //
+
+    Result = TestRandomSeek();
+    if (Result == FALSE) {
+        goto MainEnd;
+    }
+
+    //
+    // Time lookups and creates in a large directory.
+    //
+
+    Result = TestLargeDirectory();
 
 MainEnd:
     if (FileIoBuffer != NULL) {
@@ -571,6 +682,1117 @@ Return Value:
     return Status;
 }
 
+BOOL
+TestSequentialWrite (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine benchmarks large sequential writes. It fragments a fresh
+    volume by writing many small files and deleting every other one, then
+    times writing a large file in big chunks, and verifies its contents.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    TRUE on success.
+
+    FALSE on failure.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    PULONG ChunkBuffer;
+    ULONG ChunkCount;
+    ULONG ChunkIndex;
+    PFAT_IO_BUFFER ChunkIoBuffer;
+    clock_t Clock;
+    FILE_PROPERTIES DirectoryProperties;
+    FAT_SEEK_INFORMATION FatSeekInformation;
+    CHAR FileName[BENCHMARK_NAME_SIZE];
+    ULONG FileIndex;
+    PVOID FileToken;
+    ULONG FillIndex;
+    FILE *ImageFile;
+    FILE_PROPERTIES Properties;
+    BOOL Result;
+    double Seconds;
+    KSTATUS Status;
+    BOOL Unlinked;
+    PVOID VolumeToken;
+
+    ChunkIoBuffer = NULL;
+    FileToken = NULL;
+    Result = FALSE;
+    ImageFile = fopen(BENCHMARK_IMAGE, "wb+");
+    if (ImageFile == NULL) {
+        printf("Unable to open benchmark image \"%s\".\n", BENCHMARK_IMAGE);
+        return FALSE;
+    }
+
+    Status = FormatDisk(ImageFile,
+                        SECTOR_SIZE,
+                        BENCHMARK_DISK_SIZE / SECTOR_SIZE,
+                        &VolumeToken);
+
+    if (!KSUCCESS(Status)) {
+        goto TestSequentialWriteEnd;
+    }
+
+    RtlZeroMemory(&DirectoryProperties, sizeof(FILE_PROPERTIES));
+    Status = FatLookup(VolumeToken, TRUE, 0, NULL, 0, &DirectoryProperties);
+    if (!KSUCCESS(Status)) {
+        printf("Error: Could not look up root directory. Status = %d.\n",
+               Status);
+
+        goto TestSequentialWriteEnd;
+    }
+
+    //
+    // Work in a subdirectory, as the root directory may have a fixed size.
+    //
+
+    Status = CreateTestFile(VolumeToken,
+                            &DirectoryProperties,
+                            BENCHMARK_DIRECTORY_NAME,
+                            IoObjectRegularDirectory,
+                            &Properties);
+
+    if (!KSUCCESS(Status)) {
+        goto TestSequentialWriteEnd;
+    }
+
+    RtlCopyMemory(&DirectoryProperties, &Properties, sizeof(FILE_PROPERTIES));
+
+    ChunkIoBuffer = FatAllocateIoBuffer(NULL, BENCHMARK_CHUNK_SIZE);
+    if (ChunkIoBuffer == NULL) {
+        printf("Error: Unable to allocate chunk buffer.\n");
+        goto TestSequentialWriteEnd;
+    }
+
+    ChunkBuffer = FatMapIoBuffer(ChunkIoBuffer);
+    if (ChunkBuffer == NULL) {
+        printf("Error: Unable to map chunk buffer.\n");
+        goto TestSequentialWriteEnd;
+    }
+
+    //
+    // Fragment the free space.
+    //
+
+    VPRINT("Fragmenting volume with %d files.\n",
+           BENCHMARK_FRAGMENT_FILE_COUNT);
+
+    memset(ChunkBuffer, 0xAB, BENCHMARK_FRAGMENT_FILE_SIZE);
+    for (FileIndex = 0;
+         FileIndex < BENCHMARK_FRAGMENT_FILE_COUNT;
+         FileIndex += 1) {
+
+        snprintf(FileName, sizeof(FileName), "frag%d.txt", FileIndex);
+        Status = CreateTestFile(VolumeToken,
+                                &DirectoryProperties,
+                                FileName,
+                                IoObjectRegularFile,
+                                &Properties);
+
+        if (!KSUCCESS(Status)) {
+            goto TestSequentialWriteEnd;
+        }
+
+        Status = FatOpenFileId(VolumeToken,
+                               Properties.FileId,
+                               IO_ACCESS_READ | IO_ACCESS_WRITE,
+                               0,
+                               &FileToken);
+
+        if (!KSUCCESS(Status)) {
+            printf("Error: Unable to open %s. Status %d\n", FileName, Status);
+            goto TestSequentialWriteEnd;
+        }
+
+        RtlZeroMemory(&FatSeekInformation, sizeof(FAT_SEEK_INFORMATION));
+        Status = FatWriteFile(FileToken,
+                              &FatSeekInformation,
+                              ChunkIoBuffer,
+                              BENCHMARK_FRAGMENT_FILE_SIZE,
+                              0,
+                              NULL,
+                              &BytesCompleted);
+
+        FatCloseFile(FileToken);
+        FileToken = NULL;
+        if ((!KSUCCESS(Status)) ||
+            (BytesCompleted != BENCHMARK_FRAGMENT_FILE_SIZE)) {
+
+            printf("Error: Failed to write %s. Status %d.\n",
+                   FileName,
+                   Status);
+
+            goto TestSequentialWriteEnd;
+        }
+
+        if ((FileIndex & 0x1) != 0) {
+            continue;
+        }
+
+        Status = FatUnlink(VolumeToken,
+                           DirectoryProperties.FileId,
+                           FileName,
+                           strlen(FileName) + 1,
+                           Properties.FileId,
+                           &Unlinked);
+
+        if (KSUCCESS(Status)) {
+            Status = FatDeleteFileBlocks(VolumeToken,
+                                         NULL,
+                                         Properties.FileId,
+                                         0,
+                                         FALSE);
+        }
+
+        if (!KSUCCESS(Status)) {
+            printf("Error: Failed to delete %s. Status %d.\n",
+                   FileName,
+                   Status);
+
+            goto TestSequentialWriteEnd;
+        }
+    }
+
+    //
+    // Time the sequential write.
+    //
+
+    Status = CreateTestFile(VolumeToken,
+                            &DirectoryProperties,
+                            BENCHMARK_FILE_NAME,
+                            IoObjectRegularFile,
+                            &Properties);
+
+    if (!KSUCCESS(Status)) {
+        goto TestSequentialWriteEnd;
+    }
+
+    Status = FatOpenFileId(VolumeToken,
+                           Properties.FileId,
+                           IO_ACCESS_READ | IO_ACCESS_WRITE,
+                           0,
+                           &FileToken);
+
+    if (!KSUCCESS(Status)) {
+        printf("Error: Unable to open %s. Status %d\n",
+               BENCHMARK_FILE_NAME,
+               Status);
+
+        goto TestSequentialWriteEnd;
+    }
+
+    ChunkCount = BENCHMARK_FILE_SIZE / BENCHMARK_CHUNK_SIZE;
+    RtlZeroMemory(&FatSeekInformation, sizeof(FAT_SEEK_INFORMATION));
+    Clock = clock();
+    for (ChunkIndex = 0; ChunkIndex < ChunkCount; ChunkIndex += 1) {
+        for (FillIndex = 0;
+             FillIndex < (BENCHMARK_CHUNK_SIZE / sizeof(ULONG));
+             FillIndex += 1) {
+
+            ChunkBuffer[FillIndex] = (ChunkIndex << 16) | FillIndex;
+        }
+
+        Status = FatWriteFile(FileToken,
+                              &FatSeekInformation,
+                              ChunkIoBuffer,
+                              BENCHMARK_CHUNK_SIZE,
+                              0,
+                              NULL,
+                              &BytesCompleted);
+
+        if ((!KSUCCESS(Status)) || (BytesCompleted != BENCHMARK_CHUNK_SIZE)) {
+            printf("Error: Sequential write of chunk %d failed. Status %d.\n",
+                   ChunkIndex,
+                   Status);
+
+            goto TestSequentialWriteEnd;
+        }
+    }
+
+    Seconds = (double)(clock() - Clock) / CLOCKS_PER_SEC;
+    VPRINT("Wrote %dMB sequentially in %.3f seconds.\n",
+           BENCHMARK_FILE_SIZE / (1024 * 1024),
+           Seconds);
+
+    //
+    // Read it all back and make sure every chunk landed where it should.
+    //
+
+    Status = FatFileSeek(FileToken,
+                         NULL,
+                         0,
+                         SeekCommandFromBeginning,
+                         0,
+                         &FatSeekInformation);
+
+    if (!KSUCCESS(Status)) {
+        printf("Error: Could not seek to the beginning. Status %d.\n",
+               Status);
+
+        goto TestSequentialWriteEnd;
+    }
+
+    for (ChunkIndex = 0; ChunkIndex < ChunkCount; ChunkIndex += 1) {
+        Status = FatReadFile(FileToken,
+                             &FatSeekInformation,
+                             ChunkIoBuffer,
+                             BENCHMARK_CHUNK_SIZE,
+                             0,
+                             NULL,
+                             &BytesCompleted);
+
+        if ((!KSUCCESS(Status)) || (BytesCompleted != BENCHMARK_CHUNK_SIZE)) {
+            printf("Error: Sequential read of chunk %d failed. Status %d.\n",
+                   ChunkIndex,
+                   Status);
+
+            goto TestSequentialWriteEnd;
+        }
+
+        for (FillIndex = 0;
+             FillIndex < (BENCHMARK_CHUNK_SIZE / sizeof(ULONG));
+             FillIndex += 1) {
+
+            if (ChunkBuffer[FillIndex] != ((ChunkIndex << 16) | FillIndex)) {
+                printf("Error: Chunk %d offset %lu had %x instead of %x.\n",
+                       ChunkIndex,
+                       (long)FillIndex * sizeof(ULONG),
+                       ChunkBuffer[FillIndex],
+                       (ChunkIndex << 16) | FillIndex);
+
+                goto TestSequentialWriteEnd;
+            }
+        }
+    }
+
+    Result = TRUE;
+
+TestSequentialWriteEnd:
+    if (FileToken != NULL) {
+        FatCloseFile(FileToken);
+    }
+
+    if (ChunkIoBuffer != NULL) {
+        FatFreeIoBuffer(ChunkIoBuffer);
+    }
+
+    fclose(ImageFile);
+    remove(BENCHMARK_IMAGE);
+    return Result;
+}
+
+BOOL
+TestRandomSeek (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine benchmarks random seeks and reads in a file whose clusters
+    are all discontiguous, then truncates and regrows the file to make sure
+    stale cluster runs are not used afterwards.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    TRUE on success.
+
+    FALSE on failure.
+
+--*/
+
+{
+
+    ULONG Chunk;
+    PFAT_IO_BUFFER ChunkIoBuffer;
+    clock_t Clock;
+    FILE_PROPERTIES DirectoryProperties;
+    PVOID FileToken;
+    PVOID FillerToken;
+    FILE *ImageFile;
+    ULONG Iteration;
+    FILE_PROPERTIES Properties;
+    BOOL Result;
+    double Seconds;
+    KSTATUS Status;
+    ULONG Version;
+    PVOID VolumeToken;
+
+    ChunkIoBuffer = NULL;
+    FileToken = NULL;
+    FillerToken = NULL;
+    Result = FALSE;
+    ImageFile = fopen(SEEK_IMAGE, "wb+");
+    if (ImageFile == NULL) {
+        printf("Unable to open seek image \"%s\".\n", SEEK_IMAGE);
+        return FALSE;
+    }
+
+    Status = FormatDisk(ImageFile,
+                        SECTOR_SIZE,
+                        SEEK_DISK_SIZE / SECTOR_SIZE,
+                        &VolumeToken);
+
+    if (!KSUCCESS(Status)) {
+        goto TestRandomSeekEnd;
+    }
+
+    RtlZeroMemory(&DirectoryProperties, sizeof(FILE_PROPERTIES));
+    Status = FatLookup(VolumeToken, TRUE, 0, NULL, 0, &DirectoryProperties);
+    if (!KSUCCESS(Status)) {
+        printf("Error: Could not look up root directory. Status = %d.\n",
+               Status);
+
+        goto TestRandomSeekEnd;
+    }
+
+    Status = CreateTestFile(VolumeToken,
+                            &DirectoryProperties,
+                            SEEK_FILLER_NAME,
+                            IoObjectRegularFile,
+                            &Properties);
+
+    if (!KSUCCESS(Status)) {
+        goto TestRandomSeekEnd;
+    }
+
+    Status = FatOpenFileId(VolumeToken,
+                           Properties.FileId,
+                           IO_ACCESS_READ | IO_ACCESS_WRITE,
+                           0,
+                           &FillerToken);
+
+    if (!KSUCCESS(Status)) {
+        printf("Error: Unable to open %s. Status %d\n",
+               SEEK_FILLER_NAME,
+               Status);
+
+        goto TestRandomSeekEnd;
+    }
+
+    Status = CreateTestFile(VolumeToken,
+                            &DirectoryProperties,
+                            SEEK_FILE_NAME,
+                            IoObjectRegularFile,
+                            &Properties);
+
+    if (!KSUCCESS(Status)) {
+        goto TestRandomSeekEnd;
+    }
+
+    Status = FatOpenFileId(VolumeToken,
+                           Properties.FileId,
+                           IO_ACCESS_READ | IO_ACCESS_WRITE,
+                           0,
+                           &FileToken);
+
+    if (!KSUCCESS(Status)) {
+        printf("Error: Unable to open %s. Status %d\n",
+               SEEK_FILE_NAME,
+               Status);
+
+        goto TestRandomSeekEnd;
+    }
+
+    ChunkIoBuffer = FatAllocateIoBuffer(NULL, SEEK_CHUNK_SIZE);
+    if (ChunkIoBuffer == NULL) {
+        printf("Error: Unable to allocate chunk buffer.\n");
+        goto TestRandomSeekEnd;
+    }
+
+    //
+    // Write the two files in alternation so neither has any contiguous
+    // clusters.
+    //
+
+    for (Chunk = 0; Chunk < SEEK_CHUNK_COUNT; Chunk += 1) {
+        Status = TransferSeekChunk(FileToken, TRUE, 1, Chunk, ChunkIoBuffer);
+        if (KSUCCESS(Status)) {
+            Status = TransferSeekChunk(FillerToken,
+                                       TRUE,
+                                       1,
+                                       Chunk,
+                                       ChunkIoBuffer);
+        }
+
+        if (!KSUCCESS(Status)) {
+            goto TestRandomSeekEnd;
+        }
+    }
+
+    //
+    // Time random seeks and reads.
+    //
+
+    Clock = clock();
+    for (Iteration = 0; Iteration < SEEK_ITERATIONS; Iteration += 1) {
+        Chunk = rand() % SEEK_CHUNK_COUNT;
+        Status = TransferSeekChunk(FileToken, FALSE, 1, Chunk, ChunkIoBuffer);
+        if (!KSUCCESS(Status)) {
+            goto TestRandomSeekEnd;
+        }
+    }
+
+    Seconds = (double)(clock() - Clock) / CLOCKS_PER_SEC;
+    VPRINT("Did %d random seeks and reads in %.3f seconds.\n",
+           SEEK_ITERATIONS,
+           Seconds);
+
+    //
+    // Truncate the file to half its size without going through the open
+    // file, then grow it back with new contents.
+    //
+
+    Status = FatDeleteFileBlocks(VolumeToken,
+                                 NULL,
+                                 Properties.FileId,
+                                 (SEEK_CHUNK_COUNT / 2) * SEEK_CHUNK_SIZE,
+                                 TRUE);
+
+    if (!KSUCCESS(Status)) {
+        printf("Error: Failed to truncate %s. Status %d.\n",
+               SEEK_FILE_NAME,
+               Status);
+
+        goto TestRandomSeekEnd;
+    }
+
+    for (Chunk = SEEK_CHUNK_COUNT / 2; Chunk < SEEK_CHUNK_COUNT; Chunk += 1) {
+        Status = TransferSeekChunk(FillerToken,
+                                   TRUE,
+                                   2,
+                                   Chunk + SEEK_CHUNK_COUNT,
+                                   ChunkIoBuffer);
+
+        if (KSUCCESS(Status)) {
+            Status = TransferSeekChunk(FileToken,
+                                       TRUE,
+                                       2,
+                                       Chunk,
+                                       ChunkIoBuffer);
+        }
+
+        if (!KSUCCESS(Status)) {
+            goto TestRandomSeekEnd;
+        }
+    }
+
+    for (Iteration = 0; Iteration < SEEK_ITERATIONS; Iteration += 1) {
+        Chunk = rand() % SEEK_CHUNK_COUNT;
+        Version = 1;
+        if (Chunk >= SEEK_CHUNK_COUNT / 2) {
+            Version = 2;
+        }
+
+        Status = TransferSeekChunk(FileToken,
+                                   FALSE,
+                                   Version,
+                                   Chunk,
+                                   ChunkIoBuffer);
+
+        if (!KSUCCESS(Status)) {
+            goto TestRandomSeekEnd;
+        }
+    }
+
+    Result = TRUE;
+
+TestRandomSeekEnd:
+    if (FileToken != NULL) {
+        FatCloseFile(FileToken);
+    }
+
+    if (FillerToken != NULL) {
+        FatCloseFile(FillerToken);
+    }
+
+    if (ChunkIoBuffer != NULL) {
+        FatFreeIoBuffer(ChunkIoBuffer);
+    }
+
+    fclose(ImageFile);
+    remove(SEEK_IMAGE);
+    return Result;
+}
+
+KSTATUS
+TransferSeekChunk (
+    PVOID FileToken,
+    BOOL Write,
+    ULONG Version,
+    ULONG Chunk,
+    PFAT_IO_BUFFER IoBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine seeks to the given chunk of a random seek test file and
+    either writes its pattern or reads it and verifies the pattern.
+
+Arguments:
+
+    FileToken - Supplies the open file.
+
+    Write - Supplies a boolean indicating whether to write the chunk (TRUE)
+        or read and verify it (FALSE).
+
+    Version - Supplies the version of the contents expected in the chunk.
+
+    Chunk - Supplies the index of the chunk.
+
+    IoBuffer - Supplies a chunk sized buffer to use.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PULONG Buffer;
+    UINTN BytesCompleted;
+    FAT_SEEK_INFORMATION FatSeekInformation;
+    ULONG Index;
+    KSTATUS Status;
+
+    Buffer = FatMapIoBuffer(IoBuffer);
+    RtlZeroMemory(&FatSeekInformation, sizeof(FAT_SEEK_INFORMATION));
+    Status = FatFileSeek(FileToken,
+                         NULL,
+                         0,
+                         SeekCommandFromBeginning,
+                         (ULONGLONG)Chunk * SEEK_CHUNK_SIZE,
+                         &FatSeekInformation);
+
+    if ((!KSUCCESS(Status)) &&
+        ((Write == FALSE) || (Status != STATUS_END_OF_FILE))) {
+
+        printf("Error: Failed to seek to chunk %d. Status %d.\n",
+               Chunk,
+               Status);
+
+        return Status;
+    }
+
+    if (Write != FALSE) {
+        for (Index = 0; Index < SEEK_CHUNK_SIZE / sizeof(ULONG); Index += 1) {
+            Buffer[Index] = SEEK_PATTERN(Version, Chunk, Index);
+        }
+
+        Status = FatWriteFile(FileToken,
+                              &FatSeekInformation,
+                              IoBuffer,
+                              SEEK_CHUNK_SIZE,
+                              0,
+                              NULL,
+                              &BytesCompleted);
+
+    } else {
+        Status = FatReadFile(FileToken,
+                             &FatSeekInformation,
+                             IoBuffer,
+                             SEEK_CHUNK_SIZE,
+                             0,
+                             NULL,
+                             &BytesCompleted);
+    }
+
+    if ((!KSUCCESS(Status)) || (BytesCompleted != SEEK_CHUNK_SIZE)) {
+        printf("Error: Failed to transfer chunk %d. Status %d.\n",
+               Chunk,
+               Status);
+
+        if (KSUCCESS(Status)) {
+            Status = STATUS_DATA_LENGTH_MISMATCH;
+        }
+
+        return Status;
+    }
+
+    if (Write == FALSE) {
+        for (Index = 0; Index < SEEK_CHUNK_SIZE / sizeof(ULONG); Index += 1) {
+            if (Buffer[Index] != SEEK_PATTERN(Version, Chunk, Index)) {
+                printf("Error: Chunk %d word %d had %x instead of %x.\n",
+                       Chunk,
+                       Index,
+                       Buffer[Index],
+                       SEEK_PATTERN(Version, Chunk, Index));
+
+                return STATUS_FILE_CORRUPT;
+            }
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+BOOL
+TestLargeDirectory (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills one directory with enough files that it gets a name
+    index, and times creates and lookups in it. It then deletes, renames, and
+    replaces files, and checks that every name reads back correctly both
+    through the index and after a remount, which starts without one.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    TRUE on success.
+
+    FALSE on failure.
+
+--*/
+
+{
+
+    BLOCK_DEVICE_PARAMETERS BlockParameters;
+    clock_t Clock;
+    BOOL Created;
+    FILE_ID DirectoryId;
+    ULONGLONG DirectorySize;
+    FILE_PROPERTIES DirectoryProperties;
+    BOOL Erased;
+    PFILE_ID FileIds;
+    ULONG FileIndex;
+    CHAR FileName[BENCHMARK_NAME_SIZE];
+    FILE *ImageFile;
+    ULONG Iteration;
+    CHAR NewName[BENCHMARK_NAME_SIZE];
+    FILE_PROPERTIES Properties;
+    BOOL Result;
+    double Seconds;
+    KSTATUS Status;
+    BOOL Unlinked;
+    PVOID VolumeToken;
+
+    FileIds = NULL;
+    Result = FALSE;
+    ImageFile = fopen(DIRECTORY_IMAGE, "wb+");
+    if (ImageFile == NULL) {
+        printf("Unable to open directory image \"%s\".\n", DIRECTORY_IMAGE);
+        return FALSE;
+    }
+
+    Status = FormatDisk(ImageFile,
+                        SECTOR_SIZE,
+                        DIRECTORY_DISK_SIZE / SECTOR_SIZE,
+                        &VolumeToken);
+
+    if (!KSUCCESS(Status)) {
+        goto TestLargeDirectoryEnd;
+    }
+
+    FileIds = malloc(sizeof(FILE_ID) * DIRECTORY_FILE_COUNT);
+    if (FileIds == NULL) {
+        printf("Error: Unable to allocate file ID array.\n");
+        goto TestLargeDirectoryEnd;
+    }
+
+    RtlZeroMemory(&DirectoryProperties, sizeof(FILE_PROPERTIES));
+    Status = FatLookup(VolumeToken, TRUE, 0, NULL, 0, &DirectoryProperties);
+    if (!KSUCCESS(Status)) {
+        printf("Error: Could not look up root directory. Status = %d.\n",
+               Status);
+
+        goto TestLargeDirectoryEnd;
+    }
+
+    Status = CreateTestFile(VolumeToken,
+                            &DirectoryProperties,
+                            DIRECTORY_NAME,
+                            IoObjectRegularDirectory,
+                            &Properties);
+
+    if (!KSUCCESS(Status)) {
+        goto TestLargeDirectoryEnd;
+    }
+
+    RtlCopyMemory(&DirectoryProperties, &Properties, sizeof(FILE_PROPERTIES));
+    DirectoryId = DirectoryProperties.FileId;
+
+    //
+    // Time filling the directory. Each create first looks for the name, then
+    // for free entries.
+    //
+
+    Clock = clock();
+    for (FileIndex = 0; FileIndex < DIRECTORY_FILE_COUNT; FileIndex += 1) {
+        snprintf(FileName, sizeof(FileName), "file%05d.txt", FileIndex);
+        Status = CreateTestFile(VolumeToken,
+                                &DirectoryProperties,
+                                FileName,
+                                IoObjectRegularFile,
+                                &Properties);
+
+        if (!KSUCCESS(Status)) {
+            goto TestLargeDirectoryEnd;
+        }
+
+        FileIds[FileIndex] = Properties.FileId;
+    }
+
+    Seconds = (double)(clock() - Clock) / CLOCKS_PER_SEC;
+    VPRINT("Created %d files in one directory in %.3f seconds.\n",
+           DIRECTORY_FILE_COUNT,
+           Seconds);
+
+    //
+    // Time random lookups.
+    //
+
+    Clock = clock();
+    for (Iteration = 0;
+         Iteration < DIRECTORY_LOOKUP_ITERATIONS;
+         Iteration += 1) {
+
+        FileIndex = rand() % DIRECTORY_FILE_COUNT;
+        snprintf(FileName, sizeof(FileName), "file%05d.txt", FileIndex);
+        Status = FatLookup(VolumeToken,
+                           FALSE,
+                           DirectoryId,
+                           FileName,
+                           strlen(FileName) + 1,
+                           &Properties);
+
+        if ((!KSUCCESS(Status)) ||
+            (Properties.FileId != FileIds[FileIndex])) {
+
+            printf("Error: Lookup of %s failed. Status %d.\n",
+                   FileName,
+                   Status);
+
+            goto TestLargeDirectoryEnd;
+        }
+    }
+
+    Seconds = (double)(clock() - Clock) / CLOCKS_PER_SEC;
+    VPRINT("Did %d random lookups in %.3f seconds.\n",
+           DIRECTORY_LOOKUP_ITERATIONS,
+           Seconds);
+
+    //
+    // Creating a name that is already there must fail.
+    //
+
+    snprintf(FileName,
+             sizeof(FileName),
+             "file%05d.txt",
+             DIRECTORY_FILE_COUNT / 2);
+
+    RtlZeroMemory(&Properties, sizeof(FILE_PROPERTIES));
+    Properties.Type = IoObjectRegularFile;
+    Status = FatCreate(VolumeToken,
+                       DirectoryId,
+                       FileName,
+                       strlen(FileName) + 1,
+                       &DirectorySize,
+                       &Properties);
+
+    if (Status != STATUS_FILE_EXISTS) {
+        printf("Error: Creating duplicate %s returned %d.\n",
+               FileName,
+               Status);
+
+        goto TestLargeDirectoryEnd;
+    }
+
+    //
+    // Delete every third file and rename the one after it.
+    //
+
+    for (FileIndex = 0; FileIndex < DIRECTORY_FILE_COUNT; FileIndex += 1) {
+        snprintf(FileName, sizeof(FileName), "file%05d.txt", FileIndex);
+        if ((FileIndex % 3) == 0) {
+            Status = FatUnlink(VolumeToken,
+                               DirectoryId,
+                               FileName,
+                               strlen(FileName) + 1,
+                               FileIds[FileIndex],
+                               &Unlinked);
+
+            if (KSUCCESS(Status)) {
+                Status = FatDeleteFileBlocks(VolumeToken,
+                                             NULL,
+                                             FileIds[FileIndex],
+                                             0,
+                                             FALSE);
+            }
+
+        } else if ((FileIndex % 3) == 1) {
+            snprintf(NewName, sizeof(NewName), "moved%05d.txt", FileIndex);
+            Status = FatRename(VolumeToken,
+                               DirectoryId,
+                               FileIds[FileIndex],
+                               &Erased,
+                               DirectoryId,
+                               &Created,
+                               &DirectorySize,
+                               NewName,
+                               strlen(NewName) + 1);
+
+            if ((KSUCCESS(Status)) &&
+                (DirectorySize > DirectoryProperties.Size)) {
+
+                DirectoryProperties.Size = DirectorySize;
+                FatWriteFileProperties(VolumeToken, &DirectoryProperties, 0);
+            }
+
+        } else {
+            continue;
+        }
+
+        if (!KSUCCESS(Status)) {
+            printf("Error: Failed to delete or rename %s. Status %d.\n",
+                   FileName,
+                   Status);
+
+            goto TestLargeDirectoryEnd;
+        }
+    }
+
+    //
+    // Fill the holes back in with new files.
+    //
+
+    for (FileIndex = 0; FileIndex < DIRECTORY_FILE_COUNT; FileIndex += 3) {
+        snprintf(FileName, sizeof(FileName), "new%05d.txt", FileIndex);
+        Status = CreateTestFile(VolumeToken,
+                                &DirectoryProperties,
+                                FileName,
+                                IoObjectRegularFile,
+                                &Properties);
+
+        if (!KSUCCESS(Status)) {
+            goto TestLargeDirectoryEnd;
+        }
+
+        FileIds[FileIndex] = Properties.FileId;
+    }
+
+    if (CheckLargeDirectory(VolumeToken, DirectoryId, FileIds) == FALSE) {
+        goto TestLargeDirectoryEnd;
+    }
+
+    //
+    // Remount the volume and check again without the index.
+    //
+
+    FatUnmount(VolumeToken);
+    RtlZeroMemory(&BlockParameters, sizeof(BLOCK_DEVICE_PARAMETERS));
+    BlockParameters.DeviceToken = ImageFile;
+    BlockParameters.BlockSize = SECTOR_SIZE;
+    BlockParameters.BlockCount = DIRECTORY_DISK_SIZE / SECTOR_SIZE;
+    Status = FatMount(&BlockParameters, 0, &VolumeToken);
+    if (!KSUCCESS(Status)) {
+        printf("Error: Unable to remount image. Status %d.\n", Status);
+        goto TestLargeDirectoryEnd;
+    }
+
+    if (CheckLargeDirectory(VolumeToken, DirectoryId, FileIds) == FALSE) {
+        goto TestLargeDirectoryEnd;
+    }
+
+    Result = TRUE;
+
+TestLargeDirectoryEnd:
+    if (FileIds != NULL) {
+        free(FileIds);
+    }
+
+    fclose(ImageFile);
+    remove(DIRECTORY_IMAGE);
+    return Result;
+}
+
+BOOL
+CheckLargeDirectory (
+    PVOID VolumeToken,
+    FILE_ID DirectoryId,
+    PFILE_ID FileIds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine checks the contents of the large directory test directory
+    after files have been deleted, renamed, and replaced.
+
+Arguments:
+
+    VolumeToken - Supplies the token identifying the volume.
+
+    DirectoryId - Supplies the file ID of the directory.
+
+    FileIds - Supplies the array of expected file IDs.
+
+Return Value:
+
+    TRUE if every name that should be there is, and every name that should
+    not be is not.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    ULONG FileIndex;
+    CHAR GoneName[BENCHMARK_NAME_SIZE];
+    CHAR Name[BENCHMARK_NAME_SIZE];
+    FILE_PROPERTIES Properties;
+    KSTATUS Status;
+
+    for (FileIndex = 0; FileIndex < DIRECTORY_FILE_COUNT; FileIndex += 1) {
+        if ((FileIndex % 3) == 0) {
+            snprintf(Name, sizeof(Name), "new%05d.txt", FileIndex);
+            snprintf(GoneName, sizeof(GoneName), "file%05d.txt", FileIndex);
+
+        } else if ((FileIndex % 3) == 1) {
+            snprintf(Name, sizeof(Name), "moved%05d.txt", FileIndex);
+            snprintf(GoneName, sizeof(GoneName), "file%05d.txt", FileIndex);
+
+        } else {
+            snprintf(Name, sizeof(Name), "file%05d.txt", FileIndex);
+            snprintf(GoneName, sizeof(GoneName), "moved%05d.txt", FileIndex);
+        }
+
+        Status = FatLookup(VolumeToken,
+                           FALSE,
+                           DirectoryId,
+                           Name,
+                           strlen(Name) + 1,
+                           &Properties);
+
+        if ((!KSUCCESS(Status)) || (Properties.FileId != FileIds[FileIndex])) {
+            printf("Error: Lookup of %s failed. Status %d.\n", Name, Status);
+            return FALSE;
+        }
+
+        Status = FatLookup(VolumeToken,
+                           FALSE,
+                           DirectoryId,
+                           GoneName,
+                           strlen(GoneName) + 1,
+                           &Properties);
+
+        if (Status != STATUS_PATH_NOT_FOUND) {
+            printf("Error: Lookup of removed %s returned %d.\n",
+                   GoneName,
+                   Status);
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+KSTATUS
+CreateTestFile (
+    PVOID VolumeToken,
+    PFILE_PROPERTIES DirectoryProperties,
+    PSTR FileName,
+    IO_OBJECT_TYPE Type,
+    PFILE_PROPERTIES Properties
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates an empty file or directory in the given directory.
+
+Arguments:
+
+    VolumeToken - Supplies the token identifying the volume.
+
+    DirectoryProperties - Supplies a pointer to the properties of the
+        directory to create the file in. The size is updated if the directory
+        grew.
+
+    FileName - Supplies a pointer to the null terminated name of the file.
+
+    Type - Supplies the type of object to create.
+
+    Properties - Supplies a pointer where the new file's properties will be
+        returned.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONGLONG NewDirectorySize;
+    KSTATUS Status;
+
+    RtlZeroMemory(Properties, sizeof(FILE_PROPERTIES));
+    Properties->Type = Type;
+    Properties->Permissions = FILE_PERMISSION_USER_READ |
+                              FILE_PERMISSION_USER_WRITE;
+
+    if (Type == IoObjectRegularDirectory) {
+        Properties->Permissions |= FILE_PERMISSION_USER_EXECUTE;
+    }
+
+    Properties->HardLinkCount = 1;
+    Status = FatCreate(VolumeToken,
+                       DirectoryProperties->FileId,
+                       FileName,
+                       strlen(FileName) + 1,
+                       &NewDirectorySize,
+                       Properties);
+
+    if (!KSUCCESS(Status)) {
+        printf("Error: Unable to create file %s. Status %d.\n",
+               FileName,
+               Status);
+
+        return Status;
+    }
+
+    if (NewDirectorySize > DirectoryProperties->Size) {
+        DirectoryProperties->Size = NewDirectorySize;
+        FatWriteFileProperties(VolumeToken, DirectoryProperties, 0);
+    }
+
+    return STATUS_SUCCESS;
+}
+
 VOID
 KdPrintWithArgumentList (
     PCSTR Format,
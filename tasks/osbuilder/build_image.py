@@ -43,6 +43,8 @@ except ImportError:
 SYSTEM_BIN = [
     'debug',
     'efiboot',
+    'iostat',
+    'iotrace',
     'mount',
     'umount',
     'msetup',